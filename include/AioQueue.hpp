@@ -0,0 +1,68 @@
+/*
+ * AioQueue.hpp
+ *
+ * A thin wrapper around one Linux native AIO context (io_setup, io_submit,
+ * io_getevents), called through syscall() so no libaio is needed on the
+ * target. Writes are queued with queue(), handed to the kernel together with
+ * submit() and reaped in batches with reap(). The kernel only completes writes
+ * asynchronously on O_DIRECT files, buffered ones are written inside io_submit.
+ * The in-flight high-water mark, the writes per submit and the
+ * submit-to-completion latency are recorded.
+ */
+
+#pragma once
+
+#include "LatencyHistogram.hpp"
+#include <linux/aio_abi.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+/* One finished write, result is the byte count or a negative errno */
+struct AioCompletion {
+    uint64_t cookie;
+    int64_t result;
+    uint64_t latencyUs;
+};
+
+class AioQueue {
+
+    public:
+        AioQueue();
+        ~AioQueue();
+
+        bool open(uint32_t depth);
+        void close();
+
+        bool queue(int fd, const void *data, size_t size, uint64_t offset, uint64_t cookie);
+        int submit();
+        int reap(std::vector<AioCompletion>& completions, uint32_t minimum, uint64_t timeoutNs);
+
+        uint32_t getDepth() const;
+        uint32_t getInFlight() const;
+        uint32_t getQueued() const;
+        uint32_t getFree() const;
+        uint32_t getInFlightHighWater() const;
+        double getMeanBatch() const;
+        const LatencyHistogram& getLatency() const;
+
+    private:
+        struct Slot {
+            struct iocb cb;
+            uint64_t cookie;
+            uint64_t submitted;     // steady clock ns
+        };
+
+        aio_context_t _context;
+        std::vector<Slot> _slots;
+        std::vector<uint32_t> _free;        // slots neither queued nor in flight
+        std::vector<struct iocb*> _queued;  // prepared, not yet submitted
+        std::vector<struct io_event> _events;
+        std::vector<AioCompletion> _refused; // failed by io_submit, reported by the next reap
+        std::atomic<uint32_t> _inFlight;
+        uint32_t _inFlightHighWater;
+        uint64_t _submits;
+        uint64_t _submitted;
+        LatencyHistogram _latency;
+};
@@ -0,0 +1,51 @@
+/*
+ * AllocCounters.hpp
+ *
+ * Per-thread hot path counters of the ALLOC_COUNTERS build (make
+ * ALLOC_COUNTERS=1). That build replaces the global operator new and delete
+ * with versions counting every allocation of the calling thread, and a
+ * thread's syscalls and context switches are read from /proc/thread-self/io
+ * and getrusage. A thread starts its AllocCounters once warmed up, counts each
+ * frame it handles and logs report() at the end, so the allocations and
+ * syscalls each frame costs in steady state are known. In a normal build
+ * isEnabled() is false and nothing is counted.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+class AllocCounters {
+
+    public:
+        AllocCounters();
+
+        static bool isEnabled();
+
+        void start();
+        void count() {
+            _frames++;
+        }
+        bool isStarted() const {
+            return _started;
+        }
+
+        std::string report() const;
+
+    private:
+        /* The calling thread's totals so far */
+        struct Sample {
+            uint64_t allocations;
+            uint64_t bytes;
+            uint64_t reads;         // read-like syscalls, syscr
+            uint64_t writes;        // write-like syscalls, syscw
+            uint64_t switches;      // voluntary and involuntary context switches
+        };
+
+        static Sample sample();
+
+        bool _started;
+        uint64_t _frames;
+        Sample _start;
+};
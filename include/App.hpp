@@ -9,7 +9,7 @@
 
 #pragma once
 
-#include <string>
+#include <atomic>
 
 class Options;
 
@@ -23,8 +23,12 @@ class App {
 
     private:
         static void signalCallback(int signum);
-        static std::string getAvailableDevice();
+        static void pauseCallback(int signum);
+        static void triggerCallback(int signum);
 
         Options *_options;
-        static bool _doRun;
+        static std::atomic<bool> _doRun;
+        static std::atomic<bool> _togglePause;
+        static std::atomic<bool> _trigger;
+        static int _eventFd;
 };
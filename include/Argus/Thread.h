@@ -57,7 +57,7 @@ public:
     bool shutdown();
 
     /**
-     * Wait until the thread is in 'running' state
+     * Wait until the thread is in 'running' state, returns false early if it failed or finished
      *
      * @param timeout [in] timeout in us
      */
@@ -94,7 +94,10 @@ private:
         THREAD_DONE,            ///< execution done
     };
     Ordered<ThreadState> m_threadState;
+    pthread_mutex_t m_stateMutex;   ///< guards state changes signalled on m_stateChanged
+    pthread_cond_t m_stateChanged;  ///< broadcast on every state change, on the monotonic clock
 
+    void setState(ThreadState state);
     bool threadFunction();
 
     static void *threadFunctionStub(void *dataPtr);
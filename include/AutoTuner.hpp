@@ -0,0 +1,121 @@
+/*
+ * AutoTuner.hpp
+ *
+ * StreamBench --autotune: searches the pipeline settings for the highest frame
+ * rate the board records without dropping a frame and writes the winner as a
+ * config file StreamCapture loads with --config. Each trial is a child
+ * process, a StreamBench run of the synthetic sources or, with --live, a
+ * StreamCapture run of the cameras, given the capture options passed after
+ * "--", the candidate settings and a frame rate for --trial-time seconds. A
+ * trial sustains its rate when the child exits cleanly, no frame was dropped
+ * and the writers kept up with at least TUNE_MARGIN of the frames offered,
+ * live the rate divided by each camera's save every. Live rates stop at the
+ * sensor mode's highest, a faster --frame-rate would only run at that one. A trial over --memory-budget fails at
+ * startup like any other, so the budget bounds the search.
+ *
+ * The defaults are measured first, doubling the rate until a trial drops
+ * frames and bisecting between the last rate sustained and the first that was
+ * not. Then the settings are tried one at a time, each value on top of the
+ * best found so far: a value is kept only when it sustains TUNE_STEP more than
+ * the best, then raised the same way, so ties go to the default and to the
+ * smaller rings and queues. Settings passed after "--" are left alone. With
+ * JPEG the quality is raised last for as long as the best rate still holds.
+ *
+ * Every trial is appended to autotune.csv and the children's output to
+ * autotune.log, both next to the config file. The trials' run directories are
+ * removed once read. SIGINT stops the search and writes the best found so far.
+ *
+ * File format:
+ *     autotune.csv: trial,fps,saved_fps,dropped,sustained,settings
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define TUNE_TRIAL_TIME 20          // seconds of each trial unless --trial-time
+#define TUNE_GRACE_S 30             // startup and shutdown a trial may take past its time before it is stopped
+#define TUNE_KILL_S 10              // then before it is killed
+#define TUNE_MARGIN 0.97            // share of the offered frames the writers must keep up with
+#define TUNE_STEP 1.05              // a value must sustain this much more than the best to be kept
+#define TUNE_BISECT_STEPS 4         // refinements between a rate sustained and one that was not
+#define TUNE_MAX_FPS 240.0          // highest rate tried per synthetic camera
+#define TUNE_POLL_MS 100            // between checks of a running trial
+
+class Logger;
+
+/* What StreamBench passes on to the tuner */
+struct TuneSettings {
+    std::string config;                     // file the winner is written to
+    bool live;                              // trials run StreamCapture on the cameras
+    int trialTime;
+    double fps;                             // rate the search starts from
+    uint32_t numCameras;                    // synthetic cameras, the live cameras are counted from status.json
+    std::string workload;                   // for the config file's comment
+    std::vector<std::string> benchArgs;     // synthetic trials: the bench options of this run
+    std::vector<std::string> fixedArgs;     // the capture options after "--"
+};
+
+class AutoTuner {
+
+    public:
+        AutoTuner(const TuneSettings& settings, Logger *logger, const std::atomic<bool> *doRun);
+        ~AutoTuner();
+
+        bool run();
+        const std::string& getError() const;
+
+    private:
+        /* Options given to a trial, a flag has an empty value */
+        typedef std::vector<std::pair<std::string, std::string> > Choice;
+
+        /* One setting searched and the values tried besides its default */
+        struct Setting {
+            std::string name;
+            std::vector<Choice> values;
+        };
+
+        /* What one trial achieved */
+        struct Trial {
+            bool valid;             // the options parsed, the child ran
+            bool sustained;
+            double savedFps;        // per camera
+            uint64_t dropped;
+        };
+
+        static std::string describe(const Choice& choice);
+        static std::vector<char*> toArgv(std::vector<std::string>& args);
+        static bool readMetrics(const std::string& filename, double& writeFps, uint64_t& dropped);
+        static bool readStatus(const std::string& filename, double& fps, uint64_t& dropped, uint32_t& cameras);
+        static bool removeTree(const std::string& path);
+
+        void addSettings(bool jpeg);
+        bool isFixed(const std::string& name) const;
+        bool isValid(const Choice& choice, double fps);
+        bool runTrial(const Choice& choice, double fps, Trial& trial);
+        bool sustains(const Choice& choice, double fps);
+        double climb(const Choice& choice, double pass, double fail);
+        bool writeConfig();
+
+        TuneSettings _settings;
+        Logger *_logger;
+        const std::atomic<bool> *_doRun;
+        std::string _directory;     // of the config file, for autotune.csv and autotune.log
+        std::string _exe;           // run by the trials
+        std::vector<std::string> _outputs;  // run directories a trial writes, one per volume
+        std::vector<Setting> _searched;
+        Choice _best;
+        double _bestFps;
+        double _maxFps;             // highest rate tried per camera
+        bool _jpeg;
+        FILE *_trials;
+        int _log;
+        uint32_t _trial;
+        uint64_t _stamp;            // tells this search's run directories apart
+        std::string _error;
+};
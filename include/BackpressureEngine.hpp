@@ -0,0 +1,87 @@
+/*
+ * BackpressureEngine.hpp
+ *
+ * Degrades the recording in explicit, logged steps when storage or the
+ * encoder can't keep up, instead of letting frames vanish inside Argus or
+ * the run stop on a full queue. Each consumer reports its backlog occupancy,
+ * the share of its ring and write buffers still waiting downstream, for
+ * every acquired frame. Occupancy held above the high mark for a while moves
+ * the camera one level up a ladder, held below the low mark for longer moves
+ * it one level down. The ladder first lowers the camera's JPEG quality passed
+ * to encodeFromFd, then doubles the camera's effective save every, depending on
+ * the enabled actions. With the sets action every camera keeps the same
+ * frames, thinned by the highest level of any camera, so frame sets are
+ * dropped whole rather than left with holes. A floor set from outside, by the
+ * CapacityForecast as the volumes fill, holds every camera at least at that
+ * level whatever its backlog.
+ *
+ * Every level change is appended to backpressure.csv in the root directory.
+ * File format: elapsed_ms,camera,frame,timestamp,index,level,quality_drop,save_every,occupancy
+ * where frame and timestamp are the sensor frame number and time the change
+ * was decided at and index the next image index the camera saves.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+#define BACKPRESSURE_QUALITY 1U     // lower the JPEG quality
+#define BACKPRESSURE_STRIDE 2U      // save fewer frames per camera
+#define BACKPRESSURE_SETS 4U        // save fewer frames, the same ones on every camera
+
+class Options;
+class Logger;
+
+class BackpressureEngine {
+
+    public:
+        BackpressureEngine(const Options& options, uint32_t numCameras);
+        ~BackpressureEngine();
+
+        bool open();
+        void close();
+
+        void update(uint32_t camera, double occupancy, uint64_t frameNumber, uint64_t timestamp, uint64_t index);
+        bool keep(uint32_t camera, uint64_t frameNumber);
+
+        void setFloor(uint32_t level);
+        uint32_t getFloor() const;
+
+        uint32_t getLevel(uint32_t camera) const;
+        int getQualityDrop(uint32_t camera) const;
+        int lowerQuality(uint32_t camera, int quality) const;
+        uint32_t getSaveEvery(uint32_t camera) const;
+        uint64_t getFramesShed(uint32_t camera) const;
+
+    private:
+        /* One rung of the ladder */
+        struct Step {
+            int qualityDrop;
+            uint32_t saveEvery;
+        };
+
+        /* Per camera state, written only by that camera's consumer */
+        struct Camera {
+            std::atomic<uint32_t> level;
+            std::atomic<uint64_t> shed;
+            uint32_t highestLevel;
+            uint64_t aboveSince;    // steady clock ns occupancy first stayed above the high mark, 0 if not
+            uint64_t belowSince;    // same for below the low mark
+        };
+
+        void change(uint32_t camera, uint32_t level, double occupancy, uint64_t frameNumber, uint64_t timestamp, uint64_t index);
+
+        const Options& _options;
+        uint32_t _numCameras;
+        std::vector<Step> _steps;
+        std::vector<Camera> _cameras;
+        std::atomic<uint32_t> _floor;   // lowest level of every camera
+        Logger *_logger;
+        FILE *_file;
+        uint64_t _start;
+        std::mutex _mutex;
+};
@@ -0,0 +1,53 @@
+/*
+ * BayerPacker.hpp
+ *
+ * The copy into the ring for --raw-layout bayer12. A Bayer stream's frames
+ * are the sensor's samples in 16 bit words, RAW16, that no ISP, VIC or
+ * NvBuffer copy understands, so the packer maps each frame for the CPU and
+ * packs its samples to MIPI RAW12 into a pitch linear GRAY8 ring slot, one
+ * row of 3/2 width bytes per sensor row. The bits the samples sit in within
+ * their words are checked on every frame, from every RAW12_CHECK_ROWS-th row,
+ * and do not depend on what the frame shows: MSB aligned samples, shifted
+ * right by 4, never set the low 4 bits, LSB aligned ones, taken as they are,
+ * set them with the sensor's noise in any frame that is not black. A frame
+ * setting no low bit but some above bit 11 is MSB aligned. A frame setting
+ * neither, dark MSB aligned data or a black frame, keeps the alignment found
+ * last, MSB aligned until a frame shows otherwise. Slots are mapped once and
+ * stay mapped until close().
+ */
+
+#pragma once
+
+#include "LatencyHistogram.hpp"
+#include <Argus/Argus.h>
+#include <EGLStream/EGLStream.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+
+class BayerPacker {
+
+    public:
+        BayerPacker();
+        ~BayerPacker();
+
+        static Argus::Size2D<uint32_t> getPackedSize(Argus::Size2D<uint32_t> size);
+
+        bool pack(EGLStream::Image *image, int fd);
+        void close();
+
+        int getShift() const;
+        uint64_t getRealigned() const;
+        uint64_t getFramesPacked() const;
+        const LatencyHistogram *getLatency() const;
+        const std::string& getError() const;
+
+    private:
+        std::map<int, void*> _mappings;     // ring slot dmabuf to its plane's CPU mapping
+        uint32_t _pitch;                    // of the slots' plane, the same for every slot
+        int _shift;                         // found on the last frame that showed it, -1 until one has
+        uint64_t _realigned;                // frames whose alignment differed from the one found before
+        uint64_t _frames;
+        LatencyHistogram _latency;
+        std::string _error;
+};
@@ -0,0 +1,95 @@
+/*
+ * BoundedQueue.hpp
+ *
+ * A fixed-capacity, thread-safe FIFO used to pass work between pipeline stages.
+ * Pushing never blocks: a full queue rejects the item and counts a drop, so a
+ * slow consumer stage can never stall the stage feeding it. Popping blocks for
+ * at most the passed timeout so that owning threads can still observe shutdown.
+ *
+ * The items live in an MpmcRing, so pushes and pops take no lock. Only a pop
+ * that finds the queue empty takes the mutex, to sleep on the condition; a
+ * push notifies only while a pop is sleeping, checked after the item is
+ * published with a full fence on both sides so a wakeup is never lost.
+ */
+
+#pragma once
+
+#include "RingQueue.hpp"
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+template <typename T>
+class BoundedQueue {
+
+    public:
+        explicit BoundedQueue(size_t capacity) :
+            _ring(capacity),
+            _highWater(0),
+            _waiters(0)
+        {}
+
+        /* Append an item, returns false and counts a drop if the queue is full */
+        bool push(const T& item) {
+            if (!_ring.tryPush(item))
+                return false;
+            size_t size = _ring.size();
+            size_t highWater = _highWater.load(std::memory_order_relaxed);
+            while (size > highWater && !_highWater.compare_exchange_weak(highWater, size, std::memory_order_relaxed));
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_waiters.load(std::memory_order_relaxed) > 0) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _notEmpty.notify_one();
+            }
+            return true;
+        }
+
+        /* Remove the oldest item, waiting up to timeoutMs for one to arrive */
+        bool pop(T& item, uint32_t timeoutMs) {
+            if (_ring.tryPop(item))
+                return true;
+            std::unique_lock<std::mutex> lock(_mutex);
+            _waiters.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool popped = _notEmpty.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                                             [this, &item] { return _ring.tryPop(item); });
+            _waiters.fetch_sub(1, std::memory_order_relaxed);
+            return popped;
+        }
+
+        /* Remove the oldest item without waiting */
+        bool tryPop(T& item) {
+            return _ring.tryPop(item);
+        }
+
+        /* Copy the oldest item without removing it */
+        bool peek(T& item) {
+            return _ring.peek(item);
+        }
+
+        size_t size() {
+            return _ring.size();
+        }
+
+        size_t capacity() const {
+            return _ring.capacity();
+        }
+
+        size_t highWater() {
+            return _highWater.load(std::memory_order_relaxed);
+        }
+
+        uint64_t drops() {
+            return _ring.drops();
+        }
+
+    private:
+        MpmcRing<T> _ring;
+        std::atomic<size_t> _highWater;
+        std::atomic<uint32_t> _waiters;     // pops sleeping on _notEmpty
+        std::mutex _mutex;
+        std::condition_variable _notEmpty;
+};
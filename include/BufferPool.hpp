@@ -0,0 +1,50 @@
+/*
+ * BufferPool.hpp
+ *
+ * A fixed number of page-aligned encoder output buffers, allocated once and
+ * then checked out by the encoder and returned by the writer. Alignment keeps
+ * the buffers usable for O_DIRECT writes. If libjpeg outgrows a buffer it
+ * allocates a replacement itself; release() detects this, frees the libjpeg
+ * allocation and regrows that slot once so later frames no longer overflow it.
+ * The slots are an ObjectPool, checked out and returned without a lock.
+ */
+
+#pragma once
+
+#include "ObjectPool.hpp"
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+class BufferPool {
+
+    public:
+        BufferPool(uint32_t count, size_t bufferSize);
+        ~BufferPool();
+
+        bool allocate();
+
+        bool acquire(uint32_t& slot, unsigned char*& data, unsigned long& capacity);
+        void release(uint32_t slot, unsigned char *data, unsigned long size);
+        bool owns(uint32_t slot, const unsigned char *data) const;
+
+        uint32_t getCount() const;
+        size_t getAvailable();
+        uint64_t getGrowCount();
+
+    private:
+        /* One page-aligned buffer, owned by whoever checked out its slot */
+        struct Buffer {
+            unsigned char *data;
+            size_t capacity;
+        };
+
+        size_t roundToPage(size_t size) const;
+
+        uint32_t _count;
+        size_t _pageSize;
+        size_t _bufferSize;
+        bool _allocated;
+        ObjectPool<Buffer> _slots;
+        std::atomic<uint64_t> _growCount;
+};
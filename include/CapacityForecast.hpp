@@ -0,0 +1,92 @@
+/*
+ * CapacityForecast.hpp
+ *
+ * Forecasts how long the run can keep recording at its current settings, so
+ * an operator learns it from status.json or the log instead of from the run
+ * stopping on full volumes. The App calls sample() from its supervisor loop,
+ * which once a second takes the frames and bytes every camera wrote since the
+ * previous sample: one mean image size per camera and second. The last
+ * FORECAST_WINDOW samples are the camera's rolling size distribution. Each
+ * camera's frame rate over the window times its mean size gives the write
+ * rate, times its p90 size a cautious one, and the space every volume has
+ * left above its reserve divided by them the time left. The forecast is
+ * logged every FORECAST_LOG_S. Once the cautious time left falls below
+ * --capacity-warn a warning goes to stdout, and with a BackpressureEngine
+ * every camera's floor level is raised one step per FORECAST_ESCALATE_S to
+ * save less; it is lowered again once the forecast is back above twice the
+ * warning, as when the offload frees space.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#define FORECAST_WINDOW 120U        // one second samples per camera the sizes are taken from
+#define FORECAST_LOG_S 60U          // between two forecasts in the log
+#define FORECAST_ESCALATE_S 30U     // between two backpressure floor steps
+
+class Options;
+class Logger;
+class VolumeSet;
+class BackpressureEngine;
+class ConsumerThread;
+
+/* Time left at the current settings */
+struct Forecast {
+    uint64_t freeBytes;         // on every volume with room, above its reserve
+    double bytesPerSecond;      // at each camera's mean image size
+    double bytesPerSecondHigh;  // at each camera's p90 image size
+    double remainingS;          // at bytesPerSecond, negative while nothing is written
+    double remainingSHigh;      // at bytesPerSecondHigh
+};
+
+class CapacityForecast {
+
+    public:
+        CapacityForecast(const Options& options, uint32_t numCameras, VolumeSet *volumes, BackpressureEngine *backpressure);
+        ~CapacityForecast();
+
+        bool open();
+        void sample(ConsumerThread **consumers);
+
+        const Forecast& getForecast() const;
+        double getMeanSize(uint32_t camera) const;
+        double getHighSize(uint32_t camera) const;
+        double getFps(uint32_t camera) const;
+
+    private:
+        /* What one camera wrote between two samples */
+        struct Sample {
+            uint64_t duration;      // ns
+            uint64_t frames;
+            uint64_t bytes;
+        };
+
+        /* Per camera window of samples, the oldest overwritten first */
+        struct Camera {
+            std::vector<Sample> samples;
+            uint32_t next;
+            uint64_t lastFrames;
+            uint64_t lastBytes;
+            double fps;
+            double meanSize;        // bytes per image over the window
+            double highSize;        // p90 of the samples' mean image sizes
+        };
+
+        void update();
+        void react(uint64_t time);
+
+        const Options& _options;
+        uint32_t _numCameras;
+        VolumeSet *_volumes;
+        BackpressureEngine *_backpressure;
+        Logger *_logger;
+        std::vector<Camera> _cameras;
+        Forecast _forecast;
+        uint64_t _lastSample;       // steady clock ns, 0 before the first
+        uint64_t _nextLog;
+        uint64_t _lastStep;         // steady clock ns of the last floor change
+        bool _low;                  // the cautious time left is below --capacity-warn
+        double _lowest;             // cautious seconds left at their lowest, negative until known
+};
@@ -0,0 +1,125 @@
+/*
+ * CaptureGraph.hpp
+ *
+ * The capture pipeline shared by StreamCapture and StreamPreview: the camera
+ * provider and its devices, one capture session per device or a single one over
+ * every device, the output streams of each camera, a request per session built
+ * from a sensor mode and each camera's settings, and the consumer threads draining the
+ * streams. Teardown happens in the one order Argus accepts. With a session per
+ * camera, one camera's session, EGL streams and request can be recreated alone
+ * while the other cameras keep capturing. Methods return false on failure and
+ * getError() describes what failed, callers log it their own way.
+ */
+
+#pragma once
+
+#include <Argus/Argus.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ArgusSamples {
+class Thread;
+}
+
+/* How an output stream hands its frames to the consumer */
+enum CaptureStreamType {
+    CAPTURE_STREAM_EGL,     // EGLStream the consumer wraps in a FrameConsumer
+    CAPTURE_STREAM_BUFFER,  // BufferStream of consumer-allocated EGLImages, capture metadata enabled
+    CAPTURE_STREAM_BAYER    // EGLStream of the sensor's RAW16 samples, the ISP bypassed
+};
+
+/* ISP noise reduction of a camera's request */
+enum CaptureDenoise {
+    CAPTURE_DENOISE_DEFAULT,    // leave the driver's
+    CAPTURE_DENOISE_OFF,
+    CAPTURE_DENOISE_FAST,
+    CAPTURE_DENOISE_HIGH_QUALITY
+};
+
+/* Source settings of one camera's request, an empty exposure or gain range leaves the sensor mode's */
+struct CaptureSettings {
+    Argus::Range<uint64_t> frameDuration;   // ns
+    Argus::Range<uint64_t> exposureTime;    // ns
+    Argus::Range<float> gain;
+    CaptureDenoise denoise;
+    float denoiseStrength;                  // 0-1 relative to the mode, negative leaves the mode's
+};
+
+class CaptureGraph {
+
+    public:
+        CaptureGraph();
+        ~CaptureGraph();
+
+        bool open(uint32_t maxCameras);
+        bool createSessions(bool shared);
+        Argus::SensorMode *getSensorMode(uint32_t index);
+
+        int addStream(uint32_t camera, CaptureStreamType type, const Argus::Size2D<uint32_t>& resolution,
+                      uint32_t fifoLength = 0);
+        bool createRequests(Argus::SensorMode *sensorMode, const Argus::Range<uint64_t>& frameDuration);
+        bool createRequests(Argus::SensorMode *sensorMode, const std::vector<CaptureSettings>& settings);
+        bool setAeLock(uint32_t camera, bool lock);
+        bool setAwbLock(uint32_t camera, bool lock);
+        bool setFrameDuration(uint32_t camera, const Argus::Range<uint64_t>& frameDuration);
+        bool enableStream(int stream, bool enable);
+
+        bool registerConsumer(ArgusSamples::Thread *consumer);
+        bool startConsumers();
+        bool shutdownConsumers();
+
+        bool submit();
+        bool submit(uint32_t camera);
+        void setSingleShot(uint64_t timeoutNs);
+        bool capture();
+        void stop(uint64_t timeoutNs);
+        bool stopCamera(uint32_t camera, uint64_t timeoutNs);
+        void endStreams();
+        void endStream(int stream);
+        bool restartCamera(uint32_t camera);
+        void destroyStreams();
+        void close();
+
+        Argus::ICameraProvider *getProvider() const;
+        uint32_t getCameraCount() const;
+        uint32_t getSessionCount() const;
+        bool isShared() const;
+        Argus::CaptureSession *getSession(uint32_t index) const;
+        Argus::CameraDevice *getDevice(uint32_t camera) const;
+        Argus::OutputStream *getStream(int stream) const;
+        Argus::Request *getRequest(uint32_t camera) const;
+        const std::string& getError() const;
+
+    private:
+        /* One output stream, the camera it belongs to and how to create it again */
+        struct Stream {
+            Argus::OutputStream *stream;
+            uint32_t camera;
+            CaptureStreamType type;
+            Argus::Size2D<uint32_t> resolution;
+            uint32_t fifoLength;
+            bool enabled;           // in its session's request
+        };
+
+        bool createStream(Stream& stream);
+        Argus::Request *createRequest(uint32_t session);
+        bool applySettings(Argus::Request *request, const CaptureSettings& camera);
+        uint32_t getSessionIndex(uint32_t camera) const;
+        bool fail(const std::string& error);
+
+        Argus::CameraProvider *_provider;
+        Argus::ICameraProvider *_iProvider;
+        std::vector<Argus::CameraDevice*> _devices;
+        std::vector<Argus::CaptureSession*> _sessions;
+        std::vector<Argus::Request*> _requests;
+        Argus::SensorMode *_sensorMode;
+        std::vector<CaptureSettings> _settings;     // per session, as the requests were created
+        std::vector<bool> _repeating;
+        std::vector<Stream> _streams;
+        std::vector<ArgusSamples::Thread*> _consumers;
+        uint32_t _consumersStarted;
+        bool _shared;
+        bool _singleShot;           // capture() takes the shots, submit() repeats nothing
+        std::string _error;
+};
@@ -0,0 +1,173 @@
+/*
+ * ClusterLink.hpp
+ *
+ * Lets the StreamCapture instances of several boards record as one rig. One
+ * runs with --leader and listens on a TCP port, the others join it with
+ * --follow. The leader forwards record, stop, trigger and quit to every
+ * follower, so its SIGUSR1, SIGUSR2, trigger line and control socket drive
+ * every board. Followers start paused and report once their cameras are warm,
+ * the leader then starts every board recording at once.
+ *
+ * Sensor timestamps count CLOCK_MONOTONIC of their own board. The leader pings
+ * each follower every CLUSTER_PING_MS and estimates the offset of its clock
+ * from the four timestamps of the exchange, keeping the sample with the
+ * shortest round trip of the last CLUSTER_OFFSET_SAMPLES: the offset is off
+ * by at most half that round trip. Each board groups its cameras' frames into
+ * sets.csv as usual and reports every set it writes to the leader, which maps
+ * the set's timestamp onto its own clock and pairs the sets of all boards the
+ * way the FrameSetCollector pairs cameras, within the --frame-sets tolerance.
+ * A cross-node set missing a board is dropped or written with that entry
+ * empty, depending on the set policy. The spread of its members' timestamps
+ * is the set's alignment error.
+ *
+ * Protocol, one text line per message:
+ *     leader -> follower: welcome <node>, ping <t0>, record, stop, trigger, quit
+ *     follower -> leader: ready, pong <t0> <t1> <t2>, set <set> <timestamp>, done
+ *
+ * File formats, in the leader's root directory, nodeN is the set number in
+ * that board's sets.csv, the leader is node0:
+ *     cluster_sets.csv: set,timestamp,error_us,node0,...,nodeN
+ *     cluster_clock.csv: elapsed_ms,node,offset_ns,round_trip_ns
+ */
+
+#pragma once
+
+#include "Thread.h"
+#include "RingQueue.hpp"
+#include "LatencyHistogram.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define CLUSTER_BACKLOG 4           // followers waiting to be accepted
+#define CLUSTER_LINE_MAX 256        // longest message accepted
+#define CLUSTER_POLL_MS 50          // longest the link waits for a message
+#define CLUSTER_SEND_TIMEOUT_MS 1000    // longest a message may take to send before its peer counts as lost
+#define CLUSTER_PING_MS 500         // between clock offset samples of each follower
+#define CLUSTER_OFFSET_SAMPLES 8    // samples the shortest round trip is picked from, 4 s of drift at most
+#define CLUSTER_CONNECT_S 30        // longest a follower keeps trying to reach the leader
+#define CLUSTER_WAIT_S 60           // longest the leader waits for every follower to be warm
+#define CLUSTER_DONE_S 10           // longest the leader waits for the followers' last sets at the end
+#define CLUSTER_WAIT_SETS 8         // sets another board may get ahead before a missing one is given up on
+#define CLUSTER_SET_QUEUE 64        // sets of this board waiting for the link
+#define CLUSTER_LOG_S 60            // between the leader's alignment reports in its log
+
+class Options;
+class Logger;
+
+/* What the leader tells the followers to do */
+enum ClusterCommand {
+    CLUSTER_RECORD,
+    CLUSTER_STOP,
+    CLUSTER_TRIGGER,
+    CLUSTER_QUIT
+};
+
+class ClusterLink : public ArgusSamples::Thread {
+
+    public:
+        explicit ClusterLink(const Options& options);
+        virtual ~ClusterLink();
+
+        bool isLeader() const;
+        int getEventFd() const;
+        void broadcast(ClusterCommand command);
+        bool takeCommand(ClusterCommand& command);
+        void setReady();
+        bool isEveryoneReady();
+        bool offerSet(uint64_t set, uint64_t timestamp);
+
+        uint64_t getSetsWritten();
+        uint64_t getSetsIncomplete();
+        const LatencyHistogram *getAlignment() const;
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        /* One set a board wrote, the timestamp on that board's clock */
+        struct NodeSet {
+            uint64_t set;
+            uint64_t timestamp;
+        };
+
+        /* One exchange of ping and pong */
+        struct ClockSample {
+            int64_t offset;         // follower clock minus leader clock
+            uint64_t roundTrip;
+        };
+
+        /* A board as the leader sees it, node 0 is the leader itself */
+        struct Node {
+            int fd;
+            bool joined;
+            bool gone;              // the connection was lost or closed
+            bool ready;
+            bool done;              // sent its last set
+            std::string address;
+            std::string buffer;     // received, not yet a whole line
+            std::deque<NodeSet> pending;
+            uint64_t last;          // newest timestamp reported, 0 before the first
+            std::deque<ClockSample> samples;
+            int64_t offset;
+            uint64_t roundTrip;
+            uint64_t nextPing;
+        };
+
+        static uint64_t now();
+        bool openListener();
+        bool connectLeader();
+        void service(int timeoutMs);
+        void accept();
+        bool receive(int fd, std::string& buffer, std::vector<std::string>& lines);
+        bool sendLine(int fd, const std::string& line);
+        void lose(Node& node);
+        void signal();
+        void handleFollower(Node& node, const std::string& line, uint64_t received);
+        void handleLeader(const std::string& line, uint64_t received);
+        void ping();
+        void takeOffered();
+        uint64_t toLeader(const Node& node, uint64_t timestamp) const;
+        bool canDeliver(const Node& node, uint64_t horizon) const;
+        bool collect(bool flush);
+        bool writeSet(uint64_t timestamp, uint64_t error);
+        bool isWaiting() const;
+        void report(bool final);
+
+        const Options& _options;
+        bool _leader;
+        uint32_t _numNodes;         // the leader and every follower it waits for
+        uint64_t _tolerance;
+        Logger *_logger;
+        int _eventFd;
+        int _fd;                    // the leader's listening socket, or the follower's connection
+        std::string _buffer;        // follower: received from the leader, not yet a whole line
+        uint32_t _id;               // follower: its node number, 0 before the welcome
+        std::vector<Node> _nodes;
+        std::vector<NodeSet> _heads;    // on the leader's clock
+        std::vector<bool> _present;
+        std::vector<bool> _members;
+        SpscRing<NodeSet> _offered;    // from the collector to the link thread
+        std::deque<ClusterCommand> _commands;
+        std::mutex _mutex;          // the nodes' sockets and the commands
+        std::atomic<bool> _ready;
+        bool _readySent;
+        std::atomic<uint32_t> _followersReady;
+        std::atomic<bool> _recording;
+        FILE *_sets;
+        FILE *_clock;
+        uint64_t _start;
+        uint64_t _nextReport;
+        uint64_t _next;             // set number of the next cross-node set
+        uint64_t _reported;         // follower: sets sent to the leader
+        std::atomic<uint64_t> _setsWritten;
+        std::atomic<uint64_t> _setsIncomplete;
+        LatencyHistogram _alignment;
+        bool _failed;
+};
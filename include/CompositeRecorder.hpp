@@ -0,0 +1,137 @@
+/*
+ * CompositeRecorder.hpp
+ *
+ * The --composite recording mode: instead of one image per camera, every
+ * frame set is tiled into one large image and encoded once. Each consumer
+ * submits its ring slots to a CompositeInput in place of an encode channel.
+ * The recorder groups the queued slots by sensor timestamp the way the
+ * FrameSetCollector does, tiles the members of a set into a block-linear
+ * YUV420 canvas with one NvBufferComposite, releases the slots and JPEG
+ * encodes the canvas. A set missing a camera is dropped or written with that
+ * tile left black, depending on the set policy. The composites are written by
+ * a FrameWriter of their own as if taken by one more camera, camN with N the
+ * number of cameras, so containers, volumes, segments and checksums work as
+ * for any camera.
+ *
+ * Tiles are filled row by row with their origins on multiples of 16 pixels,
+ * the JPEG MCU size at 4:2:0, so a tile can be cut out of the composite
+ * without re-encoding it. camN/tiles.csv holds the tile of every camera,
+ * camN/composite.csv the image index every member camera saved its frame
+ * under for each composite.
+ *
+ * File formats:
+ *     tiles.csv: camera,left,top,width,height
+ *     composite.csv: index,timestamp,cam0,...,camN
+ */
+
+#pragma once
+
+#include "Thread.h"
+#include "BoundedQueue.hpp"
+#include "FrameSink.hpp"
+#include "LatencyHistogram.hpp"
+#include <Argus/Argus.h>
+#include <nvbuf_utils.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#define COMPOSITE_ALIGN 16U // JPEG MCU size at 4:2:0, tiles start on MCU boundaries
+
+class Options;
+class Logger;
+class DmabufRing;
+class BufferPool;
+class FrameWriter;
+class VolumeSet;
+class NvJPEGEncoder;
+class CompositeRecorder;
+
+/* One camera's queue into the composite, used by the consumer as its FrameSink */
+class CompositeInput : public FrameSink {
+
+    public:
+        CompositeInput(uint32_t id, CompositeRecorder& recorder);
+        virtual ~CompositeInput() {}
+
+        virtual bool submit(const FrameJob& job);
+        virtual bool hasFailed();
+        virtual uint64_t getFramesWritten();
+        virtual uint64_t getBytesWritten();
+        virtual size_t getQueueDepth();
+
+        void drain();
+
+    private:
+        friend class CompositeRecorder;
+
+        uint32_t _id;
+        DmabufRing *_ring;                  // set once the consumer registers, before its first submit
+        CompositeRecorder& _recorder;
+        BoundedQueue<FrameJob> _jobs;
+        std::atomic<bool> _closed;          // the consumer stopped, nothing more arrives
+        std::atomic<uint64_t> _framesWritten;   // of this camera, in composites handed to the writer
+        std::atomic<uint64_t> _bytesWritten;    // its share of those composites
+};
+
+class CompositeRecorder : public ArgusSamples::Thread {
+
+    public:
+        CompositeRecorder(const Options& options, uint32_t numCameras, VolumeSet *volumes);
+        virtual ~CompositeRecorder();
+
+        static Argus::Size2D<uint32_t> getCanvasSize(const Options& options, uint32_t numCameras);
+
+        CompositeInput *registerCamera(uint32_t id, DmabufRing& ring);
+        bool hasFailed();
+
+        uint64_t getComposites();
+        uint64_t getCompositesIncomplete();
+        uint64_t getCompositesDropped();
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        friend class CompositeInput;
+
+        static NvBufferRect getTile(const Options& options, uint32_t numCameras, uint32_t camera);
+        void notify();
+        bool collect(bool flush);
+        bool compose(uint32_t& count, int& quality);
+        bool encode(uint64_t timestamp, uint32_t count, int quality);
+        bool openIndexes();
+
+        const Options& _options;
+        uint32_t _numCameras;
+        uint64_t _tolerance;
+        VolumeSet *_volumes;
+        Logger *_logger;
+        std::vector<CompositeInput*> _inputs;
+        std::vector<FrameJob> _heads;
+        std::vector<bool> _present;
+        std::vector<bool> _members;
+        Argus::Size2D<uint32_t> _canvasSize;
+        int _canvas;
+        NvBufferCompositeParams _compositeParam;
+        NvJPEGEncoder *_jpegEncoder;
+        BufferPool *_pool;
+        FrameWriter *_writer;
+        FILE *_index;
+        uint64_t _next;             // image index of the next composite
+        std::atomic<uint64_t> _composites;
+        std::atomic<uint64_t> _incomplete;
+        std::atomic<uint64_t> _dropped;     // no output buffer or the writer queue full
+        std::atomic<bool> _failed;
+        LatencyHistogram _composeLatency;
+        LatencyHistogram _encodeLatency;
+        std::mutex _mutex;
+        std::condition_variable _ready;
+        std::condition_variable _drained;
+        bool _pending;              // a slot was submitted since the last collect
+};
@@ -2,10 +2,44 @@
  * ConsumerThread.hpp
  *
  * Creates an EGLStream::FrameConsumer object to read frames from the
- * OutputStream, then creates/populates an NvBuffer (dmabuf) from the frames
- * to be processed by processV4L2Fd, which saves each frame as a JPEG image.
- * Note that for ThreadExecute to terminate, stopExecute must first be 
- * called on the object.
+ * OutputStream, then copies each saved frame into an NvBuffer (dmabuf) from a
+ * DmabufRing and submits it to the shared EncodeScheduler, whose workers JPEG
+ * encode it and hand it to a FrameWriter thread for saving. In raw format a RawWriter stores
+ * the planes uncompressed instead, and in h264/h265 format a VideoWriter feeds
+ * them to the hardware video encoder. Note that for ThreadExecute
+ * to terminate, stopExecute must first be called on the object. The passed
+ * eventfd is signalled when the thread stops executing so the App can react.
+ * With a FrameSetCollector each submitted frame is reported with its sensor
+ * timestamp so the cameras' frames can be grouped into sets. With --metadata the
+ * capture metadata of each submitted frame is appended to a MetadataLog.
+ * With --zero-copy the stream is a BufferStream capturing into NvBuffers the
+ * ring owns, which are handed downstream without a copy while Argus still has
+ * others to capture into. With a VolumeSet the writers spread the images over
+ * several volumes. With a BackpressureEngine the backlog is reported for every
+ * acquired frame, and the engine decides which frames are saved and the JPEG
+ * quality they are encoded at. Settings changed while recording arrive as a
+ * CameraControl through control() and are applied between two frames. A
+ * paused consumer keeps acquiring, so AE/AWB stay converged, but releases
+ * every frame unsaved; each resume starts a new segment, listed with its first
+ * image index in camN/segments.csv. With --trigger only the bursts a trigger
+ * asks for are saved, each a segment of its own. With --pre-trigger the
+ * newest frames are copied into a PreTriggerRing while waiting, and each burst
+ * starts with them. With --interval every time-lapse shot is a burst of one
+ * frame, and the long waits in between count as no timeout. With
+ * --motion-gate a MotionGate skips frames that barely differ from the last
+ * one kept. With --exposure-gate an ExposureGate skips,
+ * or encodes at a low quality, frames whose ISP histogram is mostly black or
+ * saturated. With --tnr a TnrFilter's temporal noise reduction on the VIC
+ * takes the place of the copy into the ring, and with --raw-layout bayer12 a
+ * BayerPacker packing the RAW16 stream's samples on the CPU does. With --composite the slots go to
+ * a CompositeInput instead of an encode channel, and the CompositeRecorder
+ * tiles every frame set into one image. Every acquired frame after the warm-up is
+ * observed by a FrameCadence, so the frames lost before the consumer and the
+ * sensor timestamp jitter are known, and the drops of every later stage are
+ * counted where they happen. With --camera-restarts a disconnected stream does
+ * not end the thread: the consumer lets go of it, reports the loss and waits
+ * for the App to restart the camera and hand over the new stream through
+ * reconnect(), keeping its ring, writers and files, and logs the outage.
  */
 
 #pragma once
@@ -13,19 +47,91 @@
 #include "Thread.h"
 #include <Argus/Argus.h>
 #include <EGLStream/EGLStream.h>
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 class Options;
 class Logger;
-class NvJPEGEncoder;
+class FrameWriter;
+class BufferPool;
+class DmabufRing;
+class EncodeScheduler;
+class EncodeChannel;
+class RawWriter;
+class VideoWriter;
+class FrameSink;
+class TelemetryLog;
+class LatencyHistogram;
+class FrameSetCollector;
+class MetadataLog;
+class VolumeSet;
+class BackpressureEngine;
+class PreTriggerRing;
+class MotionGate;
+class TnrFilter;
+class BayerPacker;
+class ExposureGate;
+class FrameCadence;
+class FramePublisher;
+class QuickLookServer;
+class CompositeRecorder;
+class CompositeInput;
+struct FrameJob;
+struct MetadataRecord;
+namespace EGLStream { namespace NV { class IImageNativeBuffer; } }
+
+/* Settings changed while recording, applied by the consumer between frames. 0 leaves a setting unchanged */
+struct CameraControl {
+    int quality;                // JPEG quality the next frames start at
+    uint32_t stride;            // sensor frames per saved frame
+    uint64_t frameDuration;     // ns, the sensor's frame duration after the change
+    int pause;                  // 1 pauses saving, -1 resumes it
+    uint32_t burst;             // frames to save from the next one on, restarting a running burst
+};
+
+/* Frames lost per pipeline stage */
+struct StageDrops {
+    uint64_t sensor;            // sensor frame periods no frame was acquired for
+    uint64_t replaced;          // of those, frames the EGLStream replaced before they were acquired
+    uint64_t internal;          // of those, captures Argus made into no buffer as the consumer held them all
+    uint64_t consumer;          // acquired frames with no free ring slot to copy into
+    uint64_t encoder;           // copied frames the encoder queue had no room for
+    uint64_t writer;            // encoded images without a free write buffer, raw records without queue room
+};
 
 class ConsumerThread : public ArgusSamples::Thread {
 
     public:
-        explicit ConsumerThread(Argus::OutputStream *stream, uint32_t id, const Options& options);
+        explicit ConsumerThread(Argus::OutputStream *stream, uint32_t id, const Options& options, EncodeScheduler *scheduler,
+                                FrameSetCollector *collector, VolumeSet *volumes, BackpressureEngine *backpressure,
+                                FramePublisher *publisher, QuickLookServer *quickLook, CompositeRecorder *composite,
+                                int eventFd);
         virtual ~ConsumerThread();
 
         void stopExecute();
         bool isExecuting();
+        bool isStreamLost();
+        void reconnect(Argus::OutputStream *stream);
+        uint32_t getRestarts();
+        bool isWarm();
+        bool isPaused();
+        void control(const CameraControl& update);
+        uint64_t getLastFrameTime();
+        uint64_t getAcquireTimeouts();
+        uint64_t getFramesWritten();
+        uint64_t getBytesWritten();
+        uint64_t getFramesDropped();
+        void getStageDrops(StageDrops& drops);
+        const FrameCadence *getCadence();
+        const ExposureGate *getExposureGate();
+        size_t getQueueDepth();
+        const LatencyHistogram *getLatency();
+        int getQuality();
+        uint32_t getWritesInFlight();
+        const LatencyHistogram *getWriteLatency();
+        double getOccupancy();
 
     protected:
         virtual bool threadInitialize();
@@ -33,18 +139,60 @@ class ConsumerThread : public ArgusSamples::Thread {
         virtual bool threadShutdown();
 
     private:
-        bool processV4L2Fd(int32_t fd, uint64_t frameNumber);
         uint32_t getJPEGSize(uint32_t width, uint32_t height);
         void consumerLog(const char *s);
+        void notifySupervisor();
+        bool awaitStream();
+        void applyControl(uint32_t& stride, uint64_t& acquireTimeout, uint32_t& burstLeft);
+        void logSegment(uint32_t segment, uint64_t index, uint64_t timestamp);
+        bool copyFrame(EGLStream::Image *image, EGLStream::NV::IImageNativeBuffer *iNativeBuffer, int captureFd, int fd);
+        bool submitFrame(FrameJob& job, uint64_t sensorTimestamp, const MetadataRecord& record);
 
         Argus::OutputStream* _stream;
         Argus::UniqueObj<EGLStream::FrameConsumer> _consumer;
-        int _dmabuf;
-        NvJPEGEncoder *_jpegEncoder;
-        unsigned char *_outputBuffer;
-        uint32_t _outputBufferSize;
+        DmabufRing *_ring;
+        BufferPool *_pool;
+        FrameWriter *_writer;
+        EncodeScheduler *_scheduler;
+        EncodeChannel *_channel;
+        CompositeRecorder *_composite;
+        CompositeInput *_compositeInput;
+        RawWriter *_rawWriter;
+        VideoWriter *_videoWriter;
+        FrameSink *_sink;
+        TelemetryLog *_telemetry;
+        FrameSetCollector *_collector;
+        VolumeSet *_volumes;
+        BackpressureEngine *_backpressure;
+        FramePublisher *_publisher;
+        QuickLookServer *_quickLook;
+        MetadataLog *_metadata;
+        PreTriggerRing *_preTrigger;
+        MotionGate *_motionGate;
+        ExposureGate *_exposureGate;
+        TnrFilter *_tnr;
+        BayerPacker *_packer;
+        FrameCadence *_cadence;
         uint32_t _id;
         const Options& _options;
         Logger *_logger;
-        bool _doExecute;
+        int _eventFd;
+        std::atomic<bool> _doExecute;
+        std::atomic<bool> _warm;
+        std::atomic<bool> _paused;
+        std::atomic<bool> _controlPending;
+        CameraControl _control;
+        std::mutex _controlMutex;
+        FILE *_segments;
+        std::atomic<uint64_t> _lastFrameTime;
+        std::atomic<uint64_t> _acquireTimeouts;
+        std::atomic<uint64_t> _ringDrops;
+        std::atomic<uint64_t> _queueDrops;
+        std::atomic<uint64_t> _framesZeroCopy;
+        std::atomic<uint64_t> _framesCopied;
+        std::atomic<bool> _streamLost;      // _stream is gone, waiting in awaitStream for a restarted one
+        std::mutex _streamMutex;
+        std::condition_variable _streamReady;
+        std::atomic<uint32_t> _restarts;
+        uint64_t _outageNs;                 // summed from disconnect to the first frame of the restarted stream
 };
@@ -0,0 +1,108 @@
+/*
+ * ContainerFile.hpp
+ *
+ * Appends one camera's encoded images back to back into a large pre-allocated
+ * file instead of creating a file per image, which keeps directory sizes small
+ * on FAT/exFAT volumes. Each image gets an entry in a sidecar index so it can
+ * be extracted again. Files are rotated once they reach the configured size.
+ * In direct mode the data file is written with O_DIRECT and every image starts
+ * on a DIRECT_IO_ALIGN boundary, the index offsets skip the padding. Every
+ * entry carries the image's CRC32C, which --verify checks the data against.
+ *
+ * For segment n the files are:
+ *   cam<N>/frames<n>.mjpg  concatenated JPEG images
+ *   cam<N>/frames<n>.idx   one ContainerIndexEntry per image
+ * Proxy containers use the prefix proxies instead of frames. sync() makes
+ * everything appended so far durable, a segment is synced when it is rotated.
+ *
+ * The data file carries its own index as well, so a segment survives losing
+ * the .idx or a crash mid-write. Every CONTAINER_CHECKPOINT_IMAGES images,
+ * and on every sync(), a checkpoint record listing the images since the last
+ * one is appended on a DIRECT_IO_ALIGN boundary, each pointing back to the one
+ * before it. close() appends a footer, a checkpoint listing the whole segment,
+ * and a trailer in the last bytes of the file pointing to it, which
+ * ContainerReader maps to find any image without parsing JPEG markers.
+ * recover() closes a segment a crash left without its footer, scanning back
+ * for the last valid checkpoint only instead of through the whole file.
+ */
+
+#pragma once
+
+#include "DirectFile.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define CONTAINER_CHECKPOINT_IMAGES 64U                 // images between checkpoints, bounds the recovery scan
+#define CONTAINER_CHECKPOINT_MAGIC 0x4b504353U          // "SCPK"
+#define CONTAINER_TRAILER_MAGIC 0x52454c4941525453ULL   // "STRAILER"
+#define CONTAINER_FOOTER 1U                             // checkpoint flag, lists every image of the segment
+#define CONTAINER_NO_CHECKPOINT UINT64_MAX
+
+struct ContainerIndexEntry {
+    uint64_t index;         // image index, matches the per-file numbering
+    uint64_t timestamp;     // frame time in ns
+    uint64_t offset;        // byte offset of the image in the .mjpg file
+    uint32_t size;          // encoded size in bytes
+    uint32_t crc32c;        // checksum of the encoded image, 0 in runs from before checksums
+};
+
+/* Followed by count ContainerIndexEntry records, always starts on a DIRECT_IO_ALIGN boundary */
+struct ContainerCheckpoint {
+    uint32_t magic;         // CONTAINER_CHECKPOINT_MAGIC
+    uint32_t count;         // entries following the header
+    uint64_t sequence;      // checkpoints before this one in the segment
+    uint64_t previous;      // offset of the checkpoint before, CONTAINER_NO_CHECKPOINT for the first
+    uint32_t flags;         // CONTAINER_FOOTER
+    uint32_t crc32c;        // of the header with this field 0, continued over the entries
+};
+
+/* The last bytes of a closed segment */
+struct ContainerTrailer {
+    uint64_t magic;         // CONTAINER_TRAILER_MAGIC
+    uint64_t footer;        // offset of the footer checkpoint
+    uint64_t count;         // images in the segment
+    uint32_t reserved;
+    uint32_t crc32c;        // of the fields before it
+};
+
+class ContainerFile {
+
+    public:
+        ContainerFile(std::string directory, uint64_t rotateBytes, bool direct, std::string prefix = "frames");
+        ~ContainerFile();
+
+        bool append(const unsigned char *data, unsigned long size, uint64_t index, uint64_t timestamp);
+        bool close();
+        bool sync();
+
+        static bool recover(const std::string& path, uint64_t& images, bool& repaired);
+
+        uint32_t getSegmentCount() const;
+        uint64_t getBytesWritten() const;
+        bool getLastImage(char *path, size_t length, uint64_t& offset) const;
+
+    private:
+        bool openNext();
+        bool reserve(uint64_t end);
+        bool writeCheckpoint(bool footer);
+
+        std::string _directory;
+        std::string _prefix;
+        uint64_t _rotateBytes;
+        bool _direct;
+        uint32_t _segment;
+        DirectFile _data;
+        bool _open;
+        bool _created;          // a segment was created since the last sync, its directory entry is not durable
+        int _indexFd;
+        uint64_t _offset;       // where the next image goes
+        uint64_t _end;          // end of the last image
+        uint64_t _allocated;
+        uint64_t _bytesWritten;
+        std::vector<ContainerIndexEntry> _entries;  // every image of the segment, for the checkpoints and the footer
+        uint32_t _checkpointed;     // entries listed by a checkpoint already
+        uint64_t _checkpoint;       // offset of the last checkpoint
+        uint64_t _checkpoints;
+        std::vector<unsigned char> _record; // checkpoint being written, kept to reuse its capacity
+};
@@ -0,0 +1,63 @@
+/*
+ * ContainerReader.hpp
+ *
+ * Random access to the images of one container segment (see ContainerFile.hpp)
+ * for the tools downstream of a run, without the .idx or any JPEG parsing. The
+ * data file is mapped read-only; a closed segment's index is its footer, found
+ * through the trailer in its last bytes and used in place. A segment a crash
+ * left open is indexed from its checkpoints instead: the last valid one is
+ * searched for backwards from the end, which only crosses the images written
+ * since it and the zeros of the pre-allocation, and the rest are followed back
+ * through their previous offsets. Images are found by image index or frame
+ * time in log time and returned as pointers into the mapping.
+ */
+
+#pragma once
+
+#include "ContainerFile.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class ContainerReader {
+
+    public:
+        ContainerReader();
+        ~ContainerReader();
+
+        bool open(const std::string& path);
+        void close();
+
+        bool isRecovered() const;
+        size_t getCount() const;
+        const ContainerIndexEntry *getEntries() const;
+        uint64_t getSize() const;
+        uint64_t getValidEnd() const;
+        uint64_t getLastCheckpoint() const;
+        uint64_t getCheckpoints() const;
+
+        bool findIndex(uint64_t index, size_t& position) const;
+        bool findTime(uint64_t timestamp, size_t& position) const;
+        const unsigned char *getImage(size_t position, uint32_t& size) const;
+        bool checkEntry(const ContainerIndexEntry& entry) const;
+
+        static uint32_t checksum(const ContainerCheckpoint& header, const ContainerIndexEntry *entries);
+
+    private:
+        bool readFooter();
+        void readCheckpoints();
+        bool readCheckpoint(uint64_t offset, ContainerCheckpoint& header) const;
+        uint64_t findCheckpoint(uint64_t limit, ContainerCheckpoint& header) const;
+
+        int _fd;
+        const unsigned char *_map;
+        uint64_t _size;
+        const ContainerIndexEntry *_entries;    // into the mapping, or into _recovered
+        size_t _count;
+        std::vector<ContainerIndexEntry> _recovered;
+        bool _isRecovered;      // no valid footer, the entries come from the checkpoints
+        uint64_t _validEnd;     // end of the footer or of the last valid checkpoint
+        uint64_t _lastCheckpoint;
+        uint64_t _checkpoints;
+};
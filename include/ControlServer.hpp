@@ -0,0 +1,64 @@
+/*
+ * ControlServer.hpp
+ *
+ * Accepts commands on a Unix stream socket while recording, so settings can be
+ * tuned without a restart that would lose the AE/AWB warm-up. The App calls
+ * serve() from its supervisor loop whenever the socket is readable. Each
+ * connection sends one command line and gets one reply line back, "ok ..." or
+ * "error ...". Changed settings reach the cameras' ConsumerThreads as a
+ * CameraControl they apply between two frames, a save every on a stretched
+ * sensor also re-submits the camera's request at the new frame duration.
+ * Paused cameras keep capturing and release every frame unsaved, record and
+ * stop resume or pause them all, which is how a --daemon is driven, and quit
+ * ends the run. A --leader forwards record, stop and trigger to every
+ * follower. Every applied change is appended to options.txt with a timestamp.
+ */
+
+#pragma once
+
+#include <Argus/Argus.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define CONTROL_BACKLOG 4           // connections waiting to be served
+#define CONTROL_LINE_MAX 256        // longest command accepted
+#define CONTROL_TIMEOUT_MS 100      // longest the supervisor waits for a connected client to send
+
+class Options;
+class Logger;
+class CaptureGraph;
+class ConsumerThread;
+class ClusterLink;
+
+class ControlServer {
+
+    public:
+        ControlServer(Options& options, CaptureGraph& graph, ConsumerThread **consumers, uint32_t numCameras,
+                      const Argus::Range<uint64_t>& frameDurationRange, ClusterLink *cluster);
+        ~ControlServer();
+
+        bool open();
+        int getFd() const;
+        void serve();
+        bool isQuitRequested() const;
+
+    private:
+        std::string execute(const std::string& command);
+        std::string setQuality(uint32_t first, uint32_t last, int quality);
+        std::string setSaveEvery(uint32_t first, uint32_t last, int saveEvery);
+        std::string setPaused(uint32_t first, uint32_t last, bool paused);
+        std::string trigger(int frames);
+        std::string show();
+
+        Options& _options;
+        CaptureGraph& _graph;
+        ConsumerThread **_consumers;
+        uint32_t _numCameras;
+        Argus::Range<uint64_t> _frameDurationRange;
+        ClusterLink *_cluster;      // forwards record, stop and trigger to the followers of a --leader
+        Logger *_logger;
+        int _fd;
+        std::vector<int> _saveEvery;
+        bool _quit;
+};
@@ -0,0 +1,17 @@
+/*
+ * Crc32c.hpp
+ *
+ * CRC32C (Castagnoli) of a buffer, the checksum the writers store for every
+ * image and --verify checks the run against. On the TX2 it runs on the ARMv8
+ * CRC instructions, 8 bytes per instruction; builds without them use the
+ * table driven scalar twin, which gives the same value. A checksum can be
+ * continued over several buffers by passing the previous one back as crc.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32c(const void *data, size_t size, uint32_t crc = 0);
+uint32_t crc32cScalar(const void *data, size_t size, uint32_t crc = 0);
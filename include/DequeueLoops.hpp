@@ -0,0 +1,43 @@
+/*
+ * DequeueLoops.hpp
+ *
+ * The --dq-loops threads shared by the video encoders. Each VideoWriter and
+ * the RtpSink would otherwise start a DQ thread for its encoder's bitstream
+ * plane; with loops configured they hand the plane to the next NvV4l2PollLoop
+ * in turn, which poll()s all of its planes at once and calls their callbacks
+ * from its own thread. Six cameras in h264 then cost one or two threads
+ * instead of six waking for every buffer. Without loops next() returns NULL
+ * and each plane keeps its own thread.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class NvV4l2PollLoop;
+
+class DequeueLoops {
+
+    public:
+        static DequeueLoops& instance();
+
+        bool open(uint32_t count);
+        void close();
+
+        NvV4l2PollLoop *next();
+        uint32_t getCount();
+        std::string getReport();
+
+    private:
+        DequeueLoops();
+        ~DequeueLoops();
+        DequeueLoops(const DequeueLoops&);
+        DequeueLoops& operator=(const DequeueLoops&);
+
+        std::vector<NvV4l2PollLoop*> _loops;
+        uint32_t _next;
+        std::mutex _mutex;
+};
@@ -0,0 +1,67 @@
+/*
+ * DirectFile.hpp
+ *
+ * Keeps the page cache out of the write path so dirty pages from several
+ * cameras can never pile up into a writeback stall. A DirectFile opened in
+ * direct mode writes aligned blocks with O_DIRECT, straight from the page
+ * aligned BufferPool buffers where it can and through a small bounce buffer
+ * otherwise, padding the last block with zeros; close() trims the file to its
+ * real length. Where the file system refuses O_DIRECT (exFAT, tmpfs) it falls
+ * back to buffered writes kept bounded by a WriteBehind. Buffered mode is a
+ * plain pwrite, as before --direct-io existed.
+ *
+ * WriteBehind serves files written sequentially through their own fd: every
+ * window of new data is queued for writeback with sync_file_range, the window
+ * before it is waited for and dropped from the page cache with posix_fadvise,
+ * so at most two windows per file are ever cached.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DIRECT_IO_ALIGN 4096U               // O_DIRECT offset, length and address alignment
+#define DIRECT_IO_BOUNCE (1U << 20)         // bounce buffer for unaligned sources
+#define WRITE_BEHIND_WINDOW (8ULL << 20)    // bytes cached per file before writeback is forced
+
+class WriteBehind {
+
+    public:
+        WriteBehind();
+
+        void reset(int fd, uint64_t window);
+        void written(uint64_t end);
+        void finish();
+
+    private:
+        int _fd;
+        uint64_t _window;
+        uint64_t _queued;   // end of the range queued for writeback
+        uint64_t _dropped;  // end of the range dropped from the page cache
+};
+
+class DirectFile {
+
+    public:
+        DirectFile();
+        ~DirectFile();
+
+        static uint64_t align(uint64_t size);
+
+        bool open(const char *filename, bool direct);
+        bool preallocate(uint64_t offset, uint64_t length);
+        bool write(const void *data, size_t size, uint64_t offset);
+        bool close(uint64_t size);
+        int release(uint64_t size);
+        bool sync();
+        bool isDirect() const;
+
+    private:
+        int _fd;
+        bool _direct;       // O_DIRECT is in effect
+        bool _writeBehind;  // buffered fallback for direct mode
+        bool _trim;         // padded or preallocated, close() truncates to the real length
+        uint8_t *_bounce;
+        WriteBehind _behind;
+};
@@ -0,0 +1,75 @@
+/*
+ * DmabufRing.hpp
+ *
+ * A fixed ring of NvBuffers (dmabufs) for one camera, created once from the
+ * first acquired image and then recycled. The consumer copies each saved frame
+ * into a free slot and hands the slot to the encoder, which returns it when
+ * done, so the VIC copy of the next frame can overlap the current encode.
+ *
+ * For a buffer stream the ring also owns the capture targets: slots from
+ * getCopyCount() on wrap NvBuffers that Argus captures into directly. The
+ * consumer hands such a slot downstream as is, and releasing it gives the
+ * buffer back to Argus for the next capture instead of the free list.
+ * retain() adds a reader to a slot held downstream, such as a process the
+ * frame is shared with, and the slot only returns once every reader released it.
+ *
+ * Encoders read block-linear buffers, the raw writer maps pitch-linear ones in
+ * the --raw-layout, so the VIC copy into a slot is also the layout conversion.
+ * A --grayscale camera's slots hold the luma plane alone, the copy drops the chroma.
+ * With --raw-layout bayer12 every slot is one GRAY8 plane of packed Bayer rows.
+ */
+
+#pragma once
+
+#include "BoundedQueue.hpp"
+#include <Argus/Argus.h>
+#include <EGLStream/NV/ImageNativeBuffer.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <nvbuf_utils.h>
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+class Options;
+
+class DmabufRing {
+
+    public:
+        explicit DmabufRing(uint32_t count, uint32_t captureCount = 0);
+        ~DmabufRing();
+
+        static NvBufferColorFormat getColorFormat(const Options& options, uint32_t id);
+        static NvBufferLayout getLayout(const Options& options);
+
+        bool allocate(const EGLStream::NV::IImageNativeBuffer *image, Argus::Size2D<uint32_t> size,
+                      NvBufferColorFormat format, NvBufferLayout layout);
+        bool allocate(Argus::OutputStream *stream, EGLDisplay display, Argus::Size2D<uint32_t> size,
+                      NvBufferColorFormat format, NvBufferLayout layout);
+        bool allocate(Argus::Size2D<uint32_t> size, NvBufferColorFormat format, NvBufferLayout layout);
+        bool isAllocated() const;
+
+        bool acquire(uint32_t& slot, int& fd);
+        Argus::Buffer *acquireCapture(uint64_t timeout, Argus::Status *status, uint32_t& slot, int& fd);
+        void retain(uint32_t slot);
+        void release(uint32_t slot);
+        int getFd(uint32_t slot) const;
+
+        uint32_t getCount() const;
+        uint32_t getCopyCount() const;
+        uint32_t getCapturesHeld() const;
+        size_t getAvailable();
+
+    private:
+        uint32_t _count;
+        uint32_t _captureCount;
+        std::vector<int> _fds;
+        bool _allocated;
+        BoundedQueue<uint32_t> _free;
+        Argus::IBufferOutputStream *_stream;
+        EGLDisplay _display;
+        std::vector<EGLImageKHR> _images;
+        std::vector<Argus::Buffer*> _buffers;
+        std::atomic<uint32_t> _capturesHeld;
+        std::vector<std::atomic<uint32_t> > _retains;  // readers beyond the first still holding each slot
+};
@@ -0,0 +1,117 @@
+/*
+ * EncodeScheduler.hpp
+ *
+ * Shares a small number of JPEG encoder workers between all cameras. The TX2
+ * has a single NVJPG engine, so instead of six encoders contending for it in
+ * no particular order, each camera submits its dmabufs to an EncodeChannel and
+ * the workers service the channels round-robin, oldest-frame-first, or each
+ * worker its own cameras first, stealing from the others when idle. Each
+ * channel holds its camera's JPEG quality, steered towards a bytes per image
+ * budget if one is set. With --proxy the workers also encode a small proxy
+ * of each frame from the same dmabuf into the channel's proxy container,
+ * but only with time to spare. Per camera wait times, proxy costs and per
+ * worker engine utilisation are logged at shutdown.
+ */
+
+#pragma once
+
+#include "BoundedQueue.hpp"
+#include "FrameSink.hpp"
+#include "QualityController.hpp"
+#include "LatencyHistogram.hpp"
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+class Options;
+class Logger;
+class DmabufRing;
+class FrameWriter;
+class EncodeWorker;
+class EncodeScheduler;
+class ContainerFile;
+class ExifHeader;
+
+/* A frame waiting in a channel, stamped with its submission time */
+struct ScheduledJob {
+    FrameJob job;
+    uint64_t submitted; // steady clock ns
+};
+
+/* One camera's queue into the scheduler, used by the consumer as its FrameSink */
+class EncodeChannel : public FrameSink {
+
+    public:
+        EncodeChannel(uint32_t id, DmabufRing& ring, FrameWriter& writer, EncodeScheduler& scheduler,
+                      int quality, uint64_t budget);
+        virtual ~EncodeChannel();
+
+        virtual bool submit(const FrameJob& job);
+        virtual bool hasFailed();
+        virtual uint64_t getFramesWritten();
+        virtual uint64_t getBytesWritten();
+        virtual size_t getQueueDepth();
+        virtual const LatencyHistogram *getLatency();
+
+        void drain();
+        int getQuality() const;
+        void setQuality(int quality);
+
+    private:
+        friend class EncodeScheduler;
+        friend class EncodeWorker;
+
+        uint32_t _id;
+        DmabufRing& _ring;
+        FrameWriter& _writer;
+        EncodeScheduler& _scheduler;
+        BoundedQueue<ScheduledJob> _jobs;
+        std::atomic<uint32_t> _inFlight;
+        std::atomic<bool> _failed;
+        std::atomic<uint64_t> _submitted;
+        std::atomic<uint64_t> _encoded;
+        std::atomic<uint64_t> _totalWait;
+        std::atomic<uint64_t> _maxWait;
+        LatencyHistogram _encodeLatency;
+        QualityController _quality;
+        ContainerFile *_proxies;    // contact sheet of proxy images, NULL without --proxy
+        ExifHeader *_exif;          // NULL without --exif
+        std::mutex _proxyMutex;
+        std::atomic<uint64_t> _proxiesWritten;
+        std::atomic<uint64_t> _proxiesSkipped;
+        LatencyHistogram _proxyLatency;
+};
+
+class EncodeScheduler {
+
+    public:
+        EncodeScheduler(const Options& options, uint32_t numCameras);
+        ~EncodeScheduler();
+
+        bool start();
+        void shutdown();
+
+        EncodeChannel *registerCamera(uint32_t id, DmabufRing& ring, FrameWriter& writer);
+
+        bool next(uint32_t worker, EncodeChannel*& channel, ScheduledJob& job, uint32_t timeoutMs);
+        void finished(EncodeChannel *channel, uint64_t waitNs);
+
+    private:
+        friend class EncodeChannel;
+        void notify();
+        int32_t pickOldest(uint32_t worker, bool own);
+        int32_t pickLongest();
+
+        const Options& _options;
+        Logger *_logger;
+        std::vector<EncodeChannel*> _channels;
+        std::vector<EncodeWorker*> _workers;
+        std::vector<uint64_t> _steals;  // jobs each worker took from another worker's cameras
+        uint32_t _next;
+        uint64_t _pending;
+        std::mutex _mutex;
+        std::condition_variable _ready;
+        std::condition_variable _drained;
+};
@@ -0,0 +1,55 @@
+/*
+ * EncodeWorker.hpp
+ *
+ * One JPEG encoder thread owned by the EncodeScheduler. Each worker has its own
+ * NvJPEGEncoder, takes the next job the scheduler picks, encodes it into a
+ * buffer from that camera's FrameWriter and returns the dmabuf to its ring.
+ * With --proxy it encodes the same dmabuf a second time, scaled down, into its
+ * own buffer and appends it to the camera's proxy container, unless frames are
+ * waiting for the camera or proxies have used up their share of its time.
+ */
+
+#pragma once
+
+#include "Thread.h"
+#include "AllocCounters.hpp"
+#include <stdint.h>
+#include <atomic>
+
+class Options;
+class Logger;
+class NvJPEGEncoder;
+class EncodeScheduler;
+class EncodeChannel;
+struct ScheduledJob;
+
+class EncodeWorker : public ArgusSamples::Thread {
+
+    public:
+        explicit EncodeWorker(uint32_t id, const Options& options, EncodeScheduler& scheduler);
+        virtual ~EncodeWorker();
+
+        double getUtilisation();
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        bool processV4L2Fd(EncodeChannel *channel, const ScheduledJob& job);
+        void encodeProxy(EncodeChannel *channel, const ScheduledJob& job);
+
+        uint32_t _id;
+        const Options& _options;
+        Logger *_logger;
+        NvJPEGEncoder *_jpegEncoder;
+        EncodeScheduler& _scheduler;
+        std::atomic<uint64_t> _started;
+        std::atomic<uint64_t> _busy;
+        unsigned char *_proxyBuffer;
+        unsigned long _proxyCapacity;
+        uint64_t _proxyBusy;    // ns spent on proxies
+        bool _proxyFailed;      // a proxy failure was logged
+        AllocCounters _counters;
+};
@@ -0,0 +1,47 @@
+/*
+ * ExifHeader.hpp
+ *
+ * The APP1/EXIF segment --exif puts into every saved JPEG image, so
+ * photogrammetry software reads the capture time, exposure and camera from
+ * the images themselves. The segment is laid out once per camera: Make,
+ * Model and BodySerialNumber name the camera, and every field that changes
+ * per frame sits at an offset known in advance. write() copies the template
+ * and patches the capture time, exposure time, ISO and image number in
+ * place, a copy of a few hundred bytes and no formatting beyond the date.
+ *
+ * The segment is spliced in without moving the encoded image: the encoder
+ * writes behind getSize() bytes of headroom, and write() puts the SOI
+ * marker and the segment in front of it, overwriting the encoder's own SOI
+ * marker with the segment's last two bytes.
+ *
+ * Times are UTC, taken from the sensor timestamp moved onto the wall clock
+ * by the offset between CLOCK_REALTIME and CLOCK_MONOTONIC at startup.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EXIF_HEADER_MAX 512U // bytes of the APP1 segment, its markers included
+
+class ExifHeader {
+
+    public:
+        explicit ExifHeader(uint32_t camera);
+
+        size_t getSize() const;
+        void write(unsigned char *destination, uint64_t index, uint64_t timestamp, uint64_t exposureTime,
+                   float gain) const;
+
+    private:
+        unsigned char _template[EXIF_HEADER_MAX];  // SOI marker then the APP1 segment
+        size_t _size;               // of the APP1 segment
+        int64_t _wallOffset;        // CLOCK_REALTIME - CLOCK_MONOTONIC in ns
+        size_t _dateTime;           // offsets of the fields patched per frame
+        size_t _dateTimeOriginal;
+        size_t _subSecTime;
+        size_t _exposureTime;
+        size_t _iso;
+        size_t _imageNumber;
+};
@@ -0,0 +1,51 @@
+/*
+ * ExposureGate.hpp
+ *
+ * Recognises frames that are too dark or too bright to be of use, the rover
+ * driving into a tunnel or facing the sun, from the Bayer histogram the ISP
+ * already computed for every capture, so no pixel is touched. The share of
+ * green samples in the bins at the bottom and at the top of the range is
+ * compared with the threshold; a WDR sensor's compressed histogram is read
+ * through the normalized bin values of Ext::INonLinearHistogram. The consumer
+ * skips a failing frame before it is copied, or encodes it at a low quality.
+ * Verdicts are counted per camera, captures without a histogram are counted
+ * as unmeasured and pass.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+namespace Argus { class ICaptureMetadata; }
+
+/* Verdicts of ExposureGate::evaluate() */
+enum ExposureVerdict {
+    EXPOSURE_USABLE,
+    EXPOSURE_BLACK,
+    EXPOSURE_SATURATED
+};
+
+class ExposureGate {
+
+    public:
+        ExposureGate(double threshold);
+
+        ExposureVerdict evaluate(const Argus::ICaptureMetadata *iMetadata);
+
+        uint64_t getFramesBlack() const;
+        uint64_t getFramesSaturated() const;
+        uint64_t getFramesUnmeasured() const;
+        double getLastBlack() const;
+        double getLastSaturated() const;
+
+    private:
+        double _threshold;          // share of samples, 0-1
+        std::atomic<uint64_t> _black;
+        std::atomic<uint64_t> _saturated;
+        std::atomic<uint64_t> _unmeasured;
+        double _lastBlack;
+        double _lastSaturated;
+        std::vector<float> _binValues;  // normalized value of each bin, linear unless the histogram is compressed
+};
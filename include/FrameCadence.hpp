@@ -0,0 +1,48 @@
+/*
+ * FrameCadence.hpp
+ *
+ * Accounts the frames a camera's sensor produced that never reached its
+ * consumer, and how evenly the rest arrived. The consumer observes every frame
+ * it acquires with the sensor timestamp and frame duration of its capture
+ * metadata, its IFrame number on an EGLStream and the internal frame count
+ * where Argus reports one. A sensor timestamp delta over 1.5 frame durations
+ * counts the periods in between as lost, a frame number gap counts the frames the stream replaced
+ * before the consumer took them, and an internal frame count gap the captures
+ * Argus made into no buffer because the consumer still held them all. The
+ * deviation of every delta from the frame period goes to a jitter histogram.
+ * Observing is single threaded, the getters may be called from any thread.
+ */
+
+#pragma once
+
+#include "LatencyHistogram.hpp"
+#include <stdint.h>
+#include <atomic>
+
+class FrameCadence {
+
+    public:
+        explicit FrameCadence(uint64_t frameDuration);
+
+        void observe(uint64_t timestamp, uint64_t frameDuration, uint64_t frameNumber, uint64_t internalCount);
+
+        uint64_t getFrames() const;
+        uint64_t getPeriodsLost() const;
+        uint64_t getFramesReplaced() const;
+        uint64_t getInternalCaptures() const;
+        double getSensorFps() const;
+        const LatencyHistogram *getJitter() const;
+
+    private:
+        uint64_t _frameDuration;    // ns per frame for frames whose metadata has none
+        uint64_t _firstTimestamp;
+        uint64_t _lastTimestamp;    // 0 until the first frame
+        uint64_t _lastNumber;
+        uint64_t _lastInternal;
+        std::atomic<uint64_t> _frames;
+        std::atomic<uint64_t> _periodsLost;
+        std::atomic<uint64_t> _framesReplaced;
+        std::atomic<uint64_t> _internalCaptures;
+        std::atomic<double> _sensorFps;
+        LatencyHistogram _jitter;   // |delta - frame duration| in us
+};
@@ -0,0 +1,83 @@
+/*
+ * FramePublisher.hpp
+ *
+ * Shares the frames the consumers save with other processes at no copy cost.
+ * Each consumer offers a ring slot right before submitting it; the publisher
+ * retains the slot as the camera's newest frame and its thread sends the
+ * slot's dmabuf fd with a SharedFrame (see SharedFrame.hpp) over SCM_RIGHTS
+ * to every subscriber of the --share socket not still reading an earlier
+ * frame of that camera. The slot goes back to the ring once the sink and
+ * every subscriber who got it have released it. At most --share-slots slots
+ * per camera are held for subscribers, offers beyond and sends to a full
+ * socket are skipped, so a slow subscriber can never stall the recording.
+ */
+
+#pragma once
+
+#include "Thread.h"
+#include <stdint.h>
+#include <poll.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+class Options;
+class Logger;
+class DmabufRing;
+
+class FramePublisher : public ArgusSamples::Thread {
+
+    public:
+        explicit FramePublisher(const Options& options, uint32_t numCameras);
+        virtual ~FramePublisher();
+
+        bool offer(uint32_t camera, DmabufRing& ring, uint32_t slot, uint64_t index, uint64_t timestamp);
+
+        uint64_t getFramesShared();
+        uint32_t getSubscriberCount();
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        /* A ring slot held for subscribers */
+        struct Held {
+            DmabufRing *ring;   // NULL if nothing is held
+            uint32_t slot;
+            uint64_t token;
+            uint64_t index;
+            uint64_t timestamp;
+        };
+
+        /* A connected subscriber and the frame of each camera it is reading */
+        struct Subscriber {
+            int fd;
+            std::vector<Held> reading;
+        };
+
+        void acceptSubscribers();
+        bool receive(Subscriber& subscriber);
+        void sendNewest();
+        bool sendFrame(Subscriber& subscriber, uint32_t camera, const Held& held);
+        void drop(Held& held, uint32_t camera);
+        void disconnect(size_t index);
+
+        const Options& _options;
+        uint32_t _numCameras;
+        Logger *_logger;
+        int _fd;
+        int _eventFd;                       // counts offers, wakes the thread to send them
+        std::mutex _mutex;
+        bool _open;                         // offers are taken, cleared at shutdown
+        std::vector<Held> _newest;          // per camera, not yet sent to every idle subscriber
+        std::vector<uint32_t> _held;        // per camera, slots held by the newest and the subscribers
+        std::vector<Subscriber> _subscribers;
+        std::vector<struct pollfd> _events; // threadExecute()'s and sendNewest()'s, kept so
+        std::vector<size_t> _idle;          // the thread allocates nothing per frame
+        uint64_t _nextToken;
+        std::atomic<uint32_t> _subscriberCount;
+        std::atomic<uint64_t> _framesShared;
+        std::atomic<uint64_t> _framesSkipped;
+};
@@ -0,0 +1,74 @@
+/*
+ * FrameSetCollector.hpp
+ *
+ * A thread that groups the frames saved by every consumer into frame sets by
+ * sensor timestamp, so each line of sets.csv names the image every camera took
+ * at the same moment. Consumers report a saved frame with add(), which only
+ * pushes onto that camera's fixed-size SpscRing, the consumer its one
+ * producer and the collector its one consumer. The collector anchors a set on
+ * the oldest pending frame and takes each camera's frame within the tolerance
+ * window. A set missing a camera is either dropped or written with that entry
+ * empty, depending on the set policy. On a --leader or --follow board every
+ * set written is also handed to the ClusterLink, which pairs it with the
+ * other boards' sets.
+ *
+ * File format: set,timestamp,cam0,...,camN with the image index of each camera
+ */
+
+#pragma once
+
+#include "Thread.h"
+#include "RingQueue.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <atomic>
+
+#define SET_POLICY_DROP 0
+#define SET_POLICY_PARTIAL 1
+
+class Options;
+class Logger;
+class ClusterLink;
+
+/* One saved frame waiting to be grouped */
+struct SetEntry {
+    uint64_t timestamp;     // sensor timestamp in ns
+    uint64_t index;         // index the frame was saved under
+};
+
+class FrameSetCollector : public ArgusSamples::Thread {
+
+    public:
+        FrameSetCollector(const Options& options, uint32_t numCameras, ClusterLink *cluster);
+        virtual ~FrameSetCollector();
+
+        bool add(uint32_t camera, uint64_t timestamp, uint64_t index);
+
+        uint64_t getSetsWritten();
+        uint64_t getSetsIncomplete();
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        bool collect(bool flush);
+        bool writeSet(uint64_t timestamp, const std::vector<SetEntry>& heads, const std::vector<bool>& members);
+
+        const Options& _options;
+        uint32_t _numCameras;
+        uint64_t _tolerance;
+        ClusterLink *_cluster;
+        Logger *_logger;
+        FILE *_file;
+        std::vector<SpscRing<SetEntry>*> _queues;
+        std::vector<SetEntry> _heads;
+        std::vector<bool> _present;
+        std::vector<bool> _members;
+        uint64_t _sets;
+        std::atomic<uint64_t> _setsWritten;
+        std::atomic<uint64_t> _setsIncomplete;
+        std::atomic<bool> _failed;
+};
@@ -0,0 +1,46 @@
+/*
+ * FrameSink.hpp
+ *
+ * The stage a ConsumerThread hands its copied dmabufs to. A sink takes a ring
+ * slot with submit(), processes it on its own thread and releases the slot
+ * back to the DmabufRing when it no longer reads from the buffer. The getters
+ * feed the status file and may be called from any thread.
+ */
+
+#pragma once
+
+#include "TelemetryLog.hpp"
+#include "LatencyHistogram.hpp"
+#include <stdint.h>
+#include <stddef.h>
+
+#define JPEG_QUALITY 75 // NvJPEGEncoder's default
+
+/* One copied frame waiting to be processed */
+struct FrameJob {
+    int fd;
+    uint32_t slot;
+    uint64_t index;
+    uint64_t timestamp;
+    uint64_t sensorTimestamp;   // ns, read with frame sets, --metadata or --exif
+    uint64_t submitted;         // steady clock ns when handed to the sink
+    int quality;                // JPEG quality to encode at, lowered under backpressure
+    uint64_t exposureTime;      // ns, from the capture metadata with --exif
+    float gain;                 // analog times ISP digital gain, with --exif
+    TelemetryRecord telemetry; // filled in by each stage the frame passes
+};
+
+class FrameSink {
+
+    public:
+        virtual ~FrameSink() {}
+
+        virtual bool submit(const FrameJob& job) = 0;
+        virtual bool hasFailed() = 0;
+        virtual uint64_t getFramesWritten() = 0;
+        virtual uint64_t getBytesWritten() = 0;
+        virtual size_t getQueueDepth() = 0;
+
+        /* Per-frame processing latency, NULL if the sink does not track it */
+        virtual const LatencyHistogram *getLatency() { return NULL; }
+};
@@ -0,0 +1,160 @@
+/*
+ * FrameWriter.hpp
+ *
+ * A thread that writes one camera's encoded images to disk. The consumer checks
+ * out a buffer from the camera's BufferPool, encodes into it and submits it;
+ * the writer returns the buffer to the pool once it is on disk. Slow storage
+ * only ever costs dropped frames, never a stalled acquire loop. Queue occupancy
+ * and drop counts are kept for sizing. Images are written one file each, or
+ * appended to a ContainerFile when a container size is set. With telemetry
+ * enabled the writer appends each frame's completed TelemetryRecord. Given a
+ * VolumeSet, each image goes to the volume it selects and a failed write is
+ * retried on the next volume with room. With --aio each image file is written
+ * with O_DIRECT through an AioQueue, keeping several writes in flight and
+ * finishing them in batches as they complete. The CRC32C of every image
+ * written to a file of its own is appended to camN/checksums.csv in the root
+ * directory, container images carry theirs in the container index. Every
+ * --sync-interval ms a GroupCommit makes the images written since the last
+ * one durable together and moves camN/committed up. With --segment the files
+ * of a segment are closed once its writes are done, and the same files are
+ * opened in the next segment's directories. Given a QuickLookServer, every
+ * image written is published to it. With --restart-rows the offsets of each
+ * image's restart markers are appended to camN/restarts.csv. With --fanout
+ * image files go into numbered sub-directories of --fanout images each, the
+ * next one made as soon as the first image of the current one is written.
+ */
+
+#pragma once
+
+#include "Thread.h"
+#include "BoundedQueue.hpp"
+#include "TelemetryLog.hpp"
+#include "DirectFile.hpp"
+#include "LatencyHistogram.hpp"
+#include "AllocCounters.hpp"
+#include "GroupCommit.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+class Options;
+class Logger;
+class BufferPool;
+class ContainerFile;
+class VolumeSet;
+class AioQueue;
+class QuickLookServer;
+
+/* One encoded image travelling from the consumer to the writer */
+struct EncodedFrame {
+    unsigned char *data;
+    unsigned long size;
+    uint64_t index;
+    uint64_t timestamp;
+    uint32_t slot;
+    uint64_t submitted;         // steady clock ns when queued for writing
+    TelemetryRecord telemetry;
+};
+
+class FrameWriter : public ArgusSamples::Thread {
+
+    public:
+        explicit FrameWriter(uint32_t id, const Options& options, BufferPool& pool, TelemetryLog *telemetry,
+                             VolumeSet *volumes, QuickLookServer *quickLook = NULL);
+        virtual ~FrameWriter();
+
+        bool getBuffer(EncodedFrame& frame);
+        bool submit(const EncodedFrame& frame);
+        void returnBuffer(const EncodedFrame& frame);
+        void record(const TelemetryRecord& telemetry);
+        bool hasFailed();
+
+        size_t getQueueDepth();
+        size_t getQueueHighWater();
+        uint32_t getQueueCapacity();
+        uint64_t getFramesWritten();
+        uint64_t getBytesWritten();
+        uint64_t getFramesDropped();
+        uint32_t getWritesInFlight();
+        const LatencyHistogram *getWriteLatency();
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        /* An image whose write is queued on the AioQueue, indexed by its pool slot */
+        struct AioWrite {
+            EncodedFrame frame;
+            int fd;
+            int volume;
+            uint64_t start;         // steady clock ns the writer took the frame
+        };
+
+        void processFrame(EncodedFrame& frame);
+        void finishFrame(EncodedFrame& frame, uint64_t start, bool success);
+        void executeAio(bool wait);
+        bool queueWrite(const EncodedFrame& frame, uint64_t start);
+        void completeWrite(AioWrite& write, int64_t result);
+        bool writeFrame(const EncodedFrame& frame);
+        bool writeFile(const EncodedFrame& frame, int volume);
+        const char *formatPath(int volume, uint64_t index);
+        void recordChecksum(const EncodedFrame& frame, int volume);
+        void recordRestarts(const EncodedFrame& frame);
+        void publishImage(const EncodedFrame& frame, int volume);
+        bool openContainer();
+        bool openChecksums();
+        bool openRestarts();
+        bool enterSegment(const EncodedFrame& frame);
+        bool startSegment(uint32_t segment);
+        void drainAio();
+        std::string getRunDirectory(int volume);
+        void commitWrites();
+        uint64_t getLowestInFlight();
+        int getDirectory(int volume, uint64_t index);
+        bool makeShards(int volume, uint64_t shard);
+        void enterShard(int volume, uint64_t index);
+        void prepareShard(int volume, uint64_t index);
+        bool makeFirstShards(uint64_t index);
+
+        uint32_t _id;
+        const Options& _options;
+        Logger *_logger;
+        BufferPool& _pool;
+        ContainerFile *_container;
+        int _containerVolume;
+        TelemetryLog *_telemetry;
+        VolumeSet *_volumes;
+        QuickLookServer *_quickLook;
+        FILE *_checksums;
+        FILE *_restarts;
+        std::vector<uint32_t> _restartOffsets; // of the last image, kept to reuse its capacity
+        uint64_t _restartMarkers;
+        uint64_t _restartImages;
+        bool _restartsLogged;       // an image without restart markers was logged
+        DirectFile _file;           // reused for every image written synchronously
+        char _path[FILENAME_MAX];   // the last image's path, the prefix up to its index is kept
+        size_t _pathPrefix;
+        int _pathVolume;            // volume the prefix is formatted for, -1 for the root directory
+        bool _directLogged;
+        AioQueue *_aio;
+        bool _aioRefused;           // O_DIRECT unsupported, every image is written synchronously
+        std::vector<AioWrite> _aioWrites;
+        BoundedQueue<EncodedFrame> _pending;
+        std::atomic<uint64_t> _framesWritten;
+        std::atomic<uint64_t> _bytesWritten;
+        std::atomic<uint64_t> _framesDropped;
+        std::atomic<bool> _failed;
+        LatencyHistogram _writeLatency;
+        AllocCounters _counters;
+        GroupCommit _commit;
+        std::vector<int> _directories;  // camera directory fds synced by the commits, by volume + 1
+        std::vector<int64_t> _directoryShards;  // with --fanout, the sub-directory each of them is
+        std::vector<int> _retired;      // sub-directory fds the next commit may still sync
+        uint32_t _segment;          // with --segment, the one the writer is in
+        std::vector<int64_t> _shards;   // with --fanout, the last sub-directory made, by volume + 1
+        uint64_t _lateShards;       // sub-directories made just before their first image
+};
@@ -0,0 +1,63 @@
+/*
+ * GroupCommit.hpp
+ *
+ * Makes one writer's images crash safe in batches instead of one fsync per
+ * image. The writer hands over the fd of every image file it finishes, and
+ * the directories it created them in; every --sync-interval ms commit()
+ * fdatasyncs the files together, fsyncs the directories so their entries
+ * survive too, closes the files and then records the highest image index
+ * known durable in camN/committed. After a power loss every image up to that
+ * index is on disk, the ones after it may be lost. Container segments are
+ * synced by the writer as part of the same commit. A failed sync leaves its
+ * batch's images in doubt for good, fdatasync does not write them again, so
+ * the mark stays below the lowest of them until the next segment.
+ *
+ * File format: the durable index, 20 digits and a newline, rewritten in place
+ */
+
+#pragma once
+
+#include "LatencyHistogram.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define GROUP_COMMIT_NONE UINT64_MAX // no image committed yet
+
+class GroupCommit {
+
+    public:
+        GroupCommit();
+        ~GroupCommit();
+
+        bool open(const std::string& markPath, uint32_t intervalMs);
+        bool reopen(const std::string& markPath);
+        bool isOpen() const;
+
+        void addFile(int fd, uint64_t index);
+        void addDirectory(int fd);
+        void written(uint64_t index);
+        bool isDue(uint64_t now) const;
+        bool commit(uint64_t now, uint64_t limit, int syncError);
+
+        uint64_t getCommits() const;
+        uint64_t getFilesSynced() const;
+        uint64_t getDurableIndex() const;
+        int getError() const;
+        const LatencyHistogram& getLatency() const;
+
+    private:
+        uint64_t _intervalNs;
+        int _markFd;
+        std::vector<int> _files;        // written since the last commit, closed by it
+        std::vector<int> _directories;  // not owned, with new entries since the last commit
+        uint64_t _pendingSince;         // steady clock ns of the first write since the last commit, 0 if none
+        uint64_t _highest;              // highest index written since the first commit
+        uint64_t _lowest;               // lowest index written since the last commit
+        uint64_t _ceiling;              // the mark stays below, the lowest index of a batch whose sync failed
+        uint64_t _durable;
+        int _error;                     // errno of the last failed commit, 0 if none
+        uint64_t _commits;
+        uint64_t _filesSynced;
+        LatencyHistogram _latency;
+};
@@ -0,0 +1,104 @@
+/*
+ * LatencyHistogram.hpp
+ *
+ * A fixed-size, log-bucketed histogram of latencies in microseconds. Each power
+ * of two is split into LATENCY_SUB_BUCKETS linear buckets, so any recorded value
+ * lands in a bucket within 12.5% of it. Recording is a couple of relaxed atomic
+ * increments with no locks or allocation, so it is safe from any thread on the
+ * hot path; percentiles are read by scanning the buckets.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#define LATENCY_SUB_BUCKET_BITS 3
+#define LATENCY_SUB_BUCKETS (1U << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_MAX_BITS 32 // values are clamped to 2^32 - 1 us, over an hour
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+class LatencyHistogram {
+
+    public:
+        LatencyHistogram() {
+            reset();
+        }
+
+        /* Add one sample */
+        void record(uint64_t us) {
+            if (us > UINT32_MAX)
+                us = UINT32_MAX;
+            _buckets[getBucket(us)].fetch_add(1, std::memory_order_relaxed);
+            _count.fetch_add(1, std::memory_order_relaxed);
+            _total.fetch_add(us, std::memory_order_relaxed);
+            uint64_t max = _max.load(std::memory_order_relaxed);
+            while (us > max && !_max.compare_exchange_weak(max, us, std::memory_order_relaxed));
+        }
+
+        /* Upper bound of the bucket holding the p-th percentile, p in [0, 100] */
+        uint64_t getPercentile(double p) const {
+            uint64_t count = getCount();
+            if (count == 0)
+                return 0;
+            uint64_t rank = (uint64_t) (p / 100.0 * count + 0.5);
+            if (rank < 1)
+                rank = 1;
+            uint64_t seen = 0;
+            for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+                seen += _buckets[i].load(std::memory_order_relaxed);
+                if (seen >= rank) {
+                    uint64_t bound = getBucketLimit(i);
+                    uint64_t max = getMax();
+                    return bound < max ? bound : max;
+                }
+            }
+            return getMax();
+        }
+
+        uint64_t getCount() const {
+            return _count.load(std::memory_order_relaxed);
+        }
+
+        uint64_t getMax() const {
+            return _max.load(std::memory_order_relaxed);
+        }
+
+        uint64_t getMean() const {
+            uint64_t count = getCount();
+            return count ? _total.load(std::memory_order_relaxed) / count : 0;
+        }
+
+        /* Not synchronised with record(), call while no samples are being added */
+        void reset() {
+            for (uint32_t i = 0; i < LATENCY_BUCKETS; i++)
+                _buckets[i].store(0, std::memory_order_relaxed);
+            _count.store(0, std::memory_order_relaxed);
+            _total.store(0, std::memory_order_relaxed);
+            _max.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        /* Values below LATENCY_SUB_BUCKETS map 1:1, above that by exponent and the next bits */
+        static uint32_t getBucket(uint64_t us) {
+            if (us < LATENCY_SUB_BUCKETS)
+                return us;
+            uint32_t msb = 63 - __builtin_clzll(us);
+            uint32_t shift = msb - LATENCY_SUB_BUCKET_BITS;
+            return (shift + 1) * LATENCY_SUB_BUCKETS + ((us >> shift) & (LATENCY_SUB_BUCKETS - 1));
+        }
+
+        /* Largest value that maps to bucket i */
+        static uint64_t getBucketLimit(uint32_t i) {
+            if (i < LATENCY_SUB_BUCKETS)
+                return i;
+            uint32_t shift = i / LATENCY_SUB_BUCKETS - 1;
+            uint64_t base = (uint64_t) (LATENCY_SUB_BUCKETS + i % LATENCY_SUB_BUCKETS) << shift;
+            return base + (1ULL << shift) - 1;
+        }
+
+        std::atomic<uint64_t> _buckets[LATENCY_BUCKETS];
+        std::atomic<uint64_t> _count;
+        std::atomic<uint64_t> _total;
+        std::atomic<uint64_t> _max;
+};
@@ -0,0 +1,73 @@
+/*
+ * LogSink.hpp
+ *
+ * The single sink behind every Logger. Formatted records are pushed into a
+ * fixed lock-free MpmcRing by any thread and a background thread appends them to
+ * their log files in batches, keeping one handle open per file. A full ring
+ * drops the record rather than blocking the caller. flush() writes everything
+ * queued so far synchronously and is used for errors and at exit.
+ *
+ * captureLibrary() routes the multimedia API's own NvLogging messages, which
+ * otherwise go to std::cerr from the encoder threads, into a log file too.
+ */
+
+#pragma once
+
+#include "Thread.h"
+#include "RingQueue.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#define LOG_RING_SIZE 1024U // records
+#define LOG_RECORD_SIZE 244U // longer messages are truncated
+
+class LogSink : public ArgusSamples::Thread {
+
+    public:
+        static LogSink& instance();
+
+        int open(const std::string& path);
+        bool write(int file, const std::string& s);
+        void flush();
+
+        void captureLibrary(const std::string& path);
+
+        uint64_t getDropped();
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        LogSink();
+        virtual ~LogSink();
+        LogSink(const LogSink&);
+        LogSink& operator=(const LogSink&);
+
+        /* One record in the ring, written and read in place */
+        struct Record {
+            int32_t file;
+            uint32_t length;
+            char text[LOG_RECORD_SIZE];
+        };
+
+        void drain();
+
+        static void writeLibrary(int level, const std::string& message);
+
+        MpmcRing<Record> _ring;
+        std::atomic<int> _libraryFile;
+        std::vector<std::string> _paths;
+        std::vector<FILE*> _files;
+        std::mutex _filesMutex;
+        std::mutex _drainMutex;
+        std::mutex _wakeMutex;
+        std::condition_variable _wake;
+        std::once_flag _started;
+};
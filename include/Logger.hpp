@@ -3,6 +3,8 @@
  *
  * This class provides a singular object for handling logging operations.
  * Use Logger.log for low-priority i/o and Logger.error for high-priority.
+ * Records are handed to the shared LogSink, which writes them in the background;
+ * errors flush the sink before returning.
  */
 
 #pragma once
@@ -31,8 +33,11 @@ class Logger {
         void disableVerbose();
 
     private:
+        void openFile();
+
         std::string _name;
         std::string _directory;
         std::string _filename;
         bool _verbose;
+        int _file;
 };
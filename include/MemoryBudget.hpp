@@ -0,0 +1,103 @@
+/*
+ * MemoryBudget.hpp
+ *
+ * Accounts every NvBuffer and CPU-side buffer pool of the run against one
+ * budget, so six cameras' rings, FIFOs and write queues cannot exhaust the
+ * TX2's 8 GB shared with the GPU and the ISP mid-run. The App sizes each
+ * subsystem from the options before any camera starts with plan(), and
+ * check() fails startup with the size of each subsystem if they cannot fit
+ * in the --memory-budget or the memory available. While recording, every
+ * allocation goes through createNvBuffer() or allocate() and is refused once
+ * the budget is spent, the allocation sites report the failure as they would
+ * report the allocator's. With --mlock the CPU-side pools are locked into
+ * memory as they are allocated.
+ *
+ * Each subsystem's current and peak usage are kept, getReport() lists them
+ * next to the plan. Buffers Argus allocates itself are charged by estimate
+ * with reserve(), they cannot be measured. The multimedia API's USERPTR
+ * NvBuffer planes come from a pool the accountant owns and are charged as
+ * the pool takes them from the heap.
+ */
+
+#pragma once
+
+#include <Argus/Argus.h>
+#include <EGLStream/NV/ImageNativeBuffer.h>
+#include <nvbuf_utils.h>
+#include "NvBuffer.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+/* Subsystems usage is accounted to */
+enum MemorySubsystem {
+    MEMORY_RINGS,           // dmabuf rings: copy targets, capture targets, pre-trigger, share slots and TNR staging
+    MEMORY_EGL_STREAMS,     // Argus' own EGLStream buffers and FIFOs, estimated
+    MEMORY_ENCODER,         // encoder output pools
+    MEMORY_WRITERS,         // O_DIRECT bounce buffers
+    MEMORY_PREVIEW,         // preview, RTP, quick-look and motion gate buffers
+    MEMORY_PLANES,          // pooled USERPTR NvBuffer planes of the multimedia API
+    MEMORY_SUBSYSTEMS
+};
+
+class Options;
+
+class MemoryBudget {
+
+    public:
+        static MemoryBudget& instance();
+
+        void configure(uint64_t limit, bool lockPools);
+        static void plan(const Options& options, uint32_t numCameras, uint64_t planned[MEMORY_SUBSYSTEMS]);
+        bool check(const uint64_t planned[MEMORY_SUBSYSTEMS], std::string& message);
+
+        bool reserve(MemorySubsystem subsystem, uint64_t bytes);
+        void release(MemorySubsystem subsystem, uint64_t bytes);
+
+        int createNvBuffer(MemorySubsystem subsystem, NvBufferCreateParams& params);
+        int createNvBuffer(MemorySubsystem subsystem, const EGLStream::NV::IImageNativeBuffer *image,
+                           Argus::Size2D<uint32_t> size, NvBufferColorFormat format, NvBufferLayout layout);
+        void destroyNvBuffer(int fd);
+
+        void *allocate(MemorySubsystem subsystem, size_t size, size_t alignment);
+        void free(void *data);
+
+        uint64_t getUsed(MemorySubsystem subsystem);
+        uint64_t getPeak(MemorySubsystem subsystem);
+        std::string getReport();
+
+        static const char *getName(MemorySubsystem subsystem);
+
+    private:
+        MemoryBudget();
+
+        /* One accounted allocation */
+        struct Allocation {
+            MemorySubsystem subsystem;
+            uint64_t bytes;
+        };
+
+        bool fits(MemorySubsystem subsystem, uint64_t bytes);
+        int adopt(MemorySubsystem subsystem, int fd, Argus::Size2D<uint32_t> size);
+        bool exceeds(MemorySubsystem subsystem, uint64_t bytes);
+        bool charge(MemorySubsystem subsystem, uint64_t bytes);
+        void discharge(MemorySubsystem subsystem, uint64_t bytes);
+
+        static bool accountPlanes(int64_t bytes, void *data);
+
+        uint64_t _limit;            // bytes, 0 for no limit
+        bool _lock;
+        uint64_t _total;
+        uint64_t _peakTotal;
+        uint64_t _used[MEMORY_SUBSYSTEMS];
+        uint64_t _peak[MEMORY_SUBSYSTEMS];
+        uint64_t _planned[MEMORY_SUBSYSTEMS];
+        uint64_t _refused;          // allocations refused for the budget
+        std::string _lastRefusal;
+        std::map<int, Allocation> _nvBuffers;
+        std::map<void*, Allocation> _heap;
+        std::mutex _mutex;
+        NvBufferMemoryPool _planes;     // last, its idle planes are given back while the rest still exists
+};
@@ -0,0 +1,73 @@
+/*
+ * MetadataLog.hpp
+ *
+ * Stores the capture metadata of every saved image in cam<N>/metadata.bin as
+ * fixed-size binary records. The file is preallocated for the expected run
+ * length and memory-mapped, so appending a record is a store into the map with
+ * no formatting and no system call; the file only grows, by remapping, when a
+ * run outlasts its preallocation. The header's count is updated with every
+ * record so a file cut short by a crash still decodes. Decode with the
+ * MetadataDump tool.
+ *
+ * File layout: MetadataHeader, then MetadataRecord * count
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#define METADATA_MAGIC "UWMETA01"
+#define METADATA_STATE_UNKNOWN 0xff
+
+struct MetadataHeader {
+    char magic[8];
+    uint32_t camera;
+    uint32_t recordSize;    // sizeof(MetadataRecord) for forward compatibility
+    uint64_t count;         // records written so far
+};
+
+struct MetadataRecord {
+    uint64_t frameNumber;   // Argus frame number
+    uint64_t index;         // image index, matches the file numbering
+    uint64_t sensorTimestamp; // start of exposure in ns
+    uint64_t exposureTime;  // ns
+    uint64_t frameDuration; // ns
+    uint64_t readoutTime;   // ns
+    uint32_t captureId;     // shared by the frames of one request in a --sync-session
+    uint32_t awbCct;        // colour temperature in K
+    float analogGain;
+    float ispDigitalGain;
+    float sceneLux;
+    float awbGains[4];      // R, Gr, Gb, B
+    uint8_t aeState;        // inactive, searching, converged, flash required, timeout = 0-4
+    uint8_t awbState;       // inactive, searching, converged, locked = 0-3
+    uint8_t aeLocked;
+    uint8_t reserved;
+};
+
+class MetadataLog {
+
+    public:
+        MetadataLog(uint32_t id, std::string directory, uint64_t expectedRecords);
+        ~MetadataLog();
+
+        bool open();
+        bool append(const MetadataRecord& record);
+        bool close();
+
+        uint64_t getRecordCount() const;
+        uint64_t getGrowCount() const;
+
+    private:
+        bool map(uint64_t capacity);
+
+        uint32_t _id;
+        std::string _directory;
+        int _fd;
+        void *_map;
+        size_t _mapSize;
+        uint64_t _capacity;
+        uint64_t _growCount;
+};
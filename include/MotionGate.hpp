@@ -0,0 +1,68 @@
+/*
+ * MotionGate.hpp
+ *
+ * Skips frames that barely differ from the last frame kept, so a parked rover
+ * does not record thousands of identical images. Each candidate frame is
+ * downscaled by the VIC into a small pitch-linear NvBuffer, and the mean
+ * absolute difference of its luma against the last kept frame's is the score.
+ * A frame scoring below the threshold is skipped, unless nothing was kept for
+ * the keep interval, so the timeline keeps a frame every so often. Every run
+ * of skipped frames is appended to cam<N>/motion.csv once it ends, so the
+ * timeline stays reconstructable.
+ *
+ * File format: first_frame,last_frame,first_timestamp_ns,last_timestamp_ns,frames
+ */
+
+#pragma once
+
+#include "LatencyHistogram.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#define MOTION_GATE_WIDTH 128
+#define MOTION_GATE_HEIGHT 96
+
+namespace EGLStream { namespace NV { class IImageNativeBuffer; } }
+
+class MotionGate {
+
+    public:
+        MotionGate(uint32_t id, std::string directory, double threshold, uint64_t keepInterval);
+        ~MotionGate();
+
+        bool open();
+        bool evaluate(EGLStream::NV::IImageNativeBuffer *iNativeBuffer, int captureFd, uint64_t frameNumber,
+                      uint64_t timestamp, bool& keep);
+        bool close();
+
+        uint64_t getFramesSkipped() const;
+        double getLastScore() const;
+        const LatencyHistogram *getCost() const;
+        const std::string& getError() const;
+
+    private:
+        bool logRun();
+
+        uint32_t _id;
+        std::string _directory;
+        double _threshold;
+        uint64_t _keepInterval;
+        int _fd;
+        void *_mapping;
+        uint32_t _pitch;
+        std::vector<uint8_t> _reference;
+        bool _haveReference;
+        uint64_t _lastKept;
+        FILE *_file;
+        uint64_t _runFirstFrame;
+        uint64_t _runLastFrame;
+        uint64_t _runFirstTimestamp;
+        uint64_t _runLastTimestamp;
+        uint64_t _runFrames;
+        uint64_t _framesSkipped;
+        double _lastScore;
+        LatencyHistogram _cost;
+        std::string _error;
+};
@@ -37,6 +37,9 @@
 #define __NV_PROFILER_H__
 
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
 #include <pthread.h>
 #include <stdint.h>
 #include <sys/time.h>
@@ -55,11 +58,19 @@
  * Only one instance of NvApplicationProfiler object gets created for the application.
  * It can be accessed using getProfilerInstance().
  *
- * NvApplicationProfiler currently samples CPU usage and provides peak and average CPU
- * usage during the profiling duration. It requires that the CPU frequency be
- * constant over the entire duration. To force this, NvApplicationProfiler will start only
+ * NvApplicationProfiler samples CPU usage and provides peak and average CPU
+ * usage during the profiling duration. The process CPU usage requires that the
+ * CPU frequency be constant over the entire duration, so it is only measured
  * when the CPU governor is set to @b performance.
  *
+ * Each sample also records the utilisation and current frequency of every
+ * configured CPU core, the load or clock of the EMC, GPU, VIC and NVJPG engines
+ * where sysfs exposes them, and the temperature of every thermal zone. These
+ * are kept regardless of the governor, so throttling shows up as a drop in
+ * core frequency alongside a rise in temperature. Sources that are missing on
+ * the running kernel are skipped. If an output file is set, every sample is
+ * appended to it as one CSV row.
+ *
  * @defgroup l4t_mm_nvapplicationprofiler_group  Application Resource Profiler API
  * @ingroup aa_framework_api_group
  * @{
@@ -82,6 +93,21 @@ public:
         uint32_t num_cpu_cores;
         /** Operating frequency of the cpu in MHz. */
         uint32_t cpu_freq_mhz;
+        /** Peak utilisation of any single core during the profiling time. */
+        float peak_core_usage;
+        /** Lowest frequency sampled on any online core, in MHz. */
+        uint32_t min_cpu_freq_mhz;
+        /** Highest maximum frequency of any core, in MHz. */
+        uint32_t max_cpu_freq_mhz;
+        /** Peak GPU load during the profiling time, -1 if not available. */
+        float peak_gpu_load;
+        /** Peak EMC load during the profiling time, -1 if not available. */
+        float peak_emc_load;
+        /** Peak temperature of any thermal zone in degrees C,
+         *  -1 if not available. */
+        float peak_temperature;
+        /** Name of the thermal zone that reached peak_temperature. */
+        char peak_thermal_zone[32];
     } NvAppProfilerData;
 
     static const uint64_t DefaultSamplingInterval = 100;
@@ -109,6 +135,15 @@ public:
      */
     void stop();
 
+    /**
+     * Sets a file to which every sample is appended as a CSV row.
+     *
+     * Takes effect on the next start(). Pass NULL to stop writing samples.
+     *
+     * @param[in] path Path of the CSV file, truncated when the profiler starts.
+     */
+    void setOutputFile(const char *path);
+
     /**
      * Prints the profiler data to an output stream.
      *
@@ -148,6 +183,46 @@ private:
     uint32_t cpu_freq; /**< Operating frequency of CPU cores in MHz. */
     bool check_cpu_usage; /**< Flag indicating if cpu usage should be checked. */
 
+    /**
+     * Holds the previous /proc/stat reading of one core.
+     */
+    struct CoreSample
+    {
+        uint64_t busy;  /**< Jiffies spent outside idle and iowait. */
+        uint64_t total; /**< Total jiffies. */
+        bool valid;     /**< False until the core has been read once. */
+    };
+
+    /**
+     * Holds the sysfs files an engine's load and clock are read from.
+     */
+    struct EngineSource
+    {
+        std::string name;      /**< Column name, eg. "gpu". */
+        std::string load_path; /**< Load file, empty if not available. */
+        float load_scale;      /**< Multiplier to convert the load to percent,
+                                    0 if the load is relative to the clock. */
+        std::string rate_path; /**< Clock rate file in Hz, empty if not
+                                    available. */
+    };
+
+    /**
+     * Holds one thermal zone.
+     */
+    struct ThermalZone
+    {
+        std::string name; /**< Zone type, eg. "CPU-therm". */
+        std::string path; /**< Temperature file in millidegrees C. */
+    };
+
+    uint32_t num_configured_cores; /**< Number of cores, including offline
+                                        ones, for which columns are written. */
+    std::vector<CoreSample> core_samples; /**< Previous per-core readings. */
+    std::vector<EngineSource> engines; /**< Engines found in sysfs. */
+    std::vector<ThermalZone> thermal_zones; /**< Thermal zones found in sysfs. */
+    std::string output_path; /**< CSV file path, empty if not writing samples. */
+    std::ofstream output_file; /**< CSV file the samples are appended to. */
+
     /**
      * Holds resource usage readings (internal use only).
      */
@@ -179,6 +254,21 @@ private:
 
         /** Number of readings taken. */
         uint64_t num_readings;
+
+        /** Peak utilisation of any single core. */
+        float max_core_usage;
+        /** Lowest sampled frequency of any online core in MHz. */
+        uint32_t min_cpu_freq;
+        /** Highest maximum frequency of any core in MHz. */
+        uint32_t max_cpu_freq;
+        /** Peak GPU load, -1 if not available. */
+        float max_gpu_load;
+        /** Peak EMC load, -1 if not available. */
+        float max_emc_load;
+        /** Peak temperature of any thermal zone, -1 if not available. */
+        float max_temperature;
+        /** Index in thermal_zones of the zone that reached max_temperature. */
+        int max_thermal_zone;
     } data; /**< Internal structure to hold intermediate measurements. */
 
     /**
@@ -186,6 +276,17 @@ private:
      */
     void profile();
 
+    /**
+     * Finds the engine load and clock files and thermal zones available
+     * on the running kernel.
+     */
+    void discoverSources();
+
+    /**
+     * Writes the CSV header row naming every column.
+     */
+    void writeOutputHeader();
+
     /**
      * Default constructor used by getProfilerInstance.
      */
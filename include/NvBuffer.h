@@ -39,6 +39,7 @@
 #include <linux/videodev2.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <map>
 
 #include "v4l2_nv_extensions.h"
 
@@ -57,6 +58,8 @@
  */
 #define MAX_PLANES 3
 
+class NvBufferMemoryPool;
+
 /**
  * @brief Class representing a buffer.
  *
@@ -216,6 +219,17 @@ public:
      */
     void deallocateMemory();
 
+    /**
+     * Sets the pool NvBuffer::allocateMemory takes plane memory from.
+     *
+     * Buffers allocated after the call use the pool, buffers allocated
+     * before give their memory back the way they got it. NULL, the
+     * default, allocates every plane with @c new.
+     *
+     * @param[in] pool The pool, or NULL. Must outlive the buffers using it.
+     */
+    static void setMemoryPool(NvBufferMemoryPool *pool);
+
     /**
      * Increases the reference count of the buffer.
      *
@@ -277,6 +291,11 @@ private:
     NvBuffer *shared_buffer; /**< If this is a DMABUF buffer, @c shared_buffer
                                 points to the MMAP @c NvBuffer whose FD was
                                 sent when this buffer was queued. */
+    NvBufferMemoryPool *pool;       /**< Pool the planes were allocated from,
+                                         NULL for @c new. */
+
+    static NvBufferMemoryPool *memory_pool; /**< Pool set with
+                                                 NvBuffer::setMemoryPool. */
 
     /**
      * Disallows copy constructor.
@@ -289,5 +308,98 @@ private:
 
     friend class NvV4l2ElementPlane;
 };
+
+/**
+ * @brief Pool of aligned plane memory for USERPTR buffers.
+ *
+ * Decoders and encoders that are set up again and again allocate and free
+ * the same plane sizes each time. Once set with NvBuffer::setMemoryPool,
+ * the pool keeps freed planes on a free list by size and hands them to the
+ * next allocation of that size instead of going back to the heap. Planes
+ * are page aligned, so cache line aligned too, and rounded up to whole
+ * pages. Idle planes above @a max_idle are freed.
+ *
+ * An optional accounting callback is told of every byte the pool takes
+ * from or gives back to the heap, idle planes included, and may refuse an
+ * allocation.
+ *
+ * This class is thread safe.
+ */
+class NvBufferMemoryPool
+{
+public:
+    /**
+     * Accounting callback, @a bytes is negative when memory is given back.
+     * Return false to refuse an allocation, the return value is ignored
+     * when memory is given back.
+     */
+    typedef bool (*AccountingCallback)(int64_t bytes, void *data);
+
+    /**
+     * Creates an empty pool.
+     *
+     * @param[in] max_idle Bytes of freed planes kept for reuse.
+     */
+    NvBufferMemoryPool(uint64_t max_idle = 64ULL << 20);
+    /**
+     * Frees the idle planes. Planes still in use must not be released
+     * afterwards.
+     */
+    ~NvBufferMemoryPool();
+
+    /**
+     * Allocates a plane, reusing an idle one of the same rounded size.
+     *
+     * @param[in] length Bytes the plane must hold.
+     * @return The plane, or NULL if out of memory or refused.
+     */
+    unsigned char *allocate(uint32_t length);
+    /**
+     * Gives a plane from NvBufferMemoryPool::allocate back to the pool.
+     *
+     * @param[in] data The plane.
+     * @param[in] length The length it was allocated with.
+     */
+    void release(unsigned char *data, uint32_t length);
+    /**
+     * Frees every idle plane.
+     */
+    void trim();
+
+    /**
+     * Sets the accounting callback, NULL for none. Set it before the first
+     * allocation so the bytes given back match those taken.
+     */
+    void setAccounting(AccountingCallback callback, void *data);
+
+    uint64_t getAllocations();  /**< Planes taken from the heap. */
+    uint64_t getReuses();       /**< Allocations served by an idle plane. */
+    uint64_t getBytes();        /**< Bytes held, in use or idle. */
+    uint64_t getPeakBytes();    /**< Most bytes held at once. */
+
+private:
+    void freePlane(unsigned char *data, size_t size);
+
+    std::multimap<size_t, unsigned char *> idle; /**< Idle planes by size. */
+    uint64_t idle_bytes;
+    uint64_t max_idle;
+    uint64_t allocations;
+    uint64_t reuses;
+    uint64_t bytes;
+    uint64_t peak_bytes;
+    size_t page_size;
+    AccountingCallback accounting;
+    void *accounting_data;
+    pthread_mutex_t lock;
+
+    /**
+     * Disallows copy constructor.
+     */
+    NvBufferMemoryPool(const NvBufferMemoryPool& that);
+    /**
+     * Disallows assignment.
+     */
+    void operator=(NvBufferMemoryPool const&);
+};
 /** @} */
 #endif
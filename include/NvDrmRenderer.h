@@ -159,6 +159,31 @@ public:
      */
     int removeFB(uint32_t fb_id);
 
+    /**
+     * Imports an exported NvBuffer as a framebuffer of the buffer's own size,
+     * for showing it on a plane with setPlane().
+     *
+     * @post  If the call is successful, the application must remove (free) the
+     * framebuffer by calling removeFB() before destroying the buffer.
+     *
+     * @param[in]  fd     File descriptor of the exported buffer.
+     * @param[out] fb_id  ID of the created framebuffer.
+     * @return 0 if successful, or -1 otherwise.
+     */
+    int addBufferFB(int fd, uint32_t *fb_id);
+
+    /**
+     * Keeps the framebuffer of each buffer rendered with enqueBuffer() until
+     * the renderer is destroyed, so a buffer rendered again is only flipped
+     * to instead of being imported and set on the plane once more.
+     *
+     * @note  Only enable this when a fixed set of buffers is rendered, and
+     * keep them alive as long as the renderer.
+     *
+     * @param[in] enable  true to cache the framebuffers, false to create and
+     *                    remove one per frame.
+     */
+    void enableBufferCache(bool enable);
 
     /**
      * Close GEM (Graphics Execution Manager) handles.
@@ -272,6 +297,7 @@ private:
     std::queue<int> freeBuffers;
     std::queue<int> pendingBuffers;
     std::unordered_map <int, int> map_list;
+    bool cacheBuffers;            /**< Keep the fbs of rendered buffers in map_list. */
 
     bool stop_thread;   /**< Boolean variable used to signal rendering thread
                              to stop. */
@@ -336,6 +362,17 @@ private:
      */
     int renderInternal(int fd);
 
+    /**
+     * Imports a buffer and creates a framebuffer of size (w, h) from it.
+     *
+     * \param[in]  fd     File descriptor of the exported buffer.
+     * \param[in]  w      Framebuffer width in pixels.
+     * \param[in]  h      Framebuffer height in pixels.
+     * \param[out] fb_id  ID of the created framebuffer.
+     * \return 0 if successful, or -1 otherwise.
+     */
+    int importBuffer(int fd, uint32_t w, uint32_t h, uint32_t *fb_id);
+
     /*
      *  Returns a DRM buffer_object handle.
      *
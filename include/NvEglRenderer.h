@@ -44,6 +44,9 @@
 
 #include <X11/Xlib.h>
 
+#include <unordered_map>
+#include <vector>
+
 /**
  * @defgroup l4t_mm_nveglrenderer_group Rendering API
  *
@@ -54,6 +57,24 @@
  * @{
  */
 
+/** Maximum number of buffers drawn by one NvEglRenderer::renderCells() call. */
+#define NV_EGL_MAX_CELLS 8
+
+/**
+ * Holds one buffer drawn by NvEglRenderer::renderCells() and the part of the
+ * window it is drawn into.
+ */
+typedef struct
+{
+    int fd;             /**< FD of the exported buffer to draw. */
+    uint32_t x;         /**< Horizontal offset of the cell in the window, in pixels. */
+    uint32_t y;         /**< Vertical offset of the cell in the window, in pixels. */
+    uint32_t width;     /**< Width of the cell, in pixels. */
+    uint32_t height;    /**< Height of the cell, in pixels. */
+    int remap;          /**< Remap set with NvEglRenderer::setRemap() to sample
+                             the buffer through, or -1 to draw it as is. */
+} NvEglCell;
+
 /**
  *
  * @c %NvEglRenderer is a helper class for rendering using EGL and OpenGL
@@ -152,6 +173,38 @@ public:
      */
     int setOverlayText(char *str, uint32_t x, uint32_t y);
 
+    /**
+     * Renders several buffers into their cells of the window as one frame,
+     * each optionally through a remap.
+     *
+     * Like render(), this call waits until the frame is rendered. The
+     * @c EGLImage and texture of each buffer are kept until the renderer is
+     * destroyed, so only a fixed set of buffers must be drawn and they must
+     * stay alive as long as the renderer.
+     *
+     * @param[in] count Number of cells, at most @c NV_EGL_MAX_CELLS.
+     * @param[in] cells A pointer to the cells to draw.
+     * @return 0 for success, -1 otherwise.
+     */
+    int renderCells(uint32_t count, const NvEglCell *cells);
+
+    /**
+     * Sets a remap, the position each pixel of a cell samples its buffer at.
+     *
+     * The remap is uploaded as a texture with the next frame. Cells are drawn
+     * with nearest sampling of the remap, so it should have the cell size.
+     *
+     * @param[in] remap Index of the remap, below @c NV_EGL_MAX_CELLS.
+     * @param[in] width Width of the remap, in pixels.
+     * @param[in] height Height of the remap, in pixels.
+     * @param[in] coords A pointer to @a width x @a height pairs of source
+     *                   positions, rows from the top, as fractions of the
+     *                   buffer's width and height in units of 1/65535.
+     * @return 0 for success, -1 otherwise.
+     */
+    int setRemap(uint32_t remap, uint32_t width, uint32_t height,
+                 const uint16_t *coords);
+
 private:
     Display * x_display;    /**< Connection to the X server created using
                                   XOpenDisplay(). */
@@ -169,6 +222,33 @@ private:
     XFontStruct *fontinfo;      /**< Brush's font info */
     char overlay_str[512];       /**< Overlay's text */
 
+    GLuint plain_program;       /**< Draws a buffer as is. */
+    GLuint remap_program;       /**< Draws a buffer through a remap texture. */
+    GLint viewport[4];          /**< The window's viewport. */
+
+    /** Holds a buffer drawn by renderCells(). */
+    struct CellImage
+    {
+        EGLImageKHR image;
+        GLuint texture;
+    };
+    std::unordered_map<int, CellImage> cell_images; /**< Cached per buffer FD. */
+
+    uint32_t render_cell_count;     /**< Cells of the next frame, 0 to render render_fd. */
+    NvEglCell render_cells[NV_EGL_MAX_CELLS];
+
+    /** Holds a remap until and after it is uploaded. */
+    struct Remap
+    {
+        std::vector<uint8_t> texels;    /**< RGBA8, red and green the high and
+                                             low byte of x, blue and alpha of y. */
+        uint32_t width;
+        uint32_t height;
+        GLuint texture;
+        bool dirty;                     /**< Not uploaded yet, set under render_lock. */
+    };
+    Remap remaps[NV_EGL_MAX_CELLS];
+
     /**
      * Creates a GL texture used for rendering.
      *
@@ -182,6 +262,25 @@ private:
      * @return 0 for success, -1 otherwise.
      */
     int InitializeShaders();
+    /**
+     * Links a program from a vertex and a fragment shader, binding the
+     * vertex attributes to the locations the shared vertex arrays use.
+     *
+     * @return The program, or 0 on error.
+     */
+    GLuint LinkProgram(const char *vertex, int vertex_size,
+                       const char *fragment, int fragment_size,
+                       GLint pos_location, GLint tc_location);
+    /**
+     * Uploads the remaps set since the last frame.
+     */
+    void uploadRemaps();
+    /**
+     * Draws the cells of render_cells.
+     *
+     * @return 0 for success, -1 otherwise.
+     */
+    int drawCells();
     /**
      * Creates, compiles and attaches a shader to the @a program.
      *
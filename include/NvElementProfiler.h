@@ -31,9 +31,10 @@
 
 #include <iostream>
 #include <pthread.h>
-#include <map>
 #include <stdint.h>
 #include <sys/time.h>
+#include <atomic>
+#include "LatencyHistogram.hpp"
 
 /**
  * @file
@@ -43,6 +44,9 @@
  */
 
 
+/** Maximum number of units that can be in flight with their latency measured. */
+#define NV_PROFILER_SLOTS 64
+
 /**
  *
  * Helper class for profiling the performance of individual elements.
@@ -51,6 +55,12 @@
  * the number of units that arrived late at the element. Components should use this
  * information internally.
  *
+ * startProcessing() and finishProcessing() take no locks and allocate nothing:
+ * start times are kept in a fixed ring of NV_PROFILER_SLOTS slots indexed by unit ID,
+ * timed with @c CLOCK_MONOTONIC, and latencies go into a log-bucketed
+ * LatencyHistogram from which p50/p95/p99 are reported. A unit still in flight
+ * after NV_PROFILER_SLOTS newer units have started loses its latency sample.
+ *
  * If you require latency measurements,
  * you must call startProcessing() to indicate that a unit has been submitted
  * for processing and finishProcessing() to indicate that a unit has finished processing.
@@ -101,6 +111,12 @@ public:
         uint64_t min_latency_usec;
         /** Maximum of latencies for each processed units, in microseconds. */
         uint64_t max_latency_usec;
+        /** Median latency, in microseconds, within the histogram bucket resolution. */
+        uint64_t p50_latency_usec;
+        /** 95th percentile latency, in microseconds. */
+        uint64_t p95_latency_usec;
+        /** 99th percentile latency, in microseconds. */
+        uint64_t p99_latency_usec;
 
         /** Total units processed. */
         uint64_t total_processed_units;
@@ -167,34 +183,36 @@ private:
      */
     void reset();
 
-    pthread_mutex_t profiler_lock; /**< Mutex to synchronize multithreaded access to profiler data. */
+    pthread_mutex_t profiler_lock; /**< Serializes enable, disable and reset, never taken per unit. */
 
-    bool enabled; /**< Flag indicating if profiler is enabled. */
+    std::atomic<bool> enabled; /**< Flag indicating if profiler is enabled. */
 
     const ProfilerField valid_fields; /**< Valid fields for the element. */
 
-    struct NvElementProfilerDataInternal : NvElementProfilerData {
-        /** Wall-clock time at which the first unit was processed. */
-        struct timeval start_time;
+    /** Start time of one in-flight unit, @a id is 0 while the slot is free. */
+    struct UnitSlot {
+        std::atomic<uint64_t> id;
+        std::atomic<uint64_t> start_nsec;
+    };
 
-        /** Wall-clock time at which the latest unit was processed. */
-        struct timeval stop_time;
+    /** Start times of in-flight units, slot is the unit ID modulo NV_PROFILER_SLOTS. */
+    UnitSlot unit_slots[NV_PROFILER_SLOTS];
 
-        /** Total accumulated time.
-         *  When performance measurement is restarted @a start_time and @a stop_time
-         *  are reset. This field is used to accumulate time before
-         *  resetting. */
-        struct timeval accumulated_time;
+    std::atomic<uint64_t> unit_id_counter; /**< Unique ID of the last started unit. */
+    std::atomic<uint64_t> unit_finish_counter; /**< Units finished in order, used when finishProcessing() gets ID 0. */
 
-        /** Total accumulated latency for all units, in microseconds. */
-        uint64_t total_latency;
-    } data_int;
+    std::atomic<uint64_t> total_processed_units; /**< Total units processed. */
+    std::atomic<uint64_t> num_late_units; /**< Number of units which arrived late. */
+    std::atomic<uint64_t> min_latency_usec; /**< Minimum latency, in microseconds. */
 
-    /** Queue used to maintain the timestamps of when the unit
-     *  processing started. Required to calculate latency. */
-    std::map<uint64_t, struct timeval> unit_start_time_queue;
+    /** Monotonic time at which the first unit since enabling was processed, 0 if none. */
+    std::atomic<uint64_t> start_nsec;
+    /** Monotonic time at which the latest unit was processed. */
+    std::atomic<uint64_t> stop_nsec;
+    /** Profiling time accumulated before the last disable. */
+    std::atomic<uint64_t> accumulated_nsec;
 
-    uint64_t unit_id_counter; /**< Unique ID of the last unit. */
+    LatencyHistogram latencies; /**< Histogram of unit latencies, in microseconds. */
 
     /**
      * Constructor for NvElementProfiler.
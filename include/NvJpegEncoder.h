@@ -176,11 +176,21 @@ public:
      */
     void setScaledEncodeParams(uint32_t scale_width, uint32_t scale_height);
 
+    /**
+     * Sets the number of MCU rows per restart interval. Unlike the crop and
+     * scaling parameters it applies to every following call to
+     * #encodeFromFd or #encodeFromBuffer, until it is set again.
+     *
+     * @param[in] rows MCU rows between restart markers, 0 for none.
+     */
+    void setRestartRows(uint32_t rows);
+
 private:
 
     NvJPEGEncoder(const char *comp_name);
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
+    uint32_t restart_rows;
 
     static const NvElementProfiler::ProfilerField valid_fields =
             NvElementProfiler::PROFILER_FIELD_TOTAL_UNITS |
@@ -38,6 +38,7 @@
 
 #include <iostream>
 #include <sstream>
+#include <string>
 
 /**
  *
@@ -79,6 +80,29 @@ extern int log_level;
  */
 #define DEFAULT_LOG_LEVEL LOG_LEVEL_ERROR
 
+/**
+ * Specifies the most verbose log level compiled in, by default every level.
+ * Messages of a level above it compile to nothing whatever the runtime
+ * log_level, e.g. -DLOG_LEVEL_MAX=LOG_LEVEL_WARN keeps only errors and
+ * warnings. Information messages rank with debug messages here.
+ */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX LOG_LEVEL_DEBUG
+#endif
+
+/**
+ * Evaluates to a constant, true if messages of the level are compiled in.
+ */
+#define LOG_LEVEL_COMPILED(level) \
+    (((level) == LOG_LEVEL_INFO ? LOG_LEVEL_DEBUG : (level)) <= LOG_LEVEL_MAX)
+
+/**
+ * Holds the handler messages are passed to instead of being written to
+ * std::cerr, or NULL. The message has no trailing newline. The handler is
+ * called on the logging thread and must not block.
+ */
+extern void (*log_handler)(int level, const std::string& message);
+
 /**
  * @cond
  */
@@ -95,8 +119,9 @@ extern const char *log_level_name[];
  *
  * Prints log messages.
  *
- * Prints a log message only if the current log_level is greater
- * than or equal to the level of the message.
+ * Prints a log message only if the level of the message is compiled in
+ * and the current log_level is greater than or equal to it. The message
+ * goes to the log_handler if one is set, to std::cerr otherwise.
  *
  * Messages are in the following form:
  * [LEVEL] (FILE: LINE_NUM) Message
@@ -104,12 +129,17 @@ extern const char *log_level_name[];
  * @param[in] level The Log level of the message.
  * @param[in] str1 The NULL-terminated char array to print.
  */
-#define PRINT_MSG(level, str1) if(level <= log_level) { \
+#define PRINT_MSG(level, str1) if(LOG_LEVEL_COMPILED(level) && level <= log_level) { \
                                   std::ostringstream ostr; \
                                   ostr << "[" << log_level_name[level] << "] ("  << \
                                   __FILE__ << ":" __LINE_NUM_STR__ ") " << \
-                                  str1 << std::endl; \
-                                  std::cerr << ostr.str(); \
+                                  str1; \
+                                  if (log_handler) \
+                                      log_handler(level, ostr.str()); \
+                                  else { \
+                                      ostr << std::endl; \
+                                      std::cerr << ostr.str(); \
+                                  } \
                               }
 
 /**
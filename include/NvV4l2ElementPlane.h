@@ -52,6 +52,8 @@
 #include "NvLogging.h"
 #include "NvBuffer.h"
 
+class NvV4l2PollLoop;
+
 /**
  * Prints a plane-specific message of level LOG_LEVEL_DEBUG.
  * Must not be used by applications.
@@ -449,6 +451,21 @@ public:
      * @return 0 for success, -1 otherwise.
      */
     int startDQThread(void *data);
+    /**
+     * Sets the poll loop that dequeues the plane instead of a DQ Thread.
+     *
+     * Once set, #startDQThread hands the plane to the loop, which calls the
+     * #dqThreadCallback method from its own thread whenever the plane has a
+     * buffer to dequeue. #stopDQThread, #waitForDQThread and setting the
+     * stream to off work as with a DQ Thread. If the loop cannot poll the
+     * plane, a DQ Thread is started instead. NULL, the default, always
+     * starts a DQ Thread.
+     *
+     * @sa NvV4l2PollLoop
+     *
+     * @param[in] loop The loop, or NULL. Must outlive the plane's dequeueing.
+     */
+    void setDQPollLoop(NvV4l2PollLoop *loop);
     /**
      * Force stops the DQ Thread if it is running.
      *
@@ -532,6 +549,27 @@ private:
      */
     static void *dqThread(void *v4l2_element_plane);
 
+    NvV4l2PollLoop *poll_loop; /**< Specifies the loop set with #setDQPollLoop, or NULL. */
+    bool dq_polled;            /**< Specifies whether the loop dequeues the plane
+                                    rather than a DQ Thread. */
+
+    /**
+     * Dequeues one buffer for the poll loop and calls the #dqThreadCallback
+     * method with it, like one turn of the DQ Thread.
+     *
+     * @return FALSE once the plane is done: the callback returned FALSE,
+     *         the plane failed or the stream is off.
+     */
+    bool dispatchDQ();
+    /**
+     * Marks the dequeueing stopped and wakes #waitForDQThread.
+     */
+    void finishDQ();
+    /**
+     * Falls back to a DQ Thread for a plane the poll loop cannot poll.
+     */
+    void startDQThreadFallback();
+
     NvElementProfiler &v4l2elem_profiler; /**< A reference to the profiler belonging
                                             to the plane's parent element. */
 
@@ -581,6 +619,7 @@ private:
                                for debugging. */
 
     friend class NvV4l2Element;
+    friend class NvV4l2PollLoop;
 };
 /** @} */
 #endif
@@ -0,0 +1,91 @@
+/*
+ * NvV4l2PollLoop.h
+ *
+ * One thread dequeueing the planes of many V4L2 elements. Each plane handed
+ * to the loop with NvV4l2ElementPlane::setDQPollLoop would otherwise start a
+ * DQ Thread of its own; the loop poll()s all of their fds at once and, on each
+ * wakeup, dequeues one buffer from every ready plane and calls its callback,
+ * so six encoders cost one thread instead of six that each wake for every
+ * buffer. Capture planes are polled for POLLIN, output planes for POLLOUT,
+ * as V4L2 memory-to-memory devices report them.
+ *
+ * A plane whose fd the driver cannot poll falls back to its own DQ Thread.
+ */
+
+#ifndef __NV_V4L2_POLL_LOOP_H__
+#define __NV_V4L2_POLL_LOOP_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+class NvV4l2ElementPlane;
+
+/**
+ * @brief A thread that dequeues the planes of many V4L2 elements.
+ */
+class NvV4l2PollLoop
+{
+public:
+    /**
+     * Creates the loop and starts its thread.
+     *
+     * @param[in] name Name of the thread, at most 15 characters are kept.
+     */
+    NvV4l2PollLoop(const char *name);
+    /**
+     * Stops the thread. Every plane must have been taken back from the loop
+     * by then.
+     */
+    ~NvV4l2PollLoop();
+
+    /**
+     * Adds a plane, its callback is called from the loop's thread from now on.
+     *
+     * @return 0 for success, -1 if the loop is in error.
+     */
+    int add(NvV4l2ElementPlane *plane);
+    /**
+     * Removes a plane. Returns once the loop no longer dispatches it, may be
+     * called from the plane's own callback.
+     */
+    void remove(NvV4l2ElementPlane *plane);
+
+    /**
+     * Indicates whether the loop failed to start.
+     *
+     * @return 0 if the loop runs, non-zero otherwise.
+     */
+    int isInError();
+
+    uint32_t getPlanes();       /**< Planes currently dequeued by the loop. */
+    uint64_t getWakeups();      /**< Returns from poll() that dispatched a buffer. */
+    uint64_t getDispatched();   /**< Buffers dequeued and handed to a callback. */
+
+private:
+    static void *loopThread(void *data);
+    void run();
+    bool contains(NvV4l2ElementPlane *plane);
+
+    char name[16];
+    std::vector<NvV4l2ElementPlane *> planes;
+    pthread_mutex_t lock;          /**< Guards #planes and the counters. */
+    pthread_mutex_t dispatch_lock; /**< Held while the loop calls callbacks. */
+    pthread_t thread;
+    int wake_fd;                   /**< eventfd that interrupts poll(). */
+    bool stop;
+    int is_in_error;
+    uint64_t wakeups;
+    uint64_t dispatched;
+
+    /**
+     * Disallows copy constructor.
+     */
+    NvV4l2PollLoop(const NvV4l2PollLoop& that);
+    /**
+     * Disallows assignment.
+     */
+    void operator=(NvV4l2PollLoop const&);
+};
+
+#endif
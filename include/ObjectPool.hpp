@@ -0,0 +1,68 @@
+/*
+ * ObjectPool.hpp
+ *
+ * A fixed number of objects constructed once and then checked out and
+ * returned by index from any thread, for the buffers and slots a stage hands
+ * downstream and gets back. The free indexes are kept in an MpmcRing, so
+ * acquire and release take no lock and allocate nothing; an empty pool
+ * refuses the acquire rather than blocking. Every index starts out free.
+ * Objects are reached by index, the pool does not track which are out.
+ */
+
+#pragma once
+
+#include "RingQueue.hpp"
+#include <stdint.h>
+#include <stddef.h>
+
+template <typename T>
+class ObjectPool {
+
+    public:
+        explicit ObjectPool(uint32_t count) :
+            _objects(new T[count]()),
+            _count(count),
+            _free(count)
+        {
+            for (uint32_t i = 0; i < _count; i++)
+                _free.tryPush(i);
+        }
+
+        ~ObjectPool() {
+            delete[] _objects;
+        }
+
+        /* Check out a free object, returns false without blocking if none are available */
+        bool acquire(uint32_t& index) {
+            return _free.tryPop(index);
+        }
+
+        /* Return an object checked out with acquire, the ring has room for every index */
+        void release(uint32_t index) {
+            _free.tryPush(index);
+        }
+
+        T& operator[](uint32_t index) {
+            return _objects[index];
+        }
+
+        const T& operator[](uint32_t index) const {
+            return _objects[index];
+        }
+
+        uint32_t getCount() const {
+            return _count;
+        }
+
+        size_t getAvailable() const {
+            return _free.size();
+        }
+
+    private:
+        ObjectPool(const ObjectPool&);
+        ObjectPool& operator=(const ObjectPool&);
+
+        T *_objects;
+        const uint32_t _count;
+        MpmcRing<uint32_t> _free;
+};
@@ -8,9 +8,41 @@
 #pragma once
 
 #include "Argus/Argus.h"
+#include <vector>
+#include <string>
 
 #define CAPTURE_MODE_0 0
 
+#define FORMAT_JPEG 0
+#define FORMAT_RAW 1
+#define FORMAT_H264 2
+#define FORMAT_H265 3
+
+#define RAW_LAYOUT_I420 0
+#define RAW_LAYOUT_NV12 1
+#define RAW_LAYOUT_BAYER12 2    // sensor samples packed to 12 bit, the ISP bypassed
+
+#define ENCODE_POLICY_ROUND_ROBIN 0
+#define ENCODE_POLICY_OLDEST 1
+#define ENCODE_POLICY_STEAL 2
+
+#define DENOISE_DEFAULT 0       // leave the ISP's, in the order of CaptureDenoise
+#define DENOISE_OFF 1
+#define DENOISE_FAST 2
+#define DENOISE_HIGH_QUALITY 3
+
+#define TNR_OFF -1              // otherwise a v4l2_tnr_algorithm
+
+#define CLUSTER_ROLE_NONE 0
+#define CLUSTER_ROLE_LEADER 1
+#define CLUSTER_ROLE_FOLLOWER 2
+
+/* A region of a camera's video the encoder spends more or fewer bits on */
+struct RoiRegion {
+    Argus::Rectangle<uint32_t> rect;
+    int qpDelta;        // added to the frame's QP inside the region, negative for more detail
+};
+
 class Options {
 
     public:
@@ -19,15 +51,149 @@ class Options {
 
         /* Static class methods */
         static void printHelp();
+        static const char *getTnrName(int algorithm);
         bool parse(int argc, char * argv[]);
+        bool isVideoFormat() const;
+        bool isPreviewEnabled() const;
+        bool isBayer() const;
+        Argus::Size2D<uint32_t> getCompositeTile() const;
+        int getSaveEvery(uint32_t id) const;
+        int getFrameStride(uint32_t id) const;
+        uint64_t getFrameDuration(uint32_t id) const;
+        uint64_t getFrameDuration(uint32_t id, int saveEvery) const;
+        uint32_t getStaggerFrame(uint32_t id, uint32_t stride) const;
+        uint32_t getModeFrameRate() const;
+        uint64_t getStaggerDelay(uint32_t id) const;
+        Argus::Range<uint64_t> getExposureRange(uint32_t id) const;
+        Argus::Range<float> getGainRange(uint32_t id) const;
+        bool isAeLocked(uint32_t id) const;
+        int getDenoiseMode(uint32_t id) const;
+        float getDenoiseStrength(uint32_t id) const;
+        int getTnr(uint32_t id) const;
+        bool isGrayscale(uint32_t id) const;
+        bool hasSensorSettings() const;
+        bool isProxyEnabled() const;
+        bool hasEncodeGeometry() const;
+        Argus::Rectangle<uint32_t> getCrop(uint32_t id) const;
+        Argus::Size2D<uint32_t> getEncodeSize(uint32_t id) const;
+        int getCaptureBuffers() const;
+        int getEglFifo(uint32_t id) const;
+        int getQuality(uint32_t id) const;
+        int getQualityBudget(uint32_t id) const;
+        int getConsumerCpu(uint32_t id) const;
+        int getWriterCpu(uint32_t id) const;
+        const std::vector<RoiRegion>& getRois(uint32_t id) const;
         void write();
+        void writeChange(const std::string& change);
 
         /* Class fields, public to reduce overhead */
         char *directory;
         int captureMode;
         Argus::Size2D<uint32_t> captureResolution;
+        uint64_t captureFrameDuration;
+        uint32_t captureBitDepth;   // bits per sample the sensor mode outputs, for --raw-layout bayer12
+        uint32_t cameraCount;       // cameras of the capture graph, the --stagger phases are spread over them
+        bool clusterRecord;         // the leader starts every board recording once all are warm
         int captureTime;
         int profile;
         int verbose;
-        int saveEvery;
+        std::vector<int> saveEvery;
+        std::vector<double> frameRates;
+        std::vector<Argus::Range<uint64_t> > exposureRanges;
+        std::vector<Argus::Range<float> > gainRanges;
+        std::vector<int> aeLocks;
+        std::vector<int> denoiseModes;
+        std::vector<float> denoiseStrengths;    // negative leaves the mode's
+        std::vector<int> tnr;
+        std::vector<int> grayscale;
+        int writeQueue;
+        int dmabufRing;
+        int format;
+        int containerSize;
+        int fanout;
+        int directIo;
+        int aioDepth;
+        int syncInterval;
+        int segmentMinutes;
+        int segmentSize;
+        std::string offloadHost;
+        int offloadPort;
+        int offloadRate;
+        int bitrate;
+        int idrInterval;
+        int maxPerf;
+        int dqLoops;
+        std::vector<std::vector<RoiRegion> > rois;
+        int roiSaliency;
+        int encodeWorkers;
+        int encodePolicy;
+        std::vector<int> quality;
+        std::vector<int> qualityBudget;
+        int restartRows;
+        std::vector<Argus::Rectangle<uint32_t> > crops;
+        std::vector<Argus::Size2D<uint32_t> > scales;
+        int acquireTimeout;
+        int cameraRestarts;
+        int fullRate;
+        int telemetry;
+        int trace;
+        int metadata;
+        int exif;
+        int statusInterval;
+        int syncSession;
+        int stagger;
+        int zeroCopy;
+        int captureBuffers;
+        std::vector<int> eglFifo;
+        int memoryBudget;
+        int memoryLock;
+        int frameSetTolerance;
+        int setPolicy;
+        int composite;
+        Argus::Size2D<uint32_t> compositeTile;  // 0x0 keeps the capture resolution
+        std::vector<int> consumerCpus;
+        std::vector<int> writerCpus;
+        int rtPolicy;
+        int rtPriority;
+        Argus::Size2D<uint32_t> previewResolution;
+        int previewFps;
+        std::string streamHost;
+        int streamPort;
+        int streamBitrate;
+        std::vector<std::string> volumes;
+        int stripePolicy;
+        int volumeReserve;
+        int capacityWarn;
+        int backpressure;
+        int thermalMargin;
+        Argus::Size2D<uint32_t> proxyResolution;
+        int proxyEvery;
+        int proxyBudget;
+        int benchCameras;
+        int benchFrameSize;
+        int benchFps;
+        std::string benchJson;
+        int startPaused;
+        int daemonMode;
+        int clusterRole;
+        std::string leaderHost;     // of --follow
+        int clusterPort;            // the leader listens on, or a follower connects to
+        int followers;
+        std::string sharePath;
+        int shareSlots;
+        int quickLookPort;
+        int quickLookRate;
+        int triggerFrames;
+        int triggerGpio;
+        int preTriggerFrames;
+        double interval;            // s between time-lapse shots, 0 streams continuously
+        double motionThreshold;
+        int motionKeep;
+        int exposureGate;
+        int exposureQuality;
+        int rawLayout;
+        std::string configPath;
+        std::string controlPath;
+        std::string verifyPath;
+        int recover;
 };
@@ -0,0 +1,39 @@
+/*
+ * PerfResults.hpp
+ *
+ * Results of a benchmark run for make perf-check: the workload it ran and a
+ * flat list of named metrics, written as JSON with one metric per line so
+ * PerfCheck and a diff read it without a JSON library. Metric names are
+ * <stage>.<measure>; measures ending in fps or mib_per_s are throughput,
+ * p99_us and cpu_us_per_frame are latency and cost, the rest is context.
+ *
+ * File format:
+ *   {
+ *     "bench": "<name>",
+ *     "workload": "<description>",
+ *     "metrics": {
+ *       "<stage>.<measure>": <value>,
+ *       ...
+ *     }
+ *   }
+ */
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+class PerfResults {
+
+    public:
+        PerfResults(const std::string& bench, const std::string& workload);
+
+        void add(const std::string& metric, double value);
+        bool write(const std::string& filename) const;
+
+    private:
+        std::string _bench;
+        std::string _workload;
+        std::vector<std::pair<std::string, double> > _metrics;  // in the order added
+};
@@ -0,0 +1,43 @@
+/*
+ * PixelKernels.hpp
+ *
+ * The few loops that touch pixels on the CPU, vectorised with NEON for the
+ * A57 and Denver cores. Each kernel has a scalar twin that produces the same
+ * output bit for bit; builds without NEON use the scalar one for both, and
+ * PixelBench compares the two. Planes are 8 bit, rows are pitch bytes apart,
+ * except the 16 bit Bayer samples packRaw12 reads.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* RGBA to packed BGR, as drawn by OpenCV */
+void rgbaToBgr(const uint8_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width, uint32_t height);
+void rgbaToBgrScalar(const uint8_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width, uint32_t height);
+
+/* I420 chroma planes of width x height to the interleaved NV12 chroma plane */
+void interleaveChroma(const uint8_t *u, const uint8_t *v, uint32_t srcPitch, uint8_t *uv, uint32_t dstPitch,
+                      uint32_t width, uint32_t height);
+void interleaveChromaScalar(const uint8_t *u, const uint8_t *v, uint32_t srcPitch, uint8_t *uv, uint32_t dstPitch,
+                            uint32_t width, uint32_t height);
+
+/* Halve a plane in both directions, each output is the rounded mean of a 2x2 block */
+void downscaleHalf(const uint8_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width, uint32_t height);
+void downscaleHalfScalar(const uint8_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width,
+                         uint32_t height);
+
+/* Sum of absolute differences of two rows of length bytes */
+uint64_t sumAbsDiff(const uint8_t *a, const uint8_t *b, uint32_t length);
+uint64_t sumAbsDiffScalar(const uint8_t *a, const uint8_t *b, uint32_t length);
+
+/* Sum of a plane's samples, the mean brightness once divided by width * height */
+uint64_t sumPlane(const uint8_t *src, uint32_t pitch, uint32_t width, uint32_t height);
+uint64_t sumPlaneScalar(const uint8_t *src, uint32_t pitch, uint32_t width, uint32_t height);
+
+/* 16 bit Bayer samples shifted right by shift to MIPI RAW12, each pair of pixels in 3 bytes: the high
+   8 bits of the first, of the second, then the low 4 bits of the first and second. width is even */
+void packRaw12(const uint16_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width, uint32_t height,
+               uint32_t shift);
+void packRaw12Scalar(const uint16_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width,
+                     uint32_t height, uint32_t shift);
@@ -0,0 +1,50 @@
+/*
+ * PreTriggerRing.hpp
+ *
+ * Holds the most recent frames of one camera while a triggered run waits, so
+ * a burst can start before the trigger. Each held frame is a DmabufRing slot
+ * the consumer copied the frame into, kept with the job and metadata it will
+ * be submitted with. Once the ring is full the oldest frame's slot is reused
+ * for the newest, so the memory held is fixed at the depth. Nothing is encoded
+ * until a burst hands the frames to the sink, oldest first. Only the consumer
+ * thread uses the ring, so it takes no locks.
+ */
+
+#pragma once
+
+#include "FrameSink.hpp"
+#include "MetadataLog.hpp"
+#include <stdint.h>
+#include <vector>
+
+class DmabufRing;
+
+/* A frame copied into a ring slot, waiting for a burst */
+struct HeldFrame {
+    FrameJob job;               // slot, fd, timestamp and telemetry, the index is given on submission
+    uint64_t sensorTimestamp;   // for the FrameSetCollector
+    MetadataRecord record;      // for the MetadataLog
+};
+
+class PreTriggerRing {
+
+    public:
+        explicit PreTriggerRing(uint32_t depth);
+
+        bool reserve(DmabufRing& ring, uint32_t& slot, int& fd);
+        void push(const HeldFrame& frame);
+        bool pop(HeldFrame& frame);
+        const HeldFrame *getOldest() const;
+        void clear(DmabufRing& ring);
+
+        uint32_t getDepth() const;
+        uint32_t getSize() const;
+        uint64_t getEvicted() const;
+
+    private:
+        uint32_t _depth;
+        std::vector<HeldFrame> _frames;
+        uint32_t _head;
+        uint32_t _size;
+        uint64_t _evicted;
+};
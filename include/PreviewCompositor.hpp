@@ -0,0 +1,105 @@
+/*
+ * PreviewCompositor.hpp
+ *
+ * The preview-while-recording path. Each camera's session carries a second,
+ * small EGL output stream next to the recording stream. A PreviewSource per
+ * camera drains it: frames arriving sooner than the preview rate allows are
+ * released straight away, the others are copied into a triple buffer so the
+ * compositor never waits on the source and the source never waits on the
+ * compositor. The PreviewCompositor tiles the newest frame of every camera
+ * into one YUV420 grid with NvBufferComposite at the preview rate and hands it
+ * to its PreviewSinks. The streams are EGL mailboxes and the threads run at a
+ * lower nice level, so a slow preview costs preview frames, never recorded ones.
+ */
+
+#pragma once
+
+#include "Thread.h"
+#include <Argus/Argus.h>
+#include <EGLStream/EGLStream.h>
+#include <nvbuf_utils.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#define PREVIEW_BUFFERS 3 // triple buffer, acquire and composite never wait on each other
+
+class Options;
+class Logger;
+
+/* Where the composited preview goes, consume() may only read fd until it returns.
+   The timestamp is the steady clock ns the composite's oldest tile was acquired at */
+class PreviewSink {
+
+    public:
+        virtual ~PreviewSink() {}
+
+        virtual bool open(const Argus::Size2D<uint32_t>& size) = 0;
+        virtual bool consume(int fd, uint64_t timestamp) = 0;
+        virtual void close() = 0;
+};
+
+class PreviewSource : public ArgusSamples::Thread {
+
+    public:
+        explicit PreviewSource(Argus::OutputStream *stream, uint32_t id, const Options& options);
+        virtual ~PreviewSource();
+
+        bool getLatest(int& fd, uint64_t& lastFrameTime);
+        uint64_t getFramesTaken();
+        uint64_t getFramesDropped();
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        Argus::OutputStream *_stream;
+        uint32_t _id;
+        const Options& _options;
+        Argus::UniqueObj<EGLStream::FrameConsumer> _consumer;
+        uint64_t _interval;         // ns between taken frames
+        uint64_t _nextTake;         // steady clock ns the next frame is taken at
+        int _buffers[PREVIEW_BUFFERS];
+        std::mutex _mutex;
+        uint32_t _back;
+        uint32_t _middle;
+        uint32_t _front;
+        bool _fresh;                // the middle buffer holds a frame the compositor has not taken
+        bool _published;
+        uint64_t _lastFrameTime;
+        std::atomic<uint64_t> _framesTaken;
+        std::atomic<uint64_t> _framesDropped;
+};
+
+class PreviewCompositor : public ArgusSamples::Thread {
+
+    public:
+        explicit PreviewCompositor(const Options& options, const std::vector<Argus::OutputStream*>& streams);
+        virtual ~PreviewCompositor();
+
+        void addSink(PreviewSink *sink);
+        PreviewSource *getSource(uint32_t id);
+        uint32_t getSourceCount() const;
+        uint64_t getComposites();
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        const Options& _options;
+        Logger *_logger;
+        std::vector<PreviewSource*> _sources;
+        std::vector<PreviewSink*> _sinks;
+        uint32_t _columns;
+        Argus::Size2D<uint32_t> _compositeSize;
+        NvBufferCompositeParams _compositeParam;
+        int _composite;
+        uint64_t _interval;
+        uint64_t _nextComposite;
+        std::atomic<uint64_t> _composites;
+};
@@ -0,0 +1,69 @@
+/*
+ * PreviewLayout.hpp
+ *
+ * The grid StreamPreview composites its cameras into, shared with the
+ * StreamMosaic contact sheets so a mosaic looks like the preview did. Cells
+ * are filled column by column with CELL_SPACING pixels around each, and
+ * setupComposite() fills the NvBufferComposite parameters placing each
+ * source buffer in its cell.
+ */
+
+#pragma once
+
+#include <Argus/Argus.h>
+#include <nvbuf_utils.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CELL_SPACING 2U
+
+/* The grid the cameras are composited into, filled column by column */
+struct PreviewLayout {
+    uint32_t cellWidth;
+    uint32_t cellHeight;
+    uint32_t columns;
+    uint32_t rows;
+
+    Argus::Size2D<uint32_t> getCellSize() const {
+        return Argus::Size2D<uint32_t>(cellWidth, cellHeight);
+    }
+
+    Argus::Size2D<uint32_t> getCompositeSize() const {
+        return Argus::Size2D<uint32_t>(columns * cellWidth + (columns + 1) * CELL_SPACING,
+                                       rows * cellHeight + (rows + 1) * CELL_SPACING);
+    }
+
+    // -------------------------
+    // |  -----  -----  -----  |
+    // |  | 0 |  | 2 |  | 4 |  |
+    // |  -----  -----  -----  |
+    // |                       |
+    // |  -----  -----  -----  |
+    // |  | 1 |  | 3 |  | 5 |  |
+    // |  -----  -----  -----  |
+    // -------------------------
+    NvBufferRect getCell(uint32_t i) const {
+        NvBufferRect rect;
+        rect.top = (i % rows + 1) * CELL_SPACING + (i % rows) * cellHeight;
+        rect.left = (i / rows + 1) * CELL_SPACING + (i / rows) * cellWidth;
+        rect.width = cellWidth;
+        rect.height = cellHeight;
+        return rect;
+    }
+
+    /* Composite count sources of sourceWidth x sourceHeight, source i into cell i */
+    void setupComposite(NvBufferCompositeParams& params, uint32_t count, uint32_t sourceWidth,
+                        uint32_t sourceHeight) const {
+        memset(&params, 0, sizeof(params));
+        params.composite_flag = NVBUFFER_COMPOSITE;
+        params.input_buf_count = count;
+        for (uint32_t i = 0; i < count; i++) {
+            params.dst_comp_rect[i] = getCell(i);
+            params.dst_comp_rect_alpha[i] = 1.0f;
+            params.src_comp_rect[i].top = 0;
+            params.src_comp_rect[i].left = 0;
+            params.src_comp_rect[i].width = sourceWidth;
+            params.src_comp_rect[i].height = sourceHeight;
+        }
+    }
+};
@@ -0,0 +1,105 @@
+/*
+ * QualityController.hpp
+ *
+ * Holds one camera's JPEG quality. With a budget it steers the quality so the
+ * mean encoded size tracks the budget in bytes per image: the sizes of frames
+ * encoded at the current quality are averaged, and every few frames the
+ * quality moves in proportion to how far the average is off, outside a small
+ * dead band. A frame encoded at a different quality, lowered by backpressure
+ * or queued before the last move, says nothing about the current one and is
+ * left out. Without a budget the quality stays where it was set, at start
+ * or by setQuality() while recording. Encoder
+ * workers record sizes concurrently, the consumer reads the quality lock-free.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+
+#define QUALITY_AUTO_MIN 10         // bounds of the budget controller
+#define QUALITY_AUTO_MAX 95
+#define QUALITY_ADJUST_FRAMES 4     // frames averaged before each move
+#define QUALITY_DEADBAND 0.05       // relative size error left alone
+#define QUALITY_GAIN 25.0           // quality points per 100% size error
+#define QUALITY_MAX_STEP 10         // largest single move
+
+class QualityController {
+
+    public:
+        QualityController(int quality, uint64_t budget) :
+            _quality(quality),
+            _budget(budget),
+            _mean(0),
+            _samples(0),
+            _moves(0)
+        {}
+
+        /* Quality the next frame should be encoded at */
+        int getQuality() const {
+            return _quality.load(std::memory_order_relaxed);
+        }
+
+        /* Move the quality to a new start point, sizes seen so far no longer apply */
+        void setQuality(int quality) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _quality.store(quality, std::memory_order_relaxed);
+            _mean = 0;
+            _samples = 0;
+        }
+
+        /* Target bytes per image, 0 for a fixed quality */
+        uint64_t getBudget() const {
+            return _budget;
+        }
+
+        /* Times the quality was moved to meet the budget */
+        uint64_t getMoves() const {
+            return _moves;
+        }
+
+        /* Account an encoded image, moving the quality once enough frames at it were seen */
+        void record(int quality, uint64_t size) {
+            if (_budget == 0)
+                return;
+            std::lock_guard<std::mutex> lock(_mutex);
+            int current = _quality.load(std::memory_order_relaxed);
+            if (quality != current)
+                return;
+            _samples++;
+            _mean += ((double) size - _mean) / _samples;
+            if (_samples < QUALITY_ADJUST_FRAMES)
+                return;
+
+            double error = ((double) _budget - _mean) / _budget;
+            _mean = 0;
+            _samples = 0;
+            if (error > -QUALITY_DEADBAND && error < QUALITY_DEADBAND)
+                return;
+            int step = (int) (error * QUALITY_GAIN + (error > 0 ? 0.5 : -0.5));
+            if (step == 0)
+                step = error > 0 ? 1 : -1;
+            if (step > QUALITY_MAX_STEP)
+                step = QUALITY_MAX_STEP;
+            if (step < -QUALITY_MAX_STEP)
+                step = -QUALITY_MAX_STEP;
+            int next = current + step;
+            if (next < QUALITY_AUTO_MIN)
+                next = QUALITY_AUTO_MIN;
+            if (next > QUALITY_AUTO_MAX)
+                next = QUALITY_AUTO_MAX;
+            if (next != current) {
+                _quality.store(next, std::memory_order_relaxed);
+                _moves++;
+            }
+        }
+
+    private:
+        std::atomic<int> _quality;
+        uint64_t _budget;
+        double _mean;       // mean size of the frames seen at the current quality
+        uint32_t _samples;
+        std::atomic<uint64_t> _moves;
+        std::mutex _mutex;
+};
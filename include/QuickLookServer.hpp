@@ -0,0 +1,129 @@
+/*
+ * QuickLookServer.hpp
+ *
+ * Lets an operator browse the recently saved images of a running rover with
+ * --quicklook, without pulling full resolution files over the radio link.
+ * Each FrameWriter publishes every image it has written, the last
+ * QUICKLOOK_RECENT per camera are remembered in a table the writer updates
+ * without locks. An HTTP GET of /camN/latest.jpg or /camN/<index>.jpg reads
+ * the image back from its file or container, decodes it with the hardware
+ * JPEG decoder, scales it to ?w=<width> on the VIC and encodes the thumbnail
+ * again with NvJPEGEncoder. Thumbnails are kept in an LRU cache of
+ * QUICKLOOK_CACHE_BYTES keyed by camera, index and width. GET / lists the
+ * images that can be asked for as JSON.
+ *
+ * The recording always comes first: the thread runs at SCHED_IDLE, serves
+ * one connection at a time, makes at most --quicklook-rate thumbnails per
+ * second and answers 503 while the App reports a writer queue filling up.
+ * A cached thumbnail is served without touching the hardware.
+ */
+
+#pragma once
+
+#include "Thread.h"
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#define QUICKLOOK_RECENT 64U                // images remembered per camera
+#define QUICKLOOK_PATH_MAX 256U             // longest image path remembered
+#define QUICKLOOK_CACHE_BYTES (4U << 20)    // thumbnails kept, about 250 at 320 pixels wide
+#define QUICKLOOK_WIDTH 320U                // thumbnail width without ?w=
+#define QUICKLOOK_WIDTH_MIN 64U
+#define QUICKLOOK_WIDTH_MAX 1024U
+#define QUICKLOOK_QUALITY 75                // JPEG quality of the thumbnails
+#define QUICKLOOK_BACKOFF_PERCENT 25U       // writer queue occupancy above which nothing is decoded
+#define QUICKLOOK_BACKLOG 4                 // connections waiting to be served
+#define QUICKLOOK_REQUEST_MAX 2048          // longest request head accepted
+#define QUICKLOOK_TIMEOUT_MS 1000           // longest a client may take to send its request or read the reply
+
+class Options;
+class Logger;
+class NvJPEGDecoder;
+class NvJPEGEncoder;
+
+class QuickLookServer : public ArgusSamples::Thread {
+
+    public:
+        QuickLookServer(const Options& options, uint32_t numCameras);
+        virtual ~QuickLookServer();
+
+        void publish(uint32_t camera, uint64_t index, uint64_t timestamp, const char *path, uint64_t offset,
+                     uint64_t size);
+        void setOccupancy(double occupancy);
+
+        uint64_t getRequests();
+        uint64_t getThumbnails();
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        /* One saved image, the sequence is odd while its writer updates it */
+        struct Recent {
+            std::atomic<uint32_t> sequence;
+            uint64_t index;
+            uint64_t timestamp;
+            uint64_t offset;        // of the image in its file, 0 unless it is a container
+            uint64_t size;
+            char path[QUICKLOOK_PATH_MAX];
+        };
+
+        /* A consistent copy of a Recent */
+        struct Image {
+            uint64_t index;
+            uint64_t timestamp;
+            uint64_t offset;
+            uint64_t size;
+            char path[QUICKLOOK_PATH_MAX];
+        };
+
+        typedef std::tuple<uint32_t, uint64_t, uint32_t> ThumbnailKey;  // camera, index, width
+        struct Thumbnail {
+            ThumbnailKey key;
+            std::vector<unsigned char> data;
+        };
+
+        bool openSocket();
+        void serve(int client);
+        void reply(int client, int status, const char *type, const void *body, size_t length,
+                   const char *extraHeaders = "");
+        std::string listImages();
+        bool findImage(uint32_t camera, const std::string& name, Image& image);
+        bool readRecent(uint32_t camera, uint64_t count, Image& image);
+        bool takeToken();
+        const Thumbnail *findThumbnail(const ThumbnailKey& key);
+        const Thumbnail *makeThumbnail(const ThumbnailKey& key, const Image& image, std::string& error);
+        bool scale(int source, uint32_t width, uint32_t height, uint32_t targetWidth, uint32_t& targetHeight);
+
+        const Options& _options;
+        uint32_t _numCameras;
+        Logger *_logger;
+        int _fd;
+        Recent *_recent;                        // QUICKLOOK_RECENT per camera, a ring each
+        std::atomic<uint64_t> *_published;      // images each camera has published
+        std::atomic<uint32_t> _occupancy;       // highest writer queue occupancy in percent
+        NvJPEGDecoder *_jpegDecoder;
+        NvJPEGEncoder *_jpegEncoder;
+        int _scaled;                            // VIC target, recreated when the thumbnail size changes
+        uint32_t _scaledWidth;
+        uint32_t _scaledHeight;
+        std::vector<unsigned char> _input;      // the full image read back, kept to reuse its capacity
+        unsigned char *_output;                 // encoder output, libjpeg may replace it with a larger one
+        unsigned long _outputCapacity;
+        std::list<Thumbnail> _cache;            // most recently used first
+        std::map<ThumbnailKey, std::list<Thumbnail>::iterator> _cached;
+        uint64_t _cacheBytes;
+        double _tokens;                         // thumbnails that may be made right now
+        uint64_t _lastRefill;                   // steady clock ns the tokens were last topped up
+        std::atomic<uint64_t> _requests;
+        std::atomic<uint64_t> _thumbnails;      // made, not served from the cache
+        uint64_t _hits;
+        uint64_t _refused;                      // answered 429 or 503
+};
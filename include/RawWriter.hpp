@@ -0,0 +1,100 @@
+/*
+ * RawWriter.hpp
+ *
+ * Writes one camera's frames uncompressed into a single pre-allocated container
+ * file, bypassing the JPEG encoder. Each dmabuf from the DmabufRing is mapped
+ * once, synced for the CPU per frame and its planes are written straight into
+ * a fixed-size record; a separate index file maps records to frame numbers.
+ *
+ * Container layout (cam<N>/frames.raw):
+ *   RawContainerHeader, padded to RAW_HEADER_SIZE bytes
+ *   record 0: plane 0 (pitch[0] * height[0] bytes), plane 1, plane 2
+ *   record 1: ...
+ * Index layout (cam<N>/frames.idx): one RawIndexEntry per record.
+ *
+ * Bayer records (--raw-layout bayer12) are a single GRAY8 plane whose rows
+ * are the sensor's samples packed to MIPI RAW12, so width[0] is 3/2 of the
+ * sensor's width in bytes and packedBits is 12; YUV records leave it 0.
+ */
+
+#pragma once
+
+#include "Thread.h"
+#include "BoundedQueue.hpp"
+#include "FrameSink.hpp"
+#include "DirectFile.hpp"
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#define RAW_MAGIC "UWRAW001"
+#define RAW_HEADER_SIZE 4096
+#define RAW_MAX_PLANES 3
+#define RAW_PACKED_BITS 12  // Bayer samples per record, MIPI RAW12
+
+class Options;
+class Logger;
+class DmabufRing;
+class TelemetryLog;
+class VolumeSet;
+
+struct RawContainerHeader {
+    char magic[8];
+    uint32_t colorFormat;   // NvBufferColorFormat of the records
+    uint32_t numPlanes;
+    uint32_t width[RAW_MAX_PLANES];
+    uint32_t height[RAW_MAX_PLANES];
+    uint32_t pitch[RAW_MAX_PLANES];
+    uint64_t recordSize;    // bytes per record, the sum of pitch * height
+    uint32_t packedBits;    // bits per packed Bayer sample, 0 for YUV records
+    uint32_t sensorBits;    // bits per sample the sensor mode outputs, of those packed
+};
+
+struct RawIndexEntry {
+    uint64_t index;         // image index, matches the JPEG file numbering
+    uint64_t timestamp;     // frame time in ns
+    uint64_t record;        // record number in the container
+};
+
+class RawWriter : public ArgusSamples::Thread, public FrameSink {
+
+    public:
+        explicit RawWriter(uint32_t id, const Options& options, DmabufRing& ring, TelemetryLog *telemetry,
+                           VolumeSet *volumes);
+        virtual ~RawWriter();
+
+        virtual bool submit(const FrameJob& job);
+        virtual bool hasFailed();
+        virtual uint64_t getFramesWritten();
+        virtual uint64_t getBytesWritten();
+        virtual size_t getQueueDepth();
+        virtual const LatencyHistogram *getLatency();
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        bool openContainer(int fd);
+        void processJob(FrameJob& job);
+        bool writeFrame(const FrameJob& job);
+
+        uint32_t _id;
+        const Options& _options;
+        Logger *_logger;
+        DmabufRing& _ring;
+        TelemetryLog *_telemetry;
+        VolumeSet *_volumes;
+        int _volume;                // the container's volume in the VolumeSet
+        BoundedQueue<FrameJob> _jobs;
+        int _containerFd;
+        int _indexFd;
+        WriteBehind _behind;        // bounds the container's page cache with --direct-io
+        RawContainerHeader _header;
+        uint64_t _allocatedRecords;
+        std::vector<void*> _mappings;
+        std::atomic<uint64_t> _framesWritten;
+        LatencyHistogram _writeLatency;
+        std::atomic<bool> _failed;
+};
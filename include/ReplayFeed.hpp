@@ -0,0 +1,88 @@
+/*
+ * ReplayFeed.hpp
+ *
+ * One camera of a recorded run, read back frame by frame for a SyntheticSource
+ * in place of its pattern, so the pipeline and the tools downstream of it are
+ * exercised with real scenes and the original timing on a TX2 with no sensors
+ * attached. Takes the camN directories of the run and of its segNNN segments,
+ * on every volume it was spread over, and reads what each holds: container
+ * segments and per-file images in index order, or a raw container. Every file
+ * is mapped read-only rather than read; JPEG images are decoded with
+ * NvJPEGDecoder::decodeToFd and blitted on the VIC into the ring slot, raw
+ * records are copied through a pitch linear staging buffer and blitted the
+ * same way. Each frame keeps its recorded image index and frame time, from
+ * the container indexes or, for per-file images, from camN/metadata.bin.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define REPLAY_CONTAINER 0
+#define REPLAY_IMAGE 1
+#define REPLAY_RAW 2
+
+class ContainerReader;
+class NvJPEGDecoder;
+
+class ReplayFeed {
+
+    public:
+        ReplayFeed(const std::vector<std::string>& runs, uint32_t camera, uint64_t frameDuration);
+        ~ReplayFeed();
+
+        bool open();
+        bool peek(uint64_t& timestamp) const;
+        bool next(int fd, uint64_t& index, uint64_t& timestamp);
+        void skip();
+
+        uint64_t getCount() const;
+        uint64_t getFirstTimestamp() const;
+        uint64_t getFramesSkipped() const;
+        bool getSize(uint32_t& width, uint32_t& height);
+        const std::string& getError() const;
+
+        static uint32_t countCameras(const std::vector<std::string>& runs);
+
+    private:
+        /* A container segment, a single image or a raw container with its mapping */
+        struct Source {
+            std::string path;
+            int kind;
+            ContainerReader *container;
+            const unsigned char *map;   // of a raw container, images are mapped when read
+            uint64_t size;
+            int staging;                // pitch linear buffer a raw record is copied into
+            uint32_t numPlanes;
+            uint32_t width[3];
+            uint32_t height[3];
+            uint32_t pitch[3];
+        };
+
+        /* One frame of the camera, in the order recorded */
+        struct Entry {
+            uint32_t source;
+            uint64_t position;  // container entry, or byte offset of a raw record
+            uint64_t index;
+            uint64_t timestamp;
+        };
+
+        void addDirectory(const std::string& directory);
+        bool openRaw(Source& source, const std::string& indexPath);
+        void readMetadata(const std::string& directory);
+        bool decode(const unsigned char *data, uint64_t size, int& decoded, uint32_t& width, uint32_t& height);
+        bool copyRecord(const Source& source, uint64_t offset);
+
+        std::vector<std::string> _runs;
+        uint32_t _camera;
+        uint64_t _frameDuration;    // ns between frames of images without a recorded time
+        std::vector<Source> _sources;
+        std::vector<Entry> _entries;
+        std::vector<std::pair<uint64_t, uint64_t> > _times;    // image index and frame time from metadata.bin
+        size_t _next;
+        NvJPEGDecoder *_decoder;
+        uint64_t _skipped;
+        std::string _error;
+};
@@ -0,0 +1,259 @@
+/*
+ * RingQueue.hpp
+ *
+ * Bounded lock-free rings that pass items between threads without a lock or
+ * an allocation after construction. A full ring refuses the item and counts a
+ * drop, an empty one returns false at once; callers that need to wait do so
+ * around them, as BoundedQueue does.
+ *
+ * SpscRing is for one producer and one consumer thread: each side owns its
+ * index and a cached copy of the other's, so a push or pop touches the shared
+ * line only when the cache says the ring looks full or empty. MpmcRing takes
+ * any number of producers and consumers, or one of them, with a sequence per
+ * slot (Vyukov's bounded queue): a slot is claimed by a compare and swap of
+ * the index and handed over by a release store of its sequence, so a consumer
+ * on the TX2's weakly ordered cores never reads an item before it is written.
+ * A producer reaching a slot whose consumer has claimed it but not finished
+ * reading waits for it rather than calling the ring full, so a free list of
+ * as many slots as it has indexes never refuses one.
+ *
+ * The indexes of either side are kept on cache lines of their own, so the
+ * producers and the consumers do not invalidate each other's lines on every
+ * item. Capacities need not be powers of two.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#define CACHE_LINE_SIZE 64  // Cortex-A57 and Denver L1 lines
+
+template <typename T>
+class SpscRing {
+
+    public:
+        explicit SpscRing(size_t capacity) :
+            _items(new T[capacity]),
+            _capacity(capacity),
+            _tail(0),
+            _cachedHead(0),
+            _drops(0),
+            _head(0),
+            _cachedTail(0)
+        {}
+
+        ~SpscRing() {
+            delete[] _items;
+        }
+
+        /* Producer: append an item, returns false and counts a drop if the ring is full */
+        bool tryPush(const T& item) {
+            uint64_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail - _cachedHead == _capacity) {
+                _cachedHead = _head.load(std::memory_order_acquire);
+                if (tail - _cachedHead == _capacity) {
+                    _drops.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+            _items[tail % _capacity] = item;
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        /* Consumer: remove the oldest item */
+        bool tryPop(T& item) {
+            uint64_t head = _head.load(std::memory_order_relaxed);
+            if (head == _cachedTail) {
+                _cachedTail = _tail.load(std::memory_order_acquire);
+                if (head == _cachedTail)
+                    return false;
+            }
+            item = _items[head % _capacity];
+            _head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        /* Consumer: copy the oldest item without removing it */
+        bool peek(T& item) {
+            uint64_t head = _head.load(std::memory_order_relaxed);
+            if (head == _cachedTail) {
+                _cachedTail = _tail.load(std::memory_order_acquire);
+                if (head == _cachedTail)
+                    return false;
+            }
+            item = _items[head % _capacity];
+            return true;
+        }
+
+        /* Items queued, exact from either side's own thread and a snapshot from any other */
+        size_t size() const {
+            uint64_t head = _head.load(std::memory_order_acquire);
+            uint64_t tail = _tail.load(std::memory_order_acquire);
+            return tail > head ? tail - head : 0;
+        }
+
+        size_t capacity() const {
+            return _capacity;
+        }
+
+        uint64_t drops() const {
+            return _drops.load(std::memory_order_relaxed);
+        }
+
+    private:
+        SpscRing(const SpscRing&);
+        SpscRing& operator=(const SpscRing&);
+
+        T *_items;
+        const size_t _capacity;
+        char _pad0[CACHE_LINE_SIZE];
+        std::atomic<uint64_t> _tail;    // producer's line
+        uint64_t _cachedHead;
+        std::atomic<uint64_t> _drops;
+        char _pad1[CACHE_LINE_SIZE];
+        std::atomic<uint64_t> _head;    // consumer's line
+        uint64_t _cachedTail;
+        char _pad2[CACHE_LINE_SIZE];
+};
+
+template <typename T>
+class MpmcRing {
+
+    public:
+        explicit MpmcRing(size_t capacity) :
+            _slots(new Slot[capacity]),
+            _capacity(capacity),
+            _tail(0),
+            _drops(0),
+            _head(0)
+        {
+            for (size_t i = 0; i < _capacity; i++)
+                _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        ~MpmcRing() {
+            delete[] _slots;
+        }
+
+        /* Append an item, returns false and counts a drop if the ring is full */
+        bool tryPush(const T& item) {
+            return tryPushWith([&item](T& slot) { slot = item; });
+        }
+
+        /* Append an item filled in place by fill(T&), which must not block */
+        template <typename F>
+        bool tryPushWith(F fill) {
+            uint64_t pos = _tail.load(std::memory_order_relaxed);
+            Slot *slot = NULL;
+            while (!slot) {
+                Slot *candidate = &_slots[pos % _capacity];
+                uint64_t sequence = candidate->sequence.load(std::memory_order_acquire);
+                int64_t diff = (int64_t) sequence - (int64_t) pos;
+                if (diff == 0) {
+                    if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        slot = candidate;
+                } else if (diff < 0) {
+                    /* Full only with capacity items past the head, otherwise its consumer is still reading it */
+                    int64_t queued = (int64_t) (pos - _head.load(std::memory_order_acquire));
+                    if (queued >= (int64_t) _capacity) {
+                        _drops.fetch_add(1, std::memory_order_relaxed);
+                        return false;
+                    }
+                    pos = _tail.load(std::memory_order_relaxed);
+                } else {
+                    pos = _tail.load(std::memory_order_relaxed);
+                }
+            }
+            fill(slot->item);
+            slot->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        /* Remove the oldest item */
+        bool tryPop(T& item) {
+            return tryPopWith([&item](const T& slot) { item = slot; });
+        }
+
+        /* Remove the oldest item, read in place by consume(const T&) before its slot is reused */
+        template <typename F>
+        bool tryPopWith(F consume) {
+            uint64_t pos = _head.load(std::memory_order_relaxed);
+            Slot *slot = NULL;
+            while (!slot) {
+                Slot *candidate = &_slots[pos % _capacity];
+                uint64_t sequence = candidate->sequence.load(std::memory_order_acquire);
+                int64_t diff = (int64_t) sequence - (int64_t) (pos + 1);
+                if (diff == 0) {
+                    if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        slot = candidate;
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = _head.load(std::memory_order_relaxed);
+                }
+            }
+            consume(slot->item);
+            slot->sequence.store(pos + _capacity, std::memory_order_release);
+            return true;
+        }
+
+        /* Copy the oldest item without removing it. Another consumer may take it meanwhile, so the copy
+           is checked against the slot's sequence afterwards and retried if the slot moved on, the way a
+           seqlock reader is; T must be safe to copy while a producer rewrites it, plain data is */
+        bool peek(T& item) {
+            while (true) {
+                uint64_t pos = _head.load(std::memory_order_acquire);
+                Slot *slot = &_slots[pos % _capacity];
+                uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+                int64_t diff = (int64_t) sequence - (int64_t) (pos + 1);
+                if (diff < 0)
+                    return false;
+                if (diff > 0)
+                    continue;
+                item = slot->item;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot->sequence.load(std::memory_order_relaxed) == sequence)
+                    return true;
+            }
+        }
+
+        /* Items claimed and not yet taken, a snapshot */
+        size_t size() const {
+            uint64_t head = _head.load(std::memory_order_acquire);
+            uint64_t tail = _tail.load(std::memory_order_acquire);
+            if (tail <= head)
+                return 0;
+            return tail - head < _capacity ? tail - head : _capacity;
+        }
+
+        size_t capacity() const {
+            return _capacity;
+        }
+
+        uint64_t drops() const {
+            return _drops.load(std::memory_order_relaxed);
+        }
+
+    private:
+        MpmcRing(const MpmcRing&);
+        MpmcRing& operator=(const MpmcRing&);
+
+        /* sequence is the index the slot next expects: pos when free for a push at pos, pos + 1 when
+           holding the item pushed at pos */
+        struct Slot {
+            std::atomic<uint64_t> sequence;
+            T item;
+        };
+
+        Slot *_slots;
+        const size_t _capacity;
+        char _pad0[CACHE_LINE_SIZE];
+        std::atomic<uint64_t> _tail;    // producers' line
+        std::atomic<uint64_t> _drops;
+        char _pad1[CACHE_LINE_SIZE];
+        std::atomic<uint64_t> _head;    // consumers' line
+        char _pad2[CACHE_LINE_SIZE];
+};
@@ -0,0 +1,60 @@
+/*
+ * RoiMap.hpp
+ *
+ * Weights one camera's video bitrate by region with the encoder's ROI
+ * parameters, so the horizon and the terrain ahead keep their detail while
+ * the chassis and the sky give up bits. Static regions come from --roi and
+ * are sent with every frame. With --roi-saliency every Nth frame is also
+ * downscaled by the VIC into a small pitch-linear NvBuffer, the luma gradient
+ * of each tile of a coarse grid measures its detail, and the tiles furthest
+ * from the mean fill the region slots the static map left free: flat tiles
+ * are given a higher QP, detailed tiles a lower one. The map stays in effect
+ * until the next refresh.
+ */
+
+#pragma once
+
+#include "LatencyHistogram.hpp"
+#include <linux/videodev2.h>
+#include "v4l2_nv_extensions.h"
+#include <stdint.h>
+#include <string>
+
+#define ROI_SALIENCY_WIDTH 128
+#define ROI_SALIENCY_HEIGHT 96
+#define ROI_GRID_COLUMNS 4
+#define ROI_GRID_ROWS 3
+
+class Options;
+
+class RoiMap {
+
+    public:
+        RoiMap(uint32_t id, const Options& options);
+        ~RoiMap();
+
+        bool open();
+        bool isEnabled() const;
+        bool update(int captureFd, uint64_t frameNumber);
+        const v4l2_enc_frame_ROI_params& getParams() const;
+
+        uint64_t getRefreshes() const;
+        const LatencyHistogram *getCost() const;
+        const std::string& getError() const;
+
+    private:
+        void refresh();
+
+        uint32_t _id;
+        uint32_t _width;            // encoded frame the regions are in
+        uint32_t _height;
+        uint32_t _interval;         // frames between saliency refreshes, 0 for static regions only
+        uint32_t _static;           // regions from --roi, first in the parameters
+        v4l2_enc_frame_ROI_params _params;
+        int _fd;
+        void *_mapping;
+        uint32_t _pitch;
+        uint64_t _refreshes;
+        LatencyHistogram _cost;
+        std::string _error;
+};
@@ -0,0 +1,77 @@
+/*
+ * RtpSink.hpp
+ *
+ * A PreviewSink that streams the composite to a remote operator as H.264 over
+ * RTP/UDP (RFC 6184). Each composite is copied into one of the sink's own
+ * dmabufs and queued on the hardware encoder, which runs the ultrafast preset
+ * without B-frames in CBR at --stream-bitrate. Slice-level encode returns every
+ * slice as soon as it is done and the capture plane thread packetizes it right
+ * away, as single NAL packets or FU-A fragments, so the first packets leave
+ * before the frame has finished encoding. A composite arriving while the
+ * encoder still holds both buffers is dropped rather than queued.
+ *
+ * Latency is measured from the acquire of the composite's oldest tile to its
+ * last packet leaving the socket, and logged as percentiles. The first packet
+ * of every frame carries the tile's capture time as a wall-clock NTP timestamp
+ * in a one-byte RTP header extension (RFC 8285, id 1), so a receiver with a
+ * synchronized clock can complete the glass-to-glass measurement.
+ */
+
+#pragma once
+
+#include "PreviewCompositor.hpp"
+#include "LatencyHistogram.hpp"
+#include <stdint.h>
+#include <atomic>
+
+#define RTP_OUTPUT_BUFFERS 2
+
+class Logger;
+class NvVideoEncoder;
+class NvBuffer;
+struct v4l2_buffer;
+
+class RtpSink : public PreviewSink {
+
+    public:
+        explicit RtpSink(const Options& options);
+        virtual ~RtpSink();
+
+        virtual bool open(const Argus::Size2D<uint32_t>& size);
+        virtual bool consume(int fd, uint64_t timestamp);
+        virtual void close();
+
+    private:
+        bool setupEncoder(const Argus::Size2D<uint32_t>& size);
+        bool getOutputBuffer(struct v4l2_buffer& v4l2_buf);
+        void sendSlice(const uint8_t *data, uint32_t size, uint64_t captureTime);
+        void sendNal(const uint8_t *nal, uint32_t size, bool last);
+        void sendPacket(const uint8_t *payload, uint32_t size, const uint8_t *prefix, uint32_t prefixSize, bool marker);
+        static bool captureCallback(struct v4l2_buffer *v4l2_buf, NvBuffer *buffer,
+                                    NvBuffer *shared_buffer, void *data);
+
+        const Options& _options;
+        Logger *_logger;
+        NvVideoEncoder *_encoder;
+        int _buffers[RTP_OUTPUT_BUFFERS];
+        uint32_t _numQueued;
+        uint32_t _slicesPerFrame;
+        int _socket;
+
+        /* RTP state, only touched from the capture plane thread */
+        uint16_t _sequence;
+        uint32_t _ssrc;
+        uint32_t _rtpTimestamp;
+        uint64_t _frameCapture;     // steady clock us of the frame being sent
+        uint32_t _slicesSent;
+        bool _extensionPending;     // the next packet opens a frame and carries its capture time
+        int64_t _wallOffset;        // realtime minus steady clock, ns
+        uint8_t _packet[2048];
+
+        LatencyHistogram _latency;
+        std::atomic<uint64_t> _framesSent;
+        std::atomic<uint64_t> _framesDropped;
+        std::atomic<uint64_t> _packetsDropped;
+        std::atomic<uint64_t> _bytesSent;
+        uint64_t _opened;
+};
@@ -0,0 +1,25 @@
+/*
+ * RunLayout.hpp
+ *
+ * Walks the directory layout of a recorded run: the run directory and its
+ * segNNN segments, one camN directory per camera in each, and the NNNN
+ * sub-directories --fanout shards a camera's image files into. Shared by
+ * --verify and the tools and feeds that read a run back.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/* True if name is prefix, at least one digit and suffix, e.g. frames000.mjpg */
+bool matchName(const char *name, const char *prefix, const char *suffix);
+
+/* Names of the directory's entries sorted by name, empty if it cannot be read */
+std::vector<std::string> listDirectory(const std::string& directory);
+
+/* The run directories themselves followed by their segNNN segments */
+std::vector<std::string> findSegments(const std::vector<std::string>& runs);
+
+/* A camN directory followed by its --fanout sub-directories */
+std::vector<std::string> findCameraDirectories(const std::string& cameraDirectory);
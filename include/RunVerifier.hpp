@@ -0,0 +1,60 @@
+/*
+ * RunVerifier.hpp
+ *
+ * Checks a finished run against the CRC32C the writers recorded, in place of
+ * decoding every image on a laptop after a power loss. Each camera's
+ * checksums.csv and container indexes are read, then one thread per core
+ * re-reads the images and compares size and checksum. Images that are
+ * missing, truncated or corrupt, and image files no index lists, are logged
+ * and written to verify.csv in the run directory. With --recover container
+ * segments left open by a crash are closed before they are checked.
+ * File format: camera,index,path,problem
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <set>
+#include <string>
+#include <vector>
+
+class Options;
+class Logger;
+
+class RunVerifier {
+
+    public:
+        explicit RunVerifier(Options& options);
+        ~RunVerifier();
+
+        bool run(const std::atomic<bool>& doRun);
+
+    private:
+        /* One image to re-read */
+        struct Check {
+            uint32_t camera;
+            uint64_t index;
+            std::string path;
+            uint64_t offset;
+            uint64_t size;
+            bool container;         // offset into a container, otherwise an image file of its own
+            uint32_t crc;
+            bool checksummed;       // false for container entries from before checksums
+            int problem;            // -1 until checked
+        };
+
+        bool findVolumes(std::vector<std::string>& directories);
+        bool readChecksums(uint32_t camera, const std::vector<std::string>& directories, std::set<uint64_t>& indexed);
+        bool readContainers(uint32_t camera, const std::string& directory);
+        void recoverContainers(uint32_t camera, const std::string& directory);
+        void findUnindexed(uint32_t camera, const std::vector<std::string>& directories,
+                           const std::set<uint64_t>& indexed);
+        void verify(std::atomic<size_t>& next, const std::atomic<bool>& doRun);
+
+        Options& _options;
+        Logger *_logger;
+        std::vector<Check> _checks;
+        std::vector<Check> _unindexed;
+        uint32_t _fanout;               // image files per sub-directory, 0 if they are all in camN
+};
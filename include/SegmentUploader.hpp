@@ -0,0 +1,77 @@
+/*
+ * SegmentUploader.hpp
+ *
+ * Sends every closed segment of a --segment run to the ground station while
+ * recording, so little is left to pull off the volumes once the rover is
+ * back. Each segment goes over one TCP connection to --offload as a tar
+ * stream: the ustar header of each file is sent from user space, its data
+ * with sendfile straight from the page cache. A receiver needs nothing but
+ * tar, e.g. socat TCP-LISTEN:9000,fork EXEC:"tar x". Segments on other
+ * volumes than the first arrive as <run>.volN/segNNN.
+ *
+ * The thread runs in the SCHED_IDLE class at idle I/O priority, holds its
+ * rate to --offload-rate MiB/s and pauses while the App reports a writer
+ * queue filling up. A failed segment is sent again from the start after a
+ * pause. offload.csv in the root directory lists every segment sent.
+ * File format: segment,files,bytes,seconds
+ */
+
+#pragma once
+
+#include "Thread.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+class Options;
+class Logger;
+class VolumeSet;
+
+class SegmentUploader : public ArgusSamples::Thread {
+
+    public:
+        SegmentUploader(const Options& options, VolumeSet& volumes);
+        virtual ~SegmentUploader();
+
+        void setOccupancy(double occupancy);
+
+        uint32_t getSegmentsSent();
+        uint64_t getBytesSent();
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        /* One file of the segment, path is relative to the run directory on its volume */
+        struct Upload {
+            std::string source;
+            std::string name;
+            uint64_t size;
+            uint64_t mtime;
+        };
+
+        bool sendSegment(uint32_t segment, uint32_t& files, uint64_t& bytes);
+        void listFiles(const std::string& directory, const std::string& name, std::vector<Upload>& uploads);
+        int connectReceiver();
+        bool sendHeader(int socket, const Upload& upload);
+        bool sendFile(int socket, const Upload& upload, uint64_t& bytes);
+        bool sendAll(int socket, const void *data, size_t size);
+        bool pace(uint64_t bytes);
+        bool sleepFor(uint64_t ns);
+
+        const Options& _options;
+        VolumeSet& _volumes;
+        Logger *_logger;
+        FILE *_index;
+        std::string _runName;
+        uint32_t _next;                 // segment to send next
+        std::atomic<uint32_t> _occupancy;       // highest writer queue occupancy in percent
+        std::atomic<uint32_t> _segmentsSent;
+        std::atomic<uint64_t> _bytesSent;
+        uint64_t _paceStart;            // steady clock ns the rate is measured from
+        uint64_t _paceBytes;            // bytes sent since _paceStart
+};
@@ -0,0 +1,48 @@
+/*
+ * SessionEvents.hpp
+ *
+ * A thread that drains one capture session's IEventProvider for the whole run.
+ * Capture-complete events are counted, with those whose status was not OK
+ * counted as failed captures, and every error event is counted and logged
+ * with its status. A shared session covers every camera, otherwise there is
+ * one per camera. The getters feed the status file and may be called from
+ * any thread.
+ */
+
+#pragma once
+
+#include "Thread.h"
+#include <Argus/Argus.h>
+#include <stdint.h>
+#include <atomic>
+
+class Options;
+class Logger;
+
+class SessionEvents : public ArgusSamples::Thread {
+
+    public:
+        explicit SessionEvents(uint32_t id, Argus::CaptureSession *session, const Options& options);
+        virtual ~SessionEvents();
+
+        uint32_t getId() const;
+        uint64_t getCapturesCompleted();
+        uint64_t getCapturesFailed();
+        uint64_t getErrors();
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        uint32_t _id;
+        Argus::CaptureSession *_session;
+        const Options& _options;
+        Logger *_logger;
+        Argus::IEventProvider *_iEventProvider;
+        Argus::UniqueObj<Argus::EventQueue> _queue;
+        std::atomic<uint64_t> _capturesCompleted;
+        std::atomic<uint64_t> _capturesFailed;
+        std::atomic<uint64_t> _errors;
+};
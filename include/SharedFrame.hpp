@@ -0,0 +1,40 @@
+/*
+ * SharedFrame.hpp
+ *
+ * Wire format of the --share socket, for subscriber processes to include.
+ * The socket is SOCK_SEQPACKET, so every message arrives whole. For each
+ * camera a subscriber gets one SharedFrame at a time, with the camera's
+ * dmabuf attached as SCM_RIGHTS ancillary data; the NvBuffer behind it can be
+ * mapped or handed to the VIC, GPU or encoder like any other. Once done
+ * reading, the subscriber closes the fd and sends a SharedRelease with the
+ * frame's token, and gets the newest frame of that camera next. Frames that
+ * arrive in between are never queued for it, so a slow subscriber sees fewer
+ * frames but cannot hold up recording.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define SHARED_FRAME_MAGIC 0x31524653U  // "SFR1" in memory order
+#define SHARED_RELEASE_MAGIC 0x31524c53U // "SLR1"
+
+/* One frame handed to a subscriber, the dmabuf fd comes with it */
+struct SharedFrame {
+    uint32_t magic;         // SHARED_FRAME_MAGIC
+    uint32_t camera;
+    uint32_t width;
+    uint32_t height;
+    uint32_t colorFormat;   // NvBufferColorFormat
+    uint32_t layout;        // NvBufferLayout
+    uint64_t token;         // returned in the SharedRelease
+    uint64_t index;         // image index the recording saved the frame as
+    uint64_t timestamp;     // sensor timestamp in ns
+};
+
+/* Sent back by the subscriber, the buffer may be reused from then on */
+struct SharedRelease {
+    uint32_t magic;         // SHARED_RELEASE_MAGIC
+    uint32_t reserved;
+    uint64_t token;
+};
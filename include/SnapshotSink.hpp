@@ -0,0 +1,33 @@
+/*
+ * SnapshotSink.hpp
+ *
+ * A PreviewSink that JPEG encodes every composite it is handed and replaces
+ * preview.jpg in the root directory with it. The file is written to a
+ * temporary and renamed, so a viewer or web server polling it never reads a
+ * partial image.
+ */
+
+#pragma once
+
+#include "PreviewCompositor.hpp"
+#include <string>
+
+class NvJPEGEncoder;
+
+class SnapshotSink : public PreviewSink {
+
+    public:
+        explicit SnapshotSink(const Options& options);
+        virtual ~SnapshotSink();
+
+        virtual bool open(const Argus::Size2D<uint32_t>& size);
+        virtual bool consume(int fd, uint64_t timestamp);
+        virtual void close();
+
+    private:
+        const Options& _options;
+        NvJPEGEncoder *_jpegEncoder;
+        unsigned char *_buffer;
+        unsigned long _capacity;
+        std::string _filename;
+};
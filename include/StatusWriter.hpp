@@ -0,0 +1,44 @@
+/*
+ * StatusWriter.hpp
+ *
+ * Periodically rewrites status.json in the output directory while recording,
+ * so a headless run can be monitored with nothing more than cat. The App calls
+ * publish() from its supervisor loop; rates are computed from the difference to
+ * the previous publish. The file is written to a temporary and renamed over the
+ * old one so readers never see a partial document.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+class Options;
+class ConsumerThread;
+class VolumeSet;
+class BackpressureEngine;
+class CapacityForecast;
+class SessionEvents;
+
+class StatusWriter {
+
+    public:
+        StatusWriter(const Options& options, uint32_t numCameras, VolumeSet *volumes, BackpressureEngine *backpressure,
+                     CapacityForecast *forecast, const std::vector<SessionEvents*>& sessions);
+
+        bool publish(ConsumerThread **consumers, uint32_t numCameras);
+
+    private:
+        const Options& _options;
+        VolumeSet *_volumes;
+        BackpressureEngine *_backpressure;
+        CapacityForecast *_forecast;
+        const std::vector<SessionEvents*>& _sessions;
+        std::string _filename;
+        std::chrono::steady_clock::time_point _start;
+        std::chrono::steady_clock::time_point _last;
+        std::vector<uint64_t> _lastFrames;
+        std::vector<uint64_t> _lastBytes;
+};
@@ -0,0 +1,18 @@
+/*
+ * SteadyClock.hpp
+ *
+ * Steady clock time in ns, the clock the pipeline measures its latencies,
+ * intervals and deadlines with. Sensor timestamps are CLOCK_MONOTONIC and
+ * are compared through ClusterLink::now() instead.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+
+/* Steady clock time in ns */
+inline uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
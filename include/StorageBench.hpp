@@ -0,0 +1,54 @@
+/*
+ * StorageBench.hpp
+ *
+ * Replays the write pattern of a recording against candidate volumes before a
+ * mission, in place of testing them by hand with dd. For each volume in turn
+ * one FrameWriter per camera is fed images of the benchmark size at the
+ * benchmark rate, so the chosen container size, --direct-io and --aio
+ * settings are exercised exactly as in a run. Each volume's sustained rate,
+ * the write latency tail of its slowest camera and the drops are reported,
+ * with the smallest --save-every that keeps the demand within what the
+ * volume sustained. The files written are removed afterwards.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#define STORAGE_BENCH_TIME 20 // seconds per volume without --capture-time
+
+class Options;
+class Logger;
+
+class StorageBench {
+
+    public:
+        explicit StorageBench(Options& options);
+        ~StorageBench();
+
+        bool run(const std::atomic<bool>& doRun);
+
+    private:
+        /* What one volume sustained */
+        struct Result {
+            std::string volume;
+            double seconds;
+            uint64_t framesWritten;
+            uint64_t framesDropped;
+            uint64_t bytesWritten;
+            uint64_t p50;           // write latency of the slowest camera in us
+            uint64_t p99;
+            uint64_t max;
+            bool failed;
+        };
+
+        bool benchVolume(const std::string& volume, const std::atomic<bool>& doRun, Result& result);
+        int recommendSaveEvery(const Result& result) const;
+        double getDemand() const;
+
+        Options& _options;
+        Logger *_logger;
+};
@@ -0,0 +1,47 @@
+/*
+ * SyntheticPattern.hpp
+ *
+ * A short loop of YUV420 frames in pitch linear NvBuffers standing in for a
+ * camera, shared read-only by every SyntheticSource. A gradient moves a few
+ * pixels per frame and compresses about like a real scene, noise is the
+ * worst case for the encoder and the writers, and a file replays raw I420
+ * frames of the bench resolution, looping over the first PATTERN_FRAMES.
+ */
+
+#pragma once
+
+#include <Argus/Argus.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#define PATTERN_FRAMES 8 // frames in the loop, enough that no two consecutive frames match
+#define PATTERN_SEED 2463534242U // xorshift32 seed of the noise pattern unless another is given
+
+#define PATTERN_GRADIENT 0
+#define PATTERN_NOISE 1
+#define PATTERN_FILE 2
+
+class SyntheticPattern {
+
+    public:
+        SyntheticPattern(Argus::Size2D<uint32_t> size, int kind, const std::string& path, uint32_t seed = PATTERN_SEED);
+        ~SyntheticPattern();
+
+        bool create();
+
+        int getFd(uint64_t frame) const;
+        uint32_t getCount() const;
+        const std::string& getError() const;
+
+    private:
+        bool fill(int fd, uint32_t frame, FILE *file);
+
+        Argus::Size2D<uint32_t> _size;
+        int _kind;
+        std::string _path;
+        uint32_t _seed;
+        std::vector<int> _fds;
+        std::string _error;
+};
@@ -0,0 +1,107 @@
+/*
+ * SyntheticSource.hpp
+ *
+ * Stands in for a ConsumerThread without an Argus stream: paced at the bench
+ * frame rate, it copies the next SyntheticPattern frame into a slot of its
+ * DmabufRing with the same VIC blit a capture takes and submits the slot to
+ * the sink the real camera would use, a shared EncodeScheduler channel with
+ * its FrameWriter for JPEG, a RawWriter or a VideoWriter. Frames are dropped
+ * the same way as in the consumer when the ring or the sink is full, and
+ * ticks the thread could not keep up with are counted as late. Given a
+ * ReplayFeed the frames come from a recorded run instead, published at their
+ * recorded frame times or, at speed 0, as fast as the sink takes them, waiting
+ * for ring slots and queue space rather than dropping; the source stops after
+ * the last recorded frame. Frames are offered to --share subscribers as the
+ * consumer offers them. With --tnr each frame is staged and filtered into its
+ * slot by a TnrFilter, as an EGLStream capture is in the consumer. Note that for ThreadExecute to terminate, stopExecute
+ * must first be called on the object.
+ */
+
+#pragma once
+
+#include "Thread.h"
+#include "LatencyHistogram.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+
+class Options;
+class Logger;
+class SyntheticPattern;
+class DmabufRing;
+class BufferPool;
+class FrameWriter;
+class EncodeScheduler;
+class EncodeChannel;
+class RawWriter;
+class VideoWriter;
+class FrameSink;
+class VolumeSet;
+class FramePublisher;
+class ReplayFeed;
+class TnrFilter;
+
+/* What one stage of a source achieved over the run */
+struct StageResult {
+    const char *name;
+    uint64_t frames;
+    double fps;
+    double mibPerSecond;
+    uint64_t p50;           // latency in us
+    uint64_t p95;
+    uint64_t p99;
+    uint64_t max;
+};
+
+class SyntheticSource : public ArgusSamples::Thread {
+
+    public:
+        explicit SyntheticSource(uint32_t id, const Options& options, const SyntheticPattern& pattern,
+                                 EncodeScheduler *scheduler, VolumeSet *volumes, uint64_t frameDuration,
+                                 FramePublisher *publisher = NULL, ReplayFeed *replay = NULL, uint64_t replayEpoch = 0,
+                                 double replaySpeed = 1);
+        virtual ~SyntheticSource();
+
+        void stopExecute();
+        bool isExecuting();
+        uint64_t getFramesWritten();
+        bool report(double seconds, FILE *file);
+        void getStages(double seconds, std::vector<StageResult>& stages);
+        uint64_t getFramesDropped();
+        uint64_t getBytesPerFrame();
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        bool produce(uint64_t frame, uint64_t& index);
+        bool replay();
+
+        uint32_t _id;
+        const Options& _options;
+        const SyntheticPattern& _pattern;
+        EncodeScheduler *_scheduler;
+        VolumeSet *_volumes;
+        uint64_t _frameDuration;    // ns between frames
+        FramePublisher *_publisher;
+        ReplayFeed *_replay;
+        uint64_t _replayEpoch;      // recorded time the replay starts at, the earliest camera's first frame
+        double _replaySpeed;        // multiple of the recorded rate, 0 for as fast as the sink takes frames
+        Logger *_logger;
+        DmabufRing *_ring;
+        BufferPool *_pool;
+        FrameWriter *_writer;
+        EncodeChannel *_channel;
+        RawWriter *_rawWriter;
+        VideoWriter *_videoWriter;
+        FrameSink *_sink;
+        TnrFilter *_tnr;
+        std::atomic<bool> _doExecute;
+        std::atomic<uint64_t> _framesProduced;
+        std::atomic<uint64_t> _framesDropped;
+        std::atomic<uint64_t> _framesLate;
+        LatencyHistogram _copyLatency;
+};
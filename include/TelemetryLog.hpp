@@ -0,0 +1,71 @@
+/*
+ * TelemetryLog.hpp
+ *
+ * Appends one fixed-size binary record per saved, dropped or skipped frame to
+ * cam<N>/telemetry.bin. Each pipeline stage fills in its own timings as the
+ * record travels with the frame, and the last stage appends it. Records are
+ * batched in memory so logging costs a copy per frame and a write per batch.
+ * Decode with the TelemetryDump tool.
+ *
+ * File layout: TelemetryHeader, then TelemetryRecord * n
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+
+#define TELEMETRY_MAGIC "UWTEL001"
+
+/* TelemetryRecord flags */
+#define TELEMETRY_DROP_RING 0x1     // no free dmabuf, the frame was never copied
+#define TELEMETRY_DROP_BUFFER 0x2   // no free encoder output buffer
+#define TELEMETRY_DROP_QUEUE 0x4    // a stage queue was full
+#define TELEMETRY_FAILED 0x8        // encoding or writing failed
+#define TELEMETRY_SKIP_MOTION 0x10  // skipped by the motion gate, nothing changed since the last kept frame
+#define TELEMETRY_SKIP_EXPOSURE 0x20 // skipped by the exposure gate, mostly black or saturated
+
+struct TelemetryHeader {
+    char magic[8];
+    uint32_t camera;
+    uint32_t recordSize;    // sizeof(TelemetryRecord) for forward compatibility
+};
+
+struct TelemetryRecord {
+    uint64_t frameNumber;   // Argus frame number
+    uint64_t timestamp;     // sensor timestamp in ns
+    uint64_t index;         // image index, matches the file numbering
+    uint32_t acquireUs;     // time blocked in acquireFrame
+    uint32_t copyUs;        // copyToNvBuffer
+    uint32_t queueUs;       // waiting in the encoder and writer queues
+    uint32_t encodeUs;      // JPEG encode, or video encoder turnaround
+    uint32_t writeUs;       // writing to storage
+    uint32_t size;          // bytes written for this frame, 0 if unknown
+    uint32_t gap;           // sensor frames missed since the previous saved frame
+    uint32_t flags;         // TELEMETRY_* bits
+};
+
+class TelemetryLog {
+
+    public:
+        TelemetryLog(uint32_t id, std::string directory);
+        ~TelemetryLog();
+
+        bool open();
+        bool append(const TelemetryRecord& record);
+        bool close();
+
+        uint64_t getRecordCount();
+
+    private:
+        bool flush();
+
+        uint32_t _id;
+        std::string _directory;
+        int _fd;
+        std::vector<TelemetryRecord> _batch;
+        uint64_t _records;
+        std::mutex _mutex;
+};
@@ -0,0 +1,98 @@
+/*
+ * ThermalGovernor.hpp
+ *
+ * Sheds capture load in explicit, logged steps as the TX2 nears its thermal
+ * throttle points, so a hot day costs a known share of the frames instead of
+ * an unexplained fps collapse once the clocks are throttled. The App calls
+ * sample() from its supervisor loop, which once a second reads the thermal
+ * zones, the CPU, GPU and EMC clocks, the nvpmodel mode and the board's input
+ * power. The zone closest to its throttle point decides: headroom held below
+ * the margin moves every camera one level up a ladder, headroom held above the
+ * margin plus a hysteresis for longer moves them one level down. The ladder
+ * doubles the save every, then lowers the JPEG quality, then parks cameras
+ * from the last one down. Changes reach the ConsumerThreads as the control
+ * socket's do, a save every on a stretched sensor slows the sensor itself.
+ * The settings from before the first step are restored at level 0.
+ *
+ * The input power is integrated over the run, with the frames written that
+ * gives the frames per joule to compare nvpmodel modes by.
+ *
+ * Every sample is appended to thermal.csv in the root directory.
+ * File format: elapsed_ms,nvpmodel,cpu_mhz,gpu_mhz,emc_mhz,power_mw,zone,temp_mc,headroom_mc,level,frames,frames_per_joule
+ * where zone is the zone closest to its throttle point and frames those every
+ * camera wrote since the previous sample. Unreadable values are -1.
+ */
+
+#pragma once
+
+#include <Argus/Argus.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#define GOVERNOR_INTERVAL_MS 1000   // between two samples
+
+class Options;
+class Logger;
+class CaptureGraph;
+class ConsumerThread;
+
+class ThermalGovernor {
+
+    public:
+        ThermalGovernor(Options& options, CaptureGraph& graph, ConsumerThread **consumers, uint32_t numCameras,
+                        const Argus::Range<uint64_t>& frameDurationRange);
+        ~ThermalGovernor();
+
+        bool open();
+        void close();
+        void sample();
+
+        uint32_t getLevel() const;
+
+    private:
+        /* One rung of the ladder */
+        struct Step {
+            uint32_t saveEvery;     // multiplier of each camera's own save every
+            int qualityDrop;
+            uint32_t parked;        // cameras paused, counted from the last one
+        };
+
+        /* A thermal zone and the temperature it throttles at, in millidegrees C */
+        struct Zone {
+            std::string name;
+            std::string path;
+            int64_t throttle;
+        };
+
+        void change(uint32_t level, const Zone& zone, int64_t temperature, int64_t headroom);
+        bool setSaveEvery(uint32_t camera, uint32_t saveEvery);
+
+        Options& _options;
+        CaptureGraph& _graph;
+        ConsumerThread **_consumers;
+        uint32_t _numCameras;
+        Argus::Range<uint64_t> _frameDurationRange;
+        std::vector<Step> _steps;
+        std::vector<Zone> _zones;
+        std::vector<std::string> _cpuPaths;
+        std::string _gpuPath;
+        std::string _emcPath;
+        std::string _powerPath;
+        std::vector<int> _quality;  // each camera's quality before the first step
+        std::vector<bool> _parked;
+        uint32_t _level;
+        uint32_t _highestLevel;
+        Logger *_logger;
+        FILE *_file;
+        uint64_t _start;
+        uint64_t _lastSample;
+        uint64_t _belowSince;       // steady clock ns headroom first stayed below the margin, 0 if not
+        uint64_t _aboveSince;       // same for above the margin and the hysteresis
+        uint64_t _governedNs;       // time spent above level 0
+        uint64_t _lastFrames;
+        uint64_t _frames;           // written while the power was known
+        double _energy;             // joules
+        int _nvpmodel;
+};
@@ -0,0 +1,32 @@
+/*
+ * ThreadPlacement.hpp
+ *
+ * Pins the calling thread to one CPU core and optionally moves it into a real-time
+ * scheduling class. Pipeline threads call this from threadInitialize() so the
+ * placement applies to the thread itself rather than to whoever created it.
+ */
+
+#pragma once
+
+#include "Logger.hpp"
+
+#include <string>
+
+/* cpu < 0 leaves the affinity alone, SCHED_OTHER leaves the scheduling class alone */
+bool placeThread(int cpu, int policy, int priority, std::string& description);
+
+/* Same placement, logged to the thread's logger, a failure is printed but not fatal.
+ * Inline so the tools linking only the core library don't pull in the Logger. */
+inline bool placeThread(int cpu, int policy, int priority, Logger *logger) {
+    std::string placement;
+    bool placed = placeThread(cpu, policy, priority, placement);
+    if (placed) {
+        logger->log("Thread " + placement);
+    } else {
+        logger->log("Thread placement incomplete, " + placement, true);
+    }
+    return placed;
+}
+
+/* Printable name of a scheduling policy */
+const char *getPolicyName(int policy);
@@ -0,0 +1,50 @@
+/*
+ * TnrFilter.hpp
+ *
+ * Temporal noise reduction of one camera's frames on the VIC, so noisy
+ * low-light frames reach the encoder clean and encode into smaller images.
+ * Wraps an NvVideoConverter with its TNR algorithm set, both planes importing
+ * dmabufs: a frame is queued on the output plane and its ring slot on the
+ * capture plane, and the filtered result lands in the slot. This takes the
+ * place of the blit into the ring, it converts to the slot's layout the same
+ * way. The converter keeps the previous frames the filter blends with, so a
+ * camera's frames must pass through the same filter in order. A capture
+ * without a dmabuf of its own is first copied into the filter's pitch linear
+ * staging buffer. Frames are filtered synchronously, one at a time.
+ */
+
+#pragma once
+
+#include "LatencyHistogram.hpp"
+#include <Argus/Argus.h>
+#include <nvbuf_utils.h>
+#include <stdint.h>
+#include <string>
+
+class NvVideoConverter;
+
+class TnrFilter {
+
+    public:
+        TnrFilter(uint32_t id, int algorithm);
+        ~TnrFilter();
+
+        bool open(Argus::Size2D<uint32_t> size, NvBufferColorFormat format, NvBufferLayout layout);
+        bool process(int input, int output);
+        void close();
+
+        int getStagingFd() const;
+        uint64_t getFramesFiltered() const;
+        const LatencyHistogram *getLatency() const;
+        const std::string& getError() const;
+
+    private:
+        uint32_t _id;
+        int _algorithm;             // v4l2_tnr_algorithm
+        NvVideoConverter *_converter;
+        int _staging;
+        uint32_t _numPlanes;
+        uint64_t _frames;
+        LatencyHistogram _latency;
+        std::string _error;
+};
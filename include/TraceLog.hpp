@@ -0,0 +1,117 @@
+/*
+ * TraceLog.hpp
+ *
+ * Timeline of the pipeline stages with --trace. Each thread appends spans to
+ * a fixed buffer of its own, allocated on its first span, so recording is a
+ * couple of stores and one release store of the count with no locks. A full
+ * buffer drops the span rather than growing. write() exports every thread's
+ * spans as a Chrome trace JSON file, which chrome://tracing and Perfetto
+ * show as one track per thread, so the overlap of acquire, copy, encode and
+ * write across the cameras can be read off one timeline.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define TRACE_BUFFER_SPANS 65536U // per thread, 2 MB, about 10 minutes of a consumer at 30 fps
+
+class TraceLog {
+
+    public:
+        static TraceLog& instance();
+
+        void enable();
+        bool isEnabled() const {
+            return _enabled.load(std::memory_order_relaxed);
+        }
+
+        void nameThread(const std::string& name);
+
+        /* Add one span of the calling thread, times are steady clock ns, name must be a literal */
+        void span(const char *name, uint64_t start, uint64_t end, uint64_t frame = UINT64_MAX) {
+            if (!isEnabled())
+                return;
+            Buffer *buffer = getBuffer();
+            uint32_t count = buffer->count.load(std::memory_order_relaxed);
+            if (count >= TRACE_BUFFER_SPANS) {
+                buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            Span& span = buffer->spans[count];
+            span.name = name;
+            span.start = start;
+            span.end = end;
+            span.frame = frame;
+            buffer->count.store(count + 1, std::memory_order_release);
+        }
+
+        bool write(const std::string& path);
+
+        uint64_t getSpans();
+        uint64_t getDropped();
+
+        static uint64_t now();
+
+    private:
+        TraceLog();
+        ~TraceLog();
+        TraceLog(const TraceLog&);
+        TraceLog& operator=(const TraceLog&);
+
+        struct Span {
+            const char *name;
+            uint64_t start;
+            uint64_t end;
+            uint64_t frame; // UINT64_MAX if the span is not about one frame
+        };
+
+        /* Written only by its thread, read by write() up to the published count */
+        struct Buffer {
+            std::string name;
+            Span *spans;
+            std::atomic<uint32_t> count;
+            std::atomic<uint64_t> dropped;
+        };
+
+        Buffer *getBuffer() {
+            if (!_buffer)
+                _buffer = createBuffer();
+            return _buffer;
+        }
+        Buffer *createBuffer();
+
+        static thread_local Buffer *_buffer;
+
+        std::atomic<bool> _enabled;
+        std::mutex _mutex;
+        std::vector<Buffer*> _buffers;
+};
+
+/* Spans the enclosing scope on the calling thread */
+class TraceScope {
+
+    public:
+        explicit TraceScope(const char *name, uint64_t frame = UINT64_MAX) :
+            _name(name),
+            _frame(frame),
+            _start(TraceLog::instance().isEnabled() ? TraceLog::now() : 0)
+        {}
+
+        ~TraceScope() {
+            if (_start)
+                TraceLog::instance().span(_name, _start, TraceLog::now(), _frame);
+        }
+
+    private:
+        TraceScope(const TraceScope&);
+        TraceScope& operator=(const TraceScope&);
+
+        const char *_name;
+        uint64_t _frame;
+        uint64_t _start;
+};
@@ -0,0 +1,34 @@
+/*
+ * TriggerInput.hpp
+ *
+ * Watches a GPIO line through the sysfs interface for rising edges, such as
+ * the rover's stop signal or an operator's button wired to the carrier board.
+ * The line is exported and set to an input interrupting on rising edges unless
+ * it already is. The App polls getFd() for POLLPRI from its supervisor loop
+ * and calls acknowledge() on every event before polling again.
+ */
+
+#pragma once
+
+#include <string>
+
+#define GPIO_SYSFS "/sys/class/gpio"
+
+class TriggerInput {
+
+    public:
+        explicit TriggerInput(int gpio);
+        ~TriggerInput();
+
+        bool open();
+        int getFd() const;
+        bool acknowledge();
+        const std::string& getError() const;
+
+    private:
+        bool writeFile(const std::string& path, const std::string& value);
+
+        int _gpio;
+        int _fd;
+        std::string _error;
+};
@@ -0,0 +1,83 @@
+/*
+ * VideoWriter.hpp
+ *
+ * Records one camera as an H.264 or H.265 elementary stream with the hardware
+ * video encoder. Dmabufs from the DmabufRing are queued directly on the
+ * encoder's output plane (DMABUF memory, no CPU copy) and only released back
+ * to the ring once the encoder returns them. Encoded access units are written
+ * to cam<N>/stream.h264 or cam<N>/stream.h265 from the capture plane thread.
+ * With --roi or --roi-saliency a RoiMap gives every queued frame its region
+ * QP offsets.
+ */
+
+#pragma once
+
+#include "Thread.h"
+#include "BoundedQueue.hpp"
+#include "FrameSink.hpp"
+#include "DirectFile.hpp"
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <mutex>
+
+class Options;
+class Logger;
+class DmabufRing;
+class TelemetryLog;
+class VolumeSet;
+class NvVideoEncoder;
+class NvBuffer;
+class RoiMap;
+struct v4l2_buffer;
+
+class VideoWriter : public ArgusSamples::Thread, public FrameSink {
+
+    public:
+        explicit VideoWriter(uint32_t id, const Options& options, DmabufRing& ring, TelemetryLog *telemetry,
+                             VolumeSet *volumes);
+        virtual ~VideoWriter();
+
+        virtual bool submit(const FrameJob& job);
+        virtual bool hasFailed();
+        virtual uint64_t getFramesWritten();
+        virtual uint64_t getBytesWritten();
+        virtual size_t getQueueDepth();
+        virtual const LatencyHistogram *getLatency();
+
+    protected:
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+
+    private:
+        bool setupEncoder();
+        bool encodeFrame(const FrameJob& job);
+        bool getOutputBuffer(struct v4l2_buffer& v4l2_buf);
+        bool writeBitstream(struct v4l2_buffer *v4l2_buf, NvBuffer *buffer);
+        void recordEncoded(struct v4l2_buffer *v4l2_buf, uint32_t size, uint64_t writeStart);
+        static bool captureCallback(struct v4l2_buffer *v4l2_buf, NvBuffer *buffer,
+                                    NvBuffer *shared_buffer, void *data);
+
+        uint32_t _id;
+        const Options& _options;
+        Logger *_logger;
+        DmabufRing& _ring;
+        TelemetryLog *_telemetry;
+        VolumeSet *_volumes;
+        int _volume;                // the stream file's volume in the VolumeSet
+        BoundedQueue<FrameJob> _jobs;
+        std::deque<std::pair<uint64_t, TelemetryRecord> > _inFlight; // queue time and record, in encode order
+        std::mutex _inFlightMutex;
+        NvVideoEncoder *_encoder;
+        RoiMap *_roi;
+        int _outputFd;
+        WriteBehind _behind;        // bounds the stream file's page cache with --direct-io
+        uint32_t _numQueued;
+        std::vector<int32_t> _slots;
+        std::atomic<uint64_t> _framesWritten;
+        std::atomic<uint64_t> _bytesWritten;
+        LatencyHistogram _encodeLatency;
+        std::atomic<bool> _failed;
+};
@@ -0,0 +1,110 @@
+/*
+ * VolumeSet.hpp
+ *
+ * Spreads the image output over several volumes so no single device has to
+ * absorb every camera. The run directory is created on each volume passed with
+ * --volumes, the first one also holds the logs and metadata. Under the camera
+ * policy each camera writes to one volume, assigned round robin; under the
+ * frame policy each camera's consecutive frames rotate over the volumes. Free
+ * space is estimated from the bytes written since the last statvfs, and a
+ * volume whose estimate drops below the reserve, or that fails a write, is
+ * marked full and its cameras fail over to the next volume with room. Without
+ * --volumes the set holds the one mounted device with the most free space.
+ *
+ * With --segment the JPEG images are split into segments, one segNNN
+ * directory in the run directory of every volume each. selectSegment() maps
+ * an image to its segment by frame time or by the bytes written so far, and
+ * enterSegment() creates the segment after it ahead of time, with its camera
+ * directories and a snapshot of options.txt. A segment is closed once every
+ * camera has moved past it.
+ *
+ * Every written frame gets a line in volumes.csv in the root directory, the
+ * volume numbers are listed in options.txt.
+ *
+ * File format: camera,index,volume
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <atomic>
+#include <mutex>
+
+#define STRIPE_CAMERA 0
+#define STRIPE_FRAME 1
+
+class Options;
+class Logger;
+
+class VolumeSet {
+
+    public:
+        explicit VolumeSet(const Options& options, uint32_t numCameras);
+        ~VolumeSet();
+
+        static std::vector<std::string> findVolumes();
+        static std::string findMostFreeVolume();
+        static std::string join(const std::string& volume, const std::string& name);
+
+        bool open();
+        void close();
+
+        int assign(uint32_t camera);
+        int select(uint32_t camera);
+        void record(uint32_t camera, uint64_t index, int volume, uint64_t size, bool success);
+        void refresh();
+
+        uint32_t getVolumeCount() const;
+        const std::string& getDirectory(int volume) const;
+        std::string getCameraDirectory(int volume, uint32_t camera) const;
+
+        bool isSegmented() const;
+        uint32_t selectSegment(uint64_t timestamp, uint64_t size);
+        bool enterSegment(uint32_t camera, uint32_t segment);
+        bool isSegmentClosed(uint32_t segment);
+        std::string getSegmentDirectory(int volume, uint32_t segment) const;
+        uint64_t getFreeBytes(int volume);
+        uint64_t getRecordableBytes();
+        uint64_t getBytesWritten(int volume);
+        double getBytesPerSecond(int volume);
+        bool isFull(int volume);
+        bool isExhausted();
+
+    private:
+        struct Volume {
+            std::string directory;  // the run directory on this volume
+            uint64_t freeBytes;     // at the last statvfs
+            uint64_t sinceRefresh;  // bytes written since the last statvfs
+            uint64_t bytesWritten;
+            uint64_t framesWritten;
+            uint64_t lastBytes;     // bytesWritten at the last throughput sample
+            double bytesPerSecond;
+            bool full;
+        };
+
+        bool statVolume(Volume& volume);
+        int nextFree(int start);
+        void markFull(int volume, const char *reason);
+        bool createSegment(uint32_t segment);
+        void removeSegment(uint32_t segment);
+
+        const Options& _options;
+        uint32_t _numCameras;
+        uint64_t _reserve;
+        Logger *_logger;
+        FILE *_index;
+        std::mutex _mutex;
+        std::vector<Volume> _volumes;
+        std::vector<int> _cameraVolume;     // the camera's volume under the camera policy
+        std::vector<uint32_t> _cameraNext;  // the camera's next volume under the frame policy
+        uint64_t _lastRefresh;
+        std::atomic<uint64_t> _segmentStart;    // frame time of the first image, 0 until then
+        std::atomic<uint64_t> _segmentBytes;    // JPEG bytes asked a segment for so far
+        std::set<uint32_t> _segmentsCreated;
+        std::set<uint32_t> _segmentsEntered;
+        std::vector<uint32_t> _cameraSegment;   // the segment each camera's writer is in
+};
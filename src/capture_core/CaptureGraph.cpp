@@ -0,0 +1,487 @@
+/*
+ * CaptureGraph.cpp
+ *
+ * The capture pipeline shared by StreamCapture and StreamPreview: the camera
+ * provider and its devices, one capture session per device or a single one over
+ * every device, the output streams of each camera, a request per session built
+ * from a sensor mode and each camera's settings, and the consumer threads draining the
+ * streams. Teardown happens in the one order Argus accepts. With a session per
+ * camera, one camera's session, EGL streams and request can be recreated alone
+ * while the other cameras keep capturing. Methods return false on failure and
+ * getError() describes what failed, callers log it their own way.
+ */
+
+#include "CaptureGraph.hpp"
+
+#include "Thread.h"
+#include <EGLStream/EGLStream.h>
+#include <thread>
+
+using namespace Argus;
+
+CaptureGraph::CaptureGraph() :
+    _provider(NULL),
+    _iProvider(NULL),
+    _sensorMode(NULL),
+    _consumersStarted(0),
+    _shared(false),
+    _singleShot(false)
+{}
+
+CaptureGraph::~CaptureGraph() {
+    close();
+}
+
+/* Create the camera provider and take up to maxCameras devices, 0 takes every device */
+bool CaptureGraph::open(uint32_t maxCameras) {
+    _provider = CameraProvider::create();
+    _iProvider = interface_cast<ICameraProvider>(_provider);
+    if (!_iProvider)
+        return fail("Failed to get the ICameraProvider interface");
+
+    _iProvider->getCameraDevices(&_devices);
+    if (_devices.empty())
+        return fail("No cameras available");
+    if (maxCameras > 0 && _devices.size() > maxCameras)
+        _devices.resize(maxCameras);
+    return true;
+}
+
+/* One session per device, or a shared one so a single request triggers every sensor.
+   Separate sessions are created concurrently, each opens its own sensor */
+bool CaptureGraph::createSessions(bool shared) {
+    _shared = shared;
+    uint32_t count = shared ? 1 : _devices.size();
+    std::vector<CaptureSession*> sessions(count, NULL);
+    std::vector<Argus::Status> statuses(count, STATUS_OK);
+    if (shared) {
+        sessions[0] = _iProvider->createCaptureSession(_devices, &statuses[0]);
+    } else {
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0; i < count; i++)
+            threads.push_back(std::thread([this, &sessions, &statuses, i]() {
+                sessions[i] = _iProvider->createCaptureSession(_devices[i], &statuses[i]);
+            }));
+        for (uint32_t i = 0; i < count; i++)
+            threads[i].join();
+    }
+
+    /* Keep every session created so close() destroys them, then report the first failure */
+    for (uint32_t i = 0; i < count; i++)
+        if (sessions[i])
+            _sessions.push_back(sessions[i]);
+    for (uint32_t i = 0; i < count; i++) {
+        if (statuses[i] == STATUS_UNAVAILABLE)
+            return fail("Camera device unavailable, try rebooting");
+        if (!interface_cast<ICaptureSession>(sessions[i]))
+            return fail("Failed to get the ICaptureSession interface");
+    }
+    return true;
+}
+
+/* The passed basic sensor mode of the first camera, NULL if it has none by that index */
+SensorMode *CaptureGraph::getSensorMode(uint32_t index) {
+    ICameraProperties *iCameraProperties = interface_cast<ICameraProperties>(_devices[0]);
+    if (!iCameraProperties) {
+        fail("Failed to get the ICameraProperties interface");
+        return NULL;
+    }
+    std::vector<SensorMode*> sensorModes;
+    iCameraProperties->getBasicSensorModes(&sensorModes);
+    if (index >= sensorModes.size()) {
+        fail("Failed to get the sensor mode");
+        return NULL;
+    }
+    return sensorModes[index];
+}
+
+/* Create an output stream for the camera, returns its handle or -1. Buffer streams
+   take their resolution from the buffers the consumer allocates. An EGLStream with a
+   fifoLength queues that many frames instead of replacing the one in its mailbox. A Bayer
+   stream's resolution must be the sensor mode's, the ISP that would scale is bypassed */
+int CaptureGraph::addStream(uint32_t camera, CaptureStreamType type, const Size2D<uint32_t>& resolution,
+                            uint32_t fifoLength) {
+    Stream stream = {NULL, camera, type, resolution, fifoLength, false};
+    if (!createStream(stream))
+        return -1;
+    _streams.push_back(stream);
+    return _streams.size() - 1;
+}
+
+/* Create the output stream described by stream on its camera's session */
+bool CaptureGraph::createStream(Stream& stream) {
+    uint32_t camera = stream.camera;
+    CaptureStreamType type = stream.type;
+    ICaptureSession *iCaptureSession = interface_cast<ICaptureSession>(_sessions[getSessionIndex(camera)]);
+    UniqueObj<OutputStreamSettings> settings(iCaptureSession->createOutputStreamSettings(
+        type == CAPTURE_STREAM_BUFFER ? STREAM_TYPE_BUFFER : STREAM_TYPE_EGL));
+    IOutputStreamSettings *iStreamSettings = interface_cast<IOutputStreamSettings>(settings);
+    IEGLOutputStreamSettings *iEglStreamSettings = interface_cast<IEGLOutputStreamSettings>(settings);
+    IBufferOutputStreamSettings *iBufferStreamSettings = interface_cast<IBufferOutputStreamSettings>(settings);
+    if (!iStreamSettings || (type == CAPTURE_STREAM_BUFFER ? !iBufferStreamSettings : !iEglStreamSettings))
+        return fail("Failed to get the output stream settings interface");
+
+    /* A shared session needs each stream bound to its device */
+    if (_shared && iStreamSettings->setCameraDevice(_devices[camera]) != STATUS_OK)
+        return fail("Failed to bind the output stream to its camera device");
+
+    if (type == CAPTURE_STREAM_BUFFER) {
+        iBufferStreamSettings->setBufferType(BUFFER_TYPE_EGL_IMAGE);
+        iBufferStreamSettings->setMetadataEnable(true);
+    } else {
+        iEglStreamSettings->setPixelFormat(type == CAPTURE_STREAM_BAYER ? PIXEL_FMT_RAW16 : PIXEL_FMT_YCbCr_420_888);
+        iEglStreamSettings->setEGLDisplay(EGL_NO_DISPLAY);
+        iEglStreamSettings->setResolution(stream.resolution);
+        if (stream.fifoLength > 0 && (iEglStreamSettings->setMode(EGL_STREAM_MODE_FIFO) != STATUS_OK
+                                      || iEglStreamSettings->setFifoLength(stream.fifoLength) != STATUS_OK))
+            return fail("Failed to set the EGLStream FIFO mode");
+    }
+
+    stream.stream = iCaptureSession->createOutputStream(settings.get());
+    if (!stream.stream)
+        return fail("Failed to create the output stream");
+    return true;
+}
+
+/* Create each session's request from the sensor mode and frame duration, no stream enabled */
+bool CaptureGraph::createRequests(SensorMode *sensorMode, const Range<uint64_t>& frameDuration) {
+    CaptureSettings settings;
+    settings.frameDuration = frameDuration;
+    settings.exposureTime = Range<uint64_t>(0);
+    settings.gain = Range<float>(0);
+    settings.denoise = CAPTURE_DENOISE_DEFAULT;
+    settings.denoiseStrength = -1;
+    return createRequests(sensorMode, std::vector<CaptureSettings>(_devices.size(), settings));
+}
+
+/* Create a request per session from the settings of each camera, a shared session takes camera 0's */
+bool CaptureGraph::createRequests(SensorMode *sensorMode, const std::vector<CaptureSettings>& settings) {
+    _sensorMode = sensorMode;
+    _settings = settings;
+    for (uint32_t i = 0; i < _sessions.size(); i++) {
+        Request *request = createRequest(i);
+        if (!request)
+            return false;
+        _requests.push_back(request);
+        _repeating.push_back(false);
+    }
+    return true;
+}
+
+/* Create the session's request from the sensor mode and its camera's settings, NULL on failure */
+Request *CaptureGraph::createRequest(uint32_t session) {
+    Request *request = interface_cast<ICaptureSession>(_sessions[session])->createRequest();
+    if (!applySettings(request, _settings[session])) {
+        if (request)
+            request->destroy();
+        return NULL;
+    }
+    return request;
+}
+
+bool CaptureGraph::applySettings(Request *request, const CaptureSettings& camera) {
+    IRequest *iRequest = interface_cast<IRequest>(request);
+    if (!iRequest)
+        return fail("Failed to get the request interface");
+
+    ISourceSettings *iSourceSettings = interface_cast<ISourceSettings>(iRequest->getSourceSettings());
+    if (!iSourceSettings)
+        return fail("Failed to get the source settings interface");
+    iSourceSettings->setSensorMode(_sensorMode);
+    if (iSourceSettings->setFrameDurationRange(camera.frameDuration) != STATUS_OK)
+        return fail("Failed to set the frame duration range");
+    if (camera.exposureTime.max() > 0 && iSourceSettings->setExposureTimeRange(camera.exposureTime) != STATUS_OK)
+        return fail("Failed to set the exposure time range");
+    if (camera.gain.max() > 0 && iSourceSettings->setGainRange(camera.gain) != STATUS_OK)
+        return fail("Failed to set the gain range");
+
+    /* Noise reduction runs in the ISP, before the frame reaches any buffer */
+    if (camera.denoise == CAPTURE_DENOISE_DEFAULT && camera.denoiseStrength < 0)
+        return true;
+    IDenoiseSettings *iDenoiseSettings = interface_cast<IDenoiseSettings>(request);
+    if (!iDenoiseSettings)
+        return fail("Failed to get the denoise settings interface");
+    if (camera.denoise != CAPTURE_DENOISE_DEFAULT
+        && iDenoiseSettings->setDenoiseMode(camera.denoise == CAPTURE_DENOISE_OFF ? DENOISE_MODE_OFF
+                                            : camera.denoise == CAPTURE_DENOISE_FAST ? DENOISE_MODE_FAST
+                                            : DENOISE_MODE_HIGH_QUALITY) != STATUS_OK)
+        return fail("Failed to set the denoise mode");
+    if (camera.denoiseStrength >= 0 && iDenoiseSettings->setDenoiseStrength(camera.denoiseStrength) != STATUS_OK)
+        return fail("Failed to set the denoise strength");
+    return true;
+}
+
+/* Lock or unlock AE on the camera's request, takes effect on the next submit */
+bool CaptureGraph::setAeLock(uint32_t camera, bool lock) {
+    IRequest *iRequest = interface_cast<IRequest>(getRequest(camera));
+    if (!iRequest)
+        return fail("The camera's session is down");
+    IAutoControlSettings *iAutoControlSettings = interface_cast<IAutoControlSettings>(iRequest->getAutoControlSettings());
+    if (!iAutoControlSettings || iAutoControlSettings->setAeLock(lock) != STATUS_OK)
+        return fail("Failed to set the AE lock");
+    return true;
+}
+
+/* Lock or unlock AWB on the camera's request, takes effect on the next submit */
+bool CaptureGraph::setAwbLock(uint32_t camera, bool lock) {
+    IRequest *iRequest = interface_cast<IRequest>(getRequest(camera));
+    if (!iRequest)
+        return fail("The camera's session is down");
+    IAutoControlSettings *iAutoControlSettings = interface_cast<IAutoControlSettings>(iRequest->getAutoControlSettings());
+    if (!iAutoControlSettings || iAutoControlSettings->setAwbLock(lock) != STATUS_OK)
+        return fail("Failed to set the AWB lock");
+    return true;
+}
+
+/* Change the frame duration range of the camera's request, takes effect on the next submit
+   and is kept for the request a restart creates */
+bool CaptureGraph::setFrameDuration(uint32_t camera, const Range<uint64_t>& frameDuration) {
+    IRequest *iRequest = interface_cast<IRequest>(getRequest(camera));
+    if (!iRequest)
+        return fail("The camera's session is down");
+    ISourceSettings *iSourceSettings = interface_cast<ISourceSettings>(iRequest->getSourceSettings());
+    if (!iSourceSettings || iSourceSettings->setFrameDurationRange(frameDuration) != STATUS_OK)
+        return fail("Failed to set the frame duration range");
+    _settings[getSessionIndex(camera)].frameDuration = frameDuration;
+    return true;
+}
+
+/* Add or remove a stream from its session's request, takes effect on the next submit */
+bool CaptureGraph::enableStream(int stream, bool enable) {
+    IRequest *iRequest = interface_cast<IRequest>(getRequest(_streams[stream].camera));
+    Argus::Status status = enable ? iRequest->enableOutputStream(_streams[stream].stream)
+                                  : iRequest->disableOutputStream(_streams[stream].stream);
+    if (status != STATUS_OK)
+        return fail(enable ? "Failed to enable the output stream" : "Failed to disable the output stream");
+    _streams[stream].enabled = enable;
+    return true;
+}
+
+/* The graph starts and stops its consumers but never deletes them */
+bool CaptureGraph::registerConsumer(ArgusSamples::Thread *consumer) {
+    if (!consumer)
+        return fail("Failed to create the consumer thread");
+    _consumers.push_back(consumer);
+    return true;
+}
+
+/* Launch every consumer, then wait until each is connected to its stream */
+bool CaptureGraph::startConsumers() {
+    for (; _consumersStarted < _consumers.size(); _consumersStarted++)
+        if (!_consumers[_consumersStarted]->initialize())
+            return fail("Failed to initialize the consumer thread");
+    for (uint32_t i = 0; i < _consumers.size(); i++)
+        if (!_consumers[i]->waitRunning())
+            return fail("Failed to start the consumer thread");
+    return true;
+}
+
+/* Join every started consumer, streams must have ended for blocked acquires to return */
+bool CaptureGraph::shutdownConsumers() {
+    bool success = true;
+    for (uint32_t i = 0; i < _consumersStarted; i++)
+        success = _consumers[i]->shutdown() && success;
+    _consumersStarted = 0;
+    _consumers.clear();
+    if (!success)
+        return fail("Failed to shut down the consumer thread");
+    return true;
+}
+
+/* Start every session's repeating request */
+bool CaptureGraph::submit() {
+    for (uint32_t i = 0; i < _sessions.size(); i++)
+        if (!submit(i))
+            return false;
+    return true;
+}
+
+/* Repeat the request of the camera's session, replacing the one already repeating. Taking single
+   shots, the changed request is only kept for the next capture() */
+bool CaptureGraph::submit(uint32_t camera) {
+    uint32_t session = getSessionIndex(camera);
+    if (_singleShot)
+        return true;
+    if (!_requests[session])
+        return fail("The camera's session is down");
+    for (uint32_t i = 0; i < _streams.size(); i++)
+        if (!_shared && _streams[i].camera == camera && _streams[i].enabled && !_streams[i].stream)
+            return fail("The camera's stream has ended");
+    if (interface_cast<ICaptureSession>(_sessions[session])->repeat(_requests[session]) != STATUS_OK)
+        return fail("Failed to start the repeat capture request");
+    _repeating[session] = true;
+    return true;
+}
+
+/* Stop repeating and take single shots from now on, waiting up to timeoutNs for the repeats in flight */
+void CaptureGraph::setSingleShot(uint64_t timeoutNs) {
+    stop(timeoutNs);
+    _singleShot = true;
+}
+
+/* Capture one frame into the enabled streams of every session, the sessions are asked back to back */
+bool CaptureGraph::capture() {
+    for (uint32_t i = 0; i < _sessions.size(); i++)
+        if (interface_cast<ICaptureSession>(_sessions[i])->capture(_requests[i]) == 0)
+            return fail("Failed to submit the capture request");
+    return true;
+}
+
+/* Stop the repeating requests and wait up to timeoutNs for those in flight */
+void CaptureGraph::stop(uint64_t timeoutNs) {
+    for (uint32_t i = 0; i < _repeating.size(); i++)
+        if (_repeating[i])
+            interface_cast<ICaptureSession>(_sessions[i])->stopRepeat();
+    for (uint32_t i = 0; i < _repeating.size(); i++) {
+        if (_repeating[i])
+            interface_cast<ICaptureSession>(_sessions[i])->waitForIdle(timeoutNs);
+        _repeating[i] = false;
+    }
+}
+
+/* Stop the repeating request of the camera's own session and wait up to timeoutNs for those in flight */
+bool CaptureGraph::stopCamera(uint32_t camera, uint64_t timeoutNs) {
+    if (_shared)
+        return fail("A shared session stops every camera");
+    if (!_repeating[camera])
+        return true;
+    ICaptureSession *iCaptureSession = interface_cast<ICaptureSession>(_sessions[camera]);
+    iCaptureSession->stopRepeat();
+    _repeating[camera] = false;
+    if (iCaptureSession->waitForIdle(timeoutNs) != STATUS_OK)
+        return fail("The session did not go idle");
+    return true;
+}
+
+/* Unblock the consumers: an EGL stream is destroyed so its FrameConsumer disconnects,
+   a buffer stream ends and is destroyed once the consumer has destroyed its buffers */
+void CaptureGraph::endStreams() {
+    for (uint32_t i = 0; i < _streams.size(); i++)
+        endStream(i);
+}
+
+void CaptureGraph::endStream(int stream) {
+    IBufferOutputStream *iBufferStream = interface_cast<IBufferOutputStream>(_streams[stream].stream);
+    if (iBufferStream) {
+        iBufferStream->endOfStream();
+    } else if (_streams[stream].stream) {
+        _streams[stream].stream->destroy();
+        _streams[stream].stream = NULL;
+    }
+}
+
+/* Recreate the camera's own session once stopCamera and endStream have released it: its EGL
+   streams with their handles unchanged, and its request from the settings it was created with,
+   enabling the streams that were. The new request has AE unlocked and is not submitted yet.
+   A failure leaves the camera down, with no session, and may be retried */
+bool CaptureGraph::restartCamera(uint32_t camera) {
+    if (_shared)
+        return fail("A shared session restarts every camera");
+    for (uint32_t i = 0; i < _streams.size(); i++) {
+        if (_streams[i].camera != camera)
+            continue;
+        if (_streams[i].type == CAPTURE_STREAM_BUFFER)
+            return fail("A buffer stream cannot be recreated under its consumer");
+        if (_streams[i].stream)
+            _streams[i].stream->destroy();
+        _streams[i].stream = NULL;
+    }
+    if (_requests[camera])
+        _requests[camera]->destroy();
+    _requests[camera] = NULL;
+    if (_sessions[camera])
+        _sessions[camera]->destroy();
+    _sessions[camera] = NULL;
+
+    Argus::Status status = STATUS_OK;
+    _sessions[camera] = _iProvider->createCaptureSession(_devices[camera], &status);
+    if (status == STATUS_UNAVAILABLE || !interface_cast<ICaptureSession>(_sessions[camera])) {
+        if (_sessions[camera])
+            _sessions[camera]->destroy();
+        _sessions[camera] = NULL;
+        return fail(status == STATUS_UNAVAILABLE ? "Camera device unavailable" : "Failed to get the ICaptureSession interface");
+    }
+    for (uint32_t i = 0; i < _streams.size(); i++)
+        if (_streams[i].camera == camera && !createStream(_streams[i]))
+            return false;
+    _requests[camera] = createRequest(camera);
+    if (!_requests[camera])
+        return false;
+    for (uint32_t i = 0; i < _streams.size(); i++)
+        if (_streams[i].camera == camera && _streams[i].enabled && !enableStream(i, true))
+            return false;
+    return true;
+}
+
+void CaptureGraph::destroyStreams() {
+    for (uint32_t i = 0; i < _streams.size(); i++)
+        if (_streams[i].stream)
+            _streams[i].stream->destroy();
+    _streams.clear();
+}
+
+/* Destroy everything still held, in dependency order, a camera that failed to restart holds nothing */
+void CaptureGraph::close() {
+    destroyStreams();
+    for (uint32_t i = 0; i < _requests.size(); i++)
+        if (_requests[i])
+            _requests[i]->destroy();
+    _requests.clear();
+    _repeating.clear();
+    for (uint32_t i = 0; i < _sessions.size(); i++)
+        if (_sessions[i])
+            _sessions[i]->destroy();
+    _sessions.clear();
+    _devices.clear();
+    if (_provider)
+        _provider->destroy();
+    _provider = NULL;
+    _iProvider = NULL;
+}
+
+ICameraProvider *CaptureGraph::getProvider() const {
+    return _iProvider;
+}
+
+uint32_t CaptureGraph::getCameraCount() const {
+    return _devices.size();
+}
+
+uint32_t CaptureGraph::getSessionCount() const {
+    return _sessions.size();
+}
+
+bool CaptureGraph::isShared() const {
+    return _shared;
+}
+
+/* Session index, one per camera or the shared one, for subscribing to its events */
+CaptureSession *CaptureGraph::getSession(uint32_t index) const {
+    return _sessions[index];
+}
+
+CameraDevice *CaptureGraph::getDevice(uint32_t camera) const {
+    return _devices[camera];
+}
+
+OutputStream *CaptureGraph::getStream(int stream) const {
+    return _streams[stream].stream;
+}
+
+/* The request of the camera's session, for settings beyond the template */
+Request *CaptureGraph::getRequest(uint32_t camera) const {
+    return _requests[getSessionIndex(camera)];
+}
+
+const std::string& CaptureGraph::getError() const {
+    return _error;
+}
+
+uint32_t CaptureGraph::getSessionIndex(uint32_t camera) const {
+    return _shared ? 0 : camera;
+}
+
+bool CaptureGraph::fail(const std::string& error) {
+    _error = error;
+    return false;
+}
@@ -0,0 +1,224 @@
+/*
+ * ContainerReader.cpp
+ *
+ * Random access to the images of one container segment, mapped read-only. A
+ * closed segment is indexed by its footer in place, one left open by a crash
+ * by its checkpoints, found backwards from the end on DIRECT_IO_ALIGN
+ * boundaries and then through their previous offsets.
+ */
+
+#include "ContainerReader.hpp"
+
+#include "Crc32c.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+
+ContainerReader::ContainerReader() :
+    _fd(-1),
+    _map(NULL),
+    _size(0),
+    _entries(NULL),
+    _count(0),
+    _isRecovered(false),
+    _validEnd(0),
+    _lastCheckpoint(CONTAINER_NO_CHECKPOINT),
+    _checkpoints(0)
+{}
+
+ContainerReader::~ContainerReader() {
+    close();
+}
+
+/* Map the segment's data file and read its index, return bool indicating the file could be mapped.
+   A file without a valid footer opens as recovered, with whatever its checkpoints list */
+bool ContainerReader::open(const std::string& path) {
+    close();
+    _fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (_fd == -1 || fstat(_fd, &info) != 0) {
+        close();
+        return false;
+    }
+    _size = info.st_size;
+    if (_size > 0) {
+        void *map = mmap(NULL, _size, PROT_READ, MAP_SHARED, _fd, 0);
+        if (map == MAP_FAILED) {
+            close();
+            return false;
+        }
+        _map = (const unsigned char *) map;
+        madvise(map, _size, MADV_RANDOM);
+    }
+    if (!readFooter())
+        readCheckpoints();
+    return true;
+}
+
+void ContainerReader::close() {
+    if (_map)
+        munmap((void *) _map, _size);
+    if (_fd != -1)
+        ::close(_fd);
+    _fd = -1;
+    _map = NULL;
+    _size = 0;
+    _entries = NULL;
+    _count = 0;
+    _recovered.clear();
+    _isRecovered = false;
+    _validEnd = 0;
+    _lastCheckpoint = CONTAINER_NO_CHECKPOINT;
+    _checkpoints = 0;
+}
+
+/* True if the segment has no valid footer and was indexed from its checkpoints */
+bool ContainerReader::isRecovered() const {
+    return _isRecovered;
+}
+
+size_t ContainerReader::getCount() const {
+    return _count;
+}
+
+/* Every image of the segment in the order written, image indexes and times ascending */
+const ContainerIndexEntry *ContainerReader::getEntries() const {
+    return _entries;
+}
+
+uint64_t ContainerReader::getSize() const {
+    return _size;
+}
+
+/* Where the indexed part of the file ends, anything past it of a recovered segment is unindexed */
+uint64_t ContainerReader::getValidEnd() const {
+    return _validEnd;
+}
+
+/* Offset of the last checkpoint read, CONTAINER_NO_CHECKPOINT if none was */
+uint64_t ContainerReader::getLastCheckpoint() const {
+    return _lastCheckpoint;
+}
+
+uint64_t ContainerReader::getCheckpoints() const {
+    return _checkpoints;
+}
+
+/* Position of the image with this image index, return bool indicating the segment holds it */
+bool ContainerReader::findIndex(uint64_t index, size_t& position) const {
+    const ContainerIndexEntry *end = _entries + _count;
+    const ContainerIndexEntry *entry = std::lower_bound(_entries, end, index,
+        [](const ContainerIndexEntry& entry, uint64_t index) { return entry.index < index; });
+    position = entry - _entries;
+    return entry != end && entry->index == index;
+}
+
+/* Position of the first image taken at or after timestamp, return bool indicating there is one */
+bool ContainerReader::findTime(uint64_t timestamp, size_t& position) const {
+    const ContainerIndexEntry *end = _entries + _count;
+    const ContainerIndexEntry *entry = std::lower_bound(_entries, end, timestamp,
+        [](const ContainerIndexEntry& entry, uint64_t timestamp) { return entry.timestamp < timestamp; });
+    position = entry - _entries;
+    return entry != end;
+}
+
+/* The encoded image at position, NULL if it lies beyond the end of the file */
+const unsigned char *ContainerReader::getImage(size_t position, uint32_t& size) const {
+    if (position >= _count)
+        return NULL;
+    const ContainerIndexEntry& entry = _entries[position];
+    size = entry.size;
+    if (entry.offset > _size || entry.size > _size - entry.offset)
+        return NULL;
+    return _map + entry.offset;
+}
+
+/* True if the image an entry describes is in the file and matches its checksum, if it has one */
+bool ContainerReader::checkEntry(const ContainerIndexEntry& entry) const {
+    if (entry.size == 0 || entry.offset > _size || entry.size > _size - entry.offset)
+        return false;
+    return entry.crc32c == 0 || crc32c(_map + entry.offset, entry.size) == entry.crc32c;
+}
+
+/* Checksum of a checkpoint header and its entries, with the header's own checksum taken as 0 */
+uint32_t ContainerReader::checksum(const ContainerCheckpoint& header, const ContainerIndexEntry *entries) {
+    ContainerCheckpoint copy = header;
+    copy.crc32c = 0;
+    uint32_t crc = crc32c(&copy, sizeof(copy));
+    return header.count > 0 ? crc32c(entries, header.count * sizeof(ContainerIndexEntry), crc) : crc;
+}
+
+/* Index a closed segment by its footer, return bool indicating the trailer and footer check out */
+bool ContainerReader::readFooter() {
+    ContainerTrailer trailer;
+    if (_size < sizeof(ContainerCheckpoint) + sizeof(trailer))
+        return false;
+    memcpy(&trailer, _map + _size - sizeof(trailer), sizeof(trailer));
+    if (trailer.magic != CONTAINER_TRAILER_MAGIC || trailer.crc32c != crc32c(&trailer, offsetof(ContainerTrailer, crc32c)))
+        return false;
+
+    ContainerCheckpoint header;
+    if (!readCheckpoint(trailer.footer, header) || !(header.flags & CONTAINER_FOOTER) || header.count != trailer.count
+        || trailer.footer + sizeof(header) + header.count * sizeof(ContainerIndexEntry) + sizeof(trailer) != _size)
+        return false;
+    _entries = (const ContainerIndexEntry *) (_map + trailer.footer + sizeof(header));
+    _count = header.count;
+    _validEnd = _size;
+    _lastCheckpoint = trailer.footer;
+    _checkpoints = header.sequence + 1;
+    return true;
+}
+
+/* Index a segment left open from its checkpoints, newest first. A link that no longer checks out
+   is bridged by searching backwards from it, a footer found on the way lists everything before it */
+void ContainerReader::readCheckpoints() {
+    _isRecovered = true;
+    std::vector<uint64_t> found;
+    ContainerCheckpoint header;
+    uint64_t offset = findCheckpoint(_size, header);
+    if (offset != CONTAINER_NO_CHECKPOINT) {
+        _validEnd = offset + sizeof(header) + header.count * sizeof(ContainerIndexEntry);
+        _lastCheckpoint = offset;
+        _checkpoints = header.sequence + 1;
+    }
+    while (offset != CONTAINER_NO_CHECKPOINT) {
+        found.push_back(offset);
+        if (header.flags & CONTAINER_FOOTER || header.previous == CONTAINER_NO_CHECKPOINT)
+            break;
+        uint64_t previous = header.previous;
+        offset = previous < offset && readCheckpoint(previous, header) ? previous : findCheckpoint(offset, header);
+    }
+
+    for (size_t i = found.size(); i > 0; i--) {
+        readCheckpoint(found[i - 1], header);
+        const ContainerIndexEntry *entries = (const ContainerIndexEntry *) (_map + found[i - 1] + sizeof(header));
+        _recovered.insert(_recovered.end(), entries, entries + header.count);
+    }
+    _entries = _recovered.data();
+    _count = _recovered.size();
+}
+
+/* True if a valid checkpoint starts at offset, header is set to it */
+bool ContainerReader::readCheckpoint(uint64_t offset, ContainerCheckpoint& header) const {
+    if (offset % DIRECT_IO_ALIGN != 0 || offset > _size || _size - offset < sizeof(header))
+        return false;
+    memcpy(&header, _map + offset, sizeof(header));
+    if (header.magic != CONTAINER_CHECKPOINT_MAGIC
+        || header.count > (_size - offset - sizeof(header)) / sizeof(ContainerIndexEntry))
+        return false;
+    return header.crc32c == checksum(header, (const ContainerIndexEntry *) (_map + offset + sizeof(header)));
+}
+
+/* Offset of the last valid checkpoint starting before limit, CONTAINER_NO_CHECKPOINT if there is none */
+uint64_t ContainerReader::findCheckpoint(uint64_t limit, ContainerCheckpoint& header) const {
+    uint64_t offset = (limit + DIRECT_IO_ALIGN - 1) & ~((uint64_t) DIRECT_IO_ALIGN - 1);
+    while (offset > 0) {
+        offset -= DIRECT_IO_ALIGN;
+        if (offset < limit && readCheckpoint(offset, header))
+            return offset;
+    }
+    return CONTAINER_NO_CHECKPOINT;
+}
@@ -0,0 +1,61 @@
+/*
+ * Crc32c.cpp
+ *
+ * CRC32C (Castagnoli, reflected polynomial 0x82F63B78) of a buffer. The ARMv8
+ * version feeds the CRC unit 8 bytes at a time and finishes the tail a byte
+ * at a time, the scalar twin walks a 256 entry table built on first use.
+ */
+
+#include "Crc32c.hpp"
+
+#include <string.h>
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#define CRC32C_POLYNOMIAL 0x82F63B78U
+
+/* One table entry per byte value */
+static const uint32_t *buildTable() {
+    static uint32_t table[256];
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        table[i] = crc;
+    }
+    return table;
+}
+
+uint32_t crc32cScalar(const void *data, size_t size, uint32_t crc) {
+    static const uint32_t *table = buildTable(); // built once, thread safe
+    const uint8_t *bytes = (const uint8_t *) data;
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+#if defined(__ARM_FEATURE_CRC32)
+
+uint32_t crc32c(const void *data, size_t size, uint32_t crc) {
+    const uint8_t *bytes = (const uint8_t *) data;
+    crc = ~crc;
+    for (; size >= 8; size -= 8, bytes += 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word)); // the encoder's output carries no alignment
+        crc = __crc32cd(crc, word);
+    }
+    for (; size > 0; size--, bytes++)
+        crc = __crc32cb(crc, *bytes);
+    return ~crc;
+}
+
+#else
+
+uint32_t crc32c(const void *data, size_t size, uint32_t crc) {
+    return crc32cScalar(data, size, crc);
+}
+
+#endif
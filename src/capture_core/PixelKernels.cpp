@@ -0,0 +1,228 @@
+/*
+ * PixelKernels.cpp
+ *
+ * The few loops that touch pixels on the CPU, vectorised with NEON. Every
+ * NEON kernel handles 16 output pixels per step and finishes a row's tail with
+ * the scalar code, so any width is handled and the output matches the scalar
+ * twin exactly. width and height are the output's for downscaleHalf, and
+ * srcPitch is in bytes for packRaw12 as for the others.
+ */
+
+#include "PixelKernels.hpp"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* Scalar tails, shared by both versions of each kernel */
+static void rgbaToBgrRow(const uint8_t *src, uint8_t *dst, uint32_t from, uint32_t width) {
+    for (uint32_t x = from; x < width; x++) {
+        dst[3 * x] = src[4 * x + 2];
+        dst[3 * x + 1] = src[4 * x + 1];
+        dst[3 * x + 2] = src[4 * x];
+    }
+}
+
+static void interleaveRow(const uint8_t *u, const uint8_t *v, uint8_t *uv, uint32_t from, uint32_t width) {
+    for (uint32_t x = from; x < width; x++) {
+        uv[2 * x] = u[x];
+        uv[2 * x + 1] = v[x];
+    }
+}
+
+static void downscaleRow(const uint8_t *top, const uint8_t *bottom, uint8_t *dst, uint32_t from, uint32_t width) {
+    for (uint32_t x = from; x < width; x++)
+        dst[x] = (top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1] + 2) >> 2;
+}
+
+static uint64_t sumAbsDiffRow(const uint8_t *a, const uint8_t *b, uint32_t from, uint32_t length) {
+    uint64_t sum = 0;
+    for (uint32_t i = from; i < length; i++)
+        sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    return sum;
+}
+
+static uint64_t sumRow(const uint8_t *src, uint32_t from, uint32_t width) {
+    uint64_t sum = 0;
+    for (uint32_t x = from; x < width; x++)
+        sum += src[x];
+    return sum;
+}
+
+static void packRaw12Row(const uint16_t *src, uint8_t *dst, uint32_t from, uint32_t width, uint32_t shift) {
+    for (uint32_t x = from; x + 1 < width; x += 2) {
+        uint32_t first = (src[x] >> shift) & 0xfff;
+        uint32_t second = (src[x + 1] >> shift) & 0xfff;
+        dst[3 * x / 2] = first >> 4;
+        dst[3 * x / 2 + 1] = second >> 4;
+        dst[3 * x / 2 + 2] = (first & 0xf) | (second & 0xf) << 4;
+    }
+}
+
+void rgbaToBgrScalar(const uint8_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width, uint32_t height) {
+    for (uint32_t y = 0; y < height; y++)
+        rgbaToBgrRow(src + (uint64_t) y * srcPitch, dst + (uint64_t) y * dstPitch, 0, width);
+}
+
+void interleaveChromaScalar(const uint8_t *u, const uint8_t *v, uint32_t srcPitch, uint8_t *uv, uint32_t dstPitch,
+                            uint32_t width, uint32_t height) {
+    for (uint32_t y = 0; y < height; y++)
+        interleaveRow(u + (uint64_t) y * srcPitch, v + (uint64_t) y * srcPitch, uv + (uint64_t) y * dstPitch, 0, width);
+}
+
+void downscaleHalfScalar(const uint8_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width,
+                         uint32_t height) {
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *top = src + (uint64_t) 2 * y * srcPitch;
+        downscaleRow(top, top + srcPitch, dst + (uint64_t) y * dstPitch, 0, width);
+    }
+}
+
+uint64_t sumAbsDiffScalar(const uint8_t *a, const uint8_t *b, uint32_t length) {
+    return sumAbsDiffRow(a, b, 0, length);
+}
+
+uint64_t sumPlaneScalar(const uint8_t *src, uint32_t pitch, uint32_t width, uint32_t height) {
+    uint64_t sum = 0;
+    for (uint32_t y = 0; y < height; y++)
+        sum += sumRow(src + (uint64_t) y * pitch, 0, width);
+    return sum;
+}
+
+void packRaw12Scalar(const uint16_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width,
+                     uint32_t height, uint32_t shift) {
+    for (uint32_t y = 0; y < height; y++)
+        packRaw12Row((const uint16_t *) ((const uint8_t *) src + (uint64_t) y * srcPitch), dst + (uint64_t) y * dstPitch,
+                     0, width, shift);
+}
+
+#if defined(__ARM_NEON)
+
+void rgbaToBgr(const uint8_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width, uint32_t height) {
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *s = src + (uint64_t) y * srcPitch;
+        uint8_t *d = dst + (uint64_t) y * dstPitch;
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16) {
+            uint8x16x4_t rgba = vld4q_u8(s + 4 * x);
+            uint8x16x3_t bgr;
+            bgr.val[0] = rgba.val[2];
+            bgr.val[1] = rgba.val[1];
+            bgr.val[2] = rgba.val[0];
+            vst3q_u8(d + 3 * x, bgr);
+        }
+        rgbaToBgrRow(s, d, x, width);
+    }
+}
+
+void interleaveChroma(const uint8_t *u, const uint8_t *v, uint32_t srcPitch, uint8_t *uv, uint32_t dstPitch,
+                      uint32_t width, uint32_t height) {
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *su = u + (uint64_t) y * srcPitch;
+        const uint8_t *sv = v + (uint64_t) y * srcPitch;
+        uint8_t *d = uv + (uint64_t) y * dstPitch;
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16) {
+            uint8x16x2_t pair;
+            pair.val[0] = vld1q_u8(su + x);
+            pair.val[1] = vld1q_u8(sv + x);
+            vst2q_u8(d + 2 * x, pair);
+        }
+        interleaveRow(su, sv, d, x, width);
+    }
+}
+
+void downscaleHalf(const uint8_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width, uint32_t height) {
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *top = src + (uint64_t) 2 * y * srcPitch;
+        const uint8_t *bottom = top + srcPitch;
+        uint8_t *d = dst + (uint64_t) y * dstPitch;
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16) {
+            uint8x16x2_t t = vld2q_u8(top + 2 * x);     // even and odd columns
+            uint8x16x2_t b = vld2q_u8(bottom + 2 * x);
+            uint16x8_t low = vaddl_u8(vget_low_u8(t.val[0]), vget_low_u8(t.val[1]));
+            low = vaddw_u8(vaddw_u8(low, vget_low_u8(b.val[0])), vget_low_u8(b.val[1]));
+            uint16x8_t high = vaddl_u8(vget_high_u8(t.val[0]), vget_high_u8(t.val[1]));
+            high = vaddw_u8(vaddw_u8(high, vget_high_u8(b.val[0])), vget_high_u8(b.val[1]));
+            vst1q_u8(d + x, vcombine_u8(vrshrn_n_u16(low, 2), vrshrn_n_u16(high, 2)));
+        }
+        downscaleRow(top, bottom, d, x, width);
+    }
+}
+
+uint64_t sumAbsDiff(const uint8_t *a, const uint8_t *b, uint32_t length) {
+    uint64x2_t sum = vdupq_n_u64(0);
+    uint32_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t difference = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        sum = vpadalq_u32(sum, vpaddlq_u16(vpaddlq_u8(difference)));
+    }
+    return vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1) + sumAbsDiffRow(a, b, i, length);
+}
+
+uint64_t sumPlane(const uint8_t *src, uint32_t pitch, uint32_t width, uint32_t height) {
+    uint64x2_t sum = vdupq_n_u64(0);
+    uint64_t tail = 0;
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *s = src + (uint64_t) y * pitch;
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+            sum = vpadalq_u32(sum, vpaddlq_u16(vpaddlq_u8(vld1q_u8(s + x))));
+        tail += sumRow(s, x, width);
+    }
+    return vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1) + tail;
+}
+
+void packRaw12(const uint16_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width, uint32_t height,
+               uint32_t shift) {
+    int16x8_t right = vdupq_n_s16(-(int16_t) shift);
+    uint16x8_t mask = vdupq_n_u16(0xfff);
+    uint16x8_t nibble = vdupq_n_u16(0xf);
+    for (uint32_t y = 0; y < height; y++) {
+        const uint16_t *s = (const uint16_t *) ((const uint8_t *) src + (uint64_t) y * srcPitch);
+        uint8_t *d = dst + (uint64_t) y * dstPitch;
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16) {
+            uint16x8x2_t pair = vld2q_u16(s + x);  // first and second pixel of each pair
+            uint16x8_t first = vandq_u16(vshlq_u16(pair.val[0], right), mask);
+            uint16x8_t second = vandq_u16(vshlq_u16(pair.val[1], right), mask);
+            uint8x8x3_t packed;
+            packed.val[0] = vshrn_n_u16(first, 4);
+            packed.val[1] = vshrn_n_u16(second, 4);
+            packed.val[2] = vmovn_u16(vorrq_u16(vandq_u16(first, nibble), vshlq_n_u16(vandq_u16(second, nibble), 4)));
+            vst3_u8(d + 3 * x / 2, packed);
+        }
+        packRaw12Row(s, d, x, width, shift);
+    }
+}
+
+#else
+
+void rgbaToBgr(const uint8_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width, uint32_t height) {
+    rgbaToBgrScalar(src, srcPitch, dst, dstPitch, width, height);
+}
+
+void interleaveChroma(const uint8_t *u, const uint8_t *v, uint32_t srcPitch, uint8_t *uv, uint32_t dstPitch,
+                      uint32_t width, uint32_t height) {
+    interleaveChromaScalar(u, v, srcPitch, uv, dstPitch, width, height);
+}
+
+void downscaleHalf(const uint8_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width, uint32_t height) {
+    downscaleHalfScalar(src, srcPitch, dst, dstPitch, width, height);
+}
+
+uint64_t sumAbsDiff(const uint8_t *a, const uint8_t *b, uint32_t length) {
+    return sumAbsDiffScalar(a, b, length);
+}
+
+uint64_t sumPlane(const uint8_t *src, uint32_t pitch, uint32_t width, uint32_t height) {
+    return sumPlaneScalar(src, pitch, width, height);
+}
+
+void packRaw12(const uint16_t *src, uint32_t srcPitch, uint8_t *dst, uint32_t dstPitch, uint32_t width, uint32_t height,
+               uint32_t shift) {
+    packRaw12Scalar(src, srcPitch, dst, dstPitch, width, height, shift);
+}
+
+#endif
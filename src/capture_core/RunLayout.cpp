@@ -0,0 +1,58 @@
+/*
+ * RunLayout.cpp
+ *
+ * Walks the directory layout of a recorded run. Entries are listed sorted by
+ * name, a directory that cannot be read simply has none.
+ */
+
+#include "RunLayout.hpp"
+
+#include <dirent.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+bool matchName(const char *name, const char *prefix, const char *suffix) {
+    size_t length = strlen(name), prefixLength = strlen(prefix), suffixLength = strlen(suffix);
+    if (length <= prefixLength + suffixLength || strncmp(name, prefix, prefixLength) != 0
+        || strcmp(name + length - suffixLength, suffix) != 0)
+        return false;
+    for (size_t i = prefixLength; i < length - suffixLength; i++)
+        if (name[i] < '0' || name[i] > '9')
+            return false;
+    return true;
+}
+
+std::vector<std::string> listDirectory(const std::string& directory) {
+    std::vector<std::string> names;
+    DIR *dir = opendir(directory.c_str());
+    if (!dir)
+        return names;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+        names.push_back(entry->d_name);
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+std::vector<std::string> findSegments(const std::vector<std::string>& runs) {
+    std::vector<std::string> directories(runs);
+    for (uint32_t i = 0; i < runs.size(); i++) {
+        std::vector<std::string> names = listDirectory(runs[i]);
+        for (uint32_t j = 0; j < names.size(); j++)
+            if (matchName(names[j].c_str(), "seg", ""))
+                directories.push_back(runs[i] + "/" + names[j]);
+    }
+    return directories;
+}
+
+/* Only the camera directory itself is searched, the shards hold nothing but images */
+std::vector<std::string> findCameraDirectories(const std::string& cameraDirectory) {
+    std::vector<std::string> directories(1, cameraDirectory);
+    std::vector<std::string> names = listDirectory(cameraDirectory);
+    for (uint32_t i = 0; i < names.size(); i++)
+        if (matchName(names[i].c_str(), "", ""))
+            directories.push_back(cameraDirectory + "/" + names[i]);
+    return directories;
+}
@@ -0,0 +1,71 @@
+/*
+ * ThreadPlacement.cpp
+ *
+ * Pins the calling thread to one CPU core and optionally moves it into a real-time
+ * scheduling class. Pipeline threads call this from threadInitialize() so the
+ * placement applies to the thread itself rather than to whoever created it.
+ */
+
+#include "ThreadPlacement.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sstream>
+
+/* Apply the placement, description receives the resulting layout or what failed */
+bool placeThread(int cpu, int policy, int priority, std::string& description) {
+
+    bool errorOccurred = false;
+    std::stringstream ss;
+
+    /* Restrict the thread to a single core so the scheduler can't migrate it */
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (result != 0) {
+            ss << "failed to pin to CPU " << cpu << " (" << strerror(result) << ")";
+            errorOccurred = true;
+        } else {
+            ss << "pinned to CPU " << cpu;
+        }
+    } else {
+        ss << "not pinned";
+    }
+
+    /* Real-time classes need CAP_SYS_NICE or an RLIMIT_RTPRIO allowance */
+    ss << ", ";
+    if (policy != SCHED_OTHER) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+        int result = pthread_setschedparam(pthread_self(), policy, &param);
+        if (result != 0) {
+            ss << "failed to set " << getPolicyName(policy) << " priority " << priority
+               << " (" << strerror(result) << ")";
+            errorOccurred = true;
+        } else {
+            ss << getPolicyName(policy) << " priority " << priority;
+        }
+    } else {
+        ss << getPolicyName(policy);
+    }
+
+    description = ss.str();
+    return !errorOccurred;
+}
+
+const char *getPolicyName(int policy) {
+    switch (policy) {
+        case SCHED_FIFO:
+            return "SCHED_FIFO";
+        case SCHED_RR:
+            return "SCHED_RR";
+        case SCHED_IDLE:
+            return "SCHED_IDLE";
+        default:
+            return "SCHED_OTHER";
+    }
+}
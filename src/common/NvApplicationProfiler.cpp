@@ -30,6 +30,7 @@
 #include <fstream>
 #include <sstream>
 #include <pthread.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -38,12 +39,66 @@
 #define CPU_FREQ_FILE "/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq"
 #define REQUIRED_GOVERNOR "performance"
 
+#define PROC_STAT_FILE "/proc/stat"
+#define CORE_FREQ_FILE "/sys/devices/system/cpu/cpu%u/cpufreq/scaling_cur_freq"
+#define CORE_MAX_FREQ_FILE "/sys/devices/system/cpu/cpu%u/cpufreq/cpuinfo_max_freq"
+#define THERMAL_TYPE_FILE "/sys/class/thermal/thermal_zone%u/type"
+#define THERMAL_TEMP_FILE "/sys/class/thermal/thermal_zone%u/temp"
+#define MAX_THERMAL_ZONES 32
+
 #define TIMESPEC_DIFF_USEC(timespec1, timespec2) \
     (timespec1.tv_sec - timespec2.tv_sec) * 1000000.0 + \
     (timespec1.tv_nsec - timespec2.tv_nsec) / 1000.0
 
 using namespace std;
 
+/**
+ * Candidate sysfs files for each engine, the first readable one is used.
+ * Clock rates under debugfs need root. The EMC load is the actmon average
+ * activity in kHz relative to the EMC clock, as tegrastats reports it.
+ */
+static const struct
+{
+    const char *name;
+    const char *load_paths[2];
+    float load_scale;
+    const char *rate_paths[3];
+} engine_candidates[] =
+{
+    { "emc",
+      { "/sys/kernel/actmon_avg_activity/mc_all", NULL }, 0,
+      { "/sys/kernel/debug/clk/emc/clk_rate",
+        "/sys/kernel/debug/bpmp/debug/clk/emc/rate", NULL } },
+    { "gpu",
+      { "/sys/devices/gpu.0/load", "/sys/devices/17000000.gp10b/load" }, 0.1,
+      { "/sys/kernel/debug/clk/gpcclk/clk_rate",
+        "/sys/kernel/debug/bpmp/debug/clk/gpcclk/rate", NULL } },
+    { "vic",
+      { NULL, NULL }, 0,
+      { "/sys/kernel/debug/clk/vic03/clk_rate",
+        "/sys/kernel/debug/bpmp/debug/clk/vic/rate", NULL } },
+    { "nvjpg",
+      { NULL, NULL }, 0,
+      { "/sys/kernel/debug/clk/nvjpg/clk_rate",
+        "/sys/kernel/debug/bpmp/debug/clk/nvjpg/rate", NULL } },
+};
+
+static bool
+readValue(const string &path, uint64_t &value)
+{
+    ifstream file(path.c_str(), std::ifstream::in);
+    file >> value;
+    return !file.fail();
+}
+
+static string
+formatPath(const char *format, uint32_t index)
+{
+    char path[128];
+    snprintf(path, sizeof(path), format, index);
+    return path;
+}
+
 NvApplicationProfiler::NvApplicationProfiler()
 {
     char governor[64];
@@ -70,10 +125,83 @@ NvApplicationProfiler::NvApplicationProfiler()
         check_cpu_usage = false;
     }
     num_cpu_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    num_configured_cores = sysconf(_SC_NPROCESSORS_CONF);
 
     ifstream cpu_freq_file(CPU_FREQ_FILE, std::ifstream::in);
     cpu_freq_file >> cpu_freq_khz;
     cpu_freq = cpu_freq_khz / 1000;
+
+    discoverSources();
+}
+
+void
+NvApplicationProfiler::discoverSources()
+{
+    uint64_t value;
+
+    for (size_t i = 0; i < sizeof(engine_candidates) / sizeof(engine_candidates[0]); i++)
+    {
+        EngineSource engine;
+        engine.name = engine_candidates[i].name;
+        engine.load_scale = engine_candidates[i].load_scale;
+
+        for (int j = 0; j < 2 && engine.load_path.empty(); j++)
+        {
+            const char *path = engine_candidates[i].load_paths[j];
+            if (path && readValue(path, value))
+                engine.load_path = path;
+        }
+        for (int j = 0; j < 3 && engine.rate_path.empty(); j++)
+        {
+            const char *path = engine_candidates[i].rate_paths[j];
+            if (path && readValue(path, value))
+                engine.rate_path = path;
+        }
+
+        /* A relative load is meaningless without the clock it is relative to */
+        if (engine.load_scale == 0 && engine.rate_path.empty())
+            engine.load_path.clear();
+
+        if (!engine.load_path.empty() || !engine.rate_path.empty())
+            engines.push_back(engine);
+    }
+
+    for (uint32_t i = 0; i < MAX_THERMAL_ZONES; i++)
+    {
+        ThermalZone zone;
+        ifstream type_file(formatPath(THERMAL_TYPE_FILE, i).c_str(), std::ifstream::in);
+        if (!(type_file >> zone.name))
+            break;
+        zone.path = formatPath(THERMAL_TEMP_FILE, i);
+        if (readValue(zone.path, value))
+            thermal_zones.push_back(zone);
+    }
+}
+
+void
+NvApplicationProfiler::setOutputFile(const char *path)
+{
+    pthread_mutex_lock(&thread_lock);
+    output_path = path ? path : "";
+    pthread_mutex_unlock(&thread_lock);
+}
+
+void
+NvApplicationProfiler::writeOutputHeader()
+{
+    output_file << "time_ms,process_cpu";
+    for (uint32_t i = 0; i < num_configured_cores; i++)
+        output_file << ",cpu" << i << "_usage,cpu" << i << "_mhz";
+    for (size_t i = 0; i < engines.size(); i++)
+    {
+        if (!engines[i].load_path.empty())
+            output_file << "," << engines[i].name << "_load";
+        if (!engines[i].rate_path.empty())
+            output_file << "," << engines[i].name << "_mhz";
+    }
+    for (size_t i = 0; i < thermal_zones.size(); i++)
+        output_file << "," << thermal_zones[i].name << "_c";
+    output_file << endl;
 }
 
 NvApplicationProfiler&
@@ -97,23 +225,41 @@ NvApplicationProfiler::start(uint32_t sampling_interval_ms)
 
     if (!check_cpu_usage)
     {
-        cerr << "Set governor to " REQUIRED_GOVERNOR " before enabling profiler"
-            << endl;
-        pthread_mutex_unlock(&thread_lock);
-        return;
+        cerr << "CPU governor is not " REQUIRED_GOVERNOR
+            ", process CPU usage will not be measured" << endl;
     }
 
     running = true;
     sampling_interval = sampling_interval_ms;
 
     memset(&data, 0, sizeof(data));
+    data.min_cpu_usage = 100;
+    data.min_cpu_freq = UINT32_MAX;
+    data.max_gpu_load = -1;
+    data.max_emc_load = -1;
+    data.max_temperature = -1;
+    data.max_thermal_zone = -1;
+    core_samples.assign(num_configured_cores, CoreSample());
 
     gettimeofday(&data.start_time, NULL);
 
+    clock_gettime(CLOCK_MONOTONIC, &data.start_cpu_clock_time);
     if (check_cpu_usage)
     {
         clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &data.start_proc_cpu_clock_time);
-        clock_gettime(CLOCK_MONOTONIC, &data.start_cpu_clock_time);
+    }
+
+    if (!output_path.empty())
+    {
+        output_file.open(output_path.c_str(), std::ofstream::out | std::ofstream::trunc);
+        if (output_file.is_open())
+        {
+            writeOutputHeader();
+        }
+        else
+        {
+            cerr << "Failed to open profiler output file " << output_path << endl;
+        }
     }
 
     pthread_create(&profiling_thread, NULL, ProfilerThread, this);
@@ -125,24 +271,37 @@ NvApplicationProfiler::start(uint32_t sampling_interval_ms)
 void
 NvApplicationProfiler::stop()
 {
+    if (!running)
+    {
+        return;
+    }
+
     running = false;
     pthread_join(profiling_thread, NULL);
 
     pthread_mutex_lock(&thread_lock);
     gettimeofday(&data.stop_time, NULL);
+    if (output_file.is_open())
+    {
+        output_file.close();
+    }
     pthread_mutex_unlock(&thread_lock);
 }
 
 void
 NvApplicationProfiler::profile()
 {
+    struct timespec cur_cpu_clock_time;
+    float cpu_usage = -1;
+    uint64_t value;
+
+    clock_gettime(CLOCK_MONOTONIC, &cur_cpu_clock_time);
+
     if (check_cpu_usage)
     {
         struct timespec cur_proc_cpu_clock_time;
-        struct timespec cur_cpu_clock_time;
 
         clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cur_proc_cpu_clock_time);
-        clock_gettime(CLOCK_MONOTONIC, &cur_cpu_clock_time);
 
         if (data.num_readings)
         {
@@ -152,7 +311,7 @@ NvApplicationProfiler::profile()
             float total_cpu_time = TIMESPEC_DIFF_USEC(cur_cpu_clock_time,
                     data.stop_cpu_clock_time);
 
-            float cpu_usage = proc_cpu_time * 100 / total_cpu_time;
+            cpu_usage = proc_cpu_time * 100 / total_cpu_time;
             if (cpu_usage < data.min_cpu_usage && cpu_usage > 0)
             {
                 data.min_cpu_usage = cpu_usage;
@@ -164,8 +323,158 @@ NvApplicationProfiler::profile()
         }
 
         data.stop_proc_cpu_clock_time = cur_proc_cpu_clock_time;
-        data.stop_cpu_clock_time = cur_cpu_clock_time;
     }
+    data.stop_cpu_clock_time = cur_cpu_clock_time;
+
+    /* Per-core utilisation since the previous sample, offline cores are absent */
+    vector<float> core_usage(num_configured_cores, -1);
+    ifstream stat_file(PROC_STAT_FILE, std::ifstream::in);
+    string line;
+    while (getline(stat_file, line))
+    {
+        unsigned int core;
+        unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+        if (line.compare(0, 3, "cpu"))
+        {
+            break;
+        }
+        if (sscanf(line.c_str(), "cpu%u %llu %llu %llu %llu %llu %llu %llu %llu",
+                    &core, &user, &nice, &system, &idle, &iowait, &irq, &softirq,
+                    &steal) != 9 || core >= num_configured_cores)
+        {
+            continue;
+        }
+        uint64_t busy = user + nice + system + irq + softirq + steal;
+        uint64_t total = busy + idle + iowait;
+        CoreSample &sample = core_samples[core];
+        if (sample.valid && total > sample.total)
+        {
+            core_usage[core] = (busy - sample.busy) * 100.0 / (total - sample.total);
+            if (core_usage[core] > data.max_core_usage)
+            {
+                data.max_core_usage = core_usage[core];
+            }
+        }
+        sample.busy = busy;
+        sample.total = total;
+        sample.valid = true;
+    }
+
+    /* Per-core frequency, a core running below its maximum is throttled or idle */
+    vector<int64_t> core_freq(num_configured_cores, -1);
+    for (uint32_t i = 0; i < num_configured_cores; i++)
+    {
+        if (core_samples[i].valid && readValue(formatPath(CORE_FREQ_FILE, i), value))
+        {
+            core_freq[i] = value / 1000;
+            if (core_freq[i] < data.min_cpu_freq)
+            {
+                data.min_cpu_freq = core_freq[i];
+            }
+            if (readValue(formatPath(CORE_MAX_FREQ_FILE, i), value) &&
+                    value / 1000 > data.max_cpu_freq)
+            {
+                data.max_cpu_freq = value / 1000;
+            }
+        }
+    }
+
+    if (output_file.is_open())
+    {
+        output_file << (uint64_t) (TIMESPEC_DIFF_USEC(cur_cpu_clock_time,
+                    data.start_cpu_clock_time) / 1000) << ",";
+        if (cpu_usage >= 0)
+        {
+            output_file << cpu_usage;
+        }
+        for (uint32_t i = 0; i < num_configured_cores; i++)
+        {
+            output_file << ",";
+            if (core_usage[i] >= 0)
+            {
+                output_file << core_usage[i];
+            }
+            output_file << ",";
+            if (core_freq[i] >= 0)
+            {
+                output_file << core_freq[i];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < engines.size(); i++)
+    {
+        uint64_t rate = 0;
+        bool have_rate = !engines[i].rate_path.empty() &&
+            readValue(engines[i].rate_path, rate);
+        if (!engines[i].load_path.empty())
+        {
+            float load = -1;
+            if (readValue(engines[i].load_path, value))
+            {
+                if (engines[i].load_scale != 0)
+                {
+                    load = value * engines[i].load_scale;
+                }
+                else if (have_rate && rate >= 1000)
+                {
+                    load = value * 100.0 / (rate / 1000);
+                }
+            }
+            if (engines[i].name == "gpu" && load > data.max_gpu_load)
+            {
+                data.max_gpu_load = load;
+            }
+            if (engines[i].name == "emc" && load > data.max_emc_load)
+            {
+                data.max_emc_load = load;
+            }
+            if (output_file.is_open())
+            {
+                output_file << ",";
+                if (load >= 0)
+                {
+                    output_file << load;
+                }
+            }
+        }
+        if (!engines[i].rate_path.empty() && output_file.is_open())
+        {
+            output_file << ",";
+            if (have_rate)
+            {
+                output_file << rate / 1000000;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < thermal_zones.size(); i++)
+    {
+        float temperature = -1;
+        if (readValue(thermal_zones[i].path, value))
+        {
+            temperature = value / 1000.0;
+            if (temperature > data.max_temperature)
+            {
+                data.max_temperature = temperature;
+                data.max_thermal_zone = i;
+            }
+        }
+        if (output_file.is_open())
+        {
+            output_file << ",";
+            if (temperature >= 0)
+            {
+                output_file << temperature;
+            }
+        }
+    }
+
+    if (output_file.is_open())
+    {
+        output_file << "\n";
+    }
+
     data.num_readings++;
 }
 
@@ -219,18 +528,31 @@ NvApplicationProfiler::getProfilerData(NvAppProfilerData &pdata)
         pdata.peak_cpu_usage = data.max_cpu_usage / num_cpu_cores;
         pdata.avg_cpu_usage = proc_cpu_time * 100 / total_cpu_time / num_cpu_cores;
 
-        pdata.total_time.tv_sec = data.stop_time.tv_sec - data.start_time.tv_sec;
-        pdata.total_time.tv_usec = data.stop_time.tv_usec - data.start_time.tv_usec;
-        if (pdata.total_time.tv_usec < 0)
-        {
-            pdata.total_time.tv_sec--;
-            pdata.total_time.tv_usec += 1000000;
-        }
-
         pdata.num_cpu_cores = num_cpu_cores;
         pdata.cpu_freq_mhz = cpu_freq;
     }
 
+    pdata.total_time.tv_sec = data.stop_time.tv_sec - data.start_time.tv_sec;
+    pdata.total_time.tv_usec = data.stop_time.tv_usec - data.start_time.tv_usec;
+    if (pdata.total_time.tv_usec < 0)
+    {
+        pdata.total_time.tv_sec--;
+        pdata.total_time.tv_usec += 1000000;
+    }
+
+    pdata.peak_core_usage = data.max_core_usage;
+    pdata.min_cpu_freq_mhz = data.min_cpu_freq == UINT32_MAX ? 0 : data.min_cpu_freq;
+    pdata.max_cpu_freq_mhz = data.max_cpu_freq;
+    pdata.peak_gpu_load = data.max_gpu_load;
+    pdata.peak_emc_load = data.max_emc_load;
+    pdata.peak_temperature = data.max_temperature;
+    if (data.max_thermal_zone >= 0)
+    {
+        strncpy(pdata.peak_thermal_zone,
+                thermal_zones[data.max_thermal_zone].name.c_str(),
+                sizeof(pdata.peak_thermal_zone) - 1);
+    }
+
     pthread_mutex_unlock(&thread_lock);
 }
 void
@@ -249,6 +571,25 @@ NvApplicationProfiler::printProfilerData(std::ostream &outstream)
         outstream << "Num. of Cores = " << data.num_cpu_cores << endl;
         outstream << "CPU frequency = " << data.cpu_freq_mhz << "MHz" << endl;
     }
+    outstream << "Peak Core Usage = " << data.peak_core_usage << "%" << endl;
+    if (data.min_cpu_freq_mhz)
+    {
+        outstream << "Min CPU frequency = " << data.min_cpu_freq_mhz << "MHz (max "
+            << data.max_cpu_freq_mhz << "MHz)" << endl;
+    }
+    if (data.peak_gpu_load >= 0)
+    {
+        outstream << "Peak GPU Load = " << data.peak_gpu_load << "%" << endl;
+    }
+    if (data.peak_emc_load >= 0)
+    {
+        outstream << "Peak EMC Load = " << data.peak_emc_load << "%" << endl;
+    }
+    if (data.peak_temperature >= 0)
+    {
+        outstream << "Peak Temperature = " << data.peak_temperature << "C ("
+            << data.peak_thermal_zone << ")" << endl;
+    }
     outstream << "************************************" << endl;
 }
 
@@ -31,6 +31,8 @@
 
 #include <cstring>
 #include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <sys/mman.h>
 #include <libv4l2.h>
 
@@ -38,6 +40,8 @@
 
 #define MAX(a,b) (a > b ? a : b)
 
+NvBufferMemoryPool *NvBuffer::memory_pool = NULL;
+
 NvBuffer::NvBuffer(enum v4l2_buf_type buf_type, enum v4l2_memory memory_type,
         uint32_t n_planes, NvBufferPlaneFormat * fmt, uint32_t index)
         :buf_type(buf_type),
@@ -60,6 +64,7 @@ NvBuffer::NvBuffer(enum v4l2_buf_type buf_type, enum v4l2_memory memory_type,
     ref_count = 0;
     pthread_mutex_init(&ref_lock, NULL);
     shared_buffer = NULL;
+    pool = NULL;
 }
 
 NvBuffer::NvBuffer(uint32_t pixfmt, uint32_t width, uint32_t height,
@@ -92,6 +97,7 @@ NvBuffer::NvBuffer(uint32_t pixfmt, uint32_t width, uint32_t height,
     ref_count = 0;
     pthread_mutex_init(&ref_lock, NULL);
     shared_buffer = NULL;
+    pool = NULL;
 }
 
 NvBuffer::NvBuffer(uint32_t size, uint32_t index)
@@ -118,6 +124,7 @@ NvBuffer::NvBuffer(uint32_t size, uint32_t index)
     ref_count = 0;
     pthread_mutex_init(&ref_lock, NULL);
     shared_buffer = NULL;
+    pool = NULL;
 }
 
 NvBuffer::~NvBuffer()
@@ -218,6 +225,7 @@ NvBuffer::allocateMemory()
         return 0;
     }
 
+    pool = memory_pool;
     for (j = 0; j < n_planes; j++)
     {
         if (planes[j].data)
@@ -231,10 +239,14 @@ NvBuffer::allocateMemory()
                                planes[j].fmt.width *
                                planes[j].fmt.bytesperpixel *
                                planes[j].fmt.height);
-        planes[j].data = new unsigned char [planes[j].length];
+        if (pool)
+            planes[j].data = pool->allocate(planes[j].length);
+        else
+            planes[j].data = new unsigned char [planes[j].length];
 
-        if (planes[j].data == MAP_FAILED)
+        if (!planes[j].data || planes[j].data == MAP_FAILED)
         {
+            planes[j].data = NULL;
             SYS_ERROR_MSG("Error while allocating buffer " << index <<
                     " plane " << j);
             return -1;
@@ -268,13 +280,22 @@ NvBuffer::deallocateMemory()
                     " not allocated");
             continue;
         }
-        delete[] planes[j].data;
+        if (pool)
+            pool->release(planes[j].data, planes[j].length);
+        else
+            delete[] planes[j].data;
         planes[j].data = NULL;
     }
     allocated = false;
     DEBUG_MSG("Buffer " << index << " deallocated");
 }
 
+void
+NvBuffer::setMemoryPool(NvBufferMemoryPool *pool)
+{
+    memory_pool = pool;
+}
+
 int
 NvBuffer::ref()
 {
@@ -430,3 +451,148 @@ NvBuffer::fill_buffer_plane_format(uint32_t *num_planes,
     }
     return 0;
 }
+
+NvBufferMemoryPool::NvBufferMemoryPool(uint64_t max_idle)
+        :idle_bytes(0),
+         max_idle(max_idle),
+         allocations(0),
+         reuses(0),
+         bytes(0),
+         peak_bytes(0),
+         page_size(sysconf(_SC_PAGESIZE)),
+         accounting(NULL),
+         accounting_data(NULL)
+{
+    pthread_mutex_init(&lock, NULL);
+}
+
+NvBufferMemoryPool::~NvBufferMemoryPool()
+{
+    trim();
+    pthread_mutex_destroy(&lock);
+}
+
+unsigned char *
+NvBufferMemoryPool::allocate(uint32_t length)
+{
+    size_t size = ((size_t) length + page_size - 1) & ~(page_size - 1);
+    unsigned char *data = NULL;
+
+    pthread_mutex_lock(&lock);
+    std::multimap<size_t, unsigned char *>::iterator it = idle.find(size);
+    if (it != idle.end())
+    {
+        data = it->second;
+        idle.erase(it);
+        idle_bytes -= size;
+        reuses++;
+        pthread_mutex_unlock(&lock);
+        return data;
+    }
+
+    if (accounting && !accounting((int64_t) size, accounting_data))
+    {
+        pthread_mutex_unlock(&lock);
+        CAT_ERROR_MSG("Plane of " << size << " bytes refused by the accounting");
+        return NULL;
+    }
+    if (posix_memalign((void **) &data, page_size, size) != 0)
+    {
+        if (accounting)
+            accounting(-(int64_t) size, accounting_data);
+        pthread_mutex_unlock(&lock);
+        return NULL;
+    }
+    allocations++;
+    bytes += size;
+    peak_bytes = MAX(peak_bytes, bytes);
+    pthread_mutex_unlock(&lock);
+    return data;
+}
+
+void
+NvBufferMemoryPool::release(unsigned char *data, uint32_t length)
+{
+    size_t size = ((size_t) length + page_size - 1) & ~(page_size - 1);
+
+    pthread_mutex_lock(&lock);
+    if (idle_bytes + size <= max_idle)
+    {
+        idle.insert(std::make_pair(size, data));
+        idle_bytes += size;
+    }
+    else
+    {
+        freePlane(data, size);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void
+NvBufferMemoryPool::trim()
+{
+    pthread_mutex_lock(&lock);
+    for (std::multimap<size_t, unsigned char *>::iterator it = idle.begin();
+            it != idle.end(); ++it)
+    {
+        freePlane(it->second, it->first);
+    }
+    idle.clear();
+    idle_bytes = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+void
+NvBufferMemoryPool::setAccounting(AccountingCallback callback, void *data)
+{
+    pthread_mutex_lock(&lock);
+    accounting = callback;
+    accounting_data = data;
+    pthread_mutex_unlock(&lock);
+}
+
+uint64_t
+NvBufferMemoryPool::getAllocations()
+{
+    pthread_mutex_lock(&lock);
+    uint64_t value = allocations;
+    pthread_mutex_unlock(&lock);
+    return value;
+}
+
+uint64_t
+NvBufferMemoryPool::getReuses()
+{
+    pthread_mutex_lock(&lock);
+    uint64_t value = reuses;
+    pthread_mutex_unlock(&lock);
+    return value;
+}
+
+uint64_t
+NvBufferMemoryPool::getBytes()
+{
+    pthread_mutex_lock(&lock);
+    uint64_t value = bytes;
+    pthread_mutex_unlock(&lock);
+    return value;
+}
+
+uint64_t
+NvBufferMemoryPool::getPeakBytes()
+{
+    pthread_mutex_lock(&lock);
+    uint64_t value = peak_bytes;
+    pthread_mutex_unlock(&lock);
+    return value;
+}
+
+/* Give a plane back to the heap, call with the lock held */
+void
+NvBufferMemoryPool::freePlane(unsigned char *data, size_t size)
+{
+    free(data);
+    bytes -= size;
+    if (accounting)
+        accounting(-(int64_t) size, accounting_data);
+}
@@ -188,6 +188,7 @@ NvDrmRenderer::NvDrmRenderer(const char *name, uint32_t w, uint32_t h,
   renderingStarted = false;
   activeFd = flippedFd = -1;
   last_fb = 0;
+  cacheBuffers = false;
   int ret =0;
   log_level = LOG_LEVEL_ERROR;
   last_render_time.tv_sec = 0;
@@ -655,79 +656,125 @@ NvDrmRenderer::enqueBuffer(int fd)
 }
 
 int
-NvDrmRenderer::renderInternal(int fd)
+NvDrmRenderer::importBuffer(int fd, uint32_t w, uint32_t h, uint32_t *fb_id)
 {
   int ret;
   uint32_t i;
   uint32_t handle;
-  uint32_t fb;
   uint32_t bo_handles[4];
+  uint32_t imported = 0;
   uint32_t flags = 0;
-  bool frame_is_late = false;
 
   NvBufferParams params;
   NvBufDrmParams dParams;
   struct drm_tegra_gem_set_tiling args;
-  auto map_entry = map_list.find (fd);
-  if (map_entry != map_list.end()) {
-    fb = (uint32_t) map_entry->second;
-  } else {
-    // Create a new FB.
-    ret = NvBufferGetParams(fd, &params);
-    if (ret < 0) {
-      COMP_ERROR_MSG("Failed to get buffer information ");
+
+  ret = NvBufferGetParams(fd, &params);
+  if (ret < 0) {
+    COMP_ERROR_MSG("Failed to get buffer information ");
+    return -1;
+  }
+
+  ret = NvBufGetDrmParams(&params, &dParams);
+  if (ret < 0) {
+    COMP_ERROR_MSG("Failed to convert to DRM params ");
+    return -1;
+  }
+
+  for (i = 0; i < dParams.num_planes; i++) {
+    ret = drmPrimeFDToHandle(drm_fd, fd, &handle);
+    if (ret)
+    {
+      COMP_ERROR_MSG("Failed to import buffer object. ");
       goto error;
     }
+    bo_handles[i] = handle;
+    imported++;
 
-    ret = NvBufGetDrmParams(&params, &dParams);
-    if (ret < 0) {
-      COMP_ERROR_MSG("Failed to convert to DRM params ");
+    memset(&args, 0, sizeof(args));
+    args.handle = handle;
+    args.mode = DRM_TEGRA_GEM_TILING_MODE_PITCH;
+    args.value = 1;
+
+    ret = drmIoctl(drm_fd, DRM_IOCTL_TEGRA_GEM_SET_TILING, &args);
+    if (ret < 0)
+    {
+      COMP_ERROR_MSG("Failed to set tiling parameters ");
       goto error;
     }
+  }
 
-   for (i = 0; i < dParams.num_planes; i++) {
-     ret = drmPrimeFDToHandle(drm_fd, fd, &handle);
-     if (ret)
-     {
-       COMP_ERROR_MSG("Failed to import buffer object. ");
-       goto error;
-     }
+  ret = drmModeAddFB2(drm_fd, w, h, dParams.pixel_format, bo_handles,
+                      dParams.pitch, dParams.offset, fb_id, flags);
+  if (ret)
+  {
+    COMP_ERROR_MSG("Failed to create fb ");
+    goto error;
+  }
+
+  // The fb holds its own reference to the buffer objects. Every plane
+  // of the buffer imports to the same handle, close it once.
+  if (imported)
+    drmUtilCloseGemBo(drm_fd, bo_handles[0]);
+  return 0;
+
+error:
+  if (imported)
+    drmUtilCloseGemBo(drm_fd, bo_handles[0]);
+  return -1;
+}
 
-     memset(&args, 0, sizeof(args));
-     args.handle = handle;
-     args.mode = DRM_TEGRA_GEM_TILING_MODE_PITCH;
-     args.value = 1;
+int
+NvDrmRenderer::addBufferFB(int fd, uint32_t *fb_id)
+{
+  NvBufferParams params;
 
-     ret = drmIoctl(drm_fd, DRM_IOCTL_TEGRA_GEM_SET_TILING, &args);
-     if (ret < 0)
-     {
-       COMP_ERROR_MSG("Failed to set tiling parameters ");
-       goto error;
-     }
+  if (NvBufferGetParams(fd, &params) < 0) {
+    COMP_ERROR_MSG("Failed to get buffer information ");
+    return -1;
+  }
+  return importBuffer(fd, params.width[0], params.height[0], fb_id);
+}
 
-     bo_handles[i] = handle;
-   }
+void
+NvDrmRenderer::enableBufferCache(bool enable)
+{
+  cacheBuffers = enable;
+}
 
-    ret = drmModeAddFB2(drm_fd, width, height, dParams.pixel_format, bo_handles,
-                        dParams.pitch, dParams.offset, &fb, flags);
+int
+NvDrmRenderer::renderInternal(int fd)
+{
+  int ret;
+  uint32_t fb;
+  bool cached = false;
+  bool frame_is_late = false;
 
+  auto map_entry = map_list.find (fd);
+  if (map_entry != map_list.end()) {
+    // Already on the plane once, flipping to it is enough
+    fb = (uint32_t) map_entry->second;
+    cached = true;
+  } else {
+    // Create a new FB.
+    ret = importBuffer(fd, width, height, &fb);
     if (ret)
-    {
-      COMP_ERROR_MSG("Failed to create fb ");
       goto error;
-    }
 
     ret = setPlane(0, fb, 0, 0, width, height, 0, 0, width, height);
     if(ret) {
       COMP_ERROR_MSG("FAILED TO SET PLANE ");
+      drmModeRmFB(drm_fd, fb);
       goto error;
     }
 
-    /* TODO:
-     * We get new FDs from camera consumer. Don't do mapping until
-     * we can resolve that.
+    /* The camera consumers hand over new FDs for each frame, only map
+     * them when the caller renders a fixed set of buffers.
      */
-//    map_list.insert(std::make_pair(fd, fb));
+    if (cacheBuffers) {
+      map_list.insert(std::make_pair(fd, fb));
+      cached = true;
+    }
   }
 
   if (last_render_time.tv_sec != 0)
@@ -775,25 +822,13 @@ NvDrmRenderer::renderInternal(int fd)
     goto error;
   }
 
-  /* TODO:
-   * Don't create/remove fb for each frame but maintain mapping.
-   * We will do that once new FD for each frame from consumer is resolved.
-   */
-
-  for (i = 0; i < dParams.num_planes; i++)
-  {
-    if (!drmUtilCloseGemBo (fd,bo_handles[i]))
-    {
-      COMP_ERROR_MSG("Failed to close bo \n");
-      goto error;
-    }
+  // Uncached fbs are removed once the next frame is flipped to
+  if (!cached) {
+    if(last_fb)
+      drmModeRmFB(drm_fd, last_fb);
+    last_fb = fb;
   }
 
-   if(last_fb)
-    drmModeRmFB(drm_fd, last_fb);
-
-  last_fb = fb;
-
   profiler.finishProcessing(0, frame_is_late);
   return 0;
 
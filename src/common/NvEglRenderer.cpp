@@ -64,6 +64,18 @@ NvEglRenderer::NvEglRenderer(const char *name, uint32_t width, uint32_t height,
     x_display = NULL;
 
     texture_id = 0;
+    plain_program = 0;
+    remap_program = 0;
+    memset(viewport, 0, sizeof(viewport));
+    render_cell_count = 0;
+    memset(render_cells, 0, sizeof(render_cells));
+    for (int i = 0; i < NV_EGL_MAX_CELLS; i++)
+    {
+        remaps[i].width = 0;
+        remaps[i].height = 0;
+        remaps[i].texture = 0;
+        remaps[i].dirty = false;
+    }
     gc = NULL;
     fontinfo = NULL;
 
@@ -280,6 +292,31 @@ finish:
         glDeleteTextures(1, &renderer->texture_id);
     }
 
+    for (auto entry = renderer->cell_images.begin();
+            entry != renderer->cell_images.end(); ++entry)
+    {
+        glDeleteTextures(1, &entry->second.texture);
+        NvDestroyEGLImage(renderer->egl_display, entry->second.image);
+    }
+    renderer->cell_images.clear();
+
+    for (int i = 0; i < NV_EGL_MAX_CELLS; i++)
+    {
+        if (renderer->remaps[i].texture)
+        {
+            glDeleteTextures(1, &renderer->remaps[i].texture);
+        }
+    }
+
+    if (renderer->plain_program)
+    {
+        glDeleteProgram(renderer->plain_program);
+    }
+    if (renderer->remap_program)
+    {
+        glDeleteProgram(renderer->remap_program);
+    }
+
     if (renderer->egl_display != EGL_NO_DISPLAY)
     {
         eglMakeCurrent(renderer->egl_display, EGL_NO_SURFACE,
@@ -362,6 +399,7 @@ NvEglRenderer::render(int fd)
 {
     this->render_fd = fd;
     pthread_mutex_lock(&render_lock);
+    render_cell_count = 0;
     pthread_cond_broadcast(&render_cond);
     COMP_DEBUG_MSG("Rendering fd=" << fd);
     pthread_cond_wait(&render_cond, &render_lock);
@@ -369,25 +407,163 @@ NvEglRenderer::render(int fd)
     return 0;
 }
 
+int
+NvEglRenderer::renderCells(uint32_t count, const NvEglCell *cells)
+{
+    if (count == 0 || count > NV_EGL_MAX_CELLS)
+    {
+        COMP_ERROR_MSG("Cannot render " << count << " cells");
+        return -1;
+    }
+    pthread_mutex_lock(&render_lock);
+    render_cell_count = count;
+    memcpy(render_cells, cells, count * sizeof(NvEglCell));
+    pthread_cond_broadcast(&render_cond);
+    COMP_DEBUG_MSG("Rendering " << count << " cells");
+    pthread_cond_wait(&render_cond, &render_lock);
+    pthread_mutex_unlock(&render_lock);
+    return 0;
+}
+
+int
+NvEglRenderer::setRemap(uint32_t remap, uint32_t width, uint32_t height,
+        const uint16_t *coords)
+{
+    if (remap >= NV_EGL_MAX_CELLS || !width || !height || !coords)
+    {
+        COMP_ERROR_MSG("Invalid remap " << remap);
+        return -1;
+    }
+
+    pthread_mutex_lock(&render_lock);
+    Remap &r = remaps[remap];
+    r.texels.resize(width * height * 4);
+    for (uint32_t i = 0; i < width * height; i++)
+    {
+        r.texels[i * 4] = coords[i * 2] >> 8;
+        r.texels[i * 4 + 1] = coords[i * 2] & 0xff;
+        r.texels[i * 4 + 2] = coords[i * 2 + 1] >> 8;
+        r.texels[i * 4 + 3] = coords[i * 2 + 1] & 0xff;
+    }
+    r.width = width;
+    r.height = height;
+    r.dirty = true;
+    pthread_mutex_unlock(&render_lock);
+    return 0;
+}
+
+void
+NvEglRenderer::uploadRemaps()
+{
+    pthread_mutex_lock(&render_lock);
+    for (int i = 0; i < NV_EGL_MAX_CELLS; i++)
+    {
+        Remap &r = remaps[i];
+        if (!r.dirty)
+            continue;
+        if (!r.texture)
+        {
+            glGenTextures(1, &r.texture);
+        }
+        // The texels are encoded coordinates, never interpolate them
+        glBindTexture(GL_TEXTURE_2D, r.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, r.width, r.height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, r.texels.data());
+        r.dirty = false;
+    }
+    pthread_mutex_unlock(&render_lock);
+}
+
+int
+NvEglRenderer::drawCells()
+{
+    uploadRemaps();
+
+    glScissor(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    for (uint32_t i = 0; i < render_cell_count; i++)
+    {
+        const NvEglCell &cell = render_cells[i];
+
+        // Import each buffer once, its texture samples the buffer as it is now
+        auto entry = cell_images.find(cell.fd);
+        if (entry == cell_images.end())
+        {
+            CellImage cell_image;
+            cell_image.image = NvEGLImageFromFd(egl_display, cell.fd);
+            if (!cell_image.image)
+            {
+                COMP_ERROR_MSG("Could not get EglImage from fd " << cell.fd);
+                return -1;
+            }
+            glGenTextures(1, &cell_image.texture);
+            glBindTexture(GL_TEXTURE_EXTERNAL_OES, cell_image.texture);
+            glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, cell_image.image);
+            entry = cell_images.insert(std::make_pair(cell.fd, cell_image)).first;
+        }
+
+        bool remapped = cell.remap >= 0 && cell.remap < NV_EGL_MAX_CELLS &&
+                        remaps[cell.remap].texture;
+        glUseProgram(remapped ? remap_program : plain_program);
+        if (remapped)
+        {
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, remaps[cell.remap].texture);
+        }
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_EXTERNAL_OES, entry->second.texture);
+
+        // GL counts rows from the bottom of the window
+        GLint y = viewport[1] + viewport[3] - cell.y - cell.height;
+        glViewport(viewport[0] + cell.x, y, cell.width, cell.height);
+        glScissor(viewport[0] + cell.x, y, cell.width, cell.height);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glScissor(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glUseProgram(plain_program);
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, texture_id);
+    return 0;
+}
+
 int
 NvEglRenderer::renderInternal()
 {
-    EGLImageKHR hEglImage;
+    EGLImageKHR hEglImage = NULL;
     bool frame_is_late = false;
 
     EGLSyncKHR egl_sync;
     int iErr;
-    hEglImage = NvEGLImageFromFd(egl_display, render_fd);
-    if (!hEglImage)
+    if (render_cell_count > 0)
     {
-        COMP_ERROR_MSG("Could not get EglImage from fd. Not rendering");
-        return -1;
+        if (drawCells() < 0)
+        {
+            return -1;
+        }
     }
+    else
+    {
+        hEglImage = NvEGLImageFromFd(egl_display, render_fd);
+        if (!hEglImage)
+        {
+            COMP_ERROR_MSG("Could not get EglImage from fd. Not rendering");
+            return -1;
+        }
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_EXTERNAL_OES, texture_id);
-    glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, hEglImage);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_EXTERNAL_OES, texture_id);
+        glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, hEglImage);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
 
     iErr = glGetError();
     if (iErr != GL_NO_ERROR)
@@ -450,7 +626,10 @@ NvEglRenderer::renderInternal()
     {
         COMP_ERROR_MSG("eglDestroySyncKHR failed!");
     }
-    NvDestroyEGLImage(egl_display, hEglImage);
+    if (hEglImage)
+    {
+        NvDestroyEGLImage(egl_display, hEglImage);
+    }
 
     if (strlen(overlay_str) != 0)
     {
@@ -584,14 +763,50 @@ NvEglRenderer::CreateShader(GLuint program, GLenum type, const char *source,
     }
 }
 
-int
-NvEglRenderer::InitializeShaders(void)
+GLuint
+NvEglRenderer::LinkProgram(const char *vertex, int vertex_size,
+        const char *fragment, int fragment_size,
+        GLint pos_location, GLint tc_location)
 {
     GLuint program;
     int result = GL_FALSE;
     char log[4096];
-    uint32_t pos_location = 0;
-    uint32_t tc_location = 0;
+
+    program = glCreateProgram();
+
+    CreateShader(program, GL_VERTEX_SHADER, vertex, vertex_size);
+    CreateShader(program, GL_FRAGMENT_SHADER, fragment, fragment_size);
+
+    if (pos_location >= 0)
+    {
+        glBindAttribLocation(program, pos_location, "in_pos");
+        glBindAttribLocation(program, tc_location, "in_tc");
+    }
+
+    glLinkProgram(program);
+    if (glGetError() != GL_NO_ERROR)
+    {
+        COMP_ERROR_MSG("Got gl error as " << glGetError());
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    glGetProgramiv(program, GL_LINK_STATUS, &result);
+    if (!result)
+    {
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        COMP_ERROR_MSG("Error while Linking " << log);
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+int
+NvEglRenderer::InitializeShaders(void)
+{
+    GLint pos_location = 0;
+    GLint tc_location = 0;
 
     static const float kVertices[] = {
         -1.f, -1.f,
@@ -618,49 +833,60 @@ NvEglRenderer::InitializeShaders(void)
         "uniform samplerExternalOES tex; \n" "void main() {\n"
         "gl_FragColor = texture2D(tex, interp_tc);\n" "}\n";
 
-    glEnable(GL_SCISSOR_TEST);
-    program = glCreateProgram();
-
-    CreateShader(program, GL_VERTEX_SHADER, kVertexShader,
-                 sizeof(kVertexShader));
-    CreateShader(program, GL_FRAGMENT_SHADER, kFragmentShader,
-                 sizeof(kFragmentShader));
+    // Each pixel samples the buffer where the remap texel points, the
+    // 16 bit coordinates need highp
+    static const char kRemapFragmentShader[] =
+        "#extension GL_OES_EGL_image_external : require\n"
+        "precision highp float;\n" "varying vec2 interp_tc; \n"
+        "uniform samplerExternalOES tex; \n"
+        "uniform sampler2D remap; \n" "void main() {\n"
+        "vec4 m = texture2D(remap, interp_tc);\n"
+        "vec2 tc = vec2(m.r * 65280.0 + m.g * 255.0,\n"
+        "               m.b * 65280.0 + m.a * 255.0) / 65535.0;\n"
+        "gl_FragColor = texture2D(tex, tc);\n" "}\n";
 
-    glLinkProgram(program);
-    if (glGetError() != GL_NO_ERROR)
-    {
-        COMP_ERROR_MSG("Got gl error as " << glGetError());
-        return -1;
-    }
+    glEnable(GL_SCISSOR_TEST);
 
-    glGetProgramiv(program, GL_LINK_STATUS, &result);
-    if (!result)
+    plain_program = LinkProgram(kVertexShader, sizeof(kVertexShader),
+                                kFragmentShader, sizeof(kFragmentShader), -1, -1);
+    if (!plain_program)
     {
-        glGetShaderInfoLog(program, sizeof(log), NULL, log);
-        COMP_ERROR_MSG("Error while Linking " << log);
         return -1;
     }
 
-    glUseProgram(program);
+    glUseProgram(plain_program);
     if (glGetError() != GL_NO_ERROR)
     {
         COMP_ERROR_MSG("Got gl error as " << glGetError());
         return -1;
     }
 
-    pos_location = glGetAttribLocation(program, "in_pos");
+    pos_location = glGetAttribLocation(plain_program, "in_pos");
 
     glEnableVertexAttribArray(pos_location);
     glVertexAttribPointer(pos_location, 2, GL_FLOAT, GL_FALSE, 0, kVertices);
 
-    tc_location = glGetAttribLocation(program, "in_tc");
+    tc_location = glGetAttribLocation(plain_program, "in_tc");
 
     glEnableVertexAttribArray(tc_location);
     glVertexAttribPointer(tc_location, 2, GL_FLOAT, GL_FALSE, 0,
                           kTextureCoords);
 
+    // The remap program shares the vertex arrays, bound to the same locations
+    remap_program = LinkProgram(kVertexShader, sizeof(kVertexShader),
+                                kRemapFragmentShader, sizeof(kRemapFragmentShader),
+                                pos_location, tc_location);
+    if (!remap_program)
+    {
+        return -1;
+    }
+    glUseProgram(remap_program);
+    glUniform1i(glGetUniformLocation(remap_program, "tex"), 0);
+    glUniform1i(glGetUniformLocation(remap_program, "remap"), 1);
+    glUseProgram(plain_program);
+
     glActiveTexture(GL_TEXTURE0);
-    glUniform1i(glGetUniformLocation(program, "texSampler"), 0);
+    glUniform1i(glGetUniformLocation(plain_program, "texSampler"), 0);
     if (glGetError() != GL_NO_ERROR)
     {
         COMP_ERROR_MSG("Got gl error as " << glGetError());
@@ -673,8 +899,6 @@ NvEglRenderer::InitializeShaders(void)
 int
 NvEglRenderer::create_texture()
 {
-    int viewport[4];
-
     glGetIntegerv(GL_VIEWPORT, viewport);
     glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
     glScissor(viewport[0], viewport[1], viewport[2], viewport[3]);
@@ -28,32 +28,32 @@
 
 #include <iostream>
 #include <string.h>
-#include <map>
 #include <stdint.h>
+#include <time.h>
 #include "NvElementProfiler.h"
 
 #define LOCK() pthread_mutex_lock(&profiler_lock)
 #define UNLOCK() pthread_mutex_unlock(&profiler_lock)
 
-#define RETURN_IF_DISABLED() \
-    if (!enabled) { \
-        UNLOCK(); \
-        return; \
-    }
-
-#define GET_TIME(timeval) gettimeofday(timeval, NULL);
-
-#define TIMESPEC_DIFF_USEC(timespec1, timespec2) \
-    (((timespec1)->tv_sec - (timespec2)->tv_sec) * 1000000L + \
-        (timespec1)->tv_usec - (timespec2)->tv_usec)
+#define SLOT_MASK (NV_PROFILER_SLOTS - 1)
 
 using namespace std;
 
+static inline uint64_t
+get_time_nsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 NvElementProfiler::NvElementProfiler(ProfilerField fields)
     :valid_fields(fields)
 {
     enabled = false;
     unit_id_counter = 0;
+    unit_finish_counter = 0;
+    accumulated_nsec = 0;
 
     reset();
 
@@ -62,11 +62,9 @@ NvElementProfiler::NvElementProfiler(ProfilerField fields)
 
 NvElementProfiler::~NvElementProfiler()
 {
-    LOCK();
-    reset();
-    UNLOCK();
     pthread_mutex_destroy(&profiler_lock);
 }
+
 void
 NvElementProfiler::enableProfiling(bool reset_data)
 {
@@ -90,78 +88,63 @@ void
 NvElementProfiler::disableProfiling()
 {
     LOCK();
-    RETURN_IF_DISABLED();
-
-    data_int.accumulated_time.tv_sec +=
-        (data_int.stop_time.tv_sec - data_int.start_time.tv_sec);
-    data_int.accumulated_time.tv_usec +=
-        (data_int.stop_time.tv_usec - data_int.start_time.tv_usec);
-    data_int.start_time.tv_sec = 0;
-    data_int.start_time.tv_usec = 0;
-    data_int.stop_time.tv_sec = 0;
-    data_int.stop_time.tv_usec = 0;
+    if (!enabled)
+    {
+        UNLOCK();
+        return;
+    }
+
     enabled = false;
+    uint64_t start = start_nsec.exchange(0);
+    if (start)
+    {
+        accumulated_nsec += stop_nsec - start;
+    }
+    stop_nsec = 0;
     UNLOCK();
 }
 
 void NvElementProfiler::getProfilerData(NvElementProfiler::NvElementProfilerData &data)
 {
-    uint64_t total_time;
+    uint64_t total_units = total_processed_units;
+    uint64_t start = start_nsec;
+    uint64_t total_time_usec = (accumulated_nsec + (start ? stop_nsec - start : 0)) / 1000;
 
-    LOCK();
-
-    total_time = data_int.accumulated_time.tv_sec * 1000000L +
-        data_int.accumulated_time.tv_usec +
-        TIMESPEC_DIFF_USEC(&data_int.stop_time, &data_int.start_time);
-
-    if (data_int.total_processed_units == 0 || total_time == 0)
+    if (total_units == 0 || total_time_usec == 0)
     {
         data.average_fps = 0;
     }
     else
     {
-        data.average_fps = ((float) (data_int.total_processed_units - 1)) *
-            1000000 / total_time;
+        data.average_fps = ((float) (total_units - 1)) *
+            1000000 / total_time_usec;
     }
 
-    if (data_int.total_processed_units == 0)
+    if (latencies.getCount() == 0)
     {
         data.max_latency_usec = 0;
         data.min_latency_usec = 0;
         data.average_latency_usec = 0;
+        data.p50_latency_usec = 0;
+        data.p95_latency_usec = 0;
+        data.p99_latency_usec = 0;
     }
     else
     {
-        data.max_latency_usec = data_int.max_latency_usec;
-        data.min_latency_usec = data_int.min_latency_usec;
-        data.average_latency_usec =
-            data_int.total_latency / data_int.total_processed_units;
+        data.max_latency_usec = latencies.getMax();
+        data.min_latency_usec = min_latency_usec;
+        data.average_latency_usec = latencies.getMean();
+        data.p50_latency_usec = latencies.getPercentile(50);
+        data.p95_latency_usec = latencies.getPercentile(95);
+        data.p99_latency_usec = latencies.getPercentile(99);
     }
 
-    data.profiling_time.tv_sec =
-        data_int.accumulated_time.tv_sec + data_int.stop_time.tv_sec -
-                data_int.start_time.tv_sec;
-
-    data.profiling_time.tv_usec =
-        data_int.accumulated_time.tv_usec + data_int.stop_time.tv_usec -
-                data_int.start_time.tv_usec;
-
-    if (data.profiling_time.tv_usec < 0)
-    {
-        data.profiling_time.tv_usec += 1000000;
-        data.profiling_time.tv_sec--;
-    }
-
-    if (data.profiling_time.tv_usec > 1000000)
-    {
-        data.profiling_time.tv_usec -= 1000000;
-        data.profiling_time.tv_sec++;
-    }
+    data.profiling_time.tv_sec = total_time_usec / 1000000;
+    data.profiling_time.tv_usec = total_time_usec % 1000000;
 
-    data.total_processed_units = data_int.total_processed_units;
-    data.num_late_units = data_int.num_late_units;
+    data.total_processed_units = total_units;
+    data.num_late_units = num_late_units;
     data.valid_fields = valid_fields;
-    UNLOCK();
 }
 
 void NvElementProfiler::printProfilerData(ostream &out_stream)
@@ -194,105 +177,100 @@ void NvElementProfiler::printProfilerData(ostream &out_stream)
             data.min_latency_usec << endl;
         out_stream << "Maximum latency(usec) = " <<
             data.max_latency_usec << endl;
+        out_stream << "Latency p50/p95/p99(usec) = " <<
+            data.p50_latency_usec << "/" << data.p95_latency_usec << "/" <<
+            data.p99_latency_usec << endl;
     }
 }
 
 void
 NvElementProfiler::reset()
 {
-    memset(&data_int, 0, sizeof(data_int));
-    data_int.min_latency_usec = (uint64_t) -1;
-
-    unit_start_time_queue.clear();
+    for (uint32_t i = 0; i < NV_PROFILER_SLOTS; i++)
+    {
+        unit_slots[i].id = 0;
+        unit_slots[i].start_nsec = 0;
+    }
+    unit_finish_counter = unit_id_counter.load();
+    total_processed_units = 0;
+    num_late_units = 0;
+    min_latency_usec = UINT64_MAX;
+    start_nsec = 0;
+    stop_nsec = 0;
+    accumulated_nsec = 0;
+    latencies.reset();
 }
 
 uint64_t
 NvElementProfiler::startProcessing()
 {
-    struct timeval time;
-    uint64_t ret = 0;
-    LOCK();
-    if (enabled)
+    if (!enabled)
     {
-        std::map<uint64_t,struct timeval>::iterator it =
-            unit_start_time_queue.end();
-
-        unit_id_counter++;
-        GET_TIME(&time);
-
-        unit_start_time_queue.insert(it,
-                std::pair<uint64_t,struct timeval>(unit_id_counter, time));
-
-        ret = unit_id_counter;
+        return 0;
     }
-    UNLOCK();
-    return ret;
+
+    uint64_t id = ++unit_id_counter;
+    UnitSlot &slot = unit_slots[id & SLOT_MASK];
+    slot.start_nsec.store(get_time_nsec(), memory_order_relaxed);
+    slot.id.store(id, memory_order_release);
+    return id;
 }
 
 void
 NvElementProfiler::finishProcessing(uint64_t id, bool is_late)
 {
-    struct timeval unit_start_time;
-    struct timeval stop_time;
-    uint64_t latency;
-
-    LOCK();
-    RETURN_IF_DISABLED();
-
-    if ((valid_fields & PROFILER_FIELD_LATENCIES) &&
-            unit_start_time_queue.empty())
+    if (!enabled)
     {
-        UNLOCK();
         return;
     }
 
-    GET_TIME(&stop_time);
+    uint64_t stop_time = get_time_nsec();
 
     if (valid_fields & PROFILER_FIELD_LATENCIES)
     {
-        std::map<uint64_t, struct timeval>::iterator it;
-        if (id)
+        /* ID 0 finishes the oldest unit still in flight, nothing to do if there is none */
+        while (!id)
         {
-            it = unit_start_time_queue.find(id);
+            uint64_t next = unit_finish_counter;
+            if (next >= unit_id_counter)
+            {
+                return;
+            }
+            if (unit_finish_counter.compare_exchange_weak(next, next + 1) &&
+                    unit_slots[(next + 1) & SLOT_MASK].id.load(memory_order_acquire) == next + 1)
+            {
+                id = next + 1;
+            }
         }
-        else
+
+        /* The slot was reused if the unit stayed in flight too long, skip its latency */
+        UnitSlot &slot = unit_slots[id & SLOT_MASK];
+        uint64_t expected = id;
+        if (slot.id.load(memory_order_acquire) != id)
         {
-            it = unit_start_time_queue.begin();
+            return;
         }
-
-        if (it == unit_start_time_queue.end())
+        uint64_t unit_start_time = slot.start_nsec.load(memory_order_relaxed);
+        if (!slot.id.compare_exchange_strong(expected, 0))
         {
-            UNLOCK();
             return;
         }
-        unit_start_time = it->second;
-        unit_start_time_queue.erase(it);
 
-        latency = TIMESPEC_DIFF_USEC(&stop_time, &unit_start_time);
-        data_int.total_latency += latency;
+        uint64_t latency = (stop_time - unit_start_time) / 1000;
+        latencies.record(latency);
 
-        if (latency < data_int.min_latency_usec)
-        {
-            data_int.min_latency_usec = latency;
-        }
-        if(latency > data_int.max_latency_usec)
-        {
-            data_int.max_latency_usec = latency;
-        }
+        uint64_t min = min_latency_usec;
+        while (latency < min && !min_latency_usec.compare_exchange_weak(min, latency));
     }
 
-    data_int.stop_time = stop_time;
+    stop_nsec = stop_time;
 
-    if (!data_int.start_time.tv_sec && !data_int.start_time.tv_usec)
-    {
-        data_int.start_time = data_int.stop_time;
-    }
+    uint64_t no_start = 0;
+    start_nsec.compare_exchange_strong(no_start, stop_time);
 
     if (is_late)
     {
-        data_int.num_late_units++;
+        num_late_units++;
     }
-    data_int.total_processed_units++;
-
-    UNLOCK();
+    total_processed_units++;
 }
@@ -37,7 +37,7 @@
 #define CAT_NAME "JpegEncoder"
 
 NvJPEGEncoder::NvJPEGEncoder(const char *comp_name)
-    :NvElement(comp_name, valid_fields)
+    :NvElement(comp_name, valid_fields), restart_rows(0)
 {
     memset(&cinfo, 0, sizeof(cinfo));
     memset(&jerr, 0, sizeof(jerr));
@@ -89,6 +89,7 @@ NvJPEGEncoder::encodeFromFd(int fd, J_COLOR_SPACE color_space,
     cinfo.in_color_space = JCS_YCbCr;
     jpeg_set_defaults(&cinfo);
     jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.restart_in_rows = restart_rows;
     jpeg_set_hardware_acceleration_parameters_enc(&cinfo, TRUE, out_buf_size, 0, 0);
 
     switch (color_space)
@@ -96,6 +97,11 @@ NvJPEGEncoder::encodeFromFd(int fd, J_COLOR_SPACE color_space,
         case JCS_YCbCr:
             cinfo.in_color_space = JCS_YCbCr;
             break;
+        case JCS_GRAYSCALE:
+            cinfo.in_color_space = JCS_GRAYSCALE;
+            cinfo.input_components = 1;
+            jpeg_set_colorspace(&cinfo, JCS_GRAYSCALE);
+            break;
         default:
             COMP_ERROR_MSG("Color format " << color_space << " not supported\n");
             return -1;
@@ -212,6 +218,7 @@ NvJPEGEncoder::encodeFromBuffer(NvBuffer & buffer, J_COLOR_SPACE color_space,
 
     jpeg_set_defaults(&cinfo);
     jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.restart_in_rows = restart_rows;
     jpeg_set_hardware_acceleration_parameters_enc(&cinfo, TRUE, out_buf_size, 0, 0);
     cinfo.raw_data_in = TRUE;
 
@@ -223,6 +230,11 @@ NvJPEGEncoder::encodeFromBuffer(NvBuffer & buffer, J_COLOR_SPACE color_space,
         case JCS_YCbCr:
             cinfo.in_color_space = JCS_YCbCr;
             break;
+        case JCS_GRAYSCALE:
+            cinfo.in_color_space = JCS_GRAYSCALE;
+            cinfo.input_components = 1;
+            jpeg_set_colorspace(&cinfo, JCS_GRAYSCALE);
+            break;
         default:
             COMP_ERROR_MSG("Color format " << color_space << " not supported\n");
             return -1;
@@ -290,6 +302,12 @@ NvJPEGEncoder::setCropRect(uint32_t left, uint32_t top, uint32_t width,
 }
 
 
+void
+NvJPEGEncoder::setRestartRows(uint32_t rows)
+{
+    restart_rows = rows;
+}
+
 void
 NvJPEGEncoder::setScaledEncodeParams(uint32_t scale_width, uint32_t scale_height)
 {
@@ -30,4 +30,6 @@
 
 int log_level = DEFAULT_LOG_LEVEL;
 
+void (*log_handler)(int level, const std::string& message) = NULL;
+
 const char *log_level_name[] = {"INFO", "ERROR", "WARN", "DEBUG"};
\ No newline at end of file
@@ -27,6 +27,7 @@
  */
 
 #include "NvV4l2ElementPlane.h"
+#include "NvV4l2PollLoop.h"
 #include "NvLogging.h"
 
 #include <cstring>
@@ -89,6 +90,8 @@ NvV4l2ElementPlane::NvV4l2ElementPlane(enum v4l2_buf_type buf_type,
     stop_dqthread = false;
     dq_thread = 0;
     callback = NULL;
+    poll_loop = NULL;
+    dq_polled = false;
 
     memory_type = V4L2_MEMORY_MMAP;
 
@@ -97,6 +100,10 @@ NvV4l2ElementPlane::NvV4l2ElementPlane(enum v4l2_buf_type buf_type,
 
 NvV4l2ElementPlane::~NvV4l2ElementPlane()
 {
+    if (dq_polled)
+    {
+        poll_loop->remove(this);
+    }
     pthread_mutex_destroy(&plane_lock);
     pthread_cond_destroy(&plane_cond);
 }
@@ -572,6 +579,12 @@ NvV4l2ElementPlane::setStreamStatus(bool status)
     }
 
     pthread_mutex_unlock(&plane_lock);
+
+    /* A DQ Thread exits once the stream is off, the poll loop lets go of the plane */
+    if (!ret && !status && dq_polled)
+    {
+        stopDQThread();
+    }
     return ret;
 }
 
@@ -860,16 +873,87 @@ NvV4l2ElementPlane::startDQThread(void *data)
         return 0;
     }
     dqThread_data = data;
-    pthread_create(&dq_thread, NULL, dqThread, this);
     dqthread_running = true;
+    if (poll_loop)
+    {
+        dq_polled = true;
+        pthread_mutex_unlock(&plane_lock);
+        if (poll_loop->add(this) == 0)
+        {
+            PLANE_DEBUG_MSG("Handed to the poll loop");
+            return 0;
+        }
+        pthread_mutex_lock(&plane_lock);
+        dq_polled = false;
+    }
+    pthread_create(&dq_thread, NULL, dqThread, this);
     pthread_mutex_unlock(&plane_lock);
     PLANE_DEBUG_MSG("Started DQ Thread");
     return 0;
 }
 
+void
+NvV4l2ElementPlane::setDQPollLoop(NvV4l2PollLoop *loop)
+{
+    poll_loop = loop;
+}
+
+bool
+NvV4l2ElementPlane::dispatchDQ()
+{
+    struct v4l2_buffer v4l2_buf;
+    struct v4l2_plane planes[MAX_PLANES];
+    NvBuffer *buffer;
+    NvBuffer *shared_buffer;
+
+    memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+    memset(planes, 0, sizeof(planes));
+    v4l2_buf.m.planes = planes;
+    v4l2_buf.length = n_planes;
+
+    if (dqBuffer(v4l2_buf, &buffer, &shared_buffer, 1) < 0)
+    {
+        if (errno != EAGAIN)
+        {
+            is_in_error = 1;
+            callback(NULL, NULL, NULL, dqThread_data);
+            return false;
+        }
+        return streamon;
+    }
+    return callback(&v4l2_buf, buffer, shared_buffer, dqThread_data);
+}
+
+void
+NvV4l2ElementPlane::finishDQ()
+{
+    pthread_mutex_lock(&plane_lock);
+    dq_polled = false;
+    dqthread_running = false;
+    pthread_cond_broadcast(&plane_cond);
+    pthread_mutex_unlock(&plane_lock);
+}
+
+void
+NvV4l2ElementPlane::startDQThreadFallback()
+{
+    PLANE_WARN_MSG("Poll loop cannot poll the plane, starting a DQ Thread");
+    pthread_mutex_lock(&plane_lock);
+    dq_polled = false;
+    pthread_create(&dq_thread, NULL, dqThread, this);
+    pthread_mutex_unlock(&plane_lock);
+}
+
 int
 NvV4l2ElementPlane::stopDQThread()
 {
+    if (dq_polled)
+    {
+        poll_loop->remove(this);
+        finishDQ();
+        PLANE_DEBUG_MSG("Taken back from the poll loop");
+        return 0;
+    }
     if (blocking)
     {
         PLANE_WARN_MSG("Should not be called in blocking mode");
@@ -911,8 +995,11 @@ NvV4l2ElementPlane::waitForDQThread(uint32_t max_wait_ms)
 
     if (ret == 0)
     {
-        pthread_join(dq_thread, NULL);
-        dq_thread = 0;
+        if (dq_thread)
+        {
+            pthread_join(dq_thread, NULL);
+            dq_thread = 0;
+        }
         PLANE_DEBUG_MSG("Stopped DQ Thread");
     }
     else
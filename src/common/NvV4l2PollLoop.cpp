@@ -0,0 +1,250 @@
+/*
+ * NvV4l2PollLoop.cpp
+ *
+ * One thread poll()ing the fds of many V4L2 element planes and dispatching
+ * their dequeue callbacks, in place of a DQ Thread per plane.
+ */
+
+#include "NvV4l2PollLoop.h"
+#include "NvV4l2ElementPlane.h"
+#include "NvLogging.h"
+
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+
+#define CAT_NAME "PollLoop"
+
+#define POLL_TIMEOUT_MS 100      // longest the loop sleeps without a plane becoming ready
+#define POLL_ERROR_RETRY_MS 5    // a plane reporting POLLERR, streaming without queued buffers, is polled again after
+
+NvV4l2PollLoop::NvV4l2PollLoop(const char *name)
+        :thread(0),
+         stop(false),
+         is_in_error(0),
+         wakeups(0),
+         dispatched(0)
+{
+    strncpy(this->name, name, sizeof(this->name) - 1);
+    this->name[sizeof(this->name) - 1] = '\0';
+    pthread_mutex_init(&lock, NULL);
+    pthread_mutex_init(&dispatch_lock, NULL);
+
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd == -1)
+    {
+        CAT_SYS_ERROR_MSG("Could not create the wakeup eventfd");
+        is_in_error = 1;
+        return;
+    }
+    if (pthread_create(&thread, NULL, loopThread, this) != 0)
+    {
+        CAT_ERROR_MSG("Could not start the poll loop thread");
+        thread = 0;
+        is_in_error = 1;
+    }
+}
+
+NvV4l2PollLoop::~NvV4l2PollLoop()
+{
+    if (thread)
+    {
+        pthread_mutex_lock(&lock);
+        stop = true;
+        pthread_mutex_unlock(&lock);
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0)
+            CAT_SYS_ERROR_MSG("Could not wake the poll loop");
+        pthread_join(thread, NULL);
+    }
+    if (wake_fd != -1)
+        close(wake_fd);
+    pthread_mutex_destroy(&dispatch_lock);
+    pthread_mutex_destroy(&lock);
+}
+
+int
+NvV4l2PollLoop::add(NvV4l2ElementPlane *plane)
+{
+    if (is_in_error)
+        return -1;
+
+    pthread_mutex_lock(&lock);
+    if (!contains(plane))
+        planes.push_back(plane);
+    pthread_mutex_unlock(&lock);
+
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+        CAT_SYS_ERROR_MSG("Could not wake the poll loop");
+    return 0;
+}
+
+void
+NvV4l2PollLoop::remove(NvV4l2ElementPlane *plane)
+{
+    /* From a callback the loop is dispatching already, it skips removed planes */
+    bool dispatching = thread && pthread_equal(pthread_self(), thread);
+    if (!dispatching)
+        pthread_mutex_lock(&dispatch_lock);
+    pthread_mutex_lock(&lock);
+    std::vector<NvV4l2ElementPlane *>::iterator it =
+        std::find(planes.begin(), planes.end(), plane);
+    if (it != planes.end())
+        planes.erase(it);
+    pthread_mutex_unlock(&lock);
+    if (!dispatching)
+        pthread_mutex_unlock(&dispatch_lock);
+}
+
+int
+NvV4l2PollLoop::isInError()
+{
+    return is_in_error;
+}
+
+uint32_t
+NvV4l2PollLoop::getPlanes()
+{
+    pthread_mutex_lock(&lock);
+    uint32_t value = planes.size();
+    pthread_mutex_unlock(&lock);
+    return value;
+}
+
+uint64_t
+NvV4l2PollLoop::getWakeups()
+{
+    pthread_mutex_lock(&lock);
+    uint64_t value = wakeups;
+    pthread_mutex_unlock(&lock);
+    return value;
+}
+
+uint64_t
+NvV4l2PollLoop::getDispatched()
+{
+    pthread_mutex_lock(&lock);
+    uint64_t value = dispatched;
+    pthread_mutex_unlock(&lock);
+    return value;
+}
+
+void *
+NvV4l2PollLoop::loopThread(void *data)
+{
+    ((NvV4l2PollLoop *) data)->run();
+    return NULL;
+}
+
+/* Call with lock held */
+bool
+NvV4l2PollLoop::contains(NvV4l2ElementPlane *plane)
+{
+    return std::find(planes.begin(), planes.end(), plane) != planes.end();
+}
+
+void
+NvV4l2PollLoop::run()
+{
+    std::vector<NvV4l2ElementPlane *> polled;
+    std::vector<struct pollfd> fds;
+    std::vector<bool> errored;
+
+    prctl(PR_SET_NAME, name, 0, 0, 0);
+    CAT_DEBUG_MSG("Starting " << name);
+    while (true)
+    {
+        /* Poll the planes added so far, those without queued buffers sit out one short retry */
+        pthread_mutex_lock(&lock);
+        if (stop)
+        {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+        if (polled != planes)
+        {
+            polled = planes;
+            errored.assign(polled.size(), false);
+        }
+
+        fds.resize(polled.size() + 1);
+        fds[0].fd = wake_fd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        bool retry = false;
+        for (uint32_t i = 0; i < polled.size(); i++)
+        {
+            fds[i + 1].fd = errored[i] ? -1 : polled[i]->fd;
+            fds[i + 1].events =
+                polled[i]->buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ? POLLIN : POLLOUT;
+            fds[i + 1].revents = 0;
+            retry = retry || errored[i];
+            errored[i] = false;
+        }
+        pthread_mutex_unlock(&lock);
+
+        int ready = poll(fds.data(), fds.size(), retry ? POLL_ERROR_RETRY_MS : POLL_TIMEOUT_MS);
+        if (ready < 0)
+        {
+            if (errno != EINTR)
+                CAT_SYS_ERROR_MSG("poll failed");
+            continue;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            uint64_t count;
+            if (read(wake_fd, &count, sizeof(count)) < 0)
+                CAT_SYS_ERROR_MSG("Could not read the wakeup eventfd");
+        }
+
+        /* Dequeue one buffer from every ready plane, a removal waits until the batch is done */
+        uint64_t batch = 0;
+        pthread_mutex_lock(&dispatch_lock);
+        for (uint32_t i = 0; i < polled.size(); i++)
+        {
+            short revents = fds[i + 1].revents;
+            if (!revents)
+                continue;
+
+            pthread_mutex_lock(&lock);
+            bool present = contains(polled[i]);
+            pthread_mutex_unlock(&lock);
+            if (!present)
+                continue;
+
+            if (revents & POLLNVAL)
+            {
+                remove(polled[i]);
+                polled[i]->startDQThreadFallback();
+            }
+            else if (revents & fds[i + 1].events)
+            {
+                batch++;
+                if (!polled[i]->dispatchDQ())
+                {
+                    remove(polled[i]);
+                    polled[i]->finishDQ();
+                }
+            }
+            else if (revents & POLLERR)
+            {
+                errored[i] = true;
+            }
+        }
+        pthread_mutex_unlock(&dispatch_lock);
+
+        if (batch)
+        {
+            pthread_mutex_lock(&lock);
+            wakeups++;
+            dispatched += batch;
+            pthread_mutex_unlock(&lock);
+        }
+    }
+    CAT_DEBUG_MSG("Exiting " << name);
+}
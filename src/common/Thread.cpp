@@ -29,6 +29,9 @@
 #include "Thread.h"
 #include "Error.h"
 
+#include <errno.h>
+#include <time.h>
+
 namespace ArgusSamples
 {
 
@@ -38,11 +41,32 @@ Thread::Thread()
     , m_threadState(THREAD_INACTIVE)
 
 {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m_stateChanged, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&m_stateMutex, NULL);
 }
 
 Thread::~Thread()
 {
     (void)shutdown();
+    pthread_cond_destroy(&m_stateChanged);
+    pthread_mutex_destroy(&m_stateMutex);
+}
+
+/**
+ * Change the thread state and wake everyone waiting on it.
+ *
+ * @param [in] state    New state
+ */
+void Thread::setState(ThreadState state)
+{
+    pthread_mutex_lock(&m_stateMutex);
+    m_threadState = state;
+    pthread_cond_broadcast(&m_stateChanged);
+    pthread_mutex_unlock(&m_stateMutex);
 }
 
 bool Thread::initialize()
@@ -54,8 +78,10 @@ bool Thread::initialize()
         ORIGINATE_ERROR("Failed to create thread.");
 
     // wait for the thread to start up
+    pthread_mutex_lock(&m_stateMutex);
     while (m_threadState == THREAD_INACTIVE)
-        usleep(100);
+        pthread_cond_wait(&m_stateChanged, &m_stateMutex);
+    pthread_mutex_unlock(&m_stateMutex);
 
     return true;
 
@@ -70,7 +96,7 @@ bool Thread::shutdown()
             ORIGINATE_ERROR("Failed to join thread");
         m_threadID = 0;
         m_doShutdown = false;
-        m_threadState = THREAD_INACTIVE;
+        setState(THREAD_INACTIVE);
     }
 
    return true;
@@ -82,21 +108,32 @@ bool Thread::waitRunning(useconds_t timeoutUs)
     if ((m_threadState != THREAD_INITIALIZING) && (m_threadState != THREAD_RUNNING))
         ORIGINATE_ERROR("Invalid thread state %d", m_threadState.get());
 
-    // wait for the thread to run
-    const useconds_t sleepTimeUs = 100;
-    while (m_threadState != THREAD_RUNNING)
+    // wait for the thread to run, a failed or finished one never will
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeoutUs / 1000000;
+    deadline.tv_nsec += (long)(timeoutUs % 1000000) * 1000;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&m_stateMutex);
+    while (m_threadState == THREAD_INITIALIZING)
     {
-        usleep(sleepTimeUs);
 #ifdef DEBUG
         // in debug mode wait indefinitely
+        pthread_cond_wait(&m_stateChanged, &m_stateMutex);
 #else
-        if (timeoutUs < sleepTimeUs)
-            return false;
-        timeoutUs -= sleepTimeUs;
+        if (pthread_cond_timedwait(&m_stateChanged, &m_stateMutex, &deadline) == ETIMEDOUT)
+            break;
 #endif
     }
+    bool running = (m_threadState == THREAD_RUNNING);
+    pthread_mutex_unlock(&m_stateMutex);
 
-    return true;
+    return running;
 }
 
 /**
@@ -109,9 +146,9 @@ bool Thread::waitRunning(useconds_t timeoutUs)
     Thread *thread = static_cast<Thread*>(dataPtr);
 
     if (!thread->threadFunction())
-        thread->m_threadState = Thread::THREAD_FAILED;
+        thread->setState(Thread::THREAD_FAILED);
     else
-        thread->m_threadState = Thread::THREAD_DONE;
+        thread->setState(Thread::THREAD_DONE);
 
     return NULL;
 }
@@ -121,11 +158,11 @@ bool Thread::waitRunning(useconds_t timeoutUs)
  */
 bool Thread::threadFunction()
 {
-    m_threadState = THREAD_INITIALIZING;
+    setState(THREAD_INITIALIZING);
 
     PROPAGATE_ERROR(threadInitialize());
 
-    m_threadState = THREAD_RUNNING;
+    setState(THREAD_RUNNING);
 
     while (!m_doShutdown)
     {
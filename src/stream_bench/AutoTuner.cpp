@@ -0,0 +1,525 @@
+/*
+ * AutoTuner.cpp
+ *
+ * Searches the pipeline settings one at a time for the highest frame rate
+ * recorded without drops, running every trial as a child StreamBench or
+ * StreamCapture and reading its results back from the files it leaves.
+ */
+
+#include "AutoTuner.hpp"
+
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "VolumeSet.hpp"
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+#define STDOUT_PRINT true
+#define LOG_MODE 0644
+#define TREE_FDS 16         // directories nftw keeps open while removing a run
+
+AutoTuner::AutoTuner(const TuneSettings& settings, Logger *logger, const std::atomic<bool> *doRun) :
+    _settings(settings),
+    _logger(logger),
+    _doRun(doRun),
+    _bestFps(0),
+    _maxFps(TUNE_MAX_FPS),
+    _jpeg(false),
+    _trials(NULL),
+    _log(-1),
+    _trial(0),
+    _stamp(time(NULL)) {
+    size_t slash = _settings.config.rfind('/');
+    _directory = slash == std::string::npos ? "." : _settings.config.substr(0, slash);
+}
+
+AutoTuner::~AutoTuner() {
+    if (_trials)
+        fclose(_trials);
+    if (_log >= 0)
+        close(_log);
+}
+
+const std::string& AutoTuner::getError() const {
+    return _error;
+}
+
+/* The options of a choice as they appear on the command line */
+std::string AutoTuner::describe(const AutoTuner::Choice& choice) {
+    if (choice.empty())
+        return "defaults";
+    std::stringstream ss;
+    for (size_t i = 0; i < choice.size(); i++) {
+        ss << (i ? " " : "") << "--" << choice[i].first;
+        if (!choice[i].second.empty())
+            ss << " " << choice[i].second;
+    }
+    return ss.str();
+}
+
+/* An argv over the strings, which must outlive it */
+std::vector<char*> AutoTuner::toArgv(std::vector<std::string>& args) {
+    std::vector<char*> argv;
+    for (size_t i = 0; i < args.size(); i++)
+        argv.push_back(&args[i][0]);
+    argv.push_back(NULL);
+    return argv;
+}
+
+/* The written fps and the drops from the PerfResults of a bench run, one metric per line */
+bool AutoTuner::readMetrics(const std::string& filename, double& writeFps, uint64_t& dropped) {
+    std::ifstream file(filename);
+    if (!file.is_open())
+        return false;
+    bool fps = false, drops = false;
+    std::string line;
+    while (std::getline(file, line)) {
+        char name[128];
+        double value;
+        if (sscanf(line.c_str(), " \"%127[^\"]\": %lf", name, &value) != 2)
+            continue;
+        if (strcmp(name, "write.fps") == 0) {
+            writeFps = value;
+            fps = true;
+        } else if (strcmp(name, "pipeline.dropped") == 0) {
+            dropped = (uint64_t) value;
+            drops = true;
+        }
+    }
+    return fps && drops;
+}
+
+/* Every camera's fps and drops from the final status.json of a StreamCapture run */
+bool AutoTuner::readStatus(const std::string& filename, double& fps, uint64_t& dropped, uint32_t& cameras) {
+    std::ifstream file(filename);
+    if (!file.is_open())
+        return false;
+    std::stringstream ss;
+    ss << file.rdbuf();
+    std::string status = ss.str();
+    size_t pos = status.find("\"cameras\": [");
+    if (pos == std::string::npos)
+        return false;
+    fps = 0;
+    dropped = 0;
+    cameras = 0;
+    /* Each camera's own fps comes before its other members, image_bytes has one of its own */
+    while ((pos = status.find("{\"id\": ", pos)) != std::string::npos) {
+        size_t rate = status.find("\"fps\": ", pos);
+        size_t drops = status.find("\"frames_dropped\": ", pos);
+        if (rate == std::string::npos || drops == std::string::npos)
+            return false;
+        fps += atof(status.c_str() + rate + strlen("\"fps\": "));
+        dropped += strtoull(status.c_str() + drops + strlen("\"frames_dropped\": "), NULL, 10);
+        cameras++;
+        pos = drops;
+    }
+    return cameras > 0;
+}
+
+static int removeEntry(const char *path, const struct stat *sb, int flag, struct FTW *ftwbuf) {
+    return remove(path);
+}
+
+/* Remove a trial's run directory and everything in it */
+bool AutoTuner::removeTree(const std::string& path) {
+    if (access(path.c_str(), F_OK) != 0)
+        return true;
+    return nftw(path.c_str(), removeEntry, TREE_FDS, FTW_DEPTH | FTW_PHYS) == 0;
+}
+
+/* The settings searched, in order; the TX2's cores 1 and 2 are Denver, 0, 3, 4 and 5 A57 */
+void AutoTuner::addSettings(bool jpeg) {
+    Setting ring = {"dmabuf-ring", {{{"dmabuf-ring", "3"}}, {{"dmabuf-ring", "4"}}, {{"dmabuf-ring", "6"}}}};
+    Setting queue = {"write-queue", {{{"write-queue", "8"}}, {{"write-queue", "16"}}}};
+    Setting fifo = {"egl-fifo", {{{"egl-fifo", "2"}}, {{"egl-fifo", "4"}}}};
+    Setting encoders = {"encoders", {{{"encoders", "1"}}, {{"encoders", "3"}}, {{"encoders", "4"}}}};
+    Setting policy = {"encode-policy", {{{"encode-policy", "oldest"}}, {{"encode-policy", "steal"}}}};
+    Setting pinning = {"consumer-cpus", {{{"consumer-cpus", "0,3,4,5"}, {"writer-cpus", "1,2"}},
+                                         {{"consumer-cpus", "1,2"}, {"writer-cpus", "0,3,4,5"}}}};
+    Setting io = {"direct-io", {{{"direct-io", ""}}, {{"direct-io", ""}, {"aio", "16"}}}};
+
+    std::vector<Setting> all;
+    all.push_back(ring);
+    all.push_back(queue);
+    if (_settings.live)
+        all.push_back(fifo);
+    if (jpeg) {
+        all.push_back(encoders);
+        all.push_back(policy);
+    }
+    all.push_back(pinning);
+    all.push_back(io);
+    for (size_t i = 0; i < all.size(); i++) {
+        bool fixed = false;
+        for (size_t j = 0; j < all[i].values.size(); j++)
+            for (size_t k = 0; k < all[i].values[j].size(); k++)
+                fixed = fixed || isFixed(all[i].values[j][k].first);
+        if (fixed)
+            _logger->log("Keeping --" + all[i].name + " as given", STDOUT_PRINT);
+        else
+            _searched.push_back(all[i]);
+    }
+}
+
+/* Whether the capture options after "--" set this option, which the search then leaves alone */
+bool AutoTuner::isFixed(const std::string& name) const {
+    std::string option = "--" + name;
+    for (size_t i = 0; i < _settings.fixedArgs.size(); i++) {
+        const std::string& arg = _settings.fixedArgs[i];
+        if (arg == option || arg.compare(0, option.size() + 1, option + "=") == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Whether StreamCapture accepts the fixed options with this choice, without running anything */
+bool AutoTuner::isValid(const AutoTuner::Choice& choice, double fps) {
+    std::vector<std::string> args(1, "AutoTuner");
+    args.insert(args.end(), _settings.fixedArgs.begin(), _settings.fixedArgs.end());
+    for (size_t i = 0; i < choice.size(); i++) {
+        args.push_back("--" + choice[i].first);
+        if (!choice[i].second.empty())
+            args.push_back(choice[i].second);
+    }
+    if (_settings.live) {
+        std::stringstream ss;
+        ss << fps;
+        args.push_back("--frame-rate");
+        args.push_back(ss.str());
+    }
+    std::vector<char*> argv = toArgv(args);
+    optind = 1;
+    Options probe;
+    return probe.parse(argv.size() - 1, argv.data());
+}
+
+/* Run the options of the choice at fps for the trial time in a child, return bool indicating it ran to the end */
+bool AutoTuner::runTrial(const AutoTuner::Choice& choice, double fps, AutoTuner::Trial& trial) {
+    trial.valid = false;
+    trial.sustained = false;
+    trial.savedFps = 0;
+    trial.dropped = 0;
+    _trial++;
+
+    std::stringstream rate, seconds, name;
+    rate << fps;
+    seconds << _settings.trialTime;
+    name << "autotune-" << _stamp << "-" << _trial;
+    std::string json = _directory + "/autotune.json";
+
+    /* The bench options and the fixed, candidate and trial options after them, later ones win */
+    std::vector<std::string> capture(_settings.fixedArgs);
+    for (size_t i = 0; i < choice.size(); i++) {
+        capture.push_back("--" + choice[i].first);
+        if (!choice[i].second.empty())
+            capture.push_back(choice[i].second);
+    }
+    if (_settings.live) {
+        capture.push_back("--frame-rate");
+        capture.push_back(rate.str());
+    }
+    capture.push_back("-t");
+    capture.push_back(seconds.str());
+    capture.push_back("-r");
+    capture.push_back(name.str());
+
+    /* Check the options and find where the child will write, as it will */
+    std::vector<std::string> probeArgs(1, _exe);
+    probeArgs.insert(probeArgs.end(), capture.begin(), capture.end());
+    std::vector<char*> probeArgv = toArgv(probeArgs);
+    optind = 1;
+    Options probe;
+    if (!probe.parse(probeArgv.size() - 1, probeArgv.data()))
+        return true;
+    std::vector<std::string> volumes(probe.volumes);
+    if (volumes.empty()) {
+        std::string volume = VolumeSet::findMostFreeVolume();
+        volumes.push_back(volume.size() ? volume : ".");
+    }
+    _outputs.clear();
+    for (size_t i = 0; i < volumes.size(); i++)
+        _outputs.push_back(VolumeSet::join(volumes[i], probe.directory));
+
+    std::vector<std::string> args(1, _exe);
+    if (!_settings.live) {
+        args.insert(args.end(), _settings.benchArgs.begin(), _settings.benchArgs.end());
+        args.push_back("--fps");
+        args.push_back(rate.str());
+        args.push_back("--json");
+        args.push_back(json);
+        args.push_back("--");
+    }
+    args.insert(args.end(), capture.begin(), capture.end());
+    std::vector<char*> argv = toArgv(args);
+    unlink(json.c_str());
+
+    /* Run it with its output in autotune.log, stop it when it overruns */
+    pid_t pid = fork();
+    if (pid < 0) {
+        _error = std::string("Failed to start a trial: ") + strerror(errno);
+        return false;
+    }
+    if (pid == 0) {
+        dup2(_log, STDOUT_FILENO);
+        dup2(_log, STDERR_FILENO);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto stop = start + std::chrono::seconds(_settings.trialTime + TUNE_GRACE_S);
+    auto abandon = stop + std::chrono::seconds(TUNE_KILL_S);
+    bool interrupted = false, stopped = false, killed = false;
+    int status = 0;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        auto now = std::chrono::steady_clock::now();
+        if (!stopped && (now >= stop || !*_doRun)) {
+            kill(pid, SIGINT);
+            stopped = true;
+            interrupted = !*_doRun;
+        } else if (!killed && now >= abandon) {
+            kill(pid, SIGKILL);
+            killed = true;
+        }
+        usleep(TUNE_POLL_MS * 1000);
+    }
+    if (interrupted)
+        return false;
+
+    /* Read what it achieved and remove what it wrote */
+    bool clean = WIFEXITED(status) && WEXITSTATUS(status) == 0 && !stopped;
+    if (clean && !_settings.live) {
+        double writeFps = 0;
+        trial.valid = readMetrics(json, writeFps, trial.dropped);
+        trial.savedFps = writeFps / _settings.numCameras;
+        trial.sustained = trial.valid && trial.dropped == 0 && trial.savedFps >= TUNE_MARGIN * fps;
+    } else if (clean) {
+        double total = 0;
+        uint32_t cameras = 0;
+        trial.valid = readStatus(_outputs[0] + "/status.json", total, trial.dropped, cameras);
+        trial.savedFps = cameras ? total / cameras : 0;
+        double offered = 0;
+        for (uint32_t i = 0; i < cameras; i++)
+            offered += fps / probe.getSaveEvery(i) / cameras;
+        trial.sustained = trial.valid && trial.dropped == 0 && trial.savedFps >= TUNE_MARGIN * offered;
+    }
+    unlink(json.c_str());
+    for (size_t i = 0; i < _outputs.size(); i++) {
+        if (!removeTree(_outputs[i]))
+            _logger->log("Failed to remove " + _outputs[i] + "!", STDOUT_PRINT);
+    }
+
+    fprintf(_trials, "%u,%.2f,%.2f,%lu,%d,%s\n", _trial, fps, trial.savedFps, trial.dropped, trial.sustained ? 1 : 0,
+            describe(choice).c_str());
+    fflush(_trials);
+    std::stringstream ss;
+    ss << "Trial " << _trial << ": " << describe(choice) << " at " << fps << " fps: ";
+    if (!clean)
+        ss << (stopped ? "overran, stopped" : "failed, see autotune.log");
+    else if (!trial.valid)
+        ss << "no results";
+    else
+        ss << trial.savedFps << " fps saved, " << trial.dropped << " dropped"
+           << (trial.sustained ? ", sustained" : "");
+    _logger->log(ss.str(), STDOUT_PRINT);
+    return true;
+}
+
+/* Whether the choice records fps per camera without drops, false as well once interrupted */
+bool AutoTuner::sustains(const AutoTuner::Choice& choice, double fps) {
+    Trial trial;
+    if (!runTrial(choice, fps, trial))
+        return false;
+    return trial.sustained;
+}
+
+/* The highest rate the choice sustains, given one it does and one it does not, 0 if unknown */
+double AutoTuner::climb(const AutoTuner::Choice& choice, double pass, double fail) {
+    while (fail == 0 && pass < _maxFps && *_doRun) {
+        double next = std::min(pass * 2, _maxFps);
+        if (sustains(choice, next))
+            pass = next;
+        else
+            fail = next;
+    }
+    for (int i = 0; i < TUNE_BISECT_STEPS && fail > 0 && *_doRun; i++) {
+        double middle = (pass + fail) / 2;
+        if (sustains(choice, middle))
+            pass = middle;
+        else
+            fail = middle;
+    }
+    return pass;
+}
+
+/* Search for the best settings and write them, return bool indicating success */
+bool AutoTuner::run() {
+
+    bool errorOccurred = false;
+
+    /* Trials run this binary or, live, the StreamCapture built next to it */
+    char exe[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (length <= 0) {
+        _error = "Failed to find the StreamBench executable";
+        return false;
+    }
+    exe[length] = '\0';
+    _exe = exe;
+    if (_settings.live) {
+        _exe = _exe.substr(0, _exe.rfind('/') + 1) + "StreamCapture";
+        if (access(_exe.c_str(), X_OK) != 0) {
+            _error = "No StreamCapture next to StreamBench for the live trials";
+            return false;
+        }
+    }
+
+    /* The fixed options must parse on their own */
+    std::vector<std::string> args(1, _exe);
+    args.insert(args.end(), _settings.fixedArgs.begin(), _settings.fixedArgs.end());
+    std::vector<char*> argv = toArgv(args);
+    optind = 1;
+    Options options;
+    if (!options.parse(argv.size() - 1, argv.data())) {
+        _error = "Invalid capture options";
+        return false;
+    }
+    _jpeg = options.format == FORMAT_JPEG;
+    addSettings(_jpeg);
+    if (_settings.live)
+        _maxFps = std::min(_maxFps, (double) options.getModeFrameRate());
+
+    /* Open the trial log and the children's output */
+    std::string filename = _directory + "/autotune.csv";
+    _trials = fopen(filename.c_str(), "w");
+    if (!_trials || fprintf(_trials, "trial,fps,saved_fps,dropped,sustained,settings\n") < 0) {
+        _error = "Failed to create " + filename;
+        return false;
+    }
+    filename = _directory + "/autotune.log";
+    _log = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, LOG_MODE);
+    if (_log < 0) {
+        _error = "Failed to create " + filename;
+        return false;
+    }
+
+    /* Measure the defaults, halving the rate until they sustain it, then raising it */
+    Choice defaults;
+    double fps = std::min(_settings.fps, _maxFps), fail = 0;
+    while (*_doRun && fps >= 1 && !sustains(defaults, fps)) {
+        fail = fps;
+        fps /= 2;
+    }
+    if (!*_doRun) {
+        _error = "Interrupted before the defaults were measured";
+        return false;
+    }
+    if (fps < 1) {
+        _error = "The defaults drop frames even at 1 fps, see autotune.log";
+        return false;
+    }
+    _bestFps = climb(defaults, fps, fail);
+    std::stringstream ss;
+    ss << "The defaults sustain " << _bestFps << " fps per camera";
+    _logger->log(ss.str(), STDOUT_PRINT);
+
+    /* Try every value of every setting on top of the best so far */
+    for (size_t i = 0; i < _searched.size() && *_doRun; i++) {
+        Choice kept = _best;
+        for (size_t j = 0; j < _searched[i].values.size() && *_doRun; j++) {
+            Choice candidate = kept;
+            candidate.insert(candidate.end(), _searched[i].values[j].begin(), _searched[i].values[j].end());
+            double target = std::min(_bestFps * TUNE_STEP, _maxFps);
+            if (!isValid(candidate, target)) {
+                _logger->log("Skipping " + describe(_searched[i].values[j]) + ", not valid with the capture options",
+                             STDOUT_PRINT);
+                continue;
+            }
+            if (target <= _bestFps || !sustains(candidate, target))
+                continue;
+            _best = candidate;
+            _bestFps = climb(candidate, target, 0);
+            std::stringstream ss;
+            ss << "Keeping " << describe(_searched[i].values[j]) << ", " << _bestFps << " fps per camera";
+            _logger->log(ss.str(), STDOUT_PRINT);
+        }
+    }
+
+    /* Spend what is left on image quality, as long as the best rate holds */
+    static const char *qualities[] = {"85", "90", "95"};
+    for (size_t i = 0; _jpeg && !isFixed("quality") && i < sizeof(qualities) / sizeof(qualities[0]) && *_doRun; i++) {
+        Choice candidate = _best;
+        candidate.push_back(std::make_pair(std::string("quality"), std::string(qualities[i])));
+        if (!sustains(candidate, _bestFps))
+            break;
+        _best = candidate;
+        _logger->log(std::string("Keeping --quality ") + qualities[i], STDOUT_PRINT);
+    }
+
+    if (!*_doRun)
+        _logger->log("Interrupted, writing the best settings found so far", STDOUT_PRINT);
+    if (!writeConfig()) {
+        _error = "Failed to write " + _settings.config;
+        errorOccurred = true;
+    }
+    return !errorOccurred;
+}
+
+/* Write the fixed options and the winning choice as a config file, one long option per line */
+bool AutoTuner::writeConfig() {
+    FILE *file = fopen(_settings.config.c_str(), "w");
+    if (!file)
+        return false;
+    time_t now = time(NULL);
+    char date[64];
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    fprintf(file, "# Written by StreamBench --autotune on %s, %u trials of %d s\n", date, _trial, _settings.trialTime);
+    if (_settings.live)
+        fprintf(file, "# Live cameras: %.2f fps per camera sustained without drops\n", _bestFps);
+    else
+        fprintf(file, "# %s: %.2f fps per camera sustained without drops\n", _settings.workload.c_str(), _bestFps);
+
+    /* The capture options the trials ran with, those getopt sees as long options with their values */
+    const std::vector<std::string>& fixed = _settings.fixedArgs;
+    for (size_t i = 0; i < fixed.size(); i++) {
+        bool option = fixed[i].compare(0, 2, "--") == 0 && fixed[i].size() > 2;
+        std::string line = option ? fixed[i].substr(2) : fixed[i];
+        size_t equals = line.find('=');
+        if (option && equals != std::string::npos)
+            line[equals] = ' ';
+        else if (i + 1 < fixed.size() && !fixed[i + 1].empty() && fixed[i + 1][0] != '-')
+            line += " " + fixed[++i];
+        if (option)
+            fprintf(file, "%s\n", line.c_str());
+        else
+            fprintf(file, "# Not a long option, pass it on the command line: %s\n", line.c_str());
+    }
+    for (size_t i = 0; i < _best.size(); i++) {
+        fprintf(file, "%s", _best[i].first.c_str());
+        if (!_best[i].second.empty())
+            fprintf(file, " %s", _best[i].second.c_str());
+        fprintf(file, "\n");
+    }
+    if (_settings.live)
+        fprintf(file, "frame-rate %g\n", _bestFps);
+
+    bool errorOccurred = ferror(file) != 0;
+    errorOccurred = fclose(file) != 0 || errorOccurred;
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "Best: " << describe(_best) << " at " << _bestFps << " fps per camera, written to " << _settings.config;
+        _logger->log(ss.str(), STDOUT_PRINT);
+    }
+    return !errorOccurred;
+}
@@ -0,0 +1,377 @@
+/*
+ * ReplayFeed.cpp
+ *
+ * One camera of a recorded run, read back in recorded order from read-only
+ * mappings. JPEG images are decoded on the hardware decoder and raw records
+ * copied into a staging buffer, either is blitted on the VIC into the ring
+ * slot the source submits, scaled if the run was recorded at another size.
+ */
+
+#include "ReplayFeed.hpp"
+
+#include "ContainerReader.hpp"
+#include "MetadataLog.hpp"
+#include "RawWriter.hpp"
+#include "RunLayout.hpp"
+#include "NvJpegDecoder.h"
+#include <nvbuf_utils.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+/* Map a whole file read-only, NULL if it cannot be read or is empty */
+static const unsigned char *mapFile(const std::string& path, uint64_t& size) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) != 0 || info.st_size == 0) {
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    madvise(map, info.st_size, MADV_SEQUENTIAL);
+    size = info.st_size;
+    return (const unsigned char *) map;
+}
+
+ReplayFeed::ReplayFeed(const std::vector<std::string>& runs, uint32_t camera, uint64_t frameDuration) :
+    _runs(runs),
+    _camera(camera),
+    _frameDuration(frameDuration),
+    _next(0),
+    _decoder(NULL),
+    _skipped(0)
+{}
+
+ReplayFeed::~ReplayFeed() {
+    for (uint32_t i = 0; i < _sources.size(); i++) {
+        if (_sources[i].container)
+            delete _sources[i].container;
+        if (_sources[i].map)
+            munmap((void *) _sources[i].map, _sources[i].size);
+        if (_sources[i].staging != -1)
+            NvBufferDestroy(_sources[i].staging);
+    }
+    if (_decoder)
+        delete _decoder;
+}
+
+/* Highest camN found in the runs and their segments, plus one */
+uint32_t ReplayFeed::countCameras(const std::vector<std::string>& runs) {
+    uint32_t cameras = 0;
+    std::vector<std::string> directories = findSegments(runs);
+    for (uint32_t i = 0; i < directories.size(); i++) {
+        std::vector<std::string> names = listDirectory(directories[i]);
+        for (uint32_t j = 0; j < names.size(); j++)
+            if (matchName(names[j].c_str(), "cam", ""))
+                cameras = std::max(cameras, (uint32_t) atoi(names[j].c_str() + 3) + 1);
+    }
+    return cameras;
+}
+
+/* Index every frame of the camera, return bool indicating the camera has any */
+bool ReplayFeed::open() {
+    std::vector<std::string> directories = findSegments(_runs);
+    for (uint32_t i = 0; i < directories.size(); i++) {
+        std::string directory = directories[i] + "/cam" + std::to_string(_camera);
+        struct stat info;
+        if (stat(directory.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+            addDirectory(directory);
+    }
+    if (_entries.empty()) {
+        if (_error.empty())
+            _error = "No recorded frames of cam" + std::to_string(_camera);
+        return false;
+    }
+
+    /* Images are decoded whenever the camera has any that are not raw */
+    for (uint32_t i = 0; i < _sources.size() && !_decoder; i++) {
+        if (_sources[i].kind != REPLAY_RAW) {
+            std::string name = "replaydec" + std::to_string(_camera);
+            _decoder = NvJPEGDecoder::createJPEGDecoder(name.c_str());
+            if (!_decoder) {
+                _error = "Failed to create the JPEG decoder";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Add the frames of one camN directory and its --fanout sub-directories: container segments and
+   images in index order, or the raw container */
+void ReplayFeed::addDirectory(const std::string& directory) {
+    readMetadata(directory);
+
+    /* A raw run holds nothing else */
+    std::string rawPath = directory + "/frames.raw";
+    struct stat info;
+    if (stat(rawPath.c_str(), &info) == 0) {
+        Source source = {rawPath, REPLAY_RAW, NULL, NULL, 0, -1, 0, {0}, {0}, {0}};
+        if (openRaw(source, directory + "/frames.idx")) {
+            _sources.push_back(source);
+        } else {
+            if (source.map)
+                munmap((void *) source.map, source.size);
+            _skipped++;
+        }
+        return;
+    }
+
+    std::vector<std::string> directories = findCameraDirectories(directory);
+    std::vector<Entry> images;
+    for (uint32_t i = 0; i < directories.size(); i++) {
+        std::vector<std::string> names = listDirectory(directories[i]);
+        for (uint32_t j = 0; j < names.size(); j++) {
+            const char *name = names[j].c_str();
+            std::string path = directories[i] + "/" + names[j];
+            if (matchName(name, "frames", ".mjpg")) {
+                Source source = {path, REPLAY_CONTAINER, new ContainerReader, NULL, 0, -1, 0, {0}, {0}, {0}};
+                if (!source.container->open(path)) {
+                    delete source.container;
+                    _skipped++;
+                    continue;
+                }
+                uint32_t id = _sources.size();
+                _sources.push_back(source);
+                const ContainerIndexEntry *entries = source.container->getEntries();
+                for (size_t k = 0; k < source.container->getCount(); k++) {
+                    Entry entry = {id, k, entries[k].index, entries[k].timestamp};
+                    _entries.push_back(entry);
+                }
+            } else if (matchName(name, "image", ".jpg")) {
+                Entry entry = {(uint32_t) _sources.size(), 0, strtoull(name + 5, NULL, 10), 0};
+                Source source = {path, REPLAY_IMAGE, NULL, NULL, 0, -1, 0, {0}, {0}, {0}};
+                _sources.push_back(source);
+                images.push_back(entry);
+            }
+        }
+    }
+
+    /* Indexes may outgrow the six digits of the name, so sort by number rather than by name, and take
+       each image's time from the metadata or, without any, from its index */
+    std::sort(images.begin(), images.end(), [](const Entry& a, const Entry& b) { return a.index < b.index; });
+    for (uint32_t i = 0; i < images.size(); i++) {
+        std::vector<std::pair<uint64_t, uint64_t> >::const_iterator time = std::lower_bound(_times.begin(),
+            _times.end(), std::make_pair(images[i].index, (uint64_t) 0));
+        images[i].timestamp = time != _times.end() && time->first == images[i].index
+                              ? time->second : images[i].index * _frameDuration;
+        _entries.push_back(images[i]);
+    }
+}
+
+/* Map a raw container, index its records and create the buffer they are staged in */
+bool ReplayFeed::openRaw(Source& source, const std::string& indexPath) {
+    source.map = mapFile(source.path, source.size);
+    if (!source.map || source.size < RAW_HEADER_SIZE) {
+        _error = "Failed to map " + source.path;
+        return false;
+    }
+    RawContainerHeader header;
+    memcpy(&header, source.map, sizeof(header));
+    if (memcmp(header.magic, RAW_MAGIC, sizeof(header.magic)) != 0 || header.numPlanes == 0
+        || header.numPlanes > RAW_MAX_PLANES || header.recordSize == 0) {
+        _error = source.path + " is not a raw container";
+        return false;
+    }
+    if (header.packedBits != 0) {
+        _error = source.path + " holds Bayer records, only YUV ones are replayed";
+        return false;
+    }
+    source.numPlanes = header.numPlanes;
+    memcpy(source.width, header.width, sizeof(source.width));
+    memcpy(source.height, header.height, sizeof(source.height));
+    memcpy(source.pitch, header.pitch, sizeof(source.pitch));
+
+    NvBufferCreateParams params;
+    memset(&params, 0, sizeof(params));
+    params.width = header.width[0];
+    params.height = header.height[0];
+    params.payloadType = NvBufferPayload_SurfArray;
+    params.layout = NvBufferLayout_Pitch;
+    params.colorFormat = (NvBufferColorFormat) header.colorFormat;
+    params.nvbuf_tag = NvBufferTag_NONE;
+    if (NvBufferCreateEx(&source.staging, &params) != 0) {
+        source.staging = -1;
+        _error = "Failed to create the raw staging buffer";
+        return false;
+    }
+
+    /* Records the index lists but the data file does not hold are left out */
+    uint64_t indexSize;
+    const unsigned char *index = mapFile(indexPath, indexSize);
+    if (!index) {
+        _error = "Failed to map " + indexPath;
+        return false;
+    }
+    const RawIndexEntry *records = (const RawIndexEntry *) index;
+    uint32_t id = _sources.size();
+    for (uint64_t i = 0; i < indexSize / sizeof(RawIndexEntry); i++) {
+        uint64_t offset = RAW_HEADER_SIZE + records[i].record * header.recordSize;
+        if (offset + header.recordSize > source.size) {
+            _skipped++;
+            continue;
+        }
+        Entry entry = {id, offset, records[i].index, records[i].timestamp};
+        _entries.push_back(entry);
+    }
+    munmap((void *) index, indexSize);
+    return true;
+}
+
+/* Add the sensor timestamps of the directory's metadata.bin by image index, if there is one */
+void ReplayFeed::readMetadata(const std::string& directory) {
+    uint64_t size;
+    const unsigned char *map = mapFile(directory + "/metadata.bin", size);
+    if (!map)
+        return;
+    const MetadataHeader *header = (const MetadataHeader *) map;
+    if (size >= sizeof(MetadataHeader) && memcmp(header->magic, METADATA_MAGIC, sizeof(header->magic)) == 0
+        && header->recordSize >= sizeof(MetadataRecord)) {
+        uint64_t count = std::min(header->count, (size - sizeof(MetadataHeader)) / header->recordSize);
+        for (uint64_t i = 0; i < count; i++) {
+            const MetadataRecord *record = (const MetadataRecord *) (map + sizeof(MetadataHeader) + i * header->recordSize);
+            _times.push_back(std::make_pair(record->index, record->sensorTimestamp));
+        }
+        std::sort(_times.begin(), _times.end());
+    }
+    munmap((void *) map, size);
+}
+
+/* Frames recorded for the camera */
+uint64_t ReplayFeed::getCount() const {
+    return _entries.size();
+}
+
+/* Recorded time of the first frame, the sources of a run are paced from the earliest one */
+uint64_t ReplayFeed::getFirstTimestamp() const {
+    return _entries.empty() ? 0 : _entries[0].timestamp;
+}
+
+/* Frames and files that could not be read, mapped or decoded */
+uint64_t ReplayFeed::getFramesSkipped() const {
+    return _skipped;
+}
+
+const std::string& ReplayFeed::getError() const {
+    return _error;
+}
+
+/* Recorded time of the next frame, false once every frame was read */
+bool ReplayFeed::peek(uint64_t& timestamp) const {
+    if (_next >= _entries.size())
+        return false;
+    timestamp = _entries[_next].timestamp;
+    return true;
+}
+
+/* Pass over the next frame, dropped on a full ring as a capture would be */
+void ReplayFeed::skip() {
+    if (_next < _entries.size())
+        _next++;
+}
+
+/* Frame size of the recording, from the raw header or by decoding the first image */
+bool ReplayFeed::getSize(uint32_t& width, uint32_t& height) {
+    if (_entries.empty())
+        return false;
+    const Entry& entry = _entries[0];
+    const Source& source = _sources[entry.source];
+    if (source.kind == REPLAY_RAW) {
+        width = source.width[0];
+        height = source.height[0];
+        return true;
+    }
+    uint64_t size = 0;
+    uint32_t imageSize = 0;
+    const unsigned char *data = source.kind == REPLAY_CONTAINER
+                                ? source.container->getImage(entry.position, imageSize) : mapFile(source.path, size);
+    if (!data)
+        return false;
+    int decoded;
+    bool success = decode(data, source.kind == REPLAY_CONTAINER ? imageSize : size, decoded, width, height);
+    if (source.kind == REPLAY_IMAGE)
+        munmap((void *) data, size);
+    return success;
+}
+
+/* Decode one JPEG image into the decoder's own buffer, reused by the next decode */
+bool ReplayFeed::decode(const unsigned char *data, uint64_t size, int& decoded, uint32_t& width, uint32_t& height) {
+    uint32_t format;
+    return _decoder->decodeToFd(decoded, (unsigned char *) data, size, format, width, height) == 0;
+}
+
+/* Copy a raw record plane by plane into the source's staging buffer */
+bool ReplayFeed::copyRecord(const Source& source, uint64_t offset) {
+    NvBufferParams params;
+    if (NvBufferGetParams(source.staging, &params) != 0)
+        return false;
+    const unsigned char *record = source.map + offset;
+    for (uint32_t plane = 0; plane < source.numPlanes && plane < params.num_planes; plane++) {
+        void *mapping = NULL;
+        if (NvBufferMemMap(source.staging, plane, NvBufferMem_Write, &mapping) != 0)
+            return false;
+        uint32_t rows = std::min(source.height[plane], params.height[plane]);
+        uint32_t bytes = std::min(source.pitch[plane], params.pitch[plane]);
+        for (uint32_t y = 0; y < rows; y++)
+            memcpy((unsigned char *) mapping + y * params.pitch[plane], record + y * source.pitch[plane], bytes);
+        NvBufferMemSyncForDevice(source.staging, plane, &mapping);
+        NvBufferMemUnMap(source.staging, plane, &mapping);
+        record += (uint64_t) source.pitch[plane] * source.height[plane];
+    }
+    return true;
+}
+
+/* Read the next frame into the buffer fd with its recorded index and time, false once every frame was
+   read. Frames that cannot be read or decoded are skipped and counted */
+bool ReplayFeed::next(int fd, uint64_t& index, uint64_t& timestamp) {
+    while (_next < _entries.size()) {
+        const Entry& entry = _entries[_next++];
+        const Source& source = _sources[entry.source];
+
+        /* Raw records are staged pitch linear, images decoded straight from their mapping */
+        int input = -1;
+        if (source.kind == REPLAY_RAW) {
+            input = copyRecord(source, entry.position) ? source.staging : -1;
+        } else if (source.kind == REPLAY_CONTAINER) {
+            uint32_t size;
+            const unsigned char *data = source.container->getImage(entry.position, size);
+            uint32_t width, height;
+            if (!data || !source.container->checkEntry(source.container->getEntries()[entry.position])
+                || !decode(data, size, input, width, height))
+                input = -1;
+        } else {
+            uint64_t size;
+            const unsigned char *data = mapFile(source.path, size);
+            uint32_t width, height;
+            if (!data || !decode(data, size, input, width, height))
+                input = -1;
+            if (data)
+                munmap((void *) data, size);
+        }
+        if (input == -1) {
+            _skipped++;
+            continue;
+        }
+
+        NvBufferTransformParams params;
+        memset(&params, 0, sizeof(params));
+        params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+        params.transform_filter = NvBufferTransform_Filter_Smart;
+        if (NvBufferTransform(input, fd, &params) != 0) {
+            _skipped++;
+            continue;
+        }
+        index = entry.index;
+        timestamp = entry.timestamp;
+        return true;
+    }
+    return false;
+}
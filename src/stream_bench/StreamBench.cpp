@@ -0,0 +1,555 @@
+/*
+ * StreamBench.cpp
+ *
+ * Provides the benchmark entrypoint. Drives the consumer side of StreamCapture,
+ * the dmabuf rings, the encode scheduler and the writers, from synthetic
+ * sources instead of cameras, so the pipeline can be measured on a TX2 with no
+ * sensors attached. Bench options come first, everything after "--" is parsed
+ * as StreamCapture options:
+ *
+ *   StreamBench [--cameras N] [--fps F] [--resolution WxH] [--pattern gradient|noise|<file.yuv>] [--seed S]
+ *               [--replay <run directory>[,<run directory>...]] [--replay-speed X] [--json <file>]
+ *               [--autotune <config file> [--live] [--trial-time T]] [-- <options>]
+ *
+ * Each stage's throughput and latency percentiles are logged per camera and
+ * written to bench.csv in the root directory.
+ * File format: camera,stage,frames,fps,mib_per_s,p50_us,p95_us,p99_us,max_us
+ *
+ * With --json the stages summed over the cameras, their slowest camera's
+ * latency and the CPU time per frame are also written as PerfResults, which
+ * make perf-check compares with the committed baseline.
+ *
+ * With --replay the sources publish the frames of a recorded run instead of a
+ * pattern, each camera its own, at the recorded frame times scaled by
+ * --replay-speed or, at speed 0, as fast as the pipeline takes them without
+ * dropping any. The run's size is the frame size and the bench ends with the
+ * last recorded frame unless --capture-time ends it earlier, so the writers,
+ * the encoders and the --share subscribers downstream see the real scenes
+ * with their real timing without a camera attached.
+ *
+ * With --autotune the bench runs trials instead, child benches or, with
+ * --live, StreamCapture runs of the cameras, searching the ring, queue,
+ * encoder, pinning, I/O and quality settings for the highest frame rate
+ * recorded without drops, and writes the winner with the options after "--"
+ * as a config file for StreamCapture --config. See AutoTuner.hpp.
+ *
+ * The sources are paced, so a faster build shows in the CPU time the process
+ * spends per written frame rather than in the fps, which is logged last and
+ * compared between build profiles by make bench-profiles.
+ */
+
+#include "SyntheticPattern.hpp"
+#include "SyntheticSource.hpp"
+#include "EncodeScheduler.hpp"
+#include "VolumeSet.hpp"
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "PerfResults.hpp"
+#include "ReplayFeed.hpp"
+#include "FramePublisher.hpp"
+#include "AutoTuner.hpp"
+#include <getopt.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace Argus;
+
+#define MKDIR_MODE 0777
+#define STDOUT_PRINT true
+#define DEFAULT_BENCH_CAMERAS 6
+#define DEFAULT_BENCH_FPS 30
+#define DEFAULT_BENCH_WIDTH 2048     // IMX265 full frame
+#define DEFAULT_BENCH_HEIGHT 1536
+#define DEFAULT_BENCH_TIME 30       // seconds when --capture-time is not passed
+#define POLL_INTERVAL_US 100000
+#define DEFAULT_REPLAY_SPEED 1.0    // recorded frame times
+
+static std::atomic<bool> doRun(true);
+
+static void signalCallback(int signum) {
+    doRun = false;
+}
+
+/* User and system seconds of every thread so far */
+static double getCpuSeconds() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static void printHelp() {
+    std::cout << "Usage: StreamBench [bench options] [-- StreamCapture options]" << std::endl
+              << "  --cameras\t\t<1-inf>\t\t\tSynthetic cameras. [Default: " << DEFAULT_BENCH_CAMERAS << "]" << std::endl
+              << "  --fps\t\t\t<1-inf>\t\t\tFrames per second per camera. [Default: " << DEFAULT_BENCH_FPS << "]" << std::endl
+              << "  --resolution\t\t<WxH>\t\t\tFrame size, even. [Default: " << DEFAULT_BENCH_WIDTH << "x"
+              << DEFAULT_BENCH_HEIGHT << "]" << std::endl
+              << "  --pattern\t\t<gradient|noise|file>\tMoving gradient, random noise or a raw I420 file to replay. "
+              << "[Default: gradient]" << std::endl
+              << "  --seed\t\t<1-inf>\t\t\tSeed of the noise pattern, fixed so runs compare. [Default: " << PATTERN_SEED << "]" << std::endl
+              << "  --replay\t\t<directory,...>\t\tReplay a recorded run instead of a pattern, from every volume it was written to. "
+              << "Cameras default to the run's." << std::endl
+              << "  --replay-speed\t<0-inf>\t\t\tMultiple of the recorded frame rate, 0 for as fast as possible without drops. "
+              << "[Default: " << DEFAULT_REPLAY_SPEED << "]" << std::endl
+              << "  --json\t\t<file>\t\t\tAlso write the results summed over the cameras as JSON for make perf-check." << std::endl
+              << "  --autotune\t\t<file>\t\t\tSearch the settings for the highest rate without drops in trials, "
+              << "write the winner as a config file." << std::endl
+              << "  --live\t\t\t\t\tRun the trials on the cameras with StreamCapture instead of the synthetic sources." << std::endl
+              << "  --trial-time\t\t<1-inf>\t\t\tSeconds of each trial. [Default: " << TUNE_TRIAL_TIME << "]" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+
+    bool errorOccurred = false;
+    uint32_t numCameras = DEFAULT_BENCH_CAMERAS;
+    double fps = DEFAULT_BENCH_FPS;
+    Size2D<uint32_t> resolution(DEFAULT_BENCH_WIDTH, DEFAULT_BENCH_HEIGHT);
+    int kind = PATTERN_GRADIENT;
+    std::string path;
+    uint32_t seed = PATTERN_SEED;
+    std::string json;
+    std::vector<std::string> runs;
+    double replaySpeed = DEFAULT_REPLAY_SPEED;
+    bool camerasGiven = false;
+    bool resolutionGiven = false;
+    std::string autotune;
+    bool live = false;
+    int trialTime = TUNE_TRIAL_TIME;
+    bool fpsGiven = false;
+
+    /* Parse the bench options up to "--", which getopt consumes */
+    static struct option long_options[] = {
+        {"cameras", required_argument, NULL, 'n'},
+        {"fps", required_argument, NULL, 'r'},
+        {"resolution", required_argument, NULL, 'x'},
+        {"pattern", required_argument, NULL, 'p'},
+        {"seed", required_argument, NULL, 's'},
+        {"json", required_argument, NULL, 'j'},
+        {"replay", required_argument, NULL, 'y'},
+        {"replay-speed", required_argument, NULL, 'e'},
+        {"autotune", required_argument, NULL, 'a'},
+        {"live", no_argument, NULL, 'l'},
+        {"trial-time", required_argument, NULL, 'i'},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    int c;
+    while (!errorOccurred && (c = getopt_long(argc, argv, "+", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'n':
+                numCameras = atoi(optarg);
+                errorOccurred = numCameras < 1;
+                camerasGiven = true;
+                break;
+            case 'r':
+                fps = atof(optarg);
+                errorOccurred = fps <= 0;
+                fpsGiven = true;
+                break;
+            case 'x': {
+                unsigned int width, height;
+                char end;
+                errorOccurred = sscanf(optarg, "%ux%u%c", &width, &height, &end) != 2 || width < 2 || height < 2
+                                || width % 2 || height % 2;
+                if (!errorOccurred)
+                    resolution = Size2D<uint32_t>(width, height);
+                resolutionGiven = true;
+                break;
+            }
+            case 'p':
+                if (strcmp(optarg, "gradient") == 0) {
+                    kind = PATTERN_GRADIENT;
+                } else if (strcmp(optarg, "noise") == 0) {
+                    kind = PATTERN_NOISE;
+                } else {
+                    kind = PATTERN_FILE;
+                    path = optarg;
+                }
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 10);
+                errorOccurred = seed < 1;
+                break;
+            case 'j':
+                json = optarg;
+                break;
+            case 'y': {
+                std::stringstream ss(optarg);
+                std::string run;
+                while (std::getline(ss, run, ','))
+                    if (!run.empty())
+                        runs.push_back(run);
+                errorOccurred = runs.empty();
+                break;
+            }
+            case 'e':
+                replaySpeed = atof(optarg);
+                errorOccurred = replaySpeed < 0;
+                break;
+            case 'a':
+                autotune = optarg;
+                break;
+            case 'l':
+                live = true;
+                break;
+            case 'i':
+                trialTime = atoi(optarg);
+                errorOccurred = trialTime < 1;
+                break;
+            default:
+                errorOccurred = true;
+                break;
+        }
+    }
+    if (errorOccurred) {
+        printHelp();
+        return 1;
+    }
+
+    /* The rest are StreamCapture options, parsed from a fresh argv */
+    std::vector<char*> captureArgs(1, argv[0]);
+    for (int i = optind; i < argc; i++)
+        captureArgs.push_back(argv[i]);
+    captureArgs.push_back(NULL);
+    if (!autotune.empty() && (!runs.empty() || !json.empty())) {
+        std::cout << "--autotune runs its own trials, it does not take --replay or --json" << std::endl;
+        return 1;
+    }
+    if ((live || trialTime != TUNE_TRIAL_TIME) && autotune.empty()) {
+        std::cout << "--live and --trial-time need --autotune" << std::endl;
+        return 1;
+    }
+    optind = 1;
+    Options *options = new Options;
+    if (!options->parse(captureArgs.size() - 1, captureArgs.data())) {
+        std::cout << "An error occurred while verifying the command line options! Exiting..." << std::endl;
+        printHelp();
+        Options::printHelp();
+        delete options;
+        return 1;
+    }
+    /* Search the settings in trials of their own instead of benchmarking */
+    if (!autotune.empty()) {
+        TuneSettings settings;
+        settings.config = autotune;
+        settings.live = live;
+        settings.trialTime = trialTime;
+        settings.fps = live && !fpsGiven && !options->frameRates.empty() ? options->frameRates[0] : fps;
+        settings.numCameras = numCameras;
+        std::stringstream workload, bench;
+        workload << numCameras << " cameras, " << resolution.width() << "x" << resolution.height() << ", "
+                 << (kind == PATTERN_GRADIENT ? "gradient" : kind == PATTERN_NOISE ? "noise" : path.c_str());
+        settings.workload = workload.str();
+        bench << "--cameras " << numCameras << " --resolution " << resolution.width() << "x" << resolution.height()
+              << " --pattern " << (kind == PATTERN_GRADIENT ? "gradient" : kind == PATTERN_NOISE ? "noise" : path.c_str())
+              << " --seed " << seed;
+        std::string arg;
+        while (bench >> arg)
+            settings.benchArgs.push_back(arg);
+        /* Live trials are given the rate searched, the --frame-rate passed only starts the search */
+        for (size_t i = 1; i + 1 < captureArgs.size(); i++) {
+            if (live && strcmp(captureArgs[i], "--frame-rate") == 0)
+                i++;
+            else if (!live || strncmp(captureArgs[i], "--frame-rate=", 13) != 0)
+                settings.fixedArgs.push_back(captureArgs[i]);
+        }
+        delete options;
+        if (signal(SIGINT, signalCallback) == SIG_ERR || signal(SIGTERM, signalCallback) == SIG_ERR)
+            return 1;
+        Logger *logger = new Logger("AUTOTUNE", "");
+        AutoTuner tuner(settings, logger, &doRun);
+        bool tuned = tuner.run();
+        if (!tuned)
+            logger->error(tuner.getError() + "! Exiting...");
+        delete logger;
+        return tuned ? 0 : 1;
+    }
+
+    /* Index the recorded frames of every camera of the run, which sets the size and the cameras */
+    std::vector<ReplayFeed*> feeds;
+    uint64_t replayEpoch = UINT64_MAX;
+    if (!runs.empty()) {
+        uint32_t recorded = ReplayFeed::countCameras(runs);
+        if (recorded == 0) {
+            std::cout << "No camN directories in " << runs[0] << "! Exiting..." << std::endl;
+            delete options;
+            return 1;
+        }
+        if (!camerasGiven)
+            numCameras = recorded;
+        for (uint32_t i = 0; i < numCameras && !errorOccurred; i++) {
+            feeds.push_back(new ReplayFeed(runs, i % recorded, (uint64_t) (1e9 / fps)));
+            if (!feeds[i]->open()) {
+                std::cout << feeds[i]->getError() << "! Exiting..." << std::endl;
+                errorOccurred = true;
+            } else {
+                replayEpoch = std::min(replayEpoch, feeds[i]->getFirstTimestamp());
+            }
+        }
+        uint32_t width, height;
+        if (!errorOccurred && !resolutionGiven) {
+            if (feeds[0]->getSize(width, height)) {
+                resolution = Size2D<uint32_t>(width & ~1U, height & ~1U);
+            } else {
+                std::cout << "Failed to read the first recorded frame! Exiting..." << std::endl;
+                errorOccurred = true;
+            }
+        }
+        if (errorOccurred) {
+            for (uint32_t i = 0; i < feeds.size(); i++)
+                delete feeds[i];
+            delete options;
+            return 1;
+        }
+    }
+
+    options->captureResolution = resolution;
+    options->captureFrameDuration = (uint64_t) (1e9 / fps);
+    options->saveEvery.assign(1, 1); // the sources are paced at --fps and every frame is saved
+    options->frameRates.clear();
+    if (options->captureTime == 0 && feeds.empty())
+        options->captureTime = DEFAULT_BENCH_TIME;
+
+    errorOccurred = signal(SIGINT, signalCallback) == SIG_ERR || signal(SIGTERM, signalCallback) == SIG_ERR;
+
+    /* Put the root directory where StreamCapture would, so the bench writes to the real volume */
+    if (!errorOccurred && options->volumes.empty()) {
+        std::string volume = VolumeSet::findMostFreeVolume();
+        options->volumes.push_back(volume.size() ? volume : ".");
+    }
+    Logger *logger = new Logger("BENCH", "");
+    if (!errorOccurred) {
+        std::string directory = VolumeSet::join(options->volumes[0], options->directory);
+        strncpy(options->directory, directory.data(), FILENAME_MAX);
+        if (mkdir(options->directory, MKDIR_MODE) != 0) {
+            std::cout << "Failed to create " << options->directory << "! Exiting..." << std::endl;
+            errorOccurred = true;
+        } else {
+            logger->setDirectory(options->directory);
+            if (options->verbose)
+                logger->enableVerbose();
+            else
+                logger->disableVerbose();
+            options->write();
+        }
+    }
+
+    /* Render the frames every source copies from */
+    SyntheticPattern pattern(resolution, kind, path, seed);
+    if (!errorOccurred && feeds.empty()) {
+        logger->log("Rendering the synthetic frames...");
+        if (!pattern.create()) {
+            logger->error(pattern.getError() + "! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Open the results file */
+    FILE *file = NULL;
+    if (!errorOccurred) {
+        std::string filename = std::string(options->directory) + "/bench.csv";
+        file = fopen(filename.c_str(), "w");
+        if (!file || fprintf(file, "camera,stage,frames,fps,mib_per_s,p50_us,p95_us,p99_us,max_us\n") < 0) {
+            logger->error("Failed to create bench.csv! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Launch the JPEG encoder workers shared by all sources */
+    EncodeScheduler *scheduler = NULL;
+    if (!errorOccurred && options->format == FORMAT_JPEG) {
+        scheduler = new EncodeScheduler(*options, numCameras);
+        if (!scheduler || !scheduler->start()) {
+            logger->error("Failed to start the encode scheduler! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Create the run directory on the other volumes */
+    VolumeSet *volumes = NULL;
+    if (!errorOccurred) {
+        volumes = new VolumeSet(*options, numCameras);
+        if (!volumes || !volumes->open()) {
+            logger->error("Failed to prepare the output volumes! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Open the share socket before any frame is produced */
+    FramePublisher *publisher = NULL;
+    if (!errorOccurred && !options->sharePath.empty()) {
+        publisher = new FramePublisher(*options, numCameras);
+        if (!publisher || !publisher->initialize() || !publisher->waitRunning()) {
+            logger->error("Failed to start sharing frames! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Launch every source and wait until each has its sink ready */
+    std::vector<SyntheticSource*> sources;
+    for (uint32_t i = 0; i < numCameras && !errorOccurred; i++) {
+        sources.push_back(new SyntheticSource(i, *options, pattern, scheduler, volumes, options->captureFrameDuration,
+                                              publisher, feeds.empty() ? NULL : feeds[i], replayEpoch, replaySpeed));
+        if (!sources[i]->initialize()) {
+            logger->error("Failed to initialize the synthetic source! Exiting...");
+            errorOccurred = true;
+        }
+    }
+    for (uint32_t i = 0; i < sources.size() && !errorOccurred; i++) {
+        if (!sources[i]->waitRunning()) {
+            logger->error("Failed to start the synthetic source! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Run for captureTime seconds, SIGINT or until a source stops; a replay runs until every camera's
+       recording has ended unless captureTime is given */
+    auto start = std::chrono::steady_clock::now();
+    double cpuStart = getCpuSeconds();
+    if (!errorOccurred) {
+        std::stringstream ss;
+        if (feeds.empty()) {
+            ss << "Benchmarking " << numCameras << " cameras at " << fps << " fps, " << resolution.width() << "x"
+               << resolution.height() << ", for " << options->captureTime << " s...";
+        } else {
+            ss << "Replaying " << numCameras << " cameras of " << runs[0] << ", " << resolution.width() << "x"
+               << resolution.height() << ", ";
+            if (replaySpeed > 0)
+                ss << "at " << replaySpeed << "x the recorded rate";
+            else
+                ss << "as fast as possible";
+            if (options->captureTime > 0)
+                ss << ", for at most " << options->captureTime << " s";
+            ss << "...";
+        }
+        logger->log(ss.str(), STDOUT_PRINT);
+        auto deadline = start + std::chrono::seconds(options->captureTime);
+        bool executing = true;
+        while (doRun && executing && (options->captureTime == 0 || std::chrono::steady_clock::now() < deadline)) {
+            usleep(POLL_INTERVAL_US);
+            bool all = true, any = false;
+            for (uint32_t i = 0; i < sources.size(); i++) {
+                all = all && sources[i]->isExecuting();
+                any = any || sources[i]->isExecuting();
+            }
+            executing = feeds.empty() ? all : any;
+        }
+    }
+    double seconds = (std::chrono::steady_clock::now() - start).count() / 1e9;
+
+    /* Stop the sources, each drains its sink on shutdown */
+    for (uint32_t i = 0; i < sources.size(); i++)
+        sources[i]->stopExecute();
+    for (uint32_t i = 0; i < sources.size(); i++)
+        sources[i]->shutdown();
+    if (scheduler)
+        scheduler->shutdown();
+    if (publisher)
+        publisher->shutdown();
+
+    /* Report every stage of every camera */
+    if (!errorOccurred) {
+        for (uint32_t i = 0; i < sources.size(); i++) {
+            if (!sources[i]->report(seconds, file)) {
+                logger->error("Failed to write bench.csv!");
+                errorOccurred = true;
+            }
+        }
+    }
+
+    /* User and system time of every thread from the start of the run, per frame written */
+    double cpuPerFrame = 0;
+    if (!errorOccurred) {
+        uint64_t frames = 0;
+        for (uint32_t i = 0; i < sources.size(); i++)
+            frames += sources[i]->getFramesWritten();
+        double cpuSeconds = getCpuSeconds() - cpuStart;
+        cpuPerFrame = frames ? cpuSeconds * 1e6 / frames : 0;
+        std::stringstream ss;
+        ss << "CPU time: " << cpuSeconds << " s, per frame: " << cpuPerFrame << " us";
+        logger->log(ss.str(), STDOUT_PRINT);
+    }
+
+    /* Each stage summed over the cameras, with the latency of its slowest camera */
+    if (!errorOccurred && !json.empty()) {
+        std::stringstream workload;
+        workload << numCameras << " cameras at " << fps << " fps, " << resolution.width() << "x" << resolution.height()
+                 << ", ";
+        if (feeds.empty())
+            workload << (kind == PATTERN_GRADIENT ? "gradient" : kind == PATTERN_NOISE ? "noise" : path.c_str())
+                     << ", seed " << seed << ", " << options->captureTime << " s";
+        else
+            workload << "replay of " << runs[0] << " at " << replaySpeed << "x";
+        PerfResults results("stream", workload.str());
+        std::vector<StageResult> total;
+        uint64_t dropped = 0, bytes = 0, written = 0;
+        for (uint32_t i = 0; i < sources.size(); i++) {
+            std::vector<StageResult> stages;
+            sources[i]->getStages(seconds, stages);
+            dropped += sources[i]->getFramesDropped();
+            bytes += sources[i]->getBytesPerFrame() * sources[i]->getFramesWritten();
+            written += sources[i]->getFramesWritten();
+            for (uint32_t j = 0; j < stages.size(); j++) {
+                if (j >= total.size()) {
+                    total.push_back(stages[j]);
+                    continue;
+                }
+                total[j].frames += stages[j].frames;
+                total[j].fps += stages[j].fps;
+                total[j].mibPerSecond += stages[j].mibPerSecond;
+                total[j].p50 = std::max(total[j].p50, stages[j].p50);
+                total[j].p95 = std::max(total[j].p95, stages[j].p95);
+                total[j].p99 = std::max(total[j].p99, stages[j].p99);
+                total[j].max = std::max(total[j].max, stages[j].max);
+            }
+        }
+        for (uint32_t j = 0; j < total.size(); j++) {
+            std::string stage(total[j].name);
+            results.add(stage + ".fps", total[j].fps);
+            if (total[j].mibPerSecond > 0)
+                results.add(stage + ".mib_per_s", total[j].mibPerSecond);
+            results.add(stage + ".p50_us", total[j].p50);
+            results.add(stage + ".p99_us", total[j].p99);
+            results.add(stage + ".max_us", total[j].max);
+        }
+        results.add("write.bytes_per_frame", written ? (double) bytes / written : 0);
+        results.add("pipeline.dropped", dropped);
+        results.add("pipeline.cpu_us_per_frame", cpuPerFrame);
+        if (!results.write(json)) {
+            logger->error("Failed to write " + json + "!");
+            errorOccurred = true;
+        }
+    }
+    for (uint32_t i = 0; i < sources.size(); i++)
+        delete sources[i];
+    for (uint32_t i = 0; i < feeds.size(); i++)
+        delete feeds[i];
+    if (scheduler)
+        delete scheduler;
+    if (publisher)
+        delete publisher;
+    if (volumes) {
+        volumes->close();
+        delete volumes;
+    }
+    if (file && fclose(file) != 0) {
+        logger->error("Failed to close bench.csv!");
+        errorOccurred = true;
+    }
+
+    if (!errorOccurred)
+        logger->log("Benchmark completed, results in bench.csv", STDOUT_PRINT);
+    delete logger;
+    delete options;
+    return errorOccurred ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * SyntheticPattern.cpp
+ *
+ * A short loop of YUV420 frames in pitch linear NvBuffers standing in for a
+ * camera, shared read-only by every SyntheticSource. The frames are rendered
+ * once up front through the CPU mapping, so producing a frame at run time
+ * costs the same VIC blit a real capture does and nothing else.
+ */
+
+#include "SyntheticPattern.hpp"
+
+#include <nvbuf_utils.h>
+#include <string.h>
+
+#define PATTERN_SHIFT 4 // pixels the gradient moves per frame
+
+using namespace Argus;
+
+SyntheticPattern::SyntheticPattern(Size2D<uint32_t> size, int kind, const std::string& path, uint32_t seed) :
+    _size(size),
+    _kind(kind),
+    _path(path),
+    _seed(seed)
+{}
+
+SyntheticPattern::~SyntheticPattern() {
+    for (uint32_t i = 0; i < _fds.size(); i++)
+        NvBufferDestroy(_fds[i]);
+}
+
+/* Create and render every frame of the loop, return bool indicating success */
+bool SyntheticPattern::create() {
+
+    bool errorOccurred = false;
+
+    /* Open the replayed frames */
+    FILE *file = NULL;
+    if (!errorOccurred && _kind == PATTERN_FILE) {
+        file = fopen(_path.c_str(), "rb");
+        if (!file) {
+            _error = "Failed to open " + _path;
+            errorOccurred = true;
+        }
+    }
+
+    NvBufferCreateParams params;
+    memset(&params, 0, sizeof(params));
+    params.width = _size.width();
+    params.height = _size.height();
+    params.payloadType = NvBufferPayload_SurfArray;
+    params.layout = NvBufferLayout_Pitch;
+    params.colorFormat = NvBufferColorFormat_YUV420;
+    params.nvbuf_tag = NvBufferTag_CAMERA;
+    for (uint32_t i = 0; i < PATTERN_FRAMES && !errorOccurred; i++) {
+        int fd = -1;
+        if (NvBufferCreateEx(&fd, &params) != 0) {
+            _error = "Failed to create the pattern buffers";
+            errorOccurred = true;
+        } else {
+            _fds.push_back(fd);
+            errorOccurred = !fill(fd, i, file);
+        }
+    }
+
+    if (file)
+        fclose(file);
+    return !errorOccurred;
+}
+
+/* The buffer holding the frame'th frame of the loop */
+int SyntheticPattern::getFd(uint64_t frame) const {
+    return _fds[frame % _fds.size()];
+}
+
+uint32_t SyntheticPattern::getCount() const {
+    return _fds.size();
+}
+
+const std::string& SyntheticPattern::getError() const {
+    return _error;
+}
+
+/* Render one frame into every plane of the buffer, a file shorter than the loop starts over */
+bool SyntheticPattern::fill(int fd, uint32_t frame, FILE *file) {
+    NvBufferParams params;
+    if (NvBufferGetParams(fd, &params) != 0) {
+        _error = "Failed to get the pattern buffer parameters";
+        return false;
+    }
+
+    uint32_t state = _seed + frame; // xorshift32 state, differs per frame
+    for (uint32_t plane = 0; plane < params.num_planes; plane++) {
+        void *mapping = NULL;
+        if (NvBufferMemMap(fd, plane, NvBufferMem_Write, &mapping) != 0) {
+            _error = "Failed to map the pattern buffer";
+            return false;
+        }
+        uint8_t *data = (uint8_t *) mapping;
+        for (uint32_t y = 0; y < params.height[plane]; y++) {
+            uint8_t *row = data + y * params.pitch[plane];
+            if (_kind == PATTERN_FILE) {
+                size_t read = fread(row, 1, params.width[plane], file);
+                if (read == 0 && plane == 0 && y == 0 && frame > 0) {
+                    rewind(file);
+                    read = fread(row, 1, params.width[plane], file);
+                }
+                if (read != params.width[plane]) {
+                    NvBufferMemUnMap(fd, plane, &mapping);
+                    _error = _path + " ends inside a frame at the bench resolution";
+                    return false;
+                }
+            } else if (_kind == PATTERN_NOISE) {
+                for (uint32_t x = 0; x < params.width[plane]; x++) {
+                    state ^= state << 13;
+                    state ^= state >> 17;
+                    state ^= state << 5;
+                    row[x] = state;
+                }
+            } else {
+                uint32_t shift = frame * PATTERN_SHIFT >> (plane ? 1 : 0);
+                for (uint32_t x = 0; x < params.width[plane]; x++)
+                    row[x] = plane == 0 ? (x + y + shift) : (plane == 1 ? x + shift : y + shift) + 64;
+            }
+        }
+        NvBufferMemSyncForDevice(fd, plane, &mapping);
+        NvBufferMemUnMap(fd, plane, &mapping);
+    }
+    return true;
+}
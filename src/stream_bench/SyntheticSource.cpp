@@ -0,0 +1,438 @@
+/*
+ * SyntheticSource.cpp
+ *
+ * Stands in for a ConsumerThread without an Argus stream: paced at the bench
+ * frame rate, it copies the next SyntheticPattern frame into a slot of its
+ * DmabufRing with the same VIC blit a capture takes and submits the slot to
+ * the sink the real camera would use. Only the acquire is synthetic, the ring,
+ * the encode scheduler and the writers are the ones StreamCapture runs. A
+ * replay decodes or copies the recorded frame into the slot instead and keeps
+ * its recorded image index and frame time.
+ */
+
+#include "SyntheticSource.hpp"
+
+#include "SyntheticPattern.hpp"
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "ThreadPlacement.hpp"
+#include "FrameWriter.hpp"
+#include "BufferPool.hpp"
+#include "DmabufRing.hpp"
+#include "EncodeScheduler.hpp"
+#include "RawWriter.hpp"
+#include "VideoWriter.hpp"
+#include "FramePublisher.hpp"
+#include "ReplayFeed.hpp"
+#include "TnrFilter.hpp"
+#include "SteadyClock.hpp"
+#include <sstream>
+#include <sys/stat.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace Argus;
+
+#define MKDIR_MODE 0777
+#define STDOUT_PRINT true
+#define REPLAY_WAIT_US 1000 // between retries for a ring slot or queue space when replaying as fast as possible
+
+/* Sleep until the steady clock reaches time in ns */
+static void sleepUntil(uint64_t time) {
+    struct timespec deadline = {(time_t) (time / 1000000000ULL), (long) (time % 1000000000ULL)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+}
+
+SyntheticSource::SyntheticSource(uint32_t id, const Options& options, const SyntheticPattern& pattern,
+                                 EncodeScheduler *scheduler, VolumeSet *volumes, uint64_t frameDuration,
+                                 FramePublisher *publisher, ReplayFeed *replay, uint64_t replayEpoch,
+                                 double replaySpeed) :
+        _id(id),
+        _options(options),
+        _pattern(pattern),
+        _scheduler(scheduler),
+        _volumes(volumes),
+        _frameDuration(frameDuration),
+        _publisher(publisher),
+        _replay(replay),
+        _replayEpoch(replayEpoch),
+        _replaySpeed(replaySpeed),
+        _logger(NULL),
+        _ring(NULL),
+        _pool(NULL),
+        _writer(NULL),
+        _channel(NULL),
+        _rawWriter(NULL),
+        _videoWriter(NULL),
+        _sink(NULL),
+        _tnr(NULL),
+        _doExecute(true),
+        _framesProduced(0),
+        _framesDropped(0),
+        _framesLate(0)
+{}
+
+SyntheticSource::~SyntheticSource() {
+    if (_rawWriter)
+        delete _rawWriter;
+    if (_videoWriter)
+        delete _videoWriter;
+    if (_writer)
+        delete _writer;
+    if (_pool)
+        delete _pool;
+    if (_tnr)
+        delete _tnr;
+    if (_ring)
+        delete _ring;
+    if (_logger)
+        delete _logger;
+}
+
+bool SyntheticSource::threadInitialize() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "SOURCE " << std::to_string(_id);
+        _logger = new Logger(ss.str(), _options.directory);
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Pin the thread where the camera's consumer would run, a failure is logged but not fatal */
+    if (!errorOccurred) {
+        placeThread(_options.getConsumerCpu(_id), _options.rtPolicy, _options.rtPriority, _logger);
+    }
+
+    /* Create the image sub-directory */
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << _options.directory << "/cam" << std::to_string(_id);
+        if (mkdir(ss.str().c_str(), MKDIR_MODE) != 0) {
+            _logger->error("Failed to create image sub-directory!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Create the dmabuf ring in the layout the consumer would copy captures into, with the slots held for
+       --share subscribers on top */
+    if (!errorOccurred) {
+        _ring = new DmabufRing(_options.dmabufRing + (_publisher ? _options.shareSlots : 0));
+        if (!_ring || !_ring->allocate(_options.captureResolution, DmabufRing::getColorFormat(_options, _id),
+                                       DmabufRing::getLayout(_options))) {
+            _logger->error("Failed to create dmabuf ring!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Open the temporal noise reduction the consumer would filter its copies with */
+    if (!errorOccurred && _options.getTnr(_id) != TNR_OFF) {
+        _tnr = new TnrFilter(_id, _options.getTnr(_id));
+        if (!_tnr || !_tnr->open(_options.captureResolution, DmabufRing::getColorFormat(_options, _id),
+                                 DmabufRing::getLayout(_options))) {
+            _logger->error(_tnr ? _tnr->getError() + "!" : "Failed to create the TNR filter!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Raw frames skip the encoder, the writer maps the dmabufs directly */
+    bool encode = _options.format == FORMAT_JPEG;
+    if (!errorOccurred && _options.format == FORMAT_RAW) {
+        _rawWriter = new RawWriter(_id, _options, *_ring, NULL, _volumes);
+        _sink = _rawWriter;
+        if (!_rawWriter || !_rawWriter->initialize() || !_rawWriter->waitRunning()) {
+            _logger->error("Failed to start raw writer thread!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Video frames are queued on the video encoder straight from the ring */
+    if (!errorOccurred && _options.isVideoFormat()) {
+        _videoWriter = new VideoWriter(_id, _options, *_ring, NULL, _volumes);
+        _sink = _videoWriter;
+        if (!_videoWriter || !_videoWriter->initialize() || !_videoWriter->waitRunning()) {
+            _logger->error("Failed to start video writer thread!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Allocate memory for JPEG encoded images, sized as the consumer does */
+    if (!errorOccurred && encode) {
+        Size2D<uint32_t> size = _options.getEncodeSize(_id);
+        _pool = new BufferPool(_options.writeQueue, size.width() * size.height() * 3 / 2);
+        if (!_pool || !_pool->allocate()) {
+            _logger->error("Failed to allocate buffer memory!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Launch the writer thread, which returns buffers to the pool once written */
+    if (!errorOccurred && encode) {
+        _writer = new FrameWriter(_id, _options, *_pool, NULL, _volumes);
+        if (!_writer || !_writer->initialize() || !_writer->waitRunning()) {
+            _logger->error("Failed to start writer thread!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Register with the encode scheduler, whose workers return dmabufs to the ring once encoded */
+    if (!errorOccurred && encode) {
+        _channel = _scheduler ? _scheduler->registerCamera(_id, *_ring, *_writer) : NULL;
+        _sink = _channel;
+        if (!_channel) {
+            _logger->error("Failed to register with the encode scheduler!");
+            errorOccurred = true;
+        }
+    }
+
+    return !errorOccurred;
+}
+
+bool SyntheticSource::threadExecute() {
+
+    bool errorOccurred = false;
+
+    /* A replay is paced by its recording instead */
+    if (_replay) {
+        errorOccurred = !replay();
+        _doExecute = false;
+        requestShutdown();
+        return !errorOccurred;
+    }
+
+    /* Produce a frame every frame duration, ticks missed while behind are skipped rather than caught up */
+    uint64_t next = now();
+    uint64_t frame = 0;
+    uint64_t index = 1;
+    while (!errorOccurred && _doExecute) {
+        sleepUntil(next);
+        if (_sink->hasFailed()) {
+            _logger->log("An error occurred while writing the image, are all volumes full or failing? Exiting...", STDOUT_PRINT);
+            break;
+        }
+        errorOccurred = !produce(frame++, index);
+
+        next += _frameDuration;
+        uint64_t time = now();
+        if (time > next + _frameDuration) {
+            uint64_t missed = (time - next) / _frameDuration;
+            _framesLate += missed;
+            next += missed * _frameDuration;
+        }
+    }
+    _doExecute = false;
+
+    requestShutdown();
+    return !errorOccurred;
+}
+
+/* Publish every recorded frame at its recorded time relative to the epoch, scaled by the speed, or as fast
+   as possible at speed 0. Frames published more than a frame duration behind are counted as late, none is
+   skipped. Return bool indicating no fatal error occurred */
+bool SyntheticSource::replay() {
+    bool errorOccurred = false;
+    uint64_t start = now();
+    uint64_t frame = 0;
+    uint64_t index = 0;
+    uint64_t timestamp;
+    while (!errorOccurred && _doExecute && _replay->peek(timestamp)) {
+        if (_replaySpeed > 0) {
+            uint64_t offset = timestamp > _replayEpoch ? timestamp - _replayEpoch : 0;
+            uint64_t deadline = start + (uint64_t) (offset / _replaySpeed);
+            sleepUntil(deadline);
+            if (now() > deadline + _frameDuration)
+                _framesLate++;
+        }
+        if (_sink->hasFailed()) {
+            _logger->log("An error occurred while writing the image, are all volumes full or failing? Exiting...", STDOUT_PRINT);
+            break;
+        }
+        errorOccurred = !produce(frame++, index);
+    }
+
+    if (!errorOccurred && _doExecute) {
+        std::stringstream ss;
+        ss << "Replay finished after " << _framesProduced << " of " << _replay->getCount() << " recorded frames, "
+           << _replay->getFramesSkipped() << " unreadable";
+        _logger->log(ss.str(), STDOUT_PRINT);
+    }
+    return !errorOccurred;
+}
+
+bool SyntheticSource::threadShutdown() {
+    if (_channel)
+        _channel->drain();
+    if (_writer)
+        _writer->shutdown();
+    if (_rawWriter)
+        _rawWriter->shutdown();
+    if (_videoWriter)
+        _videoWriter->shutdown();
+    return true;
+}
+
+/* Used to stop infinite loop in execute */
+void SyntheticSource::stopExecute() {
+    _doExecute = false;
+}
+
+bool SyntheticSource::isExecuting() {
+    return _doExecute;
+}
+
+/* Frames through the whole pipeline, after shutdown */
+uint64_t SyntheticSource::getFramesWritten() {
+    return _sink->getFramesWritten();
+}
+
+/* Mean size of a written frame, after shutdown */
+uint64_t SyntheticSource::getBytesPerFrame() {
+    uint64_t frames = _sink->getFramesWritten();
+    return frames ? _sink->getBytesWritten() / frames : 0;
+}
+
+/* Frames dropped on a full ring or sink queue */
+uint64_t SyntheticSource::getFramesDropped() {
+    return _framesDropped;
+}
+
+/* Copy the frame'th pattern frame, or the next recorded one, into a free ring slot and submit it, false on
+   a fatal error */
+bool SyntheticSource::produce(uint64_t frame, uint64_t& index) {
+    FrameJob job;
+    memset(&job, 0, sizeof(job));
+    _framesProduced++;
+    bool wait = _replay && _replaySpeed <= 0;
+    bool acquired;
+    while (!(acquired = _ring->acquire(job.slot, job.fd)) && wait && _doExecute)
+        usleep(REPLAY_WAIT_US);
+    if (!acquired) {
+        _framesDropped++;
+        if (_replay)
+            _replay->skip();
+        index++;
+        return true;
+    }
+
+    /* A recorded frame brings its own index and time, the end of the recording is not an error. With TNR
+       the frame is staged and the filter writes the slot */
+    uint64_t copyStart = now();
+    uint64_t timestamp = copyStart;
+    int target = _tnr ? _tnr->getStagingFd() : job.fd;
+    if (_replay) {
+        if (!_replay->next(target, index, timestamp)) {
+            _ring->release(job.slot);
+            _framesProduced--;
+            return true;
+        }
+    } else {
+        NvBufferTransformParams params;
+        memset(&params, 0, sizeof(params));
+        params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+        params.transform_filter = NvBufferTransform_Filter_Smart;
+        if (NvBufferTransform(_pattern.getFd(frame), target, &params) != 0) {
+            _logger->error("An error occurred while copying to the NvBuffer! Exiting...");
+            _ring->release(job.slot);
+            return false;
+        }
+    }
+    if (_tnr && !_tnr->process(target, job.fd)) {
+        _logger->error(_tnr->getError() + "! Exiting...");
+        _ring->release(job.slot);
+        return false;
+    }
+    uint64_t copyEnd = now();
+    _copyLatency.record((copyEnd - copyStart) / 1000);
+
+    job.index = index++;
+    job.timestamp = timestamp;
+    job.submitted = copyEnd;
+    job.quality = _channel ? _channel->getQuality() : JPEG_QUALITY;
+    job.telemetry.frameNumber = frame + 1;
+    job.telemetry.timestamp = timestamp;
+    job.telemetry.index = job.index;
+    job.telemetry.copyUs = (copyEnd - copyStart) / 1000;
+    if (_publisher)
+        _publisher->offer(_id, *_ring, job.slot, job.index, timestamp);
+    bool submitted;
+    while (!(submitted = _sink->submit(job)) && wait && _doExecute && !_sink->hasFailed())
+        usleep(REPLAY_WAIT_US);
+    if (!submitted) {
+        _ring->release(job.slot);
+        _framesDropped++;
+    }
+    return true;
+}
+
+/* Throughput and latency of each stage the sink has over seconds, call once the thread has shut down */
+void SyntheticSource::getStages(double seconds, std::vector<StageResult>& stages) {
+    struct Stage {
+        const char *name;
+        uint64_t frames;
+        uint64_t bytes;
+        const LatencyHistogram *latency;
+    };
+    const LatencyHistogram *encodeLatency = _channel ? _channel->getLatency() : _videoWriter ? _sink->getLatency() : NULL;
+    const LatencyHistogram *writeLatency = _writer ? _writer->getWriteLatency() : _rawWriter ? _sink->getLatency() : NULL;
+    Stage all[] = {
+        {"copy", _framesProduced - _framesDropped, 0, &_copyLatency},
+        {"tnr", _tnr ? _tnr->getFramesFiltered() : 0, 0, _tnr ? _tnr->getLatency() : NULL},
+        {"encode", _sink->getFramesWritten(), 0, encodeLatency},
+        {"write", _sink->getFramesWritten(), _sink->getBytesWritten(), writeLatency}
+    };
+
+    stages.clear();
+    for (uint32_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        if (!all[i].latency)
+            continue;
+        StageResult stage;
+        stage.name = all[i].name;
+        stage.frames = all[i].frames;
+        stage.fps = all[i].frames / seconds;
+        stage.mibPerSecond = all[i].bytes / seconds / (1 << 20);
+        stage.p50 = all[i].latency->getPercentile(50);
+        stage.p95 = all[i].latency->getPercentile(95);
+        stage.p99 = all[i].latency->getPercentile(99);
+        stage.max = all[i].latency->getMax();
+        stages.push_back(stage);
+    }
+}
+
+/* Log each stage's throughput and latency over seconds and append them to the bench file,
+   call once the thread has shut down */
+bool SyntheticSource::report(double seconds, FILE *file) {
+    std::vector<StageResult> stages;
+    getStages(seconds, stages);
+
+    bool success = true;
+    for (uint32_t i = 0; i < stages.size(); i++) {
+        const StageResult& stage = stages[i];
+        std::stringstream ss;
+        ss << "Stage " << stage.name << ": " << stage.frames << " frames, " << stage.fps << " fps";
+        if (stage.mibPerSecond > 0)
+            ss << ", " << stage.mibPerSecond << " MiB/s";
+        ss << ", latency p50/p95/p99/max " << stage.p50 << "/" << stage.p95 << "/" << stage.p99 << "/" << stage.max << " us";
+        _logger->log(ss.str(), STDOUT_PRINT);
+        if (fprintf(file, "%u,%s,%lu,%.2f,%.2f,%lu,%lu,%lu,%lu\n", _id, stage.name, stage.frames, stage.fps,
+                    stage.mibPerSecond, stage.p50, stage.p95, stage.p99, stage.max) < 0)
+            success = false;
+    }
+
+    std::stringstream ss;
+    ss << "Frames produced: " << _framesProduced << ", dropped: " << _framesDropped << ", late ticks: " << _framesLate;
+    _logger->log(ss.str(), STDOUT_PRINT);
+    ss.str("");
+    ss << "Bytes per frame written: " << getBytesPerFrame() << ", TNR " << Options::getTnrName(_options.getTnr(_id));
+    _logger->log(ss.str(), STDOUT_PRINT);
+    return success;
+}
@@ -0,0 +1,168 @@
+/*
+ * AioQueue.cpp
+ *
+ * A thin wrapper around one Linux native AIO context, called through syscall()
+ * so no libaio is needed on the target; L4T R32's 4.9 kernel has no io_uring.
+ * Writes are queued with queue(), handed to the kernel together with submit()
+ * and reaped in batches with reap(). The kernel only completes writes
+ * asynchronously on O_DIRECT files, buffered ones are written inside io_submit.
+ */
+
+#include "AioQueue.hpp"
+
+#include "SteadyClock.hpp"
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+AioQueue::AioQueue() :
+    _context(0),
+    _inFlight(0),
+    _inFlightHighWater(0),
+    _submits(0),
+    _submitted(0)
+{}
+
+AioQueue::~AioQueue() {
+    close();
+}
+
+/* Create the context for up to depth writes in flight, return bool indicating success */
+bool AioQueue::open(uint32_t depth) {
+    if (syscall(SYS_io_setup, depth, &_context) != 0) {
+        _context = 0;
+        return false;
+    }
+    _slots.resize(depth);
+    _events.resize(depth);
+    for (uint32_t i = 0; i < depth; i++)
+        _free.push_back(depth - 1 - i);
+    return true;
+}
+
+/* Destroy the context, the kernel waits for writes still in flight */
+void AioQueue::close() {
+    if (_context)
+        syscall(SYS_io_destroy, _context);
+    _context = 0;
+}
+
+/* Prepare a write, false if every slot is queued or in flight */
+bool AioQueue::queue(int fd, const void *data, size_t size, uint64_t offset, uint64_t cookie) {
+    if (_free.empty())
+        return false;
+    uint32_t index = _free.back();
+    _free.pop_back();
+
+    Slot& slot = _slots[index];
+    memset(&slot.cb, 0, sizeof(slot.cb));
+    slot.cb.aio_lio_opcode = IOCB_CMD_PWRITE;
+    slot.cb.aio_fildes = fd;
+    slot.cb.aio_buf = (uint64_t) (uintptr_t) data;
+    slot.cb.aio_nbytes = size;
+    slot.cb.aio_offset = offset;
+    slot.cb.aio_data = index;
+    slot.cookie = cookie;
+    _queued.push_back(&slot.cb);
+    return true;
+}
+
+/* Hand every queued write to the kernel, in one call unless one is refused, returns how many were
+   taken or -errno of the first refused. Writes left over while the kernel is out of resources stay
+   queued for the next call */
+int AioQueue::submit() {
+    if (_queued.empty())
+        return 0;
+    uint64_t time = now();
+    for (uint32_t i = 0; i < _queued.size(); i++)
+        _slots[_queued[i]->aio_data].submitted = time;
+
+    /* io_submit takes the writes up to the first it cannot, and fails only when that is the first */
+    int taken = 0, error = 0;
+    while (!_queued.empty()) {
+        long count = syscall(SYS_io_submit, _context, (long) _queued.size(), _queued.data());
+        if (count < 0 && errno == EAGAIN)
+            break;
+        if (count < 0) {
+            /* A refused write is failed rather than retried forever, reap() reports it; the rest are tried */
+            int refusal = errno;
+            if (error == 0)
+                error = refusal;
+            uint32_t index = _queued[0]->aio_data;
+            AioCompletion completion = {_slots[index].cookie, -refusal, 0};
+            _refused.push_back(completion);
+            _free.push_back(index);
+            _queued.erase(_queued.begin());
+            continue;
+        }
+        if (count == 0)
+            break;
+        _queued.erase(_queued.begin(), _queued.begin() + count);
+        _inFlight += count;
+        if (_inFlight > _inFlightHighWater)
+            _inFlightHighWater = _inFlight;
+        _submits++;
+        _submitted += count;
+        taken += count;
+    }
+    return error ? -error : taken;
+}
+
+/* Wait up to timeoutNs for at least minimum writes to finish and take every finished one,
+   returns how many were appended to completions or -errno */
+int AioQueue::reap(std::vector<AioCompletion>& completions, uint32_t minimum, uint64_t timeoutNs) {
+    int refused = _refused.size();
+    completions.insert(completions.end(), _refused.begin(), _refused.end());
+    _refused.clear();
+    if (_inFlight == 0 || (refused > 0 && minimum > 0))
+        return refused;
+    if (minimum > _inFlight)
+        minimum = _inFlight;
+    struct timespec timeout = {(time_t) (timeoutNs / 1000000000ULL), (long) (timeoutNs % 1000000000ULL)};
+    long count = syscall(SYS_io_getevents, _context, (long) minimum, (long) _events.size(), _events.data(), &timeout);
+    if (count < 0)
+        return errno == EINTR ? 0 : -errno;
+
+    uint64_t time = now();
+    for (long i = 0; i < count; i++) {
+        uint32_t index = _events[i].data;
+        AioCompletion completion = {_slots[index].cookie, _events[i].res, (time - _slots[index].submitted) / 1000};
+        _latency.record(completion.latencyUs);
+        completions.push_back(completion);
+        _free.push_back(index);
+    }
+    _inFlight -= count;
+    return refused + count;
+}
+
+uint32_t AioQueue::getDepth() const {
+    return _slots.size();
+}
+
+uint32_t AioQueue::getInFlight() const {
+    return _inFlight;
+}
+
+uint32_t AioQueue::getQueued() const {
+    return _queued.size();
+}
+
+uint32_t AioQueue::getFree() const {
+    return _free.size();
+}
+
+uint32_t AioQueue::getInFlightHighWater() const {
+    return _inFlightHighWater;
+}
+
+/* Writes handed to the kernel per io_submit */
+double AioQueue::getMeanBatch() const {
+    return _submits ? (double) _submitted / _submits : 0;
+}
+
+/* Submit to completion latency in us */
+const LatencyHistogram& AioQueue::getLatency() const {
+    return _latency;
+}
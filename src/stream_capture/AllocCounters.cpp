@@ -0,0 +1,132 @@
+/*
+ * AllocCounters.cpp
+ *
+ * Per-thread hot path counters of the ALLOC_COUNTERS build (make
+ * ALLOC_COUNTERS=1). That build replaces the global operator new and delete
+ * with versions counting every allocation of the calling thread; malloc calls
+ * made by the Jetson libraries are not seen. Syscalls are the read and write
+ * class ones the kernel accounts per thread in /proc/thread-self/io, so an
+ * open or close is only visible as its effect on the context switches.
+ */
+
+#include "AllocCounters.hpp"
+
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#ifdef ALLOC_COUNTERS
+
+static thread_local uint64_t threadAllocations = 0;
+static thread_local uint64_t threadBytes = 0;
+
+void *operator new(size_t size) {
+    threadAllocations++;
+    threadBytes += size;
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept {
+    threadAllocations++;
+    threadBytes += size;
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t&) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t&) noexcept {
+    free(p);
+}
+
+#endif
+
+AllocCounters::AllocCounters() :
+    _started(false),
+    _frames(0)
+{
+    memset(&_start, 0, sizeof(_start));
+}
+
+/* True in the ALLOC_COUNTERS build */
+bool AllocCounters::isEnabled() {
+#ifdef ALLOC_COUNTERS
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* Take the calling thread's counters as the base, frames are counted from here on */
+void AllocCounters::start() {
+    if (!isEnabled())
+        return;
+    _start = sample();
+    _frames = 0;
+    _started = true;
+}
+
+/* Costs per frame since start() on the calling thread, empty in a normal build or before start() */
+std::string AllocCounters::report() const {
+    if (!_started)
+        return "";
+    Sample now = sample();
+    double frames = _frames ? _frames : 1;
+    char line[256];
+    snprintf(line, sizeof(line), "Per frame after warm-up (%lu frames): %.2f allocations (%.0f bytes), "
+             "%.2f read and %.2f write syscalls, %.2f context switches", _frames,
+             (now.allocations - _start.allocations) / frames, (now.bytes - _start.bytes) / frames,
+             (now.reads - _start.reads) / frames, (now.writes - _start.writes) / frames,
+             (now.switches - _start.switches) / frames);
+    return line;
+}
+
+/* Read without iostreams or the heap, so taking a sample does not count against the thread */
+AllocCounters::Sample AllocCounters::sample() {
+    Sample sample;
+    memset(&sample, 0, sizeof(sample));
+#ifdef ALLOC_COUNTERS
+    sample.allocations = threadAllocations;
+    sample.bytes = threadBytes;
+#endif
+    char buffer[512];
+    int fd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+    ssize_t length = fd != -1 ? read(fd, buffer, sizeof(buffer) - 1) : -1;
+    if (fd != -1)
+        close(fd);
+    if (length > 0) {
+        buffer[length] = '\0';
+        const char *syscr = strstr(buffer, "syscr: ");
+        const char *syscw = strstr(buffer, "syscw: ");
+        sample.reads = syscr ? strtoull(syscr + 7, NULL, 10) : 0;
+        sample.writes = syscw ? strtoull(syscw + 7, NULL, 10) : 0;
+    }
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) == 0)
+        sample.switches = usage.ru_nvcsw + usage.ru_nivcsw;
+    return sample;
+}
@@ -9,17 +9,52 @@
 
 #include "App.hpp"
 
+#include "CaptureGraph.hpp"
 #include "ConsumerThread.hpp"
+#include "EncodeScheduler.hpp"
+#include "FrameSetCollector.hpp"
+#include "ClusterLink.hpp"
+#include "CompositeRecorder.hpp"
+#include "PreviewCompositor.hpp"
+#include "SnapshotSink.hpp"
+#include "RtpSink.hpp"
+#include "StatusWriter.hpp"
+#include "SessionEvents.hpp"
+#include "FramePublisher.hpp"
+#include "ControlServer.hpp"
+#include "ThermalGovernor.hpp"
+#include "CapacityForecast.hpp"
+#include "TriggerInput.hpp"
+#include "StorageBench.hpp"
+#include "RunVerifier.hpp"
+#include "VolumeSet.hpp"
+#include "BackpressureEngine.hpp"
+#include "SegmentUploader.hpp"
+#include "QuickLookServer.hpp"
+#include "TraceLog.hpp"
+#include "LatencyHistogram.hpp"
+#include "MemoryBudget.hpp"
+#include "RawWriter.hpp"
+#include "DequeueLoops.hpp"
 #include "Options.hpp"
 #include "Logger.hpp"
+#include "LogSink.hpp"
+#include "NvApplicationProfiler.h"
 #include <Argus/Argus.h>
 #include <EGLStream/EGLStream.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
 
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 
 using namespace Argus;
@@ -27,13 +62,94 @@ using namespace EGLStream;
 
 #define MKDIR_MODE 0777
 #define STDOUT_PRINT true
+#define VIDEO_ENCODER_PIXEL_RATE (3840ULL * 2160ULL * 60ULL) // TX2 NVENC capacity, 4K @ 60 fps
+#define HEALTH_CHECK_MS 250 // longest the supervisor sleeps without an event
+#define COMPOSITE_MAX_SIDE 16384U // widest and tallest image NVJPG encodes
+#define STALL_TIMEOUT_MS 2000 // warn if a connected camera delivers no frame for this long
+#define RESTART_BACKOFF_MS 1000 // wait before a camera's next restart, times the attempts it already had
+#define RESTART_RELEASE_MS 2000 // longest a consumer takes to let go of its ended stream
+#define RESTART_IDLE_NS 1000000000ULL // longest a failed session's captures in flight are waited for
+#define SHOT_IDLE_NS 1000000000ULL // longest the last repeats before the time-lapse are waited for
+#define SHOT_DRAIN_MS 500 // the consumers take the frames the last repeats left in their streams before the first shot
+#define SHOT_POLL_MS 5 // how often a shot's saved frames are counted until every camera has one
+#define PROFILER_INTERVAL_MS 500 // system.csv sampling period with --profile
+#define PRE_TRIGGER_MEMORY_SHARE 0.5 // most of the memory the CPU, GPU and ISP share the pre-trigger rings may hold
 
-bool App::_doRun = true;
+/* Log how long the startup phase ending now took, trace it and restart the phase clock */
+static void logPhase(Logger *logger, const char *phase, std::chrono::steady_clock::time_point& since) {
+    auto now = std::chrono::steady_clock::now();
+    std::stringstream ss;
+    ss << "Startup phase " << phase << ": "
+       << std::chrono::duration_cast<std::chrono::milliseconds>(now - since).count() << " ms";
+    logger->log(ss.str());
+    TraceLog::instance().span(phase,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(since.time_since_epoch()).count(),
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count());
+    since = now;
+}
+
+/* Restart the one camera whose stream failed or stalled while the others keep capturing: stop its
+   session, end its stream so the consumer lets go of it, recreate session, stream and request, hand
+   the new stream to the consumer and submit. Return bool indicating the camera captures again, a
+   failure leaves it down for a later attempt */
+static bool restartCamera(Logger *logger, const Options& options, CaptureGraph& graph, uint32_t camera, int stream,
+                          ConsumerThread *consumer, std::vector<SessionEvents*>& sessionEvents) {
+    std::string name = "Camera " + std::to_string(camera);
+    if (!graph.stopCamera(camera, RESTART_IDLE_NS))
+        logger->log(name + ": " + graph.getError() + ", restarting anyway", STDOUT_PRINT);
+    if (sessionEvents[camera]) {
+        sessionEvents[camera]->shutdown();
+        delete sessionEvents[camera];
+        sessionEvents[camera] = NULL;
+    }
+
+    /* The session can only go once the consumer has destroyed its FrameConsumer */
+    graph.endStream(stream);
+    for (uint32_t waited = 0; !consumer->isStreamLost() && consumer->isExecuting() && waited < RESTART_RELEASE_MS; waited++)
+        usleep(1000);
+    if (!consumer->isStreamLost()) {
+        logger->log(name + ": the consumer did not let go of its stream", STDOUT_PRINT);
+        return false;
+    }
+
+    if (!graph.restartCamera(camera)) {
+        logger->log(name + ": " + graph.getError(), STDOUT_PRINT);
+        return false;
+    }
+    sessionEvents[camera] = new SessionEvents(camera, graph.getSession(camera), options);
+    if (!sessionEvents[camera]->initialize() || !sessionEvents[camera]->waitRunning()) {
+        logger->log(name + ": failed to start the session event thread", STDOUT_PRINT);
+        return false;
+    }
+    consumer->reconnect(graph.getStream(stream));
+    if (!graph.submit(camera)) {
+        logger->log(name + ": " + graph.getError(), STDOUT_PRINT);
+        return false;
+    }
+    return true;
+}
+
+/* Pause or resume saving on every camera at once */
+static void setEveryPaused(ConsumerThread **consumers, int numCameras, bool pause) {
+    for (int i = 0; i < numCameras; i++) {
+        CameraControl update;
+        memset(&update, 0, sizeof(update));
+        update.pause = pause ? 1 : -1;
+        consumers[i]->control(update);
+    }
+}
+
+std::atomic<bool> App::_doRun(true);
+std::atomic<bool> App::_togglePause(false);
+std::atomic<bool> App::_trigger(false);
+int App::_eventFd = -1;
 App::App() :
     _options(new Options)
 {}
 
 App::~App() {
+    if (_eventFd != -1)
+        close(_eventFd);
     delete _options;
 }
 
@@ -42,12 +158,22 @@ bool App::run(int argc, char * argv[]) {
     /* Repeatedly use this value for error handling */
     bool errorOccurred = false;
 
+    /* Time each startup phase, the log has no directory until the options are parsed */
+    auto startupBegin = std::chrono::steady_clock::now();
+    auto phaseBegin = startupBegin;
+
+    /* Create the eventfd the signal handler and consumers wake the supervisor with */
+    _eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    errorOccurred = _eventFd == -1;
+
     /* Register signal callback to various signals (ctrl+c, ctrl+d, etc...)
        Lazy OR means lines are executed if errorOccurred is not already true */
     errorOccurred = errorOccurred || signal(SIGHUP, signalCallback) == SIG_ERR;
     errorOccurred = errorOccurred || signal(SIGINT, signalCallback) == SIG_ERR;
     errorOccurred = errorOccurred || signal(SIGQUIT, signalCallback) == SIG_ERR;
     errorOccurred = errorOccurred || signal(SIGTERM, signalCallback) == SIG_ERR;
+    errorOccurred = errorOccurred || signal(SIGUSR1, pauseCallback) == SIG_ERR;
+    errorOccurred = errorOccurred || signal(SIGUSR2, triggerCallback) == SIG_ERR;
 
     /* Create the logger object, don't log until directory path is set in options */
     Logger *logger = NULL;
@@ -80,21 +206,51 @@ bool App::run(int argc, char * argv[]) {
             logger->disableVerbose();
     } 
 
+    /* Record the timeline from the first startup phase on, before any thread to trace starts */
+    if (!errorOccurred && _options->trace) {
+        TraceLog::instance().enable();
+        TraceLog::instance().nameThread("PRODUCER");
+    }
+
+    /* A daemon outlives the terminal that started it */
+    if (!errorOccurred && _options->daemonMode)
+        errorOccurred = signal(SIGHUP, SIG_IGN) == SIG_ERR;
+
+    /* With --bench-storage the candidate volumes are benchmarked instead of recording */
+    if (!errorOccurred && _options->benchCameras > 0) {
+        StorageBench bench(*_options);
+        return bench.run(_doRun);
+    }
+
+    /* With --verify a finished run is checked against its checksums instead of recording */
+    if (!errorOccurred && !_options->verifyPath.empty()) {
+        RunVerifier verifier(*_options);
+        return verifier.run(_doRun);
+    }
+
     /* Search for available usb device and pre-append options directory to reflect changes
      * Eg. If we choose directory "bar" and a device is found mounted at /media/nvidia/foo/
      * the resultant path should be /media/nvidia/foo/bar/
      * Eg. If we choose directory "bar" and no device is found
      * the resultant path should be ./bar/
+     * With --volumes the root directory goes on the first listed volume instead
      */
-    if (!errorOccurred) {
+    if (!errorOccurred && _options->volumes.empty()) {
         if (_options->verbose)
             std::cout << "Searching for first available volume...\n";
-        std::string path = getAvailableDevice();
-        if (path.size() == 0)
+        std::string path = VolumeSet::findMostFreeVolume();
+        if (path.size() == 0) {
             std::cout << "Volume not found, falling back to saving on system memory...\n";
-        else
+            path = ".";
+        } else {
             std::cout << "Using volume mounted at: " << path << "\n";
-        strncat(&path[0], _options->directory, FILENAME_MAX);    // pre-append the resultant path to the chosen directory name
+        }
+        _options->volumes.push_back(path);
+    } else if (!errorOccurred) {
+        std::cout << "Spreading images over " << _options->volumes.size() << " volumes, root on: " << _options->volumes[0] << "\n";
+    }
+    if (!errorOccurred) {
+        std::string path = VolumeSet::join(_options->volumes[0], _options->directory);
         strncpy(_options->directory, path.data(), FILENAME_MAX); // copy the full path to the options directory
     }
     logger->setDirectory(_options->directory);
@@ -108,330 +264,1019 @@ bool App::run(int argc, char * argv[]) {
         }
     }
 
-    /* Create the CameraProvider object and get the core interface */
-    UniqueObj<CameraProvider> cameraProvider;
-    ICameraProvider *iCameraProvider = NULL;
-    if (!errorOccurred) {
-        logger->log("Getting the camera provider...");
-        cameraProvider.reset(CameraProvider::create());
-        iCameraProvider = interface_cast<ICameraProvider>(cameraProvider);
-        if (!iCameraProvider) {
-            logger->error("An error occured while creating the camera provider! Exiting...");
-            errorOccurred = true;
-        }
-    }
+    /* The multimedia API's messages go to the log file from here on, its encoder threads never wait on stderr */
+    if (!errorOccurred)
+        LogSink::instance().captureLibrary(std::string(_options->directory) + "/log.txt");
+    if (!errorOccurred)
+        logPhase(logger, "options", phaseBegin);
 
-    /* Get the camera devices */
-    std::vector<CameraDevice*> cameraDevices;
+    /* Create the camera provider and get the camera devices */
+    CaptureGraph graph;
     if (!errorOccurred) {
         logger->log("Getting the camera devices...");
-        iCameraProvider->getCameraDevices(&cameraDevices);
-        if (cameraDevices.size() == 0) {
-            logger->error("No cameras available! Exiting...");
+        if (!graph.open(0)) {
+            logger->error(graph.getError() + "! Exiting...");
             errorOccurred = true;
         }
     }
-    uint8_t numCameras = cameraDevices.size();
+    if (!errorOccurred)
+        logPhase(logger, "camera devices", phaseBegin);
+    uint8_t numCameras = graph.getCameraCount();
+    if (numCameras > 0)
+        _options->cameraCount = numCameras;
 
-    /* Create the capture session using the first device and get the core interface */
-    UniqueObj<CaptureSession> captureSessions[numCameras];
-    ICaptureSession *iCaptureSessions[numCameras];
+    /* Create one capture session per device, or one over every device so a single request triggers all sensors */
     if (!errorOccurred) {
-        logger->log("Creating the capture sessions...");
-        for (uint8_t i = 0; i < numCameras && !errorOccurred; i++) {
-            Argus::Status status;
-            captureSessions[i].reset(iCameraProvider->createCaptureSession(cameraDevices[i], &status));
-            iCaptureSessions[i] = interface_cast<ICaptureSession>(captureSessions[i]);
-            if (status == STATUS_UNAVAILABLE) {
-                logger->error("Camera device unavailable, try rebooting. Exiting...");
-                errorOccurred = true;
-            } else if (!iCaptureSessions[i]) {
-                logger->error("Failed to get ICaptureSession interface! Exiting...");
-                errorOccurred = true;
-            }
+        logger->log(_options->syncSession ? "Creating the shared capture session..." : "Creating the capture sessions...");
+        if (!graph.createSessions(_options->syncSession)) {
+            logger->error(graph.getError() + "! Exiting...");
+            errorOccurred = true;
         }
     }
+    if (!errorOccurred)
+        logPhase(logger, "capture sessions", phaseBegin);
 
     /* Verify the selected sensor mode */
-    ICameraProperties *iCameraProperties = NULL;
-    std::vector<SensorMode*> sensorModes;
     SensorMode *sensorMode = NULL;
     ISensorMode *iSensorMode = NULL;
     if (!errorOccurred) {
         logger->log("Verifying the selected sensor mode...");
-        iCameraProperties = interface_cast<ICameraProperties>(cameraDevices[0]);
-        if (!iCameraProperties) {
-            logger->error("Failed to get ICameraProperties interface! Exiting...");
+        sensorMode = graph.getSensorMode(_options->captureMode);
+        if (!sensorMode && _options->captureMode != CAPTURE_MODE_0) {
+            logger->log("Unable to set selected sensor mode, setting to default...", STDOUT_PRINT);
+            _options->captureMode = CAPTURE_MODE_0;
+            sensorMode = graph.getSensorMode(_options->captureMode);
+        }
+        iSensorMode = interface_cast<ISensorMode>(sensorMode);
+        if (!sensorMode) {
+            logger->error(graph.getError() + "! Exiting...");
+            errorOccurred = true;
+        } else if (!iSensorMode) {
+            logger->error("Failed to get ISensorMode interface! Exiting...");
+            errorOccurred = true;
+        } else {
+            _options->captureResolution = iSensorMode->getResolution();
+            _options->captureFrameDuration = iSensorMode->getFrameDurationRange().min();
+            std::stringstream ss;
+            ss << "Sensor mode " << _options->captureMode << ": " << _options->captureResolution.width() << "x"
+               << _options->captureResolution.height() << " @ " << 1e9 / _options->captureFrameDuration << " fps";
+            logger->log(ss.str(), STDOUT_PRINT);
+        }
+    }
+
+    /* Each camera's sensor runs at its frame rate stretched by its save every, so only the frames we save
+       are produced, unless a sensor cannot run that slow */
+    for (uint8_t i = 0; i < numCameras && !errorOccurred && !_options->fullRate; i++) {
+        if (_options->getFrameDuration(i) > iSensorMode->getFrameDurationRange().max()) {
+            logger->log("Sensor mode cannot run slow enough for --save-every, capturing at full rate instead", STDOUT_PRINT);
+            _options->fullRate = true;
+        }
+    }
+    for (uint8_t i = 0; i < numCameras && !errorOccurred; i++) {
+        std::stringstream ss;
+        ss << "Camera " << (int) i << " captures at " << 1e9 / _options->getFrameDuration(i) << " fps, saving 1 in "
+           << _options->getFrameStride(i) << " frames";
+        if (_options->stagger)
+            ss << ", staggered by " << _options->getStaggerFrame(i, _options->getFrameStride(i)) << " frames and "
+               << _options->getStaggerDelay(i) / 1000 << " us";
+        if (_options->getFrameDuration(i) > iSensorMode->getFrameDurationRange().max()) {
+            logger->error(ss.str() + ", slower than the sensor mode allows! Exiting...");
+            errorOccurred = true;
+        } else {
+            logger->log(ss.str(), STDOUT_PRINT);
+        }
+    }
+
+    /* Check the combined video encoder load, sessions beyond the encoder's capacity drop frames */
+    if (!errorOccurred && _options->isVideoFormat()) {
+        uint64_t pixelRate = 0;
+        for (uint8_t i = 0; i < numCameras; i++)
+            pixelRate += (uint64_t) _options->captureResolution.area() * (1000000000ULL / _options->getFrameDuration(i))
+                         / _options->getFrameStride(i);
+        std::stringstream ss;
+        ss << "Video encoder load: " << numCameras << " sessions, " << pixelRate / 1000000
+           << " Mpixel/s of " << VIDEO_ENCODER_PIXEL_RATE / 1000000 << " Mpixel/s available";
+        logger->log(ss.str(), STDOUT_PRINT);
+        if (pixelRate > VIDEO_ENCODER_PIXEL_RATE)
+            logger->log("Video encoder capacity exceeded, increase --save-every to avoid dropped frames", STDOUT_PRINT);
+    }
+
+    /* Bayer records take the sensor's samples as they are, the mode must deliver Bayer samples that pack into 12 bits.
+       A packed record is as large as an i420 one, what the ISP, its YUV conversion and the VIC copy cost is saved */
+    if (!errorOccurred && _options->isBayer()) {
+        _options->captureBitDepth = iSensorMode->getOutputBitDepth();
+        uint64_t pixelRate = 0;
+        for (uint8_t i = 0; i < numCameras; i++)
+            pixelRate += (uint64_t) _options->captureResolution.area() * (1000000000ULL / _options->getFrameDuration(i))
+                         / _options->getFrameStride(i);
+        if (iSensorMode->getSensorModeType() != SENSOR_MODE_TYPE_BAYER || _options->captureBitDepth > RAW_PACKED_BITS) {
+            logger->error("Sensor mode " + std::to_string(_options->captureMode) + " has no Bayer output of at most "
+                          + std::to_string(RAW_PACKED_BITS) + " bits, as --raw-layout bayer12 needs! Exiting...");
+            errorOccurred = true;
+        } else {
+            std::stringstream ss;
+            ss << "Bayer capture: " << _options->captureBitDepth << " bit samples packed to " << RAW_PACKED_BITS
+               << " bit with the ISP bypassed, " << numCameras << " sessions, " << pixelRate / 1000000 << " Mpixel/s, "
+               << (pixelRate * RAW_PACKED_BITS / 8 >> 20) << " MiB/s of records";
+            logger->log(ss.str(), STDOUT_PRINT);
+        }
+    }
+
+    /* Check the pre-trigger rings fit, each held frame is a full YUV420 NvBuffer */
+    if (!errorOccurred && _options->preTriggerFrames > 0) {
+        uint64_t frameBytes = (uint64_t) _options->captureResolution.area() * 3 / 2;
+        uint64_t ringBytes = frameBytes * _options->preTriggerFrames * numCameras;
+        uint64_t memoryBytes = (uint64_t) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE);
+        std::stringstream ss;
+        ss << "Pre-trigger rings: " << _options->preTriggerFrames << " frames per camera, "
+           << (ringBytes >> 20) << " MiB of " << (memoryBytes >> 20) << " MiB memory";
+        if (ringBytes > memoryBytes * PRE_TRIGGER_MEMORY_SHARE) {
+            logger->error(ss.str() + ", more than " + std::to_string((int) (PRE_TRIGGER_MEMORY_SHARE * 100))
+                          + "%, lower --pre-trigger! Exiting...");
+            errorOccurred = true;
+        } else {
+            logger->log(ss.str(), STDOUT_PRINT);
+        }
+    }
+
+    /* Check each camera's crop fits the sensor frame, NVJPG only scales down */
+    for (uint8_t i = 0; i < numCameras && !errorOccurred && _options->format == FORMAT_JPEG && _options->hasEncodeGeometry(); i++) {
+        Rectangle<uint32_t> crop = _options->getCrop(i);
+        Size2D<uint32_t> size = _options->getEncodeSize(i);
+        std::stringstream ss;
+        ss << "Camera " << (int) i << " encodes " << crop.width() << "x" << crop.height() << "+" << crop.left()
+           << "+" << crop.top() << " of " << _options->captureResolution.width() << "x"
+           << _options->captureResolution.height() << " at " << size.width() << "x" << size.height();
+        if (crop.right() > _options->captureResolution.width() || crop.bottom() > _options->captureResolution.height()) {
+            logger->error(ss.str() + ", the crop lies outside the sensor frame! Exiting...");
+            errorOccurred = true;
+        } else if (size.width() > crop.width() || size.height() > crop.height()) {
+            logger->error(ss.str() + ", larger than the crop! Exiting...");
+            errorOccurred = true;
+        } else if (_options->isProxyEnabled() && (_options->proxyResolution.width() > crop.width()
+                                                  || _options->proxyResolution.height() > crop.height())) {
+            logger->error(ss.str() + ", smaller than the proxy! Exiting...");
+            errorOccurred = true;
+        } else {
+            logger->log(ss.str(), STDOUT_PRINT);
+        }
+    }
+
+    /* Check every camera gets a tile and the composite is one NVJPG can encode */
+    if (!errorOccurred && _options->composite) {
+        Size2D<uint32_t> canvas = CompositeRecorder::getCanvasSize(*_options, numCameras);
+        std::stringstream ss;
+        ss << "Composite of " << (int) numCameras << " cameras: " << canvas.width() << "x" << canvas.height();
+        if (numCameras > MAX_COMPOSITE_FRAME) {
+            logger->error(ss.str() + ", NvBufferComposite takes at most " + std::to_string(MAX_COMPOSITE_FRAME)
+                          + " sources! Exiting...");
+            errorOccurred = true;
+        } else if (canvas.width() > COMPOSITE_MAX_SIDE || canvas.height() > COMPOSITE_MAX_SIDE) {
+            logger->error(ss.str() + ", larger than the encoder takes, use smaller --composite tiles! Exiting...");
             errorOccurred = true;
         } else {
-            iCameraProperties->getBasicSensorModes(&sensorModes);
-            if (sensorModes.size() == 0) {
-                logger->error("Failed to get sensor modes! Exiting...");
+            logger->log(ss.str(), STDOUT_PRINT);
+        }
+    }
+
+    /* Check each camera's ROI regions lie in the encoded frame */
+    for (uint8_t i = 0; i < numCameras && !errorOccurred && _options->isVideoFormat(); i++) {
+        const std::vector<RoiRegion>& regions = _options->getRois(i);
+        for (size_t r = 0; r < regions.size() && !errorOccurred; r++) {
+            if (regions[r].rect.right() > _options->captureResolution.width()
+                    || regions[r].rect.bottom() > _options->captureResolution.height()) {
+                std::stringstream ss;
+                ss << "Camera " << (int) i << " ROI " << regions[r].rect.width() << "x" << regions[r].rect.height()
+                   << "+" << regions[r].rect.left() << "+" << regions[r].rect.top() << " lies outside the "
+                   << _options->captureResolution.width() << "x" << _options->captureResolution.height()
+                   << " frame! Exiting...";
+                logger->error(ss.str());
                 errorOccurred = true;
-            } else if (_options->captureMode > sensorModes.size()) {
-                logger->log("Unable to set selected sensor mode, setting to default...", STDOUT_PRINT);
-                _options->captureMode = CAPTURE_MODE_0;
-            } else {
-                sensorMode = sensorModes[_options->captureMode];
-                iSensorMode = interface_cast<ISensorMode>(sensorMode);
-                if (!iSensorMode) {
-                    logger->error("Failed to get ISensorMode interface! Exiting...");
-                    errorOccurred = true;
-                } else {
-                    _options->captureResolution = iSensorMode->getResolution();
-                }
             }
         }
     }
 
+    /* Size every subsystem's buffers against the memory budget before any is allocated, Argus' own are charged now */
+    if (!errorOccurred) {
+        MemoryBudget::instance().configure((uint64_t) _options->memoryBudget << 20, _options->memoryLock);
+        uint64_t planned[MEMORY_SUBSYSTEMS];
+        MemoryBudget::plan(*_options, numCameras, planned);
+        std::string message;
+        if (!MemoryBudget::instance().check(planned, message)) {
+            logger->error(message + "! Exiting...");
+            errorOccurred = true;
+        } else {
+            logger->log(message, STDOUT_PRINT);
+            MemoryBudget::instance().reserve(MEMORY_EGL_STREAMS, planned[MEMORY_EGL_STREAMS]);
+        }
+    }
+
     /* Write the options object to file */
     if (!errorOccurred) {
         logger->log("Writing the command line options to a file...");
         _options->write();
     }
+    if (!errorOccurred)
+        logPhase(logger, "sensor mode", phaseBegin);
 
-    /* Initialize the settings of output stream */
-    UniqueObj<OutputStream> captureStreams[numCameras];
+    /* The consumers wrap the capture buffers of a buffer stream in EGLImages on the default display */
+    EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+    if (!errorOccurred && _options->zeroCopy) {
+        logger->log("Initializing the EGL display...");
+        eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, NULL, NULL)) {
+            logger->error("Failed to initialize the EGL display! Exiting...");
+            eglDisplay = EGL_NO_DISPLAY;
+            errorOccurred = true;
+        }
+    }
+
+    /* Create the output streams, a buffer stream takes its resolution from the consumer's buffers */
+    int captureStreams[numCameras];
     if (!errorOccurred) {
         logger->log("Creating the output streams...");
         for (uint8_t i = 0; i < numCameras && !errorOccurred; i++) {
-            UniqueObj<OutputStreamSettings> streamSettings(iCaptureSessions[i]->createOutputStreamSettings(STREAM_TYPE_EGL));
-            IEGLOutputStreamSettings *iEglStreamSettings = interface_cast<IEGLOutputStreamSettings>(streamSettings);
-            if (!iEglStreamSettings) {
-                logger->error("Failed to get IEGLOutputStreamSettings interface! Exiting...");
+            CaptureStreamType type = _options->zeroCopy ? CAPTURE_STREAM_BUFFER
+                                     : _options->isBayer() ? CAPTURE_STREAM_BAYER : CAPTURE_STREAM_EGL;
+            captureStreams[i] = graph.addStream(i, type, _options->captureResolution, _options->getEglFifo(i));
+            if (captureStreams[i] < 0) {
+                logger->error(graph.getError() + "! Exiting...");
+                errorOccurred = true;
+            }
+        }
+    }
+
+    /* Report what each FIFO slot beyond the mailbox's one frame costs, a YUV420 frame each or a RAW16 one */
+    if (!errorOccurred && !_options->eglFifo.empty()) {
+        uint64_t area = _options->captureResolution.area();
+        uint64_t frameBytes = _options->isBayer() ? area * 2 : area * 3 / 2;
+        for (uint8_t i = 0; i < numCameras; i++) {
+            uint32_t fifo = _options->getEglFifo(i);
+            std::stringstream ss;
+            ss << "Camera " << (int) i << ": ";
+            if (fifo == 0)
+                ss << "EGLStream mailbox";
+            else
+                ss << "EGLStream FIFO of " << fifo << " frames, " << frameBytes / 1024 << " KiB per slot, "
+                   << (fifo - 1) * frameBytes / (1 << 20) << " MiB more than a mailbox";
+            logger->log(ss.str(), STDOUT_PRINT);
+        }
+    }
+
+    /* Add the small preview stream next to each capture stream, always an EGL mailbox
+       so the preview can only ever lose its own frames */
+    std::vector<int> previewStreams;
+    if (!errorOccurred && _options->isPreviewEnabled()) {
+        logger->log("Creating the preview streams...");
+        for (uint8_t i = 0; i < numCameras && !errorOccurred; i++) {
+            previewStreams.push_back(graph.addStream(i, CAPTURE_STREAM_EGL, _options->previewResolution));
+            if (previewStreams[i] < 0) {
+                logger->error(graph.getError() + "! Exiting...");
                 errorOccurred = true;
-            } else {
-                iEglStreamSettings->setPixelFormat(PIXEL_FMT_YCbCr_420_888);
-                iEglStreamSettings->setEGLDisplay(EGL_NO_DISPLAY);
-                iEglStreamSettings->setResolution(_options->captureResolution);
-                captureStreams[i] = (UniqueObj<OutputStream>) iCaptureSessions[i]->createOutputStream(streamSettings.get());
-                if (!captureStreams[i]) {
-                    logger->error("Failed to create capture stream! Exiting...");
-                    errorOccurred = true;
-                }
             }
         }
     }
+    if (!errorOccurred)
+        logPhase(logger, "output streams", phaseBegin);
+
+    /* Launch the JPEG encoder workers shared by all consumers */
+    EncodeScheduler *scheduler = NULL;
+    if (!errorOccurred && _options->format == FORMAT_JPEG) {
+        logger->log("Launching the encode scheduler...");
+        scheduler = new EncodeScheduler(*_options, numCameras);
+        if (!scheduler || !scheduler->start()) {
+            logger->error("Failed to start the encode scheduler! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Lead or join the other boards, a follower waits here until the leader is up */
+    ClusterLink *cluster = NULL;
+    if (!errorOccurred && _options->clusterRole != CLUSTER_ROLE_NONE) {
+        logger->log("Launching the cluster link...");
+        cluster = new ClusterLink(*_options);
+        if (!cluster || !cluster->initialize() || !cluster->waitRunning()) {
+            logger->error("Failed to start the cluster link! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Launch the collector grouping the cameras' frames into sets */
+    FrameSetCollector *collector = NULL;
+    if (!errorOccurred && _options->frameSetTolerance > 0) {
+        logger->log("Launching the frame set collector...");
+        collector = new FrameSetCollector(*_options, numCameras, cluster);
+        if (!collector || !collector->initialize() || !collector->waitRunning()) {
+            logger->error("Failed to start the frame set collector! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Create the run directory on the other volumes and open the frame placement index */
+    VolumeSet *volumes = NULL;
+    if (!errorOccurred) {
+        logger->log("Preparing the output volumes...");
+        volumes = new VolumeSet(*_options, numCameras + (_options->composite ? 1 : 0)); // the composites are one more camera
+        if (!volumes || !volumes->open()) {
+            logger->error("Failed to prepare the output volumes! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Launch the recorder tiling every frame set into one image, the consumers hand it their slots */
+    CompositeRecorder *composite = NULL;
+    if (!errorOccurred && _options->composite) {
+        logger->log("Launching the composite recorder...");
+        composite = new CompositeRecorder(*_options, numCameras, volumes);
+        if (!composite || !composite->initialize() || !composite->waitRunning()) {
+            logger->error("Failed to start the composite recorder! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Start the threads dequeueing every video encoder's bitstream plane in place of one thread per encoder */
+    if (!errorOccurred && _options->dqLoops > 0) {
+        logger->log("Starting the dequeue loops...");
+        if (!DequeueLoops::instance().open(_options->dqLoops)) {
+            logger->error("Failed to start the dequeue loops! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Open the backpressure decision log, consumers consult the engine for every frame */
+    BackpressureEngine *backpressure = NULL;
+    if (!errorOccurred && _options->backpressure) {
+        logger->log("Preparing the backpressure engine...");
+        backpressure = new BackpressureEngine(*_options, numCameras);
+        if (!backpressure || !backpressure->open()) {
+            logger->error("Failed to prepare the backpressure engine! Exiting...");
+            errorOccurred = true;
+        }
+    }
+    /* Send closed segments to the ground station in the background */
+    SegmentUploader *uploader = NULL;
+    if (!errorOccurred && _options->offloadPort > 0) {
+        uploader = new SegmentUploader(*_options, *volumes);
+        if (!uploader || !uploader->initialize() || !uploader->waitRunning()) {
+            logger->error("Failed to start the segment offload! Exiting...");
+            errorOccurred = true;
+        }
+    }
+    if (!errorOccurred)
+        logPhase(logger, "encoder and volumes", phaseBegin);
+
+    /* Open the share socket before any frame is saved */
+    FramePublisher *publisher = NULL;
+    if (!errorOccurred && !_options->sharePath.empty()) {
+        publisher = new FramePublisher(*_options, numCameras);
+        if (!publisher || !publisher->initialize() || !publisher->waitRunning()) {
+            logger->error("Failed to start sharing frames! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Serve thumbnails of the images the writers publish */
+    QuickLookServer *quickLook = NULL;
+    if (!errorOccurred && _options->quickLookPort > 0) {
+        quickLook = new QuickLookServer(*_options, numCameras);
+        if (!quickLook || !quickLook->initialize() || !quickLook->waitRunning()) {
+            logger->error("Failed to start the quick-look server! Exiting...");
+            errorOccurred = true;
+        }
+    }
 
-    /* Launch the threads to consume frames from the OutputStream */
+    /* Create the threads to consume frames from the OutputStream */
     ConsumerThread *consumers[numCameras];
     uint8_t numThreadsCreated = 0;
-    uint8_t numThreadsInitialized = 0;
     if (!errorOccurred) {
-        logger->log("Launching consumer threads...");
-        for (uint8_t i = 0; i < numCameras  && !errorOccurred; i++) {
-            consumers[i] = new ConsumerThread(captureStreams[i].get(), i, *_options);
+        for (uint8_t i = 0; i < numCameras && !errorOccurred; i++) {
+            consumers[i] = new ConsumerThread(graph.getStream(captureStreams[i]), i, *_options, scheduler, collector, volumes,
+                                              backpressure, publisher, quickLook, composite, _eventFd);
             numThreadsCreated = i + 1;
-            if (!consumers[i]) {
-                logger->error("Failed to create consumer thread! Exiting...");
-                errorOccurred = true;
-            } else if (!consumers[i]->initialize()) {
-                logger->error("Failed to initialize consumer thread! Exiting...");
+            if (!graph.registerConsumer(consumers[i])) {
+                logger->error(graph.getError() + "! Exiting...");
                 errorOccurred = true;
-            } else {
-                numThreadsInitialized = i + 1;
             }
         }
     }
 
-    /* Wait until the consumer thread is connected to the stream */
+    /* Create the preview sources draining the preview streams and the compositor tiling them */
+    PreviewCompositor *preview = NULL;
+    if (!errorOccurred && _options->isPreviewEnabled()) {
+        std::vector<OutputStream*> streams;
+        for (uint8_t i = 0; i < numCameras; i++)
+            streams.push_back(graph.getStream(previewStreams[i]));
+        preview = new PreviewCompositor(*_options, streams);
+        preview->addSink(new SnapshotSink(*_options));
+        if (_options->streamPort > 0)
+            preview->addSink(new RtpSink(*_options));
+        for (uint8_t i = 0; i < numCameras; i++)
+            graph.registerConsumer(preview->getSource(i));
+        graph.registerConsumer(preview);
+    }
+
+    /* Launch every consumer and wait until each is connected to its stream, they set up concurrently */
     if (!errorOccurred) {
-        logger->log("Waiting for the consumer threads...");
-        for (uint8_t i = 0; i < numCameras && !errorOccurred; i++) {
-            if (!consumers[i]->waitRunning()) {
-                logger->error("Failed to start consumer thread! Exiting...");
-                errorOccurred = true;
-            }
+        logger->log("Launching consumer threads...");
+        if (!graph.startConsumers()) {
+            logger->error(graph.getError() + "! Exiting...");
+            errorOccurred = true;
         }
     }
+    if (!errorOccurred)
+        logPhase(logger, "consumers", phaseBegin);
 
-    /* Create capture request and enable its output stream */
-    UniqueObj<Request> requests[numCameras];
+    /* Create a capture request per session and enable its output streams */
     if (!errorOccurred) {
         logger->log("Creating capture requests and enabling output streams...");
-        for (uint8_t i = 0; i < numCameras && !errorOccurred; i++) {
-            requests[i].reset(iCaptureSessions[i]->createRequest());
-            IRequest *iRequest = interface_cast<IRequest>(requests[i]);
-            if (!iRequest) {
-                logger->error("Failed to get request interface! Exiting...");
-                errorOccurred = true;
-            } else {
-                ISourceSettings *iSourceSettings = interface_cast<ISourceSettings>(iRequest->getSourceSettings());
-                if (!iSourceSettings) {
-                    logger->error("Failed to get source settings interface! Exiting...");
-                    errorOccurred = true;
-                } else {
-                    iSourceSettings->setSensorMode(sensorMode);
-                    iSourceSettings->setFrameDurationRange(iSensorMode->getFrameDurationRange());
-                    iRequest->enableOutputStream(captureStreams[i].get());
-                }
-            }
+        std::vector<CaptureSettings> settings(numCameras);
+        for (uint8_t i = 0; i < numCameras; i++) {
+            settings[i].frameDuration = Range<uint64_t>(_options->getFrameDuration(i));
+            if (_options->getFrameDuration(i) == _options->captureFrameDuration)
+                settings[i].frameDuration = iSensorMode->getFrameDurationRange();
+            settings[i].exposureTime = _options->getExposureRange(i);
+            settings[i].gain = _options->getGainRange(i);
+            settings[i].denoise = (CaptureDenoise) _options->getDenoiseMode(i); // DENOISE_* match CaptureDenoise
+            settings[i].denoiseStrength = _options->getDenoiseStrength(i);
         }
+        errorOccurred = !graph.createRequests(sensorMode, settings);
+        for (uint8_t i = 0; i < numCameras && !errorOccurred; i++)
+            errorOccurred = !graph.enableStream(captureStreams[i], true);
+        for (uint8_t i = 0; i < previewStreams.size() && !errorOccurred; i++)
+            errorOccurred = !graph.enableStream(previewStreams[i], true);
+        if (errorOccurred)
+            logger->error(graph.getError() + "! Exiting...");
     }
 
-    /* Submit capture requests. */
-    uint8_t numSuccessfulRequests = 0;
+    /* Drain every session's events before the first capture can complete or fail */
+    std::vector<SessionEvents*> sessionEvents;
+    for (uint32_t i = 0; i < graph.getSessionCount() && !errorOccurred; i++) {
+        sessionEvents.push_back(new SessionEvents(i, graph.getSession(i), *_options));
+        if (!sessionEvents[i]->initialize() || !sessionEvents[i]->waitRunning()) {
+            logger->error("Failed to start the session event thread! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Submit capture requests. Staggered cameras start theirs in the order of their offsets, each that long after the first */
     if (!errorOccurred) {
         logger->log("Starting repeat capture requests...");
-        for (uint8_t i = 0; i < numCameras && !errorOccurred; i++) {
-            if (iCaptureSessions[i] && iCaptureSessions[i]->repeat(requests[i].get()) != STATUS_OK) {
-                logger->error("Failed to start repeat capture requests! Exiting...");
+        if (!_options->stagger && !graph.submit()) {
+            logger->error(graph.getError() + "! Exiting...");
+            errorOccurred = true;
+        }
+        std::vector<uint32_t> submitOrder;
+        for (uint32_t i = 0; i < graph.getSessionCount() && _options->stagger; i++)
+            submitOrder.push_back(i);
+        std::stable_sort(submitOrder.begin(), submitOrder.end(), [this](uint32_t a, uint32_t b) {
+            return _options->getStaggerDelay(a) < _options->getStaggerDelay(b);
+        });
+        auto submitStart = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < submitOrder.size() && !errorOccurred; i++) {
+            std::this_thread::sleep_until(submitStart + std::chrono::nanoseconds(_options->getStaggerDelay(submitOrder[i])));
+            if (!graph.submit(submitOrder[i])) {
+                logger->error(graph.getError() + "! Exiting...");
                 errorOccurred = true;
-            } else {
-                numSuccessfulRequests = i + 1;
             }
         }
     }
 
+    /* Open the control socket, its commands are served from the supervisor loop */
+    ControlServer *control = NULL;
+    if (!errorOccurred && !_options->controlPath.empty()) {
+        control = new ControlServer(*_options, graph, consumers, numCameras, iSensorMode->getFrameDurationRange(), cluster);
+        if (!control || !control->open()) {
+            logger->error("Failed to open the control socket! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Find the thermal zones and the power monitor, the governor samples them from the supervisor loop */
+    ThermalGovernor *governor = NULL;
+    if (!errorOccurred && _options->thermalMargin > 0) {
+        governor = new ThermalGovernor(*_options, graph, consumers, numCameras, iSensorMode->getFrameDurationRange());
+        if (!governor || !governor->open()) {
+            logger->error("Failed to prepare the thermal governor! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Forecast the recording time left from the images written, sampled from the supervisor loop */
+    CapacityForecast *forecast = NULL;
     if (!errorOccurred) {
+        forecast = new CapacityForecast(*_options, numCameras, volumes, backpressure);
+        if (!forecast || !forecast->open()) {
+            logger->error("Failed to create the capacity forecast! Exiting...");
+            errorOccurred = true;
+        }
+    }
 
-        /* Wait for captureTime seconds or until SIGINT is received. */
-        if (_options->captureTime > 0) {
-            time_t start = time(0);
-            while (_doRun && time(0) - start < _options->captureTime) {
-                sleep(1);
-                for (int i = 0; i < numCameras; i++) {
-                    if (!consumers[i]->isExecuting())
+    /* Watch the trigger line, its edges are served from the supervisor loop */
+    TriggerInput *triggerInput = NULL;
+    if (!errorOccurred && _options->triggerGpio >= 0) {
+        triggerInput = new TriggerInput(_options->triggerGpio);
+        if (!triggerInput || !triggerInput->open()) {
+            logger->error((triggerInput ? triggerInput->getError() : std::string("Failed to create the trigger input")) + "! Exiting...");
+            errorOccurred = true;
+        }
+    }
+    if (!errorOccurred) {
+        logPhase(logger, "requests", phaseBegin);
+        std::stringstream ss;
+        ss << "Startup took " << std::chrono::duration_cast<std::chrono::milliseconds>(
+              phaseBegin - startupBegin).count() << " ms, first frames follow the warm-up";
+        logger->log(ss.str(), STDOUT_PRINT);
+        if (cluster && !cluster->isLeader())
+            logger->log("Saving is paused until the leader records", STDOUT_PRINT);
+        else if (cluster && _options->clusterRecord)
+            logger->log("Every board starts recording once all cameras are warm", STDOUT_PRINT);
+        else if (_options->startPaused)
+            logger->log("Saving is paused, resume with SIGUSR1 or the control socket", STDOUT_PRINT);
+        if (_options->triggerFrames > 0)
+            logger->log("Waiting for triggers, each saves " + std::to_string(_options->triggerFrames) + " frames per camera", STDOUT_PRINT);
+    }
+
+    if (!errorOccurred) {
+
+        /* Sample CPU, engine load and temperatures into system.csv for the whole run */
+        NvApplicationProfiler& profiler = NvApplicationProfiler::getProfilerInstance();
+        if (_options->profile) {
+            std::string path = std::string(_options->directory) + "/system.csv";
+            profiler.setOutputFile(path.c_str());
+            profiler.start(PROFILER_INTERVAL_MS);
+        }
+
+        /* Wait for captureTime seconds, SIGINT or a consumer exiting, waking on every event */
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + std::chrono::seconds(_options->captureTime);
+        std::vector<bool> stalled(numCameras, false);
+        std::vector<bool> aeLocked(numCameras, false);
+        std::vector<int> restarts(numCameras, 0);
+        std::vector<bool> down(numCameras, false);
+        std::vector<std::chrono::steady_clock::time_point> nextRestart(numCameras, start);
+        bool shooting = false;
+        bool shotPending = false;
+        uint32_t shots = 0;
+        uint32_t shotsIncomplete = 0;
+        auto nextShot = start;
+        auto shotStart = start;
+        std::vector<uint64_t> shotFrames(numCameras, 0);
+        LatencyHistogram shotLatency;
+        StatusWriter status(*_options, numCameras, volumes, backpressure, forecast, sessionEvents);
+        auto statusInterval = std::chrono::seconds(_options->statusInterval);
+        auto nextStatus = start + statusInterval;
+        bool statusFailed = false;
+        struct pollfd events[4] = {{_eventFd, POLLIN, 0}, {control ? control->getFd() : -1, POLLIN, 0},
+                                   {triggerInput ? triggerInput->getFd() : -1, POLLPRI | POLLERR, 0},
+                                   {cluster ? cluster->getEventFd() : -1, POLLIN, 0}};
+        uint32_t triggers = 0;
+        bool clusterReady = false;
+        while (_doRun) {
+            int timeoutMs = HEALTH_CHECK_MS;
+            auto now = std::chrono::steady_clock::now();
+            if (_options->captureTime > 0) {
+                if (now >= deadline)
+                    break;
+                int64_t remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+                if (remaining < timeoutMs)
+                    timeoutMs = remaining;
+            }
+            if (shooting) {
+                int64_t untilShot = std::max<int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(nextShot - now).count() + 1, 0);
+                if (shotPending && SHOT_POLL_MS < untilShot)
+                    untilShot = SHOT_POLL_MS;
+                if (untilShot < timeoutMs)
+                    timeoutMs = untilShot;
+            }
+
+            /* Clear the event count, the state it refers to is re-checked below, and serve waiting commands */
+            if (poll(events, 4, timeoutMs) > 0) {
+                uint64_t count;
+                if ((events[0].revents & POLLIN) && read(_eventFd, &count, sizeof(count)) < 0)
+                    count = 0;
+                if (events[1].revents & POLLIN) {
+                    control->serve();
+                    if (control->isQuitRequested())
+                        break;
+                }
+                if (events[2].revents & POLLPRI) {
+                    triggerInput->acknowledge(); // a short pulse may read low already, the edge still counts
+                    _trigger = true;
+                }
+                if ((events[3].revents & POLLIN) && read(events[3].fd, &count, sizeof(count)) < 0)
+                    count = 0;
+            }
+
+            /* A follower does what the leader says and tells it once its cameras are warm */
+            if (cluster && !cluster->isLeader()) {
+                ClusterCommand command;
+                while (cluster->takeCommand(command)) {
+                    if (command == CLUSTER_QUIT) {
+                        logger->log("The leader ended the run, stopping...", STDOUT_PRINT);
                         _doRun = false;
+                    } else if (command == CLUSTER_TRIGGER) {
+                        _trigger = true;
+                    } else {
+                        setEveryPaused(consumers, numCameras, command == CLUSTER_STOP);
+                        logger->log(command == CLUSTER_STOP ? "The leader paused every camera" : "The leader resumed every camera",
+                                    STDOUT_PRINT);
+                        _options->writeChange(command == CLUSTER_STOP ? "every camera paused by the leader"
+                                                                      : "every camera resumed by the leader");
+                    }
+                }
+                if (!_doRun)
+                    break;
+                bool warm = !clusterReady;
+                for (int i = 0; i < numCameras && warm; i++)
+                    warm = consumers[i]->isWarm();
+                if (warm) {
+                    cluster->setReady();
+                    clusterReady = true;
                 }
             }
-        }
 
-        /* Wait until SIGINT is received. */
-        else {
-            while (_doRun) {
-                sleep(1);
+            /* The leader starts every board at once when all are warm, or without the followers still cold after a while */
+            if (cluster && cluster->isLeader() && !clusterReady) {
+                bool warm = true;
+                for (int i = 0; i < numCameras; i++)
+                    warm = warm && consumers[i]->isWarm();
+                bool late = std::chrono::steady_clock::now() - start >= std::chrono::seconds(CLUSTER_WAIT_S);
+                if (warm && (cluster->isEveryoneReady() || late)) {
+                    clusterReady = true;
+                    if (!cluster->isEveryoneReady())
+                        logger->log("Not every follower is warm after " + std::to_string(CLUSTER_WAIT_S) + " s, the others start now",
+                                    STDOUT_PRINT);
+                    if (_options->clusterRecord) {
+                        setEveryPaused(consumers, numCameras, false);
+                        cluster->broadcast(CLUSTER_RECORD);
+                        logger->log("Every board is warm, recording...", STDOUT_PRINT);
+                        _options->writeChange("every board resumed");
+                    }
+                }
+            }
+
+            /* SIGUSR2 or the trigger line start a burst on every camera at once, so its frames form sets */
+            if (_trigger.exchange(false) && _options->triggerFrames > 0) {
                 for (int i = 0; i < numCameras; i++) {
-                    if (!consumers[i]->isExecuting())
+                    CameraControl update;
+                    memset(&update, 0, sizeof(update));
+                    update.burst = _options->triggerFrames;
+                    consumers[i]->control(update);
+                }
+                logger->log("Trigger " + std::to_string(++triggers) + ", saving " + std::to_string(_options->triggerFrames)
+                            + " frames per camera", STDOUT_PRINT);
+                if (cluster)
+                    cluster->broadcast(CLUSTER_TRIGGER);
+            }
+
+            /* SIGUSR1 pauses every camera while any is saving, otherwise resumes them all */
+            if (_togglePause.exchange(false)) {
+                bool pause = false;
+                for (int i = 0; i < numCameras; i++)
+                    pause = pause || !consumers[i]->isPaused();
+                setEveryPaused(consumers, numCameras, pause);
+                if (cluster)
+                    cluster->broadcast(pause ? CLUSTER_STOP : CLUSTER_RECORD);
+                logger->log(pause ? "Pausing every camera..." : "Resuming every camera...", STDOUT_PRINT);
+                _options->writeChange(pause ? "every camera paused" : "every camera resumed");
+            }
+
+            /* Stop everything as soon as one consumer exits, warn once about stalled cameras */
+            uint64_t nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+            for (int i = 0; i < numCameras; i++) {
+                if (!consumers[i]->isExecuting())
+                    _doRun = false;
+                uint64_t last = consumers[i]->getLastFrameTime();
+                bool stall = last != 0 && nowNs - last > STALL_TIMEOUT_MS * 1000000ULL && !consumers[i]->isStreamLost()
+                             && !shooting; // time-lapse frames are far apart
+                if (stall && !stalled[i]) {
+                    std::stringstream ss;
+                    ss << "Camera " << i << " has not delivered a frame for " << STALL_TIMEOUT_MS << " ms!";
+                    logger->log(ss.str(), STDOUT_PRINT);
+                }
+                stalled[i] = stall;
+            }
+
+            /* Restart a camera whose stream was lost or stalled on its own, backing off after each attempt;
+               one out of attempts stays down while the others record on, the run stops once every one is */
+            for (int i = 0; i < numCameras && _doRun && _options->cameraRestarts > 0; i++) {
+                if (down[i] || !(consumers[i]->isStreamLost() || stalled[i]) || std::chrono::steady_clock::now() < nextRestart[i])
+                    continue;
+                if (restarts[i] >= _options->cameraRestarts) {
+                    graph.stopCamera(i, RESTART_IDLE_NS);
+                    graph.endStream(captureStreams[i]);
+                    down[i] = true;
+                    logger->log("Camera " + std::to_string(i) + " failed again after " + std::to_string(restarts[i])
+                                + " restarts, leaving it down", STDOUT_PRINT);
+                    _options->writeChange("camera " + std::to_string(i) + " down");
+                    if (std::count(down.begin(), down.end(), true) == numCameras) {
+                        logger->log("Every camera is down, stopping...", STDOUT_PRINT);
                         _doRun = false;
+                    }
+                    continue;
+                }
+                restarts[i]++;
+                logger->log("Restarting camera " + std::to_string(i) + ", attempt " + std::to_string(restarts[i]) + " of "
+                            + std::to_string(_options->cameraRestarts) + "...", STDOUT_PRINT);
+                TraceScope scope("restart camera");
+                bool restarted = restartCamera(logger, *_options, graph, i, captureStreams[i], consumers[i], sessionEvents);
+                nextRestart[i] = std::chrono::steady_clock::now() + std::chrono::milliseconds(RESTART_BACKOFF_MS * restarts[i]);
+                aeLocked[i] = false; // the new request starts unlocked, it is locked again after the warm-up
+                stalled[i] = false;
+                _options->writeChange("camera " + std::to_string(i) + (restarted ? " restarted" : " restart failed"));
+                if (restarted)
+                    logger->log("Camera " + std::to_string(i) + " restarted, its outage is logged with its first frame",
+                                STDOUT_PRINT);
+            }
+
+            /* Lock AE on cameras that asked for it once their warm-up has converged, a shared session locks once */
+            for (int i = 0; i < numCameras && _options->hasSensorSettings(); i++) {
+                if (!_options->isAeLocked(i) || aeLocked[i] || !consumers[i]->isWarm() || (graph.isShared() && i > 0))
+                    continue;
+                aeLocked[i] = true;
+                if (graph.setAeLock(i, true) && graph.submit(i)) {
+                    logger->log("Camera " + std::to_string(i) + " AE locked");
+                } else {
+                    logger->log("Camera " + std::to_string(i) + ": " + graph.getError() + ", AE stays unlocked", STDOUT_PRINT);
+                }
+            }
+
+            /* Time-lapse: once every camera is warm, lock AE and AWB where they converged and stop streaming,
+               the shots start once the consumers have taken what the last repeats left */
+            if (_options->interval > 0 && !shooting) {
+                bool warm = true;
+                for (int i = 0; i < numCameras; i++)
+                    warm = warm && consumers[i]->isWarm();
+                if (warm) {
+                    for (int i = 0; i < numCameras && !(graph.isShared() && i > 0); i++)
+                        if (!graph.setAeLock(i, true) || !graph.setAwbLock(i, true))
+                            logger->log("Camera " + std::to_string(i) + ": " + graph.getError() + ", its shots keep adjusting",
+                                        STDOUT_PRINT);
+                    graph.setSingleShot(SHOT_IDLE_NS);
+                    shooting = true;
+                    nextShot = std::chrono::steady_clock::now() + std::chrono::milliseconds(SHOT_DRAIN_MS);
+                    std::stringstream ss;
+                    ss << "Every camera is warm, AE/AWB locked, taking a shot every " << _options->interval << " s";
+                    logger->log(ss.str(), STDOUT_PRINT);
+                }
+            }
+
+            /* A shot is saved once every camera saving frames has written one more */
+            if (shotPending) {
+                bool saved = true;
+                for (int i = 0; i < numCameras; i++)
+                    saved = saved && (consumers[i]->isPaused() || consumers[i]->getFramesWritten() > shotFrames[i]);
+                if (saved) {
+                    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - shotStart).count();
+                    shotLatency.record(us);
+                    logger->log("Shot " + std::to_string(shots) + " saved by every camera " + std::to_string(us / 1000)
+                                + " ms after its capture");
+                    shotPending = false;
                 }
             }
+
+            /* Take the next shot, each consumer is asked for its frame before the capture can deliver it */
+            if (shooting && std::chrono::steady_clock::now() >= nextShot) {
+                if (shotPending) {
+                    shotsIncomplete++;
+                    logger->log("Shot " + std::to_string(shots) + " was not saved by every camera before the next",
+                                STDOUT_PRINT);
+                }
+                for (int i = 0; i < numCameras; i++) {
+                    shotFrames[i] = consumers[i]->getFramesWritten();
+                    CameraControl update;
+                    memset(&update, 0, sizeof(update));
+                    update.burst = 1;
+                    consumers[i]->control(update);
+                }
+                shots++;
+                shotStart = std::chrono::steady_clock::now();
+                TraceScope scope("shot");
+                shotPending = graph.capture();
+                if (!shotPending)
+                    logger->log("Shot " + std::to_string(shots) + ": " + graph.getError() + "!", STDOUT_PRINT);
+                nextShot += std::chrono::microseconds((int64_t) (_options->interval * 1e6));
+                if (nextShot < shotStart)
+                    nextShot = shotStart + std::chrono::microseconds((int64_t) (_options->interval * 1e6)); // fell behind, skip what was missed
+            }
+
+            /* Re-read the volumes' free space so full ones are failed over before writes fail,
+               and stop cleanly once the last one reaches its reserve */
+            volumes->refresh();
+            if (volumes->isExhausted()) {
+                logger->log("Every volume has reached its free space reserve, stopping...", STDOUT_PRINT);
+                _doRun = false;
+            }
+
+            /* Forecast how long the volumes last, saving less once that is short */
+            forecast->sample(consumers);
+
+            /* The offload and the quick-look server back off while any camera's writer queue fills */
+            if (uploader || quickLook) {
+                double occupancy = 0;
+                for (uint8_t i = 0; i < numCameras; i++)
+                    if (consumers[i]->isExecuting())
+                        occupancy = std::max(occupancy, consumers[i]->getOccupancy());
+                if (uploader)
+                    uploader->setOccupancy(occupancy);
+                if (quickLook)
+                    quickLook->setOccupancy(occupancy);
+            }
+
+            /* Publish status.json, warn once if the volume rejects it */
+            if (_options->statusInterval > 0 && std::chrono::steady_clock::now() >= nextStatus) {
+                nextStatus += statusInterval;
+                TraceScope scope("status");
+                if (!status.publish(consumers, numCameras) && !statusFailed) {
+                    logger->log("Failed to write status.json!", STDOUT_PRINT);
+                    statusFailed = true;
+                }
+            }
+
+            /* Shed load before the board throttles, the governor samples once per interval */
+            if (governor)
+                governor->sample();
+        }
+        if (_options->statusInterval > 0)
+            status.publish(consumers, numCameras);
+        if (cluster)
+            cluster->broadcast(CLUSTER_QUIT);
+        if (_options->interval > 0) {
+            std::stringstream ss;
+            ss << "Time-lapse shots: " << shots << ", not saved by every camera: " << shotsIncomplete + (shotPending ? 1 : 0)
+               << ", capture to every camera saved p50/p99/max " << shotLatency.getPercentile(50) / 1000 << "/"
+               << shotLatency.getPercentile(99) / 1000 << "/" << shotLatency.getMax() / 1000 << " ms";
+            logger->log(ss.str(), STDOUT_PRINT);
+        }
+
+        if (_options->profile) {
+            profiler.stop();
+            std::stringstream ss;
+            profiler.printProfilerData(ss);
+            logger->log(ss.str(), STDOUT_PRINT);
         }
 
-        /* Start stop process for threads */
+        /* Start stop process for threads, they exit on their next frame or when the streams are destroyed */
         for (uint8_t i = 0; i < numCameras; i++)
             if (consumers[i])
                 consumers[i]->stopExecute();
-        sleep(1);
     }
 
-    /* Stop the repeating request. */
-    if (!errorOccurred)
-        logger->log("Stopping repeat capture requests...", STDOUT_PRINT);
-    for (uint8_t i = 0; i < numSuccessfulRequests; i++) {
-        if (iCaptureSessions[i]) {
-            iCaptureSessions[i]->stopRepeat();
-        }
-    }
+    /* Stop taking commands and triggers before the cameras they change go away */
+    if (control)
+        delete control;
+    if (governor)
+        delete governor;
+    if (forecast)
+        delete forecast;
+    if (triggerInput)
+        delete triggerInput;
 
-    /* Wait until the requests have been fulfilled */
+    /* Stop the repeating requests and wait until those in flight have been fulfilled */
     uint64_t timeout = 5000000000UL; // nanoseconds
     if (!errorOccurred)
-        logger->log("Finishing remaining capture requests...", STDOUT_PRINT);
-    for (uint8_t i = 0; i < numSuccessfulRequests; i++)
-        if (iCaptureSessions[i])
-            iCaptureSessions[i]->waitForIdle(timeout);
+        logger->log("Stopping repeat capture requests...", STDOUT_PRINT);
+    uint64_t stepStart = TraceLog::now();
+    graph.stop(timeout);
+    TraceLog::instance().span("stop requests", stepStart, TraceLog::now());
+
+    /* Stop draining events once no capture is in flight, each thread logs its session's totals,
+       a camera that failed to restart has none */
+    for (uint32_t i = 0; i < sessionEvents.size(); i++) {
+        if (!sessionEvents[i])
+            continue;
+        sessionEvents[i]->shutdown();
+        delete sessionEvents[i];
+    }
 
-    /* Destroy the output streams. */
+    /* Destroy the output streams, a buffer stream instead ends so blocked acquires return and
+       is destroyed once the consumers have destroyed its buffers */
     if (!errorOccurred)
         logger->log("Destroying the output streams...", STDOUT_PRINT);
-    for (uint8_t i = 0; i < numCameras; i++)
-        if (captureStreams[i])
-            captureStreams[i].reset();
+    stepStart = TraceLog::now();
+    graph.endStreams();
+    TraceLog::instance().span("end streams", stepStart, TraceLog::now());
+
+    /* Hand the slots held for subscribers back before the consumers destroy their rings */
+    if (publisher)
+        publisher->shutdown();
 
     /* Wait for the consumer thread to complete. */
     if (!errorOccurred)
         logger->log("Waiting for consumers to terminate...", STDOUT_PRINT);
-    for (uint8_t i = 0; i < numThreadsInitialized; i++) {
-        if (consumers[i])
-            consumers[i]->shutdown();
-    }
+    stepStart = TraceLog::now();
+    graph.shutdownConsumers();
+    TraceLog::instance().span("shutdown consumers", stepStart, TraceLog::now());
     for (uint8_t i = 0; i < numThreadsCreated; i++)
         delete consumers[i];
+    if (publisher)
+        delete publisher;
+    if (quickLook) {
+        quickLook->shutdown();
+        delete quickLook;
+    }
+    if (preview)
+        delete preview;
+    graph.destroyStreams();
 
-    if (!errorOccurred)
-        logger->log("Process has completed successfully, exiting...", STDOUT_PRINT);
-    return !errorOccurred;
-}
-
-/* Sets the static variable _doRun to false to exit the infinite loop in run() */
-void App::signalCallback(int signum) {
-    _doRun = false;
-}
+    /* Stop the dequeue loops once every encoder has taken its plane back */
+    if (DequeueLoops::instance().getCount() > 0) {
+        logger->log(DequeueLoops::instance().getReport(), STDOUT_PRINT);
+        DequeueLoops::instance().close();
+    }
 
-/* Parse the output of df to return the mount path of the disk with the most available space
- * df output takes the form:
- * Filesystem     1K-blocks     Used Available Use% Mounted on
- * /dev/mmcblk0p1  28768292 20688856   6595048  76% /
- * none             3984856        0   3984856   0% /dev
- * tmpfs            4024628    67608   3957020   2% /dev/shm
- * tmpfs            4024628    29104   3995524   1% /run
- * tmpfs               5120        4      5116   1% /run/lock
- * tmpfs            4024628        0   4024628   0% /sys/fs/cgroup
- * tmpfs             804924      124    804800   1% /run/user/1000
- * /dev/mmcblk2p1 124852224    16768 124835456   1% /media/nvidia/3739-6239
- * ...
- */
-std::string App::getAvailableDevice() {
+    /* Encode the last sets and close the composite writer once every consumer has drained its input */
+    if (composite) {
+        composite->shutdown();
+        delete composite;
+    }
 
-    // command string
-    char cmd[] = "df | grep \"^/dev\"";
+    /* Stop the encoder workers once every consumer has drained its queue */
+    if (scheduler) {
+        stepStart = TraceLog::now();
+        scheduler->shutdown();
+        TraceLog::instance().span("shutdown encoders", stepStart, TraceLog::now());
+        delete scheduler;
+    }
 
-    // resultant strings, remains empty if pipe fails
-    std::string result("");
+    /* Stop the offload before the segments it reads are closed, what is left is sent next time */
+    if (uploader) {
+        uploader->shutdown();
+        delete uploader;
+    }
 
-    // avoid magic numbers
-    enum HEADER_INDEX {FILESYSTEM, BLOCKS, USED, AVAILABLE, USE_PERCENT, MOUNT_POINT};
+    /* Flush the placement index once every writer has finished */
+    if (volumes) {
+        volumes->close();
+        delete volumes;
+    }
 
-    // stores one line from the cmd result
-    size_t bufferSize = 256;
-    char buffer[bufferSize];
-    std::stringstream ss;
-    std::string str;
-    uint64_t lastAvail = 0;
-    uint64_t currAvail = 0;
-    bool setMount = false;
-
-    // open the pipe and repeatedly parse lines...
-    FILE* pipe = popen(cmd, "r");
-    if (pipe) {
-        while (fgets(&buffer[0], bufferSize, pipe)) {
-
-            // read buffer into string stream
-            ss.str(buffer);
-            setMount = false;
-            for (int i = 0; i <= MOUNT_POINT; i++) {
-
-                // skip if ss is empty
-                if (ss.rdbuf()->in_avail() == 0)
-                    break;
+    /* Close the decision log once no consumer consults the engine any more */
+    if (backpressure) {
+        backpressure->close();
+        delete backpressure;
+    }
 
-                // validate the next token
-                ss >> str;
-                switch (i) {
-
-                    // check if device has more space than last selection
-                    case AVAILABLE:
-                        currAvail = atoi(str.c_str());
-                        if (currAvail > lastAvail) {
-                            lastAvail = currAvail;
-                            setMount = true;
-                        }
-                        break;
+    /* Group the last frames once no consumer can report any more */
+    if (collector) {
+        collector->shutdown();
+        delete collector;
+    }
 
-                    // get mount point path
-                    case MOUNT_POINT:
-                        if (setMount && str.size() > 1) {
-                            result = str + "/";
-                        }
-                        break;
+    /* Pair the boards' last sets once this board's collector has reported its own */
+    if (cluster) {
+        cluster->shutdown();
+        delete cluster;
+    }
 
-                    default:
-                        break;
-                }
-            }
+    /* Export the timeline once every traced thread has stopped */
+    if (_options->trace && TraceLog::instance().isEnabled()) {
+        std::string path = std::string(_options->directory) + "/trace.json";
+        std::stringstream ss;
+        ss << "Trace of " << TraceLog::instance().getSpans() << " spans";
+        if (TraceLog::instance().getDropped() > 0)
+            ss << ", " << TraceLog::instance().getDropped() << " dropped on full thread buffers,";
+        if (TraceLog::instance().write(path)) {
+            ss << " written to " << path;
+            logger->log(ss.str(), STDOUT_PRINT);
+        } else {
+            logger->log("Failed to write " + path + "!", STDOUT_PRINT);
         }
-        pclose(pipe);
     }
-    return result;
+
+    if (eglDisplay != EGL_NO_DISPLAY)
+        eglTerminate(eglDisplay);
+
+    /* Report the peak each subsystem reached once every buffer is released */
+    logger->log(MemoryBudget::instance().getReport(), STDOUT_PRINT);
+
+    if (!errorOccurred)
+        logger->log("Process has completed successfully, exiting...", STDOUT_PRINT);
+    return !errorOccurred;
+}
+
+/* Sets the static variable _doRun to false and wakes run(), only async-signal-safe calls here */
+/* Wake the supervisor to pause or resume, the cameras are changed from its thread */
+void App::pauseCallback(int signum) {
+    _togglePause = true;
+    uint64_t one = 1;
+    if (_eventFd != -1 && write(_eventFd, &one, sizeof(one)) < 0)
+        return;
+}
+
+/* Wake the supervisor to start a burst */
+void App::triggerCallback(int signum) {
+    _trigger = true;
+    uint64_t one = 1;
+    if (_eventFd != -1 && write(_eventFd, &one, sizeof(one)) < 0)
+        return;
+}
+
+void App::signalCallback(int signum) {
+    _doRun = false;
+    uint64_t one = 1;
+    if (_eventFd != -1 && write(_eventFd, &one, sizeof(one)) < 0)
+        return;
 }
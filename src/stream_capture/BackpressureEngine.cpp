@@ -0,0 +1,235 @@
+/*
+ * BackpressureEngine.cpp
+ *
+ * Degrades the recording in explicit, logged steps when storage or the
+ * encoder can't keep up. Each consumer reports its backlog occupancy for every
+ * acquired frame; sustained occupancy above the high mark moves the camera one
+ * level up the ladder, a longer spell below the low mark one level down. The
+ * ladder lowers the JPEG quality first, then doubles the save every. With the
+ * sets action every camera keeps the frames of the highest level, so frame
+ * sets are dropped whole. Every change goes to backpressure.csv, floor
+ * changes to the log only.
+ */
+
+#include "BackpressureEngine.hpp"
+
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "SteadyClock.hpp"
+#include <algorithm>
+#include <sstream>
+
+#define STDOUT_PRINT true
+#define OCCUPANCY_HIGH 0.75             // backlog share that counts as falling behind
+#define OCCUPANCY_LOW 0.25              // backlog share that counts as keeping up
+#define ESCALATE_HOLD_NS 250000000ULL   // time above the high mark before stepping up
+#define RELAX_HOLD_NS 2000000000ULL     // time below the low mark before stepping down
+#define QUALITY_STEP 15                 // quality given up per level
+#define QUALITY_DROP_MAX 45             // most quality the ladder gives up
+#define QUALITY_MIN 30                  // lowest quality the ladder lowers to
+#define SAVE_EVERY_MAX 8U               // largest save every multiplier
+
+BackpressureEngine::BackpressureEngine(const Options& options, uint32_t numCameras) :
+    _options(options),
+    _numCameras(numCameras),
+    _cameras(numCameras),
+    _floor(0),
+    _logger(NULL),
+    _file(NULL),
+    _start(now())
+{
+    for (uint32_t i = 0; i < numCameras; i++) {
+        _cameras[i].level = 0;
+        _cameras[i].shed = 0;
+        _cameras[i].highestLevel = 0;
+        _cameras[i].aboveSince = 0;
+        _cameras[i].belowSince = 0;
+    }
+
+    /* Build the ladder, quality only matters to JPEG and goes first as it costs no frames */
+    Step step = {0, 1};
+    _steps.push_back(step);
+    if ((options.backpressure & BACKPRESSURE_QUALITY) && options.format == FORMAT_JPEG) {
+        for (step.qualityDrop = QUALITY_STEP; step.qualityDrop <= QUALITY_DROP_MAX; step.qualityDrop += QUALITY_STEP)
+            _steps.push_back(step);
+        step.qualityDrop = _steps.back().qualityDrop;
+    }
+    if (options.backpressure & (BACKPRESSURE_STRIDE | BACKPRESSURE_SETS)) {
+        for (step.saveEvery = 2; step.saveEvery <= SAVE_EVERY_MAX; step.saveEvery *= 2)
+            _steps.push_back(step);
+    }
+}
+
+BackpressureEngine::~BackpressureEngine() {
+    close();
+    if (_logger)
+        delete _logger;
+}
+
+/* Create the logger and the decision log, return bool indicating success */
+bool BackpressureEngine::open() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        _logger = new Logger("BACKPRESSURE", _options.directory);
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Open the decision log */
+    if (!errorOccurred) {
+        std::string filename = std::string(_options.directory) + "/backpressure.csv";
+        _file = fopen(filename.c_str(), "w");
+        if (!_file || fprintf(_file, "elapsed_ms,camera,frame,timestamp,index,level,quality_drop,save_every,occupancy\n") < 0) {
+            _logger->error("Failed to create backpressure.csv!");
+            errorOccurred = true;
+        }
+    }
+
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "Ladder of " << _steps.size() - 1 << " levels, up to " << _steps.back().qualityDrop << " quality points off"
+           << " and save every " << _steps.back().saveEvery;
+        _logger->log(ss.str());
+    }
+    return !errorOccurred;
+}
+
+/* Close the decision log and log how far each camera degraded */
+void BackpressureEngine::close() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_file)
+        return;
+    if (fclose(_file) != 0)
+        _logger->error("Failed to close backpressure.csv!");
+    _file = NULL;
+
+    for (uint32_t i = 0; i < _numCameras; i++) {
+        std::stringstream ss;
+        ss << "Camera " << i << " highest level: " << _cameras[i].highestLevel
+           << ", frames shed: " << _cameras[i].shed.load();
+        _logger->log(ss.str(), _cameras[i].highestLevel > 0);
+    }
+}
+
+/* Feed the camera's backlog occupancy in [0, 1] for an acquired frame, from its consumer only */
+void BackpressureEngine::update(uint32_t camera, double occupancy, uint64_t frameNumber, uint64_t timestamp, uint64_t index) {
+    Camera& state = _cameras[camera];
+    uint64_t time = now();
+    uint32_t level = state.level;
+
+    if (occupancy >= OCCUPANCY_HIGH) {
+        state.belowSince = 0;
+        if (!state.aboveSince)
+            state.aboveSince = time;
+        if (time - state.aboveSince >= ESCALATE_HOLD_NS && level + 1 < _steps.size()) {
+            state.aboveSince = time;
+            change(camera, level + 1, occupancy, frameNumber, timestamp, index);
+        }
+    } else if (occupancy <= OCCUPANCY_LOW) {
+        state.aboveSince = 0;
+        if (!state.belowSince)
+            state.belowSince = time;
+        if (time - state.belowSince >= RELAX_HOLD_NS && level > 0) {
+            state.belowSince = time;
+            change(camera, level - 1, occupancy, frameNumber, timestamp, index);
+        }
+    } else {
+        state.aboveSince = 0;
+        state.belowSince = 0;
+    }
+}
+
+/* True if the camera should save this frame, counted as shed otherwise. Under the sets action
+   the frame number decides for every camera alike, which needs --sync-session to line up */
+bool BackpressureEngine::keep(uint32_t camera, uint64_t frameNumber) {
+    uint32_t saveEvery = getSaveEvery(camera);
+    if (saveEvery == 1 || frameNumber % saveEvery == 0)
+        return true;
+    _cameras[camera].shed++;
+    return false;
+}
+
+/* Hold every camera at least at level, clamped to the top of the ladder; any thread */
+void BackpressureEngine::setFloor(uint32_t level) {
+    if (level >= _steps.size())
+        level = _steps.size() - 1;
+    uint32_t previous = _floor.exchange(level);
+    if (previous == level)
+        return;
+    std::stringstream ss;
+    ss << "Floor level " << previous << " -> " << level << " (quality -" << _steps[level].qualityDrop << ", save every "
+       << _steps[level].saveEvery << ") for every camera";
+    _logger->log(ss.str(), STDOUT_PRINT);
+}
+
+uint32_t BackpressureEngine::getFloor() const {
+    return _floor;
+}
+
+/* The camera's level, at least the floor */
+uint32_t BackpressureEngine::getLevel(uint32_t camera) const {
+    return std::max<uint32_t>(_cameras[camera].level, _floor);
+}
+
+/* JPEG quality points the camera currently gives up */
+int BackpressureEngine::getQualityDrop(uint32_t camera) const {
+    return _steps[getLevel(camera)].qualityDrop;
+}
+
+/* The camera's JPEG quality lowered for its level, never below QUALITY_MIN unless it already was */
+int BackpressureEngine::lowerQuality(uint32_t camera, int quality) const {
+    int lowered = quality - getQualityDrop(camera);
+    if (lowered >= QUALITY_MIN)
+        return lowered;
+    return quality < QUALITY_MIN ? quality : QUALITY_MIN;
+}
+
+/* Saved frames per frame kept, the highest of any camera under the sets action */
+uint32_t BackpressureEngine::getSaveEvery(uint32_t camera) const {
+    if (!(_options.backpressure & BACKPRESSURE_SETS))
+        return _steps[getLevel(camera)].saveEvery;
+    uint32_t saveEvery = 1;
+    for (uint32_t i = 0; i < _numCameras; i++)
+        if (_steps[getLevel(i)].saveEvery > saveEvery)
+            saveEvery = _steps[getLevel(i)].saveEvery;
+    return saveEvery;
+}
+
+/* Frames the camera left unsaved to relieve the backlog */
+uint64_t BackpressureEngine::getFramesShed(uint32_t camera) const {
+    return _cameras[camera].shed;
+}
+
+/* Move the camera to level and record the decision */
+void BackpressureEngine::change(uint32_t camera, uint32_t level, double occupancy, uint64_t frameNumber,
+                                uint64_t timestamp, uint64_t index) {
+    Camera& state = _cameras[camera];
+    uint32_t previous = state.level;
+    state.level = level;
+    if (level > state.highestLevel)
+        state.highestLevel = level;
+
+    uint64_t elapsed = (now() - _start) / 1000000;
+    int qualityDrop = getQualityDrop(camera);
+    uint32_t saveEvery = getSaveEvery(camera);
+    std::stringstream ss;
+    ss << "Camera " << camera << (level > previous ? " falling behind" : " catching up") << ", level " << previous
+       << " -> " << level << " (quality -" << qualityDrop << ", save every " << saveEvery << ") at frame " << frameNumber
+       << ", occupancy " << (int) (occupancy * 100) << "%";
+    _logger->log(ss.str(), STDOUT_PRINT);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_file && fprintf(_file, "%lu,%u,%lu,%lu,%lu,%u,%d,%u,%.2f\n", elapsed, camera, frameNumber, timestamp,
+                         index, level, qualityDrop, saveEvery, occupancy) < 0)
+        _logger->error("Failed to write backpressure.csv!");
+    if (_file)
+        fflush(_file);
+}
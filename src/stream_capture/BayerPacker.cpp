@@ -0,0 +1,123 @@
+/*
+ * BayerPacker.cpp
+ *
+ * Packs RAW16 Bayer frames to MIPI RAW12 into GRAY8 ring slots on the CPU,
+ * with the NEON kernel from PixelKernels. The slot is synced for the device
+ * afterwards, so the raw writer's sync for the CPU sees the packed rows.
+ */
+
+#include "BayerPacker.hpp"
+
+#include "PixelKernels.hpp"
+#include "SteadyClock.hpp"
+#include <nvbuf_utils.h>
+
+#define RAW12_MSB_MASK 0xf000   // bits no LSB aligned 12 bit sample reaches
+#define RAW12_LSB_MASK 0x000f   // bits no MSB aligned 12 bit sample reaches
+#define RAW12_MSB_SHIFT 4       // MSB aligned samples in 16 bit words
+#define RAW12_CHECK_ROWS 16     // every this many rows are checked for the alignment
+
+using namespace Argus;
+using namespace EGLStream;
+
+BayerPacker::BayerPacker() :
+    _pitch(0),
+    _shift(-1),
+    _realigned(0),
+    _frames(0)
+{}
+
+BayerPacker::~BayerPacker() {
+    close();
+}
+
+/* Size of the GRAY8 slots a Bayer frame of size packs into, two samples in three bytes */
+Size2D<uint32_t> BayerPacker::getPackedSize(Size2D<uint32_t> size) {
+    return Size2D<uint32_t>(size.width() * 3 / 2, size.height());
+}
+
+/* Pack the RAW16 frame in image into the slot fd, return bool indicating success */
+bool BayerPacker::pack(Image *image, int fd) {
+    uint64_t start = now();
+    IImage *iImage = interface_cast<IImage>(image);
+    IImage2D *iImage2D = interface_cast<IImage2D>(image);
+    if (!iImage || !iImage2D) {
+        _error = "Failed to get the RAW16 image interfaces";
+        return false;
+    }
+    const uint16_t *src = (const uint16_t *) iImage->mapBuffer();
+    Size2D<uint32_t> size = iImage2D->getSize(0);
+    uint32_t stride = iImage2D->getStride(0);
+    if (!src) {
+        _error = "Failed to map the RAW16 frame";
+        return false;
+    }
+
+    /* Map the slot on its first use, every slot has the plane of the one the ring was created with */
+    std::map<int, void*>::iterator mapping = _mappings.find(fd);
+    if (mapping == _mappings.end()) {
+        NvBufferParams params;
+        void *data = NULL;
+        if (NvBufferGetParams(fd, &params) != 0 || params.width[0] < getPackedSize(size).width()
+            || params.height[0] < size.height()) {
+            _error = "The Bayer frame does not fit the ring slot";
+            return false;
+        }
+        if (NvBufferMemMap(fd, 0, NvBufferMem_Write, &data) != 0) {
+            _error = "Failed to map the ring slot";
+            return false;
+        }
+        _pitch = params.pitch[0];
+        mapping = _mappings.insert(std::make_pair(fd, data)).first;
+    }
+
+    /* Check where this frame's samples sit in their words, a frame that cannot tell keeps the last found */
+    uint16_t bits = 0;
+    for (uint32_t y = 0; y < size.height(); y += RAW12_CHECK_ROWS) {
+        const uint16_t *row = (const uint16_t *) ((const uint8_t *) src + (uint64_t) y * stride);
+        for (uint32_t x = 0; x < size.width(); x++)
+            bits |= row[x];
+    }
+    int shift = bits & RAW12_LSB_MASK ? 0 : bits & RAW12_MSB_MASK ? RAW12_MSB_SHIFT : _shift;
+    if (shift >= 0 && _shift >= 0 && shift != _shift)
+        _realigned++;
+    if (shift >= 0)
+        _shift = shift;
+
+    packRaw12(src, stride, (uint8_t *) mapping->second, _pitch, size.width(), size.height(),
+              _shift < 0 ? RAW12_MSB_SHIFT : _shift);
+    NvBufferMemSyncForDevice(fd, 0, &mapping->second);
+    _frames++;
+    _latency.record((now() - start) / 1000);
+    return true;
+}
+
+/* Unmap every slot, the ring still owns the buffers */
+void BayerPacker::close() {
+    for (std::map<int, void*>::iterator i = _mappings.begin(); i != _mappings.end(); ++i)
+        NvBufferMemUnMap(i->first, 0, &i->second);
+    _mappings.clear();
+}
+
+/* Right shift from the RAW16 words to the 12 bit samples found last, -1 before a frame showed it */
+int BayerPacker::getShift() const {
+    return _shift;
+}
+
+/* Frames whose samples sat differently in their words than in the frame that showed it before */
+uint64_t BayerPacker::getRealigned() const {
+    return _realigned;
+}
+
+uint64_t BayerPacker::getFramesPacked() const {
+    return _frames;
+}
+
+/* Time to map and pack one frame */
+const LatencyHistogram *BayerPacker::getLatency() const {
+    return &_latency;
+}
+
+const std::string& BayerPacker::getError() const {
+    return _error;
+}
@@ -0,0 +1,94 @@
+/*
+ * BufferPool.cpp
+ *
+ * A fixed number of page-aligned encoder output buffers, allocated once and
+ * then checked out by the encoder and returned by the writer. Alignment keeps
+ * the buffers usable for O_DIRECT writes. If libjpeg outgrows a buffer it
+ * allocates a replacement itself; release() detects this, frees the libjpeg
+ * allocation and regrows that slot once so later frames no longer overflow it.
+ * The slots are an ObjectPool, checked out and returned without a lock.
+ */
+
+#include "BufferPool.hpp"
+
+#include "MemoryBudget.hpp"
+#include <stdlib.h>
+#include <unistd.h>
+
+BufferPool::BufferPool(uint32_t count, size_t bufferSize) :
+    _count(count),
+    _pageSize(sysconf(_SC_PAGESIZE)),
+    _bufferSize(bufferSize),
+    _allocated(false),
+    _slots(count),
+    _growCount(0)
+{}
+
+BufferPool::~BufferPool() {
+    for (uint32_t i = 0; i < _count; i++)
+        if (_slots[i].data)
+            MemoryBudget::instance().free(_slots[i].data);
+}
+
+/* Allocate every buffer, call once before the pool is used */
+bool BufferPool::allocate() {
+    for (uint32_t i = 0; i < _count; i++) {
+        _slots[i].capacity = roundToPage(_bufferSize);
+        _slots[i].data = (unsigned char *) MemoryBudget::instance().allocate(MEMORY_ENCODER, _slots[i].capacity,
+                                                                             _pageSize);
+        if (!_slots[i].data)
+            return false;
+    }
+    _allocated = true;
+    return true;
+}
+
+/* Check out a free buffer, returns false without blocking if none are available */
+bool BufferPool::acquire(uint32_t& slot, unsigned char*& data, unsigned long& capacity) {
+    if (!_allocated || !_slots.acquire(slot))
+        return false;
+    data = _slots[slot].data;
+    capacity = _slots[slot].capacity;
+    return true;
+}
+
+/* Return a buffer, data is the pointer the encoder left behind and size its used length */
+void BufferPool::release(uint32_t slot, unsigned char *data, unsigned long size) {
+
+    /* libjpeg replaced our buffer with its own malloc'd one, grow the slot to fit unless the budget is spent */
+    Buffer& buffer = _slots[slot];
+    if (data && data != buffer.data) {
+        free(data);
+        size_t grown = roundToPage(size + size / 4);
+        void *ptr = MemoryBudget::instance().allocate(MEMORY_ENCODER, grown, _pageSize);
+        if (ptr) {
+            MemoryBudget::instance().free(buffer.data);
+            buffer.data = (unsigned char *) ptr;
+            buffer.capacity = grown;
+        }
+        _growCount++;
+    }
+    _slots.release(slot);
+}
+
+/* True if data is still the slot's own page-aligned buffer, whose capacity is a page multiple */
+bool BufferPool::owns(uint32_t slot, const unsigned char *data) const {
+    return data == _slots[slot].data;
+}
+
+uint32_t BufferPool::getCount() const {
+    return _count;
+}
+
+size_t BufferPool::getAvailable() {
+    return _allocated ? _slots.getAvailable() : 0;
+}
+
+/* Number of times libjpeg overflowed a buffer, non-zero means the initial size is too small */
+uint64_t BufferPool::getGrowCount() {
+    return _growCount;
+}
+
+size_t BufferPool::roundToPage(size_t size) const {
+    return (size + _pageSize - 1) / _pageSize * _pageSize;
+}
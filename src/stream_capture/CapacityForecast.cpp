@@ -0,0 +1,216 @@
+/*
+ * CapacityForecast.cpp
+ *
+ * Forecasts the recording time left from a rolling window of each camera's
+ * image sizes and frame rate and the volumes' free space above their reserve.
+ * Sampled once a second from the supervisor loop, logged once a minute, and
+ * raising the BackpressureEngine's floor while the time left is short.
+ */
+
+#include "CapacityForecast.hpp"
+
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "VolumeSet.hpp"
+#include "BackpressureEngine.hpp"
+#include "ConsumerThread.hpp"
+#include "SteadyClock.hpp"
+#include <algorithm>
+#include <sstream>
+
+#define STDOUT_PRINT true
+#define FORECAST_SAMPLE_NS 1000000000ULL   // between two samples
+#define FORECAST_PERCENTILE 0.9             // of the samples' image sizes for the cautious rate
+#define FORECAST_RECOVER 2.0                // times --capacity-warn the forecast must clear to undo a step
+
+/* Seconds as hours and minutes, or unbounded while nothing is written */
+static std::string formatDuration(double seconds) {
+    if (seconds < 0)
+        return "unbounded";
+    uint64_t minutes = (uint64_t) (seconds / 60);
+    std::stringstream ss;
+    if (minutes >= 60)
+        ss << minutes / 60 << " h " << minutes % 60 << " min";
+    else if (minutes > 0)
+        ss << minutes << " min";
+    else
+        ss << (uint64_t) seconds << " s";
+    return ss.str();
+}
+
+CapacityForecast::CapacityForecast(const Options& options, uint32_t numCameras, VolumeSet *volumes,
+                                   BackpressureEngine *backpressure) :
+    _options(options),
+    _numCameras(numCameras),
+    _volumes(volumes),
+    _backpressure(backpressure),
+    _logger(NULL),
+    _cameras(numCameras),
+    _lastSample(0),
+    _nextLog(0),
+    _lastStep(0),
+    _low(false),
+    _lowest(-1)
+{
+    for (uint32_t i = 0; i < numCameras; i++) {
+        _cameras[i].next = 0;
+        _cameras[i].lastFrames = 0;
+        _cameras[i].lastBytes = 0;
+        _cameras[i].fps = 0;
+        _cameras[i].meanSize = 0;
+        _cameras[i].highSize = 0;
+    }
+    _forecast.freeBytes = 0;
+    _forecast.bytesPerSecond = 0;
+    _forecast.bytesPerSecondHigh = 0;
+    _forecast.remainingS = -1;
+    _forecast.remainingSHigh = -1;
+}
+
+CapacityForecast::~CapacityForecast() {
+    if (_logger) {
+        std::stringstream ss;
+        ss << "Shortest forecast: " << formatDuration(_lowest) << " left at the p90 image size";
+        _logger->log(ss.str());
+        delete _logger;
+    }
+}
+
+/* Create the logger, return bool indicating success */
+bool CapacityForecast::open() {
+    _logger = new Logger("CAPACITY", _options.directory);
+    if (!_logger)
+        return false;
+    if (_options.verbose)
+        _logger->enableVerbose();
+    else
+        _logger->disableVerbose();
+    return true;
+}
+
+/* Take what every camera wrote since the last sample and update the forecast, at most once a
+   second; call from the supervisor loop only */
+void CapacityForecast::sample(ConsumerThread **consumers) {
+    uint64_t time = now();
+    if (_lastSample && time - _lastSample < FORECAST_SAMPLE_NS)
+        return;
+
+    /* The first call only takes the counters to measure from */
+    for (uint32_t i = 0; i < _numCameras; i++) {
+        Camera& camera = _cameras[i];
+        uint64_t frames = consumers[i]->getFramesWritten();
+        uint64_t bytes = consumers[i]->getBytesWritten();
+        if (_lastSample) {
+            Sample sample = {time - _lastSample, frames - camera.lastFrames, bytes - camera.lastBytes};
+            if (camera.samples.size() < FORECAST_WINDOW) {
+                camera.samples.push_back(sample);
+            } else {
+                camera.samples[camera.next] = sample;
+                camera.next = (camera.next + 1) % FORECAST_WINDOW;
+            }
+        }
+        camera.lastFrames = frames;
+        camera.lastBytes = bytes;
+    }
+    if (!_lastSample)
+        _nextLog = time + FORECAST_LOG_S * 1000000000ULL;
+    _lastSample = time;
+    update();
+    react(time);
+}
+
+/* Turn the windows into rates and the free space into the time left */
+void CapacityForecast::update() {
+    _forecast.bytesPerSecond = 0;
+    _forecast.bytesPerSecondHigh = 0;
+    std::vector<double> sizes;
+    for (uint32_t i = 0; i < _numCameras; i++) {
+        Camera& camera = _cameras[i];
+        uint64_t duration = 0, frames = 0, bytes = 0;
+        sizes.clear();
+        for (size_t j = 0; j < camera.samples.size(); j++) {
+            const Sample& sample = camera.samples[j];
+            duration += sample.duration;
+            frames += sample.frames;
+            bytes += sample.bytes;
+            if (sample.frames > 0)
+                sizes.push_back((double) sample.bytes / sample.frames);
+        }
+        camera.fps = duration > 0 ? frames * 1e9 / duration : 0;
+        camera.meanSize = frames > 0 ? (double) bytes / frames : 0;
+        camera.highSize = camera.meanSize;
+        if (!sizes.empty()) {
+            std::vector<double>::iterator high = sizes.begin() + (size_t) ((sizes.size() - 1) * FORECAST_PERCENTILE);
+            std::nth_element(sizes.begin(), high, sizes.end());
+            camera.highSize = std::max(*high, camera.meanSize);
+        }
+        _forecast.bytesPerSecond += camera.fps * camera.meanSize;
+        _forecast.bytesPerSecondHigh += camera.fps * camera.highSize;
+    }
+
+    _forecast.freeBytes = _volumes->getRecordableBytes();
+    _forecast.remainingS = _forecast.bytesPerSecond > 0 ? _forecast.freeBytes / _forecast.bytesPerSecond : -1;
+    _forecast.remainingSHigh = _forecast.bytesPerSecondHigh > 0 ? _forecast.freeBytes / _forecast.bytesPerSecondHigh : -1;
+    if (_forecast.remainingSHigh >= 0 && (_lowest < 0 || _forecast.remainingSHigh < _lowest))
+        _lowest = _forecast.remainingSHigh;
+}
+
+/* Log the forecast when due, warn once it runs short and step the backpressure floor */
+void CapacityForecast::react(uint64_t time) {
+    if (time >= _nextLog) {
+        _nextLog += FORECAST_LOG_S * 1000000000ULL;
+        std::stringstream ss;
+        ss << "Recording time left: " << formatDuration(_forecast.remainingS) << " at "
+           << _forecast.bytesPerSecond / (1 << 20) << " MiB/s, " << formatDuration(_forecast.remainingSHigh)
+           << " at the p90 image size, " << (_forecast.freeBytes >> 20) << " MiB free above the reserve";
+        _logger->log(ss.str());
+    }
+    if (_options.capacityWarn == 0)
+        return;
+
+    double warn = _options.capacityWarn * 60.0;
+    bool low = _forecast.remainingSHigh >= 0 && _forecast.remainingSHigh < warn;
+    bool clear = _forecast.remainingSHigh < 0 || _forecast.remainingSHigh > warn * FORECAST_RECOVER;
+    if (low && !_low) {
+        std::stringstream ss;
+        ss << "Recording time left is short: " << formatDuration(_forecast.remainingSHigh)
+           << " at the p90 image size, below --capacity-warn " << _options.capacityWarn << " min";
+        if (_backpressure)
+            ss << ", saving less";
+        _logger->log(ss.str(), STDOUT_PRINT);
+        _low = true;
+    } else if (clear && _low) {
+        _logger->log("Recording time left is " + formatDuration(_forecast.remainingSHigh) + " again", STDOUT_PRINT);
+        _low = false;
+    }
+
+    /* Step the floor while short, long enough apart for the window to see the previous step */
+    if (!_backpressure || time - _lastStep < FORECAST_ESCALATE_S * 1000000000ULL)
+        return;
+    uint32_t floor = _backpressure->getFloor();
+    if (low)
+        _backpressure->setFloor(floor + 1);
+    else if (clear && floor > 0)
+        _backpressure->setFloor(floor - 1);
+    if (_backpressure->getFloor() != floor)
+        _lastStep = time;
+}
+
+const Forecast& CapacityForecast::getForecast() const {
+    return _forecast;
+}
+
+/* Camera's mean bytes per image over the window */
+double CapacityForecast::getMeanSize(uint32_t camera) const {
+    return _cameras[camera].meanSize;
+}
+
+/* Camera's p90 of the window's per second mean image sizes */
+double CapacityForecast::getHighSize(uint32_t camera) const {
+    return _cameras[camera].highSize;
+}
+
+/* Camera's images written per second over the window */
+double CapacityForecast::getFps(uint32_t camera) const {
+    return _cameras[camera].fps;
+}
@@ -0,0 +1,729 @@
+/*
+ * ClusterLink.cpp
+ *
+ * The link between the boards of a --leader / --follow rig, a thread on each
+ * board serving one TCP connection per follower. The supervisor hands it the
+ * commands to forward and takes those the leader sent, the FrameSetCollector
+ * hands it each set it wrote. The leader samples every follower's clock
+ * offset NTP style and pairs the boards' sets into cluster_sets.csv on its own
+ * clock, the followers only answer and report.
+ */
+
+#include "ClusterLink.hpp"
+
+#include "FrameSetCollector.hpp"
+#include "Options.hpp"
+#include "Logger.hpp"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sstream>
+#include <thread>
+#include <chrono>
+
+#define STDOUT_PRINT true
+
+static const char *COMMAND_NAMES[] = {"record", "stop", "trigger", "quit"};
+
+ClusterLink::ClusterLink(const Options& options) :
+    _options(options),
+    _leader(options.clusterRole == CLUSTER_ROLE_LEADER),
+    _numNodes(_leader ? options.followers + 1 : 1),
+    _tolerance((uint64_t) options.frameSetTolerance * 1000),
+    _logger(NULL),
+    _eventFd(-1),
+    _fd(-1),
+    _id(0),
+    _nodes(_numNodes),
+    _heads(_numNodes),
+    _present(_numNodes),
+    _members(_numNodes),
+    _offered(CLUSTER_SET_QUEUE),
+    _ready(false),
+    _readySent(false),
+    _followersReady(0),
+    _recording(false),
+    _sets(NULL),
+    _clock(NULL),
+    _start(0),
+    _nextReport(0),
+    _next(0),
+    _reported(0),
+    _setsWritten(0),
+    _setsIncomplete(0),
+    _failed(false)
+{
+    for (uint32_t i = 0; i < _numNodes; i++) {
+        Node& node = _nodes[i];
+        node.fd = -1;
+        node.joined = i == 0; // the leader itself
+        node.gone = false;
+        node.ready = false;
+        node.done = false;
+        node.last = 0;
+        node.offset = 0;
+        node.roundTrip = 0;
+        node.nextPing = 0;
+    }
+}
+
+ClusterLink::~ClusterLink() {
+    shutdown();
+    for (uint32_t i = 0; i < _numNodes; i++)
+        if (_nodes[i].fd != -1)
+            close(_nodes[i].fd);
+    if (_fd != -1)
+        close(_fd);
+    if (_eventFd != -1)
+        close(_eventFd);
+    if (_sets)
+        fclose(_sets);
+    if (_clock)
+        fclose(_clock);
+    if (_logger)
+        delete _logger;
+}
+
+/* CLOCK_MONOTONIC in ns, the clock of the sensor timestamps */
+uint64_t ClusterLink::now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+bool ClusterLink::isLeader() const {
+    return _leader;
+}
+
+/* Readable whenever the leader sent a command or a follower became warm, the supervisor polls it */
+int ClusterLink::getEventFd() const {
+    return _eventFd;
+}
+
+/* Forward a command to every follower, called by the leader's supervisor and control socket. A follower
+   forwards nothing, what it is told stays on its own board */
+void ClusterLink::broadcast(ClusterCommand command) {
+    if (!_leader)
+        return;
+    if (command == CLUSTER_RECORD || command == CLUSTER_STOP)
+        _recording = command == CLUSTER_RECORD; // followers warming up later start in this state
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (uint32_t i = 1; i < _numNodes; i++)
+        if (_nodes[i].fd != -1)
+            sendLine(_nodes[i].fd, COMMAND_NAMES[command]); // a lost follower is noticed on its next receive
+}
+
+/* Take the oldest command the leader sent, false if there is none */
+bool ClusterLink::takeCommand(ClusterCommand& command) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_commands.empty())
+        return false;
+    command = _commands.front();
+    _commands.pop_front();
+    return true;
+}
+
+/* Every camera of this follower is warm, the leader is told on the link's next pass */
+void ClusterLink::setReady() {
+    _ready = true;
+}
+
+/* True once every follower the leader waits for reported its cameras warm */
+bool ClusterLink::isEveryoneReady() {
+    return _followersReady >= _numNodes - 1;
+}
+
+/* Report a set this board's collector wrote, never blocks it; a refused set is left out of the cross-node index */
+bool ClusterLink::offerSet(uint64_t set, uint64_t timestamp) {
+    NodeSet entry = {set, timestamp};
+    return _offered.tryPush(entry);
+}
+
+uint64_t ClusterLink::getSetsWritten() {
+    return _setsWritten;
+}
+
+uint64_t ClusterLink::getSetsIncomplete() {
+    return _setsIncomplete;
+}
+
+/* Spread of the member timestamps of each cross-node set, in us */
+const LatencyHistogram *ClusterLink::getAlignment() const {
+    return &_alignment;
+}
+
+bool ClusterLink::threadInitialize() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        _logger = new Logger("CLUSTER", _options.directory);
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Create the eventfd the supervisor is woken with */
+    if (!errorOccurred) {
+        _eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (_eventFd == -1) {
+            _logger->error("Failed to create the cluster eventfd!");
+            errorOccurred = true;
+        }
+    }
+
+    /* The leader listens for its followers and keeps the cross-node indexes */
+    if (!errorOccurred && _leader) {
+        if (!openListener()) {
+            _logger->error("Failed to listen on cluster port " + std::to_string(_options.clusterPort) + ": "
+                           + strerror(errno));
+            errorOccurred = true;
+        }
+    }
+    if (!errorOccurred && _leader) {
+        std::string directory(_options.directory);
+        _sets = fopen((directory + "/cluster_sets.csv").c_str(), "w");
+        _clock = fopen((directory + "/cluster_clock.csv").c_str(), "w");
+        if (!_sets || !_clock) {
+            _logger->error("Failed to create the cross-node indexes!");
+            errorOccurred = true;
+        } else {
+            fprintf(_sets, "set,timestamp,error_us");
+            for (uint32_t i = 0; i < _numNodes; i++)
+                fprintf(_sets, ",node%u", i);
+            fprintf(_sets, "\n");
+            fprintf(_clock, "elapsed_ms,node,offset_ns,round_trip_ns\n");
+        }
+    }
+
+    /* A follower waits for the leader to come up */
+    if (!errorOccurred && !_leader && !connectLeader()) {
+        _logger->error("Failed to reach the leader at " + _options.leaderHost + ":"
+                       + std::to_string(_options.clusterPort) + "!");
+        errorOccurred = true;
+    }
+
+    if (!errorOccurred) {
+        _start = now();
+        _nextReport = _start + CLUSTER_LOG_S * 1000000000ULL;
+        std::stringstream ss;
+        if (_leader)
+            ss << "Leading " << _numNodes - 1 << " followers on port " << _options.clusterPort;
+        else
+            ss << "Following the leader at " << _options.leaderHost << ":" << _options.clusterPort;
+        _logger->log(ss.str(), STDOUT_PRINT);
+    }
+    return !errorOccurred;
+}
+
+bool ClusterLink::threadExecute() {
+    service(CLUSTER_POLL_MS);
+    if (_leader) {
+        if (!_failed && !collect(false)) {
+            _logger->error("Failed to write the cross-node set index!");
+            _failed = true;
+        }
+        if (now() >= _nextReport) {
+            _nextReport += CLUSTER_LOG_S * 1000000000ULL;
+            report(false);
+            fflush(_clock);
+        }
+    }
+    return true;
+}
+
+bool ClusterLink::threadShutdown() {
+
+    /* A follower's collector has written its last sets, send them and say it is done */
+    if (!_leader) {
+        service(0);
+        if (_fd != -1) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            sendLine(_fd, "done");
+        }
+        _logger->log("Sets reported to the leader: " + std::to_string(_reported), STDOUT_PRINT);
+        return true;
+    }
+
+    /* The followers flush their collectors once told to quit, wait a while for their last sets */
+    uint64_t deadline = now() + CLUSTER_DONE_S * 1000000000ULL;
+    while (isWaiting() && now() < deadline)
+        service(CLUSTER_POLL_MS);
+    for (uint32_t i = 1; i < _numNodes; i++)
+        if (_nodes[i].joined && !_nodes[i].gone && !_nodes[i].done)
+            _logger->log("Node " + std::to_string(i) + " did not send its last sets", STDOUT_PRINT);
+
+    /* Whatever is left can only form incomplete sets */
+    takeOffered();
+    if (!_failed && !collect(true))
+        _failed = true;
+    if (_sets && fflush(_sets) != 0)
+        _failed = true;
+    if (_clock)
+        fflush(_clock);
+    report(true);
+    return !_failed;
+}
+
+/* Listen on every address at the cluster port, return bool indicating success */
+bool ClusterLink::openListener() {
+    _fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_fd == -1)
+        return false;
+    int reuse = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(_options.clusterPort);
+    return bind(_fd, (struct sockaddr *) &address, sizeof(address)) == 0 && listen(_fd, CLUSTER_BACKLOG) == 0;
+}
+
+/* Connect to the leader, retrying each second for up to CLUSTER_CONNECT_S, return bool indicating success */
+bool ClusterLink::connectLeader() {
+    std::string port = std::to_string(_options.clusterPort);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(CLUSTER_CONNECT_S);
+    bool waiting = false;
+    while (_fd == -1) {
+        struct addrinfo hints;
+        struct addrinfo *result = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(_options.leaderHost.c_str(), port.c_str(), &hints, &result) == 0) {
+            _fd = ::socket(result->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (_fd != -1 && connect(_fd, result->ai_addr, result->ai_addrlen) != 0) {
+                close(_fd);
+                _fd = -1;
+            }
+            freeaddrinfo(result);
+        }
+        if (_fd != -1)
+            break;
+        if (std::chrono::steady_clock::now() >= deadline)
+            return false;
+        if (!waiting) {
+            _logger->log("Waiting for the leader at " + _options.leaderHost + ":" + port + "...", STDOUT_PRINT);
+            waiting = true;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    /* Pongs go out at once, a blocked send means the leader is gone */
+    int noDelay = 1;
+    struct timeval timeout = {CLUSTER_SEND_TIMEOUT_MS / 1000, (CLUSTER_SEND_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    setsockopt(_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return true;
+}
+
+/* Wait up to timeoutMs for messages and handle them, then send what is due */
+void ClusterLink::service(int timeoutMs) {
+    std::vector<struct pollfd> descriptors;
+    std::vector<uint32_t> owners;
+    if (_fd != -1)
+        descriptors.push_back({_fd, POLLIN, 0});
+    for (uint32_t i = 1; i < _numNodes && _leader; i++) {
+        if (_nodes[i].fd == -1)
+            continue;
+        descriptors.push_back({_nodes[i].fd, POLLIN, 0});
+        owners.push_back(i);
+    }
+
+    /* The receive time is taken before any message is handled, so a pong leaves the link's own delay out */
+    if (poll(descriptors.data(), descriptors.size(), timeoutMs) > 0) {
+        uint64_t received = now();
+        std::vector<std::string> lines;
+        if (_leader) {
+            if (descriptors[0].revents & POLLIN)
+                accept();
+            for (size_t i = 1; i < descriptors.size(); i++) {
+                if (!descriptors[i].revents)
+                    continue;
+                Node& node = _nodes[owners[i - 1]];
+                lines.clear();
+                bool connected = receive(node.fd, node.buffer, lines);
+                for (size_t j = 0; j < lines.size(); j++)
+                    handleFollower(node, lines[j], received);
+                if (!connected) {
+                    _logger->log("Lost node " + std::to_string(owners[i - 1]) + " at " + node.address, !node.done);
+                    lose(node);
+                }
+            }
+        } else if (_fd != -1 && descriptors[0].revents) {
+            bool connected = receive(_fd, _buffer, lines);
+            for (size_t j = 0; j < lines.size(); j++)
+                handleLeader(lines[j], received);
+            if (!connected) {
+                _logger->log("Lost the leader, recording on alone until stopped here", STDOUT_PRINT);
+                std::lock_guard<std::mutex> lock(_mutex);
+                close(_fd);
+                _fd = -1;
+            }
+        }
+    }
+
+    if (_leader) {
+        ping();
+        takeOffered();
+        return;
+    }
+
+    /* A follower reports its warm cameras and its sets as they come */
+    if (_fd != -1 && _ready && !_readySent) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _readySent = sendLine(_fd, "ready");
+    }
+    NodeSet entry;
+    while (_offered.tryPop(entry)) {
+        if (_fd == -1)
+            continue;
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::stringstream ss;
+        ss << "set " << entry.set << " " << entry.timestamp;
+        if (sendLine(_fd, ss.str()))
+            _reported++;
+    }
+}
+
+/* Accept a follower into the node it had if it lost its connection, else the first that has not joined
+   yet, else the first whose follower is gone */
+void ClusterLink::accept() {
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    int fd = accept4(_fd, (struct sockaddr *) &address, &length, SOCK_CLOEXEC);
+    if (fd == -1)
+        return;
+    char host[INET_ADDRSTRLEN] = "";
+    inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+    uint32_t id = 1;
+    while (id < _numNodes && !(_nodes[id].gone && _nodes[id].address == host))
+        id++;
+    for (uint32_t i = 1; i < _numNodes && id == _numNodes; i++)
+        if (!_nodes[i].joined)
+            id = i;
+    for (uint32_t i = 1; i < _numNodes && id == _numNodes; i++)
+        if (_nodes[i].gone)
+            id = i;
+    if (id == _numNodes) {
+        close(fd);
+        _logger->log(std::string("Refused a node at ") + host + ", all " + std::to_string(_numNodes - 1)
+                     + " followers have joined", STDOUT_PRINT);
+        return;
+    }
+
+    int noDelay = 1;
+    struct timeval timeout = {CLUSTER_SEND_TIMEOUT_MS / 1000, (CLUSTER_SEND_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    Node& node = _nodes[id];
+    std::lock_guard<std::mutex> lock(_mutex);
+    bool rejoined = node.gone;
+    if (rejoined) {
+        /* A follower back after a lost connection starts over, the sets it left unpaired are dropped and its
+           clock is sampled again; it warms up again before it counts as ready */
+        if (node.ready)
+            _followersReady--;
+        node.gone = false;
+        node.ready = false;
+        node.done = false;
+        node.buffer.clear();
+        node.pending.clear();
+        node.last = 0;
+        node.samples.clear();
+        node.offset = 0;
+        node.roundTrip = 0;
+    }
+    node.fd = fd;
+    node.joined = true;
+    node.address = host;
+    node.nextPing = 0; // its clock is sampled right away
+    sendLine(fd, "welcome " + std::to_string(id));
+    _logger->log("Node " + std::to_string(id) + (rejoined ? " rejoined from " : " joined from ") + host, STDOUT_PRINT);
+}
+
+/* Read what arrived on fd and split off the whole lines, false once the peer is gone */
+bool ClusterLink::receive(int fd, std::string& buffer, std::vector<std::string>& lines) {
+    char data[CLUSTER_LINE_MAX];
+    ssize_t length = recv(fd, data, sizeof(data), MSG_DONTWAIT);
+    if (length == 0)
+        return false;
+    if (length < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    buffer.append(data, length);
+    size_t end;
+    while ((end = buffer.find('\n')) != std::string::npos) {
+        lines.push_back(buffer.substr(0, end));
+        buffer.erase(0, end + 1);
+    }
+    return buffer.size() < CLUSTER_LINE_MAX; // no message of ours is that long
+}
+
+/* Send one message, the caller holds the mutex. Return bool indicating success */
+bool ClusterLink::sendLine(int fd, const std::string& line) {
+    std::string message = line + "\n";
+    return send(fd, message.data(), message.size(), MSG_NOSIGNAL) == (ssize_t) message.size();
+}
+
+/* Close a follower's connection, the sets it already reported are still paired */
+void ClusterLink::lose(Node& node) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    close(node.fd);
+    node.fd = -1;
+    node.gone = true;
+}
+
+/* Wake the supervisor */
+void ClusterLink::signal() {
+    uint64_t count = 1;
+    if (write(_eventFd, &count, sizeof(count)) < 0)
+        _logger->log("Failed to wake the supervisor");
+}
+
+/* Handle one message of a follower on the leader */
+void ClusterLink::handleFollower(Node& node, const std::string& line, uint64_t received) {
+    uint32_t id = &node - &_nodes[0];
+    std::stringstream ss(line);
+    std::string verb;
+    ss >> verb;
+
+    /* A follower warming up after the others started recording starts right away */
+    if (verb == "ready") {
+        if (node.ready)
+            return;
+        node.ready = true;
+        _followersReady++;
+        _logger->log("Node " + std::to_string(id) + " is warm", STDOUT_PRINT);
+        signal();
+        if (_recording) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            sendLine(node.fd, "record");
+        }
+        return;
+    }
+
+    /* t0 and t3 on the leader's clock, t1 and t2 on the follower's */
+    if (verb == "pong") {
+        uint64_t t0, t1, t2;
+        if (!(ss >> t0 >> t1 >> t2))
+            return;
+        ClockSample sample;
+        sample.offset = ((int64_t) (t1 - t0) + (int64_t) (t2 - received)) / 2;
+        int64_t roundTrip = (int64_t) (received - t0) - (int64_t) (t2 - t1);
+        sample.roundTrip = roundTrip > 0 ? roundTrip : 0;
+        node.samples.push_back(sample);
+        if (node.samples.size() > CLUSTER_OFFSET_SAMPLES)
+            node.samples.pop_front();
+        ClockSample best = node.samples.front();
+        for (size_t i = 1; i < node.samples.size(); i++)
+            if (node.samples[i].roundTrip < best.roundTrip)
+                best = node.samples[i];
+        if (node.samples.size() == 1) {
+            std::stringstream message;
+            message << "Node " << id << " clock offset " << best.offset / 1000 << " us, round trip "
+                    << best.roundTrip / 1000 << " us";
+            _logger->log(message.str(), STDOUT_PRINT);
+        }
+        node.offset = best.offset;
+        node.roundTrip = best.roundTrip;
+        fprintf(_clock, "%lu,%u,%ld,%lu\n", (unsigned long) ((received - _start) / 1000000), id, (long) sample.offset,
+                (unsigned long) sample.roundTrip);
+        return;
+    }
+
+    if (verb == "set") {
+        NodeSet entry;
+        if (ss >> entry.set >> entry.timestamp) {
+            node.pending.push_back(entry);
+            node.last = entry.timestamp;
+        }
+        return;
+    }
+    if (verb == "done") {
+        node.done = true;
+        return;
+    }
+    _logger->log("Node " + std::to_string(id) + " sent an unknown message: " + line);
+}
+
+/* Handle one message of the leader on a follower */
+void ClusterLink::handleLeader(const std::string& line, uint64_t received) {
+    std::stringstream ss(line);
+    std::string verb;
+    ss >> verb;
+    if (verb == "welcome") {
+        ss >> _id;
+        _logger->log("Joined the leader as node " + std::to_string(_id), STDOUT_PRINT);
+        return;
+    }
+    if (verb == "ping") {
+        uint64_t t0;
+        if (!(ss >> t0))
+            return;
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::stringstream reply;
+        reply << "pong " << t0 << " " << received << " " << now();
+        sendLine(_fd, reply.str());
+        return;
+    }
+    for (int command = CLUSTER_RECORD; command <= CLUSTER_QUIT; command++) {
+        if (verb != COMMAND_NAMES[command])
+            continue;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _commands.push_back((ClusterCommand) command);
+        }
+        _logger->log("The leader sent " + verb);
+        signal();
+        return;
+    }
+    _logger->log("The leader sent an unknown message: " + line);
+}
+
+/* Sample the clock of every follower whose ping is due */
+void ClusterLink::ping() {
+    uint64_t time = now();
+    for (uint32_t i = 1; i < _numNodes; i++) {
+        Node& node = _nodes[i];
+        if (node.fd == -1 || time < node.nextPing)
+            continue;
+        node.nextPing = time + CLUSTER_PING_MS * 1000000ULL;
+        std::lock_guard<std::mutex> lock(_mutex);
+        sendLine(node.fd, "ping " + std::to_string(now()));
+    }
+}
+
+/* Move the sets of the leader's own collector to node 0 */
+void ClusterLink::takeOffered() {
+    NodeSet entry;
+    while (_offered.tryPop(entry)) {
+        _nodes[0].pending.push_back(entry);
+        _nodes[0].last = entry.timestamp;
+    }
+}
+
+/* A node's timestamp on the leader's clock, with the node's current best offset */
+uint64_t ClusterLink::toLeader(const Node& node, uint64_t timestamp) const {
+    return (uint64_t) ((int64_t) timestamp - node.offset);
+}
+
+/* True if the node may still report a set at or before horizon, on the leader's clock; its sets arrive in order */
+bool ClusterLink::canDeliver(const Node& node, uint64_t horizon) const {
+    if (!node.joined || node.gone || node.done)
+        return false;
+    return node.last == 0 || toLeader(node, node.last) <= horizon;
+}
+
+/* True while a follower that joined has not sent its last sets */
+bool ClusterLink::isWaiting() const {
+    for (uint32_t i = 1; i < _numNodes; i++)
+        if (_nodes[i].joined && !_nodes[i].gone && !_nodes[i].done)
+            return true;
+    return false;
+}
+
+/* Pair every cross-node set that can be decided, flush decides the rest. Returns false if writing failed */
+bool ClusterLink::collect(bool flush) {
+    while (true) {
+
+        /* Anchor the next set on the oldest pending set, a follower's are only placed once its clock is known */
+        bool anyPresent = false;
+        bool lagging = flush;
+        uint64_t anchor = UINT64_MAX;
+        for (uint32_t i = 0; i < _numNodes; i++) {
+            Node& node = _nodes[i];
+            _present[i] = !node.pending.empty();
+            if (_present[i]) {
+                if (i > 0 && node.samples.empty() && !flush)
+                    return true;
+                anyPresent = true;
+                _heads[i].set = node.pending.front().set;
+                _heads[i].timestamp = toLeader(node, node.pending.front().timestamp);
+                if (_heads[i].timestamp < anchor)
+                    anchor = _heads[i].timestamp;
+            }
+            if (node.pending.size() >= CLUSTER_WAIT_SETS)
+                lagging = true;
+        }
+        if (!anyPresent)
+            return true;
+
+        /* A board with nothing pending may still report this set unless the others are well ahead */
+        uint32_t count = 0;
+        bool decided = true;
+        uint64_t error = 0;
+        for (uint32_t i = 0; i < _numNodes; i++) {
+            _members[i] = _present[i] && _heads[i].timestamp <= anchor + _tolerance;
+            if (_members[i]) {
+                count++;
+                if (_heads[i].timestamp - anchor > error)
+                    error = _heads[i].timestamp - anchor;
+            } else if (!_present[i] && !lagging && canDeliver(_nodes[i], anchor + _tolerance)) {
+                decided = false;
+            }
+        }
+        if (!decided)
+            return true;
+
+        /* Consume the members, their sets can't belong to a later cross-node set */
+        for (uint32_t i = 0; i < _numNodes; i++)
+            if (_members[i])
+                _nodes[i].pending.pop_front();
+
+        if (count > 1)
+            _alignment.record(error / 1000);
+        bool complete = count == _numNodes;
+        if (!complete)
+            _setsIncomplete++;
+        if (complete || _options.setPolicy == SET_POLICY_PARTIAL) {
+            if (!writeSet(anchor, error))
+                return false;
+        }
+        _next++;
+    }
+}
+
+/* Append one line naming each member board's set, non-members are left empty */
+bool ClusterLink::writeSet(uint64_t timestamp, uint64_t error) {
+    fprintf(_sets, "%lu,%lu,%lu", (unsigned long) _next, (unsigned long) timestamp, (unsigned long) (error / 1000));
+    for (uint32_t i = 0; i < _numNodes; i++) {
+        if (_members[i])
+            fprintf(_sets, ",%lu", (unsigned long) _heads[i].set);
+        else
+            fprintf(_sets, ",");
+    }
+    if (fprintf(_sets, "\n") < 0)
+        return false;
+    _setsWritten++;
+    return true;
+}
+
+/* Log the alignment so far and each follower's clock offset, final also prints it */
+void ClusterLink::report(bool final) {
+    std::stringstream ss;
+    ss << "Cross-node sets written: " << _setsWritten << ", incomplete "
+       << (_options.setPolicy == SET_POLICY_DROP ? "dropped: " : "written: ") << _setsIncomplete
+       << ", alignment error p50/p99/max " << _alignment.getPercentile(50) << "/" << _alignment.getPercentile(99)
+       << "/" << _alignment.getMax() << " us";
+    for (uint32_t i = 1; i < _numNodes; i++) {
+        if (_nodes[i].samples.empty())
+            continue;
+        ss << ", node " << i << " clock offset " << _nodes[i].offset / 1000 << " us +-" << _nodes[i].roundTrip / 2000 << " us";
+    }
+    _logger->log(ss.str(), final);
+}
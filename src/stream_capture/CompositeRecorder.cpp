@@ -0,0 +1,471 @@
+/*
+ * CompositeRecorder.cpp
+ *
+ * Groups the slots every camera submits into frame sets by sensor timestamp,
+ * tiles each set into one canvas with NvBufferComposite and JPEG encodes it
+ * for a FrameWriter of its own. The slots go back to their rings as soon as
+ * the composite is done, the encode only reads the canvas.
+ */
+
+#include "CompositeRecorder.hpp"
+
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "DmabufRing.hpp"
+#include "BufferPool.hpp"
+#include "FrameWriter.hpp"
+#include "FrameSetCollector.hpp"
+#include "MemoryBudget.hpp"
+#include "TraceLog.hpp"
+#include "SteadyClock.hpp"
+#include "NvJpegEncoder.h"
+#include <sys/stat.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+#include <chrono>
+
+#define STDOUT_PRINT true
+#define MKDIR_MODE 0777
+#define COMPOSITE_WAIT_FRAMES 2     // frames another camera may get ahead before a missing one is given up on
+#define COMPOSITE_WAIT_MS 5         // longest the recorder sleeps without a submitted slot
+#define DRAIN_TIMEOUT_MS 5000       // upper bound on waiting for a camera's queued slots
+
+static uint32_t alignUp(uint32_t value, uint32_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+CompositeInput::CompositeInput(uint32_t id, CompositeRecorder& recorder) :
+    _id(id),
+    _ring(NULL),
+    _recorder(recorder),
+    _jobs(recorder._options.dmabufRing + recorder._options.preTriggerFrames + recorder._options.shareSlots
+          + recorder._options.getCaptureBuffers()),
+    _closed(false),
+    _framesWritten(0),
+    _bytesWritten(0)
+{}
+
+/* Queue a copied frame, the slot is released back to the ring once composited */
+bool CompositeInput::submit(const FrameJob& job) {
+    if (!_jobs.push(job))
+        return false;
+    _recorder.notify();
+    return true;
+}
+
+/* True once a composite or its write has failed, every consumer should stop */
+bool CompositeInput::hasFailed() {
+    return _recorder.hasFailed();
+}
+
+uint64_t CompositeInput::getFramesWritten() {
+    return _framesWritten;
+}
+
+uint64_t CompositeInput::getBytesWritten() {
+    return _bytesWritten;
+}
+
+size_t CompositeInput::getQueueDepth() {
+    return _jobs.size();
+}
+
+/* Stop waiting for this camera and wait until every slot it submitted is back in its ring */
+void CompositeInput::drain() {
+    _closed = true;
+    _recorder.notify();
+    std::unique_lock<std::mutex> lock(_recorder._mutex);
+    _recorder._drained.wait_for(lock, std::chrono::milliseconds(DRAIN_TIMEOUT_MS), [this] { return _jobs.size() == 0; });
+}
+
+CompositeRecorder::CompositeRecorder(const Options& options, uint32_t numCameras, VolumeSet *volumes) :
+    _options(options),
+    _numCameras(numCameras),
+    _tolerance((uint64_t) options.frameSetTolerance * 1000),
+    _volumes(volumes),
+    _logger(NULL),
+    _heads(numCameras),
+    _present(numCameras),
+    _members(numCameras),
+    _canvasSize(getCanvasSize(options, numCameras)),
+    _canvas(-1),
+    _jpegEncoder(NULL),
+    _pool(NULL),
+    _writer(NULL),
+    _index(NULL),
+    _next(1),
+    _composites(0),
+    _incomplete(0),
+    _dropped(0),
+    _failed(false),
+    _pending(false)
+{
+    for (uint32_t i = 0; i < _numCameras; i++)
+        _inputs.push_back(new CompositeInput(i, *this));
+    memset(&_compositeParam, 0, sizeof(_compositeParam));
+}
+
+CompositeRecorder::~CompositeRecorder() {
+    shutdown();
+    if (_writer)
+        delete _writer;
+    if (_pool)
+        delete _pool;
+    if (_jpegEncoder)
+        delete _jpegEncoder;
+    if (_canvas != -1)
+        MemoryBudget::instance().destroyNvBuffer(_canvas);
+    if (_index)
+        fclose(_index);
+    for (uint32_t i = 0; i < _inputs.size(); i++)
+        delete _inputs[i];
+    if (_logger)
+        delete _logger;
+}
+
+/* Tile of camera in the canvas: cells of the tile size rounded up to the MCU size, filled row by row
+   on a grid as close to square as the camera count allows */
+NvBufferRect CompositeRecorder::getTile(const Options& options, uint32_t numCameras, uint32_t camera) {
+    Argus::Size2D<uint32_t> tile = options.getCompositeTile();
+    uint32_t columns = (uint32_t) ceil(sqrt((double) numCameras));
+    NvBufferRect rect;
+    rect.top = (camera / columns) * alignUp(tile.height(), COMPOSITE_ALIGN);
+    rect.left = (camera % columns) * alignUp(tile.width(), COMPOSITE_ALIGN);
+    rect.width = tile.width();
+    rect.height = tile.height();
+    return rect;
+}
+
+/* Size of the canvas every tile fits in */
+Argus::Size2D<uint32_t> CompositeRecorder::getCanvasSize(const Options& options, uint32_t numCameras) {
+    Argus::Size2D<uint32_t> tile = options.getCompositeTile();
+    uint32_t columns = (uint32_t) ceil(sqrt((double) numCameras));
+    uint32_t rows = (numCameras + columns - 1) / columns;
+    return Argus::Size2D<uint32_t>(columns * alignUp(tile.width(), COMPOSITE_ALIGN),
+                                   rows * alignUp(tile.height(), COMPOSITE_ALIGN));
+}
+
+/* Hand the consumer of camera id its input, NULL if the camera is unknown or already registered */
+CompositeInput *CompositeRecorder::registerCamera(uint32_t id, DmabufRing& ring) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (id >= _inputs.size() || _inputs[id]->_ring)
+        return NULL;
+    _inputs[id]->_ring = &ring;
+    return _inputs[id];
+}
+
+/* True once compositing, encoding or writing has failed */
+bool CompositeRecorder::hasFailed() {
+    return _failed || (_writer && _writer->hasFailed());
+}
+
+uint64_t CompositeRecorder::getComposites() {
+    return _composites;
+}
+
+uint64_t CompositeRecorder::getCompositesIncomplete() {
+    return _incomplete;
+}
+
+uint64_t CompositeRecorder::getCompositesDropped() {
+    return _dropped;
+}
+
+/* Wake the recorder, a slot was submitted or a camera stopped */
+void CompositeRecorder::notify() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _pending = true;
+    _ready.notify_one();
+}
+
+bool CompositeRecorder::threadInitialize() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        _logger = new Logger("COMPOSITE", _options.directory);
+        TraceLog::instance().nameThread("COMPOSITE");
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Create the composite camera's directory, the consumers create their own */
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "Tiling " << _numCameras << " cameras into " << _canvasSize.width() << "x" << _canvasSize.height()
+           << " composites of " << _options.getCompositeTile().width() << "x" << _options.getCompositeTile().height()
+           << " tiles, written as cam" << _numCameras << "...";
+        _logger->log(ss.str(), STDOUT_PRINT);
+        std::string directory = std::string(_options.directory) + "/cam" + std::to_string(_numCameras);
+        if (mkdir(directory.c_str(), MKDIR_MODE) != 0) {
+            _logger->error("Failed to create the composite sub-directory!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Allocate the canvas, the encoder reads block-linear buffers; sources are scaled into their tiles
+       and the area outside every tile stays black */
+    if (!errorOccurred) {
+        NvBufferCreateParams params;
+        memset(&params, 0, sizeof(params));
+        params.width = _canvasSize.width();
+        params.height = _canvasSize.height();
+        params.payloadType = NvBufferPayload_SurfArray;
+        params.layout = NvBufferLayout_BlockLinear;
+        params.colorFormat = NvBufferColorFormat_YUV420;
+        params.nvbuf_tag = NvBufferTag_VIDEO_CONVERT;
+        if ((_canvas = MemoryBudget::instance().createNvBuffer(MEMORY_ENCODER, params)) == -1) {
+            _logger->error("Failed to allocate the composite canvas!");
+            errorOccurred = true;
+        }
+        _compositeParam.composite_flag = NVBUFFER_COMPOSITE;
+        for (uint32_t i = 0; i < _numCameras; i++) {
+            _compositeParam.src_comp_rect[i].top = 0;
+            _compositeParam.src_comp_rect[i].left = 0;
+            _compositeParam.src_comp_rect[i].width = _options.captureResolution.width();
+            _compositeParam.src_comp_rect[i].height = _options.captureResolution.height();
+            _compositeParam.dst_comp_rect[i] = getTile(_options, _numCameras, i);
+            _compositeParam.dst_comp_rect_alpha[i] = 1.0f;
+        }
+    }
+
+    /* Create the encoder */
+    if (!errorOccurred) {
+        _jpegEncoder = NvJPEGEncoder::createJPEGEncoder("compositeenc");
+        if (!_jpegEncoder) {
+            _logger->error("Failed to create the JPEG encoder!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Allocate memory for the encoded composites, nothing is allocated per set */
+    if (!errorOccurred) {
+        _pool = new BufferPool(_options.writeQueue, _canvasSize.area() * 3 / 2);
+        if (!_pool || !_pool->allocate()) {
+            _logger->error("Failed to allocate buffer memory!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Launch the writer of the composite camera */
+    if (!errorOccurred) {
+        _writer = new FrameWriter(_numCameras, _options, *_pool, NULL, _volumes);
+        if (!_writer) {
+            _logger->error("Failed to create writer thread!");
+            errorOccurred = true;
+        } else if (!_writer->initialize() || !_writer->waitRunning()) {
+            _logger->error("Failed to start writer thread!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Record the layout and open the composite index */
+    if (!errorOccurred && !openIndexes()) {
+        _logger->error("Failed to create the composite indexes!");
+        errorOccurred = true;
+    }
+
+    return !errorOccurred;
+}
+
+bool CompositeRecorder::threadExecute() {
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _ready.wait_for(lock, std::chrono::milliseconds(COMPOSITE_WAIT_MS), [this] { return _pending; });
+        _pending = false;
+    }
+
+    /* Once a camera has stopped the run is ending, sets are decided with whatever has arrived */
+    bool flush = false;
+    for (uint32_t i = 0; i < _numCameras; i++)
+        flush = flush || _inputs[i]->_closed;
+    if (!collect(flush) && !_failed) {
+        _logger->error("Failed to write a composite! Exiting...");
+        _failed = true;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _drained.notify_all();
+    return true;
+}
+
+bool CompositeRecorder::threadShutdown() {
+    collect(true);
+    if (_writer)
+        _writer->shutdown();
+    if (_index && fflush(_index) != 0)
+        _failed = true;
+
+    std::stringstream ss;
+    ss << "Composites written: " << _composites << ", incomplete "
+       << (_options.setPolicy == SET_POLICY_DROP ? "dropped: " : "written: ") << _incomplete
+       << ", dropped without a buffer or writer queue room: " << _dropped;
+    _logger->log(ss.str(), STDOUT_PRINT);
+    if (_composeLatency.getCount() > 0) {
+        ss.str("");
+        ss << "Composite p50/p99/max " << _composeLatency.getPercentile(50) << "/" << _composeLatency.getPercentile(99)
+           << "/" << _composeLatency.getMax() << " us, encode p50/p99/max " << _encodeLatency.getPercentile(50) << "/"
+           << _encodeLatency.getPercentile(99) << "/" << _encodeLatency.getMax() << " us";
+        _logger->log(ss.str(), STDOUT_PRINT);
+    }
+    return !_failed;
+}
+
+/* Composite and encode every set that can be decided, flush decides the rest. Slots are released
+   whatever happens to their set. Returns false if compositing, encoding or writing failed */
+bool CompositeRecorder::collect(bool flush) {
+    bool success = true;
+    while (true) {
+
+        /* Anchor the next set on the oldest pending frame */
+        bool anyPresent = false;
+        bool lagging = flush;
+        uint64_t anchor = UINT64_MAX;
+        for (uint32_t i = 0; i < _numCameras; i++) {
+            _present[i] = _inputs[i]->_jobs.peek(_heads[i]);
+            if (_present[i]) {
+                anyPresent = true;
+                if (_heads[i].sensorTimestamp < anchor)
+                    anchor = _heads[i].sensorTimestamp;
+            }
+            if (_inputs[i]->_jobs.size() >= COMPOSITE_WAIT_FRAMES)
+                lagging = true;
+        }
+        if (!anyPresent)
+            return success;
+
+        /* A camera with nothing pending may still deliver this set unless the others are ahead */
+        uint32_t count = 0;
+        bool decided = true;
+        for (uint32_t i = 0; i < _numCameras; i++) {
+            _members[i] = _present[i] && _heads[i].sensorTimestamp <= anchor + _tolerance;
+            if (_members[i])
+                count++;
+            else if (!_present[i] && !lagging)
+                decided = false;
+        }
+        if (!decided)
+            return success;
+
+        bool complete = count == _numCameras;
+        if (!complete)
+            _incomplete++;
+        bool write = !_failed && (complete || _options.setPolicy == SET_POLICY_PARTIAL);
+        int quality = 0;
+        if (write && !compose(count, quality))
+            success = false;
+
+        /* The canvas holds the set, the slots can go back before the encode */
+        FrameJob job;
+        for (uint32_t i = 0; i < _numCameras; i++) {
+            if (_members[i]) {
+                _inputs[i]->_ring->release(_heads[i].slot);
+                _inputs[i]->_jobs.tryPop(job);
+            }
+        }
+        if (write && success && !encode(anchor, count, quality))
+            success = false;
+    }
+}
+
+/* Tile the members into the canvas, quality is the lowest any of them asked for */
+bool CompositeRecorder::compose(uint32_t& count, int& quality) {
+    uint64_t start = now();
+    NvBufferCompositeParams compositeParam = _compositeParam;
+    int dmabufs[MAX_COMPOSITE_FRAME];
+    count = 0;
+    quality = 100;
+    for (uint32_t i = 0; i < _numCameras; i++) {
+        if (!_members[i])
+            continue;
+        dmabufs[count] = _heads[i].fd;
+        compositeParam.src_comp_rect[count] = _compositeParam.src_comp_rect[i];
+        compositeParam.dst_comp_rect[count] = _compositeParam.dst_comp_rect[i];
+        quality = std::min(quality, _heads[i].quality);
+        count++;
+    }
+    compositeParam.input_buf_count = count;
+    if (NvBufferComposite(dmabufs, _canvas, &compositeParam) != 0) {
+        _logger->error("Failed to composite a frame set!");
+        return false;
+    }
+    uint64_t end = now();
+    _composeLatency.record((end - start) / 1000);
+    TraceLog::instance().span("composite", start, end, _next);
+    return true;
+}
+
+/* Encode the canvas, hand it to the writer and list its members; a composite without an output buffer
+   or room in the writer queue is dropped and counted */
+bool CompositeRecorder::encode(uint64_t timestamp, uint32_t count, int quality) {
+    EncodedFrame encoded;
+    memset(&encoded, 0, sizeof(encoded));
+    encoded.index = _next++;
+    encoded.timestamp = timestamp;
+    if (!_writer->getBuffer(encoded)) {
+        _dropped++;
+        return true;
+    }
+
+    uint64_t start = now();
+    _jpegEncoder->setRestartRows(_options.restartRows);
+    if (_jpegEncoder->encodeFromFd(_canvas, JCS_YCbCr, &encoded.data, encoded.size, quality) != 0) {
+        _logger->error("An error occurred while encoding the composite!");
+        _writer->returnBuffer(encoded);
+        return false;
+    }
+    uint64_t end = now();
+    _encodeLatency.record((end - start) / 1000);
+    TraceLog::instance().span("encode", start, end, encoded.index);
+    unsigned long size = encoded.size;
+    if (!_writer->submit(encoded)) {
+        _writer->returnBuffer(encoded);
+        _dropped++;
+        return true;
+    }
+    _composites++;
+
+    /* The set in the index, non-members are left empty */
+    fprintf(_index, "%lu,%lu", (unsigned long) encoded.index, (unsigned long) timestamp);
+    for (uint32_t i = 0; i < _numCameras; i++) {
+        if (_members[i]) {
+            fprintf(_index, ",%06lu", (unsigned long) _heads[i].index);
+            _inputs[i]->_framesWritten++;
+            _inputs[i]->_bytesWritten += size / count;
+        } else {
+            fprintf(_index, ",");
+        }
+    }
+    return fprintf(_index, "\n") >= 0;
+}
+
+/* Write tiles.csv and open composite.csv with its header, both in the composite camera's directory */
+bool CompositeRecorder::openIndexes() {
+    std::string directory = std::string(_options.directory) + "/cam" + std::to_string(_numCameras);
+    FILE *tiles = fopen((directory + "/tiles.csv").c_str(), "w");
+    if (!tiles)
+        return false;
+    fprintf(tiles, "camera,left,top,width,height\n");
+    for (uint32_t i = 0; i < _numCameras; i++) {
+        NvBufferRect tile = getTile(_options, _numCameras, i);
+        fprintf(tiles, "%u,%u,%u,%u,%u\n", i, tile.left, tile.top, tile.width, tile.height);
+    }
+    if (fclose(tiles) != 0)
+        return false;
+
+    _index = fopen((directory + "/composite.csv").c_str(), "w");
+    if (!_index)
+        return false;
+    fprintf(_index, "index,timestamp");
+    for (uint32_t i = 0; i < _numCameras; i++)
+        fprintf(_index, ",cam%u", i);
+    return fprintf(_index, "\n") >= 0;
+}
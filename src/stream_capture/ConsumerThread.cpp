@@ -2,49 +2,233 @@
  * ConsumerThread.cpp
  *
  * Creates an EGLStream::FrameConsumer object to read frames from the
- * OutputStream, then creates/populates an NvBuffer (dmabuf) from the frames
- * to be processed by processV4L2Fd, which saves each frame as a JPEG image.
- * Note that for ThreadExecute to terminate, stopExecute must first be 
- * called on the object.
+ * OutputStream, then copies each saved frame into an NvBuffer (dmabuf) from a
+ * DmabufRing and submits it to the shared EncodeScheduler, whose workers JPEG
+ * encode it and hand it to a FrameWriter thread for saving. In raw format a RawWriter stores
+ * the planes uncompressed instead, and in h264/h265 format a VideoWriter feeds
+ * them to the hardware video encoder. Note that for ThreadExecute
+ * to terminate, stopExecute must first be called on the object. The passed
+ * eventfd is signalled when the thread stops executing so the App can react.
+ * With a FrameSetCollector each submitted frame is reported with its sensor
+ * timestamp so the cameras' frames can be grouped into sets. With --metadata the
+ * capture metadata of each submitted frame is appended to a MetadataLog.
+ * With --zero-copy the stream is a BufferStream capturing into NvBuffers the
+ * ring owns, which are handed downstream without a copy while Argus still has
+ * others to capture into. With a VolumeSet the writers spread the images over
+ * several volumes. With a BackpressureEngine the backlog is reported for every
+ * acquired frame, and the engine decides which frames are saved and the JPEG
+ * quality they are encoded at. Settings changed while recording arrive as a
+ * CameraControl through control() and are applied between two frames. A
+ * paused consumer keeps acquiring, so AE/AWB stay converged, but releases
+ * every frame unsaved; each resume starts a new segment, listed with its first
+ * image index in camN/segments.csv. With --trigger only the bursts a trigger
+ * asks for are saved, each a segment of its own. With --pre-trigger the
+ * newest frames are copied into a PreTriggerRing while waiting, and each burst
+ * starts with them. With --motion-gate a MotionGate skips frames that barely
+ * differ from the last one kept. With --exposure-gate an ExposureGate skips,
+ * or encodes at a low quality, frames whose ISP histogram is mostly black or
+ * saturated. With --tnr a TnrFilter's temporal noise reduction on the VIC
+ * takes the place of the copy into the ring, and with --raw-layout bayer12 a
+ * BayerPacker packing the RAW16 stream's samples on the CPU does. Every acquired frame after the warm-up is
+ * observed by a FrameCadence, so the frames lost before the consumer and the
+ * sensor timestamp jitter are known, and the drops of every later stage are
+ * counted where they happen.
  */
 
 #include "ConsumerThread.hpp"
 
 #include "Options.hpp"
 #include "Logger.hpp"
-#include <NvJpegEncoder.h>
+#include "ThreadPlacement.hpp"
+#include "FrameWriter.hpp"
+#include "BufferPool.hpp"
+#include "DmabufRing.hpp"
+#include "EncodeScheduler.hpp"
+#include "RawWriter.hpp"
+#include "VideoWriter.hpp"
+#include "TelemetryLog.hpp"
+#include "TraceLog.hpp"
+#include "AllocCounters.hpp"
+#include "FrameSetCollector.hpp"
+#include "CompositeRecorder.hpp"
+#include "MetadataLog.hpp"
+#include "BackpressureEngine.hpp"
+#include "PreTriggerRing.hpp"
+#include "MotionGate.hpp"
+#include "ExposureGate.hpp"
+#include "TnrFilter.hpp"
+#include "BayerPacker.hpp"
+#include "FrameCadence.hpp"
+#include "FramePublisher.hpp"
+#include "SteadyClock.hpp"
 #include <EGLStream/NV/ImageNativeBuffer.h>
-#include <fstream>
+#include <EGLStream/ArgusCaptureMetadata.h>
+#include <Argus/Ext/InternalFrameCount.h>
+#include <algorithm>
 #include <sstream>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <chrono>
+#include <string.h>
 
 using namespace Argus;
 using namespace EGLStream;
 
 #define MKDIR_MODE 0777
 #define STDOUT_PRINT true
-#define NUM_FRAMES_SKIP 100 // skip frames to avoid white-balance issues
+#define NUM_FRAMES_SKIP 100 // most frames skipped at full rate while AE/AWB converge
+#define WARMUP_CONVERGED_FRAMES 3 // consecutive converged frames that end the warm-up early
+#define REPEAT_WAIT_US 1000 // pause before acquiring again after the EGLStream handed out a frame a second time
+#define INTERVAL_ACQUIRE_NS 1000000000ULL // acquire timeout between time-lapse shots, nothing arrives until the next
 
-ConsumerThread::ConsumerThread(OutputStream *stream, uint32_t id, const Options& options) :
+/* Argus states are UUIDs, store them as the small codes MetadataRecord documents */
+static uint8_t getAeStateValue(const AeState& state) {
+    const AeState states[] = {AE_STATE_INACTIVE, AE_STATE_SEARCHING, AE_STATE_CONVERGED,
+                              AE_STATE_FLASH_REQUIRED, AE_STATE_TIMEOUT};
+    for (uint8_t i = 0; i < sizeof(states) / sizeof(states[0]); i++)
+        if (state == states[i])
+            return i;
+    return METADATA_STATE_UNKNOWN;
+}
+
+static uint8_t getAwbStateValue(const AwbState& state) {
+    const AwbState states[] = {AWB_STATE_INACTIVE, AWB_STATE_SEARCHING, AWB_STATE_CONVERGED, AWB_STATE_LOCKED};
+    for (uint8_t i = 0; i < sizeof(states) / sizeof(states[0]); i++)
+        if (state == states[i])
+            return i;
+    return METADATA_STATE_UNKNOWN;
+}
+
+/* True once auto exposure and white balance have settled on the frame */
+static bool isConverged(const ICaptureMetadata *iMetadata) {
+    AwbState awb = iMetadata->getAwbState();
+    return (iMetadata->getAeState() == AE_STATE_CONVERGED || iMetadata->getAeLocked())
+           && (awb == AWB_STATE_CONVERGED || awb == AWB_STATE_LOCKED);
+}
+
+/* The frame's capture metadata, NULL if it has none */
+static const ICaptureMetadata *getCaptureMetadata(Frame *frame) {
+    IArgusCaptureMetadata *iArgusCaptureMetadata = interface_cast<IArgusCaptureMetadata>(frame);
+    if (!iArgusCaptureMetadata)
+        return NULL;
+    return interface_cast<ICaptureMetadata>(iArgusCaptureMetadata->getMetadata());
+}
+
+/* Internal frame count of a capture, 0 if Argus does not report one */
+static uint64_t getInternalFrameCount(const CaptureMetadata *metadata) {
+    const Ext::IInternalFrameCount *iInternal = interface_cast<const Ext::IInternalFrameCount>(metadata);
+    return iInternal ? iInternal->getInternalFrameCount() : 0;
+}
+
+/* Copy the exposure the EXIF header of the frame's image reports */
+static void fillExposure(const ICaptureMetadata *iMetadata, FrameJob& job) {
+    job.exposureTime = iMetadata ? iMetadata->getSensorExposureTime() : 0;
+    job.gain = iMetadata ? iMetadata->getSensorAnalogGain() * iMetadata->getIspDigitalGain() : 0.0f;
+}
+
+/* Fill a MetadataRecord from the capture metadata, read before the buffer can be handed back */
+static void fillMetadataRecord(const ICaptureMetadata *iMetadata, uint64_t frameNumber, uint64_t index, MetadataRecord& record) {
+    memset(&record, 0, sizeof(record));
+    record.frameNumber = frameNumber;
+    record.index = index;
+    if (iMetadata) {
+        BayerTuple<float> gains = iMetadata->getAwbGains();
+        record.sensorTimestamp = iMetadata->getSensorTimestamp();
+        record.exposureTime = iMetadata->getSensorExposureTime();
+        record.frameDuration = iMetadata->getFrameDuration();
+        record.readoutTime = iMetadata->getFrameReadoutTime();
+        record.captureId = iMetadata->getCaptureId();
+        record.awbCct = iMetadata->getAwbCct();
+        record.analogGain = iMetadata->getSensorAnalogGain();
+        record.ispDigitalGain = iMetadata->getIspDigitalGain();
+        record.sceneLux = iMetadata->getSceneLux();
+        record.awbGains[0] = gains.r();
+        record.awbGains[1] = gains.gEven();
+        record.awbGains[2] = gains.gOdd();
+        record.awbGains[3] = gains.b();
+        record.aeState = getAeStateValue(iMetadata->getAeState());
+        record.awbState = getAwbStateValue(iMetadata->getAwbState());
+        record.aeLocked = iMetadata->getAeLocked();
+    }
+}
+
+ConsumerThread::ConsumerThread(OutputStream *stream, uint32_t id, const Options& options, EncodeScheduler *scheduler,
+                               FrameSetCollector *collector, VolumeSet *volumes, BackpressureEngine *backpressure,
+                               FramePublisher *publisher, QuickLookServer *quickLook, CompositeRecorder *composite,
+                               int eventFd) :
         _stream(stream),
-        _dmabuf(-1),
-        _jpegEncoder(NULL),
-        _outputBuffer(NULL),
-        _outputBufferSize(0),
+        _ring(NULL),
+        _pool(NULL),
+        _writer(NULL),
+        _scheduler(scheduler),
+        _channel(NULL),
+        _composite(composite),
+        _compositeInput(NULL),
+        _rawWriter(NULL),
+        _videoWriter(NULL),
+        _sink(NULL),
+        _telemetry(NULL),
+        _collector(collector),
+        _volumes(volumes),
+        _backpressure(backpressure),
+        _publisher(publisher),
+        _quickLook(quickLook),
+        _metadata(NULL),
+        _preTrigger(NULL),
+        _motionGate(NULL),
+        _exposureGate(NULL),
+        _tnr(NULL),
+        _packer(NULL),
+        _cadence(NULL),
         _id(id),
         _options(options),
         _logger(NULL),
-        _doExecute(true)
+        _eventFd(eventFd),
+        _doExecute(true),
+        _warm(false),
+        _paused(options.startPaused),
+        _controlPending(false),
+        _segments(NULL),
+        _lastFrameTime(0),
+        _acquireTimeouts(0),
+        _ringDrops(0),
+        _queueDrops(0),
+        _framesZeroCopy(0),
+        _framesCopied(0),
+        _streamLost(false),
+        _restarts(0),
+        _outageNs(0)
 {}
 
 ConsumerThread::~ConsumerThread() {
-    if (_jpegEncoder)
-        delete _jpegEncoder;
-    if (_outputBuffer)
-        delete[] _outputBuffer;
-    if (_dmabuf != -1)
-        NvBufferDestroy(_dmabuf);
+    if (_rawWriter)
+        delete _rawWriter;
+    if (_videoWriter)
+        delete _videoWriter;
+    if (_writer)
+        delete _writer;
+    if (_pool)
+        delete _pool;
+    if (_preTrigger)
+        delete _preTrigger;
+    if (_motionGate)
+        delete _motionGate;
+    if (_exposureGate)
+        delete _exposureGate;
+    if (_tnr)
+        delete _tnr;
+    if (_packer)
+        delete _packer;
+    if (_cadence)
+        delete _cadence;
+    if (_ring)
+        delete _ring;
+    if (_telemetry)
+        delete _telemetry;
+    if (_metadata)
+        delete _metadata;
+    if (_segments)
+        fclose(_segments);
     if (_logger)
         delete _logger;
 }
@@ -58,6 +242,7 @@ bool ConsumerThread::threadInitialize() {
         std::stringstream ss;
         ss << "CONSUMER " << std::to_string(_id);
         _logger = new Logger(ss.str(), _options.directory);
+        TraceLog::instance().nameThread(ss.str());
         if (!_logger) {
             errorOccurred = true;
         } else {
@@ -70,6 +255,11 @@ bool ConsumerThread::threadInitialize() {
         }
     }
 
+    /* Pin the thread and set its scheduling class, a failure is logged but not fatal */
+    if (!errorOccurred) {
+        placeThread(_options.getConsumerCpu(_id), _options.rtPolicy, _options.rtPriority, _logger);
+    }
+
     /* Create the image sub-directory */
     if (!errorOccurred) {
         _logger->log("Creating the image sub-directory...");
@@ -81,8 +271,8 @@ bool ConsumerThread::threadInitialize() {
         }
     }
 
-    /* Create the frame consumer */
-    if (!errorOccurred) {
+    /* Create the frame consumer, a buffer stream is read through the ring instead */
+    if (!errorOccurred && !_options.zeroCopy) {
         _logger->log("Creating the frame consumer...");
         _consumer.reset(FrameConsumer::create(_stream));
         if (!_consumer && !_consumer.get()) {
@@ -91,26 +281,184 @@ bool ConsumerThread::threadInitialize() {
         }
     }
 
-    /* Allocate memory for JPEG encoded images */
+    /* Open the per-frame telemetry log, every later stage appends to it */
+    if (!errorOccurred && _options.telemetry) {
+        _logger->log("Creating the telemetry log...");
+        std::stringstream ss;
+        ss << _options.directory << "/cam" << std::to_string(_id);
+        _telemetry = new TelemetryLog(_id, ss.str());
+        if (!_telemetry || !_telemetry->open()) {
+            _logger->error("Failed to create the telemetry log!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Open the capture metadata log, preallocated for the frames a timed run will save */
+    if (!errorOccurred && _options.metadata) {
+        _logger->log("Creating the metadata log...");
+        std::stringstream ss;
+        ss << _options.directory << "/cam" << std::to_string(_id);
+        uint64_t expected = (uint64_t) _options.captureTime * (1000000000ULL / _options.getFrameDuration(_id))
+                            / _options.getFrameStride(_id);
+        _metadata = new MetadataLog(_id, ss.str(), expected);
+        if (!_metadata || !_metadata->open()) {
+            _logger->error("Failed to create the metadata log!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Create the motion gate's downscale buffer */
+    if (!errorOccurred && _options.motionThreshold > 0) {
+        _logger->log("Creating the motion gate...");
+        std::stringstream ss;
+        ss << _options.directory << "/cam" << std::to_string(_id);
+        _motionGate = new MotionGate(_id, ss.str(), _options.motionThreshold, _options.motionKeep * 1000000000ULL);
+        if (!_motionGate || !_motionGate->open()) {
+            _logger->error(_motionGate ? _motionGate->getError() + "!" : "Failed to create the motion gate!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Open the temporal noise reduction, which filters every copy into the ring in frame order */
+    if (!errorOccurred && _options.getTnr(_id) != TNR_OFF) {
+        _logger->log(std::string("Creating the ") + Options::getTnrName(_options.getTnr(_id)) + " TNR filter...");
+        _tnr = new TnrFilter(_id, _options.getTnr(_id));
+        if (!_tnr || !_tnr->open(_options.captureResolution, DmabufRing::getColorFormat(_options, _id),
+                                 DmabufRing::getLayout(_options))) {
+            _logger->error(_tnr ? _tnr->getError() + "!" : "Failed to create the TNR filter!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Create the exposure gate, it only reads the capture metadata */
+    if (!errorOccurred && _options.exposureGate > 0) {
+        _exposureGate = new ExposureGate(_options.exposureGate / 100.0);
+        if (!_exposureGate) {
+            _logger->error("Failed to create the exposure gate!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Create the frame cadence accounting */
     if (!errorOccurred) {
-        _logger->log("Creating the encoder output buffer...");
-        _outputBufferSize = getJPEGSize(_options.captureResolution.width(), _options.captureResolution.height());
-        _outputBuffer = new unsigned char[_outputBufferSize];
-        if (!_outputBuffer) {
-            _logger->error("Failed to allocate buffer memory!");
+        _cadence = new FrameCadence(_options.getFrameDuration(_id));
+        if (!_cadence) {
+            _logger->error("Failed to create the frame cadence accounting!");
             errorOccurred = true;
         }
     }
 
-    /* Create encoder with name jpegenc */
+    /* Create the dmabuf ring, buffers are created from the first saved frame; the pre-trigger frames and
+       those held for --share subscribers take slots of their own on top of the copy and capture targets */
     if (!errorOccurred) {
-        _logger->log("Creating the encoder...");
-        _jpegEncoder = NvJPEGEncoder::createJPEGEncoder("jpegenc");
-        if (!_jpegEncoder) {
-            _logger->error("Failed to create JPEGEncoder!");
+        uint32_t shared = _publisher ? _options.shareSlots : 0;
+        _ring = new DmabufRing(_options.dmabufRing + _options.preTriggerFrames + shared,
+                               _options.zeroCopy ? _options.getCaptureBuffers() + shared : 0);
+        if (!_ring) {
+            _logger->error("Failed to create dmabuf ring!");
+            errorOccurred = true;
+        }
+    }
+    if (!errorOccurred && _options.preTriggerFrames > 0) {
+        _preTrigger = new PreTriggerRing(_options.preTriggerFrames);
+        if (!_preTrigger) {
+            _logger->error("Failed to create the pre-trigger ring!");
+            errorOccurred = true;
+        }
+    }
+
+    /* With a buffer stream the ring also owns the capture targets, so allocate it up front */
+    if (!errorOccurred && _options.zeroCopy) {
+        _logger->log("Creating " + std::to_string(_options.getCaptureBuffers()) + " capture buffers...");
+        if (!_ring->allocate(_stream, eglGetDisplay(EGL_DEFAULT_DISPLAY), _options.captureResolution,
+                             DmabufRing::getColorFormat(_options, _id), DmabufRing::getLayout(_options))) {
+            _logger->error("Failed to create the capture buffers!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Bayer frames are packed on the CPU, there is no NvBuffer to take the slots' layout from */
+    if (!errorOccurred && _options.isBayer()) {
+        _packer = new BayerPacker();
+        if (!_packer || !_ring->allocate(BayerPacker::getPackedSize(_options.captureResolution),
+                                         DmabufRing::getColorFormat(_options, _id), DmabufRing::getLayout(_options))) {
+            _logger->error("Failed to create the Bayer ring buffers!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Raw frames skip the encoder, the writer maps the dmabufs directly */
+    bool encode = _options.format == FORMAT_JPEG && !_composite;
+    if (!errorOccurred && _options.format == FORMAT_RAW) {
+        _logger->log("Launching the raw writer thread...");
+        _rawWriter = new RawWriter(_id, _options, *_ring, _telemetry, _volumes);
+        _sink = _rawWriter;
+        if (!_rawWriter) {
+            _logger->error("Failed to create raw writer thread!");
+            errorOccurred = true;
+        } else if (!_rawWriter->initialize() || !_rawWriter->waitRunning()) {
+            _logger->error("Failed to start raw writer thread!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Video frames are queued on the video encoder straight from the ring */
+    if (!errorOccurred && _options.isVideoFormat()) {
+        _logger->log("Launching the video writer thread...");
+        _videoWriter = new VideoWriter(_id, _options, *_ring, _telemetry, _volumes);
+        _sink = _videoWriter;
+        if (!_videoWriter) {
+            _logger->error("Failed to create video writer thread!");
+            errorOccurred = true;
+        } else if (!_videoWriter->initialize() || !_videoWriter->waitRunning()) {
+            _logger->error("Failed to start video writer thread!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Allocate memory for JPEG encoded images, nothing is allocated per frame */
+    if (!errorOccurred && encode) {
+        _logger->log("Creating the encoder output buffer pool...");
+        Size2D<uint32_t> size = _options.getEncodeSize(_id);
+        _pool = new BufferPool(_options.writeQueue, getJPEGSize(size.width(), size.height()));
+        if (!_pool || !_pool->allocate()) {
+            _logger->error("Failed to allocate buffer memory!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Launch the writer thread, which returns buffers to the pool once written */
+    if (!errorOccurred && encode) {
+        _logger->log("Launching the writer thread...");
+        _writer = new FrameWriter(_id, _options, *_pool, _telemetry, _volumes, _quickLook);
+        if (!_writer) {
+            _logger->error("Failed to create writer thread!");
+            errorOccurred = true;
+        } else if (!_writer->initialize() || !_writer->waitRunning()) {
+            _logger->error("Failed to start writer thread!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Register with the encode scheduler, whose workers return dmabufs to the ring once encoded */
+    if (!errorOccurred && encode) {
+        _logger->log("Registering with the encode scheduler...");
+        _channel = _scheduler ? _scheduler->registerCamera(_id, *_ring, *_writer) : NULL;
+        _sink = _channel;
+        if (!_channel) {
+            _logger->error("Failed to register with the encode scheduler!");
+            errorOccurred = true;
+        }
+    }
+
+    /* With --composite the recorder takes the slots, tiles each frame set and encodes it once */
+    if (!errorOccurred && _composite) {
+        _logger->log("Registering with the composite recorder...");
+        _compositeInput = _composite->registerCamera(_id, *_ring);
+        _sink = _compositeInput;
+        if (!_compositeInput) {
+            _logger->error("Failed to register with the composite recorder!");
             errorOccurred = true;
-        } else if (_options.profile) {
-            _jpegEncoder->enableProfiling();
         }
     }
 
@@ -121,69 +469,398 @@ bool ConsumerThread::threadExecute() {
 
     IEGLOutputStream *iEglOutputStream = interface_cast<IEGLOutputStream>(_stream);
     IFrameConsumer *iFrameConsumer = interface_cast<IFrameConsumer>(_consumer);
+    bool bufferStream = _options.zeroCopy;
     bool errorOccurred = false;
 
-    /* Wait until the producer has connected to the stream. */
-    _logger->log("Waiting until producer is connected...");
-    if (iEglOutputStream->waitUntilConnected() != STATUS_OK) {
-        _logger->error("Stream failed to connect! Exiting...");
-        errorOccurred = true;
-    } else
-        _logger->log("Producer has connected! Continuing...", STDOUT_PRINT);
+    /* Wait until the producer has connected to the stream, a buffer stream needs no connection */
+    if (!bufferStream) {
+        _logger->log("Waiting until producer is connected...");
+        if (iEglOutputStream->waitUntilConnected() != STATUS_OK) {
+            _logger->error("Stream failed to connect! Exiting...");
+            errorOccurred = true;
+        } else
+            _logger->log("Producer has connected! Continuing...", STDOUT_PRINT);
+    }
 
     /* Repeatedly save frames until a shutdown is requested from outside the class */
+    uint64_t acquireTimeout = _options.acquireTimeout * _options.getFrameDuration(_id);
+    uint32_t stride = _options.getFrameStride(_id);
+    uint64_t framesSkip = NUM_FRAMES_SKIP * _options.captureFrameDuration / _options.getFrameDuration(_id); // same warm-up time when the sensor runs slower
+    uint32_t captureCount = _ring->getCount() - _ring->getCopyCount();
     uint64_t index = 1;
+    uint64_t captures = 0;
+    uint64_t lastNumber = 0;
     UniqueObj<Frame> frame;
     IFrame *iFrame = NULL;
     NV::IImageNativeBuffer *iNativeBuffer = NULL;
     bool wroteFirst = false;
+    bool warm = false;
+    uint32_t convergedFrames = 0;
+    uint64_t lastSaved = 0;
+    uint32_t segment = 0;
+    uint32_t burstLeft = 0;
+    bool segmentOpen = false;
+    uint64_t firstIndex = 0;
+    uint64_t firstTimestamp = 0;
+    uint64_t lostAt = 0;
+    AllocCounters counters;
     auto start = std::chrono::steady_clock::now();
     while (!errorOccurred && _doExecute) {
 
-        /* Acquire a frame, null when stream ends or no frames available */
-        frame.reset(iFrameConsumer->acquireFrame());
-        iFrame = interface_cast<IFrame>(frame);
+        /* Acquire a frame from the EGLStream or a filled capture target from the buffer stream,
+           null on timeout or when the stream ends. Once warm, time-lapse shots are seconds apart */
+        bool idle = _options.interval > 0 && warm;
+        uint64_t timeout = idle ? INTERVAL_ACQUIRE_NS : acquireTimeout;
+        Status status = STATUS_OK;
+        uint64_t acquireStart = now();
+        uint64_t frameNumber = 0;
+        uint64_t timestamp = 0;
+        const CaptureMetadata *captureMetadata = NULL;
+        const ICaptureMetadata *iMetadata = NULL;
+        uint32_t captureSlot = 0;
+        int captureFd = -1;
+        if (bufferStream) {
+            Buffer *buffer = _ring->acquireCapture(timeout, &status, captureSlot, captureFd);
+            if (buffer) {
+                frameNumber = ++captures;
+                captureMetadata = interface_cast<IBuffer>(buffer)->getMetadata();
+                iMetadata = interface_cast<const ICaptureMetadata>(captureMetadata);
+                timestamp = iMetadata ? iMetadata->getSensorTimestamp() : 0;
+            }
+        } else {
+            frame.reset(iFrameConsumer->acquireFrame(timeout, &status));
+            iFrame = interface_cast<IFrame>(frame);
+            if (iFrame) {
+                frameNumber = iFrame->getNumber();
+                timestamp = iFrame->getTime();
+            }
+        }
+        uint64_t acquireEnd = now();
+        TraceLog::instance().span("acquire", acquireStart, acquireEnd, frameNumber);
+
+        /* Take the settings changed since the last frame, so no frame sees half of a change; a shot's
+           burst is asked for while the acquire already waits, so it must apply to the frame it returned */
+        if (_controlPending)
+            applyControl(stride, acquireTimeout, burstLeft);
+
+        /* Between time-lapse shots only a shot that does not arrive is a timeout */
+        if (frameNumber == 0 && status == STATUS_TIMEOUT) {
+            if (!idle || burstLeft > 0)
+                _acquireTimeouts++;
+            continue;
+        } else if (frameNumber == 0 && (status == STATUS_DISCONNECTED || status == STATUS_END_OF_STREAM)) {
+            if (_options.cameraRestarts == 0 || !_doExecute) {
+                _logger->log("The producer has disconnected from the stream, stopping...", _doExecute);
+                break;
+            }
+
+            /* Keep the ring and everything downstream, only the stream is replaced; the restarted
+               sensor's frame numbers start over and AE/AWB converge again */
+            frame.reset();
+            iFrame = NULL;
+            if (!lostAt)
+                lostAt = acquireEnd;
+            if (!awaitStream())
+                break;
+            iFrameConsumer = interface_cast<IFrameConsumer>(_consumer);
+            lastNumber = 0;
+            warm = false;
+            convergedFrames = 0;
+            continue;
+        }
+        if (frameNumber != 0)
+            _lastFrameTime = acquireEnd;
+
+        /* The first frame of a restarted stream ends the camera's outage */
+        if (frameNumber != 0 && lostAt) {
+            _outageNs += acquireEnd - lostAt;
+            std::stringstream ss;
+            ss << "Stream restored by restart " << _restarts << ", outage " << (acquireEnd - lostAt) / 1000000 << " ms";
+            _logger->log(ss.str(), STDOUT_PRINT);
+            lostAt = 0;
+        }
+
+        /* An EGLStream hands the released frame out again when no new one has arrived yet */
+        if (!bufferStream && frameNumber != 0 && frameNumber <= lastNumber) {
+            usleep(REPEAT_WAIT_US);
+            continue;
+        }
+        if (frameNumber != 0)
+            lastNumber = frameNumber;
+
+        /* Skip frames until AE and AWB have converged on a few frames in a row, or at most framesSkip */
+        if (!warm) {
+            const ICaptureMetadata *warmMetadata = bufferStream ? iMetadata : getCaptureMetadata(frame.get());
+            convergedFrames = warmMetadata && isConverged(warmMetadata) ? convergedFrames + 1 : 0;
+            if (convergedFrames >= WARMUP_CONVERGED_FRAMES || frameNumber > framesSkip) {
+                std::stringstream ss;
+                ss << (convergedFrames >= WARMUP_CONVERGED_FRAMES ? "AE/AWB converged" : "AE/AWB still converging")
+                   << " after " << frameNumber << " frames ("
+                   << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+                   << " ms), saving from now on";
+                _logger->log(ss.str(), convergedFrames < WARMUP_CONVERGED_FRAMES);
+                warm = true;
+                _warm = true;
+                notifySupervisor();
+                if (!counters.isStarted())
+                    counters.start();
+            }
+        } else if (frameNumber != 0) {
+            counters.count();
+        }
+
+        /* Account the frames lost before this one and its timing, a buffer stream's frame numbers are ours */
+        if (warm && frameNumber != 0) {
+            if (!bufferStream) {
+                IArgusCaptureMetadata *iArgusCaptureMetadata = interface_cast<IArgusCaptureMetadata>(frame.get());
+                captureMetadata = iArgusCaptureMetadata ? iArgusCaptureMetadata->getMetadata() : NULL;
+            }
+            const ICaptureMetadata *iCadence = interface_cast<const ICaptureMetadata>(captureMetadata);
+            _cadence->observe(iCadence ? iCadence->getSensorTimestamp() : timestamp,
+                              iCadence ? iCadence->getFrameDuration() : 0, bufferStream ? 0 : frameNumber,
+                              getInternalFrameCount(captureMetadata));
+        }
 
         /* Update the start time since we skip the first few frames */
-        if (iFrame && iFrame->getNumber() > NUM_FRAMES_SKIP && !wroteFirst)
+        if (warm && !wroteFirst)
             start = std::chrono::steady_clock::now();
 
-        if (iFrame && iFrame->getNumber() > NUM_FRAMES_SKIP && (_options.saveEvery == 1 || iFrame->getNumber() % _options.saveEvery == 0)) {
+        /* Triggered runs only save bursts, which take every frame the sensor delivers at full quality;
+           while waiting for one the newest frames are held for it, a pause drops them. Each time-lapse
+           shot is a burst of one frame */
+        bool burst = burstLeft > 0 && !_paused;
+        bool holding = _paused || ((_options.triggerFrames > 0 || _options.interval > 0) && !burst);
+        bool hold = _preTrigger && warm && holding && !_paused;
+        if (_preTrigger && _paused && _preTrigger->getSize() > 0)
+            _preTrigger->clear(*_ring);
+
+        /* Report the backlog, the engine may save fewer frames than the stride while it is high. Staggered
+           cameras each save a different frame of the stride */
+        bool save = warm && !holding && (burst || stride == 1 || frameNumber % stride == _options.getStaggerFrame(_id, stride));
+        if (_backpressure && warm && !holding) {
+            _backpressure->update(_id, getOccupancy(), frameNumber, timestamp, index);
+            if (save && !burst && !_backpressure->keep(_id, frameNumber / stride))
+                save = false;
+        }
+        if (save && burst)
+            burstLeft--;
 
-            /* Get the IImageNativeBuffer extension interface */
+        /* Judge the exposure from the ISP histogram before any pixel is copied, a burst keeps every frame */
+        bool poorExposure = false;
+        if (save && !burst && _exposureGate) {
+            if (!bufferStream)
+                iMetadata = getCaptureMetadata(frame.get());
+            poorExposure = _exposureGate->evaluate(iMetadata) != EXPOSURE_USABLE;
+            if (poorExposure && (_options.exposureQuality == 0 || _options.format != FORMAT_JPEG)) {
+                save = false;
+                if (_telemetry) {
+                    TelemetryRecord skipped;
+                    memset(&skipped, 0, sizeof(skipped));
+                    skipped.frameNumber = frameNumber;
+                    skipped.timestamp = timestamp;
+                    skipped.acquireUs = (acquireEnd - acquireStart) / 1000;
+                    skipped.flags = TELEMETRY_SKIP_EXPOSURE;
+                    _telemetry->append(skipped);
+                }
+            }
+        }
+
+        /* Get the IImageNativeBuffer extension interface */
+        if ((save || hold) && !bufferStream && !_packer) {
             iNativeBuffer = interface_cast<NV::IImageNativeBuffer>(iFrame->getImage());
             if (!iNativeBuffer) {
                 _logger->error("An error occurred while retrieving the image buffer interface! Exiting...");
                 errorOccurred = true;
             }
+        }
 
-            /* If we don't already have a buffer, create one from this image */
-            if (!errorOccurred) {
-                if (_dmabuf == -1) {
-                    _dmabuf = iNativeBuffer->createNvBuffer(iEglOutputStream->getResolution(),
-                                                            NvBufferColorFormat_YUV420,
-                                                            NvBufferLayout_BlockLinear);
-                    if (_dmabuf == -1) {
-                        _logger->error("An error occurred while creating the NvBuffer! Exiting...");
-                        errorOccurred = true;
-                    }
-                } else if (iNativeBuffer->copyToNvBuffer(_dmabuf) != STATUS_OK) {
+        /* If we don't already have buffers, create the ring from this image */
+        if ((save || hold) && !errorOccurred && !_ring->isAllocated()) {
+            if (!_ring->allocate(iNativeBuffer, iEglOutputStream->getResolution(),
+                                 DmabufRing::getColorFormat(_options, _id), DmabufRing::getLayout(_options))) {
+                _logger->error("An error occurred while creating the NvBuffer ring! Exiting...");
+                errorOccurred = true;
+            }
+        }
+
+        /* Skip frames that barely differ from the last one kept, a burst keeps every frame */
+        if (save && !burst && _motionGate && !errorOccurred) {
+            bool keep = true;
+            if (!_motionGate->evaluate(iNativeBuffer, captureFd, frameNumber, timestamp, keep)) {
+                _logger->error(_motionGate->getError() + "! Exiting...");
+                errorOccurred = true;
+            } else if (!keep) {
+                save = false;
+                if (_telemetry) {
+                    TelemetryRecord skipped;
+                    memset(&skipped, 0, sizeof(skipped));
+                    skipped.frameNumber = frameNumber;
+                    skipped.timestamp = timestamp;
+                    skipped.acquireUs = (acquireEnd - acquireStart) / 1000;
+                    skipped.flags = TELEMETRY_SKIP_MOTION;
+                    _telemetry->append(skipped);
+                }
+            }
+        }
+
+        /* Every resume or burst starts a new segment, segments.csv is only written once there has been a pause */
+        if (holding && segmentOpen) {
+            segmentOpen = false;
+            segment++;
+        }
+        if (save && !segmentOpen) {
+            const HeldFrame *oldest = _preTrigger ? _preTrigger->getOldest() : NULL;
+            uint64_t segmentTimestamp = oldest ? oldest->job.timestamp : timestamp;
+            segmentOpen = true;
+            if (segment == 0) {
+                firstIndex = index;
+                firstTimestamp = segmentTimestamp;
+            } else {
+                if (segment == 1)
+                    logSegment(0, firstIndex, firstTimestamp);
+                logSegment(segment, index, segmentTimestamp);
+                _logger->log("Segment " + std::to_string(segment) + " starts at image " + std::to_string(index), STDOUT_PRINT);
+            }
+        }
+
+        /* Hand unsaved capture targets straight back to Argus */
+        if (captureFd != -1 && !save && !hold)
+            _ring->release(captureSlot);
+
+        /* Copy the frame into a held slot, nothing is encoded until a burst; once the depth is reached the
+           oldest held frame makes room */
+        if (hold && !errorOccurred) {
+            HeldFrame held;
+            memset(&held, 0, sizeof(held));
+            if (_preTrigger->reserve(*_ring, held.job.slot, held.job.fd)) {
+                uint64_t copyStart = now();
+                if (!copyFrame(iFrame ? iFrame->getImage() : NULL, iNativeBuffer, captureFd, held.job.fd)) {
                     _logger->error("An error occurred while copying to the NvBuffer! Exiting...");
+                    _ring->release(held.job.slot);
                     errorOccurred = true;
+                } else {
+                    if (!bufferStream)
+                        iMetadata = getCaptureMetadata(frame.get());
+                    held.job.timestamp = timestamp;
+                    held.job.telemetry.frameNumber = frameNumber;
+                    held.job.telemetry.timestamp = timestamp;
+                    held.job.telemetry.acquireUs = (acquireEnd - acquireStart) / 1000;
+                    uint64_t copyEnd = now();
+                    held.job.telemetry.copyUs = (copyEnd - copyStart) / 1000;
+                    TraceLog::instance().span("copy held", copyStart, copyEnd, frameNumber);
+                    held.sensorTimestamp = iMetadata ? iMetadata->getSensorTimestamp() : 0;
+                    if (_options.exif)
+                        fillExposure(iMetadata, held.job);
+                    if (_metadata)
+                        fillMetadataRecord(iMetadata, frameNumber, 0, held.record);
+                    _preTrigger->push(held);
                 }
             }
+            if (captureFd != -1)
+                _ring->release(captureSlot);
+        }
+        if (errorOccurred)
+            break;
+
+        if (save) {
+
+            /* Stop once a downstream stage has failed, full volumes are normally failed over before that */
+            if (_sink->hasFailed()) {
+                _logger->log("An error occurred while writing the image, are all volumes full or failing? Exiting...", STDOUT_PRINT);
+                if (captureFd != -1)
+                    _ring->release(captureSlot);
+                break;
+            }
+
+            /* A burst starts with the frames held from before its trigger, oldest first */
+            HeldFrame held;
+            while (!errorOccurred && _preTrigger && _preTrigger->pop(held)) {
+                held.job.index = index++;
+                held.job.telemetry.index = held.job.index;
+                held.record.index = held.job.index;
+                held.job.quality = _channel ? _channel->getQuality() : _options.getQuality(_id);
+                held.job.submitted = now();
+                lastSaved = held.job.telemetry.frameNumber;
+                errorOccurred = !submitFrame(held.job, held.sensorTimestamp, held.record);
+            }
+
+            /* Start this frame's telemetry, gap counts sensor frames Argus never delivered */
+            FrameJob job;
+            memset(&job, 0, sizeof(job));
+            job.telemetry.frameNumber = frameNumber;
+            job.telemetry.timestamp = timestamp;
+            job.telemetry.index = index;
+            job.telemetry.acquireUs = (acquireEnd - acquireStart) / 1000;
+            uint64_t expected = _backpressure ? stride * _backpressure->getSaveEvery(_id) : stride;
+            if (lastSaved != 0 && job.telemetry.frameNumber > lastSaved + expected)
+                job.telemetry.gap = job.telemetry.frameNumber - lastSaved - expected;
+            lastSaved = job.telemetry.frameNumber;
+            job.quality = _channel ? _channel->getQuality() : _options.getQuality(_id);
+            if (_backpressure && !burst)
+                job.quality = _backpressure->lowerQuality(_id, job.quality);
+            if (poorExposure)
+                job.quality = std::min(job.quality, _options.exposureQuality);
+
+            /* Read the metadata now, a handed off capture target may return to Argus at any time */
+            uint64_t sensorTimestamp = 0;
+            MetadataRecord record;
+            if (!errorOccurred && (_collector || _metadata || _options.exif)) {
+                if (!bufferStream)
+                    iMetadata = getCaptureMetadata(frame.get());
+                sensorTimestamp = iMetadata ? iMetadata->getSensorTimestamp() : 0;
+                if (_metadata)
+                    fillMetadataRecord(iMetadata, frameNumber, index, record);
+                if (_options.exif)
+                    fillExposure(iMetadata, job);
+            }
 
-            /* Process frame. */
-            if (!errorOccurred) {
-                if (processV4L2Fd(_dmabuf, index++)) {
-                    if (!wroteFirst) {
-                        _logger->log("First image successfully written! You may now disconnect.", STDOUT_PRINT);
-                        wroteFirst = true;
+            /* Hand a capture target downstream as is while Argus keeps at least one to capture into,
+               otherwise copy into a free ring slot; drop the frame if the ring is full */
+            bool haveSlot = false;
+            if (!errorOccurred && captureFd != -1 && _ring->getCapturesHeld() < captureCount) {
+                job.slot = captureSlot;
+                job.fd = captureFd;
+                haveSlot = true;
+                _framesZeroCopy++;
+            } else if (!errorOccurred) {
+                haveSlot = _ring->acquire(job.slot, job.fd);
+                if (!haveSlot) {
+                    _ringDrops++;
+                    index++;
+                    if (_telemetry) {
+                        job.telemetry.flags |= TELEMETRY_DROP_RING;
+                        _telemetry->append(job.telemetry);
                     }
                 } else {
-                    // device is probably full, don't actually set the error status, just exit
-                    _logger->log("An error occurred while writing the JPEG image, is the device/system full? Exiting...", STDOUT_PRINT);
-                    _doExecute = false;
+                    if (captureFd != -1)
+                        _framesCopied++;
+                    uint64_t copyStart = now();
+                    bool copied = copyFrame(iFrame ? iFrame->getImage() : NULL, iNativeBuffer, captureFd, job.fd);
+                    uint64_t copyEnd = now();
+                    job.telemetry.copyUs = (copyEnd - copyStart) / 1000;
+                    TraceLog::instance().span("copy", copyStart, copyEnd, index);
+                    if (!copied) {
+                        _logger->error("An error occurred while copying to the NvBuffer! Exiting...");
+                        _ring->release(job.slot);
+                        haveSlot = false;
+                        errorOccurred = true;
+                    }
+                }
+                if (captureFd != -1)
+                    _ring->release(captureSlot);
+            }
+
+            /* Submit the slot, the sink releases it once nothing reads from it anymore */
+            if (haveSlot) {
+                job.index = index++;
+                job.timestamp = timestamp;
+                job.submitted = now();
+                if (_publisher)
+                    _publisher->offer(_id, *_ring, job.slot, job.index, sensorTimestamp);
+                errorOccurred = !submitFrame(job, sensorTimestamp, record);
+                if (!wroteFirst && _sink->getFramesWritten() > 0) {
+                    _logger->log("First image successfully written! You may now disconnect.", STDOUT_PRINT);
+                    wroteFirst = true;
                 }
             }
 
@@ -193,6 +870,7 @@ bool ConsumerThread::threadExecute() {
         }
     }
     _doExecute = false;
+    notifySupervisor();
 
     /* Calculate and display effective fps */
     auto stop = std::chrono::steady_clock::now();
@@ -206,7 +884,83 @@ bool ConsumerThread::threadExecute() {
     _logger->log(ss.str());
     ss.str("");
     ss << "Effective fps: " << std::to_string(fps) << " fps";
-    _logger->log(ss.str());    
+    _logger->log(ss.str());
+    ss.str("");
+    StageDrops drops;
+    getStageDrops(drops);
+    const LatencyHistogram *jitter = _cadence->getJitter();
+    ss << "Sensor fps: " << _cadence->getSensorFps() << " over " << _cadence->getFrames()
+       << " frames, frame interval jitter p50/p99/max " << jitter->getPercentile(50) << "/" << jitter->getPercentile(99)
+       << "/" << jitter->getMax() << " us";
+    _logger->log(ss.str());
+    ss.str("");
+    ss << "Frames lost: sensor " << drops.sensor << " periods (stream replaced " << drops.replaced
+       << ", Argus internal captures " << drops.internal << "), consumer " << drops.consumer << " (ring full), encoder "
+       << drops.encoder << " (queue full), writer " << drops.writer << " (no buffer)";
+    _logger->log(ss.str(), drops.sensor + drops.consumer + drops.encoder + drops.writer > 0);
+    ss.str("");
+    ss << "Acquire timeouts: " << std::to_string(_acquireTimeouts.load());
+    _logger->log(ss.str(), _acquireTimeouts > 0);
+    if (_restarts > 0 || lostAt) {
+        ss.str("");
+        ss << "Stream restarts: " << _restarts << ", outage " << (_outageNs + (lostAt ? now() - lostAt : 0)) / 1000000
+           << " ms" << (lostAt ? ", the stream was still lost at the end" : "");
+        _logger->log(ss.str(), STDOUT_PRINT);
+    }
+    if (_backpressure) {
+        ss.str("");
+        ss << "Images shed by backpressure: " << std::to_string(_backpressure->getFramesShed(_id));
+        _logger->log(ss.str());
+    }
+    if (bufferStream) {
+        ss.str("");
+        ss << "Images handed off without a copy: " << std::to_string(_framesZeroCopy.load())
+           << ", copied as every capture buffer was held: " << std::to_string(_framesCopied.load());
+        _logger->log(ss.str(), _framesCopied > 0);
+    }
+    if (_motionGate) {
+        const LatencyHistogram *cost = _motionGate->getCost();
+        ss.str("");
+        ss << "Images skipped unchanged: " << std::to_string(_motionGate->getFramesSkipped()) << ", gate cost p50/p99/max "
+           << cost->getPercentile(50) << "/" << cost->getPercentile(99) << "/" << cost->getMax() << " us";
+        _logger->log(ss.str());
+    }
+    if (_tnr) {
+        const LatencyHistogram *latency = _tnr->getLatency();
+        ss.str("");
+        ss << "Images through TNR: " << std::to_string(_tnr->getFramesFiltered()) << ", filter p50/p99/max "
+           << latency->getPercentile(50) << "/" << latency->getPercentile(99) << "/" << latency->getMax() << " us";
+        _logger->log(ss.str());
+    }
+
+    /* The packing cost bounds the Bayer frame rate one consumer core sustains */
+    if (_packer) {
+        const LatencyHistogram *latency = _packer->getLatency();
+        ss.str("");
+        ss << "Bayer frames packed: " << std::to_string(_packer->getFramesPacked()) << ", samples shifted right by "
+           << _packer->getShift() << ", realigned " << _packer->getRealigned() << " times, pack p50/p99/max " << latency->getPercentile(50) << "/"
+           << latency->getPercentile(99) << "/" << latency->getMax() << " us";
+        if (latency->getPercentile(99) > 0)
+            ss << ", at most " << 1000000 / latency->getPercentile(99) << " fps per consumer";
+        _logger->log(ss.str(), STDOUT_PRINT);
+    }
+    if (_exposureGate) {
+        ss.str("");
+        ss << "Images " << (_options.exposureQuality && _options.format == FORMAT_JPEG ? "encoded at quality "
+                            + std::to_string(_options.exposureQuality) : std::string("skipped"))
+           << " for exposure: black " << _exposureGate->getFramesBlack() << ", saturated "
+           << _exposureGate->getFramesSaturated() << ", " << _exposureGate->getFramesUnmeasured() << " without a histogram";
+        _logger->log(ss.str());
+    }
+    if (_preTrigger) {
+        ss.str("");
+        ss << "Pre-trigger frames replaced unsaved: " << std::to_string(_preTrigger->getEvicted())
+           << ", held at the end: " << std::to_string(_preTrigger->getSize());
+        _logger->log(ss.str());
+    }
+
+    if (counters.isStarted())
+        _logger->log(counters.report(), STDOUT_PRINT);
 
     _logger->log("Process completed, requesting shutdown...", STDOUT_PRINT);
     requestShutdown();
@@ -214,14 +968,55 @@ bool ConsumerThread::threadExecute() {
 }
 
 bool ConsumerThread::threadShutdown() {
-    if (_jpegEncoder && _options.profile)
-        _jpegEncoder->printProfilingStats();
+    if (_channel)
+        _channel->drain();
+    if (_compositeInput)
+        _compositeInput->drain();
+    if (_writer)
+        _writer->shutdown();
+    if (_rawWriter)
+        _rawWriter->shutdown();
+    if (_videoWriter)
+        _videoWriter->shutdown();
+    if (_motionGate && !_motionGate->close())
+        _logger->error("Failed to write motion.csv!");
+    if (_telemetry && !_telemetry->close())
+        _logger->error("Failed to write the telemetry log!");
+    if (_metadata) {
+        std::stringstream ss;
+        ss << "Metadata records: " << _metadata->getRecordCount();
+        if (_metadata->getGrowCount() > 0)
+            ss << ", outgrew the preallocation " << _metadata->getGrowCount() << " times";
+        _logger->log(ss.str());
+        if (!_metadata->close())
+            _logger->error("Failed to write the metadata log!");
+    }
     return true;
 }
 
-/* Used to stop infinite loop in execute */
+/* Used to stop infinite loop in execute, also ends a wait for a restarted stream */
 void ConsumerThread::stopExecute() {
+    std::lock_guard<std::mutex> lock(_streamMutex);
     _doExecute = false;
+    _streamReady.notify_all();
+}
+
+/* Whether the consumer has let go of its failed stream and waits for the camera to be restarted */
+bool ConsumerThread::isStreamLost() {
+    return _streamLost;
+}
+
+/* Hand over the output stream of the restarted camera, the consumer connects to it on its own thread */
+void ConsumerThread::reconnect(OutputStream *stream) {
+    std::lock_guard<std::mutex> lock(_streamMutex);
+    _stream = stream;
+    _streamLost = false;
+    _streamReady.notify_all();
+}
+
+/* Times the consumer connected to a restarted stream */
+uint32_t ConsumerThread::getRestarts() {
+    return _restarts;
 }
 
 /* Used to check if the thread should be killed */
@@ -229,27 +1024,251 @@ bool ConsumerThread::isExecuting() {
     return _doExecute;
 }
 
-/* JPEG encode the passed file descriptor, return bool indicating successful file writing */
-bool ConsumerThread::processV4L2Fd(int32_t fd, uint64_t index) {
-    
-    bool success = false;
+/* Queue changed settings for the consumer to apply before its next frame, later changes to one setting win */
+void ConsumerThread::control(const CameraControl& update) {
+    std::lock_guard<std::mutex> lock(_controlMutex);
+    if (!_controlPending)
+        memset(&_control, 0, sizeof(_control));
+    if (update.quality)
+        _control.quality = update.quality;
+    if (update.stride)
+        _control.stride = update.stride;
+    if (update.frameDuration)
+        _control.frameDuration = update.frameDuration;
+    if (update.pause)
+        _control.pause = update.pause;
+    if (update.burst)
+        _control.burst = update.burst;
+    _controlPending = true;
+}
 
-    /* Create a file with name filename */
-    char filename[FILENAME_MAX];
-    sprintf(filename, "%s/cam%u/image%06lu.jpg", _options.directory, _id, index);
-    std::ofstream *outputFile = new std::ofstream(filename);
+/* Apply the queued settings, called by the consumer between frames */
+void ConsumerThread::applyControl(uint32_t& stride, uint64_t& acquireTimeout, uint32_t& burstLeft) {
+    std::lock_guard<std::mutex> lock(_controlMutex);
+    std::stringstream ss;
+    ss << "Control:";
+    if (_control.quality && _channel) {
+        _channel->setQuality(_control.quality);
+        ss << " quality " << _control.quality;
+    }
+    if (_control.stride) {
+        stride = _control.stride;
+        ss << " stride " << stride;
+    }
+    if (_control.frameDuration) {
+        acquireTimeout = _options.acquireTimeout * _control.frameDuration;
+        ss << " frame duration " << _control.frameDuration << " ns";
+    }
+    if (_control.pause) {
+        _paused = _control.pause > 0;
+        ss << (_paused ? " paused" : " resumed");
+    }
+    if (_control.burst) {
+        burstLeft = _control.burst;
+        ss << " burst of " << burstLeft << " frames";
+    }
+    _logger->log(ss.str());
+    _controlPending = false;
+}
 
-    /* Write the image to the file */
-    if (outputFile) {
-        unsigned long size = _outputBufferSize;
-        if (_jpegEncoder->encodeFromFd(fd, JCS_YCbCr, &_outputBuffer, size) == 0) {
-            outputFile->write((char *) _outputBuffer, size);
-            success = outputFile->good();
-            outputFile->close();
+/* True while frames are released unsaved */
+bool ConsumerThread::isPaused() {
+    return _paused;
+}
+
+/* Append a segment's first image index and sensor timestamp to camN/segments.csv, created on first use */
+void ConsumerThread::logSegment(uint32_t segment, uint64_t index, uint64_t timestamp) {
+    if (!_segments) {
+        std::stringstream ss;
+        ss << _options.directory << "/cam" << std::to_string(_id) << "/segments.csv";
+        _segments = fopen(ss.str().c_str(), "w");
+        if (!_segments || fprintf(_segments, "segment,first_index,timestamp_ns\n") < 0) {
+            _logger->error("Failed to create segments.csv!");
+            return;
         }
     }
-    delete outputFile;
-    return success;
+    if (fprintf(_segments, "%u,%lu,%lu\n", segment, index, timestamp) < 0 || fflush(_segments) != 0)
+        _logger->error("Failed to write segments.csv!");
+}
+
+/* True once the warm-up is over and frames are being saved */
+bool ConsumerThread::isWarm() {
+    return _warm;
+}
+
+/* Steady clock time in ns of the last acquired frame, 0 before the first */
+uint64_t ConsumerThread::getLastFrameTime() {
+    return _lastFrameTime;
+}
+
+/* Number of acquireFrame calls that timed out, grows steadily for a dead camera */
+uint64_t ConsumerThread::getAcquireTimeouts() {
+    return _acquireTimeouts;
+}
+
+/* The sink getters are only valid once the thread is running */
+uint64_t ConsumerThread::getFramesWritten() {
+    return _sink ? _sink->getFramesWritten() : 0;
+}
+
+uint64_t ConsumerThread::getBytesWritten() {
+    return _sink ? _sink->getBytesWritten() : 0;
+}
+
+/* Frames dropped because the ring or a sink queue was full */
+uint64_t ConsumerThread::getFramesDropped() {
+    return _ringDrops + _queueDrops;
+}
+
+/* Frames lost at every stage so far, only valid once the thread is running */
+void ConsumerThread::getStageDrops(StageDrops& drops) {
+    memset(&drops, 0, sizeof(drops));
+    if (_cadence) {
+        drops.sensor = _cadence->getPeriodsLost();
+        drops.replaced = _cadence->getFramesReplaced();
+        drops.internal = _cadence->getInternalCaptures();
+    }
+    drops.consumer = _ringDrops;
+    drops.encoder = _options.format == FORMAT_RAW ? 0 : _queueDrops.load();
+    drops.writer = (_options.format == FORMAT_RAW ? _queueDrops.load() : 0) + (_writer ? _writer->getFramesDropped() : 0);
+}
+
+/* Sensor timing of the acquired frames, NULL before the thread is running */
+const FrameCadence *ConsumerThread::getCadence() {
+    return _cadence;
+}
+
+/* The exposure gate's verdicts, NULL without --exposure-gate */
+const ExposureGate *ConsumerThread::getExposureGate() {
+    return _exposureGate;
+}
+
+size_t ConsumerThread::getQueueDepth() {
+    return _sink ? _sink->getQueueDepth() : 0;
+}
+
+const LatencyHistogram *ConsumerThread::getLatency() {
+    return _sink ? _sink->getLatency() : NULL;
+}
+
+/* JPEG quality the next frame is encoded at before any backpressure, 0 unless jpeg */
+int ConsumerThread::getQuality() {
+    return _channel ? _channel->getQuality() : 0;
+}
+
+/* Image writes submitted to the kernel and not yet complete, 0 without --aio */
+uint32_t ConsumerThread::getWritesInFlight() {
+    return _writer ? _writer->getWritesInFlight() : 0;
+}
+
+/* Image write latency, NULL for formats without a FrameWriter */
+const LatencyHistogram *ConsumerThread::getWriteLatency() {
+    return _writer ? _writer->getWriteLatency() : NULL;
+}
+
+/* Destroy the frame consumer of the lost stream and wait until the supervisor hands over the
+   restarted camera's stream, return bool indicating a new stream connected before a shutdown.
+   A new stream failing to connect is let go again for the next restart */
+bool ConsumerThread::awaitStream() {
+    _logger->log("The producer has disconnected from the stream, waiting for the camera to restart...", STDOUT_PRINT);
+    while (true) {
+        _consumer.reset();
+        _warm = false;
+        {
+            std::lock_guard<std::mutex> lock(_streamMutex);
+            _stream = NULL;
+            _streamLost = true;
+        }
+        notifySupervisor();
+
+        std::unique_lock<std::mutex> lock(_streamMutex);
+        _streamReady.wait(lock, [this]() { return _stream != NULL || !_doExecute; });
+        if (!_doExecute)
+            return false;
+        lock.unlock();
+
+        _consumer.reset(FrameConsumer::create(_stream));
+        IEGLOutputStream *iEglOutputStream = interface_cast<IEGLOutputStream>(_stream);
+        if (_consumer && iEglOutputStream && iEglOutputStream->waitUntilConnected() == STATUS_OK) {
+            _restarts++;
+            _lastFrameTime = now(); // a restarted stream that delivers nothing stalls like any other
+            _logger->log("Producer has connected to the restarted stream! Continuing...", STDOUT_PRINT);
+            return true;
+        }
+        _logger->log("The restarted stream failed to connect, waiting for another restart...", STDOUT_PRINT);
+    }
+}
+
+/* Wake the App so it notices this consumer has stopped or warmed up without polling */
+void ConsumerThread::notifySupervisor() {
+    uint64_t one = 1;
+    if (_eventFd != -1 && write(_eventFd, &one, sizeof(one)) < 0)
+        _logger->error("Failed to wake the supervisor!");
+}
+
+/* Share of the ring and write buffers waiting downstream, 1 when nothing is left to save into */
+double ConsumerThread::getOccupancy() {
+    uint32_t capacity = _ring->getCount() - _options.preTriggerFrames + (_pool ? _pool->getCount() : 0);
+    double occupancy = (double) (getQueueDepth() + getWritesInFlight()) / capacity;
+    return occupancy < 1.0 ? occupancy : 1.0;
+}
+
+/* Copy the acquired frame into the NvBuffer, from the capture target with a buffer stream */
+bool ConsumerThread::copyFrame(Image *image, NV::IImageNativeBuffer *iNativeBuffer, int captureFd, int fd) {
+
+    /* Bayer samples are packed on the CPU, RAW16 frames have no native buffer to copy */
+    if (_packer) {
+        if (!_packer->pack(image, fd)) {
+            _logger->error(_packer->getError() + "!");
+            return false;
+        }
+        return true;
+    }
+
+    /* The filter writes the slot itself, an EGLStream frame is staged for it first */
+    if (_tnr) {
+        int input = captureFd;
+        if (input == -1) {
+            input = _tnr->getStagingFd();
+            if (iNativeBuffer->copyToNvBuffer(input) != STATUS_OK)
+                return false;
+        }
+        if (!_tnr->process(input, fd)) {
+            _logger->error(_tnr->getError() + "!");
+            return false;
+        }
+        return true;
+    }
+    if (captureFd == -1)
+        return iNativeBuffer->copyToNvBuffer(fd) == STATUS_OK;
+    NvBufferTransformParams params;
+    memset(&params, 0, sizeof(params));
+    params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+    params.transform_filter = NvBufferTransform_Filter_Smart;
+    return NvBufferTransform(captureFd, fd, &params) == 0;
+}
+
+/* Hand a filled slot to the sink, which releases it once nothing reads from it anymore; a full sink drops
+   the frame. Returns false only on a fatal error */
+bool ConsumerThread::submitFrame(FrameJob& job, uint64_t sensorTimestamp, const MetadataRecord& record) {
+    TraceScope scope("submit", job.index);
+    job.sensorTimestamp = sensorTimestamp;
+    if (!_sink->submit(job)) {
+        _ring->release(job.slot);
+        _queueDrops++;
+        if (_telemetry) {
+            job.telemetry.flags |= TELEMETRY_DROP_QUEUE;
+            _telemetry->append(job.telemetry);
+        }
+        return true;
+    }
+    if (_collector)
+        _collector->add(_id, sensorTimestamp, job.index);
+    if (_metadata && !_metadata->append(record)) {
+        _logger->error("An error occurred while storing the capture metadata! Exiting...");
+        return false;
+    }
+    return true;
 }
 
 /* Returns the buffer size, in bytes, of an encoded JPEG image with the same width and height as the passed fields */
@@ -0,0 +1,250 @@
+/*
+ * ContainerFile.cpp
+ *
+ * Appends one camera's encoded images back to back into a large pre-allocated
+ * file instead of creating a file per image, which keeps directory sizes small
+ * on FAT/exFAT volumes. Each image gets an entry in a sidecar index so it can
+ * be extracted again. Files are rotated once they reach the configured size.
+ * In direct mode the data file is written with O_DIRECT and every image starts
+ * on a DIRECT_IO_ALIGN boundary, the index offsets skip the padding. Every
+ * entry carries the image's CRC32C, which --verify checks the data against.
+ * Checkpoints every CONTAINER_CHECKPOINT_IMAGES images and a footer on close
+ * index the data file itself, recover() closes a segment a crash left open.
+ */
+
+#include "ContainerFile.hpp"
+
+#include "ContainerReader.hpp"
+#include "Crc32c.hpp"
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define FILE_MODE 0666
+#define PREALLOC_BYTES (64UL << 20) // container grows by this much at a time
+
+/* A checkpoint at offset listing count entries, the footer is followed by the trailer */
+static void buildRecord(std::vector<unsigned char>& record, const ContainerIndexEntry *entries, uint32_t count,
+                        uint64_t sequence, uint64_t previous, bool footer, uint64_t offset) {
+    ContainerCheckpoint header = {CONTAINER_CHECKPOINT_MAGIC, count, sequence, previous, footer ? CONTAINER_FOOTER : 0U, 0};
+    header.crc32c = ContainerReader::checksum(header, entries);
+    size_t length = count * sizeof(ContainerIndexEntry);
+    record.resize(sizeof(header) + length + (footer ? sizeof(ContainerTrailer) : 0));
+    memcpy(record.data(), &header, sizeof(header));
+    if (length > 0)
+        memcpy(record.data() + sizeof(header), entries, length);
+    if (footer) {
+        ContainerTrailer trailer = {CONTAINER_TRAILER_MAGIC, offset, count, 0, 0};
+        trailer.crc32c = crc32c(&trailer, offsetof(ContainerTrailer, crc32c));
+        memcpy(record.data() + sizeof(header) + length, &trailer, sizeof(trailer));
+    }
+}
+
+ContainerFile::ContainerFile(std::string directory, uint64_t rotateBytes, bool direct, std::string prefix) :
+    _directory(directory),
+    _prefix(prefix),
+    _rotateBytes(rotateBytes),
+    _direct(direct),
+    _segment(0),
+    _open(false),
+    _created(false),
+    _indexFd(-1),
+    _offset(0),
+    _end(0),
+    _allocated(0),
+    _bytesWritten(0),
+    _checkpointed(0),
+    _checkpoint(CONTAINER_NO_CHECKPOINT),
+    _checkpoints(0)
+{
+    _entries.reserve(CONTAINER_CHECKPOINT_IMAGES * 64); // a GiB of 256 KiB images before the first reallocation
+}
+
+ContainerFile::~ContainerFile() {
+    close();
+}
+
+/* Append one image and its index entry, return bool indicating successful writing */
+bool ContainerFile::append(const unsigned char *data, unsigned long size, uint64_t index, uint64_t timestamp) {
+
+    /* Rotate once the current file would exceed the limit, the full segment is made durable first */
+    if (_open && _offset > 0 && _offset + size > _rotateBytes && (!sync() || !close()))
+        return false;
+    if (!_open && !openNext())
+        return false;
+
+    uint64_t length = _data.isDirect() ? DirectFile::align(size) : size;
+    if (!reserve(_offset + length) || !_data.write(data, size, _offset))
+        return false;
+
+    ContainerIndexEntry entry = {index, timestamp, _offset, (uint32_t) size, crc32c(data, size)};
+    if (write(_indexFd, &entry, sizeof(entry)) != sizeof(entry))
+        return false;
+    _entries.push_back(entry);
+
+    _end = _offset + size;
+    _offset += length;
+    _bytesWritten += size;
+    return _entries.size() - _checkpointed < CONTAINER_CHECKPOINT_IMAGES || writeCheckpoint(false);
+}
+
+/* Write the footer, close the current segment and release its unused pre-allocation */
+bool ContainerFile::close() {
+    bool success = true;
+    if (_open) {
+        success = writeCheckpoint(true);
+        success = _data.close(_end) && success;
+        _open = false;
+    }
+    if (_indexFd != -1) {
+        ::close(_indexFd);
+        _indexFd = -1;
+    }
+    return success;
+}
+
+/* Checkpoint and flush the data and index appended so far and a new segment's directory entry,
+   return bool indicating success */
+bool ContainerFile::sync() {
+    bool success = !_open || _entries.size() == _checkpointed || writeCheckpoint(false);
+    success = _data.sync() && success;
+    if (_indexFd != -1)
+        success = fdatasync(_indexFd) == 0 && success;
+    if (_created) {
+        int fd = open(_directory.c_str(), O_RDONLY | O_DIRECTORY);
+        success = fd != -1 && fsync(fd) == 0 && success;
+        if (fd != -1)
+            ::close(fd);
+        _created = !success;
+    }
+    return success;
+}
+
+/* Close a segment a crash left without its footer. The images of its checkpoints are kept, then
+   those after the last one while the .idx lists them and their checksum matches; the rest is
+   truncated, the footer written and the .idx rewritten to match. Return bool indicating the segment
+   is intact or was repaired, images is set to the images it holds */
+bool ContainerFile::recover(const std::string& path, uint64_t& images, bool& repaired) {
+    repaired = false;
+    ContainerReader reader;
+    if (!reader.open(path))
+        return false;
+    images = reader.getCount();
+    if (!reader.isRecovered())
+        return true;
+
+    std::vector<ContainerIndexEntry> entries(reader.getEntries(), reader.getEntries() + reader.getCount());
+    uint64_t end = reader.getValidEnd();
+    std::string indexPath = path.substr(0, path.find_last_of('.')) + ".idx";
+    int fd = ::open(indexPath.c_str(), O_RDONLY);
+    if (fd != -1) {
+        ContainerIndexEntry entry;
+        while (read(fd, &entry, sizeof(entry)) == sizeof(entry)) {
+            if (!entries.empty() && entry.index <= entries.back().index)
+                continue;
+            if (entry.offset < end || !reader.checkEntry(entry))
+                break;
+            entries.push_back(entry);
+            end = entry.offset + entry.size;
+        }
+        ::close(fd);
+    }
+    if (entries.empty() && reader.getSize() > 0)
+        return false; // nothing left to tell the images apart, leave the file as it is
+    uint64_t sequence = reader.getCheckpoints();
+    uint64_t previous = reader.getLastCheckpoint();
+    reader.close();
+
+    /* Footer after the last image kept, the file ends with its trailer */
+    std::vector<unsigned char> record;
+    uint64_t offset = DirectFile::align(end);
+    buildRecord(record, entries.data(), entries.size(), sequence, previous, true, offset);
+    fd = ::open(path.c_str(), O_WRONLY);
+    bool success = fd != -1 && ftruncate(fd, offset) == 0
+        && pwrite(fd, record.data(), record.size(), offset) == (ssize_t) record.size()
+        && ftruncate(fd, offset + record.size()) == 0 && fdatasync(fd) == 0;
+    if (fd != -1)
+        success = ::close(fd) == 0 && success;
+
+    /* The rewritten .idx replaces the old one only once complete */
+    std::string temporary = indexPath + ".tmp";
+    fd = success ? ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, FILE_MODE) : -1;
+    size_t length = entries.size() * sizeof(ContainerIndexEntry);
+    success = fd != -1 && write(fd, entries.data(), length) == (ssize_t) length && fdatasync(fd) == 0;
+    if (fd != -1)
+        success = ::close(fd) == 0 && success;
+    success = success && rename(temporary.c_str(), indexPath.c_str()) == 0;
+
+    images = entries.size();
+    repaired = success;
+    return success;
+}
+
+uint32_t ContainerFile::getSegmentCount() const {
+    return _segment;
+}
+
+uint64_t ContainerFile::getBytesWritten() const {
+    return _bytesWritten;
+}
+
+/* Where the last image appended lives, return bool indicating the open segment has one */
+bool ContainerFile::getLastImage(char *path, size_t length, uint64_t& offset) const {
+    if (!_open || _entries.empty())
+        return false;
+    snprintf(path, length, "%s/%s%03u.mjpg", _directory.c_str(), _prefix.c_str(), _segment - 1);
+    offset = _entries.back().offset;
+    return true;
+}
+
+/* Open the data and index files for the next segment */
+bool ContainerFile::openNext() {
+    char filename[FILENAME_MAX];
+    snprintf(filename, FILENAME_MAX, "%s/%s%03u.mjpg", _directory.c_str(), _prefix.c_str(), _segment);
+    _open = _data.open(filename, _direct);
+    snprintf(filename, FILENAME_MAX, "%s/%s%03u.idx", _directory.c_str(), _prefix.c_str(), _segment);
+    _indexFd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, FILE_MODE);
+    _segment++;
+    _created = true;
+    _offset = 0;
+    _end = 0;
+    _allocated = 0;
+    _entries.clear();
+    _checkpointed = 0;
+    _checkpoint = CONTAINER_NO_CHECKPOINT;
+    _checkpoints = 0;
+    if (!_open || _indexFd == -1) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+/* Extend the pre-allocation up to end, file systems without fallocate simply grow on write */
+bool ContainerFile::reserve(uint64_t end) {
+    while (end > _allocated) {
+        if (!_data.preallocate(_allocated, PREALLOC_BYTES))
+            return false;
+        _allocated += PREALLOC_BYTES;
+    }
+    return true;
+}
+
+/* Append a checkpoint listing the images since the last one, or the footer listing every image of
+   the segment, on the next DIRECT_IO_ALIGN boundary, return bool indicating successful writing */
+bool ContainerFile::writeCheckpoint(bool footer) {
+    uint32_t first = footer ? 0 : _checkpointed;
+    uint64_t offset = DirectFile::align(_offset);
+    buildRecord(_record, _entries.data() + first, _entries.size() - first, _checkpoints, _checkpoint, footer, offset);
+    uint64_t length = _data.isDirect() ? DirectFile::align(_record.size()) : _record.size();
+    if (!reserve(offset + length) || !_data.write(_record.data(), _record.size(), offset))
+        return false;
+    _checkpoint = offset;
+    _checkpoints++;
+    _checkpointed = _entries.size();
+    _end = offset + _record.size();
+    _offset = offset + length;
+    return true;
+}
@@ -0,0 +1,271 @@
+/*
+ * ControlServer.cpp
+ *
+ * Accepts commands on a Unix stream socket while recording, so settings can be
+ * tuned without a restart that would lose the AE/AWB warm-up. The App calls
+ * serve() from its supervisor loop whenever the socket is readable. Each
+ * connection sends one command line and gets one reply line back:
+ *
+ *   quality <camera|all> <1-100>       JPEG quality the camera's next frames start at
+ *   save-every <camera|all> <1-inf>    save every n-th frame from now on
+ *   pause <camera|all>                 release frames unsaved, the sensors keep capturing
+ *   resume <camera|all>                save again from the next frame, in a new segment
+ *   trigger [frames]                   save a burst of the next frames of every camera, --trigger many by default
+ *   show                               every camera's current settings
+ *   record / stop                      resume or pause every camera, how a --daemon is driven
+ *   quit                               end the run as SIGINT would
+ *
+ * On a --leader, record, stop, trigger and quit also reach every follower.
+ *
+ * Settings reach the consumers as a CameraControl applied between frames. Every
+ * applied change is appended to options.txt with a timestamp. ./StreamCtl
+ * sends one command and prints the reply.
+ */
+
+#include "ControlServer.hpp"
+
+#include "CaptureGraph.hpp"
+#include "ClusterLink.hpp"
+#include "ConsumerThread.hpp"
+#include "Options.hpp"
+#include "Logger.hpp"
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sstream>
+
+using namespace Argus;
+
+#define STDOUT_PRINT true
+
+ControlServer::ControlServer(Options& options, CaptureGraph& graph, ConsumerThread **consumers, uint32_t numCameras,
+                             const Range<uint64_t>& frameDurationRange, ClusterLink *cluster) :
+    _options(options),
+    _graph(graph),
+    _consumers(consumers),
+    _numCameras(numCameras),
+    _frameDurationRange(frameDurationRange),
+    _cluster(cluster),
+    _logger(NULL),
+    _fd(-1),
+    _saveEvery(numCameras),
+    _quit(false)
+{
+    for (uint32_t i = 0; i < numCameras; i++)
+        _saveEvery[i] = options.getSaveEvery(i);
+}
+
+ControlServer::~ControlServer() {
+    if (_fd != -1) {
+        ::close(_fd);
+        unlink(_options.controlPath.c_str());
+    }
+    if (_logger)
+        delete _logger;
+}
+
+/* Bind the socket at the control path, replacing a socket a previous run left behind */
+bool ControlServer::open() {
+    _logger = new Logger("CONTROL", _options.directory);
+    if (!_logger)
+        return false;
+    if (_options.verbose)
+        _logger->enableVerbose();
+    else
+        _logger->disableVerbose();
+
+    struct stat info;
+    if (stat(_options.controlPath.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+        unlink(_options.controlPath.c_str());
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, _options.controlPath.c_str(), sizeof(address.sun_path) - 1);
+    _fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_fd == -1) {
+        _logger->error("Failed to create the control socket!");
+        return false;
+    }
+    if (bind(_fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(_fd, CONTROL_BACKLOG) != 0) {
+        _logger->error("Failed to bind the control socket to " + _options.controlPath + "!");
+        ::close(_fd);
+        _fd = -1;
+        return false;
+    }
+    _logger->log("Accepting commands on " + _options.controlPath, STDOUT_PRINT);
+    return true;
+}
+
+/* Listening socket the supervisor polls, -1 before open() */
+int ControlServer::getFd() const {
+    return _fd;
+}
+
+/* Serve every connection waiting on the socket, one command each */
+void ControlServer::serve() {
+    int client;
+    while ((client = accept4(_fd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+        struct timeval timeout = {0, CONTROL_TIMEOUT_MS * 1000};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        char buffer[CONTROL_LINE_MAX];
+        ssize_t length = recv(client, buffer, sizeof(buffer) - 1, 0);
+        if (length > 0) {
+            buffer[length] = '\0';
+            std::string command(buffer, strcspn(buffer, "\r\n"));
+            std::string reply = execute(command);
+            _logger->log(command + " -> " + reply);
+            reply += "\n";
+            if (send(client, reply.data(), reply.size(), MSG_NOSIGNAL) < 0)
+                _logger->log("Failed to reply to " + command);
+        }
+        ::close(client);
+    }
+}
+
+/* True once a client sent quit, the supervisor then ends the run */
+bool ControlServer::isQuitRequested() const {
+    return _quit;
+}
+
+/* Parse and apply one command line, returns the reply */
+std::string ControlServer::execute(const std::string& command) {
+    std::stringstream ss(command);
+    std::string verb, target, extra;
+    int value = 0;
+    ss >> verb;
+    if (verb == "show")
+        return show();
+    if (verb == "record" || verb == "stop" || verb == "quit") {
+        if (ss >> extra)
+            return "error expected " + verb + " alone";
+        if (verb == "quit") {
+            _quit = true;
+            return "ok";
+        }
+        if (_cluster)
+            _cluster->broadcast(verb == "stop" ? CLUSTER_STOP : CLUSTER_RECORD);
+        return setPaused(0, _numCameras - 1, verb == "stop");
+    }
+    if (verb == "trigger") {
+        int frames = _options.triggerFrames;
+        if (ss >> value)
+            frames = value;
+        else if (!ss.eof())
+            frames = 0;
+        if (frames < 1 || ss >> extra)
+            return "error expected trigger <frames>, or trigger alone with --trigger";
+        return trigger(frames);
+    }
+    bool pause = verb == "pause" || verb == "resume";
+    if (verb != "quality" && verb != "save-every" && !pause)
+        return "error unknown command, expected quality, save-every, pause, resume, trigger, show, record, stop or quit";
+    if (pause && (!(ss >> target) || ss >> extra))
+        return "error expected " + verb + " <camera|all>";
+    if (!pause && (!(ss >> target >> value) || ss >> extra))
+        return "error expected " + verb + " <camera|all> <value>";
+
+    uint32_t first = 0;
+    uint32_t last = _numCameras - 1;
+    if (target != "all") {
+        char *end = NULL;
+        long camera = strtol(target.c_str(), &end, 10);
+        if (*end != '\0' || camera < 0 || camera >= (long) _numCameras)
+            return "error no camera " + target;
+        first = last = camera;
+    }
+    if (pause)
+        return setPaused(first, last, verb == "pause");
+    return verb == "quality" ? setQuality(first, last, value) : setSaveEvery(first, last, value);
+}
+
+/* Pause or resume saving on the cameras */
+std::string ControlServer::setPaused(uint32_t first, uint32_t last, bool paused) {
+    for (uint32_t i = first; i <= last; i++) {
+        CameraControl update;
+        memset(&update, 0, sizeof(update));
+        update.pause = paused ? 1 : -1;
+        _consumers[i]->control(update);
+        _options.writeChange("camera " + std::to_string(i) + (paused ? " paused" : " resumed"));
+    }
+    return "ok";
+}
+
+/* Save the next frames of every camera, all cameras start together so the burst forms frame sets */
+std::string ControlServer::trigger(int frames) {
+    for (uint32_t i = 0; i < _numCameras; i++) {
+        CameraControl update;
+        memset(&update, 0, sizeof(update));
+        update.burst = frames;
+        _consumers[i]->control(update);
+    }
+    if (_cluster)
+        _cluster->broadcast(CLUSTER_TRIGGER);
+    _logger->log("Triggered a burst of " + std::to_string(frames) + " frames", STDOUT_PRINT);
+    return "ok";
+}
+
+/* Start the cameras' next JPEG images at quality */
+std::string ControlServer::setQuality(uint32_t first, uint32_t last, int quality) {
+    if (_options.format != FORMAT_JPEG)
+        return "error quality needs jpeg format";
+    if (quality < 1 || quality > 100)
+        return "error quality must be 1 to 100";
+    for (uint32_t i = first; i <= last; i++) {
+        CameraControl update;
+        memset(&update, 0, sizeof(update));
+        update.quality = quality;
+        _consumers[i]->control(update);
+        _options.writeChange("camera " + std::to_string(i) + " quality " + std::to_string(quality));
+    }
+    return "ok";
+}
+
+/* Save every n-th frame of the cameras, a stretched sensor is re-timed so it still only captures saved frames */
+std::string ControlServer::setSaveEvery(uint32_t first, uint32_t last, int saveEvery) {
+    if (saveEvery < 1)
+        return "error save every must be >= 1";
+    bool stretched = !_options.fullRate;
+    if (stretched && _graph.isShared() && (first != 0 || last != _numCameras - 1))
+        return "error --sync-session cameras share one request, use all";
+    for (uint32_t i = first; i <= last && stretched; i++)
+        if (_options.getFrameDuration(i, saveEvery) > _frameDurationRange.max())
+            return "error the sensor mode cannot run slow enough";
+
+    for (uint32_t i = first; i <= last; i++) {
+        CameraControl update;
+        memset(&update, 0, sizeof(update));
+        if (stretched) {
+            uint64_t duration = _options.getFrameDuration(i, saveEvery);
+            Range<uint64_t> range = duration == _options.captureFrameDuration ? _frameDurationRange
+                                                                              : Range<uint64_t>(duration);
+            bool submit = !_graph.isShared() || i == first;
+            if (submit && (!_graph.setFrameDuration(i, range) || !_graph.submit(i)))
+                return "error " + _graph.getError();
+            update.frameDuration = duration;
+        } else {
+            update.stride = saveEvery;
+        }
+        _consumers[i]->control(update);
+        _saveEvery[i] = saveEvery;
+        _options.writeChange("camera " + std::to_string(i) + " save every " + std::to_string(saveEvery));
+    }
+    return "ok";
+}
+
+/* Every camera's current settings on one line */
+std::string ControlServer::show() {
+    std::stringstream ss;
+    ss << "ok";
+    for (uint32_t i = 0; i < _numCameras; i++) {
+        ss << (i ? ";" : "") << " camera " << i << (_consumers[i]->isPaused() ? " paused" : " recording")
+           << " save-every " << _saveEvery[i];
+        if (_options.format == FORMAT_JPEG)
+            ss << " quality " << _consumers[i]->getQuality();
+    }
+    return ss.str();
+}
@@ -0,0 +1,78 @@
+/*
+ * DequeueLoops.cpp
+ *
+ * The --dq-loops threads shared by the video encoders, handed out in turn.
+ */
+
+#include "DequeueLoops.hpp"
+
+#include "NvV4l2PollLoop.h"
+#include <sstream>
+
+/* The process-wide loops, none until open() */
+DequeueLoops& DequeueLoops::instance() {
+    static DequeueLoops loops;
+    return loops;
+}
+
+DequeueLoops::DequeueLoops() :
+    _next(0)
+{}
+
+DequeueLoops::~DequeueLoops() {
+    close();
+}
+
+/* Start count loop threads, 0 leaves every plane its own DQ thread */
+bool DequeueLoops::open(uint32_t count) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (uint32_t i = 0; i < count; i++) {
+        std::stringstream ss;
+        ss << "dqloop" << i;
+        NvV4l2PollLoop *loop = new NvV4l2PollLoop(ss.str().c_str());
+        if (!loop || loop->isInError()) {
+            delete loop;
+            return false;
+        }
+        _loops.push_back(loop);
+    }
+    return true;
+}
+
+/* Stop the loops, call once every encoder has taken its plane back */
+void DequeueLoops::close() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (uint32_t i = 0; i < _loops.size(); i++)
+        delete _loops[i];
+    _loops.clear();
+}
+
+/* The loop the next plane goes to, NULL without loops */
+NvV4l2PollLoop *DequeueLoops::next() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_loops.empty())
+        return NULL;
+    return _loops[_next++ % _loops.size()];
+}
+
+uint32_t DequeueLoops::getCount() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _loops.size();
+}
+
+/* Buffers dispatched and the wakeups they took, more than one buffer per wakeup is a batch. Call before close() */
+std::string DequeueLoops::getReport() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint64_t wakeups = 0;
+    uint64_t dispatched = 0;
+    for (uint32_t i = 0; i < _loops.size(); i++) {
+        wakeups += _loops[i]->getWakeups();
+        dispatched += _loops[i]->getDispatched();
+    }
+    std::stringstream ss;
+    ss.precision(2);
+    ss << std::fixed << "Dequeue loops: " << _loops.size() << " threads, " << dispatched << " bitstream buffers in " << wakeups << " wakeups";
+    if (wakeups > 0)
+        ss << ", " << (double) dispatched / wakeups << " per wakeup";
+    return ss.str();
+}
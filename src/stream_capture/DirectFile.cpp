@@ -0,0 +1,186 @@
+/*
+ * DirectFile.cpp
+ *
+ * Keeps the page cache out of the write path so dirty pages from several
+ * cameras can never pile up into a writeback stall. A DirectFile opened in
+ * direct mode writes aligned blocks with O_DIRECT, straight from the page
+ * aligned BufferPool buffers where it can and through a small bounce buffer
+ * otherwise, padding the last block with zeros; close() trims the file to its
+ * real length. Where the file system refuses O_DIRECT it falls back to
+ * buffered writes kept bounded by a WriteBehind.
+ */
+
+#include "DirectFile.hpp"
+
+#include "MemoryBudget.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+
+#define FILE_MODE 0666
+
+WriteBehind::WriteBehind() :
+    _fd(-1),
+    _window(WRITE_BEHIND_WINDOW),
+    _queued(0),
+    _dropped(0)
+{}
+
+/* Start tracking a file written sequentially from offset 0 */
+void WriteBehind::reset(int fd, uint64_t window) {
+    _fd = fd;
+    _window = window;
+    _queued = 0;
+    _dropped = 0;
+}
+
+/* The file now holds data up to end, queue a full window for writeback and drop the one before it */
+void WriteBehind::written(uint64_t end) {
+    if (_fd == -1 || end < _queued + _window)
+        return;
+    sync_file_range(_fd, _queued, end - _queued, SYNC_FILE_RANGE_WRITE);
+    if (_queued > _dropped) {
+        sync_file_range(_fd, _dropped, _queued - _dropped,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(_fd, _dropped, _queued - _dropped, POSIX_FADV_DONTNEED);
+        _dropped = _queued;
+    }
+    _queued = end;
+}
+
+/* Write back and drop everything still cached, before the fd is closed */
+void WriteBehind::finish() {
+    if (_fd == -1)
+        return;
+    sync_file_range(_fd, _dropped, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(_fd, _dropped, 0, POSIX_FADV_DONTNEED);
+    _fd = -1;
+}
+
+DirectFile::DirectFile() :
+    _fd(-1),
+    _direct(false),
+    _writeBehind(false),
+    _trim(false),
+    _bounce(NULL)
+{}
+
+DirectFile::~DirectFile() {
+    if (_fd != -1)
+        ::close(_fd);
+    MemoryBudget::instance().free(_bounce);
+}
+
+/* Size rounded up to the O_DIRECT alignment */
+uint64_t DirectFile::align(uint64_t size) {
+    return (size + DIRECT_IO_ALIGN - 1) & ~((uint64_t) DIRECT_IO_ALIGN - 1);
+}
+
+/* Create or truncate the file, direct mode falls back to write-behind if O_DIRECT is refused */
+bool DirectFile::open(const char *filename, bool direct) {
+    _direct = false;
+    _writeBehind = false;
+    if (direct) {
+        _fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, FILE_MODE);
+        _direct = _fd != -1;
+        _writeBehind = _fd == -1 && errno == EINVAL;
+        if (_direct && !_bounce &&
+            !(_bounce = (uint8_t *) MemoryBudget::instance().allocate(MEMORY_WRITERS, DIRECT_IO_BOUNCE, DIRECT_IO_ALIGN))) {
+            close(0);
+            return false;
+        }
+    }
+    if (_fd == -1 && (!direct || _writeBehind))
+        _fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, FILE_MODE);
+    if (_writeBehind)
+        _behind.reset(_fd, WRITE_BEHIND_WINDOW);
+    _trim = _direct;
+    return _fd != -1;
+}
+
+/* Reserve space ahead of the writes, file systems without fallocate simply grow on write */
+bool DirectFile::preallocate(uint64_t offset, uint64_t length) {
+    _trim = true;
+    return fallocate(_fd, 0, offset, length) == 0 || errno == EOPNOTSUPP;
+}
+
+/* Write size bytes at offset, in direct mode offset must be aligned and the last block is
+   padded with zeros, return bool indicating successful writing */
+bool DirectFile::write(const void *data, size_t size, uint64_t offset) {
+    if (!_direct) {
+        if (pwrite(_fd, data, size, offset) != (ssize_t) size)
+            return false;
+        if (_writeBehind)
+            _behind.written(offset + size);
+        return true;
+    }
+
+    if (offset % DIRECT_IO_ALIGN != 0)
+        return false;
+    const uint8_t *source = (const uint8_t *) data;
+    while (size > 0) {
+        size_t length;
+        ssize_t written;
+        if ((uintptr_t) source % DIRECT_IO_ALIGN == 0 && size >= DIRECT_IO_ALIGN) {
+            /* Whole blocks of an aligned buffer go straight to the device */
+            length = size & ~((size_t) DIRECT_IO_ALIGN - 1);
+            written = pwrite(_fd, source, length, offset);
+            if (written != (ssize_t) length)
+                return false;
+        } else {
+            /* The tail, or an unaligned buffer, goes through the bounce buffer */
+            length = std::min(size, (size_t) DIRECT_IO_BOUNCE);
+            size_t padded = align(length);
+            memcpy(_bounce, source, length);
+            memset(_bounce + length, 0, padded - length);
+            written = pwrite(_fd, _bounce, padded, offset);
+            if (written != (ssize_t) padded)
+                return false;
+        }
+        source += length;
+        size -= length;
+        offset += length;
+    }
+    return true;
+}
+
+/* Trim the padding and pre-allocation beyond size and close, return bool indicating success */
+bool DirectFile::close(uint64_t size) {
+    if (_fd == -1)
+        return true;
+    bool success = !_trim || ftruncate(_fd, size) == 0;
+    if (_writeBehind)
+        _behind.finish();
+    success = ::close(_fd) == 0 && success;
+    _fd = -1;
+    return success;
+}
+
+/* Trim like close() but hand the fd over instead of closing it, -1 on failure */
+int DirectFile::release(uint64_t size) {
+    if (_fd == -1)
+        return -1;
+    bool success = !_trim || ftruncate(_fd, size) == 0;
+    if (_writeBehind)
+        _behind.finish();
+    int fd = _fd;
+    _fd = -1;
+    if (!success) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Flush the file's data to the device, return bool indicating success */
+bool DirectFile::sync() {
+    return _fd == -1 || fdatasync(_fd) == 0;
+}
+
+/* True if the open file bypasses the page cache */
+bool DirectFile::isDirect() const {
+    return _direct;
+}
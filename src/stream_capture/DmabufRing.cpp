@@ -0,0 +1,213 @@
+/*
+ * DmabufRing.cpp
+ *
+ * A fixed ring of NvBuffers (dmabufs) for one camera, created once from the
+ * first acquired image and then recycled. The consumer copies each saved frame
+ * into a free slot and hands the slot to the encoder, which returns it when
+ * done, so the VIC copy of the next frame can overlap the current encode.
+ *
+ * For a buffer stream the ring also owns the capture targets: slots from
+ * getCopyCount() on wrap NvBuffers that Argus captures into directly. The
+ * consumer hands such a slot downstream as is, and releasing it gives the
+ * buffer back to Argus for the next capture instead of the free list.
+ * retain() adds a reader to a slot held downstream, such as a process the
+ * frame is shared with, and the slot only returns once every reader released it.
+ *
+ * Encoders read block-linear buffers, the raw writer maps pitch-linear ones in
+ * the --raw-layout, so the VIC copy into a slot is also the layout conversion.
+ */
+
+#include "DmabufRing.hpp"
+
+#include "Options.hpp"
+#include "MemoryBudget.hpp"
+#include <string.h>
+
+using namespace Argus;
+using namespace EGLStream;
+
+DmabufRing::DmabufRing(uint32_t count, uint32_t captureCount) :
+    _count(count),
+    _captureCount(captureCount),
+    _fds(count + captureCount, -1),
+    _allocated(false),
+    _free(count),
+    _stream(NULL),
+    _display(EGL_NO_DISPLAY),
+    _images(captureCount, EGL_NO_IMAGE_KHR),
+    _buffers(captureCount, NULL),
+    _capturesHeld(0),
+    _retains(count + captureCount)
+{
+    for (uint32_t i = 0; i < _retains.size(); i++)
+        _retains[i] = 0;
+}
+
+DmabufRing::~DmabufRing() {
+    for (uint32_t i = 0; i < _captureCount; i++) {
+        if (_buffers[i])
+            _buffers[i]->destroy();
+        if (_images[i] != EGL_NO_IMAGE_KHR)
+            NvDestroyEGLImage(_display, _images[i]);
+    }
+    for (uint32_t i = 0; i < _fds.size(); i++)
+        if (_fds[i] != -1)
+            MemoryBudget::instance().destroyNvBuffer(_fds[i]);
+}
+
+/* Colour format of camera id's ring buffers for the run's output format */
+NvBufferColorFormat DmabufRing::getColorFormat(const Options& options, uint32_t id) {
+    if (options.isGrayscale(id) || options.isBayer())
+        return NvBufferColorFormat_GRAY8;
+    if (options.format == FORMAT_RAW && options.rawLayout == RAW_LAYOUT_NV12)
+        return NvBufferColorFormat_NV12;
+    return NvBufferColorFormat_YUV420;
+}
+
+/* Memory layout of the ring's buffers, the raw writer maps them so they must be pitch-linear */
+NvBufferLayout DmabufRing::getLayout(const Options& options) {
+    return options.format == FORMAT_RAW ? NvBufferLayout_Pitch : NvBufferLayout_BlockLinear;
+}
+
+/* Create every buffer in the ring from the passed image, call once from the consumer */
+bool DmabufRing::allocate(const NV::IImageNativeBuffer *image, Size2D<uint32_t> size,
+                          NvBufferColorFormat format, NvBufferLayout layout) {
+    for (uint32_t i = 0; i < _count; i++) {
+        _fds[i] = MemoryBudget::instance().createNvBuffer(MEMORY_RINGS, image, size, format, layout);
+        if (_fds[i] == -1)
+            return false;
+        _free.push(i);
+    }
+    _allocated = true;
+    return true;
+}
+
+/* Create every buffer for a buffer stream and hand the capture targets to Argus, call once before capturing */
+bool DmabufRing::allocate(OutputStream *stream, EGLDisplay display, Size2D<uint32_t> size,
+                          NvBufferColorFormat format, NvBufferLayout layout) {
+    _stream = interface_cast<IBufferOutputStream>(stream);
+    _display = display;
+    if (!_stream)
+        return false;
+
+    NvBufferCreateParams params;
+    memset(&params, 0, sizeof(params));
+    params.width = size.width();
+    params.height = size.height();
+    params.payloadType = NvBufferPayload_SurfArray;
+    params.layout = layout;
+    params.colorFormat = format;
+    params.nvbuf_tag = NvBufferTag_CAMERA;
+    for (uint32_t i = 0; i < _fds.size(); i++)
+        if ((_fds[i] = MemoryBudget::instance().createNvBuffer(MEMORY_RINGS, params)) == -1)
+            return false;
+    for (uint32_t i = 0; i < _count; i++)
+        _free.push(i);
+
+    /* Wrap each capture target in an EGLImage backed Argus Buffer tagged with its slot */
+    UniqueObj<BufferSettings> settings(_stream->createBufferSettings());
+    IEGLImageBufferSettings *iSettings = interface_cast<IEGLImageBufferSettings>(settings);
+    if (!iSettings)
+        return false;
+    for (uint32_t i = 0; i < _captureCount; i++) {
+        _images[i] = NvEGLImageFromFd(_display, _fds[_count + i]);
+        if (_images[i] == EGL_NO_IMAGE_KHR)
+            return false;
+        iSettings->setEGLDisplay(_display);
+        iSettings->setEGLImage(_images[i]);
+        _buffers[i] = _stream->createBuffer(settings.get());
+        IBuffer *iBuffer = interface_cast<IBuffer>(_buffers[i]);
+        if (!iBuffer)
+            return false;
+        iBuffer->setClientData((void *) (uintptr_t) (_count + i));
+        if (_stream->releaseBuffer(_buffers[i]) != STATUS_OK)
+            return false;
+    }
+    _allocated = true;
+    return true;
+}
+
+/* Create every buffer without a capture to copy the layout from, for sources other than Argus */
+bool DmabufRing::allocate(Size2D<uint32_t> size, NvBufferColorFormat format, NvBufferLayout layout) {
+    NvBufferCreateParams params;
+    memset(&params, 0, sizeof(params));
+    params.width = size.width();
+    params.height = size.height();
+    params.payloadType = NvBufferPayload_SurfArray;
+    params.layout = layout;
+    params.colorFormat = format;
+    params.nvbuf_tag = NvBufferTag_CAMERA;
+    for (uint32_t i = 0; i < _count; i++) {
+        if ((_fds[i] = MemoryBudget::instance().createNvBuffer(MEMORY_RINGS, params)) == -1)
+            return false;
+        _free.push(i);
+    }
+    _allocated = true;
+    return true;
+}
+
+bool DmabufRing::isAllocated() const {
+    return _allocated;
+}
+
+/* Take a free buffer, returns false without blocking if every buffer is in use */
+bool DmabufRing::acquire(uint32_t& slot, int& fd) {
+    if (!_free.tryPop(slot))
+        return false;
+    fd = _fds[slot];
+    return true;
+}
+
+/* Wait for Argus to fill a capture target, NULL on timeout or when the stream ends */
+Buffer *DmabufRing::acquireCapture(uint64_t timeout, Status *status, uint32_t& slot, int& fd) {
+    Buffer *buffer = _stream->acquireBuffer(timeout, status);
+    IBuffer *iBuffer = interface_cast<IBuffer>(buffer);
+    if (!iBuffer)
+        return NULL;
+    _capturesHeld++;
+    slot = (uintptr_t) iBuffer->getClientData();
+    fd = _fds[slot];
+    return buffer;
+}
+
+/* Add a reader to a slot the caller holds, it then takes one more release to return */
+void DmabufRing::retain(uint32_t slot) {
+    _retains[slot]++;
+}
+
+/* Give a buffer back once nothing downstream reads from it anymore */
+void DmabufRing::release(uint32_t slot) {
+    uint32_t retains = _retains[slot];
+    while (retains > 0 && !_retains[slot].compare_exchange_weak(retains, retains - 1));
+    if (retains > 0)
+        return;
+    if (slot < _count) {
+        _free.push(slot);
+    } else {
+        _capturesHeld--;
+        _stream->releaseBuffer(_buffers[slot - _count]);
+    }
+}
+
+int DmabufRing::getFd(uint32_t slot) const {
+    return _fds[slot];
+}
+
+/* Every slot, copy targets and capture targets */
+uint32_t DmabufRing::getCount() const {
+    return _count + _captureCount;
+}
+
+/* Slots below this are copy targets */
+uint32_t DmabufRing::getCopyCount() const {
+    return _count;
+}
+
+/* Capture targets acquired from Argus and not yet released */
+uint32_t DmabufRing::getCapturesHeld() const {
+    return _capturesHeld;
+}
+
+size_t DmabufRing::getAvailable() {
+    return _free.size();
+}
@@ -0,0 +1,315 @@
+/*
+ * EncodeScheduler.cpp
+ *
+ * Shares a small number of JPEG encoder workers between all cameras. The TX2
+ * has a single NVJPG engine, so instead of six encoders contending for it in
+ * no particular order, each camera submits its dmabufs to an EncodeChannel and
+ * the workers service the channels round-robin, oldest-frame-first, or each
+ * worker its own cameras first, stealing from the others when idle. Each
+ * channel holds its camera's JPEG quality, steered towards a bytes per image
+ * budget if one is set. With --proxy the workers also encode a small proxy
+ * of each frame from the same dmabuf into the channel's proxy container,
+ * but only with time to spare. Per camera wait times, proxy costs and per
+ * worker engine utilisation are logged at shutdown.
+ */
+
+#include "EncodeScheduler.hpp"
+
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "DmabufRing.hpp"
+#include "FrameWriter.hpp"
+#include "EncodeWorker.hpp"
+#include "ContainerFile.hpp"
+#include "ExifHeader.hpp"
+#include "SteadyClock.hpp"
+#include <sstream>
+#include <chrono>
+
+#define STDOUT_PRINT true
+#define DRAIN_TIMEOUT_MS 5000 // upper bound on waiting for a camera's queued encodes
+#define PROXY_ROTATE_BYTES (1ULL << 30) // proxy containers rotate every GiB
+
+EncodeChannel::EncodeChannel(uint32_t id, DmabufRing& ring, FrameWriter& writer, EncodeScheduler& scheduler,
+                             int quality, uint64_t budget) :
+    _id(id),
+    _ring(ring),
+    _writer(writer),
+    _scheduler(scheduler),
+    _jobs(ring.getCount()),
+    _inFlight(0),
+    _failed(false),
+    _submitted(0),
+    _encoded(0),
+    _totalWait(0),
+    _maxWait(0),
+    _quality(quality, budget),
+    _proxies(NULL),
+    _exif(NULL),
+    _proxiesWritten(0),
+    _proxiesSkipped(0)
+{}
+
+EncodeChannel::~EncodeChannel() {
+    if (_proxies)
+        delete _proxies;
+    if (_exif)
+        delete _exif;
+}
+
+/* Queue a copied frame, the slot is released back to the ring once encoded */
+bool EncodeChannel::submit(const FrameJob& job) {
+    ScheduledJob scheduled = {job, now()};
+    if (!_jobs.push(scheduled))
+        return false;
+    _submitted++;
+    _scheduler.notify();
+    return true;
+}
+
+/* True once an encode or write has failed, the owning consumer should stop */
+bool EncodeChannel::hasFailed() {
+    return _failed || _writer.hasFailed();
+}
+
+uint64_t EncodeChannel::getFramesWritten() {
+    return _writer.getFramesWritten();
+}
+
+uint64_t EncodeChannel::getBytesWritten() {
+    return _writer.getBytesWritten();
+}
+
+/* Frames waiting for an encoder plus encoded images waiting for the writer */
+size_t EncodeChannel::getQueueDepth() {
+    return _jobs.size() + _inFlight + _writer.getQueueDepth();
+}
+
+/* JPEG encode time of this camera's frames */
+const LatencyHistogram *EncodeChannel::getLatency() {
+    return &_encodeLatency;
+}
+
+/* JPEG quality the camera's next frame should be encoded at, before any backpressure */
+int EncodeChannel::getQuality() const {
+    return _quality.getQuality();
+}
+
+/* Encode the next frames at quality, a budget then steers it from there */
+void EncodeChannel::setQuality(int quality) {
+    _quality.setQuality(quality);
+}
+
+/* Wait until every job this camera submitted has been encoded */
+void EncodeChannel::drain() {
+    std::unique_lock<std::mutex> lock(_scheduler._mutex);
+    _scheduler._drained.wait_for(lock, std::chrono::milliseconds(DRAIN_TIMEOUT_MS),
+                                 [this] { return _jobs.size() == 0 && _inFlight == 0; });
+}
+
+EncodeScheduler::EncodeScheduler(const Options& options, uint32_t numCameras) :
+    _options(options),
+    _logger(NULL),
+    _channels(numCameras, NULL),
+    _steals(options.encodeWorkers, 0),
+    _next(0),
+    _pending(0)
+{}
+
+EncodeScheduler::~EncodeScheduler() {
+    for (uint32_t i = 0; i < _workers.size(); i++)
+        delete _workers[i];
+    for (uint32_t i = 0; i < _channels.size(); i++)
+        delete _channels[i];
+    if (_logger)
+        delete _logger;
+}
+
+/* Launch the encoder workers */
+bool EncodeScheduler::start() {
+
+    bool errorOccurred = false;
+
+    _logger = new Logger("SCHEDULER", _options.directory);
+    if (!_logger) {
+        errorOccurred = true;
+    } else if (_options.verbose) {
+        _logger->enableVerbose();
+    } else {
+        _logger->disableVerbose();
+    }
+
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "Launching " << _options.encodeWorkers << " encoder workers...";
+        _logger->log(ss.str());
+    }
+    for (int i = 0; i < _options.encodeWorkers && !errorOccurred; i++) {
+        EncodeWorker *worker = new EncodeWorker(i, _options, *this);
+        if (!worker) {
+            _logger->error("Failed to create encoder worker!");
+            errorOccurred = true;
+        } else {
+            _workers.push_back(worker);
+            if (!worker->initialize()) {
+                _logger->error("Failed to start encoder worker!");
+                errorOccurred = true;
+            }
+        }
+    }
+
+    /* The workers create their encoders concurrently, wait for all of them at once */
+    for (uint32_t i = 0; i < _workers.size() && !errorOccurred; i++) {
+        if (!_workers[i]->waitRunning()) {
+            _logger->error("Failed to start encoder worker!");
+            errorOccurred = true;
+        }
+    }
+    return !errorOccurred;
+}
+
+/* Stop the workers and log fairness and utilisation, call after every consumer has drained */
+void EncodeScheduler::shutdown() {
+    for (uint32_t i = 0; i < _workers.size(); i++) {
+        double utilisation = _workers[i]->getUtilisation();
+        _workers[i]->shutdown();
+        std::stringstream ss;
+        ss << "Worker " << i << " encoder utilisation: " << (int) (utilisation * 100) << "%";
+        if (_options.encodePolicy == ENCODE_POLICY_STEAL)
+            ss << ", stole " << _steals[i] << " jobs";
+        _logger->log(ss.str());
+    }
+    for (uint32_t i = 0; i < _channels.size(); i++) {
+        EncodeChannel *channel = _channels[i];
+        if (!channel)
+            continue;
+        uint64_t encoded = channel->_encoded;
+        std::stringstream ss;
+        ss << "Camera " << i << ": submitted " << channel->_submitted
+           << ", encoded " << encoded
+           << ", mean wait " << (encoded ? channel->_totalWait / encoded / 1000 : 0) << " us"
+           << ", max wait " << channel->_maxWait / 1000 << " us"
+           << ", quality " << channel->getQuality();
+        if (channel->_quality.getBudget() > 0)
+            ss << " after " << channel->_quality.getMoves() << " moves towards "
+               << (channel->_quality.getBudget() >> 10) << " KiB per image";
+        _logger->log(ss.str());
+        if (channel->_proxies) {
+            ss.str("");
+            ss << "Camera " << i << ": proxies written " << channel->_proxiesWritten
+               << ", skipped " << channel->_proxiesSkipped
+               << ", cost p50 " << channel->_proxyLatency.getPercentile(50) << " us"
+               << ", p99 " << channel->_proxyLatency.getPercentile(99) << " us"
+               << ", " << (channel->_proxies->getBytesWritten() >> 10) << " KiB";
+            _logger->log(ss.str());
+            if (!channel->_proxies->close())
+                _logger->error("Failed to close the proxy container!");
+        }
+    }
+}
+
+/* Create the channel a consumer submits its frames to, owned by the scheduler */
+EncodeChannel *EncodeScheduler::registerCamera(uint32_t id, DmabufRing& ring, FrameWriter& writer) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (id >= _channels.size() || _channels[id])
+        return NULL;
+    EncodeChannel *channel = new EncodeChannel(id, ring, writer, *this, _options.getQuality(id),
+                                               (uint64_t) _options.getQualityBudget(id) << 10);
+    if (channel && _options.isProxyEnabled()) {
+        std::string directory = std::string(_options.directory) + "/cam" + std::to_string(id);
+        channel->_proxies = new ContainerFile(directory, PROXY_ROTATE_BYTES, false, "proxies");
+        if (!channel->_proxies) {
+            delete channel;
+            channel = NULL;
+        }
+    }
+    if (channel && _options.exif)
+        channel->_exif = new ExifHeader(id);
+    _channels[id] = channel;
+    return channel;
+}
+
+/* Channel with the oldest queued frame, among the worker's own cameras if own, or all, -1 if none */
+int32_t EncodeScheduler::pickOldest(uint32_t worker, bool own) {
+    uint64_t oldest = UINT64_MAX;
+    int32_t chosen = -1;
+    for (uint32_t i = 0; i < _channels.size(); i++) {
+        ScheduledJob head;
+        if (own && i % _workers.size() != worker)
+            continue;
+        if (_channels[i] && _channels[i]->_jobs.peek(head) && head.submitted < oldest) {
+            oldest = head.submitted;
+            chosen = i;
+        }
+    }
+    return chosen;
+}
+
+/* Channel with the most queued frames, the camera falling furthest behind, -1 if none */
+int32_t EncodeScheduler::pickLongest() {
+    size_t longest = 0;
+    int32_t chosen = -1;
+    for (uint32_t i = 0; i < _channels.size(); i++) {
+        if (_channels[i] && _channels[i]->_jobs.size() > longest) {
+            longest = _channels[i]->_jobs.size();
+            chosen = i;
+        }
+    }
+    return chosen;
+}
+
+/* Pick the next job for the worker by policy, waiting up to timeoutMs for one to arrive */
+bool EncodeScheduler::next(uint32_t worker, EncodeChannel*& channel, ScheduledJob& job, uint32_t timeoutMs) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!_ready.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return _pending > 0; }))
+        return false;
+    _pending--;
+
+    uint32_t count = _channels.size();
+    int32_t chosen = -1;
+    if (_options.encodePolicy == ENCODE_POLICY_OLDEST) {
+        chosen = pickOldest(worker, false);
+    } else if (_options.encodePolicy == ENCODE_POLICY_STEAL) {
+        /* Camera i belongs to worker i modulo the workers, so a camera's frames mostly stay on one encoder */
+        chosen = pickOldest(worker, true);
+        if (chosen == -1) {
+            chosen = pickLongest();
+            if (chosen != -1 && worker < _steals.size())
+                _steals[worker]++;
+        }
+    } else {
+        for (uint32_t k = 0; k < count && chosen == -1; k++) {
+            uint32_t i = (_next + k) % count;
+            if (_channels[i] && _channels[i]->_jobs.size() > 0)
+                chosen = i;
+        }
+        if (chosen != -1)
+            _next = (chosen + 1) % count;
+    }
+
+    if (chosen == -1 || !_channels[chosen]->_jobs.tryPop(job))
+        return false;
+    channel = _channels[chosen];
+    channel->_inFlight++;
+    return true;
+}
+
+/* Record a completed job and wake anyone draining its channel */
+void EncodeScheduler::finished(EncodeChannel *channel, uint64_t waitNs) {
+    channel->_encoded++;
+    channel->_totalWait += waitNs;
+    if (waitNs > channel->_maxWait)
+        channel->_maxWait = waitNs;
+    std::lock_guard<std::mutex> lock(_mutex);
+    channel->_inFlight--;
+    _drained.notify_all();
+}
+
+/* Count a newly submitted job and wake one worker */
+void EncodeScheduler::notify() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending++;
+    }
+    _ready.notify_one();
+}
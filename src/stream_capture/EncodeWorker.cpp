@@ -0,0 +1,246 @@
+/*
+ * EncodeWorker.cpp
+ *
+ * One JPEG encoder thread owned by the EncodeScheduler. Each worker has its own
+ * NvJPEGEncoder, takes the next job the scheduler picks, encodes it into a
+ * buffer from that camera's FrameWriter and returns the dmabuf to its ring.
+ * With --proxy it encodes the same dmabuf a second time, scaled down, into its
+ * own buffer and appends it to the camera's proxy container, unless frames are
+ * waiting for the camera or proxies have used up their share of its time.
+ */
+
+#include "EncodeWorker.hpp"
+
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "ThreadPlacement.hpp"
+#include "TraceLog.hpp"
+#include "FrameWriter.hpp"
+#include "DmabufRing.hpp"
+#include "EncodeScheduler.hpp"
+#include "ContainerFile.hpp"
+#include "ExifHeader.hpp"
+#include "SteadyClock.hpp"
+#include <NvJpegEncoder.h>
+#include <sstream>
+#include <sched.h>
+#include <stdlib.h>
+
+#define STDOUT_PRINT true
+#define POP_TIMEOUT_MS 100 // bounds how long shutdown waits on an idle scheduler
+#define PROXY_QUALITY 70
+
+EncodeWorker::EncodeWorker(uint32_t id, const Options& options, EncodeScheduler& scheduler) :
+    _id(id),
+    _options(options),
+    _logger(NULL),
+    _jpegEncoder(NULL),
+    _scheduler(scheduler),
+    _started(now()),
+    _busy(0),
+    _proxyBuffer(NULL),
+    _proxyCapacity(0),
+    _proxyBusy(0),
+    _proxyFailed(false)
+{}
+
+EncodeWorker::~EncodeWorker() {
+    if (_jpegEncoder)
+        delete _jpegEncoder;
+    free(_proxyBuffer);
+    if (_logger)
+        delete _logger;
+}
+
+bool EncodeWorker::threadInitialize() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "ENCODER " << std::to_string(_id);
+        _logger = new Logger(ss.str(), _options.directory);
+        TraceLog::instance().nameThread(ss.str());
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Pin the thread and set its scheduling class, a failure is logged but not fatal */
+    if (!errorOccurred) {
+        placeThread(_options.getWriterCpu(_id), SCHED_OTHER, 0, _logger);
+    }
+
+    /* Create encoder with name jpegenc */
+    if (!errorOccurred) {
+        _logger->log("Creating the encoder...");
+        _jpegEncoder = NvJPEGEncoder::createJPEGEncoder("jpegenc");
+        if (!_jpegEncoder) {
+            _logger->error("Failed to create JPEGEncoder!");
+            errorOccurred = true;
+        } else if (_options.profile) {
+            _jpegEncoder->enableProfiling();
+        }
+    }
+
+    /* Allocate the proxy output, libjpeg grows it should an image not fit */
+    if (!errorOccurred && _options.isProxyEnabled()) {
+        _proxyCapacity = _options.proxyResolution.area() * 3 / 2;
+        _proxyBuffer = (unsigned char *) malloc(_proxyCapacity);
+        if (!_proxyBuffer) {
+            _logger->error("Failed to allocate the proxy buffer!");
+            errorOccurred = true;
+        }
+    }
+
+    _started = now();
+    return !errorOccurred;
+}
+
+bool EncodeWorker::threadExecute() {
+    EncodeChannel *channel = NULL;
+    ScheduledJob job;
+    if (_scheduler.next(_id, channel, job, POP_TIMEOUT_MS)) {
+        uint64_t start = now();
+        if (!processV4L2Fd(channel, job))
+            channel->_failed = true;
+        channel->_ring.release(job.job.slot);
+        _busy += now() - start;
+        _scheduler.finished(channel, start - job.submitted);
+        if (_counters.isStarted())
+            _counters.count();
+        else
+            _counters.start(); // the first job sets up the encoder
+    }
+    return true;
+}
+
+bool EncodeWorker::threadShutdown() {
+    if (_counters.isStarted())
+        _logger->log(_counters.report(), STDOUT_PRINT);
+    if (_jpegEncoder && _options.profile)
+        _jpegEncoder->printProfilingStats();
+    return true;
+}
+
+/* Fraction of time since start spent encoding */
+double EncodeWorker::getUtilisation() {
+    uint64_t elapsed = now() - _started;
+    return elapsed ? (double) _busy / elapsed : 0.0;
+}
+
+/* JPEG encode the job's file descriptor and queue it for writing, return false only on encoder failure */
+bool EncodeWorker::processV4L2Fd(EncodeChannel *channel, const ScheduledJob& job) {
+
+    /* Drop the frame if every output buffer is still queued, the writer counts it */
+    FrameWriter& writer = channel->_writer;
+    EncodedFrame encoded;
+    encoded.telemetry = job.job.telemetry;
+    encoded.telemetry.queueUs = (now() - job.submitted) / 1000;
+    if (!writer.getBuffer(encoded)) {
+        encoded.telemetry.flags |= TELEMETRY_DROP_BUFFER;
+        writer.record(encoded.telemetry);
+        return true;
+    }
+
+    /* Encode into the checked-out buffer and hand it over */
+    encoded.index = job.job.index;
+    encoded.timestamp = job.job.timestamp;
+    uint64_t start = now();
+
+    /* Crop and scale in the encoder, it forgets the crop after every image and the workers
+       serve every camera, so both are set for each one */
+    if (_options.hasEncodeGeometry()) {
+        Argus::Rectangle<uint32_t> crop = _options.getCrop(channel->_id);
+        Argus::Size2D<uint32_t> size = _options.getEncodeSize(channel->_id);
+        _jpegEncoder->setCropRect(crop.left(), crop.top(), crop.width(), crop.height());
+        _jpegEncoder->setScaledEncodeParams(size.width(), size.height());
+    }
+    _jpegEncoder->setRestartRows(_options.restartRows);
+    J_COLOR_SPACE colorSpace = _options.isGrayscale(channel->_id) ? JCS_GRAYSCALE : JCS_YCbCr; // a luma only slot
+
+    /* With --exif the encoder writes behind room for the APP1 segment, which then goes in after the
+       SOI marker without moving the image */
+    unsigned char *buffer = encoded.data;
+    size_t headroom = channel->_exif ? channel->_exif->getSize() : 0;
+    encoded.data += headroom;
+    encoded.size -= headroom;
+    int result = _jpegEncoder->encodeFromFd(job.job.fd, colorSpace, &encoded.data, encoded.size, job.job.quality);
+    if (encoded.data == buffer + headroom) {
+        encoded.data = buffer;
+        if (headroom && result == 0) {
+            channel->_exif->write(buffer, job.job.index, job.job.timestamp, job.job.exposureTime, job.job.gain);
+            encoded.size += headroom;
+        }
+    } // else libjpeg outgrew the buffer and left its own, without headroom: the image goes without EXIF
+    if (result != 0) {
+        _logger->error("An error occurred while encoding the JPEG image!");
+        writer.returnBuffer(encoded);
+        encoded.telemetry.flags |= TELEMETRY_FAILED;
+        writer.record(encoded.telemetry);
+        return false;
+    }
+    uint64_t end = now();
+    encoded.telemetry.encodeUs = (end - start) / 1000;
+    TraceLog::instance().span("encode", start, end, job.job.index);
+    channel->_encodeLatency.record(encoded.telemetry.encodeUs);
+    channel->_quality.record(job.job.quality, encoded.size);
+    if (!writer.submit(encoded)) {
+        encoded.telemetry.flags |= TELEMETRY_DROP_QUEUE;
+        writer.record(encoded.telemetry);
+        writer.returnBuffer(encoded);
+    }
+
+    /* The dmabuf is still ours, encode the proxy from it */
+    if (channel->_proxies && job.job.index % _options.proxyEvery == 0)
+        encodeProxy(channel, job);
+    return true;
+}
+
+/* Encode a scaled down copy of the job into the camera's proxy container. Proxies are best
+   effort: one is skipped while frames wait for this camera or once proxies have taken more
+   than their share of this worker's time, and a failure never stops the recording */
+void EncodeWorker::encodeProxy(EncodeChannel *channel, const ScheduledJob& job) {
+    uint64_t start = now();
+    if (channel->_jobs.size() > 0 || _proxyBusy * 100 > (start - _started) * _options.proxyBudget) {
+        channel->_proxiesSkipped++;
+        return;
+    }
+
+    Argus::Rectangle<uint32_t> crop = _options.getCrop(channel->_id);
+    _jpegEncoder->setCropRect(crop.left(), crop.top(), crop.width(), crop.height());
+    _jpegEncoder->setScaledEncodeParams(_options.proxyResolution.width(), _options.proxyResolution.height());
+    _jpegEncoder->setRestartRows(0); // proxies are decoded whole
+    unsigned char *data = _proxyBuffer;
+    unsigned long size = _proxyCapacity;
+    bool success = _jpegEncoder->encodeFromFd(job.job.fd, _options.isGrayscale(channel->_id) ? JCS_GRAYSCALE : JCS_YCbCr,
+                                               &data, size, PROXY_QUALITY) == 0;
+    if (data != _proxyBuffer) {
+        free(_proxyBuffer);
+        _proxyBuffer = data;
+        _proxyCapacity = size;
+    }
+    if (success) {
+        std::lock_guard<std::mutex> lock(channel->_proxyMutex);
+        success = channel->_proxies->append(data, size, job.job.index, job.job.timestamp);
+    }
+
+    uint64_t end = now();
+    uint64_t elapsed = end - start;
+    TraceLog::instance().span("encode proxy", start, end, job.job.index);
+    _proxyBusy += elapsed;
+    channel->_proxyLatency.record(elapsed / 1000);
+    if (success) {
+        channel->_proxiesWritten++;
+    } else {
+        channel->_proxiesSkipped++;
+        if (!_proxyFailed)
+            _logger->error("Failed to encode or store a proxy image, skipping it!");
+        _proxyFailed = true;
+    }
+}
@@ -0,0 +1,179 @@
+/*
+ * ExifHeader.cpp
+ *
+ * The APP1/EXIF segment of --exif, laid out once per camera and patched per
+ * frame where the capture time, exposure, ISO and image number go.
+ *
+ * Segment layout: FFE1, length, "Exif\0\0", little endian TIFF header, IFD0
+ * (Make, Model, DateTime, Exif IFD pointer), Exif IFD (ExposureTime,
+ * ISOSpeedRatings, ExifVersion, DateTimeOriginal, OffsetTimeOriginal,
+ * ImageNumber, SubSecTimeOriginal, BodySerialNumber), then the values that do
+ * not fit their entries
+ */
+
+#include "ExifHeader.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+#define TIFF_START 12U              // SOI, APP1 marker, length and "Exif\0\0" come first
+#define IFD0_ENTRIES 4U
+#define EXIF_ENTRIES 8U
+#define IFD_ENTRY_SIZE 12U
+#define DATE_LENGTH 20U             // "YYYY:MM:DD HH:MM:SS" and its NUL
+
+#define TYPE_SHORT 3U
+#define TYPE_ASCII 2U
+#define TYPE_LONG 4U
+#define TYPE_RATIONAL 5U
+#define TYPE_UNDEFINED 7U
+
+static void put16(unsigned char *destination, uint16_t value) {
+    destination[0] = value & 0xff;
+    destination[1] = value >> 8;
+}
+
+static void put32(unsigned char *destination, uint32_t value) {
+    for (uint32_t i = 0; i < 4; i++)
+        destination[i] = (value >> (i * 8)) & 0xff;
+}
+
+/* Nanoseconds on a clock */
+static int64_t getClock(clockid_t clock) {
+    struct timespec time;
+    clock_gettime(clock, &time);
+    return (int64_t) time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+/* Builds the TIFF structure behind TIFF_START, offsets are from the TIFF header */
+class TiffBuilder {
+
+    public:
+        TiffBuilder(unsigned char *tiff, uint32_t dataStart) : _tiff(tiff), _data(dataStart) {}
+
+        /* Write entry i of the IFD at ifd with a value of length bytes, kept in the entry if it fits
+           and in the data area on an even offset otherwise, and return the offset of the value */
+        uint32_t setEntryData(uint32_t ifd, uint32_t i, uint16_t tag, uint16_t type, uint32_t count,
+                              const void *value, uint32_t length) {
+            uint32_t offset = getValueOffset(ifd, i);
+            if (length > 4) {
+                setEntry(ifd, i, tag, type, count, _data);
+                offset = _data;
+                _data += length + (length & 1);
+            } else {
+                setEntry(ifd, i, tag, type, count, 0);
+            }
+            memcpy(_tiff + offset, value, length);
+            return offset;
+        }
+
+        /* Write entry i of the IFD at ifd, whose value or value offset is value */
+        void setEntry(uint32_t ifd, uint32_t i, uint16_t tag, uint16_t type, uint32_t count, uint32_t value) {
+            unsigned char *entry = _tiff + ifd + 2 + i * IFD_ENTRY_SIZE;
+            put16(entry, tag);
+            put16(entry + 2, type);
+            put32(entry + 4, count);
+            put32(entry + 8, value);
+        }
+
+        /* Offset of the value of entry i of the IFD at ifd, for values stored in the entry */
+        uint32_t getValueOffset(uint32_t ifd, uint32_t i) const {
+            return ifd + 2 + i * IFD_ENTRY_SIZE + 8;
+        }
+
+        uint32_t getEnd() const {
+            return _data;
+        }
+
+    private:
+        unsigned char *_tiff;
+        uint32_t _data;
+};
+
+ExifHeader::ExifHeader(uint32_t camera) :
+    _size(0),
+    _wallOffset(getClock(CLOCK_REALTIME) - getClock(CLOCK_MONOTONIC))
+{
+    memset(_template, 0, sizeof(_template));
+    unsigned char *tiff = _template + TIFF_START;
+    memcpy(tiff, "II*\0", 4);
+    put32(tiff + 4, 8);
+    uint32_t ifd0 = 8;
+    uint32_t exif = ifd0 + 2 + IFD0_ENTRIES * IFD_ENTRY_SIZE + 4;
+    uint32_t dataStart = exif + 2 + EXIF_ENTRIES * IFD_ENTRY_SIZE + 4;
+    put16(tiff + ifd0, IFD0_ENTRIES);
+    put16(tiff + exif, EXIF_ENTRIES);
+
+    /* The camera's names never change, the date and the exposure are placeholders */
+    TiffBuilder builder(tiff, dataStart);
+    std::string make = "UofWRoverLICameras";
+    std::string model = "cam" + std::to_string(camera);
+    std::string serial = std::to_string(camera);
+    char date[DATE_LENGTH] = "0000:00:00 00:00:00";
+    unsigned char exposure[8];
+    put32(exposure, 0);
+    put32(exposure + 4, 1000000); // ExposureTime in us
+
+    /* Entries in ascending tag order, as TIFF requires */
+    builder.setEntryData(ifd0, 0, 0x010f, TYPE_ASCII, make.size() + 1, make.c_str(), make.size() + 1);
+    builder.setEntryData(ifd0, 1, 0x0110, TYPE_ASCII, model.size() + 1, model.c_str(), model.size() + 1);
+    uint32_t dateOffset = builder.setEntryData(ifd0, 2, 0x0132, TYPE_ASCII, DATE_LENGTH, date, DATE_LENGTH);
+    builder.setEntry(ifd0, 3, 0x8769, TYPE_LONG, 1, exif);
+    uint32_t exposureOffset = builder.setEntryData(exif, 0, 0x829a, TYPE_RATIONAL, 1, exposure, sizeof(exposure));
+    builder.setEntry(exif, 1, 0x8827, TYPE_SHORT, 1, 0);
+    builder.setEntryData(exif, 2, 0x9000, TYPE_UNDEFINED, 4, "0231", 4);
+    uint32_t originalOffset = builder.setEntryData(exif, 3, 0x9003, TYPE_ASCII, DATE_LENGTH, date, DATE_LENGTH);
+    builder.setEntryData(exif, 4, 0x9011, TYPE_ASCII, 7, "+00:00", 7);
+    builder.setEntry(exif, 5, 0x9211, TYPE_LONG, 1, 0);
+    builder.setEntryData(exif, 6, 0x9291, TYPE_ASCII, 4, "000", 4);
+    builder.setEntryData(exif, 7, 0xa431, TYPE_ASCII, serial.size() + 1, serial.c_str(), serial.size() + 1);
+
+    _dateTime = TIFF_START + dateOffset;
+    _dateTimeOriginal = TIFF_START + originalOffset;
+    _subSecTime = TIFF_START + builder.getValueOffset(exif, 6);
+    _exposureTime = TIFF_START + exposureOffset;
+    _iso = TIFF_START + builder.getValueOffset(exif, 1);
+    _imageNumber = TIFF_START + builder.getValueOffset(exif, 5);
+
+    /* The segment's length counts itself but not its marker */
+    _size = TIFF_START - 2 + builder.getEnd();
+    _template[0] = 0xff;
+    _template[1] = 0xd8;
+    _template[2] = 0xff;
+    _template[3] = 0xe1;
+    _template[4] = (_size - 2) >> 8;
+    _template[5] = (_size - 2) & 0xff;
+    memcpy(_template + 6, "Exif\0\0", 6);
+}
+
+/* Bytes of headroom the encoder writes behind, the APP1 segment's size */
+size_t ExifHeader::getSize() const {
+    return _size;
+}
+
+/* Write the SOI marker and the patched APP1 segment to destination, the encoded image follows
+   getSize() bytes in with its own SOI marker, which is overwritten. A frame without a timestamp
+   takes the time it is written */
+void ExifHeader::write(unsigned char *destination, uint64_t index, uint64_t timestamp, uint64_t exposureTime,
+                       float gain) const {
+    memcpy(destination, _template, _size + 2);
+
+    int64_t wall = timestamp ? (int64_t) timestamp + _wallOffset : getClock(CLOCK_REALTIME);
+    time_t seconds = wall / 1000000000LL;
+    struct tm utc;
+    char date[DATE_LENGTH];
+    if (gmtime_r(&seconds, &utc) && strftime(date, sizeof(date), "%Y:%m:%d %H:%M:%S", &utc) == DATE_LENGTH - 1) {
+        memcpy(destination + _dateTime, date, DATE_LENGTH - 1);
+        memcpy(destination + _dateTimeOriginal, date, DATE_LENGTH - 1);
+    }
+    char subSec[4];
+    snprintf(subSec, sizeof(subSec), "%03u", (uint32_t) (wall / 1000000 % 1000));
+    memcpy(destination + _subSecTime, subSec, 3);
+
+    put32(destination + _exposureTime, exposureTime / 1000);
+    float iso = gain * 100.0f + 0.5f; // ISO 100 at unity gain
+    put16(destination + _iso, iso < 65535.0f ? (uint16_t) iso : 65535);
+    put32(destination + _imageNumber, (uint32_t) index);
+}
@@ -0,0 +1,101 @@
+/*
+ * ExposureGate.cpp
+ *
+ * Flags black and saturated frames from the Bayer histogram of their capture
+ * metadata: the share of green samples in bins below the black level or above
+ * the white level, bins placed by Ext::INonLinearHistogram when compressed.
+ */
+
+#include "ExposureGate.hpp"
+
+#include <Argus/Argus.h>
+#include <Argus/Ext/NonLinearHistogram.h>
+
+using namespace Argus;
+
+#define EXPOSURE_BLACK_LEVEL 0.04f  // normalized bin values below this count as black
+#define EXPOSURE_WHITE_LEVEL 0.96f  // normalized bin values above this count as saturated
+
+ExposureGate::ExposureGate(double threshold) :
+    _threshold(threshold),
+    _black(0),
+    _saturated(0),
+    _unmeasured(0),
+    _lastBlack(0),
+    _lastSaturated(0)
+{}
+
+/* Judge the capture by its histogram, a capture without one is usable */
+ExposureVerdict ExposureGate::evaluate(const ICaptureMetadata *iMetadata) {
+    const InterfaceProvider *histogram = iMetadata ? iMetadata->getBayerHistogram() : NULL;
+    const IBayerHistogram *iHistogram = interface_cast<const IBayerHistogram>(histogram);
+    std::vector<BayerTuple<uint32_t> > bins;
+    if (!iHistogram || iHistogram->getHistogram(&bins) != STATUS_OK || bins.empty()) {
+        _unmeasured++;
+        return EXPOSURE_USABLE;
+    }
+
+    /* Bin values are evenly spread unless the sensor's data was compressed */
+    const Ext::INonLinearHistogram *iNonLinear = interface_cast<const Ext::INonLinearHistogram>(histogram);
+    std::vector<BayerTuple<float> > values;
+    if (iNonLinear && iNonLinear->getHistogramBinValues(&values) == STATUS_OK && values.size() == bins.size()) {
+        _binValues.resize(bins.size());
+        for (size_t i = 0; i < bins.size(); i++)
+            _binValues[i] = (values[i].gEven() + values[i].gOdd()) / 2;
+    } else if (_binValues.size() != bins.size()) {
+        _binValues.resize(bins.size());
+        for (size_t i = 0; i < bins.size(); i++)
+            _binValues[i] = (i + 0.5f) / bins.size();
+    }
+
+    uint64_t total = 0, black = 0, saturated = 0;
+    for (size_t i = 0; i < bins.size(); i++) {
+        uint64_t count = (uint64_t) bins[i].gEven() + bins[i].gOdd();
+        total += count;
+        if (_binValues[i] < EXPOSURE_BLACK_LEVEL)
+            black += count;
+        else if (_binValues[i] > EXPOSURE_WHITE_LEVEL)
+            saturated += count;
+    }
+    if (total == 0) {
+        _unmeasured++;
+        return EXPOSURE_USABLE;
+    }
+    _lastBlack = (double) black / total;
+    _lastSaturated = (double) saturated / total;
+
+    if (_lastSaturated >= _threshold) {
+        _saturated++;
+        return EXPOSURE_SATURATED;
+    }
+    if (_lastBlack >= _threshold) {
+        _black++;
+        return EXPOSURE_BLACK;
+    }
+    return EXPOSURE_USABLE;
+}
+
+/* Frames judged too dark since the start */
+uint64_t ExposureGate::getFramesBlack() const {
+    return _black;
+}
+
+/* Frames judged too bright since the start */
+uint64_t ExposureGate::getFramesSaturated() const {
+    return _saturated;
+}
+
+/* Captures without a histogram, passed unjudged */
+uint64_t ExposureGate::getFramesUnmeasured() const {
+    return _unmeasured;
+}
+
+/* Share of black samples in the last measured frame */
+double ExposureGate::getLastBlack() const {
+    return _lastBlack;
+}
+
+/* Share of saturated samples in the last measured frame */
+double ExposureGate::getLastSaturated() const {
+    return _lastSaturated;
+}
@@ -0,0 +1,89 @@
+/*
+ * FrameCadence.cpp
+ *
+ * Accounts the frames a camera's sensor produced that never reached its
+ * consumer, and how evenly the rest arrived. Periods lost are taken from the
+ * sensor timestamps, which are the only measure a buffer stream has, frames
+ * replaced from the IFrame numbers of an EGLStream and internal captures from
+ * the Ext::InternalFrameCount of the capture metadata. Each delta is compared
+ * with the frame duration of the later frame, so AE stretching the frames or
+ * a re-timed sensor are not counted as lost frames.
+ */
+
+#include "FrameCadence.hpp"
+
+#define LOST_THRESHOLD_NUM 3    // a delta over 3/2 frame durations has lost frames in it
+#define LOST_THRESHOLD_DEN 2
+
+FrameCadence::FrameCadence(uint64_t frameDuration) :
+    _frameDuration(frameDuration),
+    _firstTimestamp(0),
+    _lastTimestamp(0),
+    _lastNumber(0),
+    _lastInternal(0),
+    _frames(0),
+    _periodsLost(0),
+    _framesReplaced(0),
+    _internalCaptures(0),
+    _sensorFps(0)
+{}
+
+/* Account one acquired frame, a 0 timestamp, frame duration, frame number or internal count is one
+   the stream does not report */
+void FrameCadence::observe(uint64_t timestamp, uint64_t frameDuration, uint64_t frameNumber, uint64_t internalCount) {
+    _frames++;
+    if (frameNumber && _lastNumber && frameNumber > _lastNumber + 1)
+        _framesReplaced += frameNumber - _lastNumber - 1;
+    if (internalCount && _lastInternal && internalCount > _lastInternal + 1)
+        _internalCaptures += internalCount - _lastInternal - 1;
+    _lastNumber = frameNumber;
+    _lastInternal = internalCount;
+
+    if (timestamp == 0)
+        return;
+    if (frameDuration == 0)
+        frameDuration = _frameDuration;
+    if (_lastTimestamp && timestamp > _lastTimestamp && frameDuration > 0) {
+        uint64_t delta = timestamp - _lastTimestamp;
+        if (delta * LOST_THRESHOLD_DEN > frameDuration * LOST_THRESHOLD_NUM) {
+            _periodsLost += (delta + frameDuration / 2) / frameDuration - 1;
+        } else {
+            uint64_t deviation = delta > frameDuration ? delta - frameDuration : frameDuration - delta;
+            _jitter.record(deviation / 1000);
+        }
+        _sensorFps = (_frames - 1) * 1e9 / (timestamp - _firstTimestamp);
+    } else if (!_firstTimestamp) {
+        _firstTimestamp = timestamp;
+    }
+    _lastTimestamp = timestamp;
+}
+
+/* Frames observed */
+uint64_t FrameCadence::getFrames() const {
+    return _frames;
+}
+
+/* Sensor frame periods without a frame */
+uint64_t FrameCadence::getPeriodsLost() const {
+    return _periodsLost;
+}
+
+/* Frames the EGLStream replaced before the consumer acquired them */
+uint64_t FrameCadence::getFramesReplaced() const {
+    return _framesReplaced;
+}
+
+/* Captures Argus made internally because no output buffer was free */
+uint64_t FrameCadence::getInternalCaptures() const {
+    return _internalCaptures;
+}
+
+/* Frames acquired per second of sensor time, lost frames count against it */
+double FrameCadence::getSensorFps() const {
+    return _sensorFps;
+}
+
+/* Deviation of each frame's sensor timestamp delta from its frame duration in us, lost frames excluded */
+const LatencyHistogram *FrameCadence::getJitter() const {
+    return &_jitter;
+}
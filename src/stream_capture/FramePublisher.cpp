@@ -0,0 +1,306 @@
+/*
+ * FramePublisher.cpp
+ *
+ * Shares the frames the consumers save with other processes at no copy cost.
+ * Each consumer offers a ring slot right before submitting it; the publisher
+ * retains the slot as the camera's newest frame and its thread sends the
+ * slot's dmabuf fd with a SharedFrame over SCM_RIGHTS to each idle subscriber
+ * of the camera. The kernel duplicates the fd into the subscriber, the token
+ * tells the publisher when the buffer may be reused. A newer offer replaces
+ * an unsent newest frame, so subscribers only ever see the latest one.
+ */
+
+#include "FramePublisher.hpp"
+
+#include "SharedFrame.hpp"
+#include "DmabufRing.hpp"
+#include "Options.hpp"
+#include "Logger.hpp"
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <sstream>
+
+#define STDOUT_PRINT true
+#define SHARE_BACKLOG 4         // subscribers waiting to be accepted
+#define SHARE_POLL_MS 100       // bounds how long shutdown waits on an idle socket
+
+FramePublisher::FramePublisher(const Options& options, uint32_t numCameras) :
+    _options(options),
+    _numCameras(numCameras),
+    _logger(NULL),
+    _fd(-1),
+    _eventFd(-1),
+    _open(false),
+    _held(numCameras, 0),
+    _nextToken(1),
+    _subscriberCount(0),
+    _framesShared(0),
+    _framesSkipped(0)
+{
+    Held none = {NULL, 0, 0, 0, 0};
+    _newest.assign(numCameras, none);
+}
+
+FramePublisher::~FramePublisher() {
+    if (_logger)
+        delete _logger;
+}
+
+/* Hold the slot the consumer is about to submit as the camera's newest frame, false if it is not shared */
+bool FramePublisher::offer(uint32_t camera, DmabufRing& ring, uint32_t slot, uint64_t index, uint64_t timestamp) {
+    if (_subscriberCount == 0)
+        return false;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_open || camera >= _numCameras)
+            return false;
+        if (_newest[camera].ring)
+            drop(_newest[camera], camera);
+        if (_held[camera] >= (uint32_t) _options.shareSlots) {
+            _framesSkipped++;
+            return false;
+        }
+        ring.retain(slot);
+        _held[camera]++;
+        Held held = {&ring, slot, _nextToken++, index, timestamp};
+        _newest[camera] = held;
+    }
+    /* A failed wake only delays the send to the next poll */
+    uint64_t one = 1;
+    ssize_t woken = write(_eventFd, &one, sizeof(one));
+    (void) woken;
+    return true;
+}
+
+/* Frames sent to subscribers */
+uint64_t FramePublisher::getFramesShared() {
+    return _framesShared;
+}
+
+uint32_t FramePublisher::getSubscriberCount() {
+    return _subscriberCount;
+}
+
+bool FramePublisher::threadInitialize() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        _logger = new Logger("SHARE", _options.directory);
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Bind the socket, replacing one a previous run left behind */
+    if (!errorOccurred) {
+        struct stat info;
+        if (stat(_options.sharePath.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+            unlink(_options.sharePath.c_str());
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, _options.sharePath.c_str(), sizeof(address.sun_path) - 1);
+        _fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (_fd == -1 || bind(_fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(_fd, SHARE_BACKLOG) != 0) {
+            _logger->error("Failed to bind the share socket to " + _options.sharePath + "!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Create the event the consumers wake the thread with */
+    if (!errorOccurred) {
+        _eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (_eventFd == -1) {
+            _logger->error("Failed to create the share event!");
+            errorOccurred = true;
+        }
+    }
+
+    if (!errorOccurred) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _open = true;
+        _logger->log("Sharing frames on " + _options.sharePath, STDOUT_PRINT);
+    }
+    return !errorOccurred;
+}
+
+bool FramePublisher::threadExecute() {
+    std::vector<struct pollfd>& events = _events;
+    events.resize(2 + _subscribers.size());
+    events[0].fd = _fd;
+    events[0].events = POLLIN;
+    events[1].fd = _eventFd;
+    events[1].events = POLLIN;
+    for (size_t i = 0; i < _subscribers.size(); i++) {
+        events[2 + i].fd = _subscribers[i].fd;
+        events[2 + i].events = POLLIN;
+    }
+    if (poll(events.data(), events.size(), SHARE_POLL_MS) <= 0)
+        return true;
+
+    /* Take releases first, they free the subscribers and slots the new frames go to */
+    uint64_t count;
+    if ((events[1].revents & POLLIN) && read(_eventFd, &count, sizeof(count)) < 0)
+        count = 0;
+    for (size_t i = _subscribers.size(); i > 0; i--) {
+        short revents = events[1 + i].revents;
+        if ((revents & (POLLIN | POLLHUP | POLLERR)) && !receive(_subscribers[i - 1]))
+            disconnect(i - 1);
+    }
+    if (events[0].revents & POLLIN)
+        acceptSubscribers();
+    sendNewest();
+    return true;
+}
+
+bool FramePublisher::threadShutdown() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _open = false;
+        for (uint32_t i = 0; i < _numCameras; i++)
+            if (_newest[i].ring)
+                drop(_newest[i], i);
+    }
+    while (!_subscribers.empty())
+        disconnect(_subscribers.size() - 1);
+    if (_fd != -1) {
+        close(_fd);
+        unlink(_options.sharePath.c_str());
+    }
+    if (_eventFd != -1)
+        close(_eventFd);
+    if (_logger) {
+        std::stringstream ss;
+        ss << "Frames shared: " << _framesShared << ", skipped as every share slot was held: " << _framesSkipped;
+        _logger->log(ss.str());
+    }
+    return true;
+}
+
+/* Take every waiting subscriber */
+void FramePublisher::acceptSubscribers() {
+    int fd;
+    while ((fd = accept4(_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        Held none = {NULL, 0, 0, 0, 0};
+        Subscriber subscriber = {fd, std::vector<Held>(_numCameras, none)};
+        std::lock_guard<std::mutex> lock(_mutex);
+        _subscribers.push_back(subscriber);
+        _subscriberCount++;
+        _logger->log("Subscriber connected, " + std::to_string(_subscribers.size()) + " in total", STDOUT_PRINT);
+    }
+}
+
+/* Release every frame the subscriber is done with, false once it has gone */
+bool FramePublisher::receive(Subscriber& subscriber) {
+    SharedRelease release;
+    ssize_t length;
+    while ((length = recv(subscriber.fd, &release, sizeof(release), MSG_DONTWAIT)) > 0) {
+        if (length != sizeof(release) || release.magic != SHARED_RELEASE_MAGIC)
+            continue;
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (uint32_t i = 0; i < _numCameras; i++)
+            if (subscriber.reading[i].ring && subscriber.reading[i].token == release.token)
+                drop(subscriber.reading[i], i);
+    }
+    return length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/* Hand each camera's newest frame to every subscriber done with the previous one */
+void FramePublisher::sendNewest() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (uint32_t i = 0; i < _numCameras; i++) {
+        if (!_newest[i].ring)
+            continue;
+        std::vector<size_t>& idle = _idle;
+        idle.clear();
+        for (size_t j = 0; j < _subscribers.size(); j++)
+            if (!_subscribers[j].reading[i].ring)
+                idle.push_back(j);
+
+        /* Each subscriber holds the slot once, the last one, or the one at the limit, takes the newest's hold */
+        for (size_t k = 0; k < idle.size() && _newest[i].ring; k++) {
+            Held held = _newest[i];
+            if (k + 1 == idle.size() || _held[i] >= (uint32_t) _options.shareSlots) {
+                _newest[i].ring = NULL;
+            } else {
+                held.ring->retain(held.slot);
+                _held[i]++;
+            }
+            Subscriber& subscriber = _subscribers[idle[k]];
+            if (sendFrame(subscriber, i, held)) {
+                subscriber.reading[i] = held;
+                _framesShared++;
+            } else {
+                drop(held, i);
+            }
+        }
+    }
+}
+
+/* Send the frame with its dmabuf attached, false if the subscriber's socket is full or gone */
+bool FramePublisher::sendFrame(Subscriber& subscriber, uint32_t camera, const Held& held) {
+    SharedFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.magic = SHARED_FRAME_MAGIC;
+    frame.camera = camera;
+    frame.width = _options.captureResolution.width();
+    frame.height = _options.captureResolution.height();
+    frame.colorFormat = DmabufRing::getColorFormat(_options, camera);
+    frame.layout = DmabufRing::getLayout(_options);
+    frame.token = held.token;
+    frame.index = held.index;
+    frame.timestamp = held.timestamp;
+
+    int fd = held.ring->getFd(held.slot);
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {&frame, sizeof(frame)};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fd));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+    return sendmsg(subscriber.fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t) sizeof(frame);
+}
+
+/* Give up one hold on a slot, call with the mutex held */
+void FramePublisher::drop(Held& held, uint32_t camera) {
+    held.ring->release(held.slot);
+    held.ring = NULL;
+    _held[camera]--;
+}
+
+/* Close a subscriber and release every frame it was reading */
+void FramePublisher::disconnect(size_t index) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    Subscriber& subscriber = _subscribers[index];
+    for (uint32_t i = 0; i < _numCameras; i++)
+        if (subscriber.reading[i].ring)
+            drop(subscriber.reading[i], i);
+    close(subscriber.fd);
+    _subscribers.erase(_subscribers.begin() + index);
+    _subscriberCount--;
+    if (_logger)
+        _logger->log("Subscriber disconnected, " + std::to_string(_subscribers.size()) + " left", STDOUT_PRINT);
+}
@@ -0,0 +1,206 @@
+/*
+ * FrameSetCollector.cpp
+ *
+ * A thread that groups the frames saved by every consumer into frame sets by
+ * sensor timestamp, so each line of sets.csv names the image every camera took
+ * at the same moment. Consumers report a saved frame with add(), which only
+ * pushes onto that camera's fixed-size queue. The collector anchors a set on
+ * the oldest pending frame and takes each camera's frame within the tolerance
+ * window. A set missing a camera is either dropped or written with that entry
+ * empty, depending on the set policy.
+ */
+
+#include "FrameSetCollector.hpp"
+
+#include "ClusterLink.hpp"
+#include "Options.hpp"
+#include "Logger.hpp"
+#include <sstream>
+#include <thread>
+#include <chrono>
+
+#define STDOUT_PRINT true
+#define SET_RING_SIZE 16        // pending frames per camera before new ones are refused
+#define SET_WAIT_FRAMES 4       // frames another camera may get ahead before a missing one is given up on
+#define COLLECT_INTERVAL_MS 50  // how often the collector looks for complete sets
+
+FrameSetCollector::FrameSetCollector(const Options& options, uint32_t numCameras, ClusterLink *cluster) :
+    _options(options),
+    _numCameras(numCameras),
+    _tolerance((uint64_t) options.frameSetTolerance * 1000),
+    _cluster(cluster),
+    _logger(NULL),
+    _file(NULL),
+    _heads(numCameras),
+    _present(numCameras),
+    _members(numCameras),
+    _sets(0),
+    _setsWritten(0),
+    _setsIncomplete(0),
+    _failed(false)
+{
+    for (uint32_t i = 0; i < _numCameras; i++)
+        _queues.push_back(new SpscRing<SetEntry>(SET_RING_SIZE));
+}
+
+FrameSetCollector::~FrameSetCollector() {
+    shutdown();
+    for (uint32_t i = 0; i < _numCameras; i++)
+        delete _queues[i];
+    if (_file)
+        fclose(_file);
+    if (_logger)
+        delete _logger;
+}
+
+/* Report a saved frame, never blocks the consumer; a refused frame is left out of the sets */
+bool FrameSetCollector::add(uint32_t camera, uint64_t timestamp, uint64_t index) {
+    SetEntry entry = {timestamp, index};
+    return camera < _numCameras && _queues[camera]->tryPush(entry);
+}
+
+uint64_t FrameSetCollector::getSetsWritten() {
+    return _setsWritten;
+}
+
+uint64_t FrameSetCollector::getSetsIncomplete() {
+    return _setsIncomplete;
+}
+
+bool FrameSetCollector::threadInitialize() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        _logger = new Logger("SETS", _options.directory);
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Create the set index and write its header */
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << _options.directory << "/sets.csv";
+        _file = fopen(ss.str().c_str(), "w");
+        if (!_file) {
+            _logger->error("Failed to create the frame set index!");
+            errorOccurred = true;
+        } else {
+            fprintf(_file, "set,timestamp");
+            for (uint32_t i = 0; i < _numCameras; i++)
+                fprintf(_file, ",cam%u", i);
+            fprintf(_file, "\n");
+        }
+    }
+
+    return !errorOccurred;
+}
+
+bool FrameSetCollector::threadExecute() {
+    if (!_failed && !collect(false)) {
+        _logger->error("Failed to write the frame set index!");
+        _failed = true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(COLLECT_INTERVAL_MS));
+    return true;
+}
+
+bool FrameSetCollector::threadShutdown() {
+
+    /* Every consumer has stopped, whatever is left can only form incomplete sets */
+    if (!_failed && !collect(true))
+        _failed = true;
+    if (_file && fflush(_file) != 0)
+        _failed = true;
+
+    uint64_t refused = 0;
+    for (uint32_t i = 0; i < _numCameras; i++)
+        refused += _queues[i]->drops();
+
+    std::stringstream ss;
+    ss << "Frame sets written: " << _setsWritten;
+    _logger->log(ss.str(), STDOUT_PRINT);
+    ss.str("");
+    ss << "Incomplete frame sets " << (_options.setPolicy == SET_POLICY_DROP ? "dropped: " : "written: ") << _setsIncomplete;
+    _logger->log(ss.str(), _setsIncomplete > 0);
+    if (refused > 0) {
+        ss.str("");
+        ss << "Frames left out of sets (collector behind): " << refused;
+        _logger->log(ss.str(), STDOUT_PRINT);
+    }
+    return !_failed;
+}
+
+/* Emit every set that can be decided, flush decides the rest. Returns false if writing failed */
+bool FrameSetCollector::collect(bool flush) {
+    while (true) {
+
+        /* Anchor the next set on the oldest pending frame */
+        bool anyPresent = false;
+        bool lagging = flush;
+        uint64_t anchor = UINT64_MAX;
+        for (uint32_t i = 0; i < _numCameras; i++) {
+            _present[i] = _queues[i]->peek(_heads[i]);
+            if (_present[i]) {
+                anyPresent = true;
+                if (_heads[i].timestamp < anchor)
+                    anchor = _heads[i].timestamp;
+            }
+            if (_queues[i]->size() >= SET_WAIT_FRAMES)
+                lagging = true;
+        }
+        if (!anyPresent)
+            return true;
+
+        /* A camera with nothing pending may still deliver this set unless the others are well ahead */
+        uint32_t count = 0;
+        bool decided = true;
+        for (uint32_t i = 0; i < _numCameras; i++) {
+            _members[i] = _present[i] && _heads[i].timestamp <= anchor + _tolerance;
+            if (_members[i])
+                count++;
+            else if (!_present[i] && !lagging)
+                decided = false;
+        }
+        if (!decided)
+            return true;
+
+        /* Consume the members, their frames can't belong to a later set */
+        SetEntry entry;
+        for (uint32_t i = 0; i < _numCameras; i++)
+            if (_members[i])
+                _queues[i]->tryPop(entry);
+
+        bool complete = count == _numCameras;
+        if (!complete)
+            _setsIncomplete++;
+        if (complete || _options.setPolicy == SET_POLICY_PARTIAL) {
+            if (!writeSet(anchor, _heads, _members))
+                return false;
+        }
+        _sets++;
+    }
+}
+
+/* Append one line naming each member's image index, non-members are left empty */
+bool FrameSetCollector::writeSet(uint64_t timestamp, const std::vector<SetEntry>& heads, const std::vector<bool>& members) {
+    fprintf(_file, "%lu,%lu", (unsigned long) _sets, (unsigned long) timestamp);
+    for (uint32_t i = 0; i < _numCameras; i++) {
+        if (members[i])
+            fprintf(_file, ",%06lu", (unsigned long) heads[i].index);
+        else
+            fprintf(_file, ",");
+    }
+    if (fprintf(_file, "\n") < 0)
+        return false;
+    _setsWritten++;
+    if (_cluster)
+        _cluster->offerSet(_sets, timestamp);
+    return true;
+}
@@ -0,0 +1,881 @@
+/*
+ * FrameWriter.cpp
+ *
+ * A thread that writes one camera's encoded images to disk. The consumer checks
+ * out a buffer from the camera's BufferPool, encodes into it and submits it;
+ * the writer returns the buffer to the pool once it is on disk. Slow storage
+ * only ever costs dropped frames, never a stalled acquire loop. Queue occupancy
+ * and drop counts are kept for sizing. Images are written one file each, or
+ * appended to a ContainerFile when a container size is set. With telemetry
+ * enabled the writer appends each frame's completed TelemetryRecord. Given a
+ * VolumeSet, each image goes to the volume it selects and a failed write is
+ * retried on the next volume with room. With --aio each image file is written
+ * with O_DIRECT through an AioQueue, keeping several writes in flight and
+ * finishing them in batches as they complete. The CRC32C of every image
+ * written to a file of its own is appended to camN/checksums.csv in the root
+ * directory, container images carry theirs in the container index. Every
+ * --sync-interval ms a GroupCommit makes the images written since the last
+ * one durable together and moves camN/committed up. With --segment every
+ * path is under the current segment's directory. With --restart-rows the
+ * restart markers of every image are listed in camN/restarts.csv. With
+ * --fanout image files go into camN/NNNN sub-directories made ahead.
+ *
+ * File format: index,volume,size,crc32c
+ * restarts.csv: index,markers,offsets, the byte offsets of the RSTn markers from the start of the
+ * image separated by spaces
+ */
+
+#include "FrameWriter.hpp"
+
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "ThreadPlacement.hpp"
+#include "BufferPool.hpp"
+#include "ContainerFile.hpp"
+#include "VolumeSet.hpp"
+#include "AioQueue.hpp"
+#include "QuickLookServer.hpp"
+#include "Crc32c.hpp"
+#include "TraceLog.hpp"
+#include "SteadyClock.hpp"
+#include <sched.h>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+
+#define STDOUT_PRINT true
+#define POP_TIMEOUT_MS 100 // bounds how long shutdown waits on an idle queue
+#define REAP_TIMEOUT_NS 5000000ULL // bounds how long a new frame waits behind writes in flight
+#define FILE_MODE 0666
+#define MKDIR_MODE 0777
+#define RESTARTS_RESERVE 256U // markers per image listed without growing the list, 97 at one per MCU row
+
+/* Offsets of the RSTn markers in a JPEG image. The header segments are stepped over, their tables
+   may hold bytes that look like markers, the entropy coded data stuffs every 0xFF it codes */
+static void findRestarts(const unsigned char *data, size_t size, std::vector<uint32_t>& offsets) {
+    offsets.clear();
+    size_t position = 2;
+    bool scan = false;
+    while (!scan && position + 4 <= size && data[position] == 0xFF) {
+        scan = data[position + 1] == 0xDA;
+        position += 2 + ((data[position + 2] << 8) | data[position + 3]);
+    }
+    if (!scan)
+        return;
+    const unsigned char *end = data + size;
+    for (const unsigned char *byte = data + position; byte + 1 < end; byte++) {
+        byte = (const unsigned char *) memchr(byte, 0xFF, end - byte - 1);
+        if (!byte)
+            break;
+        if (byte[1] >= 0xD0 && byte[1] <= 0xD7)
+            offsets.push_back(byte - data);
+    }
+}
+
+FrameWriter::FrameWriter(uint32_t id, const Options& options, BufferPool& pool, TelemetryLog *telemetry,
+                         VolumeSet *volumes, QuickLookServer *quickLook) :
+    _id(id),
+    _options(options),
+    _logger(NULL),
+    _pool(pool),
+    _container(NULL),
+    _containerVolume(-1),
+    _telemetry(telemetry),
+    _volumes(volumes),
+    _quickLook(quickLook),
+    _checksums(NULL),
+    _restarts(NULL),
+    _restartMarkers(0),
+    _restartImages(0),
+    _restartsLogged(false),
+    _pathPrefix(0),
+    _pathVolume(-2),
+    _directLogged(false),
+    _aio(NULL),
+    _aioRefused(false),
+    _aioWrites(pool.getCount()),
+    _pending(pool.getCount()),
+    _framesWritten(0),
+    _bytesWritten(0),
+    _framesDropped(0),
+    _failed(false),
+    _segment(0),
+    _lateShards(0)
+{
+    for (uint32_t i = 0; i < _aioWrites.size(); i++)
+        _aioWrites[i].fd = -1;
+    _restartOffsets.reserve(RESTARTS_RESERVE);
+}
+
+FrameWriter::~FrameWriter() {
+    for (uint32_t i = 0; i < _directories.size(); i++)
+        if (_directories[i] != -1)
+            close(_directories[i]);
+    for (uint32_t i = 0; i < _retired.size(); i++)
+        close(_retired[i]);
+    if (_checksums)
+        fclose(_checksums);
+    if (_restarts)
+        fclose(_restarts);
+    if (_aio)
+        delete _aio;
+    if (_container)
+        delete _container;
+    if (_logger)
+        delete _logger;
+}
+
+bool FrameWriter::threadInitialize() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "WRITER " << std::to_string(_id);
+        _logger = new Logger(ss.str(), _options.directory);
+        TraceLog::instance().nameThread(ss.str());
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Pin the thread and set its scheduling class, a failure is logged but not fatal */
+    if (!errorOccurred) {
+        placeThread(_options.getWriterCpu(_id), SCHED_OTHER, 0, _logger);
+    }
+
+    /* Open the container, rotated every containerSize GB */
+    if (!errorOccurred && _options.containerSize > 0) {
+        _logger->log("Creating the image container...");
+        if (!openContainer()) {
+            _logger->error("Failed to create the image container!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Open the checksum index, line buffered so a power loss only costs the entries of the images in flight */
+    if (!errorOccurred && _options.containerSize == 0 && !openChecksums()) {
+        _logger->error("Failed to create checksums.csv!");
+        errorOccurred = true;
+    }
+
+    /* Make the first sub-directories of the camera directories, later ones are made ahead */
+    if (!errorOccurred && _options.containerSize == 0 && !makeFirstShards(0)) {
+        _logger->error("Failed to create the image sub-directories!");
+        errorOccurred = true;
+    }
+
+    /* Open the restart marker index, a lost tail can be found again from the images themselves */
+    if (!errorOccurred && _options.restartRows > 0 && !openRestarts()) {
+        _logger->error("Failed to create restarts.csv!");
+        errorOccurred = true;
+    }
+
+    /* Create the durable mark the group commits move up */
+    if (!errorOccurred && _options.syncInterval > 0) {
+        std::string filename = getRunDirectory(-1) + "/cam" + std::to_string(_id) + "/committed";
+        if (!_commit.open(filename, _options.syncInterval)) {
+            _logger->error("Failed to create the durable mark!");
+            errorOccurred = true;
+        } else {
+            _directories.assign((_volumes ? _volumes->getVolumeCount() : 0) + 1, -1);
+            _directoryShards.assign(_directories.size(), 0);
+            _logger->log("Committing the written images every " + std::to_string(_options.syncInterval) + " ms");
+        }
+    }
+
+    /* Create the async I/O context, one image file per write so containers stay synchronous */
+    if (!errorOccurred && _options.aioDepth > 0 && _options.containerSize == 0) {
+        uint32_t depth = std::min((uint32_t) _options.aioDepth, _pool.getCount());
+        _aio = new AioQueue();
+        if (!_aio || !_aio->open(depth)) {
+            _logger->log("Failed to create the async I/O context, writing synchronously", STDOUT_PRINT);
+            delete _aio;
+            _aio = NULL;
+        } else {
+            _logger->log("Keeping up to " + std::to_string(depth) + " writes in flight");
+        }
+    }
+
+    return !errorOccurred;
+}
+
+bool FrameWriter::threadExecute() {
+    EncodedFrame frame;
+    if (_aio)
+        executeAio(true);
+    else if (_pending.pop(frame, POP_TIMEOUT_MS))
+        processFrame(frame);
+    if (_commit.isOpen() && _commit.isDue(now()))
+        commitWrites();
+    return true;
+}
+
+bool FrameWriter::threadShutdown() {
+
+    /* Drain anything the consumer submitted before it stopped, then every write in flight */
+    EncodedFrame frame;
+    while (_aio && !_failed && _pending.size() > 0)
+        executeAio(false);
+    while (_aio && _aio->getInFlight() + _aio->getQueued() > 0)
+        executeAio(false);
+    while (!_failed && _pending.tryPop(frame))
+        processFrame(frame);
+
+    /* Commit the last images before the container is closed */
+    if (_commit.isOpen())
+        commitWrites();
+
+    if (_container && !_container->close()) {
+        _logger->error("Failed to close the image container!");
+        _failed = true;
+    }
+    if (_checksums && fclose(_checksums) != 0)
+        _logger->error("Failed to close checksums.csv!");
+    _checksums = NULL;
+    if (_restarts && fclose(_restarts) != 0)
+        _logger->error("Failed to close restarts.csv!");
+    _restarts = NULL;
+
+    std::stringstream ss;
+    ss << "Images written: " << _framesWritten;
+    _logger->log(ss.str());
+    ss.str("");
+    ss << "Images dropped (no free buffer): " << _framesDropped;
+    _logger->log(ss.str(), _framesDropped > 0);
+    ss.str("");
+    ss << "Write queue high-water mark: " << _pending.highWater() << "/" << _pool.getCount();
+    _logger->log(ss.str());
+    if (_options.fanout > 0) {
+        ss.str("");
+        ss << "Sub-directories made on the write path: " << _lateShards;
+        _logger->log(ss.str(), _lateShards > 0);
+    }
+    if (_restartImages > 0) {
+        ss.str("");
+        ss << "Restart markers per image: " << (double) _restartMarkers / _restartImages;
+        _logger->log(ss.str());
+    }
+    if (_counters.isStarted())
+        _logger->log(_counters.report(), STDOUT_PRINT);
+    if (_commit.isOpen()) {
+        const LatencyHistogram& latency = _commit.getLatency();
+        uint64_t commits = _commit.getCommits();
+        ss.str("");
+        ss << "Group commits: " << commits << ", files synced per commit: "
+           << (commits ? (double) _commit.getFilesSynced() / commits : 0.0) << ", commit latency (us): p50 "
+           << latency.getPercentile(50) << ", p99 " << latency.getPercentile(99) << ", max " << latency.getMax();
+        _logger->log(ss.str(), STDOUT_PRINT);
+        ss.str("");
+        if (_commit.getDurableIndex() == GROUP_COMMIT_NONE)
+            ss << "No image was committed";
+        else
+            ss << "Durable up to image " << _commit.getDurableIndex();
+        _logger->log(ss.str());
+    }
+    if (_pool.getGrowCount() > 0) {
+        ss.str("");
+        ss << "Encoder outgrew its output buffer " << _pool.getGrowCount() << " times";
+        _logger->log(ss.str(), STDOUT_PRINT);
+    }
+    if (_aio) {
+        const LatencyHistogram& latency = _aio->getLatency();
+        ss.str("");
+        ss << "Async writes: " << latency.getCount() << ", in flight high-water mark: " << _aio->getInFlightHighWater()
+           << "/" << _aio->getDepth() << ", writes per submit: " << _aio->getMeanBatch();
+        _logger->log(ss.str());
+        ss.str("");
+        ss << "Async write latency (us): p50 " << latency.getPercentile(50) << ", p95 " << latency.getPercentile(95)
+           << ", p99 " << latency.getPercentile(99) << ", max " << latency.getMax();
+        _logger->log(ss.str());
+    }
+    return true;
+}
+
+/* Check out a free buffer for the encoder, counts a drop if none is available */
+bool FrameWriter::getBuffer(EncodedFrame& frame) {
+    if (!_pool.acquire(frame.slot, frame.data, frame.size)) {
+        _framesDropped++;
+        return false;
+    }
+    return true;
+}
+
+/* Queue an encoded buffer for writing, the writer returns it to the free list */
+bool FrameWriter::submit(const EncodedFrame& frame) {
+    EncodedFrame queued = frame;
+    queued.submitted = now();
+    return _pending.push(queued);
+}
+
+/* Return a buffer to the pool, also used by the consumer to discard a failed encode */
+void FrameWriter::returnBuffer(const EncodedFrame& frame) {
+    _pool.release(frame.slot, frame.data, frame.size);
+}
+
+/* Append a frame's telemetry, used by earlier stages for frames that never reach the writer */
+void FrameWriter::record(const TelemetryRecord& telemetry) {
+    if (_telemetry)
+        _telemetry->append(telemetry);
+}
+
+/* True once a write has failed, the owning consumer should stop */
+bool FrameWriter::hasFailed() {
+    return _failed;
+}
+
+size_t FrameWriter::getQueueDepth() {
+    return _pending.size();
+}
+
+size_t FrameWriter::getQueueHighWater() {
+    return _pending.highWater();
+}
+
+uint32_t FrameWriter::getQueueCapacity() {
+    return _pool.getCount();
+}
+
+uint64_t FrameWriter::getFramesWritten() {
+    return _framesWritten;
+}
+
+uint64_t FrameWriter::getBytesWritten() {
+    return _bytesWritten;
+}
+
+uint64_t FrameWriter::getFramesDropped() {
+    return _framesDropped;
+}
+
+/* Writes handed to the kernel and not yet complete, 0 without --aio */
+uint32_t FrameWriter::getWritesInFlight() {
+    return _aio ? _aio->getInFlight() : 0;
+}
+
+/* Latency from the writer taking an image to its write completing, async or not */
+const LatencyHistogram *FrameWriter::getWriteLatency() {
+    return &_writeLatency;
+}
+
+/* Write one image, record its telemetry and return its buffer to the pool */
+void FrameWriter::processFrame(EncodedFrame& frame) {
+    TraceScope scope("write", frame.index);
+    uint64_t start = now();
+    finishFrame(frame, start, enterSegment(frame) && writeFrame(frame));
+}
+
+/* Account a written or failed image, record its telemetry and return its buffer to the pool */
+void FrameWriter::finishFrame(EncodedFrame& frame, uint64_t start, bool success) {
+    if (_counters.isStarted())
+        _counters.count();
+    else
+        _counters.start(); // the first image sets up the lazily created state
+    _writeLatency.record((now() - start) / 1000);
+    if (success) {
+        _framesWritten++;
+        _bytesWritten += frame.size;
+    } else {
+        _failed = true;
+    }
+    if (_telemetry) {
+        frame.telemetry.queueUs += (start - frame.submitted) / 1000;
+        frame.telemetry.writeUs = (now() - start) / 1000;
+        frame.telemetry.size = frame.size;
+        if (!success)
+            frame.telemetry.flags |= TELEMETRY_FAILED;
+        _telemetry->append(frame.telemetry);
+    }
+    returnBuffer(frame);
+}
+
+/* Make the images written since the last commit durable together, a failed sync is logged and
+   holds the durable mark below the images it covered */
+void FrameWriter::commitWrites() {
+    uint64_t start = now();
+    int error = 0;
+    errno = 0;
+    if (_container && !_container->sync())
+        error = errno ? errno : EIO;
+    if (_checksums && (fflush(_checksums) != 0 || fdatasync(fileno(_checksums)) != 0) && error == 0)
+        error = errno;
+    bool success = _commit.commit(start, getLowestInFlight(), error);
+    for (uint32_t i = 0; i < _retired.size(); i++)
+        close(_retired[i]);
+    _retired.clear();
+    TraceLog::instance().span("commit", start, now());
+    if (!success)
+        _logger->log("Group commit failed, images since image " + std::to_string(_commit.getDurableIndex()) +
+                     " may not survive a power loss: " + std::string(strerror(_commit.getError())), STDOUT_PRINT);
+}
+
+/* Lowest index of an async write still in flight, GROUP_COMMIT_NONE when none is */
+uint64_t FrameWriter::getLowestInFlight() {
+    uint64_t lowest = GROUP_COMMIT_NONE;
+    for (uint32_t i = 0; _aio && i < _aioWrites.size(); i++)
+        if (_aioWrites[i].fd != -1 && _aioWrites[i].frame.index < lowest)
+            lowest = _aioWrites[i].frame.index;
+    return lowest;
+}
+
+/* The camera's directory on a volume, -1 for the root directory, opened once for the commits */
+int FrameWriter::getDirectory(int volume, uint64_t index) {
+    int& fd = _directories[volume + 1];
+    int64_t shard = _options.fanout > 0 ? index / _options.fanout : 0;
+    if (fd != -1 && shard != _directoryShards[volume + 1]) {
+        _retired.push_back(fd); // the next commit may still sync it
+        fd = -1;
+    }
+    if (fd == -1) {
+        std::string directory = getRunDirectory(volume) + "/cam" + std::to_string(_id);
+        if (_options.fanout > 0) {
+            char name[32];
+            snprintf(name, sizeof(name), "/%04lu", (uint64_t) shard);
+            directory += name;
+        }
+        fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        _directoryShards[volume + 1] = shard;
+    }
+    return fd;
+}
+
+/* Queue every frame there is room for, submit them together and finish the writes that
+   completed. Blocks for a new frame only while nothing is in flight */
+void FrameWriter::executeAio(bool wait) {
+    EncodedFrame frame;
+    while (_aio->getFree() > 0) {
+        bool idle = _aio->getInFlight() + _aio->getQueued() == 0;
+        if (!(idle && wait ? _pending.pop(frame, POP_TIMEOUT_MS) : _pending.tryPop(frame)))
+            break;
+        uint64_t start = now();
+        if (!enterSegment(frame)) {
+            finishFrame(frame, start, false);
+            continue;
+        }
+        bool queued = queueWrite(frame, start);
+        TraceLog::instance().span("queue write", start, now(), frame.index);
+        if (!queued) {
+            TraceScope scope("write", frame.index);
+            finishFrame(frame, start, writeFrame(frame));
+        }
+    }
+
+    int submitted = _aio->submit();
+    if (submitted < 0)
+        _logger->log("The kernel refused an async write: " + std::string(strerror(-submitted)), STDOUT_PRINT);
+
+    /* Wait for a completion when full or idle, otherwise only take what has finished */
+    std::vector<AioCompletion> completions;
+    bool block = _aio->getFree() == 0 || _pending.size() == 0;
+    _aio->reap(completions, block ? 1 : 0, block ? REAP_TIMEOUT_NS : 0);
+    for (uint32_t i = 0; i < completions.size(); i++)
+        completeWrite(_aioWrites[completions[i].cookie], completions[i].result);
+    if (_commit.isOpen() && _commit.isDue(now()))
+        commitWrites();
+}
+
+/* Open the image file with O_DIRECT and queue its padded write straight from the pool buffer,
+   false leaves the frame to the synchronous path */
+bool FrameWriter::queueWrite(const EncodedFrame& frame, uint64_t start) {
+    if (_aioRefused || !_pool.owns(frame.slot, frame.data))
+        return false; // O_DIRECT unsupported, or a libjpeg allocation without padding room
+
+    int volume = _volumes ? _volumes->select(_id) : -1;
+    if (_volumes && volume < 0)
+        return false;
+    enterShard(volume, frame.index);
+    const char *filename = formatPath(volume, frame.index);
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, FILE_MODE);
+    if (fd == -1) {
+        if (errno == EINVAL) {
+            _logger->log("O_DIRECT refused, writing synchronously", STDOUT_PRINT);
+            _aioRefused = true;
+        }
+        return false;
+    }
+    uint64_t length = DirectFile::align(frame.size);
+    if ((fallocate(fd, 0, 0, length) != 0 && errno != EOPNOTSUPP) || !_aio->queue(fd, frame.data, length, 0, frame.slot)) {
+        close(fd);
+        remove(filename);
+        return false;
+    }
+
+    AioWrite& write = _aioWrites[frame.slot];
+    write.frame = frame;
+    write.fd = fd;
+    write.volume = volume;
+    write.start = start;
+    return true;
+}
+
+/* Trim and close a finished image file, a failed write is retried synchronously on the next volume */
+void FrameWriter::completeWrite(AioWrite& write, int64_t result) {
+    EncodedFrame& frame = write.frame;
+    uint64_t start = now();
+    bool success = result == (int64_t) DirectFile::align(frame.size) && ftruncate(write.fd, frame.size) == 0;
+    if (success && _commit.isOpen()) {
+        _commit.addFile(write.fd, frame.index); // synced and closed by the next commit
+        int directory = getDirectory(write.volume, frame.index);
+        if (directory != -1)
+            _commit.addDirectory(directory);
+    } else {
+        success = close(write.fd) == 0 && success;
+    }
+    write.fd = -1;
+    TraceLog::instance().span("close", start, now(), frame.index);
+    if (_volumes)
+        _volumes->record(_id, frame.index, write.volume, frame.size, success);
+    if (success) {
+        recordChecksum(frame, std::max(write.volume, 0)); // -1 without --volumes
+        recordRestarts(frame);
+        publishImage(frame, write.volume);
+        prepareShard(write.volume, frame.index);
+    }
+    if (!success) {
+        remove(formatPath(write.volume, frame.index));
+        std::stringstream ss;
+        ss << "Async write of image " << frame.index << " failed, retrying synchronously";
+        _logger->log(ss.str(), STDOUT_PRINT);
+        success = writeFrame(frame);
+    }
+    finishFrame(frame, write.start, success);
+}
+
+/* Write one encoded image, failing over to the next volume until one takes it or every
+   volume is full, return bool indicating successful file writing */
+bool FrameWriter::writeFrame(const EncodedFrame& frame) {
+    if (!_volumes && _container) {
+        bool success = _container->append(frame.data, frame.size, frame.index, frame.timestamp);
+        if (success && _commit.isOpen())
+            _commit.written(frame.index); // the commit syncs the container
+        if (success) {
+            recordRestarts(frame);
+            publishImage(frame, -1);
+        }
+        return success;
+    }
+    if (!_volumes)
+        return writeFile(frame, -1);
+
+    for (uint32_t attempt = 0; attempt < _volumes->getVolumeCount(); attempt++) {
+        bool success;
+        int volume;
+        if (_options.containerSize > 0) {
+            /* A container stays on its camera's volume and is reopened when the camera fails over */
+            volume = _volumes->assign(_id);
+            if (volume != _containerVolume && !openContainer())
+                return false;
+            success = _container->append(frame.data, frame.size, frame.index, frame.timestamp);
+            if (success && _commit.isOpen())
+                _commit.written(frame.index);
+            if (success) {
+                recordRestarts(frame);
+                publishImage(frame, volume);
+            }
+        } else {
+            volume = _volumes->select(_id);
+            if (volume < 0)
+                return false;
+            success = writeFile(frame, volume);
+        }
+        _volumes->record(_id, frame.index, volume, frame.size, success);
+        if (success)
+            return true;
+
+        std::stringstream ss;
+        ss << "Failed to write image " << frame.index << " to volume " << volume << ", trying the next one";
+        _logger->log(ss.str(), STDOUT_PRINT);
+    }
+    return false;
+}
+
+/* Close the current container and open one on the camera's volume, return bool indicating success */
+bool FrameWriter::openContainer() {
+    if (_container) {
+        if (!_container->close())
+            _logger->log("Failed to close the last image container", STDOUT_PRINT);
+        delete _container;
+        _container = NULL;
+    }
+
+    if (_volumes) {
+        _containerVolume = _volumes->assign(_id);
+        if (_containerVolume < 0)
+            return false;
+    }
+    std::string directory = getRunDirectory(_volumes ? _containerVolume : -1) + "/cam" + std::to_string(_id);
+    _container = new ContainerFile(directory, (uint64_t) _options.containerSize << 30, _options.directIo);
+    return _container != NULL;
+}
+
+/* Open the checksum index, line buffered so a power loss only costs the entries of the images in
+   flight, return bool indicating success */
+bool FrameWriter::openChecksums() {
+    std::string filename = getRunDirectory(-1) + "/cam" + std::to_string(_id) + "/checksums.csv";
+    _checksums = fopen(filename.c_str(), "w");
+    return _checksums && setvbuf(_checksums, NULL, _IOLBF, 0) == 0
+        && fprintf(_checksums, "index,volume,size,crc32c\n") >= 0;
+}
+
+/* Open the restart marker index, return bool indicating success */
+bool FrameWriter::openRestarts() {
+    std::string filename = getRunDirectory(-1) + "/cam" + std::to_string(_id) + "/restarts.csv";
+    _restarts = fopen(filename.c_str(), "w");
+    return _restarts && fprintf(_restarts, "index,markers,offsets\n") >= 0;
+}
+
+/* Move on if the image belongs to a later segment, a camera running behind the boundary stays
+   where it is. Return bool indicating the image can be written */
+bool FrameWriter::enterSegment(const EncodedFrame& frame) {
+    if (!_volumes || !_volumes->isSegmented())
+        return true;
+    uint32_t segment = _volumes->selectSegment(frame.timestamp, frame.size);
+    if (segment <= _segment)
+        return true;
+    return startSegment(segment) && (_container || makeFirstShards(frame.index));
+}
+
+/* Finish the last segment's writes, commit and close its files and open the same ones in the new
+   segment, whose directories were created ahead. Return bool indicating success */
+bool FrameWriter::startSegment(uint32_t segment) {
+    uint64_t start = now();
+    drainAio();
+    if (_commit.isOpen())
+        commitWrites();
+
+    /* The last segment is complete on disk before the writer moves on, it may be offloaded then */
+    bool container = _container != NULL;
+    if (_container) {
+        if (!_container->close())
+            _logger->log("Failed to close the image container of the last segment", STDOUT_PRINT);
+        delete _container;
+        _container = NULL;
+    }
+    bool checksums = _checksums != NULL;
+    if (_checksums && fclose(_checksums) != 0)
+        _logger->log("Failed to close checksums.csv of the last segment", STDOUT_PRINT);
+    _checksums = NULL;
+    bool restarts = _restarts != NULL;
+    if (_restarts && fclose(_restarts) != 0)
+        _logger->log("Failed to close restarts.csv of the last segment", STDOUT_PRINT);
+    _restarts = NULL;
+    if (!_volumes->enterSegment(_id, segment)) {
+        _logger->error("Failed to create segment " + std::to_string(segment) + "!");
+        return false;
+    }
+
+    _segment = segment;
+    _pathVolume = -2;
+    for (uint32_t i = 0; i < _directories.size(); i++) {
+        if (_directories[i] != -1)
+            close(_directories[i]);
+        _directories[i] = -1;
+    }
+    bool success = true;
+    if (container && !openContainer()) {
+        _logger->error("Failed to create the image container of segment " + std::to_string(segment) + "!");
+        success = false;
+    }
+    if (checksums) {
+        if (!openChecksums()) {
+            _logger->error("Failed to create checksums.csv of segment " + std::to_string(segment) + "!");
+            success = false;
+        }
+    }
+    if (restarts && !openRestarts()) {
+        _logger->error("Failed to create restarts.csv of segment " + std::to_string(segment) + "!");
+        success = false;
+    }
+    if (_commit.isOpen() && !_commit.reopen(getRunDirectory(-1) + "/cam" + std::to_string(_id) + "/committed")) {
+        _logger->error("Failed to create the durable mark of segment " + std::to_string(segment) + "!");
+        success = false;
+    }
+    TraceLog::instance().span("segment", start, now());
+    _logger->log("Writing segment " + std::to_string(segment));
+    return success;
+}
+
+/* Complete every write in flight, so none lands after its segment's files were closed */
+void FrameWriter::drainAio() {
+    std::vector<AioCompletion> completions;
+    while (_aio && _aio->getInFlight() + _aio->getQueued() > 0) {
+        int submitted = _aio->submit();
+        if (submitted < 0)
+            _logger->log("The kernel refused an async write: " + std::string(strerror(-submitted)), STDOUT_PRINT);
+        completions.clear();
+        _aio->reap(completions, 1, REAP_TIMEOUT_NS);
+        for (uint32_t i = 0; i < completions.size(); i++)
+            completeWrite(_aioWrites[completions[i].cookie], completions[i].result);
+    }
+}
+
+/* The run directory on volume, -1 for the root directory, or with --segment the current segment's
+   directory in it */
+std::string FrameWriter::getRunDirectory(int volume) {
+    if (_volumes && _volumes->isSegmented())
+        return _volumes->getSegmentDirectory(std::max(volume, 0), _segment);
+    return volume >= 0 ? _volumes->getDirectory(volume) : std::string(_options.directory);
+}
+
+/* Write one encoded image to its own file under volume's run directory, -1 for the root directory,
+   and index its checksum, return bool indicating success */
+bool FrameWriter::writeFile(const EncodedFrame& frame, int volume) {
+    enterShard(volume, frame.index);
+    const char *filename = formatPath(volume, frame.index);
+
+    /* With --direct-io preallocate the padded length, write the image around the page cache and
+       trim the padding, otherwise a plain write through the reused file */
+    bool success = _file.open(filename, _options.directIo);
+    if (success && _options.directIo)
+        success = _file.preallocate(0, DirectFile::align(frame.size));
+    success = success && _file.write(frame.data, frame.size, 0);
+    if (success && _options.directIo && !_directLogged) {
+        _logger->log(_file.isDirect() ? "Writing images with O_DIRECT"
+                                      : "O_DIRECT refused, writing images through a bounded page cache", STDOUT_PRINT);
+        _directLogged = true;
+    }
+    uint64_t start = now();
+    if (success && _commit.isOpen()) {
+        /* Keep the file open for the next commit to sync */
+        int fd = _file.release(frame.size);
+        success = fd != -1;
+        if (success) {
+            _commit.addFile(fd, frame.index);
+            int directory = getDirectory(volume, frame.index);
+            if (directory != -1)
+                _commit.addDirectory(directory);
+        }
+    } else {
+        success = _file.close(frame.size) && success;
+    }
+    TraceLog::instance().span("close", start, now(), frame.index);
+    if (success) {
+        recordChecksum(frame, std::max(volume, 0));
+        recordRestarts(frame);
+        publishImage(frame, volume);
+        prepareShard(volume, frame.index);
+    } else {
+        remove(filename); // don't leave a truncated image behind on a full volume
+    }
+    return success;
+}
+
+/* The image's path under volume's run directory, -1 for the root directory. The prefix up to the
+   index is only formatted again when the volume changes, so no path is built on the heap */
+const char *FrameWriter::formatPath(int volume, uint64_t index) {
+    if (volume != _pathVolume) {
+        std::string directory = getRunDirectory(volume);
+        int length = snprintf(_path, FILENAME_MAX, "%s/cam%u/", directory.c_str(), _id);
+        _pathPrefix = length > 0 ? std::min((size_t) length, (size_t) FILENAME_MAX - 1) : 0;
+        _pathVolume = volume;
+    }
+    if (_options.fanout > 0)
+        snprintf(_path + _pathPrefix, FILENAME_MAX - _pathPrefix, "%04lu/image%06lu.jpg", index / _options.fanout, index);
+    else
+        snprintf(_path + _pathPrefix, FILENAME_MAX - _pathPrefix, "image%06lu.jpg", index);
+    return _path;
+}
+
+/* With --fanout make the camera's sub-directories on volume up to shard that do not exist yet, and
+   with --sync-interval sync the camera directory they are entries of. Return bool indicating success */
+bool FrameWriter::makeShards(int volume, uint64_t shard) {
+    int64_t& made = _shards[volume + 1];
+    if ((int64_t) shard <= made)
+        return true;
+    std::string directory = getRunDirectory(volume) + "/cam" + std::to_string(_id);
+    char name[32];
+    bool success = true;
+    for (int64_t i = made + 1; success && i <= (int64_t) shard; i++) {
+        snprintf(name, sizeof(name), "/%04lu", (uint64_t) i);
+        success = mkdir((directory + name).c_str(), MKDIR_MODE) == 0 || errno == EEXIST;
+        if (success)
+            made = i;
+    }
+    if (success && _commit.isOpen()) {
+        int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        success = fd != -1 && fsync(fd) == 0;
+        if (fd != -1)
+            close(fd);
+    }
+    if (!success)
+        _logger->log("Failed to create the sub-directories of " + directory + ": " + std::string(strerror(errno)),
+                     STDOUT_PRINT);
+    return success;
+}
+
+/* Make sure the image's sub-directory exists before it is opened. It was normally made ahead, one
+   made here counts as late */
+void FrameWriter::enterShard(int volume, uint64_t index) {
+    if (_options.fanout == 0 || (int64_t) (index / _options.fanout) <= _shards[volume + 1])
+        return;
+    _lateShards++;
+    makeShards(volume, index / _options.fanout);
+}
+
+/* Once an image is written, make the sub-directory after its own ahead, while the writes of the
+   current one still have most of it to go */
+void FrameWriter::prepareShard(int volume, uint64_t index) {
+    if (_options.fanout > 0)
+        makeShards(volume, index / _options.fanout + 1);
+}
+
+/* With --fanout make the current sub-directory and the next on every volume the camera may write
+   to, at startup and on entering a segment. Return bool indicating success */
+bool FrameWriter::makeFirstShards(uint64_t index) {
+    if (_options.fanout == 0)
+        return true;
+    _shards.assign((_volumes ? _volumes->getVolumeCount() : 0) + 1, (int64_t) (index / _options.fanout) - 1);
+    bool success = true;
+    for (int volume = _volumes ? 0 : -1; volume < (int) (_volumes ? _volumes->getVolumeCount() : 0); volume++)
+        success = makeShards(volume, index / _options.fanout + 1) && success;
+    return success;
+}
+
+/* Append a written image's CRC32C to the checksum index --verify checks the run against */
+void FrameWriter::recordChecksum(const EncodedFrame& frame, int volume) {
+    if (_checksums)
+        fprintf(_checksums, "%lu,%d,%lu,%08x\n", frame.index, volume, frame.size, crc32c(frame.data, frame.size));
+}
+
+/* List the restart markers of a written image for decoders splitting it across cores. The first
+   image without any is logged, the encoder may not honour the restart interval */
+void FrameWriter::recordRestarts(const EncodedFrame& frame) {
+    if (!_restarts)
+        return;
+    findRestarts(frame.data, frame.size, _restartOffsets);
+    if (_restartOffsets.empty() && !_restartsLogged) {
+        _restartsLogged = true;
+        _logger->log("Image " + std::to_string(frame.index) + " has no restart markers", STDOUT_PRINT);
+    }
+    _restartMarkers += _restartOffsets.size();
+    _restartImages++;
+    fprintf(_restarts, "%lu,%zu,", frame.index, _restartOffsets.size());
+    for (size_t i = 0; i < _restartOffsets.size(); i++)
+        fprintf(_restarts, i ? " %u" : "%u", _restartOffsets[i]);
+    fputc('\n', _restarts);
+}
+
+/* Tell the quick-look server where a written image lives, in the container or its own file */
+void FrameWriter::publishImage(const EncodedFrame& frame, int volume) {
+    if (!_quickLook)
+        return;
+    if (_container) {
+        char path[FILENAME_MAX];
+        uint64_t offset;
+        if (_container->getLastImage(path, sizeof(path), offset))
+            _quickLook->publish(_id, frame.index, frame.timestamp, path, offset, frame.size);
+    } else {
+        _quickLook->publish(_id, frame.index, frame.timestamp, formatPath(volume, frame.index), 0, frame.size);
+    }
+}
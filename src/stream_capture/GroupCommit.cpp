@@ -0,0 +1,163 @@
+/*
+ * GroupCommit.cpp
+ *
+ * Makes one writer's images crash safe in batches instead of one fsync per
+ * image. Every --sync-interval ms commit() fdatasyncs the image files written
+ * since the last commit together, fsyncs their directories, closes the files
+ * and records the highest image index known durable in camN/committed. A
+ * failed batch holds the mark below its lowest image until the next segment.
+ */
+
+#include "GroupCommit.hpp"
+
+#include "SteadyClock.hpp"
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define FILE_MODE 0666
+#define MARK_LENGTH 21 // 20 digits and a newline, the file is rewritten in place
+
+GroupCommit::GroupCommit() :
+    _intervalNs(0),
+    _markFd(-1),
+    _pendingSince(0),
+    _highest(GROUP_COMMIT_NONE),
+    _lowest(GROUP_COMMIT_NONE),
+    _ceiling(GROUP_COMMIT_NONE),
+    _durable(GROUP_COMMIT_NONE),
+    _error(0),
+    _commits(0),
+    _filesSynced(0)
+{}
+
+GroupCommit::~GroupCommit() {
+    for (uint32_t i = 0; i < _files.size(); i++)
+        close(_files[i]);
+    if (_markFd != -1)
+        close(_markFd);
+}
+
+/* Create the durable mark, return bool indicating success */
+bool GroupCommit::open(const std::string& markPath, uint32_t intervalMs) {
+    _intervalNs = (uint64_t) intervalMs * 1000000;
+    _markFd = ::open(markPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, FILE_MODE);
+    _files.reserve(64); // a second of images at 30 fps without growing
+    return _markFd != -1;
+}
+
+/* Start a new durable mark once everything written was committed, e.g. for a new segment, return
+   bool indicating success. The counters carry on */
+bool GroupCommit::reopen(const std::string& markPath) {
+    if (_markFd != -1)
+        close(_markFd);
+    _markFd = ::open(markPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, FILE_MODE);
+    _pendingSince = 0;
+    _highest = GROUP_COMMIT_NONE;
+    _lowest = GROUP_COMMIT_NONE;
+    _ceiling = GROUP_COMMIT_NONE;
+    _durable = GROUP_COMMIT_NONE;
+    return _markFd != -1;
+}
+
+bool GroupCommit::isOpen() const {
+    return _markFd != -1;
+}
+
+/* Take over a finished image file, it is synced and closed by the next commit */
+void GroupCommit::addFile(int fd, uint64_t index) {
+    _files.push_back(fd);
+    written(index);
+}
+
+/* A directory got a new entry, it is synced by the next commit */
+void GroupCommit::addDirectory(int fd) {
+    if (std::find(_directories.begin(), _directories.end(), fd) == _directories.end())
+        _directories.push_back(fd);
+}
+
+/* An image the writer syncs itself with the commit, a container image */
+void GroupCommit::written(uint64_t index) {
+    if (_pendingSince == 0)
+        _pendingSince = now();
+    if (_highest == GROUP_COMMIT_NONE || index > _highest)
+        _highest = index;
+    if (index < _lowest)
+        _lowest = index;
+}
+
+/* True once the oldest write not yet committed is an interval old */
+bool GroupCommit::isDue(uint64_t now) const {
+    return _pendingSince != 0 && now - _pendingSince >= _intervalNs;
+}
+
+/* Sync the files and directories written since the last commit, then move the durable mark up to
+   the highest index written, but below limit, the lowest index still being written. syncError is the
+   errno of a sync the writer made of this batch itself, 0 if it succeeded. Return bool indicating
+   success, a failed commit leaves the mark where it was and below its batch from then on */
+bool GroupCommit::commit(uint64_t now, uint64_t limit, int syncError) {
+    int error = syncError;
+    for (uint32_t i = 0; i < _files.size(); i++) {
+        if (fdatasync(_files[i]) != 0 && error == 0)
+            error = errno;
+        if (close(_files[i]) != 0 && error == 0)
+            error = errno;
+    }
+    for (uint32_t i = 0; i < _directories.size(); i++)
+        if (fsync(_directories[i]) != 0 && error == 0)
+            error = errno;
+    _filesSynced += _files.size();
+    _files.clear();
+    _directories.clear();
+    _pendingSince = 0;
+    if (error != 0 && _lowest < _ceiling)
+        _ceiling = _lowest;
+    _lowest = GROUP_COMMIT_NONE;
+
+    uint64_t durable = _highest;
+    if (durable != GROUP_COMMIT_NONE && limit != GROUP_COMMIT_NONE && durable >= limit)
+        durable = limit > 0 ? limit - 1 : GROUP_COMMIT_NONE;
+    if (durable != GROUP_COMMIT_NONE && _ceiling != GROUP_COMMIT_NONE && durable >= _ceiling)
+        durable = _ceiling > 0 ? _ceiling - 1 : GROUP_COMMIT_NONE;
+    if (error == 0 && durable != GROUP_COMMIT_NONE && (_durable == GROUP_COMMIT_NONE || durable > _durable)) {
+        char mark[MARK_LENGTH + 1];
+        snprintf(mark, sizeof(mark), "%020lu\n", durable);
+        ssize_t written = pwrite(_markFd, mark, MARK_LENGTH, 0);
+        if (written != MARK_LENGTH)
+            error = written < 0 ? errno : EIO;
+        else if (fdatasync(_markFd) != 0)
+            error = errno;
+        else
+            _durable = durable;
+    }
+    _error = error;
+    bool success = error == 0;
+
+    _commits++;
+    _latency.record((::now() - now) / 1000);
+    return success;
+}
+
+uint64_t GroupCommit::getCommits() const {
+    return _commits;
+}
+
+uint64_t GroupCommit::getFilesSynced() const {
+    return _filesSynced;
+}
+
+/* Highest image index on disk together with every image before it, GROUP_COMMIT_NONE before the first commit */
+uint64_t GroupCommit::getDurableIndex() const {
+    return _durable;
+}
+
+/* errno of the last commit's first failure, 0 if it succeeded */
+int GroupCommit::getError() const {
+    return _error;
+}
+
+const LatencyHistogram& GroupCommit::getLatency() const {
+    return _latency;
+}
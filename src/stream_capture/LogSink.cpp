@@ -0,0 +1,132 @@
+/*
+ * LogSink.cpp
+ *
+ * The single sink behind every Logger. Formatted records are pushed into a
+ * fixed lock-free MpmcRing by any thread and a background thread appends them to
+ * their log files in batches, keeping one handle open per file. A full ring
+ * drops the record rather than blocking the caller. flush() writes everything
+ * queued so far synchronously and is used for errors and at exit.
+ */
+
+#include "LogSink.hpp"
+
+#include "NvLogging.h"
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <sstream>
+
+#define FLUSH_INTERVAL_MS 200 // longest a record waits in the ring
+
+/* The process-wide sink, its thread starts with the first opened file */
+LogSink& LogSink::instance() {
+    static LogSink sink;
+    return sink;
+}
+
+LogSink::LogSink() :
+    _ring(LOG_RING_SIZE),
+    _libraryFile(-1)
+{}
+
+/* Stop the thread before members go away, it drains the ring on the way out */
+LogSink::~LogSink() {
+    log_handler = NULL;
+    shutdown();
+    flush();
+    for (uint32_t i = 0; i < _files.size(); i++)
+        if (_files[i])
+            fclose(_files[i]);
+}
+
+/* Return the id for a log file path, the file itself is opened on first write */
+int LogSink::open(const std::string& path) {
+    std::call_once(_started, [this] { initialize(); });
+    std::lock_guard<std::mutex> lock(_filesMutex);
+    for (uint32_t i = 0; i < _paths.size(); i++)
+        if (_paths[i] == path)
+            return i;
+    _paths.push_back(path);
+    _files.push_back(NULL);
+    return _paths.size() - 1;
+}
+
+/* Queue one record without blocking, returns false and counts a drop if the ring is full */
+bool LogSink::write(int file, const std::string& s) {
+    bool queued = _ring.tryPushWith([&](Record& record) {
+        record.file = file;
+        record.length = s.size() < LOG_RECORD_SIZE - 1 ? s.size() : LOG_RECORD_SIZE - 1;
+        memcpy(record.text, s.data(), record.length);
+        record.text[record.length++] = '\n';
+    });
+
+    /* Wake the thread early once half the ring is queued so bursts do not fill it */
+    if (queued && _ring.size() >= LOG_RING_SIZE / 2)
+        _wake.notify_one();
+    return queued;
+}
+
+/* Write everything queued so far and flush the file handles */
+void LogSink::flush() {
+    std::lock_guard<std::mutex> lock(_drainMutex);
+    drain();
+}
+
+/* Queue the multimedia API's messages for the log file instead of writing them to std::cerr */
+void LogSink::captureLibrary(const std::string& path) {
+    _libraryFile = open(path);
+    log_handler = writeLibrary;
+}
+
+uint64_t LogSink::getDropped() {
+    return _ring.drops();
+}
+
+bool LogSink::threadInitialize() {
+    return true;
+}
+
+bool LogSink::threadExecute() {
+    {
+        std::unique_lock<std::mutex> lock(_wakeMutex);
+        _wake.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+    }
+    flush();
+    return true;
+}
+
+bool LogSink::threadShutdown() {
+    flush();
+    return true;
+}
+
+/* The NvLogging handler, formatted like a Logger record and never blocking the encoder thread it runs on */
+void LogSink::writeLibrary(int level, const std::string& message) {
+    std::stringstream ss;
+    ss << "MMAPI [" << time(0) << "]: " << message;
+    instance().write(instance()._libraryFile, ss.str());
+}
+
+/* Pop and write every committed record, call with _drainMutex held */
+void LogSink::drain() {
+    std::vector<FILE*> touched;
+    auto writeRecord = [&](const Record& record) {
+        FILE *file = NULL;
+        {
+            std::lock_guard<std::mutex> lock(_filesMutex);
+            if (record.file >= 0 && (uint32_t) record.file < _files.size()) {
+                if (!_files[record.file])
+                    _files[record.file] = fopen(_paths[record.file].c_str(), "a");
+                file = _files[record.file];
+            }
+        }
+        if (file) {
+            fwrite(record.text, 1, record.length, file);
+            if (touched.empty() || touched.back() != file)
+                touched.push_back(file);
+        }
+    };
+    while (_ring.tryPopWith(writeRecord));
+    for (uint32_t i = 0; i < touched.size(); i++)
+        fflush(touched[i]);
+}
@@ -3,12 +3,14 @@
  *
  * This class provides a singular object for handling logging operations.
  * Use Logger.log for low-priority i/o and Logger.error for high-priority.
+ * Records are handed to the shared LogSink, which writes them in the background;
+ * errors flush the sink before returning.
  */
 
 #include "Logger.hpp"
 
+#include "LogSink.hpp"
 #include <iostream>
-#include <fstream>
 #include <sstream>
 #include <time.h>
 
@@ -21,29 +23,41 @@ Logger::Logger(string name, string directory, string filename) :
     _name(name),
     _directory(directory),
     _filename(filename),
-    _verbose(DEFAULT_VERBOSE)
-{}
+    _verbose(DEFAULT_VERBOSE),
+    _file(-1)
+{
+    openFile();
+}
 
 Logger::Logger(const char *name, const char *directory, const char *filename) :
     _name(name),
     _directory(directory),
     _filename(filename),
-    _verbose(DEFAULT_VERBOSE)
-{}
+    _verbose(DEFAULT_VERBOSE),
+    _file(-1)
+{
+    openFile();
+}
 
 Logger::Logger(string name, string directory) :
     _name(name),
     _directory(directory),
     _filename(DEFAULT_FILENAME),
-    _verbose(DEFAULT_VERBOSE)
-{}
+    _verbose(DEFAULT_VERBOSE),
+    _file(-1)
+{
+    openFile();
+}
 
 Logger::Logger(const char *name, const char *directory) :
     _name(name),
     _directory(directory),
     _filename(DEFAULT_FILENAME),
-    _verbose(DEFAULT_VERBOSE)
-{}
+    _verbose(DEFAULT_VERBOSE),
+    _file(-1)
+{
+    openFile();
+}
 
 Logger::~Logger() {}
 
@@ -58,12 +72,8 @@ void Logger::log(string s, bool verbose) {
     if (_verbose || verbose)
         cout << ss.str() << "\n";
 
-    // write to log file
-    string logname(_directory);
-    logname = logname + "/" + _filename;
-    ofstream logfile(logname, ios_base::app);
-    if (logfile)
-        logfile << ss.str() << "\n";
+    // queue for the log file
+    LogSink::instance().write(_file, ss.str());
 }
 
 /* Standard method for formatted printing and logging */
@@ -76,12 +86,9 @@ void Logger::error(string s) {
     // write to STDOUT
     cout << ss.str() << "\n";
 
-    // write to log file
-    string logname(_directory);
-    logname = logname + "/" + _filename;
-    ofstream logfile(logname, ios_base::app);
-    if (logfile)
-        logfile << ss.str() << "\n";
+    // queue for the log file and write it out now
+    LogSink::instance().write(_file, ss.str());
+    LogSink::instance().flush();
 }
 
 /* Wrapper around std::string method */
@@ -97,6 +104,7 @@ void Logger::error(const char *s) {
 /* Update the value stored in _directory */
 void Logger::setDirectory(string directory) {
     _directory = directory;
+    openFile();
 }
 
 /* Wrapper around std::string method */
@@ -113,3 +121,8 @@ void Logger::enableVerbose() {
 void Logger::disableVerbose() {
     _verbose = false;
 }
+
+/* Look up the shared sink's id for this logger's file */
+void Logger::openFile() {
+    _file = LogSink::instance().open(_directory + "/" + _filename);
+}
@@ -0,0 +1,339 @@
+/*
+ * MemoryBudget.cpp
+ *
+ * Accounts the run's NvBuffers and buffer pools per subsystem against the
+ * --memory-budget. The plan sizes every subsystem from the options with the
+ * same counts the consumers allocate, NvBuffers by their padded block-linear
+ * size; at run time each buffer is charged its real size as the allocator
+ * reports it.
+ */
+
+#include "MemoryBudget.hpp"
+
+#include "Options.hpp"
+#include "CompositeRecorder.hpp"
+#include "DirectFile.hpp"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sstream>
+
+#define NVBUFFER_PITCH_ALIGN 256U   // row alignment of block-linear NvBuffers
+#define NVBUFFER_HEIGHT_ALIGN 128U  // rows per block-linear block
+#define EGL_STREAM_BUFFERS 2U       // Argus' own buffers per EGLStream besides its FIFO, an estimate
+#define PAGE_SIZE_ESTIMATE 4096U
+#define MEMINFO_FILE "/proc/meminfo"
+#define MIB (1024.0 * 1024.0)
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/* Bytes of a YUV420 NvBuffer of size, as padded for block-linear */
+static uint64_t getFrameBytes(Argus::Size2D<uint32_t> size) {
+    return alignUp(size.width(), NVBUFFER_PITCH_ALIGN) * alignUp(size.height(), NVBUFFER_HEIGHT_ALIGN) * 3 / 2;
+}
+
+/* Memory the kernel could give us without swapping, 0 if unknown */
+static uint64_t getAvailable() {
+    FILE *file = fopen(MEMINFO_FILE, "r");
+    if (!file)
+        return 0;
+    char line[128];
+    unsigned long long kib = 0;
+    while (fgets(line, sizeof(line), file))
+        if (sscanf(line, "MemAvailable: %llu kB", &kib) == 1)
+            break;
+    fclose(file);
+    return kib * 1024;
+}
+
+MemoryBudget& MemoryBudget::instance() {
+    static MemoryBudget budget;
+    return budget;
+}
+
+MemoryBudget::MemoryBudget() :
+    _limit(0),
+    _lock(false),
+    _total(0),
+    _peakTotal(0),
+    _refused(0)
+{
+    memset(_used, 0, sizeof(_used));
+    memset(_peak, 0, sizeof(_peak));
+    memset(_planned, 0, sizeof(_planned));
+}
+
+/* Set the budget in bytes, 0 for none, and whether pools are locked, call before anything is allocated.
+   From here on every USERPTR NvBuffer takes its planes from the accounted pool */
+void MemoryBudget::configure(uint64_t limit, bool lockPools) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _limit = limit;
+        _lock = lockPools;
+    }
+    _planes.setAccounting(accountPlanes, this);
+    NvBuffer::setMemoryPool(&_planes);
+}
+
+/* Bytes each subsystem will allocate for the options, counted as the consumers create their buffers */
+void MemoryBudget::plan(const Options& options, uint32_t numCameras, uint64_t planned[MEMORY_SUBSYSTEMS]) {
+    memset(planned, 0, sizeof(uint64_t) * MEMORY_SUBSYSTEMS);
+    uint64_t frameBytes = getFrameBytes(options.captureResolution);
+    uint32_t shared = options.sharePath.empty() ? 0 : options.shareSlots;
+    for (uint32_t i = 0; i < numCameras; i++) {
+        uint64_t slots = options.dmabufRing + options.preTriggerFrames + shared;
+        if (options.zeroCopy)
+            slots += options.getCaptureBuffers() + shared;
+        planned[MEMORY_RINGS] += slots * frameBytes;
+        if (!options.zeroCopy)
+            planned[MEMORY_EGL_STREAMS] += (options.getEglFifo(i) + EGL_STREAM_BUFFERS) * frameBytes;
+        if (options.format == FORMAT_JPEG && !options.composite) {
+            Argus::Size2D<uint32_t> size = options.getEncodeSize(i);
+            planned[MEMORY_ENCODER] += options.writeQueue * alignUp(size.area() * 3 / 2, PAGE_SIZE_ESTIMATE);
+        }
+        if (options.directIo)
+            planned[MEMORY_WRITERS] += DIRECT_IO_BOUNCE;
+    }
+
+    /* A composite is encoded from one canvas into a pool of its own, its writer is one more */
+    if (options.composite) {
+        Argus::Size2D<uint32_t> canvas = CompositeRecorder::getCanvasSize(options, numCameras);
+        planned[MEMORY_ENCODER] += getFrameBytes(canvas) + options.writeQueue * alignUp(canvas.area() * 3 / 2, PAGE_SIZE_ESTIMATE);
+        if (options.directIo)
+            planned[MEMORY_WRITERS] += DIRECT_IO_BOUNCE;
+    }
+}
+
+/* True if the plan fits the budget and the memory available, otherwise message says by how much it is off */
+bool MemoryBudget::check(const uint64_t planned[MEMORY_SUBSYSTEMS], std::string& message) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    memcpy(_planned, planned, sizeof(_planned));
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < MEMORY_SUBSYSTEMS; i++)
+        total += planned[i];
+    uint64_t available = getAvailable();
+
+    std::stringstream ss;
+    ss.precision(1);
+    ss << std::fixed << "Buffers need " << total / MIB << " MiB:";
+    for (uint32_t i = 0; i < MEMORY_SUBSYSTEMS; i++)
+        if (planned[i])
+            ss << " " << getName((MemorySubsystem) i) << " " << planned[i] / MIB << " MiB";
+    if (_limit && total > _limit) {
+        ss << ", over the memory budget of " << _limit / MIB << " MiB. Lower --dmabuf-ring, --write-queue, --egl-fifo,"
+           << " --pre-trigger, --capture-buffers or the resolution, or raise --memory-budget";
+        message = ss.str();
+        return false;
+    }
+    if (available && total > available) {
+        ss << ", only " << available / MIB << " MiB are available. Lower --dmabuf-ring, --write-queue, --egl-fifo,"
+           << " --pre-trigger, --capture-buffers or the resolution";
+        message = ss.str();
+        return false;
+    }
+    if (_limit)
+        ss << " of a " << _limit / MIB << " MiB budget";
+    message = ss.str();
+    return true;
+}
+
+/* Charge bytes the subsystem holds outside this accountant, false if the budget cannot take them */
+bool MemoryBudget::reserve(MemorySubsystem subsystem, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return charge(subsystem, bytes);
+}
+
+void MemoryBudget::release(MemorySubsystem subsystem, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    discharge(subsystem, bytes);
+}
+
+/* NvBufferCreateEx within the budget, the dmabuf fd or -1. The cameras create their rings concurrently,
+   so the buffer is created unlocked and charged at the size the allocator gives it */
+int MemoryBudget::createNvBuffer(MemorySubsystem subsystem, NvBufferCreateParams& params) {
+    Argus::Size2D<uint32_t> size(params.width, params.height);
+    if (!fits(subsystem, getFrameBytes(size)))
+        return -1;
+    int fd = -1;
+    if (NvBufferCreateEx(&fd, &params) != 0)
+        return -1;
+    return adopt(subsystem, fd, size);
+}
+
+/* createNvBuffer() of a captured image within the budget, the dmabuf fd or -1 */
+int MemoryBudget::createNvBuffer(MemorySubsystem subsystem, const EGLStream::NV::IImageNativeBuffer *image,
+                                 Argus::Size2D<uint32_t> size, NvBufferColorFormat format, NvBufferLayout layout) {
+    if (!fits(subsystem, getFrameBytes(size)))
+        return -1;
+    int fd = image->createNvBuffer(size, format, layout);
+    if (fd <= 0)
+        return -1;
+    return adopt(subsystem, fd, size);
+}
+
+/* NvBufferDestroy and give the buffer's bytes back */
+void MemoryBudget::destroyNvBuffer(int fd) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::map<int, Allocation>::iterator it = _nvBuffers.find(fd);
+    if (it != _nvBuffers.end()) {
+        discharge(it->second.subsystem, it->second.bytes);
+        _nvBuffers.erase(it);
+    }
+    NvBufferDestroy(fd);
+}
+
+/* Aligned heap memory within the budget, locked with --mlock, NULL if refused or out of memory */
+void *MemoryBudget::allocate(MemorySubsystem subsystem, size_t size, size_t alignment) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!charge(subsystem, size))
+        return NULL;
+    void *data = NULL;
+    if (posix_memalign(&data, alignment, size) != 0) {
+        discharge(subsystem, size);
+        return NULL;
+    }
+    if (_lock && mlock(data, size) != 0) {
+        std::stringstream ss;
+        ss << "mlock of " << size << " bytes for " << getName(subsystem) << " failed: " << strerror(errno)
+           << ", raise the memlock limit (ulimit -l)";
+        _lastRefusal = ss.str();
+        _refused++;
+        ::free(data);
+        discharge(subsystem, size);
+        return NULL;
+    }
+    Allocation allocation = {subsystem, size};
+    _heap[data] = allocation;
+    return data;
+}
+
+/* Free memory from allocate(), NULL is ignored */
+void MemoryBudget::free(void *data) {
+    if (!data)
+        return;
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::map<void*, Allocation>::iterator it = _heap.find(data);
+    if (it != _heap.end()) {
+        if (_lock)
+            munlock(data, it->second.bytes);
+        discharge(it->second.subsystem, it->second.bytes);
+        _heap.erase(it);
+    }
+    ::free(data);
+}
+
+uint64_t MemoryBudget::getUsed(MemorySubsystem subsystem) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _used[subsystem];
+}
+
+uint64_t MemoryBudget::getPeak(MemorySubsystem subsystem) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _peak[subsystem];
+}
+
+/* Each subsystem's peak next to its plan, the total peak and the refusals on one line */
+std::string MemoryBudget::getReport() {
+    uint64_t planeAllocations = _planes.getAllocations(); // before _mutex, the pool calls in holding its own lock
+    uint64_t planeReuses = _planes.getReuses();
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::stringstream ss;
+    ss.precision(1);
+    ss << std::fixed << "Memory peak:";
+    for (uint32_t i = 0; i < MEMORY_SUBSYSTEMS; i++)
+        if (_peak[i] || _planned[i])
+            ss << " " << getName((MemorySubsystem) i) << " " << _peak[i] / MIB << " MiB (planned " << _planned[i] / MIB << "),";
+    ss << " total " << _peakTotal / MIB << " MiB";
+    if (_limit)
+        ss << " of " << _limit / MIB << " MiB";
+    if (_lock)
+        ss << ", pools locked";
+    if (planeAllocations > 0)
+        ss << ", " << planeAllocations << " planes allocated and " << planeReuses << " reused";
+    if (_refused)
+        ss << ", " << _refused << " allocations refused, last: " << _lastRefusal;
+    return ss.str();
+}
+
+const char *MemoryBudget::getName(MemorySubsystem subsystem) {
+    switch (subsystem) {
+        case MEMORY_RINGS:
+            return "rings";
+        case MEMORY_EGL_STREAMS:
+            return "egl streams";
+        case MEMORY_ENCODER:
+            return "encoder";
+        case MEMORY_WRITERS:
+            return "writers";
+        case MEMORY_PREVIEW:
+            return "preview";
+        case MEMORY_PLANES:
+            return "planes";
+        default:
+            return "unknown";
+    }
+}
+
+/* The plane pool's accounting, charged as it takes planes from the heap and discharged as it frees them */
+bool MemoryBudget::accountPlanes(int64_t bytes, void *data) {
+    MemoryBudget *budget = (MemoryBudget *) data;
+    if (bytes < 0) {
+        budget->release(MEMORY_PLANES, -bytes);
+        return true;
+    }
+    return budget->reserve(MEMORY_PLANES, bytes);
+}
+
+/* Check a new buffer of about bytes would fit before it is created */
+bool MemoryBudget::fits(MemorySubsystem subsystem, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return !exceeds(subsystem, bytes);
+}
+
+/* Charge a created NvBuffer at its real size, destroying it if that no longer fits */
+int MemoryBudget::adopt(MemorySubsystem subsystem, int fd, Argus::Size2D<uint32_t> size) {
+    NvBufferParams created;
+    uint64_t bytes = NvBufferGetParams(fd, &created) == 0 ? created.nv_buffer_size : getFrameBytes(size);
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!charge(subsystem, bytes)) {
+        NvBufferDestroy(fd);
+        return -1;
+    }
+    Allocation allocation = {subsystem, bytes};
+    _nvBuffers[fd] = allocation;
+    return fd;
+}
+
+/* True and the refusal recorded if bytes more would exceed the budget, call with _mutex held */
+bool MemoryBudget::exceeds(MemorySubsystem subsystem, uint64_t bytes) {
+    if (!_limit || _total + bytes <= _limit)
+        return false;
+    std::stringstream ss;
+    ss << getName(subsystem) << " asked for " << bytes << " bytes with " << _limit - _total << " left";
+    _lastRefusal = ss.str();
+    _refused++;
+    return true;
+}
+
+/* Account bytes to the subsystem unless the budget would be exceeded, call with _mutex held */
+bool MemoryBudget::charge(MemorySubsystem subsystem, uint64_t bytes) {
+    if (exceeds(subsystem, bytes))
+        return false;
+    _total += bytes;
+    _used[subsystem] += bytes;
+    if (_used[subsystem] > _peak[subsystem])
+        _peak[subsystem] = _used[subsystem];
+    if (_total > _peakTotal)
+        _peakTotal = _total;
+    return true;
+}
+
+/* Call with _mutex held */
+void MemoryBudget::discharge(MemorySubsystem subsystem, uint64_t bytes) {
+    _total -= bytes;
+    _used[subsystem] -= bytes;
+}
@@ -0,0 +1,109 @@
+/*
+ * MetadataLog.cpp
+ *
+ * Stores the capture metadata of every saved image in cam<N>/metadata.bin as
+ * fixed-size binary records. The file is preallocated for the expected run
+ * length and memory-mapped, so appending a record is a store into the map with
+ * no formatting and no system call; the file only grows, by remapping, when a
+ * run outlasts its preallocation. The header's count is updated with every
+ * record so a file cut short by a crash still decodes. Decode with the
+ * MetadataDump tool.
+ */
+
+#include "MetadataLog.hpp"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define FILE_MODE 0666
+#define METADATA_CHUNK 16384 // records added per growth, about 9 minutes of one camera at 30 fps
+
+MetadataLog::MetadataLog(uint32_t id, std::string directory, uint64_t expectedRecords) :
+    _id(id),
+    _directory(directory),
+    _fd(-1),
+    _map(NULL),
+    _mapSize(0),
+    _capacity(expectedRecords > 0 ? expectedRecords + METADATA_CHUNK / 16 : METADATA_CHUNK),
+    _growCount(0)
+{}
+
+MetadataLog::~MetadataLog() {
+    close();
+}
+
+/* Create and preallocate the file, map it and write its header */
+bool MetadataLog::open() {
+    std::string filename = _directory + "/metadata.bin";
+    _fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, FILE_MODE);
+    if (_fd == -1 || !map(_capacity))
+        return false;
+
+    MetadataHeader *header = (MetadataHeader *) _map;
+    memcpy(header->magic, METADATA_MAGIC, sizeof(header->magic));
+    header->camera = _id;
+    header->recordSize = sizeof(MetadataRecord);
+    header->count = 0;
+    return true;
+}
+
+/* Store one record, only ever called from the owning consumer */
+bool MetadataLog::append(const MetadataRecord& record) {
+    if (!_map)
+        return false;
+    MetadataHeader *header = (MetadataHeader *) _map;
+    if (header->count == _capacity) {
+        if (!map(_capacity + METADATA_CHUNK))
+            return false;
+        header = (MetadataHeader *) _map;
+        _growCount++;
+    }
+    MetadataRecord *records = (MetadataRecord *) (header + 1);
+    records[header->count] = record;
+    header->count++;
+    return true;
+}
+
+/* Trim the preallocated tail and close the file */
+bool MetadataLog::close() {
+    bool success = true;
+    uint64_t count = getRecordCount();
+    if (_map) {
+        success = munmap(_map, _mapSize) == 0;
+        _map = NULL;
+    }
+    if (_fd != -1) {
+        success = ftruncate(_fd, sizeof(MetadataHeader) + count * sizeof(MetadataRecord)) == 0 && success;
+        success = ::close(_fd) == 0 && success;
+        _fd = -1;
+    }
+    return success;
+}
+
+uint64_t MetadataLog::getRecordCount() const {
+    return _map ? ((MetadataHeader *) _map)->count : 0;
+}
+
+/* Number of times a run outlasted the preallocation */
+uint64_t MetadataLog::getGrowCount() const {
+    return _growCount;
+}
+
+/* Size the file for capacity records and (re)map all of it */
+bool MetadataLog::map(uint64_t capacity) {
+    size_t size = sizeof(MetadataHeader) + capacity * sizeof(MetadataRecord);
+    /* Reserve the blocks up front, fall back to a sparse file where the filesystem can't */
+    if (posix_fallocate(_fd, 0, size) != 0 && ftruncate(_fd, size) != 0)
+        return false;
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+    if (_map)
+        munmap(_map, _mapSize);
+    _map = map;
+    _mapSize = size;
+    _capacity = capacity;
+    return true;
+}
@@ -0,0 +1,176 @@
+/*
+ * MotionGate.cpp
+ *
+ * Skips frames that barely differ from the last frame kept. Each candidate is
+ * downscaled by the VIC into a small pitch-linear NvBuffer, mapped once, and
+ * its mean absolute luma difference against the last kept frame is the score.
+ * Runs of skipped frames are appended to cam<N>/motion.csv as they end.
+ *
+ * File format: first_frame,last_frame,first_timestamp_ns,last_timestamp_ns,frames
+ */
+
+#include "MotionGate.hpp"
+
+#include "PixelKernels.hpp"
+#include "MemoryBudget.hpp"
+#include "SteadyClock.hpp"
+#include <Argus/Argus.h>
+#include <EGLStream/EGLStream.h>
+#include <EGLStream/NV/ImageNativeBuffer.h>
+#include <nvbuf_utils.h>
+#include <string.h>
+
+using namespace Argus;
+using namespace EGLStream;
+
+MotionGate::MotionGate(uint32_t id, std::string directory, double threshold, uint64_t keepInterval) :
+    _id(id),
+    _directory(directory),
+    _threshold(threshold),
+    _keepInterval(keepInterval),
+    _fd(-1),
+    _mapping(NULL),
+    _pitch(0),
+    _reference(MOTION_GATE_WIDTH * MOTION_GATE_HEIGHT),
+    _haveReference(false),
+    _lastKept(0),
+    _file(NULL),
+    _runFirstFrame(0),
+    _runLastFrame(0),
+    _runFirstTimestamp(0),
+    _runLastTimestamp(0),
+    _runFrames(0),
+    _framesSkipped(0),
+    _lastScore(0)
+{}
+
+MotionGate::~MotionGate() {
+    close();
+    if (_mapping)
+        NvBufferMemUnMap(_fd, 0, &_mapping);
+    if (_fd != -1)
+        MemoryBudget::instance().destroyNvBuffer(_fd);
+}
+
+/* Create and map the downscale target, return bool indicating success */
+bool MotionGate::open() {
+    NvBufferCreateParams params;
+    memset(&params, 0, sizeof(params));
+    params.width = MOTION_GATE_WIDTH;
+    params.height = MOTION_GATE_HEIGHT;
+    params.payloadType = NvBufferPayload_SurfArray;
+    params.layout = NvBufferLayout_Pitch;
+    params.colorFormat = NvBufferColorFormat_YUV420;
+    params.nvbuf_tag = NvBufferTag_CAMERA;
+    if ((_fd = MemoryBudget::instance().createNvBuffer(MEMORY_PREVIEW, params)) == -1) {
+        _error = "Failed to create the motion gate buffer";
+        return false;
+    }
+    NvBufferParams layout;
+    if (NvBufferGetParams(_fd, &layout) != 0 || NvBufferMemMap(_fd, 0, NvBufferMem_Read, &_mapping) != 0) {
+        _mapping = NULL;
+        _error = "Failed to map the motion gate buffer";
+        return false;
+    }
+    _pitch = layout.pitch[0];
+    return true;
+}
+
+/* Score the frame against the last kept one and decide whether to keep it; a VIC copy from the capture
+   target with a buffer stream, from the EGLStream frame otherwise. Returns false if the frame could not
+   be downscaled or motion.csv not be written */
+bool MotionGate::evaluate(NV::IImageNativeBuffer *iNativeBuffer, int captureFd, uint64_t frameNumber,
+                          uint64_t timestamp, bool& keep) {
+    uint64_t start = now();
+    bool scaled;
+    if (captureFd != -1) {
+        NvBufferTransformParams params;
+        memset(&params, 0, sizeof(params));
+        params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+        params.transform_filter = NvBufferTransform_Filter_Smart;
+        scaled = NvBufferTransform(captureFd, _fd, &params) == 0;
+    } else {
+        scaled = iNativeBuffer->copyToNvBuffer(_fd) == STATUS_OK;
+    }
+    if (!scaled) {
+        _error = "Failed to downscale the frame for the motion gate";
+        return false;
+    }
+    NvBufferMemSyncForCpu(_fd, 0, &_mapping);
+
+    /* Mean absolute luma difference against the last kept frame, 0-255 */
+    uint64_t sad = 0;
+    for (uint32_t y = 0; y < MOTION_GATE_HEIGHT; y++)
+        sad += sumAbsDiff((const uint8_t *) _mapping + (size_t) y * _pitch, _reference.data() + y * MOTION_GATE_WIDTH,
+                          MOTION_GATE_WIDTH);
+    _lastScore = (double) sad / (MOTION_GATE_WIDTH * MOTION_GATE_HEIGHT);
+
+    keep = !_haveReference || _lastScore >= _threshold || (_keepInterval > 0 && timestamp - _lastKept >= _keepInterval);
+    if (keep) {
+        for (uint32_t y = 0; y < MOTION_GATE_HEIGHT; y++)
+            memcpy(_reference.data() + y * MOTION_GATE_WIDTH, (const uint8_t *) _mapping + (size_t) y * _pitch,
+                   MOTION_GATE_WIDTH);
+        _haveReference = true;
+        _lastKept = timestamp;
+        if (_runFrames > 0 && !logRun())
+            return false;
+    } else {
+        if (_runFrames == 0) {
+            _runFirstFrame = frameNumber;
+            _runFirstTimestamp = timestamp;
+        }
+        _runLastFrame = frameNumber;
+        _runLastTimestamp = timestamp;
+        _runFrames++;
+        _framesSkipped++;
+    }
+    _cost.record((now() - start) / 1000);
+    return true;
+}
+
+/* Log the run still open and close motion.csv, return bool indicating success */
+bool MotionGate::close() {
+    bool success = _runFrames == 0 || logRun();
+    if (_file && fclose(_file) != 0)
+        success = false;
+    _file = NULL;
+    return success;
+}
+
+/* Append the ended run of skipped frames, creating motion.csv with the first */
+bool MotionGate::logRun() {
+    if (!_file) {
+        std::string filename = _directory + "/motion.csv";
+        _file = fopen(filename.c_str(), "w");
+        if (!_file || fprintf(_file, "first_frame,last_frame,first_timestamp_ns,last_timestamp_ns,frames\n") < 0) {
+            _error = "Failed to create motion.csv";
+            return false;
+        }
+    }
+    if (fprintf(_file, "%lu,%lu,%lu,%lu,%lu\n", _runFirstFrame, _runLastFrame, _runFirstTimestamp, _runLastTimestamp,
+                _runFrames) < 0 || fflush(_file) != 0) {
+        _error = "Failed to write motion.csv";
+        return false;
+    }
+    _runFrames = 0;
+    return true;
+}
+
+/* Frames skipped since the start */
+uint64_t MotionGate::getFramesSkipped() const {
+    return _framesSkipped;
+}
+
+/* Score of the last evaluated frame */
+double MotionGate::getLastScore() const {
+    return _lastScore;
+}
+
+/* Time each evaluation took, downscale included, in us */
+const LatencyHistogram *MotionGate::getCost() const {
+    return &_cost;
+}
+
+const std::string& MotionGate::getError() const {
+    return _error;
+}
@@ -6,12 +6,25 @@
  */
 
 #include "Options.hpp"
+#include "FrameSetCollector.hpp"
+#include "VolumeSet.hpp"
+#include "DirectFile.hpp"
+#include "BackpressureEngine.hpp"
+#include "FrameSink.hpp"
+#include "StorageBench.hpp"
+#include "MotionGate.hpp"
+#include "TraceLog.hpp"
 #include <iostream>
 #include <getopt.h>
 #include <chrono>
 #include <unistd.h>
 #include <string.h>
+#include <stdio.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <fstream>
+#include <sstream>
 
 using namespace std;
 
@@ -21,6 +34,142 @@ using namespace std;
 #define DEFAULT_VERBOSE false
 #define DEFAULT_CAPTURE_TIME 0U
 #define DEFAULT_SAVE_EVERY 4U
+#define DEFAULT_WRITE_QUEUE 4U
+#define DEFAULT_DMABUF_RING 2U
+#define DEFAULT_CONTAINER_SIZE 0U
+#define DEFAULT_FANOUT 0U
+#define DEFAULT_DIRECT_IO false
+#define DEFAULT_AIO_DEPTH 0U
+#define DEFAULT_SYNC_INTERVAL 1000U
+#define DEFAULT_SEGMENT_MINUTES 0U
+#define DEFAULT_SEGMENT_SIZE 0U
+#define DEFAULT_OFFLOAD_RATE 4U
+#define DEFAULT_BITRATE 16U
+#define DEFAULT_IDR_INTERVAL 30U
+#define DEFAULT_MAX_PERF false
+#define DEFAULT_DQ_LOOPS 0U
+#define MAX_DQ_LOOPS 6U // one per TX2 core
+#define DEFAULT_ROI_SALIENCY 0U
+#define MAX_ROI_REGIONS 8U // V4L2_MAX_ROI_REGIONS of the encoder
+#define MAX_ROI_QP_DELTA 51
+#define DEFAULT_ENCODE_WORKERS 2U
+#define DEFAULT_ACQUIRE_TIMEOUT 4U
+#define DEFAULT_CAMERA_RESTARTS 0U
+#define DEFAULT_FULL_RATE false
+#define DEFAULT_TELEMETRY false
+#define DEFAULT_TRACE false
+#define DEFAULT_RECOVER false
+#define DEFAULT_METADATA false
+#define DEFAULT_EXIF false
+#define DEFAULT_STATUS_INTERVAL 1U
+#define DEFAULT_SYNC_SESSION false
+#define DEFAULT_STAGGER false
+#define DEFAULT_ZERO_COPY false
+#define DEFAULT_FRAME_SET_TOLERANCE 0U
+#define DEFAULT_RT_PRIORITY 10U
+#define DEFAULT_PREVIEW_FPS 2U
+#define DEFAULT_STREAM_BITRATE 2000U
+#define DEFAULT_VOLUME_RESERVE 1024U
+#define DEFAULT_CAPACITY_WARN 10U
+#define DEFAULT_BACKPRESSURE 0U
+#define DEFAULT_THERMAL_MARGIN 0U
+#define DEFAULT_QUALITY_BUDGET 0U
+#define DEFAULT_RESTART_ROWS 0U
+#define DEFAULT_PROXY_EVERY 1U
+#define DEFAULT_PROXY_BUDGET 20U
+#define DEFAULT_START_PAUSED false
+#define DEFAULT_DAEMON false
+#define DEFAULT_FOLLOWERS 1U
+#define DEFAULT_SHARE_SLOTS 1U
+#define DEFAULT_QUICKLOOK_RATE 2U
+#define DEFAULT_TRIGGER_FRAMES 0U
+#define DEFAULT_PRE_TRIGGER_FRAMES 0U
+#define DEFAULT_INTERVAL 0.0
+#define DEFAULT_MOTION_THRESHOLD 0.0
+#define DEFAULT_MOTION_KEEP 10U
+#define DEFAULT_EXPOSURE_GATE 0U
+#define DEFAULT_EXPOSURE_QUALITY 0U
+#define DEFAULT_EGL_FIFO 0U
+#define DEFAULT_MEMORY_BUDGET 0U
+#define DEFAULT_MEMORY_LOCK false
+#define DEFAULT_CAPTURE_BUFFERS 0U
+#define CAPTURE_SPARE 2U // capture buffers Argus keeps beyond the ones downstream may hold
+
+/* Options without a short flag */
+enum LongOptions {
+    OPT_BITRATE = 256,
+    OPT_IDR_INTERVAL,
+    OPT_DQ_LOOPS,
+    OPT_ROI,
+    OPT_ROI_SALIENCY,
+    OPT_ENCODERS,
+    OPT_ENCODE_POLICY,
+    OPT_ACQUIRE_TIMEOUT,
+    OPT_CAMERA_RESTARTS,
+    OPT_STATUS_INTERVAL,
+    OPT_CONSUMER_CPUS,
+    OPT_WRITER_CPUS,
+    OPT_RT_POLICY,
+    OPT_RT_PRIORITY,
+    OPT_FRAME_SETS,
+    OPT_SET_POLICY,
+    OPT_COMPOSITE,
+    OPT_PREVIEW,
+    OPT_PREVIEW_FPS,
+    OPT_STREAM_TO,
+    OPT_STREAM_BITRATE,
+    OPT_VOLUMES,
+    OPT_STRIPE,
+    OPT_VOLUME_RESERVE,
+    OPT_CAPACITY_WARN,
+    OPT_FANOUT,
+    OPT_AIO,
+    OPT_SYNC_INTERVAL,
+    OPT_SEGMENT,
+    OPT_OFFLOAD,
+    OPT_OFFLOAD_RATE,
+    OPT_BACKPRESSURE,
+    OPT_THERMAL_MARGIN,
+    OPT_QUALITY,
+    OPT_QUALITY_BUDGET,
+    OPT_RESTART_ROWS,
+    OPT_CROP,
+    OPT_SCALE,
+    OPT_PROXY,
+    OPT_PROXY_EVERY,
+    OPT_PROXY_BUDGET,
+    OPT_BENCH_STORAGE,
+    OPT_BENCH_JSON,
+    OPT_FRAME_RATE,
+    OPT_EXPOSURE,
+    OPT_GAIN,
+    OPT_AE_LOCK,
+    OPT_DENOISE,
+    OPT_TNR,
+    OPT_GRAYSCALE,
+    OPT_CONFIG,
+    OPT_CONTROL,
+    OPT_TRIGGER,
+    OPT_TRIGGER_GPIO,
+    OPT_PRE_TRIGGER,
+    OPT_INTERVAL,
+    OPT_MOTION_GATE,
+    OPT_MOTION_KEEP,
+    OPT_EXPOSURE_GATE,
+    OPT_EXPOSURE_QUALITY,
+    OPT_RAW_LAYOUT,
+    OPT_VERIFY,
+    OPT_LEADER,
+    OPT_FOLLOWERS,
+    OPT_FOLLOW,
+    OPT_EGL_FIFO,
+    OPT_MEMORY_BUDGET,
+    OPT_CAPTURE_BUFFERS,
+    OPT_SHARE,
+    OPT_SHARE_SLOTS,
+    OPT_QUICKLOOK,
+    OPT_QUICKLOOK_RATE
+};
 
 /* 2048x1554 @ 38 FPS */
 #define CAPTURE_WIDTH_0 2048U
@@ -35,13 +184,89 @@ using namespace std;
 
 /* Default constructor, initialize to all default options then parse the input */
 Options::Options() :
-    profile(DEFAULT_PROFILE),
-    verbose(DEFAULT_VERBOSE),
-    captureTime(DEFAULT_CAPTURE_TIME),
-    saveEvery(DEFAULT_SAVE_EVERY),
     directory(NULL),
     captureMode(CAPTURE_MODE_0),
-    captureResolution(0)
+    captureResolution(0),
+    captureFrameDuration(1000000000UL / CAPTURE_FPS_0),
+    captureBitDepth(0),
+    cameraCount(1),
+    clusterRecord(false),
+    captureTime(DEFAULT_CAPTURE_TIME),
+    profile(DEFAULT_PROFILE),
+    verbose(DEFAULT_VERBOSE),
+    writeQueue(DEFAULT_WRITE_QUEUE),
+    dmabufRing(DEFAULT_DMABUF_RING),
+    format(FORMAT_JPEG),
+    containerSize(DEFAULT_CONTAINER_SIZE),
+    fanout(DEFAULT_FANOUT),
+    directIo(DEFAULT_DIRECT_IO),
+    aioDepth(DEFAULT_AIO_DEPTH),
+    syncInterval(DEFAULT_SYNC_INTERVAL),
+    segmentMinutes(DEFAULT_SEGMENT_MINUTES),
+    segmentSize(DEFAULT_SEGMENT_SIZE),
+    offloadPort(0),
+    offloadRate(DEFAULT_OFFLOAD_RATE),
+    bitrate(DEFAULT_BITRATE),
+    idrInterval(DEFAULT_IDR_INTERVAL),
+    maxPerf(DEFAULT_MAX_PERF),
+    dqLoops(DEFAULT_DQ_LOOPS),
+    roiSaliency(DEFAULT_ROI_SALIENCY),
+    encodeWorkers(DEFAULT_ENCODE_WORKERS),
+    encodePolicy(ENCODE_POLICY_ROUND_ROBIN),
+    restartRows(DEFAULT_RESTART_ROWS),
+    acquireTimeout(DEFAULT_ACQUIRE_TIMEOUT),
+    cameraRestarts(DEFAULT_CAMERA_RESTARTS),
+    fullRate(DEFAULT_FULL_RATE),
+    telemetry(DEFAULT_TELEMETRY),
+    trace(DEFAULT_TRACE),
+    metadata(DEFAULT_METADATA),
+    exif(DEFAULT_EXIF),
+    statusInterval(DEFAULT_STATUS_INTERVAL),
+    syncSession(DEFAULT_SYNC_SESSION),
+    stagger(DEFAULT_STAGGER),
+    zeroCopy(DEFAULT_ZERO_COPY),
+    captureBuffers(DEFAULT_CAPTURE_BUFFERS),
+    memoryBudget(DEFAULT_MEMORY_BUDGET),
+    memoryLock(DEFAULT_MEMORY_LOCK),
+    frameSetTolerance(DEFAULT_FRAME_SET_TOLERANCE),
+    setPolicy(SET_POLICY_DROP),
+    composite(0),
+    compositeTile(0),
+    rtPolicy(SCHED_OTHER),
+    rtPriority(DEFAULT_RT_PRIORITY),
+    previewResolution(0),
+    previewFps(DEFAULT_PREVIEW_FPS),
+    streamPort(0),
+    streamBitrate(DEFAULT_STREAM_BITRATE),
+    stripePolicy(STRIPE_CAMERA),
+    volumeReserve(DEFAULT_VOLUME_RESERVE),
+    capacityWarn(DEFAULT_CAPACITY_WARN),
+    backpressure(DEFAULT_BACKPRESSURE),
+    thermalMargin(DEFAULT_THERMAL_MARGIN),
+    proxyResolution(0),
+    proxyEvery(DEFAULT_PROXY_EVERY),
+    proxyBudget(DEFAULT_PROXY_BUDGET),
+    benchCameras(0),
+    benchFrameSize(0),
+    benchFps(0),
+    startPaused(DEFAULT_START_PAUSED),
+    daemonMode(DEFAULT_DAEMON),
+    clusterRole(CLUSTER_ROLE_NONE),
+    clusterPort(0),
+    followers(DEFAULT_FOLLOWERS),
+    shareSlots(DEFAULT_SHARE_SLOTS),
+    quickLookPort(0),
+    quickLookRate(DEFAULT_QUICKLOOK_RATE),
+    triggerFrames(DEFAULT_TRIGGER_FRAMES),
+    triggerGpio(-1),
+    preTriggerFrames(DEFAULT_PRE_TRIGGER_FRAMES),
+    interval(DEFAULT_INTERVAL),
+    motionThreshold(DEFAULT_MOTION_THRESHOLD),
+    motionKeep(DEFAULT_MOTION_KEEP),
+    exposureGate(DEFAULT_EXPOSURE_GATE),
+    exposureQuality(DEFAULT_EXPOSURE_QUALITY),
+    rawLayout(RAW_LAYOUT_I420),
+    recover(DEFAULT_RECOVER)
 {
     /* Assign time since epoch */
     directory = new char[FILENAME_MAX];
@@ -51,6 +276,285 @@ Options::Options() :
     }
 }
 
+/* Parse a comma separated list of integers, each within [min, max] */
+static bool parseIntList(const char *arg, vector<int>& values, long min, long max) {
+    stringstream ss(arg);
+    string item;
+    values.clear();
+    while (getline(ss, item, ',')) {
+        char *end = NULL;
+        long value = strtol(item.c_str(), &end, 10);
+        if (item.empty() || *end != '\0' || value < min || value > max)
+            return false;
+        values.push_back(value);
+    }
+    return !values.empty();
+}
+
+/* v4l2_tnr_algorithm names, in the order of the enum */
+static const char *const TNR_NAMES[] = {"original", "outdoor-low", "outdoor-medium", "outdoor-high", "indoor-low",
+                                        "indoor-medium", "indoor-high"};
+
+/* Parse a comma separated list of off, fast or hq, each optionally followed by :<strength> */
+static bool parseDenoiseList(const char *arg, vector<int>& modes, vector<float>& strengths) {
+    stringstream ss(arg);
+    string item;
+    modes.clear();
+    strengths.clear();
+    while (getline(ss, item, ',')) {
+        size_t colon = item.find(':');
+        string mode = item.substr(0, colon);
+        float strength = -1;
+        if (colon != string::npos) {
+            char *end = NULL;
+            strength = strtof(item.c_str() + colon + 1, &end);
+            if (colon + 1 == item.size() || *end != '\0' || strength < 0 || strength > 1)
+                return false;
+        }
+        if (mode == "off")
+            modes.push_back(DENOISE_OFF);
+        else if (mode == "fast")
+            modes.push_back(DENOISE_FAST);
+        else if (mode == "hq")
+            modes.push_back(DENOISE_HIGH_QUALITY);
+        else
+            return false;
+        strengths.push_back(strength);
+    }
+    return !modes.empty();
+}
+
+static string formatDenoise(int mode, float strength) {
+    string name = mode == DENOISE_OFF ? "off" : mode == DENOISE_FAST ? "fast" : "hq";
+    if (strength < 0)
+        return name;
+    stringstream ss;
+    ss << name << ":" << strength;
+    return ss.str();
+}
+
+/* Parse a comma separated list of TNR algorithm names or off */
+static bool parseTnrList(const char *arg, vector<int>& algorithms) {
+    stringstream ss(arg);
+    string item;
+    algorithms.clear();
+    while (getline(ss, item, ',')) {
+        int algorithm = item == "off" ? TNR_OFF : -2;
+        for (int i = 0; i < (int) (sizeof(TNR_NAMES) / sizeof(TNR_NAMES[0])) && algorithm == -2; i++)
+            if (item == TNR_NAMES[i])
+                algorithm = i;
+        if (algorithm == -2)
+            return false;
+        algorithms.push_back(algorithm);
+    }
+    return !algorithms.empty();
+}
+
+/* Parse a comma separated list of CPU indices, each must name a configured core */
+static bool parseCpuList(const char *arg, vector<int>& cpus) {
+    return parseIntList(arg, cpus, 0, sysconf(_SC_NPROCESSORS_CONF) - 1);
+}
+
+/* Parse a comma separated list of mount points, each must be an existing directory */
+static bool parseVolumeList(const char *arg, vector<string>& volumes) {
+    stringstream ss(arg);
+    string item;
+    volumes.clear();
+    while (getline(ss, item, ',')) {
+        struct stat info;
+        while (item.size() > 1 && item.back() == '/')
+            item.pop_back();
+        if (item.empty() || stat(item.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+            return false;
+        volumes.push_back(item);
+    }
+    return !volumes.empty();
+}
+
+/* Parse a comma separated list of WxH+X+Y crop rectangles, full leaves a camera uncropped.
+   Sizes and offsets must be even to keep the 4:2:0 chroma aligned */
+static bool parseCropList(const char *arg, vector<Argus::Rectangle<uint32_t> >& crops) {
+    stringstream ss(arg);
+    string item;
+    crops.clear();
+    while (getline(ss, item, ',')) {
+        uint32_t width, height, left, top;
+        char end;
+        if (item == "full") {
+            crops.push_back(Argus::Rectangle<uint32_t>(0));
+            continue;
+        }
+        if (sscanf(item.c_str(), "%ux%u+%u+%u%c", &width, &height, &left, &top, &end) != 4
+                || width == 0 || height == 0 || (width | height | left | top) & 1)
+            return false;
+        crops.push_back(Argus::Rectangle<uint32_t>(left, top, left + width, top + height));
+    }
+    return !crops.empty();
+}
+
+/* Parse a comma separated list of ROI maps, one per camera. Each map is up to MAX_ROI_REGIONS
+   WxH+X+Y:QP regions separated by /, none leaves a camera's bitrate unweighted */
+static bool parseRoiList(const char *arg, vector<vector<RoiRegion> >& rois) {
+    stringstream ss(arg);
+    string item;
+    rois.clear();
+    while (getline(ss, item, ',')) {
+        vector<RoiRegion> regions;
+        if (item != "none") {
+            stringstream regionStream(item);
+            string region;
+            while (getline(regionStream, region, '/')) {
+                uint32_t width, height, left, top;
+                int qpDelta;
+                char end;
+                if (sscanf(region.c_str(), "%ux%u+%u+%u:%d%c", &width, &height, &left, &top, &qpDelta, &end) != 5
+                        || width == 0 || height == 0 || qpDelta < -MAX_ROI_QP_DELTA || qpDelta > MAX_ROI_QP_DELTA)
+                    return false;
+                RoiRegion roi;
+                roi.rect = Argus::Rectangle<uint32_t>(left, top, left + width, top + height);
+                roi.qpDelta = qpDelta;
+                regions.push_back(roi);
+            }
+            if (regions.empty() || regions.size() > MAX_ROI_REGIONS)
+                return false;
+        }
+        rois.push_back(regions);
+    }
+    return !rois.empty();
+}
+
+/* Parse a comma separated list of WxH encode sizes, full encodes a camera at its crop size */
+static bool parseScaleList(const char *arg, vector<Argus::Size2D<uint32_t> >& scales) {
+    stringstream ss(arg);
+    string item;
+    scales.clear();
+    while (getline(ss, item, ',')) {
+        uint32_t width, height;
+        char end;
+        if (item == "full") {
+            scales.push_back(Argus::Size2D<uint32_t>(0));
+            continue;
+        }
+        if (sscanf(item.c_str(), "%ux%u%c", &width, &height, &end) != 2 || width == 0 || height == 0 || (width | height) & 1)
+            return false;
+        scales.push_back(Argus::Size2D<uint32_t>(width, height));
+    }
+    return !scales.empty();
+}
+
+/* A crop as WxH+X+Y, or full */
+static string formatCrop(const Argus::Rectangle<uint32_t>& crop) {
+    if (crop.area() == 0)
+        return "full";
+    stringstream ss;
+    ss << crop.width() << "x" << crop.height() << "+" << crop.left() << "+" << crop.top();
+    return ss.str();
+}
+
+/* An ROI map as WxH+X+Y:QP regions separated by /, or none */
+static string formatRois(const vector<RoiRegion>& regions) {
+    if (regions.empty())
+        return "none";
+    stringstream ss;
+    for (size_t i = 0; i < regions.size(); i++)
+        ss << (i ? "/" : "") << formatCrop(regions[i].rect) << ":" << regions[i].qpDelta;
+    return ss.str();
+}
+
+/* Parse a comma separated list of frame rates, 0 runs a camera at the sensor mode's rate */
+static bool parseRateList(const char *arg, vector<double>& rates) {
+    stringstream ss(arg);
+    string item;
+    rates.clear();
+    while (getline(ss, item, ',')) {
+        char *end = NULL;
+        double rate = strtod(item.c_str(), &end);
+        if (item.empty() || *end != '\0' || rate < 0)
+            return false;
+        rates.push_back(rate);
+    }
+    return !rates.empty();
+}
+
+/* Parse a comma separated list of MIN-MAX or fixed ranges, auto leaves a camera's range to the sensor mode
+   and is stored as an empty range. Values are multiplied by scale */
+template <typename T>
+static bool parseRangeList(const char *arg, vector<Argus::Range<T> >& ranges, double scale) {
+    stringstream ss(arg);
+    string item;
+    ranges.clear();
+    while (getline(ss, item, ',')) {
+        double low, high;
+        char end;
+        if (item == "auto") {
+            ranges.push_back(Argus::Range<T>(0));
+            continue;
+        }
+        int fields = sscanf(item.c_str(), "%lf-%lf%c", &low, &high, &end);
+        if (fields == 1)
+            high = low;
+        else if (fields != 2)
+            return false;
+        if (low <= 0 || high < low)
+            return false;
+        ranges.push_back(Argus::Range<T>((T) (low * scale), (T) (high * scale)));
+    }
+    return !ranges.empty();
+}
+
+/* A range as MIN-MAX after dividing by scale, or auto */
+template <typename T>
+static string formatRange(const Argus::Range<T>& range, double scale) {
+    if (range.max() == 0)
+        return "auto";
+    stringstream ss;
+    ss << range.min() / scale << "-" << range.max() / scale;
+    return ss.str();
+}
+
+/* Read a config file of long options, one "name [value]" per line, # starts a comment */
+static bool readConfig(const string& path, vector<string>& args) {
+    ifstream file(path);
+    if (!file.is_open())
+        return false;
+    string line;
+    while (getline(file, line)) {
+        size_t comment = line.find('#');
+        if (comment != string::npos)
+            line.erase(comment);
+        stringstream ss(line);
+        string name, value, extra;
+        if (!(ss >> name))
+            continue;
+        args.push_back("--" + name);
+        if (ss >> value)
+            args.push_back(value);
+        if (ss >> extra)
+            return false;
+    }
+    return true;
+}
+
+/* Parse a comma separated list of backpressure actions, or off */
+static bool parseBackpressure(const char *arg, int& actions) {
+    stringstream ss(arg);
+    string item;
+    actions = 0;
+    if (strcmp(arg, "off") == 0)
+        return true;
+    while (getline(ss, item, ',')) {
+        if (item == "quality")
+            actions |= BACKPRESSURE_QUALITY;
+        else if (item == "stride")
+            actions |= BACKPRESSURE_STRIDE;
+        else if (item == "sets")
+            actions |= BACKPRESSURE_SETS;
+        else
+            return false;
+    }
+    return actions != 0;
+}
+
 /* Default destructor, do nothing since there are no heap-allocated member fields */
 Options::~Options() {
     delete[] directory;
@@ -75,11 +579,178 @@ void Options::printHelp() {
          << "  cam1" << endl
          << "  ..." << endl
          << "  options.txt" << endl
-         << endl << "  --save-every\t\t-s\t<1-inf>\t\tSave every s frames from the stream. [Default: " << DEFAULT_SAVE_EVERY << "]" << endl
-         << "Default will save every frame, if s == 2 then every second frame is saved, etc." << endl
+         << endl << "  --format\t\t-f\t<jpeg, raw, h264 or h265>\tOutput format for saved frames. [Default: jpeg]" << endl
+         << "jpeg: one hardware encoded imageNNNNNN.jpg per frame." << endl
+         << "raw: uncompressed pitch-linear YUV420 records appended to camN/frames.raw, indexed by camN/frames.idx." << endl
+         << endl << "  --raw-layout\t\t\t<i420, nv12 or bayer12>\tPlanes of the raw records, the VIC converts each frame while the previous one is written; bayer12 packs the sensor's samples with the ISP bypassed. [Default: i420]" << endl
+         << "h264/h265: hardware encoded elementary stream per camera in camN/stream.h264 or camN/stream.h265." << endl
+         << endl << "  --bitrate\t\t\t<1-inf>\t\tVideo bitrate per camera in Mbit/s for h264/h265. [Default: " << DEFAULT_BITRATE << "]" << endl
+         << endl << "  --idr-interval\t\t<1-inf>\t\tFrames between IDR frames for h264/h265. [Default: " << DEFAULT_IDR_INTERVAL << "]" << endl
+         << endl << "  --max-perf\t\t\tNone\t\tRun the video encoder at maximum clocks for h264/h265." << endl
+         << endl << "  --dq-loops\t\t\t<0-" << MAX_DQ_LOOPS << ">\t\tThreads poll()ing every video encoder's bitstream plane, 0 for a thread per encoder. [Default: " << DEFAULT_DQ_LOOPS << "]" << endl
+         << endl << "  --roi\t\t\t\t<list>\t\tComma separated ROI maps weighting each camera's bitrate for h264/h265. [Default: none]" << endl
+         << "Each map is up to " << MAX_ROI_REGIONS << " WxH+X+Y:QP regions separated by /, in capture pixels. A negative QP delta spends more bits on a region." << endl
+         << endl << "  --roi-saliency\t\t<0-inf>\t\tFrames between refreshes of an ROI map from each frame's detail for h264/h265, 0 for static maps only. [Default: " << DEFAULT_ROI_SALIENCY << "]" << endl
+         << endl << "  --encoders\t\t\t<1-inf>\t\tJPEG encoder workers shared by all cameras for jpeg. [Default: " << DEFAULT_ENCODE_WORKERS << "]" << endl
+         << endl << "  --encode-policy\t\t<rr, oldest or steal>\tOrder in which the encoder workers service the cameras for jpeg. [Default: rr]" << endl
+         << "rr: round-robin over the cameras with queued frames. oldest: the longest waiting frame first." << endl
+         << "steal: each worker serves its own cameras oldest first and takes from the longest other queue when they are empty." << endl
+         << endl << "  --container\t\t-c\t<0-inf>\t\tAppend JPEG images to one container per camera, rotated every c GB. [Default: " << DEFAULT_CONTAINER_SIZE << "]" << endl
+         << "Writes camN/framesNNN.mjpg with a camN/framesNNN.idx offset/timestamp index. 0 writes one file per image." << endl
+         << endl << "  --fanout\t\t\t<0-inf>\t\tImage files per sub-directory of each camera directory, e.g. camN/0012/image012345.jpg. [Default: " << DEFAULT_FANOUT << "]" << endl
+         << "Keeps directories small on long runs, the next sub-directory is made ahead. 0 writes every image into camN." << endl
+         << endl << "  --quality\t\t\t<list>\t\tComma separated JPEG quality per camera, 1-100, camera i takes entry i modulo the list. [Default: " << JPEG_QUALITY << "]" << endl
+         << endl << "  --quality-budget\t\t<list>\t\tComma separated KiB per JPEG image per camera, in the same way. [Default: " << DEFAULT_QUALITY_BUDGET << "]" << endl
+         << "The camera's quality then starts at --quality and is adjusted from the encoded sizes to meet the budget. 0 keeps it fixed." << endl
+         << endl << "  --restart-rows\t\t<0-inf>\t\tMCU rows per JPEG restart interval, for decoding each image on several cores. [Default: " << DEFAULT_RESTART_ROWS << "]" << endl
+         << "The offset of every restart marker is written to camN/restarts.csv. 0 writes no restart markers." << endl
+         << endl << "  --crop\t\t\t<list>\t\tComma separated WxH+X+Y rectangles each camera's JPEG images are cropped to, in the same way. [Default: full]" << endl
+         << "Applied by the hardware encoder, full leaves a camera uncropped. Sizes and offsets must be even." << endl
+         << endl << "  --scale\t\t\t<list>\t\tComma separated WxH sizes each camera's JPEG images are scaled down to after cropping. [Default: full]" << endl
+         << "Applied by the hardware encoder, full keeps the crop size. Sizes must be even." << endl
+         << endl << "  --proxy\t\t\t<WxH>\t\tAlso encode a WxH proxy of each JPEG image into camN/proxies000.mjpg for quick review. [Default: off]" << endl
+         << "A second, scaled hardware encode of the same dmabuf, indexed like a container. Skipped while frames wait for the camera." << endl
+         << endl << "  --proxy-every\t\t\t<1-inf>\t\tEncode a proxy of every n-th saved image. [Default: " << DEFAULT_PROXY_EVERY << "]" << endl
+         << endl << "  --proxy-budget\t\t<1-100>\t\tMost percent of each encoder worker's time spent on proxies. [Default: " << DEFAULT_PROXY_BUDGET << "]" << endl
+         << endl << "  --direct-io\t\t\tNone\t\tKeep saved frames out of the page cache so writeback can't stall the system." << endl
+         << "JPEG images and containers are preallocated and written with O_DIRECT, or written back and dropped from the cache" << endl
+         << "right away where the file system refuses O_DIRECT. Raw and video files are written back every " << (WRITE_BEHIND_WINDOW >> 20) << " MiB." << endl
+         << endl << "  --aio\t\t\t\t<0-inf>\t\tJPEG image writes kept in flight per camera with Linux AIO, needs --direct-io. [Default: " << DEFAULT_AIO_DEPTH << "]" << endl
+         << "Writes are submitted and completed in batches, status.json shows the writes in flight and their latency. 0 writes synchronously." << endl
+         << endl << "  --sync-interval\t\t<0-inf>\t\tMs between group commits making the saved images crash safe. [Default: " << DEFAULT_SYNC_INTERVAL << "]" << endl
+         << "Each commit fdatasyncs the images and container segments written since the last one together, fsyncs their directories" << endl
+         << "and records the highest durable image index in camN/committed. 0 never syncs." << endl
+         << endl << "  --segment\t\t\t<N>m|<N>g\tStart a new segNNN directory every N minutes or every N GB of JPEG images. [Default: off]" << endl
+         << "Each segment has its own camN directories, containers, checksums and options.txt snapshot, the next one is created ahead." << endl
+         << endl << "  --offload\t\t\t<host:port>\tSend every closed segment to host:port over TCP as a tar stream while recording, needs --segment. [Default: off]" << endl
+         << "Runs at idle CPU and I/O priority and pauses while a writer queue fills. Receive with e.g. socat TCP-LISTEN:port,fork EXEC:\"tar x\"." << endl
+         << endl << "  --offload-rate\t\t<0-inf>\t\tMost MiB/s the offload sends. 0 is unlimited. [Default: " << DEFAULT_OFFLOAD_RATE << "]" << endl
+         << endl << "  --save-every\t\t-s\t<list>\t\tComma separated, save every s frames from the stream, camera i takes entry i modulo the list. [Default: " << DEFAULT_SAVE_EVERY << "]" << endl
+         << "If s == 1 every frame is saved, if s == 2 then every second frame is saved, etc." << endl
+         << "The sensor frame duration is stretched s times so only saved frames are captured and processed." << endl
+         << endl << "  --full-rate\t\t\tNone\t\tRun the sensor at full rate and discard unsaved frames instead." << endl
+         << "Costs ISP and acquire work on every frame but keeps AE/AWB converging at the full frame rate." << endl
+         << endl << "  --frame-rate\t\t\t<list>\t\tComma separated sensor frame rate per camera before --save-every, in the same way. [Default: 0]" << endl
+         << "0 runs a camera at the sensor mode's rate, the rate cannot exceed it." << endl
+         << endl << "  --exposure\t\t\t<list>\t\tComma separated MIN-MAX exposure time range in us per camera, in the same way. [Default: auto]" << endl
+         << endl << "  --gain\t\t\t<list>\t\tComma separated MIN-MAX analog gain range per camera, in the same way. [Default: auto]" << endl
+         << "A single value fixes the exposure or gain, auto leaves the sensor mode's range to AE." << endl
+         << endl << "  --ae-lock\t\t\t<list>\t\tComma separated 0 or 1 per camera, 1 locks AE once the warm-up has converged, in the same way. [Default: 0]" << endl
+         << endl << "  --denoise\t\t\t<list>\t\tComma separated ISP noise reduction per camera, off, fast or hq with an optional :<0-1> strength, in the same way. [Default: ISP's]" << endl
+         << "Noisy low-light frames encode into much larger JPEGs, hq may lower the capture rate." << endl
+         << endl << "  --tnr\t\t\t\t<list>\t\tComma separated VIC temporal noise reduction per camera, in the same way. [Default: off]" << endl
+         << "off, original, outdoor-low, outdoor-medium, outdoor-high, indoor-low, indoor-medium or indoor-high, by scene and light." << endl
+         << "Runs instead of the blit into the dmabuf ring, so it needs the copy --zero-copy skips." << endl
+         << endl << "  --grayscale\t\t\t<list>\t\tComma separated 0 or 1 per camera, 1 keeps only the luma plane, in the same way. [Default: 0]" << endl
+         << "Single component JPEGs or one plane raw records, the chroma is never copied into the dmabuf ring." << endl
+         << "The crop, scale and JPEG quality of each camera are set with --crop, --scale and --quality." << endl
+         << endl << "  --write-queue\t\t-w\t<1-inf>\t\tEncoded images buffered per camera while waiting to be written. [Default: " << DEFAULT_WRITE_QUEUE << "]" << endl
+         << "Frames arriving while every buffer is queued are dropped and counted in the log." << endl
+         << endl << "  --dmabuf-ring\t\t-b\t<1-inf>\t\tNvBuffers per camera used as copy targets for the encoder. [Default: " << DEFAULT_DMABUF_RING << "]" << endl
+         << "Two or more let the copy of the next frame overlap the encode of the current one." << endl
+         << endl << "  --zero-copy\t\t\tNone\t\tCapture into NvBuffers handed to the encoder or writer without a copy." << endl
+         << "Saved frames are only copied into the dmabuf ring when Argus would otherwise run out of capture buffers." << endl
+         << endl << "  --capture-buffers\t\t<2-inf>\t\tNvBuffers per camera Argus captures into with --zero-copy. [Default: dmabuf ring + 2]" << endl
+         << "Enough to cover every frame queued downstream plus one for Argus means no frame is ever copied." << endl
+         << endl << "  --egl-fifo\t\t\t<list>\t\tComma separated EGLStream FIFO length per camera, camera i takes entry i modulo the list. [Default: " << DEFAULT_EGL_FIFO << "]" << endl
+         << "A FIFO holds that many completed frames for a late consumer instead of replacing the unacquired one, 0 keeps the mailbox." << endl
+         << endl << "  --memory-budget\t\t<0-inf>\t\tMiB the NvBuffers and buffer pools may take together, 0 for no limit. [Default: " << DEFAULT_MEMORY_BUDGET << "]" << endl
+         << "Startup fails with the size of each subsystem if the configuration cannot fit, the peak of each is logged at the end." << endl
+         << endl << "  --mlock\t\t\tNone\t\tLock the CPU-side buffer pools into memory so they are never paged or reclaimed." << endl
+         << endl << "  --sync-session\t\t\tNone\t\tCapture every camera from one session with one repeating request." << endl
+         << "All sensors are triggered together so frames from one request carry matching timestamps." << endl
+         << endl << "  --stagger\t\t\tNone\t\tSpread the cameras' frames evenly over the saved frame period instead of capturing them together." << endl
+         << "Each camera starts its repeats and, with --full-rate, picks its saved frames a step later, so NVJPG and the writer see a steady load." << endl
+         << endl << "  --frame-sets\t\t\t<0-inf>\t\tGroup the cameras' frames into sets whose sensor timestamps lie within this many us. [Default: " << DEFAULT_FRAME_SET_TOLERANCE << "]" << endl
+         << "Writes sets.csv in the root directory with the image index of each camera per set. 0 disables grouping." << endl
+         << endl << "  --set-policy\t\t\t<drop or partial>\tWhat to do with a frame set missing a camera. [Default: drop]" << endl
+         << "drop: leave it out of sets.csv. partial: write it with the missing cameras left empty." << endl
+         << endl << "  --composite\t\t\t<full or WxH>\tTile every frame set into one JPEG image, each camera scaled to a WxH tile. [Default: off]" << endl
+         << "full keeps the capture resolution. Needs --frame-sets, the composites are written as one more camera." << endl
+         << endl << "  --preview\t\t\t<WxH>\t\tAlso capture every camera at WxH and tile the cameras into preview.jpg in the root directory. [Default: off]" << endl
+         << "A second, small stream per session, frames the preview can't keep up with are dropped without slowing the recording." << endl
+         << endl << "  --preview-fps\t\t\t<1-inf>\t\tRate the preview takes frames and rewrites preview.jpg at. [Default: " << DEFAULT_PREVIEW_FPS << "]" << endl
+         << endl << "  --stream-to\t\t\t<host:port>\tStream the preview as low-latency H.264 over RTP/UDP to host:port, needs --preview. [Default: off]" << endl
+         << "Logs the latency from acquire to the last packet sent, each frame carries its capture time for the receiver." << endl
+         << endl << "  --stream-bitrate\t\t<1-inf>\t\tConstant bitrate of the RTP stream in kbit/s, size it to the radio link. [Default: " << DEFAULT_STREAM_BITRATE << "]" << endl
+         << endl << "  --volumes\t\t\t<list>\t\tComma separated mount points the images are spread over. [Default: the volume with the most free space]" << endl
+         << "The run directory is created on each, the first also holds the logs. volumes.csv in the root directory names the volume of every frame." << endl
+         << endl << "  --stripe\t\t\t<camera or frame>\tHow the images are spread over the volumes. [Default: camera]" << endl
+         << "camera: each camera writes to one volume. frame: each camera's frames rotate over the volumes. Containers, raw and video always stripe by camera." << endl
+         << endl << "  --volume-reserve\t\t<0-inf>\t\tMiB kept free on each volume, a volume reaching it fails its cameras over to the next. [Default: " << DEFAULT_VOLUME_RESERVE << "]" << endl
+         << endl << "  --capacity-warn\t\t<0-inf>\t\tMinutes of recording left at which to warn, and with --backpressure save less, 0 off. [Default: " << DEFAULT_CAPACITY_WARN << "]" << endl
+         << "The time left is forecast from each camera's recent image sizes and the volumes' free space, logged every minute and listed in status.json." << endl
+         << endl << "  --backpressure\t\t<list or off>\tHow to degrade when the encoder or storage falls behind. [Default: off]" << endl
+         << "Comma separated actions taken in steps while a camera's backlog stays high, and undone once it drains." << endl
+         << "quality: lower the JPEG quality. stride: save fewer frames. sets: save fewer frames, the same ones on every camera." << endl
+         << "Every step is written to backpressure.csv in the root directory with the frame it took effect at." << endl
+         << endl << "  --thermal-margin\t\t<0-50>\t\tDegrees C below the throttle point at which load is shed to stay cool, 0 off. [Default: " << DEFAULT_THERMAL_MARGIN << "]" << endl
+         << "Steps up the save every, lowers the JPEG quality, then parks cameras while the hottest zone stays within the margin." << endl
+         << "Temperatures, clocks, nvpmodel, board power and frames per joule are written to thermal.csv in the root directory." << endl
+         << endl << "  --acquire-timeout\t\t<1-inf>\t\tFrame periods a consumer waits for a frame before counting a timeout. [Default: " << DEFAULT_ACQUIRE_TIMEOUT << "]" << endl
+         << "Bounds how long stopping a consumer takes, timeouts are logged per camera to expose dead cameras." << endl
+         << endl << "  --camera-restarts\t\t<0-inf>\t\tTimes a camera whose stream fails or stalls is restarted alone, 0 stops the run. [Default: " << DEFAULT_CAMERA_RESTARTS << "]" << endl
+         << "Recreates only that camera's session and stream, the others keep recording. Each outage is logged with its duration." << endl
          << endl << "  --capture-time\t-t\t<0-inf>\t\tRecording time in seconds. [Default: " << DEFAULT_CAPTURE_TIME << "]" << endl
          << "Passing 0 requires the process be killed from an external signal (ctrl+c)." << endl
-         << endl << "  --profile\t\t-p\tNone\t\tEnable encoder profiling." << endl
+         << endl << "  --telemetry\t\t\tNone\t\tWrite a binary per-frame timing record to camN/telemetry.bin." << endl
+         << "Decode with ./TelemetryDump camN/telemetry.bin, which prints one CSV line per frame." << endl
+         << endl << "  --trace\t\t\tNone\t\tWrite a timeline of every pipeline stage to trace.json in the root directory." << endl
+         << "Open it in chrome://tracing or ui.perfetto.dev, each thread keeps its first " << TRACE_BUFFER_SPANS << " spans." << endl
+         << endl << "  --metadata\t\t\tNone\t\tStore the capture metadata of every saved image in camN/metadata.bin." << endl
+         << "Exposure, gains, AWB, timestamps and AE/AWB state. Decode with ./MetadataDump camN/metadata.bin." << endl
+         << endl << "  --exif\t\t\tNone\t\tPut an EXIF header with capture time, exposure, ISO and camera into every JPEG image." << endl
+         << endl << "  --status-interval\t\t<0-inf>\t\tSeconds between rewrites of status.json in the root directory. [Default: " << DEFAULT_STATUS_INTERVAL << "]" << endl
+         << "Holds per-camera fps, bytes/s, queue depth, drops, latency percentiles and the volume's free space. 0 disables it." << endl
+         << endl << "  --bench-storage\t\t<NxKiB@fps>\tReplay N cameras writing KiB images at fps against each volume, then exit. [Default: off]" << endl
+         << "Uses the chosen container, --direct-io and --aio settings for --capture-time seconds per volume, " << STORAGE_BENCH_TIME << " if unset." << endl
+         << "Tests --volumes or every mounted device, reports the sustained rate and tail latency and recommends a --save-every." << endl
+         << endl << "  --bench-json\t\t\t<file>\t\tWrite the --bench-storage results as JSON for make perf-check. [Default: none]" << endl
+         << endl << "  --verify\t\t\t<directory>\tCheck every image of a finished run against its recorded CRC32C on all cores, then exit." << endl
+         << "Other volumes come from the run's options.txt, or --volumes if they are mounted elsewhere now. Problems go to verify.csv." << endl
+         << endl << "  --recover\t\t\tNone\t\tWith --verify, first close the container segments a crash left open." << endl
+         << "Keeps the images of the last valid checkpoint and those after it that still check out, truncates the rest." << endl
+         << endl << "  --config\t\t\t<file>\t\tRead long options from a file first, one \"name [value]\" per line, # starts a comment." << endl
+         << "Options on the command line override those in the file, options.txt lists the result." << endl
+         << endl << "  --control\t\t\t<path>\t\tAccept runtime commands on a Unix socket at path. [Default: off]" << endl
+         << "One command per connection, e.g. echo \"quality 2 80\" | socat - UNIX-CONNECT:path. Commands:" << endl
+         << "quality <camera|all> <1-100>, save-every <camera|all> <1-inf>, pause <camera|all>, resume <camera|all>, show," << endl
+         << "record and stop for every camera at once, and quit. ./StreamCtl path <command> sends one. Changes are appended to options.txt." << endl
+         << endl << "  --daemon\t\t\tNone\t\tKeep the cameras warm until quit, recording only between record and stop on --control." << endl
+         << "Starts paused and ignores --capture-time and SIGHUP, so switching to recording costs one frame instead of the session setup." << endl
+         << endl << "  --leader\t\t\t<port>\t\tLead the StreamCapture of other boards joining on this TCP port, needs --frame-sets. [Default: off]" << endl
+         << "Forwards record, stop, trigger and quit, aligns the boards' clocks and pairs their frame sets into cluster_sets.csv." << endl
+         << endl << "  --followers\t\t\t<1-inf>\t\tBoards the leader waits for before starting every board recording. [Default: " << DEFAULT_FOLLOWERS << "]" << endl
+         << endl << "  --follow\t\t\t<host>:<port>\tJoin a --leader: start paused, record, stop, trigger and quit when it does. [Default: off]" << endl
+         << "Runs until the leader quits and reports every frame set to it, give it the leader's --frame-sets and --trigger." << endl
+         << endl << "  --share\t\t\t<path>\t\tSend each saved frame's dmabuf to subscribers of a Unix socket at path, see SharedFrame.hpp. [Default: off]" << endl
+         << "Each subscriber gets the newest frame of a camera once it released the previous one, so it can never stall the recording." << endl
+         << endl << "  --share-slots\t\t\t<1-inf>\t\tRing slots per camera held for subscribers, added to the dmabuf ring. [Default: " << DEFAULT_SHARE_SLOTS << "]" << endl
+         << endl << "  --quicklook\t\t\t<port>\t\tServe thumbnails of the recently saved images over HTTP on port, needs jpeg format. [Default: off]" << endl
+         << "GET / lists each camera's recent images, /camN/latest.jpg and /camN/<index>.jpg?w=<width> return one downscaled." << endl
+         << endl << "  --quicklook-rate\t\t<1-inf>\t\tThumbnails decoded and encoded per second at most, cached ones are free. [Default: " << DEFAULT_QUICKLOOK_RATE << "]" << endl
+         << endl << "  --paused\t\t\tNone\t\tStart with saving paused, the cameras still capture so AE/AWB stay converged." << endl
+         << "SIGUSR1 pauses or resumes every camera, each resume starts a new segment listed in camN/segments.csv." << endl
+         << endl << "  --trigger\t\t\t<0-inf>\t\tOnly save bursts of this many frames per camera, each started by a trigger. [Default: " << DEFAULT_TRIGGER_FRAMES << "]" << endl
+         << "The sessions stay warm between bursts. SIGUSR2, the control socket's trigger command or --trigger-gpio start a burst," << endl
+         << "which saves every frame the sensors deliver at full quality. 0 records continuously." << endl
+         << endl << "  --trigger-gpio\t\t<0-inf>\t\tAlso start a burst on every rising edge of this sysfs GPIO line. [Default: none]" << endl
+         << endl << "  --pre-trigger\t\t\t<0-inf>\t\tFrames per camera from before each trigger a burst starts with. [Default: " << DEFAULT_PRE_TRIGGER_FRAMES << "]" << endl
+         << "They are held as YUV420 NvBuffers, about 4.7 MB each at 2048x1536, and only encoded once a burst asks for them." << endl
+         << endl << "  --interval\t\t\t<seconds>\tTime-lapse: once warm, stop streaming and take one frame per camera every interval. [Default: off]" << endl
+         << "Each shot is a single capture request with AE and AWB locked at their converged values, the sensors idle in between." << endl
+         << endl << "  --motion-gate\t\t\t<0-255>\t\tSkip frames whose mean luma difference to the last kept frame is below this. [Default: off]" << endl
+         << "Frames are compared at " << MOTION_GATE_WIDTH << "x" << MOTION_GATE_HEIGHT << ", runs of skipped frames are listed in camN/motion.csv." << endl
+         << endl << "  --motion-keep\t\t\t<0-inf>\t\tSeconds after which the motion gate keeps a frame anyway, 0 never does. [Default: " << DEFAULT_MOTION_KEEP << "]" << endl
+         << endl << "  --exposure-gate\t\t<1-100>\t\tPercentage of black or saturated samples in a frame's ISP histogram that makes it unusable. [Default: off]" << endl
+         << endl << "  --exposure-quality\t\t<0-100>\t\tJPEG quality unusable frames are encoded at, 0 skips them, as every other format does. [Default: " << DEFAULT_EXPOSURE_QUALITY << "]" << endl
+         << endl << "  --consumer-cpus\t\t<list>\t\tComma separated cores the consumer threads are pinned to, camera i takes entry i modulo the list. [Default: none]" << endl
+         << endl << "  --writer-cpus\t\t\t<list>\t\tComma separated cores the encoder and writer threads are pinned to, in the same way. [Default: none]" << endl
+         << "On the TX2, cores 1 and 2 are the Denver cores and 0, 3, 4 and 5 the A57 cores." << endl
+         << endl << "  --rt-policy\t\t\t<other, fifo or rr>\tScheduling class of the consumer threads. [Default: other]" << endl
+         << endl << "  --rt-priority\t\t\t<1-99>\t\tReal-time priority of the consumer threads with fifo or rr. [Default: " << DEFAULT_RT_PRIORITY << "]" << endl
+         << "Real-time scheduling needs root or an RLIMIT_RTPRIO allowance." << endl
+         << endl << "  --profile\t\t-p\tNone\t\tEnable encoder and system profiling." << endl
          << endl << "  --verbose\t\t-v\tNone\t\tEnable verbose output." << endl
          << endl << "  --help\t\t-h\tNone\t\tPrint this help." << endl
          << endl;
@@ -88,23 +759,141 @@ void Options::printHelp() {
 /* Parse all command line arguments and validate the inputs */
 bool Options::parse(int argc, char *argv[]) {
 
-    int valid;
+    int valid = true;
+
+    /* Options from a --config file come first so the command line overrides them */
+    vector<string> configArgs;
+    vector<char*> args(1, argv[0]);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            configPath = argv[++i];
+        } else if (strncmp(argv[i], "--config=", 9) == 0) {
+            configPath = argv[i] + 9;
+        } else {
+            continue;
+        }
+        if (!readConfig(configPath, configArgs)) {
+            cout << "Invalid config file " << configPath << ", expected one long option and its value per line" << endl;
+            return false;
+        }
+    }
+    for (size_t i = 0; i < configArgs.size(); i++)
+        args.push_back(&configArgs[i][0]);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--config") == 0 && i + 1 < argc)
+            i++;
+        else if (strncmp(argv[i], "--config=", 9) != 0)
+            args.push_back(argv[i]);
+    }
+    argc = args.size();
+    args.push_back(NULL);
+    argv = args.data();
 
     static struct option long_options[] = {
         /* These options set a flag. */
         {"profile", no_argument, &profile, 1},
         {"verbose", no_argument, &verbose, 1},
         {"help", no_argument, &valid, 0},
+        {"max-perf", no_argument, &maxPerf, 1},
+        {"full-rate", no_argument, &fullRate, 1},
+        {"telemetry", no_argument, &telemetry, 1},
+        {"trace", no_argument, &trace, 1},
+        {"metadata", no_argument, &metadata, 1},
+        {"exif", no_argument, &exif, 1},
+        {"sync-session", no_argument, &syncSession, 1},
+        {"stagger", no_argument, &stagger, 1},
+        {"zero-copy", no_argument, &zeroCopy, 1},
+        {"mlock", no_argument, &memoryLock, 1},
+        {"direct-io", no_argument, &directIo, 1},
+        {"paused", no_argument, &startPaused, 1},
+        {"daemon", no_argument, &daemonMode, 1},
+        {"recover", no_argument, &recover, 1},
         /* These options don’t set a flag. We distinguish them by their indices. */
         {"root-directory", required_argument, NULL, 'r'},
         {"capture-mode",  required_argument, NULL, 'm'},
         {"save-every",  required_argument, NULL, 's'},
         {"capture-time", required_argument, NULL, 't'},
+        {"write-queue", required_argument, NULL, 'w'},
+        {"dmabuf-ring", required_argument, NULL, 'b'},
+        {"format", required_argument, NULL, 'f'},
+        {"container", required_argument, NULL, 'c'},
+        {"fanout", required_argument, NULL, OPT_FANOUT},
+        {"bitrate", required_argument, NULL, OPT_BITRATE},
+        {"idr-interval", required_argument, NULL, OPT_IDR_INTERVAL},
+        {"dq-loops", required_argument, NULL, OPT_DQ_LOOPS},
+        {"roi", required_argument, NULL, OPT_ROI},
+        {"roi-saliency", required_argument, NULL, OPT_ROI_SALIENCY},
+        {"encoders", required_argument, NULL, OPT_ENCODERS},
+        {"encode-policy", required_argument, NULL, OPT_ENCODE_POLICY},
+        {"acquire-timeout", required_argument, NULL, OPT_ACQUIRE_TIMEOUT},
+        {"camera-restarts", required_argument, NULL, OPT_CAMERA_RESTARTS},
+        {"status-interval", required_argument, NULL, OPT_STATUS_INTERVAL},
+        {"consumer-cpus", required_argument, NULL, OPT_CONSUMER_CPUS},
+        {"writer-cpus", required_argument, NULL, OPT_WRITER_CPUS},
+        {"rt-policy", required_argument, NULL, OPT_RT_POLICY},
+        {"rt-priority", required_argument, NULL, OPT_RT_PRIORITY},
+        {"frame-sets", required_argument, NULL, OPT_FRAME_SETS},
+        {"set-policy", required_argument, NULL, OPT_SET_POLICY},
+        {"composite", required_argument, NULL, OPT_COMPOSITE},
+        {"preview", required_argument, NULL, OPT_PREVIEW},
+        {"preview-fps", required_argument, NULL, OPT_PREVIEW_FPS},
+        {"stream-to", required_argument, NULL, OPT_STREAM_TO},
+        {"stream-bitrate", required_argument, NULL, OPT_STREAM_BITRATE},
+        {"volumes", required_argument, NULL, OPT_VOLUMES},
+        {"stripe", required_argument, NULL, OPT_STRIPE},
+        {"volume-reserve", required_argument, NULL, OPT_VOLUME_RESERVE},
+        {"capacity-warn", required_argument, NULL, OPT_CAPACITY_WARN},
+        {"aio", required_argument, NULL, OPT_AIO},
+        {"sync-interval", required_argument, NULL, OPT_SYNC_INTERVAL},
+        {"segment", required_argument, NULL, OPT_SEGMENT},
+        {"offload", required_argument, NULL, OPT_OFFLOAD},
+        {"offload-rate", required_argument, NULL, OPT_OFFLOAD_RATE},
+        {"backpressure", required_argument, NULL, OPT_BACKPRESSURE},
+        {"thermal-margin", required_argument, NULL, OPT_THERMAL_MARGIN},
+        {"quality", required_argument, NULL, OPT_QUALITY},
+        {"quality-budget", required_argument, NULL, OPT_QUALITY_BUDGET},
+        {"restart-rows", required_argument, NULL, OPT_RESTART_ROWS},
+        {"crop", required_argument, NULL, OPT_CROP},
+        {"scale", required_argument, NULL, OPT_SCALE},
+        {"proxy", required_argument, NULL, OPT_PROXY},
+        {"proxy-every", required_argument, NULL, OPT_PROXY_EVERY},
+        {"proxy-budget", required_argument, NULL, OPT_PROXY_BUDGET},
+        {"bench-storage", required_argument, NULL, OPT_BENCH_STORAGE},
+        {"bench-json", required_argument, NULL, OPT_BENCH_JSON},
+        {"frame-rate", required_argument, NULL, OPT_FRAME_RATE},
+        {"exposure", required_argument, NULL, OPT_EXPOSURE},
+        {"gain", required_argument, NULL, OPT_GAIN},
+        {"ae-lock", required_argument, NULL, OPT_AE_LOCK},
+        {"denoise", required_argument, NULL, OPT_DENOISE},
+        {"tnr", required_argument, NULL, OPT_TNR},
+        {"grayscale", required_argument, NULL, OPT_GRAYSCALE},
+        {"egl-fifo", required_argument, NULL, OPT_EGL_FIFO},
+        {"memory-budget", required_argument, NULL, OPT_MEMORY_BUDGET},
+        {"capture-buffers", required_argument, NULL, OPT_CAPTURE_BUFFERS},
+        {"share", required_argument, NULL, OPT_SHARE},
+        {"share-slots", required_argument, NULL, OPT_SHARE_SLOTS},
+        {"quicklook", required_argument, NULL, OPT_QUICKLOOK},
+        {"quicklook-rate", required_argument, NULL, OPT_QUICKLOOK_RATE},
+        {"config", required_argument, NULL, OPT_CONFIG},
+        {"control", required_argument, NULL, OPT_CONTROL},
+        {"trigger", required_argument, NULL, OPT_TRIGGER},
+        {"trigger-gpio", required_argument, NULL, OPT_TRIGGER_GPIO},
+        {"pre-trigger", required_argument, NULL, OPT_PRE_TRIGGER},
+        {"interval", required_argument, NULL, OPT_INTERVAL},
+        {"motion-gate", required_argument, NULL, OPT_MOTION_GATE},
+        {"motion-keep", required_argument, NULL, OPT_MOTION_KEEP},
+        {"exposure-gate", required_argument, NULL, OPT_EXPOSURE_GATE},
+        {"exposure-quality", required_argument, NULL, OPT_EXPOSURE_QUALITY},
+        {"raw-layout", required_argument, NULL, OPT_RAW_LAYOUT},
+        {"verify", required_argument, NULL, OPT_VERIFY},
+        {"leader", required_argument, NULL, OPT_LEADER},
+        {"followers", required_argument, NULL, OPT_FOLLOWERS},
+        {"follow", required_argument, NULL, OPT_FOLLOW},
         {NULL, 0, NULL, 0}
     };
 
     int c;
-    while (valid && (c = getopt_long(argc, argv, "m:r:s:t:pvh", long_options, NULL)) != -1) {
+    while (valid && (c = getopt_long(argc, argv, "m:r:s:t:w:b:f:c:pvh", long_options, NULL)) != -1) {
         switch (c) {
 
             /* Do nothing */
@@ -118,10 +907,6 @@ bool Options::parse(int argc, char *argv[]) {
                     cout << "Invalid sensor mode, expected " << CAPTURE_MODE_0 << " or " << CAPTURE_MODE_1 << endl;
                     valid = false;
                 }
-                if (captureMode == CAPTURE_MODE_1) {
-                    cout << "Selected capture mode temporarily disabled, sorry!" << endl;
-                    valid = false; 
-                }
                 break;
 
             /* Copy and validate passed folder name */
@@ -134,11 +919,10 @@ bool Options::parse(int argc, char *argv[]) {
                 }
                 break;
 
-            /* Get the frame saving frequency */
+            /* Get the frame saving frequency per camera */
             case 's':
-                saveEvery = atoi(optarg);
-                if (saveEvery < 1) {
-                    cout << "Invalid save rate, expected >= 1" << endl;
+                if (!parseIntList(optarg, saveEvery, 1, INT32_MAX)) {
+                    cout << "Invalid save rate list, expected comma separated values >= 1" << endl;
                     valid = false;
                 }
                 break;
@@ -152,47 +936,1371 @@ bool Options::parse(int argc, char *argv[]) {
                 }
                 break;
 
-            /* Enable encoder profiling */
-            case 'p':
-                profile = !DEFAULT_PROFILE;
+            /* Get the number of buffered frames per writer */
+            case 'w':
+                writeQueue = atoi(optarg);
+                if (writeQueue < 1) {
+                    cout << "Invalid write queue depth, expected >= 1" << endl;
+                    valid = false;
+                }
                 break;
 
-            /* Enable verbose output */
-            case 'v':
-                verbose = !DEFAULT_VERBOSE;
+            /* Get the number of NvBuffers per consumer */
+            case 'b':
+                dmabufRing = atoi(optarg);
+                if (dmabufRing < 1) {
+                    cout << "Invalid dmabuf ring size, expected >= 1" << endl;
+                    valid = false;
+                }
                 break;
-        
-            /* Show the help message */
-            case 'h':
-                valid = false;
+
+            /* Get the number of capture buffers per camera */
+            case OPT_CAPTURE_BUFFERS:
+                captureBuffers = atoi(optarg);
+                if (captureBuffers < 2) {
+                    cout << "Invalid capture buffer count, expected >= 2" << endl;
+                    valid = false;
+                }
                 break;
 
-            /* Ignore anything else */
-            default:
+            /* Get the EGLStream FIFO length per camera */
+            case OPT_EGL_FIFO:
+                if (!parseIntList(optarg, eglFifo, 0, INT32_MAX)) {
+                    cout << "Invalid EGLStream FIFO list, expected comma separated values >= 0" << endl;
+                    valid = false;
+                }
                 break;
-        }
-    }
-    return valid;
-}
 
-/* Write to a file options.txt in the root directory */
-void Options::write() {
+            /* Get the memory budget */
+            case OPT_MEMORY_BUDGET:
+                memoryBudget = atoi(optarg);
+                if (memoryBudget < 0) {
+                    cout << "Invalid memory budget, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
 
-    /* Create the file */
-    string filename(directory);
-    filename += "/options.txt";
-    ofstream outputFile;
+            /* Get the output format */
+            case 'f':
+                if (strcmp(optarg, "jpeg") == 0) {
+                    format = FORMAT_JPEG;
+                } else if (strcmp(optarg, "raw") == 0) {
+                    format = FORMAT_RAW;
+                } else if (strcmp(optarg, "h264") == 0) {
+                    format = FORMAT_H264;
+                } else if (strcmp(optarg, "h265") == 0) {
+                    format = FORMAT_H265;
+                } else {
+                    cout << "Invalid format, expected jpeg, raw, h264 or h265" << endl;
+                    valid = false;
+                }
+                break;
 
-    /* Write */
-    outputFile.open(filename);
-    outputFile << "Root directory: " << directory << endl;
-    outputFile << "Capture mode: " << captureMode << endl;
-    if (captureTime == 0)
-        outputFile << "Capture time: inf" << endl;
-    else
-        outputFile << "Capture time: " << captureTime << endl;
-    outputFile << "Profile: " << (bool) profile << endl;
-    outputFile << "Verbose: " << (bool) verbose << endl;
-    outputFile << "Save every: " << saveEvery << endl;
-    outputFile.close();
+            /* Get the plane layout of raw records */
+            case OPT_RAW_LAYOUT:
+                if (strcmp(optarg, "i420") == 0) {
+                    rawLayout = RAW_LAYOUT_I420;
+                } else if (strcmp(optarg, "nv12") == 0) {
+                    rawLayout = RAW_LAYOUT_NV12;
+                } else if (strcmp(optarg, "bayer12") == 0) {
+                    rawLayout = RAW_LAYOUT_BAYER12;
+                } else {
+                    cout << "Invalid raw layout, expected i420, nv12 or bayer12" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the container rotation size */
+            case 'c':
+                containerSize = atoi(optarg);
+                if (containerSize < 0) {
+                    cout << "Invalid container size, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the image files per sub-directory */
+            case OPT_FANOUT:
+                fanout = atoi(optarg);
+                if (fanout < 0) {
+                    cout << "Invalid fan-out, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the video bitrate in Mbit/s */
+            case OPT_BITRATE:
+                bitrate = atoi(optarg);
+                if (bitrate < 1) {
+                    cout << "Invalid bitrate, expected >= 1" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the video IDR interval */
+            case OPT_IDR_INTERVAL:
+                idrInterval = atoi(optarg);
+                if (idrInterval < 1) {
+                    cout << "Invalid IDR interval, expected >= 1" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the number of shared encoder dequeue loops */
+            case OPT_DQ_LOOPS:
+                dqLoops = atoi(optarg);
+                if (dqLoops < 0 || dqLoops > (int) MAX_DQ_LOOPS) {
+                    cout << "Invalid dequeue loops, expected 0-" << MAX_DQ_LOOPS << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the ROI maps per camera */
+            case OPT_ROI:
+                if (!parseRoiList(optarg, rois)) {
+                    cout << "Invalid ROI list, expected comma separated maps of up to " << MAX_ROI_REGIONS
+                         << " <width>x<height>+<left>+<top>:<qp delta> regions separated by /, or none" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the frames between saliency ROI refreshes */
+            case OPT_ROI_SALIENCY:
+                roiSaliency = atoi(optarg);
+                if (roiSaliency < 0) {
+                    cout << "Invalid ROI saliency interval, expected 0-inf" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the number of shared JPEG encoder workers */
+            case OPT_ENCODERS:
+                encodeWorkers = atoi(optarg);
+                if (encodeWorkers < 1) {
+                    cout << "Invalid number of encoders, expected >= 1" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the encoder scheduling policy */
+            case OPT_ENCODE_POLICY:
+                if (strcmp(optarg, "rr") == 0) {
+                    encodePolicy = ENCODE_POLICY_ROUND_ROBIN;
+                } else if (strcmp(optarg, "oldest") == 0) {
+                    encodePolicy = ENCODE_POLICY_OLDEST;
+                } else if (strcmp(optarg, "steal") == 0) {
+                    encodePolicy = ENCODE_POLICY_STEAL;
+                } else {
+                    cout << "Invalid encode policy, expected rr, oldest or steal" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the acquire timeout in frame periods */
+            case OPT_ACQUIRE_TIMEOUT:
+                acquireTimeout = atoi(optarg);
+                if (acquireTimeout < 1) {
+                    cout << "Invalid acquire timeout, expected >= 1" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the restarts allowed per camera */
+            case OPT_CAMERA_RESTARTS:
+                cameraRestarts = atoi(optarg);
+                if (cameraRestarts < 0) {
+                    cout << "Invalid camera restarts, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the status file interval in seconds */
+            case OPT_STATUS_INTERVAL:
+                statusInterval = atoi(optarg);
+                if (statusInterval < 0) {
+                    cout << "Invalid status interval, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the cores the consumers are pinned to */
+            case OPT_CONSUMER_CPUS:
+                if (!parseCpuList(optarg, consumerCpus)) {
+                    cout << "Invalid consumer CPU list, expected comma separated cores below " << sysconf(_SC_NPROCESSORS_CONF) << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the cores the encoders and writers are pinned to */
+            case OPT_WRITER_CPUS:
+                if (!parseCpuList(optarg, writerCpus)) {
+                    cout << "Invalid writer CPU list, expected comma separated cores below " << sysconf(_SC_NPROCESSORS_CONF) << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the consumer scheduling class */
+            case OPT_RT_POLICY:
+                if (strcmp(optarg, "other") == 0) {
+                    rtPolicy = SCHED_OTHER;
+                } else if (strcmp(optarg, "fifo") == 0) {
+                    rtPolicy = SCHED_FIFO;
+                } else if (strcmp(optarg, "rr") == 0) {
+                    rtPolicy = SCHED_RR;
+                } else {
+                    cout << "Invalid scheduling policy, expected other, fifo or rr" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the consumer real-time priority */
+            case OPT_RT_PRIORITY:
+                rtPriority = atoi(optarg);
+                if (rtPriority < sched_get_priority_min(SCHED_FIFO) || rtPriority > sched_get_priority_max(SCHED_FIFO)) {
+                    cout << "Invalid real-time priority, expected " << sched_get_priority_min(SCHED_FIFO)
+                         << "-" << sched_get_priority_max(SCHED_FIFO) << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the frame set grouping tolerance in us */
+            case OPT_FRAME_SETS:
+                frameSetTolerance = atoi(optarg);
+                if (frameSetTolerance < 0) {
+                    cout << "Invalid frame set tolerance, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the incomplete frame set policy */
+            case OPT_SET_POLICY:
+                if (strcmp(optarg, "drop") == 0) {
+                    setPolicy = SET_POLICY_DROP;
+                } else if (strcmp(optarg, "partial") == 0) {
+                    setPolicy = SET_POLICY_PARTIAL;
+                } else {
+                    cout << "Invalid set policy, expected drop or partial" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the preview stream resolution */
+            case OPT_COMPOSITE: {
+                uint32_t width = 0, height = 0;
+                char end;
+                if (strcmp(optarg, "full") == 0) {
+                    composite = 1;
+                    compositeTile = Argus::Size2D<uint32_t>(0, 0);
+                } else if (sscanf(optarg, "%ux%u%c", &width, &height, &end) != 2 || width == 0 || height == 0
+                           || width % 2 || height % 2) {
+                    cout << "Invalid composite tile size, expected full or an even <width>x<height>" << endl;
+                    valid = false;
+                } else {
+                    composite = 1;
+                    compositeTile = Argus::Size2D<uint32_t>(width, height);
+                }
+                break;
+            }
+
+            /* Get the preview stream resolution */
+            case OPT_PREVIEW: {
+                uint32_t width = 0, height = 0;
+                char end;
+                if (sscanf(optarg, "%ux%u%c", &width, &height, &end) != 2 || width == 0 || height == 0) {
+                    cout << "Invalid preview resolution, expected <width>x<height>" << endl;
+                    valid = false;
+                } else {
+                    previewResolution = Argus::Size2D<uint32_t>(width, height);
+                }
+                break;
+            }
+
+            /* Get the preview rate */
+            case OPT_PREVIEW_FPS:
+                previewFps = atoi(optarg);
+                if (previewFps < 1) {
+                    cout << "Invalid preview rate, expected >= 1" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the RTP receiver, the port follows the last colon */
+            case OPT_STREAM_TO: {
+                const char *colon = strrchr(optarg, ':');
+                streamPort = colon ? atoi(colon + 1) : 0;
+                if (!colon || colon == optarg || streamPort < 1 || streamPort > 65535) {
+                    cout << "Invalid stream receiver, expected <host>:<port>" << endl;
+                    valid = false;
+                } else {
+                    streamHost.assign(optarg, colon - optarg);
+                }
+                break;
+            }
+
+            /* Get the RTP stream bitrate in kbit/s */
+            case OPT_STREAM_BITRATE:
+                streamBitrate = atoi(optarg);
+                if (streamBitrate < 1) {
+                    cout << "Invalid stream bitrate, expected >= 1" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the volumes the images are spread over */
+            case OPT_VOLUMES:
+                if (!parseVolumeList(optarg, volumes)) {
+                    cout << "Invalid volume list, expected comma separated existing directories" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the striping policy */
+            case OPT_STRIPE:
+                if (strcmp(optarg, "camera") == 0) {
+                    stripePolicy = STRIPE_CAMERA;
+                } else if (strcmp(optarg, "frame") == 0) {
+                    stripePolicy = STRIPE_FRAME;
+                } else {
+                    cout << "Invalid stripe policy, expected camera or frame" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the free space reserve per volume in MiB */
+            case OPT_VOLUME_RESERVE:
+                volumeReserve = atoi(optarg);
+                if (volumeReserve < 0) {
+                    cout << "Invalid volume reserve, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the recording minutes left at which to warn */
+            case OPT_CAPACITY_WARN:
+                capacityWarn = atoi(optarg);
+                if (capacityWarn < 0) {
+                    cout << "Invalid capacity warning, expected minutes >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the async writes in flight per camera */
+            case OPT_AIO:
+                aioDepth = atoi(optarg);
+                if (aioDepth < 0) {
+                    cout << "Invalid async write depth, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the group commit interval */
+            case OPT_SYNC_INTERVAL:
+                syncInterval = atoi(optarg);
+                if (syncInterval < 0) {
+                    cout << "Invalid sync interval, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the segment length, in minutes or GB */
+            case OPT_SEGMENT: {
+                int length;
+                char unit, end;
+                if (sscanf(optarg, "%d%c%c", &length, &unit, &end) != 2 || length < 1 || (unit != 'm' && unit != 'g')) {
+                    cout << "Invalid segment, expected <minutes>m or <GB>g, e.g. 10m or 4g" << endl;
+                    valid = false;
+                } else {
+                    segmentMinutes = unit == 'm' ? length : 0;
+                    segmentSize = unit == 'g' ? length : 0;
+                }
+                break;
+            }
+
+            /* Get the offload receiver, the port follows the last colon */
+            case OPT_OFFLOAD: {
+                const char *colon = strrchr(optarg, ':');
+                offloadPort = colon ? atoi(colon + 1) : 0;
+                if (!colon || colon == optarg || offloadPort < 1 || offloadPort > 65535) {
+                    cout << "Invalid offload receiver, expected <host>:<port>" << endl;
+                    valid = false;
+                } else {
+                    offloadHost.assign(optarg, colon - optarg);
+                }
+                break;
+            }
+
+            /* Get the offload rate limit in MiB/s */
+            case OPT_OFFLOAD_RATE:
+                offloadRate = atoi(optarg);
+                if (offloadRate < 0) {
+                    cout << "Invalid offload rate, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the backpressure actions */
+            case OPT_BACKPRESSURE:
+                if (!parseBackpressure(optarg, backpressure)) {
+                    cout << "Invalid backpressure actions, expected off or a comma separated list of quality, stride and sets" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the thermal margin */
+            case OPT_THERMAL_MARGIN:
+                thermalMargin = atoi(optarg);
+                if (thermalMargin < 0 || thermalMargin > 50) {
+                    cout << "Invalid thermal margin, expected 0 to 50" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the JPEG quality per camera */
+            case OPT_QUALITY:
+                if (!parseIntList(optarg, quality, 1, 100)) {
+                    cout << "Invalid JPEG quality list, expected comma separated values from 1 to 100" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the JPEG size budget per camera in KiB */
+            case OPT_QUALITY_BUDGET:
+                if (!parseIntList(optarg, qualityBudget, 0, INT32_MAX)) {
+                    cout << "Invalid JPEG budget list, expected comma separated values >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the MCU rows per restart interval */
+            case OPT_RESTART_ROWS:
+                restartRows = atoi(optarg);
+                if (restartRows < 0) {
+                    cout << "Invalid restart rows, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the JPEG crop per camera */
+            case OPT_CROP:
+                if (!parseCropList(optarg, crops)) {
+                    cout << "Invalid crop list, expected comma separated <width>x<height>+<left>+<top> with even values, or full" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the JPEG output size per camera */
+            case OPT_SCALE:
+                if (!parseScaleList(optarg, scales)) {
+                    cout << "Invalid scale list, expected comma separated <width>x<height> with even values, or full" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the proxy resolution */
+            case OPT_PROXY: {
+                uint32_t width, height;
+                char end;
+                if (sscanf(optarg, "%ux%u%c", &width, &height, &end) != 2 || width == 0 || height == 0 || (width | height) & 1) {
+                    cout << "Invalid proxy resolution, expected <width>x<height> with even values" << endl;
+                    valid = false;
+                } else {
+                    proxyResolution = Argus::Size2D<uint32_t>(width, height);
+                }
+                break;
+            }
+
+            /* Get the proxy rate */
+            case OPT_PROXY_EVERY:
+                proxyEvery = atoi(optarg);
+                if (proxyEvery < 1) {
+                    cout << "Invalid proxy rate, expected >= 1" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the share of encoder time proxies may take */
+            case OPT_PROXY_BUDGET:
+                proxyBudget = atoi(optarg);
+                if (proxyBudget < 1 || proxyBudget > 100) {
+                    cout << "Invalid proxy budget, expected 1 to 100" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the write pattern the storage benchmark replays */
+            case OPT_BENCH_STORAGE: {
+                int cameras, size, fps;
+                char end;
+                if (sscanf(optarg, "%dx%d@%d%c", &cameras, &size, &fps, &end) != 3 || cameras < 1 || size < 1 || fps < 1) {
+                    cout << "Invalid storage benchmark, expected <cameras>x<KiB>@<fps>, e.g. 6x600@38" << endl;
+                    valid = false;
+                } else {
+                    benchCameras = cameras;
+                    benchFrameSize = size;
+                    benchFps = fps;
+                }
+                break;
+            }
+
+            /* Get the file the storage benchmark results are written to */
+            case OPT_BENCH_JSON:
+                benchJson = optarg;
+                break;
+
+            /* Get the sensor frame rate per camera */
+            case OPT_FRAME_RATE:
+                if (!parseRateList(optarg, frameRates)) {
+                    cout << "Invalid frame rate list, expected comma separated values >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the exposure time range per camera, given in us and kept in ns */
+            case OPT_EXPOSURE:
+                if (!parseRangeList(optarg, exposureRanges, 1000.0)) {
+                    cout << "Invalid exposure list, expected comma separated <min>-<max> or <value> in us, or auto" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the analog gain range per camera */
+            case OPT_GAIN:
+                if (!parseRangeList(optarg, gainRanges, 1.0)) {
+                    cout << "Invalid gain list, expected comma separated <min>-<max> or <value>, or auto" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the AE lock per camera */
+            case OPT_AE_LOCK:
+                if (!parseIntList(optarg, aeLocks, 0, 1)) {
+                    cout << "Invalid AE lock list, expected comma separated 0 or 1" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the ISP noise reduction per camera */
+            case OPT_DENOISE:
+                if (!parseDenoiseList(optarg, denoiseModes, denoiseStrengths)) {
+                    cout << "Invalid denoise list, expected comma separated off, fast or hq, each with an optional :<0-1> strength" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the temporal noise reduction algorithm per camera */
+            case OPT_TNR:
+                if (!parseTnrList(optarg, tnr)) {
+                    cout << "Invalid TNR list, expected comma separated off, original, outdoor-low, outdoor-medium, outdoor-high, "
+                         << "indoor-low, indoor-medium or indoor-high" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the luma only recording per camera */
+            case OPT_GRAYSCALE:
+                if (!parseIntList(optarg, grayscale, 0, 1)) {
+                    cout << "Invalid grayscale list, expected comma separated 0 or 1" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Config files are read before parsing, one may not include another */
+            case OPT_CONFIG:
+                cout << "Invalid config file, --config cannot be nested" << endl;
+                valid = false;
+                break;
+
+            /* Get the control socket path */
+            case OPT_CONTROL: {
+                struct sockaddr_un address;
+                if (strlen(optarg) == 0 || strlen(optarg) >= sizeof(address.sun_path)) {
+                    cout << "Invalid control socket path, expected 1 to " << sizeof(address.sun_path) - 1 << " characters" << endl;
+                    valid = false;
+                } else {
+                    controlPath = optarg;
+                }
+                break;
+            }
+
+            /* Get the frame sharing socket path */
+            case OPT_SHARE: {
+                struct sockaddr_un address;
+                if (strlen(optarg) == 0 || strlen(optarg) >= sizeof(address.sun_path)) {
+                    cout << "Invalid share socket path, expected 1 to " << sizeof(address.sun_path) - 1 << " characters" << endl;
+                    valid = false;
+                } else {
+                    sharePath = optarg;
+                }
+                break;
+            }
+
+            /* Get the ring slots per camera held for subscribers */
+            case OPT_SHARE_SLOTS:
+                shareSlots = atoi(optarg);
+                if (shareSlots < 1) {
+                    cout << "Invalid share slots, expected >= 1" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the quick-look server's port */
+            case OPT_QUICKLOOK:
+                quickLookPort = atoi(optarg);
+                if (quickLookPort < 1 || quickLookPort > 65535) {
+                    cout << "Invalid quick-look port, expected 1 to 65535" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the thumbnails per second the quick-look server makes at most */
+            case OPT_QUICKLOOK_RATE:
+                quickLookRate = atoi(optarg);
+                if (quickLookRate < 1) {
+                    cout << "Invalid quick-look rate, expected >= 1" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the frames of each triggered burst */
+            case OPT_TRIGGER:
+                triggerFrames = atoi(optarg);
+                if (triggerFrames < 0) {
+                    cout << "Invalid trigger burst, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the GPIO line of the trigger input */
+            case OPT_TRIGGER_GPIO:
+                triggerGpio = atoi(optarg);
+                if (triggerGpio < 0) {
+                    cout << "Invalid trigger GPIO, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the run directory to verify */
+            case OPT_VERIFY:
+                verifyPath = optarg;
+                if (verifyPath.empty()) {
+                    cout << "Invalid run directory to verify" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the port the leader listens on for its followers */
+            case OPT_LEADER:
+                clusterPort = atoi(optarg);
+                if (clusterRole == CLUSTER_ROLE_FOLLOWER) {
+                    cout << "--leader and --follow exclude each other" << endl;
+                    valid = false;
+                } else if (clusterPort < 1 || clusterPort > 65535) {
+                    cout << "Invalid leader port, expected 1 to 65535" << endl;
+                    valid = false;
+                }
+                clusterRole = CLUSTER_ROLE_LEADER;
+                break;
+
+            /* Get the number of followers the leader waits for */
+            case OPT_FOLLOWERS:
+                followers = atoi(optarg);
+                if (followers < 1) {
+                    cout << "Invalid number of followers, expected >= 1" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the leader to follow, the port follows the last colon */
+            case OPT_FOLLOW: {
+                const char *colon = strrchr(optarg, ':');
+                clusterPort = colon ? atoi(colon + 1) : 0;
+                if (clusterRole == CLUSTER_ROLE_LEADER) {
+                    cout << "--leader and --follow exclude each other" << endl;
+                    valid = false;
+                } else if (!colon || colon == optarg || clusterPort < 1 || clusterPort > 65535) {
+                    cout << "Invalid leader, expected <host>:<port>" << endl;
+                    valid = false;
+                } else {
+                    leaderHost.assign(optarg, colon - optarg);
+                }
+                clusterRole = CLUSTER_ROLE_FOLLOWER;
+                break;
+            }
+
+            /* Get the frames held from before each trigger */
+            case OPT_PRE_TRIGGER:
+                preTriggerFrames = atoi(optarg);
+                if (preTriggerFrames < 0) {
+                    cout << "Invalid pre-trigger depth, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the seconds between time-lapse shots */
+            case OPT_INTERVAL: {
+                char *end = NULL;
+                interval = strtod(optarg, &end);
+                if (*end != '\0' || interval <= 0) {
+                    cout << "Invalid interval, expected seconds > 0" << endl;
+                    valid = false;
+                }
+                break;
+            }
+
+            /* Get the score below which frames are skipped */
+            case OPT_MOTION_GATE: {
+                char *end = NULL;
+                motionThreshold = strtod(optarg, &end);
+                if (*end != '\0' || motionThreshold <= 0 || motionThreshold > 255) {
+                    cout << "Invalid motion gate threshold, expected a mean luma difference in (0, 255]" << endl;
+                    valid = false;
+                }
+                break;
+            }
+
+            /* Get the longest time the motion gate skips for */
+            case OPT_MOTION_KEEP:
+                motionKeep = atoi(optarg);
+                if (motionKeep < 0) {
+                    cout << "Invalid motion gate keep interval, expected >= 0" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the percentage of black or saturated samples that makes a frame unusable */
+            case OPT_EXPOSURE_GATE:
+                exposureGate = atoi(optarg);
+                if (exposureGate < 1 || exposureGate > 100) {
+                    cout << "Invalid exposure gate, expected a percentage of samples in 1-100" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Get the JPEG quality unusable frames are encoded at */
+            case OPT_EXPOSURE_QUALITY:
+                exposureQuality = atoi(optarg);
+                if (exposureQuality < 0 || exposureQuality > 100) {
+                    cout << "Invalid exposure quality, expected 0-100" << endl;
+                    valid = false;
+                }
+                break;
+
+            /* Enable encoder and system profiling */
+            case 'p':
+                profile = !DEFAULT_PROFILE;
+                break;
+
+            /* Enable verbose output */
+            case 'v':
+                verbose = !DEFAULT_VERBOSE;
+                break;
+        
+            /* Show the help message */
+            case 'h':
+                valid = false;
+                break;
+
+            /* Ignore anything else */
+            default:
+                break;
+        }
+    }
+
+    /* The kernel only writes O_DIRECT files asynchronously */
+    if (valid && aioDepth > 0 && !directIo) {
+        cout << "--aio needs --direct-io, buffered writes would complete inside io_submit" << endl;
+        valid = false;
+    }
+
+    /* A buffer stream holds every capture until the consumer releases it, there is no mailbox to replace */
+    if (valid && zeroCopy && !eglFifo.empty()) {
+        cout << "--egl-fifo needs EGLStreams, --zero-copy already never replaces a frame" << endl;
+        valid = false;
+    }
+
+    /* TNR replaces the copy into the ring, a handed off capture target is never copied */
+    bool anyTnr = false;
+    for (size_t i = 0; i < tnr.size(); i++)
+        anyTnr = anyTnr || tnr[i] != TNR_OFF;
+    if (valid && zeroCopy && anyTnr) {
+        cout << "--tnr filters the copy into the dmabuf ring, --zero-copy hands captures over without one" << endl;
+        valid = false;
+    }
+
+    /* Luma only slots are the copy into the ring dropping the chroma, Argus and the video encoder need all three planes */
+    bool anyGrayscale = false;
+    for (size_t i = 0; i < grayscale.size(); i++)
+        anyGrayscale = anyGrayscale || grayscale[i];
+    if (valid && anyGrayscale && zeroCopy) {
+        cout << "--grayscale drops the chroma in the copy into the dmabuf ring, --zero-copy hands captures over without one" << endl;
+        valid = false;
+    }
+    if (valid && anyGrayscale && isVideoFormat()) {
+        cout << "--grayscale needs jpeg or raw format, the video encoder takes YUV420 only" << endl;
+        valid = false;
+    }
+
+    /* A composite is one JPEG of a whole frame set, the per camera image settings have nothing to apply to */
+    if (valid && composite && format != FORMAT_JPEG) {
+        cout << "--composite needs jpeg format" << endl;
+        valid = false;
+    }
+    if (valid && composite && frameSetTolerance == 0) {
+        cout << "--composite tiles frame sets, set their tolerance with --frame-sets" << endl;
+        valid = false;
+    }
+    if (valid && composite && (exif || hasEncodeGeometry() || anyGrayscale)) {
+        cout << "--composite encodes the tiled sets, --exif, --crop, --scale, --proxy and --grayscale apply to single camera images" << endl;
+        valid = false;
+    }
+    for (size_t i = 0; valid && i < grayscale.size() * tnr.size(); i++) {  // every pairing of the two lists
+        if (isGrayscale(i) && getTnr(i) != TNR_OFF) {
+            cout << "--tnr filters YUV420 or NV12 frames, camera " << i << " also has --grayscale" << endl;
+            valid = false;
+        }
+    }
+
+    /* Bayer records are the sensor's samples packed on the CPU, every stage that reads YUV pixels is left out */
+    if (valid && rawLayout == RAW_LAYOUT_BAYER12 && format != FORMAT_RAW) {
+        cout << "--raw-layout needs raw format" << endl;
+        valid = false;
+    }
+    if (valid && isBayer() && (zeroCopy || anyTnr || anyGrayscale || motionThreshold > 0 || !sharePath.empty()
+                               || isPreviewEnabled())) {
+        cout << "--raw-layout bayer12 packs the sensor's samples, not with --zero-copy, --tnr, --grayscale, --motion-gate, --share or --preview" << endl;
+        valid = false;
+    }
+
+    if (valid && captureBuffers > 0 && !zeroCopy) {
+        cout << "--capture-buffers needs --zero-copy, an EGLStream allocates its own" << endl;
+        valid = false;
+    }
+
+    /* Proxies are a second JPEG encode */
+    if (valid && isProxyEnabled() && format != FORMAT_JPEG) {
+        cout << "--proxy needs jpeg format" << endl;
+        valid = false;
+    }
+
+    /* Thumbnails are decoded from the saved JPEG images */
+    if (valid && quickLookPort > 0 && format != FORMAT_JPEG) {
+        cout << "--quicklook needs jpeg format" << endl;
+        valid = false;
+    }
+
+    /* Containers hold every image of a camera in one file already */
+    if (valid && fanout > 0 && containerSize > 0) {
+        cout << "--fanout shards image files, it does not apply to --container" << endl;
+        valid = false;
+    }
+
+    /* EXIF headers only go into JPEG images */
+    if (valid && exif && format != FORMAT_JPEG) {
+        cout << "--exif needs jpeg format" << endl;
+        valid = false;
+    }
+
+    /* Restart markers are a JPEG feature */
+    if (valid && restartRows > 0 && format != FORMAT_JPEG) {
+        cout << "--restart-rows needs jpeg format" << endl;
+        valid = false;
+    }
+
+    /* Only JPEG frames have a quality to lower */
+    if (valid && backpressure == (int) BACKPRESSURE_QUALITY && format != FORMAT_JPEG) {
+        cout << "--backpressure quality needs jpeg format, add stride or sets" << endl;
+        valid = false;
+    }
+
+    /* A shared session has one request, so every camera shares its sensor settings */
+    if (valid && syncSession && (frameRates.size() > 1 || exposureRanges.size() > 1 || gainRanges.size() > 1
+                                 || aeLocks.size() > 1 || denoiseModes.size() > 1)) {
+        cout << "--sync-session captures every camera with one request, pass one --frame-rate, --exposure, --gain, --ae-lock and --denoise" << endl;
+        valid = false;
+    }
+    if (valid && syncSession && saveEvery.size() > 1 && !fullRate) {
+        cout << "--sync-session runs every sensor at one rate, saving per camera rates with --full-rate" << endl;
+        fullRate = 1;
+    }
+
+    /* Staggered cameras never capture together, matching timestamps need them synchronized */
+    if (valid && stagger && (syncSession || frameSetTolerance > 0)) {
+        cout << "--stagger offsets every camera's frames, it cannot be combined with --sync-session or --frame-sets" << endl;
+        valid = false;
+    }
+
+    /* A restart recreates one camera's session and EGLStream under its running consumer */
+    if (valid && cameraRestarts > 0 && (syncSession || zeroCopy || isPreviewEnabled())) {
+        cout << "--camera-restarts needs a session and an EGLStream per camera, not --sync-session, --zero-copy or --preview" << endl;
+        valid = false;
+    }
+
+    /* A trigger line and the pre-trigger ring need bursts to start */
+    if (valid && triggerGpio >= 0 && triggerFrames == 0) {
+        cout << "--trigger-gpio needs --trigger with the frames per burst" << endl;
+        valid = false;
+    }
+    if (valid && preTriggerFrames > 0 && triggerFrames == 0) {
+        cout << "--pre-trigger needs --trigger with the frames per burst" << endl;
+        valid = false;
+    }
+
+    /* Time-lapse shots replace the repeating request, frames only arrive when a shot asks for them */
+    if (valid && interval > 0 && (triggerFrames > 0 || isVideoFormat() || cameraRestarts > 0)) {
+        cout << "--interval takes single shots, not with --trigger, h264/h265 format or --camera-restarts" << endl;
+        valid = false;
+    }
+
+    /* A daemon is driven through its control socket and runs until told to quit */
+    if (valid && daemonMode && controlPath.empty()) {
+        cout << "--daemon needs --control, it is started and stopped through the socket" << endl;
+        valid = false;
+    }
+    if (valid && daemonMode) {
+        if (captureTime > 0)
+            cout << "--daemon runs until quit, ignoring --capture-time" << endl;
+        captureTime = 0;
+        startPaused = 1;
+    }
+
+    /* The boards pair their frame sets, every board starts paused until the leader starts them all */
+    if (valid && clusterRole != CLUSTER_ROLE_NONE && (frameSetTolerance == 0 || interval > 0)) {
+        cout << "--leader and --follow pair the boards' frame sets, they need --frame-sets and not --interval" << endl;
+        valid = false;
+    }
+    if (valid && clusterRole == CLUSTER_ROLE_FOLLOWER) {
+        if (captureTime > 0)
+            cout << "--follow runs until the leader quits, ignoring --capture-time" << endl;
+        captureTime = 0;
+        startPaused = 1;
+    }
+    if (valid && clusterRole == CLUSTER_ROLE_LEADER) {
+        clusterRecord = !startPaused; // a paused or daemon leader starts them on record instead
+        startPaused = 1;
+    }
+
+    /* Only closed segments are offloaded */
+    if (valid && offloadPort > 0 && segmentMinutes == 0 && segmentSize == 0) {
+        cout << "--offload sends closed segments, pass --segment as well" << endl;
+        valid = false;
+    }
+
+    /* The RTP stream is encoded from the preview composite */
+    if (valid && streamPort > 0 && !isPreviewEnabled()) {
+        cout << "--stream-to needs a preview stream, pass --preview as well" << endl;
+        valid = false;
+    }
+    return valid;
+}
+
+/* True if frames are recorded with the hardware video encoder */
+bool Options::isVideoFormat() const {
+    return format == FORMAT_H264 || format == FORMAT_H265;
+}
+
+/* True if a preview stream is captured next to the recording */
+/* Size each camera is scaled to in a --composite, the capture resolution for full */
+Argus::Size2D<uint32_t> Options::getCompositeTile() const {
+    return compositeTile.area() > 0 ? compositeTile : captureResolution;
+}
+
+bool Options::isPreviewEnabled() const {
+    return previewResolution.area() > 0;
+}
+
+/* True if raw records hold the sensor's Bayer samples instead of ISP processed YUV */
+bool Options::isBayer() const {
+    return format == FORMAT_RAW && rawLayout == RAW_LAYOUT_BAYER12;
+}
+
+/* Save every n-th frame of camera id */
+int Options::getSaveEvery(uint32_t id) const {
+    return saveEvery.empty() ? DEFAULT_SAVE_EVERY : saveEvery[id % saveEvery.size()];
+}
+
+/* Sensor frames per saved frame camera id's consumer sees, 1 unless the sensor runs at full rate */
+int Options::getFrameStride(uint32_t id) const {
+    return fullRate ? getSaveEvery(id) : 1;
+}
+
+/* Sensor frame duration of camera id in ns, its frame rate stretched by its save every unless at full rate.
+   Only valid once captureFrameDuration holds the sensor mode's shortest frame duration */
+uint64_t Options::getFrameDuration(uint32_t id) const {
+    return getFrameDuration(id, getSaveEvery(id));
+}
+
+/* Sensor frame duration of camera id in ns if it saved every saveEvery-th frame */
+uint64_t Options::getFrameDuration(uint32_t id, int saveEvery) const {
+    double rate = frameRates.empty() ? 0 : frameRates[id % frameRates.size()];
+    uint64_t duration = rate > 0 ? (uint64_t) (1e9 / rate) : captureFrameDuration;
+    if (duration < captureFrameDuration)
+        duration = captureFrameDuration;
+    return fullRate ? duration : duration * saveEvery;
+}
+
+/* Highest frame rate of the selected sensor mode as listed in the help, before Argus reports the real one */
+uint32_t Options::getModeFrameRate() const {
+    return captureMode == (int) CAPTURE_MODE_1 ? CAPTURE_FPS_1 : CAPTURE_FPS_0;
+}
+
+/* With --stagger, the sensor frame within each stride camera id saves: camera i of n is i / n of a saved
+   frame period after camera 0, this is the part of it that is whole sensor frames. 0 for every camera otherwise */
+uint32_t Options::getStaggerFrame(uint32_t id, uint32_t stride) const {
+    if (!stagger || stride <= 1)
+        return 0;
+    return (uint64_t) id * stride / cameraCount % stride;
+}
+
+/* With --stagger, how long after camera 0's the repeats of camera id start in ns: the rest of its offset
+   that is less than a sensor frame. Independent sensors keep the phase while their clocks agree, nothing
+   pulls them back after a drift. 0 for every camera otherwise */
+uint64_t Options::getStaggerDelay(uint32_t id) const {
+    if (!stagger)
+        return 0;
+    uint64_t stride = getFrameStride(id);
+    return (uint64_t) id * stride % cameraCount * getFrameDuration(id) / cameraCount;
+}
+
+/* Exposure time range of camera id in ns, empty to leave it to the sensor mode */
+Argus::Range<uint64_t> Options::getExposureRange(uint32_t id) const {
+    return exposureRanges.empty() ? Argus::Range<uint64_t>(0) : exposureRanges[id % exposureRanges.size()];
+}
+
+/* Analog gain range of camera id, empty to leave it to the sensor mode */
+Argus::Range<float> Options::getGainRange(uint32_t id) const {
+    return gainRanges.empty() ? Argus::Range<float>(0) : gainRanges[id % gainRanges.size()];
+}
+
+/* True if camera id's AE is locked once converged */
+bool Options::isAeLocked(uint32_t id) const {
+    return !aeLocks.empty() && aeLocks[id % aeLocks.size()];
+}
+
+/* True if any camera's request needs more than the sensor mode and frame duration */
+bool Options::hasSensorSettings() const {
+    return !exposureRanges.empty() || !gainRanges.empty() || !aeLocks.empty();
+}
+
+/* ISP noise reduction mode of camera id, a DENOISE_* */
+int Options::getDenoiseMode(uint32_t id) const {
+    return denoiseModes.empty() ? DENOISE_DEFAULT : denoiseModes[id % denoiseModes.size()];
+}
+
+/* ISP noise reduction strength of camera id, negative for the mode's */
+float Options::getDenoiseStrength(uint32_t id) const {
+    return denoiseStrengths.empty() ? -1 : denoiseStrengths[id % denoiseStrengths.size()];
+}
+
+/* Temporal noise reduction algorithm of camera id, TNR_OFF for none */
+int Options::getTnr(uint32_t id) const {
+    return tnr.empty() ? TNR_OFF : tnr[id % tnr.size()];
+}
+
+/* Whether camera id keeps only the luma plane */
+bool Options::isGrayscale(uint32_t id) const {
+    return !grayscale.empty() && grayscale[id % grayscale.size()];
+}
+
+/* Name of a TNR algorithm as --tnr takes it */
+const char *Options::getTnrName(int algorithm) {
+    if (algorithm < 0 || algorithm >= (int) (sizeof(TNR_NAMES) / sizeof(TNR_NAMES[0])))
+        return "off";
+    return TNR_NAMES[algorithm];
+}
+
+/* NvBuffers each camera's buffer stream captures into, by default two more than the ring can hold downstream */
+int Options::getCaptureBuffers() const {
+    return captureBuffers > 0 ? captureBuffers : dmabufRing + CAPTURE_SPARE;
+}
+
+/* EGLStream FIFO length of camera id, 0 for a mailbox */
+int Options::getEglFifo(uint32_t id) const {
+    return eglFifo.empty() ? DEFAULT_EGL_FIFO : eglFifo[id % eglFifo.size()];
+}
+
+/* JPEG quality camera id starts at */
+int Options::getQuality(uint32_t id) const {
+    return quality.empty() ? JPEG_QUALITY : quality[id % quality.size()];
+}
+
+/* Target KiB per JPEG image of camera id, 0 for a fixed quality */
+int Options::getQualityBudget(uint32_t id) const {
+    return qualityBudget.empty() ? DEFAULT_QUALITY_BUDGET : qualityBudget[id % qualityBudget.size()];
+}
+
+/* True if proxies are encoded next to the JPEG images */
+bool Options::isProxyEnabled() const {
+    return proxyResolution.area() > 0;
+}
+
+/* True if any camera's JPEG images are cropped or scaled, or proxies need the encoder rescaled */
+bool Options::hasEncodeGeometry() const {
+    return !crops.empty() || !scales.empty() || isProxyEnabled();
+}
+
+/* Rectangle of the sensor frame camera id encodes, the whole frame unless cropped */
+Argus::Rectangle<uint32_t> Options::getCrop(uint32_t id) const {
+    if (crops.empty() || crops[id % crops.size()].area() == 0)
+        return Argus::Rectangle<uint32_t>(0, 0, captureResolution.width(), captureResolution.height());
+    return crops[id % crops.size()];
+}
+
+/* Static ROI regions of camera id's video, empty unless --roi set some */
+const vector<RoiRegion>& Options::getRois(uint32_t id) const {
+    static const vector<RoiRegion> none;
+    if (rois.empty())
+        return none;
+    return rois[id % rois.size()];
+}
+
+/* Size of camera id's JPEG images, the crop size unless scaled */
+Argus::Size2D<uint32_t> Options::getEncodeSize(uint32_t id) const {
+    if (scales.empty() || scales[id % scales.size()].area() == 0) {
+        Argus::Rectangle<uint32_t> crop = getCrop(id);
+        return Argus::Size2D<uint32_t>(crop.width(), crop.height());
+    }
+    return scales[id % scales.size()];
+}
+
+/* Core consumer id is pinned to, -1 if consumers are not pinned */
+int Options::getConsumerCpu(uint32_t id) const {
+    return consumerCpus.empty() ? -1 : consumerCpus[id % consumerCpus.size()];
+}
+
+/* Core encoder worker or writer id is pinned to, -1 if they are not pinned */
+int Options::getWriterCpu(uint32_t id) const {
+    return writerCpus.empty() ? -1 : writerCpus[id % writerCpus.size()];
+}
+
+/* Write to a file options.txt in the root directory */
+void Options::write() {
+
+    /* Create the file */
+    string filename(directory);
+    filename += "/options.txt";
+    ofstream outputFile;
+
+    /* Write */
+    outputFile.open(filename);
+    outputFile << "Root directory: " << directory << endl;
+    outputFile << "Capture mode: " << captureMode << endl;
+    outputFile << "Capture resolution: " << captureResolution.width() << "x" << captureResolution.height() << endl;
+    outputFile << "Frame duration: " << captureFrameDuration << " ns" << endl;
+    if (captureTime == 0)
+        outputFile << "Capture time: inf" << endl;
+    else
+        outputFile << "Capture time: " << captureTime << endl;
+    outputFile << "Profile: " << (bool) profile << endl;
+    outputFile << "Telemetry: " << (bool) telemetry << endl;
+    outputFile << "Trace: " << (bool) trace << endl;
+    outputFile << "Metadata: " << (bool) metadata << endl;
+    outputFile << "EXIF: " << (bool) exif << endl;
+    outputFile << "Status interval: " << statusInterval << " s" << endl;
+    outputFile << "Verbose: " << (bool) verbose << endl;
+    outputFile << "Save every:";
+    for (size_t i = 0; i < saveEvery.size(); i++)
+        outputFile << (i ? "," : " ") << saveEvery[i];
+    outputFile << (saveEvery.empty() ? " " + to_string(DEFAULT_SAVE_EVERY) : "") << endl;
+    outputFile << "Frame rate:";
+    for (size_t i = 0; i < frameRates.size(); i++)
+        outputFile << (i ? "," : " ") << frameRates[i];
+    outputFile << (frameRates.empty() ? " 0" : "") << " fps" << endl;
+    outputFile << "Exposure:";
+    for (size_t i = 0; i < exposureRanges.size(); i++)
+        outputFile << (i ? "," : " ") << formatRange(exposureRanges[i], 1000.0);
+    outputFile << (exposureRanges.empty() ? " auto" : "") << " us" << endl;
+    outputFile << "Gain:";
+    for (size_t i = 0; i < gainRanges.size(); i++)
+        outputFile << (i ? "," : " ") << formatRange(gainRanges[i], 1.0);
+    outputFile << (gainRanges.empty() ? " auto" : "") << endl;
+    outputFile << "AE lock:";
+    for (size_t i = 0; i < aeLocks.size(); i++)
+        outputFile << (i ? "," : " ") << aeLocks[i];
+    outputFile << (aeLocks.empty() ? " 0" : "") << endl;
+    outputFile << "Denoise:";
+    for (size_t i = 0; i < denoiseModes.size(); i++)
+        outputFile << (i ? "," : " ") << formatDenoise(denoiseModes[i], denoiseStrengths[i]);
+    outputFile << (denoiseModes.empty() ? " ISP default" : "") << endl;
+    outputFile << "TNR:";
+    for (size_t i = 0; i < tnr.size(); i++)
+        outputFile << (i ? "," : " ") << getTnrName(tnr[i]);
+    outputFile << (tnr.empty() ? " off" : "") << endl;
+    outputFile << "Grayscale:";
+    for (size_t i = 0; i < grayscale.size(); i++)
+        outputFile << (i ? "," : " ") << grayscale[i];
+    outputFile << (grayscale.empty() ? " 0" : "") << endl;
+    outputFile << "Full rate: " << (bool) fullRate << endl;
+    outputFile << "Write queue: " << writeQueue << endl;
+    outputFile << "Dmabuf ring: " << dmabufRing << endl;
+    outputFile << "Zero copy: " << (bool) zeroCopy << endl;
+    if (zeroCopy)
+        outputFile << "Capture buffers: " << getCaptureBuffers() << endl;
+    outputFile << "EGL FIFO:";
+    for (size_t i = 0; i < eglFifo.size(); i++)
+        outputFile << (i ? "," : " ") << eglFifo[i];
+    outputFile << (eglFifo.empty() ? " " + to_string(DEFAULT_EGL_FIFO) : "") << endl;
+    outputFile << "Memory budget: " << (memoryBudget ? to_string(memoryBudget) + " MiB" : "none") << endl;
+    outputFile << "Memory lock: " << (bool) memoryLock << endl;
+    outputFile << "Sync session: " << (bool) syncSession << endl;
+    outputFile << "Stagger: " << (bool) stagger << endl;
+    outputFile << "Frame set tolerance: " << frameSetTolerance << " us" << endl;
+    if (frameSetTolerance > 0)
+        outputFile << "Set policy: " << (setPolicy == SET_POLICY_PARTIAL ? "partial" : "drop") << endl;
+    if (composite)
+        outputFile << "Composite: " << getCompositeTile().width() << "x" << getCompositeTile().height() << " tiles" << endl;
+    else
+        outputFile << "Composite: off" << endl;
+    if (isPreviewEnabled())
+        outputFile << "Preview: " << previewResolution.width() << "x" << previewResolution.height()
+                   << " @ " << previewFps << " fps" << endl;
+    else
+        outputFile << "Preview: off" << endl;
+    if (streamPort > 0)
+        outputFile << "Stream: " << streamHost << ":" << streamPort << " @ " << streamBitrate << " kbit/s" << endl;
+    outputFile << "Acquire timeout: " << acquireTimeout << " frames" << endl;
+    outputFile << "Camera restarts: " << cameraRestarts << endl;
+    const char *formats[] = {"jpeg", "raw", "h264", "h265"};
+    outputFile << "Format: " << formats[format] << endl;
+    if (format == FORMAT_RAW)
+        outputFile << "Raw layout: " << (rawLayout == RAW_LAYOUT_BAYER12 ? "bayer12" : rawLayout == RAW_LAYOUT_NV12 ? "nv12" : "i420") << endl;
+    if (isBayer())
+        outputFile << "Capture bit depth: " << captureBitDepth << endl;
+    if (isVideoFormat()) {
+        outputFile << "Bitrate: " << bitrate << " Mbit/s" << endl;
+        outputFile << "IDR interval: " << idrInterval << endl;
+        outputFile << "Max perf: " << (bool) maxPerf << endl;
+        outputFile << "Dequeue loops: " << dqLoops << endl;
+        outputFile << "ROI:";
+        for (size_t i = 0; i < rois.size(); i++)
+            outputFile << (i ? "," : " ") << formatRois(rois[i]);
+        outputFile << (rois.empty() ? " none" : "") << endl;
+        outputFile << "ROI saliency: " << roiSaliency << " frames" << endl;
+    } else if (format == FORMAT_JPEG) {
+        outputFile << "Encoders: " << encodeWorkers << endl;
+        outputFile << "Encode policy: " << (encodePolicy == ENCODE_POLICY_OLDEST ? "oldest"
+                                            : encodePolicy == ENCODE_POLICY_STEAL ? "steal" : "rr") << endl;
+        outputFile << "JPEG quality:";
+        for (size_t i = 0; i < quality.size(); i++)
+            outputFile << (i ? "," : " ") << quality[i];
+        outputFile << (quality.empty() ? " " + to_string(JPEG_QUALITY) : "") << endl;
+        outputFile << "Quality budget:";
+        for (size_t i = 0; i < qualityBudget.size(); i++)
+            outputFile << (i ? "," : " ") << qualityBudget[i];
+        outputFile << (qualityBudget.empty() ? " " + to_string(DEFAULT_QUALITY_BUDGET) : "") << " KiB" << endl;
+        outputFile << "Restart rows: " << restartRows << endl;
+        outputFile << "Crop:";
+        for (size_t i = 0; i < crops.size(); i++)
+            outputFile << (i ? "," : " ") << formatCrop(crops[i]);
+        outputFile << (crops.empty() ? " full" : "") << endl;
+        outputFile << "Scale:";
+        for (size_t i = 0; i < scales.size(); i++) {
+            outputFile << (i ? "," : " ");
+            if (scales[i].area() == 0)
+                outputFile << "full";
+            else
+                outputFile << scales[i].width() << "x" << scales[i].height();
+        }
+        outputFile << (scales.empty() ? " full" : "") << endl;
+        if (isProxyEnabled())
+            outputFile << "Proxy: " << proxyResolution.width() << "x" << proxyResolution.height() << " every "
+                       << proxyEvery << ", " << proxyBudget << "% of encoder time" << endl;
+        else
+            outputFile << "Proxy: off" << endl;
+    }
+    outputFile << "Container size: " << containerSize << " GB" << endl;
+    outputFile << "Fan-out: " << fanout << endl;
+    outputFile << "Direct I/O: " << (bool) directIo << endl;
+    outputFile << "Async writes in flight: " << aioDepth << endl;
+    outputFile << "Sync interval: " << syncInterval << " ms" << endl;
+    if (segmentMinutes > 0)
+        outputFile << "Segment: " << segmentMinutes << " min" << endl;
+    else if (segmentSize > 0)
+        outputFile << "Segment: " << segmentSize << " GB" << endl;
+    else
+        outputFile << "Segment: off" << endl;
+    if (offloadPort > 0)
+        outputFile << "Offload: " << offloadHost << ":" << offloadPort << " @ " << offloadRate << " MiB/s" << endl;
+    else
+        outputFile << "Offload: off" << endl;
+    for (size_t i = 0; i < volumes.size(); i++)
+        outputFile << "Volume " << i << ": " << volumes[i] << endl;
+    if (volumes.size() > 1) {
+        outputFile << "Stripe: " << (stripePolicy == STRIPE_FRAME ? "frame" : "camera") << endl;
+        outputFile << "Volume reserve: " << volumeReserve << " MiB" << endl;
+    }
+    outputFile << "Capacity warning: " << capacityWarn << " min" << endl;
+    outputFile << "Backpressure:";
+    if (backpressure & BACKPRESSURE_QUALITY)
+        outputFile << " quality";
+    if (backpressure & BACKPRESSURE_STRIDE)
+        outputFile << " stride";
+    if (backpressure & BACKPRESSURE_SETS)
+        outputFile << " sets";
+    outputFile << (backpressure ? "" : " off") << endl;
+    if (thermalMargin > 0)
+        outputFile << "Thermal margin: " << thermalMargin << " C" << endl;
+    outputFile << "Consumer CPUs:";
+    for (size_t i = 0; i < consumerCpus.size(); i++)
+        outputFile << (i ? "," : " ") << consumerCpus[i];
+    outputFile << (consumerCpus.empty() ? " none" : "") << endl;
+    outputFile << "Writer CPUs:";
+    for (size_t i = 0; i < writerCpus.size(); i++)
+        outputFile << (i ? "," : " ") << writerCpus[i];
+    outputFile << (writerCpus.empty() ? " none" : "") << endl;
+    const char *policies[] = {"other", "fifo", "rr"};
+    outputFile << "RT policy: " << policies[rtPolicy] << endl;
+    if (rtPolicy != SCHED_OTHER)
+        outputFile << "RT priority: " << rtPriority << endl;
+    outputFile << "Config file: " << (configPath.empty() ? "none" : configPath) << endl;
+    outputFile << "Control socket: " << (controlPath.empty() ? "off" : controlPath) << endl;
+    outputFile << "Start paused: " << (bool) startPaused << endl;
+    outputFile << "Daemon: " << (bool) daemonMode << endl;
+    if (clusterRole == CLUSTER_ROLE_LEADER)
+        outputFile << "Cluster: leading " << followers << " followers on port " << clusterPort << endl;
+    else if (clusterRole == CLUSTER_ROLE_FOLLOWER)
+        outputFile << "Cluster: following " << leaderHost << ":" << clusterPort << endl;
+    else
+        outputFile << "Cluster: off" << endl;
+    outputFile << "Share socket: " << (sharePath.empty() ? "off" : sharePath) << endl;
+    if (!sharePath.empty())
+        outputFile << "Share slots: " << shareSlots << endl;
+    if (quickLookPort > 0)
+        outputFile << "Quick-look: port " << quickLookPort << " @ " << quickLookRate << " thumbnails/s" << endl;
+    else
+        outputFile << "Quick-look: off" << endl;
+    if (triggerFrames > 0) {
+        outputFile << "Trigger burst: " << triggerFrames << " frames" << endl;
+        outputFile << "Trigger GPIO: " << (triggerGpio >= 0 ? to_string(triggerGpio) : "none") << endl;
+        outputFile << "Pre-trigger frames: " << preTriggerFrames << endl;
+    } else {
+        outputFile << "Trigger: off" << endl;
+    }
+    if (interval > 0)
+        outputFile << "Interval: " << interval << " s" << endl;
+    else
+        outputFile << "Interval: off" << endl;
+    if (motionThreshold > 0) {
+        outputFile << "Motion gate: " << motionThreshold << endl;
+        outputFile << "Motion gate keep: " << motionKeep << " s" << endl;
+    } else {
+        outputFile << "Motion gate: off" << endl;
+    }
+    if (exposureGate > 0) {
+        outputFile << "Exposure gate: " << exposureGate << "%" << endl;
+        outputFile << "Exposure quality: " << exposureQuality << (exposureQuality ? "" : " (skip)") << endl;
+    } else {
+        outputFile << "Exposure gate: off" << endl;
+    }
+    outputFile.close();
+}
+
+/* Append a change made while recording to options.txt, stamped with the wall clock time */
+void Options::writeChange(const std::string& change) {
+    string filename(directory);
+    filename += "/options.txt";
+    ofstream outputFile(filename, ios::app);
+    time_t now = time(0);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    outputFile << "Changed at " << stamp << ": " << change << endl;
 }
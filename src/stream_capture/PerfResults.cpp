@@ -0,0 +1,33 @@
+/*
+ * PerfResults.cpp
+ *
+ * The workload and flat metrics of one benchmark run, written as JSON with
+ * one metric per line for make perf-check.
+ */
+
+#include "PerfResults.hpp"
+
+#include <stdio.h>
+
+PerfResults::PerfResults(const std::string& bench, const std::string& workload) :
+    _bench(bench),
+    _workload(workload)
+{}
+
+/* Add a metric, written in the order added */
+void PerfResults::add(const std::string& metric, double value) {
+    _metrics.push_back(std::make_pair(metric, value));
+}
+
+/* Write the results to filename, return bool indicating success */
+bool PerfResults::write(const std::string& filename) const {
+    FILE *file = fopen(filename.c_str(), "w");
+    if (!file)
+        return false;
+    fprintf(file, "{\n  \"bench\": \"%s\",\n  \"workload\": \"%s\",\n  \"metrics\": {", _bench.c_str(), _workload.c_str());
+    for (size_t i = 0; i < _metrics.size(); i++)
+        fprintf(file, "%s\n    \"%s\": %.3f", i ? "," : "", _metrics[i].first.c_str(), _metrics[i].second);
+    fprintf(file, "\n  }\n}\n");
+    bool success = !ferror(file);
+    return fclose(file) == 0 && success;
+}
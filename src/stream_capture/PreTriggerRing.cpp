@@ -0,0 +1,76 @@
+/*
+ * PreTriggerRing.cpp
+ *
+ * Holds the most recent frames of one camera while a triggered run waits, so
+ * a burst can start before the trigger. Each held frame is a DmabufRing slot
+ * the consumer copied the frame into; once the ring is full the oldest frame's
+ * slot is reused for the newest, so the memory held is fixed at the depth.
+ */
+
+#include "PreTriggerRing.hpp"
+
+#include "DmabufRing.hpp"
+
+PreTriggerRing::PreTriggerRing(uint32_t depth) :
+    _depth(depth),
+    _frames(depth),
+    _head(0),
+    _size(0),
+    _evicted(0)
+{}
+
+/* Find a slot for the next frame: a free ring slot while the depth is not reached or the ring has
+   none to spare, else the oldest held frame's, which is dropped. False if neither is available */
+bool PreTriggerRing::reserve(DmabufRing& ring, uint32_t& slot, int& fd) {
+    if (_size < _depth && ring.acquire(slot, fd))
+        return true;
+    if (_size == 0)
+        return false;
+    slot = _frames[_head].job.slot;
+    fd = _frames[_head].job.fd;
+    _head = (_head + 1) % _depth;
+    _size--;
+    _evicted++;
+    return true;
+}
+
+/* Hold a frame copied into a reserved slot */
+void PreTriggerRing::push(const HeldFrame& frame) {
+    _frames[(_head + _size) % _depth] = frame;
+    _size++;
+}
+
+/* Take the oldest held frame, its slot is the caller's to submit or release */
+bool PreTriggerRing::pop(HeldFrame& frame) {
+    if (_size == 0)
+        return false;
+    frame = _frames[_head];
+    _head = (_head + 1) % _depth;
+    _size--;
+    return true;
+}
+
+/* The oldest held frame, NULL if none is held */
+const HeldFrame *PreTriggerRing::getOldest() const {
+    return _size ? &_frames[_head] : NULL;
+}
+
+/* Drop every held frame and give the slots back to the ring */
+void PreTriggerRing::clear(DmabufRing& ring) {
+    HeldFrame frame;
+    while (pop(frame))
+        ring.release(frame.job.slot);
+}
+
+uint32_t PreTriggerRing::getDepth() const {
+    return _depth;
+}
+
+uint32_t PreTriggerRing::getSize() const {
+    return _size;
+}
+
+/* Held frames that made room for newer ones */
+uint64_t PreTriggerRing::getEvicted() const {
+    return _evicted;
+}
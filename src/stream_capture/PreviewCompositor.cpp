@@ -0,0 +1,310 @@
+/*
+ * PreviewCompositor.cpp
+ *
+ * The preview-while-recording path. Each camera's session carries a second,
+ * small EGL output stream next to the recording stream. A PreviewSource per
+ * camera drains it: frames arriving sooner than the preview rate allows are
+ * released straight away, the others are copied into a triple buffer so the
+ * compositor never waits on the source and the source never waits on the
+ * compositor. The PreviewCompositor tiles the newest frame of every camera
+ * into one YUV420 grid with NvBufferComposite at the preview rate and hands it
+ * to its PreviewSinks. The streams are EGL mailboxes and the threads run at a
+ * lower nice level, so a slow preview costs preview frames, never recorded ones.
+ */
+
+#include "PreviewCompositor.hpp"
+
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "MemoryBudget.hpp"
+#include "SteadyClock.hpp"
+#include <EGLStream/NV/ImageNativeBuffer.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include <chrono>
+
+using namespace Argus;
+using namespace EGLStream;
+
+#define STDOUT_PRINT true
+#define PREVIEW_NICE 10                 // below the recording threads, which run at nice 0 or real-time
+#define ACQUIRE_TIMEOUT_NS 100000000ULL // bounds how long stopping a source takes
+#define STALE_FRAME_NS 1000000000ULL    // a camera silent this long is left blank in the composite
+
+/* Lower the calling thread's priority, Linux applies the nice value per thread */
+static void lowerPriority() {
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), PREVIEW_NICE);
+}
+
+PreviewSource::PreviewSource(OutputStream *stream, uint32_t id, const Options& options) :
+    _stream(stream),
+    _id(id),
+    _options(options),
+    _interval(1000000000ULL / options.previewFps),
+    _nextTake(0),
+    _back(0),
+    _middle(1),
+    _front(2),
+    _fresh(false),
+    _published(false),
+    _lastFrameTime(0),
+    _framesTaken(0),
+    _framesDropped(0)
+{
+    memset(_buffers, 0, sizeof(_buffers));
+}
+
+PreviewSource::~PreviewSource() {
+    for (uint32_t i = 0; i < PREVIEW_BUFFERS; i++)
+        if (_buffers[i])
+            MemoryBudget::instance().destroyNvBuffer(_buffers[i]);
+}
+
+bool PreviewSource::threadInitialize() {
+    lowerPriority();
+
+    /* Create the frame consumer and wait until it is connected to the stream */
+    _consumer.reset(FrameConsumer::create(_stream));
+    IEGLOutputStream *iEglOutputStream = interface_cast<IEGLOutputStream>(_stream);
+    if (!_consumer || !iEglOutputStream)
+        return false;
+    return iEglOutputStream->waitUntilConnected() == STATUS_OK;
+}
+
+bool PreviewSource::threadExecute() {
+
+    /* Acquire a frame, the timeout lets the thread observe shutdown */
+    IFrameConsumer *iFrameConsumer = interface_cast<IFrameConsumer>(_consumer);
+    UniqueObj<Frame> frame(iFrameConsumer->acquireFrame(ACQUIRE_TIMEOUT_NS));
+    IFrame *iFrame = interface_cast<IFrame>(frame);
+    if (!iFrame)
+        return true;
+
+    /* Frames arriving faster than the preview rate are released untouched */
+    uint64_t time = now();
+    if (time < _nextTake) {
+        _framesDropped++;
+        return true;
+    }
+    _nextTake = std::max(_nextTake + _interval, time);
+
+    /* Create the buffers from the first frame, copy every later one into the back buffer */
+    NV::IImageNativeBuffer *iNativeBuffer = interface_cast<NV::IImageNativeBuffer>(iFrame->getImage());
+    if (!iNativeBuffer)
+        return false;
+    if (!_buffers[_back]) {
+        Size2D<uint32_t> resolution = interface_cast<IEGLOutputStream>(_stream)->getResolution();
+        for (uint32_t i = 0; i < PREVIEW_BUFFERS; i++) {
+            _buffers[i] = MemoryBudget::instance().createNvBuffer(MEMORY_PREVIEW, iNativeBuffer, resolution,
+                                                                  NvBufferColorFormat_YUV420, NvBufferLayout_Pitch);
+            if (_buffers[i] == -1) {
+                _buffers[i] = 0;
+                return false;
+            }
+        }
+    } else if (iNativeBuffer->copyToNvBuffer(_buffers[_back]) != STATUS_OK) {
+        return false;
+    }
+
+    /* Publish the frame, an untaken older frame in the middle buffer is overwritten next time */
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::swap(_back, _middle);
+    _fresh = true;
+    _published = true;
+    _lastFrameTime = time;
+    _framesTaken++;
+    return true;
+}
+
+bool PreviewSource::threadShutdown() {
+    return true;
+}
+
+/* The newest frame and when it arrived, false until the camera delivered a first frame */
+bool PreviewSource::getLatest(int& fd, uint64_t& lastFrameTime) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_published)
+        return false;
+    if (_fresh) {
+        std::swap(_front, _middle);
+        _fresh = false;
+    }
+    fd = _buffers[_front];
+    lastFrameTime = _lastFrameTime;
+    return true;
+}
+
+uint64_t PreviewSource::getFramesTaken() {
+    return _framesTaken;
+}
+
+uint64_t PreviewSource::getFramesDropped() {
+    return _framesDropped;
+}
+
+PreviewCompositor::PreviewCompositor(const Options& options, const std::vector<OutputStream*>& streams) :
+    _options(options),
+    _logger(NULL),
+    _columns(ceil(sqrt(streams.size()))),
+    _composite(0),
+    _interval(1000000000ULL / options.previewFps),
+    _nextComposite(0),
+    _composites(0)
+{
+    for (uint32_t i = 0; i < streams.size(); i++)
+        _sources.push_back(new PreviewSource(streams[i], i, options));
+
+    /* Cameras fill the grid row by row, one preview resolution per cell */
+    uint32_t rows = (streams.size() + _columns - 1) / _columns;
+    Size2D<uint32_t> cell = options.previewResolution;
+    _compositeSize = Size2D<uint32_t>(cell.width() * _columns, cell.height() * rows);
+    memset(&_compositeParam, 0, sizeof(_compositeParam));
+    _compositeParam.composite_flag = NVBUFFER_COMPOSITE;
+    for (uint32_t i = 0; i < streams.size(); i++) {
+        NvBufferRect src = {0, 0, cell.width(), cell.height()};
+        NvBufferRect dst = {(i / _columns) * cell.height(), (i % _columns) * cell.width(), cell.width(), cell.height()};
+        _compositeParam.src_comp_rect[i] = src;
+        _compositeParam.dst_comp_rect[i] = dst;
+        _compositeParam.dst_comp_rect_alpha[i] = 1.0f;
+    }
+}
+
+PreviewCompositor::~PreviewCompositor() {
+    for (uint32_t i = 0; i < _sinks.size(); i++)
+        delete _sinks[i];
+    for (uint32_t i = 0; i < _sources.size(); i++)
+        delete _sources[i];
+    if (_composite)
+        MemoryBudget::instance().destroyNvBuffer(_composite);
+    if (_logger)
+        delete _logger;
+}
+
+/* Add a sink before the compositor is started, the compositor takes ownership */
+void PreviewCompositor::addSink(PreviewSink *sink) {
+    _sinks.push_back(sink);
+}
+
+PreviewSource *PreviewCompositor::getSource(uint32_t id) {
+    return _sources[id];
+}
+
+uint32_t PreviewCompositor::getSourceCount() const {
+    return _sources.size();
+}
+
+uint64_t PreviewCompositor::getComposites() {
+    return _composites;
+}
+
+bool PreviewCompositor::threadInitialize() {
+
+    bool errorOccurred = false;
+    lowerPriority();
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        _logger = new Logger("PREVIEW", _options.directory);
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Allocate the composite, the video and JPEG encoders both take pitch linear YUV420 */
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "Compositing " << _sources.size() << " cameras into " << _compositeSize.width() << "x"
+           << _compositeSize.height() << " at " << _options.previewFps << " fps...";
+        _logger->log(ss.str());
+        NvBufferCreateParams params;
+        memset(&params, 0, sizeof(params));
+        params.width = _compositeSize.width();
+        params.height = _compositeSize.height();
+        params.layout = NvBufferLayout_Pitch;
+        params.colorFormat = NvBufferColorFormat_YUV420;
+        params.nvbuf_tag = NvBufferTag_VIDEO_CONVERT;
+        if ((_composite = MemoryBudget::instance().createNvBuffer(MEMORY_PREVIEW, params)) == -1) {
+            _logger->error("Failed to allocate the preview composite!");
+            _composite = 0;
+            errorOccurred = true;
+        }
+    }
+
+    /* Open the sinks */
+    for (uint32_t i = 0; i < _sinks.size() && !errorOccurred; i++) {
+        if (!_sinks[i]->open(_compositeSize)) {
+            _logger->error("Failed to open a preview sink!");
+            errorOccurred = true;
+        }
+    }
+
+    return !errorOccurred;
+}
+
+bool PreviewCompositor::threadExecute() {
+
+    /* Run at the preview rate, skipping ticks that passed while a sink was busy */
+    uint64_t time = now();
+    if (time < _nextComposite) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(_nextComposite - time));
+        return true;
+    }
+    _nextComposite = std::max(_nextComposite + _interval, time);
+
+    /* Take the newest frame of every camera, cameras that went quiet leave their cell blank */
+    NvBufferCompositeParams compositeParam = _compositeParam;
+    int dmabufs[MAX_COMPOSITE_FRAME];
+    uint32_t count = 0;
+    uint64_t oldest = time;
+    for (uint32_t i = 0; i < _sources.size(); i++) {
+        int fd = 0;
+        uint64_t lastFrameTime = 0;
+        if (!_sources[i]->getLatest(fd, lastFrameTime) || time - lastFrameTime > STALE_FRAME_NS)
+            continue;
+        dmabufs[count] = fd;
+        oldest = std::min(oldest, lastFrameTime);
+        compositeParam.src_comp_rect[count] = _compositeParam.src_comp_rect[i];
+        compositeParam.dst_comp_rect[count] = _compositeParam.dst_comp_rect[i];
+        count++;
+    }
+    if (count == 0)
+        return true;
+    compositeParam.input_buf_count = count;
+    if (NvBufferComposite(dmabufs, _composite, &compositeParam) != 0) {
+        _logger->log("Failed to composite the preview!", STDOUT_PRINT);
+        return true;
+    }
+    _composites++;
+
+    /* A failing sink only costs the preview, the recording carries on */
+    for (uint32_t i = 0; i < _sinks.size(); i++)
+        if (!_sinks[i]->consume(_composite, oldest))
+            _logger->log("A preview sink failed to take the composite", true);
+    return true;
+}
+
+bool PreviewCompositor::threadShutdown() {
+    for (uint32_t i = 0; i < _sinks.size(); i++)
+        _sinks[i]->close();
+
+    std::stringstream ss;
+    ss << "Preview composites: " << _composites;
+    _logger->log(ss.str());
+    for (uint32_t i = 0; i < _sources.size(); i++) {
+        ss.str("");
+        ss << "Camera " << i << " preview frames taken: " << _sources[i]->getFramesTaken()
+           << ", released untouched: " << _sources[i]->getFramesDropped();
+        _logger->log(ss.str());
+    }
+    return true;
+}
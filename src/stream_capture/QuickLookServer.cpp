@@ -0,0 +1,507 @@
+/*
+ * QuickLookServer.cpp
+ *
+ * Thumbnails of the recently saved images over HTTP with --quicklook. The
+ * writers publish each image into a per-camera ring without locks; a request
+ * reads the image back, decodes it in hardware, scales it on the VIC and
+ * encodes the thumbnail again, which an LRU cache keeps. Requests:
+ *
+ *   GET /                          JSON list of each camera's recent images
+ *   GET /camN/latest.jpg[?w=W]     thumbnail of camera N's last saved image
+ *   GET /camN/<index>.jpg[?w=W]    thumbnail of image index, if still recent
+ *
+ * One connection is served at a time and closed after its reply. Thumbnails
+ * not in the cache are limited to --quicklook-rate per second (429) and
+ * refused while a writer queue fills up (503).
+ */
+
+#include "QuickLookServer.hpp"
+
+#include "ThreadPlacement.hpp"
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "MemoryBudget.hpp"
+#include "SteadyClock.hpp"
+#include "NvJpegDecoder.h"
+#include "NvJpegEncoder.h"
+#include "nvbuf_utils.h"
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <sstream>
+
+#define STDOUT_PRINT true
+#define QUICKLOOK_POLL_MS 100   // how often the thread checks for shutdown while idle
+#define QUICKLOOK_READ_RETRIES 4U
+
+static const char *getStatusText(int status) {
+    switch (status) {
+        case 200:
+            return "OK";
+        case 400:
+            return "Bad Request";
+        case 404:
+            return "Not Found";
+        case 405:
+            return "Method Not Allowed";
+        case 429:
+            return "Too Many Requests";
+        case 503:
+            return "Service Unavailable";
+        default:
+            return "Internal Server Error";
+    }
+}
+
+QuickLookServer::QuickLookServer(const Options& options, uint32_t numCameras) :
+    _options(options),
+    _numCameras(numCameras),
+    _logger(NULL),
+    _fd(-1),
+    _recent(new Recent[numCameras * QUICKLOOK_RECENT]),
+    _published(new std::atomic<uint64_t>[numCameras]),
+    _occupancy(0),
+    _jpegDecoder(NULL),
+    _jpegEncoder(NULL),
+    _scaled(-1),
+    _scaledWidth(0),
+    _scaledHeight(0),
+    _output(NULL),
+    _outputCapacity(0),
+    _cacheBytes(0),
+    _tokens(options.quickLookRate),
+    _lastRefill(0),
+    _requests(0),
+    _thumbnails(0),
+    _hits(0),
+    _refused(0)
+{
+    for (uint32_t i = 0; i < numCameras * QUICKLOOK_RECENT; i++)
+        _recent[i].sequence.store(0, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < numCameras; i++)
+        _published[i].store(0, std::memory_order_relaxed);
+}
+
+QuickLookServer::~QuickLookServer() {
+    if (_fd != -1)
+        close(_fd);
+    if (_scaled != -1)
+        MemoryBudget::instance().destroyNvBuffer(_scaled);
+    if (_jpegDecoder)
+        delete _jpegDecoder;
+    if (_jpegEncoder)
+        delete _jpegEncoder;
+    free(_output);
+    delete[] _recent;
+    delete[] _published;
+    if (_logger)
+        delete _logger;
+}
+
+/* Remember an image camera's writer has saved, called by that writer only. Never blocks, a
+   request reading the slot meanwhile notices the sequence changed and reads it again */
+void QuickLookServer::publish(uint32_t camera, uint64_t index, uint64_t timestamp, const char *path, uint64_t offset,
+                              uint64_t size) {
+    size_t length = strlen(path);
+    if (camera >= _numCameras || length >= QUICKLOOK_PATH_MAX)
+        return;
+    uint64_t published = _published[camera].load(std::memory_order_relaxed);
+    Recent& recent = _recent[camera * QUICKLOOK_RECENT + published % QUICKLOOK_RECENT];
+    uint32_t sequence = recent.sequence.load(std::memory_order_relaxed);
+    recent.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    recent.index = index;
+    recent.timestamp = timestamp;
+    recent.offset = offset;
+    recent.size = size;
+    memcpy(recent.path, path, length + 1);
+    recent.sequence.store(sequence + 2, std::memory_order_release);
+    _published[camera].store(published + 1, std::memory_order_release);
+}
+
+/* Highest occupancy of any camera's queues, 0 to 1, the supervisor loop reports it */
+void QuickLookServer::setOccupancy(double occupancy) {
+    _occupancy = (uint32_t) (occupancy * 100);
+}
+
+uint64_t QuickLookServer::getRequests() {
+    return _requests;
+}
+
+uint64_t QuickLookServer::getThumbnails() {
+    return _thumbnails;
+}
+
+bool QuickLookServer::threadInitialize() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        _logger = new Logger("QUICKLOOK", _options.directory);
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Only take CPU time nothing else wants, a failure is logged but not fatal */
+    if (!errorOccurred) {
+        placeThread(-1, SCHED_IDLE, 0, _logger);
+    }
+
+    /* Create the hardware decoder and encoder of the thumbnails */
+    if (!errorOccurred) {
+        _jpegDecoder = NvJPEGDecoder::createJPEGDecoder("quicklookdec");
+        _jpegEncoder = NvJPEGEncoder::createJPEGEncoder("quicklookenc");
+        if (!_jpegDecoder || !_jpegEncoder) {
+            _logger->error("Failed to create the quick-look JPEG decoder and encoder!");
+            errorOccurred = true;
+        }
+    }
+
+    if (!errorOccurred && !openSocket()) {
+        _logger->error("Failed to listen on quick-look port " + std::to_string(_options.quickLookPort) + ": "
+                       + strerror(errno));
+        errorOccurred = true;
+    }
+
+    if (!errorOccurred) {
+        _lastRefill = now();
+        _logger->log("Serving thumbnails on port " + std::to_string(_options.quickLookPort), STDOUT_PRINT);
+    }
+    return !errorOccurred;
+}
+
+/* Serve the next connection, waiting a short while for one */
+bool QuickLookServer::threadExecute() {
+    struct pollfd descriptor = {_fd, POLLIN, 0};
+    if (poll(&descriptor, 1, QUICKLOOK_POLL_MS) <= 0 || !(descriptor.revents & POLLIN))
+        return true;
+    int client = accept4(_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client == -1)
+        return true;
+    struct timeval timeout = {QUICKLOOK_TIMEOUT_MS / 1000, (QUICKLOOK_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    serve(client);
+    close(client);
+    return true;
+}
+
+bool QuickLookServer::threadShutdown() {
+    std::stringstream ss;
+    ss << "Quick-look requests: " << _requests << ", thumbnails made: " << _thumbnails << ", from the cache: " << _hits
+       << ", refused: " << _refused;
+    _logger->log(ss.str(), STDOUT_PRINT);
+    return true;
+}
+
+/* Listen on every address at the quick-look port, return bool indicating success */
+bool QuickLookServer::openSocket() {
+    _fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_fd == -1)
+        return false;
+    int reuse = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(_options.quickLookPort);
+    return bind(_fd, (struct sockaddr *) &address, sizeof(address)) == 0 && listen(_fd, QUICKLOOK_BACKLOG) == 0;
+}
+
+/* Read one request head and answer it */
+void QuickLookServer::serve(int client) {
+    char request[QUICKLOOK_REQUEST_MAX + 1];
+    size_t length = 0;
+    while (length < QUICKLOOK_REQUEST_MAX) {
+        ssize_t received = recv(client, request + length, QUICKLOOK_REQUEST_MAX - length, 0);
+        if (received <= 0)
+            return;
+        length += received;
+        request[length] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+            break;
+    }
+    request[length] = '\0';
+    _requests++;
+
+    /* GET <target> HTTP/1.x, the query only carries the width */
+    char method[8];
+    char target[QUICKLOOK_PATH_MAX];
+    if (sscanf(request, "%7s %255s", method, target) != 2) {
+        reply(client, 400, "text/plain", "Bad request\n", 12);
+        return;
+    }
+    if (strcmp(method, "GET") != 0) {
+        reply(client, 405, "text/plain", "Only GET is served\n", 19, "Allow: GET\r\n");
+        return;
+    }
+    std::string path = target;
+    uint32_t width = QUICKLOOK_WIDTH;
+    size_t query = path.find('?');
+    if (query != std::string::npos) {
+        size_t parameter = path.find("w=", query);
+        if (parameter != std::string::npos)
+            width = std::max(QUICKLOOK_WIDTH_MIN, std::min(QUICKLOOK_WIDTH_MAX, (uint32_t) atoi(path.c_str() + parameter + 2)));
+        path.erase(query);
+    }
+    width &= ~15U; // the encoder and the VIC take widths in multiples of 16
+
+    if (path == "/" || path == "/index.json") {
+        std::string list = listImages();
+        reply(client, 200, "application/json", list.data(), list.size(), "Cache-Control: no-cache\r\n");
+        return;
+    }
+
+    uint32_t camera;
+    char name[QUICKLOOK_PATH_MAX];
+    Image image;
+    if (sscanf(path.c_str(), "/cam%u/%255s", &camera, name) != 2 || camera >= _numCameras
+        || !findImage(camera, name, image)) {
+        reply(client, 404, "text/plain", "No such recent image\n", 21);
+        return;
+    }
+
+    /* A cached thumbnail costs nothing, a new one waits until the recording has room for it */
+    ThumbnailKey key(camera, image.index, width);
+    const Thumbnail *thumbnail = findThumbnail(key);
+    if (thumbnail) {
+        _hits++;
+    } else if (_occupancy > QUICKLOOK_BACKOFF_PERCENT) {
+        _refused++;
+        reply(client, 503, "text/plain", "Recording is busy\n", 18, "Retry-After: 1\r\n");
+        return;
+    } else if (!takeToken()) {
+        _refused++;
+        reply(client, 429, "text/plain", "Too many thumbnails\n", 20, "Retry-After: 1\r\n");
+        return;
+    } else {
+        std::string error;
+        thumbnail = makeThumbnail(key, image, error);
+        if (!thumbnail) {
+            _logger->log("Failed to make a thumbnail of camera " + std::to_string(camera) + " image "
+                         + std::to_string(image.index) + ": " + error);
+            error += "\n";
+            reply(client, 500, "text/plain", error.data(), error.size());
+            return;
+        }
+    }
+
+    /* The latest image changes, a numbered one never does */
+    std::stringstream headers;
+    headers << "X-Image-Index: " << image.index << "\r\nX-Frame-Time: " << image.timestamp << "\r\n";
+    headers << (strcmp(name, "latest.jpg") == 0 ? "Cache-Control: no-cache\r\n" : "Cache-Control: max-age=86400\r\n");
+    reply(client, 200, "image/jpeg", thumbnail->data.data(), thumbnail->data.size(), headers.str().c_str());
+}
+
+/* Send a complete HTTP/1.0 reply, the connection is closed after it */
+void QuickLookServer::reply(int client, int status, const char *type, const void *body, size_t length,
+                            const char *extraHeaders) {
+    char head[512];
+    int headLength = snprintf(head, sizeof(head), "HTTP/1.0 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                              "Connection: close\r\n%s\r\n", status, getStatusText(status), type, length, extraHeaders);
+    if (headLength <= 0 || send(client, head, headLength, MSG_NOSIGNAL | MSG_MORE) != headLength)
+        return;
+    const char *next = (const char *) body;
+    while (length > 0) {
+        ssize_t sent = send(client, next, length, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return;
+        next += sent;
+        length -= sent;
+    }
+}
+
+/* Every camera's recent images, newest first */
+std::string QuickLookServer::listImages() {
+    std::stringstream ss;
+    ss << "{\"cameras\": [";
+    for (uint32_t i = 0; i < _numCameras; i++) {
+        ss << (i ? ", " : "") << "{\"camera\": " << i << ", \"images\": [";
+        uint64_t published = _published[i].load(std::memory_order_acquire);
+        uint64_t oldest = published > QUICKLOOK_RECENT ? published - QUICKLOOK_RECENT : 0;
+        bool first = true;
+        for (uint64_t count = published; count > oldest; count--) {
+            Image image;
+            if (!readRecent(i, count - 1, image))
+                continue;
+            ss << (first ? "" : ", ") << "{\"index\": " << image.index << ", \"timestamp\": " << image.timestamp
+               << ", \"size\": " << image.size << "}";
+            first = false;
+        }
+        ss << "]}";
+    }
+    ss << "]}\n";
+    return ss.str();
+}
+
+/* Resolve latest.jpg or <index>.jpg to one of the camera's recent images */
+bool QuickLookServer::findImage(uint32_t camera, const std::string& name, Image& image) {
+    uint64_t published = _published[camera].load(std::memory_order_acquire);
+    if (published == 0)
+        return false;
+    if (name == "latest.jpg")
+        return readRecent(camera, published - 1, image);
+
+    char *end;
+    uint64_t index = strtoull(name.c_str(), &end, 10);
+    if (end == name.c_str() || strcmp(end, ".jpg") != 0)
+        return false;
+    uint64_t oldest = published > QUICKLOOK_RECENT ? published - QUICKLOOK_RECENT : 0;
+    for (uint64_t count = published; count > oldest; count--)
+        if (readRecent(camera, count - 1, image) && image.index == index)
+            return true;
+    return false;
+}
+
+/* Copy the count-th image the camera published, return bool indicating it is still in the ring
+   and its writer did not overwrite it while copying */
+bool QuickLookServer::readRecent(uint32_t camera, uint64_t count, Image& image) {
+    const Recent& recent = _recent[camera * QUICKLOOK_RECENT + count % QUICKLOOK_RECENT];
+    for (uint32_t attempt = 0; attempt < QUICKLOOK_READ_RETRIES; attempt++) {
+        uint32_t sequence = recent.sequence.load(std::memory_order_acquire);
+        if (sequence == 0)
+            return false;
+        if (sequence & 1)
+            continue;
+        image.index = recent.index;
+        image.timestamp = recent.timestamp;
+        image.offset = recent.offset;
+        image.size = recent.size;
+        memcpy(image.path, recent.path, QUICKLOOK_PATH_MAX);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (recent.sequence.load(std::memory_order_relaxed) != sequence)
+            continue;
+
+        /* Published again since count was taken, the slot holds a newer image now */
+        uint64_t published = _published[camera].load(std::memory_order_acquire);
+        image.path[QUICKLOOK_PATH_MAX - 1] = '\0';
+        return published - count <= QUICKLOOK_RECENT;
+    }
+    return false;
+}
+
+/* Take one thumbnail from the --quicklook-rate token bucket, which holds a second's worth */
+bool QuickLookServer::takeToken() {
+    uint64_t time = now();
+    _tokens = std::min((double) _options.quickLookRate, _tokens + (time - _lastRefill) / 1e9 * _options.quickLookRate);
+    _lastRefill = time;
+    if (_tokens < 1.0)
+        return false;
+    _tokens -= 1.0;
+    return true;
+}
+
+/* The cached thumbnail, moved to the front as the most recently used one, NULL if there is none */
+const QuickLookServer::Thumbnail *QuickLookServer::findThumbnail(const ThumbnailKey& key) {
+    std::map<ThumbnailKey, std::list<Thumbnail>::iterator>::iterator found = _cached.find(key);
+    if (found == _cached.end())
+        return NULL;
+    _cache.splice(_cache.begin(), _cache, found->second);
+    return &_cache.front();
+}
+
+/* Read the image back, decode, scale and encode it again and cache the result, evicting the least
+   recently used thumbnails beyond QUICKLOOK_CACHE_BYTES. NULL with error set on failure */
+const QuickLookServer::Thumbnail *QuickLookServer::makeThumbnail(const ThumbnailKey& key, const Image& image,
+                                                                 std::string& error) {
+    int fd = open(image.path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        error = "failed to open " + std::string(image.path);
+        return NULL;
+    }
+    _input.resize(image.size);
+    ssize_t length = pread(fd, _input.data(), image.size, image.offset);
+
+    /* The recording keeps the page cache, the image is not read again */
+    posix_fadvise(fd, image.offset, image.size, POSIX_FADV_DONTNEED);
+    close(fd);
+    if (length != (ssize_t) image.size) {
+        error = "failed to read " + std::string(image.path);
+        return NULL;
+    }
+
+    int decoded;
+    uint32_t format, width, height;
+    if (_jpegDecoder->decodeToFd(decoded, _input.data(), image.size, format, width, height) != 0) {
+        error = "hardware decode failed";
+        return NULL;
+    }
+    uint32_t targetWidth = std::min(std::get<2>(key), width & ~15U);
+    uint32_t targetHeight;
+    if (!scale(decoded, width, height, targetWidth, targetHeight)) {
+        error = "scaling failed";
+        return NULL;
+    }
+
+    /* libjpeg replaces a buffer it outgrows with its own, keep whichever it left us */
+    if (!_output) {
+        _outputCapacity = QUICKLOOK_WIDTH_MAX * QUICKLOOK_WIDTH_MAX * 3 / 2;
+        _output = (unsigned char *) malloc(_outputCapacity);
+    }
+    unsigned char *data = _output;
+    unsigned long size = _outputCapacity;
+    if (!data || _jpegEncoder->encodeFromFd(_scaled, JCS_YCbCr, &data, size, QUICKLOOK_QUALITY) != 0) {
+        error = "hardware encode failed";
+        return NULL;
+    }
+    if (data != _output) {
+        free(_output);
+        _output = data;
+        _outputCapacity = size;
+    }
+    _thumbnails++;
+
+    Thumbnail thumbnail;
+    thumbnail.key = key;
+    thumbnail.data.assign(data, data + size);
+    _cacheBytes += size;
+    _cache.push_front(thumbnail);
+    _cached[key] = _cache.begin();
+    while (_cacheBytes > QUICKLOOK_CACHE_BYTES && _cache.size() > 1) {
+        _cacheBytes -= _cache.back().data.size();
+        _cached.erase(_cache.back().key);
+        _cache.pop_back();
+    }
+    return &_cache.front();
+}
+
+/* Scale the decoded image into the thumbnail buffer on the VIC, keeping the aspect ratio, return
+   bool indicating success */
+bool QuickLookServer::scale(int source, uint32_t width, uint32_t height, uint32_t targetWidth, uint32_t& targetHeight) {
+    targetHeight = std::max(16U, (uint32_t) ((uint64_t) height * targetWidth / width) & ~1U);
+    if (_scaled == -1 || _scaledWidth != targetWidth || _scaledHeight != targetHeight) {
+        if (_scaled != -1)
+            MemoryBudget::instance().destroyNvBuffer(_scaled);
+        NvBufferCreateParams params;
+        memset(&params, 0, sizeof(params));
+        params.width = targetWidth;
+        params.height = targetHeight;
+        params.payloadType = NvBufferPayload_SurfArray;
+        params.layout = NvBufferLayout_Pitch;
+        params.colorFormat = NvBufferColorFormat_YUV420;
+        params.nvbuf_tag = NvBufferTag_JPEG;
+        if ((_scaled = MemoryBudget::instance().createNvBuffer(MEMORY_PREVIEW, params)) == -1)
+            return false;
+        _scaledWidth = targetWidth;
+        _scaledHeight = targetHeight;
+    }
+    NvBufferTransformParams params;
+    memset(&params, 0, sizeof(params));
+    params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+    params.transform_filter = NvBufferTransform_Filter_Smart;
+    return NvBufferTransform(source, _scaled, &params) == 0;
+}
@@ -0,0 +1,267 @@
+/*
+ * RawWriter.cpp
+ *
+ * Writes one camera's frames uncompressed into a single pre-allocated container
+ * file, bypassing the JPEG encoder. Each dmabuf from the DmabufRing is mapped
+ * once, synced for the CPU per frame and its planes are written straight into
+ * a fixed-size record; a separate index file maps records to frame numbers.
+ */
+
+#include "RawWriter.hpp"
+
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "ThreadPlacement.hpp"
+#include "DmabufRing.hpp"
+#include "TelemetryLog.hpp"
+#include "VolumeSet.hpp"
+#include "SteadyClock.hpp"
+#include <sstream>
+#include <sched.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define STDOUT_PRINT true
+#define POP_TIMEOUT_MS 100      // bounds how long shutdown waits on an idle queue
+#define PREALLOC_RECORDS 256    // container grows by this many records at a time
+#define FILE_MODE 0666
+
+RawWriter::RawWriter(uint32_t id, const Options& options, DmabufRing& ring, TelemetryLog *telemetry,
+                     VolumeSet *volumes) :
+    _id(id),
+    _options(options),
+    _logger(NULL),
+    _ring(ring),
+    _telemetry(telemetry),
+    _volumes(volumes),
+    _volume(-1),
+    _jobs(ring.getCount()),
+    _containerFd(-1),
+    _indexFd(-1),
+    _allocatedRecords(0),
+    _mappings(ring.getCount() * RAW_MAX_PLANES, NULL),
+    _framesWritten(0),
+    _failed(false)
+{
+    memset(&_header, 0, sizeof(_header));
+}
+
+RawWriter::~RawWriter() {
+    if (_containerFd != -1)
+        close(_containerFd);
+    if (_indexFd != -1)
+        close(_indexFd);
+    if (_logger)
+        delete _logger;
+}
+
+bool RawWriter::threadInitialize() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "RAW WRITER " << std::to_string(_id);
+        _logger = new Logger(ss.str(), _options.directory);
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Pin the thread and set its scheduling class, a failure is logged but not fatal */
+    if (!errorOccurred) {
+        placeThread(_options.getWriterCpu(_id), SCHED_OTHER, 0, _logger);
+    }
+
+    return !errorOccurred;
+}
+
+bool RawWriter::threadExecute() {
+    FrameJob job;
+    if (_jobs.pop(job, POP_TIMEOUT_MS))
+        processJob(job);
+    return true;
+}
+
+bool RawWriter::threadShutdown() {
+
+    /* Write anything the consumer submitted before it stopped */
+    FrameJob job;
+    while (_jobs.tryPop(job))
+        processJob(job);
+
+    /* Unmap every ring buffer we touched */
+    for (uint32_t slot = 0; slot < _ring.getCount(); slot++) {
+        for (uint32_t plane = 0; plane < RAW_MAX_PLANES; plane++) {
+            void *&mapping = _mappings[slot * RAW_MAX_PLANES + plane];
+            if (mapping) {
+                NvBufferMemUnMap(_ring.getFd(slot), plane, &mapping);
+                mapping = NULL;
+            }
+        }
+    }
+
+    /* Trim the unused pre-allocation */
+    if (_containerFd != -1) {
+        _behind.finish();
+        if (ftruncate(_containerFd, RAW_HEADER_SIZE + _framesWritten * _header.recordSize) != 0)
+            _logger->error("Failed to trim the raw container!");
+        close(_containerFd);
+        _containerFd = -1;
+    }
+    if (_indexFd != -1) {
+        close(_indexFd);
+        _indexFd = -1;
+    }
+
+    std::stringstream ss;
+    ss << "Raw frames written: " << _framesWritten;
+    _logger->log(ss.str());
+    return true;
+}
+
+/* Queue a copied frame, the slot is released back to the ring once written */
+bool RawWriter::submit(const FrameJob& job) {
+    return _jobs.push(job);
+}
+
+/* True once a write has failed, the owning consumer should stop */
+bool RawWriter::hasFailed() {
+    return _failed;
+}
+
+uint64_t RawWriter::getFramesWritten() {
+    return _framesWritten;
+}
+
+uint64_t RawWriter::getBytesWritten() {
+    return _framesWritten * _header.recordSize;
+}
+
+size_t RawWriter::getQueueDepth() {
+    return _jobs.size();
+}
+
+/* Time to sync and write one record */
+const LatencyHistogram *RawWriter::getLatency() {
+    return &_writeLatency;
+}
+
+/* Create the container and index from the layout of the first buffer */
+bool RawWriter::openContainer(int fd) {
+
+    NvBufferParams params;
+    if (NvBufferGetParams(fd, &params) != 0 || params.num_planes > RAW_MAX_PLANES) {
+        _logger->error("Failed to get the NvBuffer parameters!");
+        return false;
+    }
+    memcpy(_header.magic, RAW_MAGIC, sizeof(_header.magic));
+    _header.colorFormat = params.pixel_format;
+    _header.numPlanes = params.num_planes;
+    _header.recordSize = 0;
+    for (uint32_t i = 0; i < params.num_planes; i++) {
+        _header.width[i] = params.width[i];
+        _header.height[i] = params.height[i];
+        _header.pitch[i] = params.pitch[i];
+        _header.recordSize += (uint64_t) params.pitch[i] * params.height[i];
+    }
+    if (_options.isBayer()) {
+        _header.packedBits = RAW_PACKED_BITS;
+        _header.sensorBits = _options.captureBitDepth;
+    }
+
+    /* The container stays on the camera's volume for the whole run */
+    std::string directory(_options.directory);
+    if (_volumes) {
+        _volume = _volumes->assign(_id);
+        if (_volume < 0) {
+            _logger->error("Every volume is full!");
+            return false;
+        }
+        directory = _volumes->getDirectory(_volume);
+    }
+
+    char filename[FILENAME_MAX];
+    snprintf(filename, FILENAME_MAX, "%s/cam%u/frames.raw", directory.c_str(), _id);
+    _containerFd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, FILE_MODE);
+    if (_options.directIo && _containerFd != -1)
+        _behind.reset(_containerFd, WRITE_BEHIND_WINDOW);
+    snprintf(filename, FILENAME_MAX, "%s/cam%u/frames.idx", directory.c_str(), _id);
+    _indexFd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, FILE_MODE);
+    if (_containerFd == -1 || _indexFd == -1) {
+        _logger->error("Failed to create the raw container files!");
+        return false;
+    }
+
+    char block[RAW_HEADER_SIZE];
+    memset(block, 0, sizeof(block));
+    memcpy(block, &_header, sizeof(_header));
+    return pwrite(_containerFd, block, sizeof(block), 0) == sizeof(block);
+}
+
+/* Write each plane of the frame into the next record, return bool indicating successful writing */
+/* Write one frame, record its telemetry and return its slot to the ring */
+void RawWriter::processJob(FrameJob& job) {
+    uint64_t start = now();
+    bool success = !_failed && writeFrame(job);
+    if (!success)
+        _failed = true;
+    if (_volumes && _volume >= 0)
+        _volumes->record(_id, job.index, _volume, _header.recordSize, success);
+    _ring.release(job.slot);
+    uint64_t writeUs = (now() - start) / 1000;
+    _writeLatency.record(writeUs);
+    if (_telemetry) {
+        job.telemetry.queueUs = (start - job.submitted) / 1000;
+        job.telemetry.writeUs = writeUs;
+        job.telemetry.size = success ? _header.recordSize : 0;
+        if (!success)
+            job.telemetry.flags |= TELEMETRY_FAILED;
+        _telemetry->append(job.telemetry);
+    }
+}
+
+bool RawWriter::writeFrame(const FrameJob& job) {
+
+    if (_containerFd == -1 && !openContainer(job.fd))
+        return false;
+
+    /* Extend the pre-allocation, file systems without fallocate simply grow on write */
+    uint64_t record = _framesWritten;
+    if (record >= _allocatedRecords) {
+        off_t offset = RAW_HEADER_SIZE + _allocatedRecords * _header.recordSize;
+        if (fallocate(_containerFd, 0, offset, PREALLOC_RECORDS * _header.recordSize) != 0 && errno != EOPNOTSUPP)
+            return false;
+        _allocatedRecords += PREALLOC_RECORDS;
+    }
+
+    /* Planes are written with their pitch, the header records it for readers */
+    off_t offset = RAW_HEADER_SIZE + record * _header.recordSize;
+    for (uint32_t plane = 0; plane < _header.numPlanes; plane++) {
+        void *&mapping = _mappings[job.slot * RAW_MAX_PLANES + plane];
+        if (!mapping && NvBufferMemMap(job.fd, plane, NvBufferMem_Read, &mapping) != 0) {
+            mapping = NULL;
+            return false;
+        }
+        NvBufferMemSyncForCpu(job.fd, plane, &mapping);
+        size_t size = (size_t) _header.pitch[plane] * _header.height[plane];
+        if (pwrite(_containerFd, mapping, size, offset) != (ssize_t) size)
+            return false;
+        offset += size;
+    }
+
+    RawIndexEntry entry = {job.index, job.timestamp, record};
+    if (write(_indexFd, &entry, sizeof(entry)) != sizeof(entry))
+        return false;
+    _framesWritten++;
+    _behind.written(offset);
+    return true;
+}
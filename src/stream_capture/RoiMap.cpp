@@ -0,0 +1,184 @@
+/*
+ * RoiMap.cpp
+ *
+ * Region QP offsets for one camera's video encoder. Static regions from --roi
+ * lead the parameters, saliency tiles fill the slots left: every Nth frame is
+ * downscaled by the VIC, mapped once, and each tile's luma gradient is its
+ * detail against the frame mean.
+ */
+
+#include "RoiMap.hpp"
+
+#include "Options.hpp"
+#include "PixelKernels.hpp"
+#include "MemoryBudget.hpp"
+#include "SteadyClock.hpp"
+#include <nvbuf_utils.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#define ROI_SALIENCY_QP 6       // QP offset of a saliency tile, added to flat tiles and taken from detailed ones
+#define ROI_FLAT_SHARE 0.5      // a tile with less detail than this share of the mean is flat
+#define ROI_DETAIL_SHARE 1.5    // a tile with more detail than this share of the mean is detailed
+#define ROI_ALIGNMENT 16        // encoder macroblock size, saliency tiles are aligned to it
+
+RoiMap::RoiMap(uint32_t id, const Options& options) :
+    _id(id),
+    _width(options.captureResolution.width()),
+    _height(options.captureResolution.height()),
+    _interval(options.roiSaliency),
+    _static(0),
+    _fd(-1),
+    _mapping(NULL),
+    _pitch(0),
+    _refreshes(0)
+{
+    memset(&_params, 0, sizeof(_params));
+    const std::vector<RoiRegion>& regions = options.getRois(id);
+    for (size_t i = 0; i < regions.size() && i < V4L2_MAX_ROI_REGIONS; i++) {
+        v4l2_enc_ROI_param& param = _params.ROI_params[_static++];
+        param.ROIRect.left = regions[i].rect.left();
+        param.ROIRect.top = regions[i].rect.top();
+        param.ROIRect.width = regions[i].rect.width();
+        param.ROIRect.height = regions[i].rect.height();
+        param.QPdelta = regions[i].qpDelta;
+    }
+    _params.num_ROI_regions = _static;
+}
+
+RoiMap::~RoiMap() {
+    if (_mapping)
+        NvBufferMemUnMap(_fd, 0, &_mapping);
+    if (_fd != -1)
+        MemoryBudget::instance().destroyNvBuffer(_fd);
+}
+
+/* Create and map the saliency downscale target if refreshes are enabled, return bool indicating success */
+bool RoiMap::open() {
+    if (_interval == 0 || _static >= V4L2_MAX_ROI_REGIONS)
+        return true;
+    NvBufferCreateParams params;
+    memset(&params, 0, sizeof(params));
+    params.width = ROI_SALIENCY_WIDTH;
+    params.height = ROI_SALIENCY_HEIGHT;
+    params.payloadType = NvBufferPayload_SurfArray;
+    params.layout = NvBufferLayout_Pitch;
+    params.colorFormat = NvBufferColorFormat_YUV420;
+    params.nvbuf_tag = NvBufferTag_CAMERA;
+    if ((_fd = MemoryBudget::instance().createNvBuffer(MEMORY_PREVIEW, params)) == -1) {
+        _error = "Failed to create the ROI saliency buffer";
+        return false;
+    }
+    NvBufferParams layout;
+    if (NvBufferGetParams(_fd, &layout) != 0 || NvBufferMemMap(_fd, 0, NvBufferMem_Read, &_mapping) != 0) {
+        _mapping = NULL;
+        _error = "Failed to map the ROI saliency buffer";
+        return false;
+    }
+    _pitch = layout.pitch[0];
+    return true;
+}
+
+/* True if the encoder has to be given ROI parameters at all */
+bool RoiMap::isEnabled() const {
+    return _static > 0 || _fd != -1;
+}
+
+/* Refresh the saliency tiles from the frame if one is due, return false if it could not be downscaled */
+bool RoiMap::update(int captureFd, uint64_t frameNumber) {
+    if (_fd == -1 || frameNumber % _interval != 0)
+        return true;
+    uint64_t start = now();
+    NvBufferTransformParams params;
+    memset(&params, 0, sizeof(params));
+    params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+    params.transform_filter = NvBufferTransform_Filter_Smart;
+    if (NvBufferTransform(captureFd, _fd, &params) != 0) {
+        _error = "Failed to downscale the frame for the ROI map";
+        return false;
+    }
+    NvBufferMemSyncForCpu(_fd, 0, &_mapping);
+    refresh();
+    _refreshes++;
+    _cost.record((now() - start) / 1000);
+    return true;
+}
+
+/* Rebuild the saliency regions after the static ones from the mapped downscale */
+void RoiMap::refresh() {
+    const uint32_t tileWidth = ROI_SALIENCY_WIDTH / ROI_GRID_COLUMNS;
+    const uint32_t tileHeight = ROI_SALIENCY_HEIGHT / ROI_GRID_ROWS;
+    const uint8_t *luma = (const uint8_t *) _mapping;
+
+    /* Detail of a tile is the sum of its horizontal and vertical luma steps */
+    uint64_t detail[ROI_GRID_ROWS * ROI_GRID_COLUMNS];
+    uint64_t total = 0;
+    for (uint32_t ty = 0; ty < ROI_GRID_ROWS; ty++) {
+        for (uint32_t tx = 0; tx < ROI_GRID_COLUMNS; tx++) {
+            uint32_t x = tx * tileWidth;
+            uint32_t steps = tx == ROI_GRID_COLUMNS - 1 ? tileWidth - 1 : tileWidth;
+            uint64_t sum = 0;
+            for (uint32_t y = ty * tileHeight; y < (ty + 1) * tileHeight; y++) {
+                const uint8_t *row = luma + (size_t) y * _pitch + x;
+                sum += sumAbsDiff(row, row + 1, steps);
+                if (y + 1 < ROI_SALIENCY_HEIGHT)
+                    sum += sumAbsDiff(row, row + _pitch, tileWidth);
+            }
+            detail[ty * ROI_GRID_COLUMNS + tx] = sum;
+            total += sum;
+        }
+    }
+    double mean = (double) total / (ROI_GRID_ROWS * ROI_GRID_COLUMNS);
+
+    /* The tiles furthest from the mean take the free slots */
+    std::vector<std::pair<double, uint32_t> > candidates;
+    for (uint32_t i = 0; i < ROI_GRID_ROWS * ROI_GRID_COLUMNS && mean > 0; i++) {
+        double share = detail[i] / mean;
+        if (share < ROI_FLAT_SHARE)
+            candidates.push_back(std::make_pair(1.0 / std::max(share, 0.01), i));
+        else if (share > ROI_DETAIL_SHARE)
+            candidates.push_back(std::make_pair(share, i));
+    }
+    std::sort(candidates.rbegin(), candidates.rend());
+
+    uint32_t count = _static;
+    for (size_t c = 0; c < candidates.size() && count < V4L2_MAX_ROI_REGIONS; c++) {
+        uint32_t tile = candidates[c].second;
+        uint32_t tx = tile % ROI_GRID_COLUMNS;
+        uint32_t ty = tile / ROI_GRID_COLUMNS;
+        uint32_t left = (tx * _width / ROI_GRID_COLUMNS) & ~(ROI_ALIGNMENT - 1);
+        uint32_t top = (ty * _height / ROI_GRID_ROWS) & ~(ROI_ALIGNMENT - 1);
+        uint32_t right = tx == ROI_GRID_COLUMNS - 1 ? _width : ((tx + 1) * _width / ROI_GRID_COLUMNS) & ~(ROI_ALIGNMENT - 1);
+        uint32_t bottom = ty == ROI_GRID_ROWS - 1 ? _height : ((ty + 1) * _height / ROI_GRID_ROWS) & ~(ROI_ALIGNMENT - 1);
+        if (right <= left || bottom <= top)
+            continue;
+        v4l2_enc_ROI_param& param = _params.ROI_params[count++];
+        param.ROIRect.left = left;
+        param.ROIRect.top = top;
+        param.ROIRect.width = right - left;
+        param.ROIRect.height = bottom - top;
+        param.QPdelta = detail[tile] < mean ? ROI_SALIENCY_QP : -ROI_SALIENCY_QP;
+    }
+    _params.num_ROI_regions = count;
+}
+
+/* Parameters for the next frame, static regions first */
+const v4l2_enc_frame_ROI_params& RoiMap::getParams() const {
+    return _params;
+}
+
+/* Saliency refreshes since the start */
+uint64_t RoiMap::getRefreshes() const {
+    return _refreshes;
+}
+
+/* Time each refresh took, downscale included, in us */
+const LatencyHistogram *RoiMap::getCost() const {
+    return &_cost;
+}
+
+const std::string& RoiMap::getError() const {
+    return _error;
+}
@@ -0,0 +1,422 @@
+/*
+ * RtpSink.cpp
+ *
+ * A PreviewSink that streams the composite to a remote operator as H.264 over
+ * RTP/UDP (RFC 6184). Each composite is copied into one of the sink's own
+ * dmabufs and queued on the hardware encoder, which runs the ultrafast preset
+ * without B-frames in CBR at --stream-bitrate. Slice-level encode returns every
+ * slice as soon as it is done and the capture plane thread packetizes it right
+ * away, as single NAL packets or FU-A fragments, so the first packets leave
+ * before the frame has finished encoding. A composite arriving while the
+ * encoder still holds both buffers is dropped rather than queued.
+ *
+ * Latency is measured from the acquire of the composite's oldest tile to its
+ * last packet leaving the socket, and logged as percentiles. The first packet
+ * of every frame carries the tile's capture time as a wall-clock NTP timestamp
+ * in a one-byte RTP header extension (RFC 8285, id 1), so a receiver with a
+ * synchronized clock can complete the glass-to-glass measurement.
+ */
+
+#include "RtpSink.hpp"
+
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "MemoryBudget.hpp"
+#include "DequeueLoops.hpp"
+#include "SteadyClock.hpp"
+#include <NvVideoEncoder.h>
+#include <nvbuf_utils.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+
+#define STDOUT_PRINT true
+#define DQ_RETRIES 1                // a busy encoder drops the composite instead of stalling the compositor
+#define EOS_TIMEOUT_MS 1000         // ms to wait for the capture plane to drain at close
+#define NUM_CAPTURE_BUFFERS 10      // one per slice in flight
+#define RTP_SLICES 4                // slices per frame, the first leaves after a quarter of the encode
+#define RTP_MTU 1400                // keeps packets unfragmented over the radio link's tunnel
+#define RTP_HEADER 12
+#define RTP_EXTENSION 16            // extension header plus the 8 byte capture time, padded
+#define RTP_PAYLOAD (RTP_MTU - RTP_HEADER - RTP_EXTENSION)
+#define RTP_PAYLOAD_TYPE 96
+#define RTP_CLOCK_KHZ 90
+#define CAPTURE_TIME_ID 1
+#define NAL_FU_A 28
+#define NTP_EPOCH_OFFSET 2208988800ULL // seconds from 1900 to 1970
+
+/* Wall clock time in ns */
+static uint64_t wallNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void putBigEndian(uint8_t *dst, uint64_t value, uint32_t bytes) {
+    for (uint32_t i = 0; i < bytes; i++)
+        dst[i] = value >> (8 * (bytes - 1 - i));
+}
+
+/* Next Annex B start code at or after pos, end if there is none */
+static const uint8_t *findStartCode(const uint8_t *pos, const uint8_t *end) {
+    for (; pos + 3 <= end; pos++)
+        if (pos[0] == 0 && pos[1] == 0 && pos[2] == 1)
+            return pos;
+    return end;
+}
+
+RtpSink::RtpSink(const Options& options) :
+    _options(options),
+    _logger(NULL),
+    _encoder(NULL),
+    _numQueued(0),
+    _slicesPerFrame(1),
+    _socket(-1),
+    _sequence(rand()),
+    _ssrc(((uint32_t) rand() << 16) ^ rand()),
+    _rtpTimestamp(0),
+    _frameCapture(0),
+    _slicesSent(0),
+    _extensionPending(false),
+    _wallOffset(0),
+    _framesSent(0),
+    _framesDropped(0),
+    _packetsDropped(0),
+    _bytesSent(0),
+    _opened(0)
+{
+    memset(_buffers, 0, sizeof(_buffers));
+}
+
+RtpSink::~RtpSink() {
+    close();
+    if (_logger)
+        delete _logger;
+}
+
+bool RtpSink::open(const Argus::Size2D<uint32_t>& size) {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        _logger = new Logger("RTP", _options.directory);
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Resolve the receiver and connect a non-blocking UDP socket to it, a full socket buffer drops packets */
+    if (!errorOccurred) {
+        struct addrinfo hints;
+        struct addrinfo *result = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        std::string port = std::to_string(_options.streamPort);
+        if (getaddrinfo(_options.streamHost.c_str(), port.c_str(), &hints, &result) != 0) {
+            _logger->error("Failed to resolve the stream receiver " + _options.streamHost + "!");
+            errorOccurred = true;
+        } else {
+            _socket = socket(result->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (_socket == -1 || connect(_socket, result->ai_addr, result->ai_addrlen) != 0) {
+                _logger->error("Failed to open the stream socket!");
+                errorOccurred = true;
+            }
+            freeaddrinfo(result);
+        }
+    }
+
+    /* Allocate the buffers the composite is copied into while the encoder reads them */
+    if (!errorOccurred) {
+        NvBufferCreateParams params;
+        memset(&params, 0, sizeof(params));
+        params.width = size.width();
+        params.height = size.height();
+        params.layout = NvBufferLayout_Pitch;
+        params.colorFormat = NvBufferColorFormat_YUV420;
+        params.nvbuf_tag = NvBufferTag_VIDEO_ENC;
+        for (uint32_t i = 0; i < RTP_OUTPUT_BUFFERS && !errorOccurred; i++) {
+            if ((_buffers[i] = MemoryBudget::instance().createNvBuffer(MEMORY_PREVIEW, params)) == -1) {
+                _logger->error("Failed to allocate the stream encoder buffers!");
+                _buffers[i] = 0;
+                errorOccurred = true;
+            }
+        }
+    }
+
+    /* Create and configure the hardware encoder */
+    if (!errorOccurred) {
+        _wallOffset = (int64_t) wallNow() - (int64_t) now();
+        if (!setupEncoder(size)) {
+            _logger->error("Failed to set up the stream encoder, too many encoder sessions?");
+            errorOccurred = true;
+        }
+    }
+
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "Streaming " << size.width() << "x" << size.height() << " H.264 at " << _options.streamBitrate
+           << " kbit/s to " << _options.streamHost << ":" << _options.streamPort;
+        _logger->log(ss.str(), STDOUT_PRINT);
+        _opened = now();
+    }
+    return !errorOccurred;
+}
+
+/* Copy the composite into a free encoder buffer and queue it, drop it if the encoder holds both */
+bool RtpSink::consume(int fd, uint64_t timestamp) {
+    struct v4l2_buffer v4l2_buf;
+    struct v4l2_plane planes[MAX_PLANES];
+    memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+    memset(planes, 0, sizeof(planes));
+    v4l2_buf.m.planes = planes;
+    if (!getOutputBuffer(v4l2_buf)) {
+        _framesDropped++;
+        return true;
+    }
+
+    NvBufferTransformParams params;
+    memset(&params, 0, sizeof(params));
+    params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+    params.transform_filter = NvBufferTransform_Filter_Smart;
+    if (NvBufferTransform(fd, _buffers[v4l2_buf.index], &params) != 0)
+        return false;
+
+    /* The capture time travels with the frame through the encoder */
+    planes[0].m.fd = _buffers[v4l2_buf.index];
+    planes[0].bytesused = 1; // must be non-zero, zero signals end of stream
+    v4l2_buf.flags |= V4L2_BUF_FLAG_TIMESTAMP_COPY;
+    v4l2_buf.timestamp.tv_sec = timestamp / 1000000000UL;
+    v4l2_buf.timestamp.tv_usec = (timestamp % 1000000000UL) / 1000;
+    return _encoder->output_plane.qBuffer(v4l2_buf, NULL) == 0;
+}
+
+void RtpSink::close() {
+
+    /* Queue an empty buffer to signal end of stream, then let the capture plane drain */
+    if (_encoder) {
+        struct v4l2_buffer v4l2_buf;
+        struct v4l2_plane planes[MAX_PLANES];
+        memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+        memset(planes, 0, sizeof(planes));
+        v4l2_buf.m.planes = planes;
+        if (getOutputBuffer(v4l2_buf)) {
+            planes[0].m.fd = -1;
+            planes[0].bytesused = 0;
+            if (_encoder->output_plane.qBuffer(v4l2_buf, NULL) == 0)
+                _encoder->capture_plane.waitForDQThread(EOS_TIMEOUT_MS);
+        }
+        _encoder->capture_plane.stopDQThread();
+        _encoder->output_plane.setStreamStatus(false);
+        _encoder->capture_plane.setStreamStatus(false);
+        delete _encoder;
+        _encoder = NULL;
+
+        std::stringstream ss;
+        uint64_t seconds = std::max<uint64_t>((now() - _opened) / 1000000000ULL, 1);
+        ss << "Stream frames sent: " << _framesSent << ", dropped at the encoder: " << _framesDropped
+           << ", packets dropped at the socket: " << _packetsDropped << ", average "
+           << _bytesSent * 8 / 1000 / seconds << " kbit/s";
+        _logger->log(ss.str(), STDOUT_PRINT);
+        ss.str("");
+        ss << "Stream latency acquire to last packet p50/p95/p99/max: " << _latency.getPercentile(50) / 1000 << "/"
+           << _latency.getPercentile(95) / 1000 << "/" << _latency.getPercentile(99) / 1000 << "/"
+           << _latency.getMax() / 1000 << " ms";
+        _logger->log(ss.str(), STDOUT_PRINT);
+    }
+
+    for (uint32_t i = 0; i < RTP_OUTPUT_BUFFERS; i++) {
+        if (_buffers[i])
+            MemoryBudget::instance().destroyNvBuffer(_buffers[i]);
+        _buffers[i] = 0;
+    }
+    if (_socket != -1)
+        ::close(_socket);
+    _socket = -1;
+}
+
+/* Configure the encoder for latency over quality, the preview runs at screen resolution anyway */
+bool RtpSink::setupEncoder(const Argus::Size2D<uint32_t>& size) {
+
+    uint32_t width = size.width();
+    uint32_t height = size.height();
+
+    _encoder = NvVideoEncoder::createVideoEncoder("rtpenc");
+    if (!_encoder)
+        return false;
+
+    if (_encoder->setCapturePlaneFormat(V4L2_PIX_FMT_H264, width, height, width * height) < 0)
+        return false;
+    if (_encoder->setOutputPlaneFormat(V4L2_PIX_FMT_YUV420M, width, height) < 0)
+        return false;
+    if (_encoder->setBitrate(_options.streamBitrate * 1000U) < 0)
+        return false;
+    if (_encoder->setProfile(V4L2_MPEG_VIDEO_H264_PROFILE_BASELINE) < 0)
+        return false;
+    if (_encoder->setRateControlMode(V4L2_MPEG_VIDEO_BITRATE_MODE_CBR) < 0)
+        return false;
+    if (_encoder->setHWPresetType(V4L2_ENC_HW_PRESET_ULTRAFAST) < 0)
+        return false;
+    if (_encoder->setNumBFrames(0) < 0)
+        return false;
+
+    /* An IDR every second so a receiver joining late or losing packets recovers quickly */
+    if (_encoder->setIDRInterval(_options.previewFps) < 0)
+        return false;
+    if (_encoder->setIFrameInterval(_options.previewFps) < 0)
+        return false;
+    if (_encoder->setFrameRate(_options.previewFps, 1) < 0)
+        return false;
+    if (_encoder->setInsertSpsPpsAtIdrEnabled(true) < 0)
+        return false;
+
+    /* Fixed macroblock count slices, so the capture plane knows which slice ends the frame */
+    uint32_t macroblocks = ((width + 15) / 16) * ((height + 15) / 16);
+    uint32_t sliceLength = (macroblocks + RTP_SLICES - 1) / RTP_SLICES;
+    _slicesPerFrame = (macroblocks + sliceLength - 1) / sliceLength;
+    if (_encoder->setSliceLevelEncode(true) < 0)
+        return false;
+    if (_encoder->setSliceLength(V4L2_ENC_SLICE_LENGTH_TYPE_MBLK, sliceLength) < 0)
+        return false;
+    if (_options.maxPerf && _encoder->setMaxPerfMode(1) < 0)
+        return false;
+
+    if (_encoder->output_plane.setupPlane(V4L2_MEMORY_DMABUF, RTP_OUTPUT_BUFFERS, false, false) < 0)
+        return false;
+    if (_encoder->capture_plane.setupPlane(V4L2_MEMORY_MMAP, NUM_CAPTURE_BUFFERS, true, false) < 0)
+        return false;
+    if (_encoder->output_plane.setStreamStatus(true) < 0)
+        return false;
+    if (_encoder->capture_plane.setStreamStatus(true) < 0)
+        return false;
+
+    _encoder->capture_plane.setDQThreadCallback(captureCallback);
+    _encoder->capture_plane.setDQPollLoop(DequeueLoops::instance().next());
+    _encoder->capture_plane.startDQThread(this);
+
+    /* Hand every empty bitstream buffer to the encoder */
+    for (uint32_t i = 0; i < _encoder->capture_plane.getNumBuffers(); i++) {
+        struct v4l2_buffer v4l2_buf;
+        struct v4l2_plane planes[MAX_PLANES];
+        memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+        memset(planes, 0, sizeof(planes));
+        v4l2_buf.index = i;
+        v4l2_buf.m.planes = planes;
+        if (_encoder->capture_plane.qBuffer(v4l2_buf, NULL) < 0)
+            return false;
+    }
+    return true;
+}
+
+/* Take an unused output plane index, or one the encoder has finished reading */
+bool RtpSink::getOutputBuffer(struct v4l2_buffer& v4l2_buf) {
+    if (_numQueued < RTP_OUTPUT_BUFFERS) {
+        v4l2_buf.index = _numQueued++;
+        return true;
+    }
+    return _encoder->output_plane.dqBuffer(v4l2_buf, NULL, NULL, DQ_RETRIES) == 0;
+}
+
+/* Packetize one slice, a new capture time opens a new frame and the last slice closes it */
+void RtpSink::sendSlice(const uint8_t *data, uint32_t size, uint64_t captureTime) {
+    if (captureTime != _frameCapture || _slicesSent == _slicesPerFrame) {
+        _frameCapture = captureTime;
+        _rtpTimestamp = captureTime * RTP_CLOCK_KHZ / 1000;
+        _slicesSent = 0;
+        _extensionPending = true;
+    }
+    bool lastSlice = ++_slicesSent == _slicesPerFrame;
+
+    const uint8_t *end = data + size;
+    const uint8_t *nal = findStartCode(data, end);
+    while (nal < end) {
+        nal += 3;
+        const uint8_t *next = findStartCode(nal, end);
+
+        /* A four byte start code leaves a trailing zero on the previous NAL */
+        const uint8_t *nalEnd = next;
+        if (next < end && nalEnd > nal && nalEnd[-1] == 0)
+            nalEnd--;
+        if (nalEnd > nal)
+            sendNal(nal, nalEnd - nal, lastSlice && next == end);
+        nal = next;
+    }
+
+    if (lastSlice) {
+        _latency.record(now() / 1000 - captureTime);
+        _framesSent++;
+    }
+}
+
+/* Send a NAL unit as one packet, or split it into FU-A fragments when it exceeds the MTU */
+void RtpSink::sendNal(const uint8_t *nal, uint32_t size, bool last) {
+    if (size <= RTP_PAYLOAD) {
+        sendPacket(nal, size, NULL, 0, last);
+        return;
+    }
+    uint8_t fu[2];
+    fu[0] = (nal[0] & 0x60) | NAL_FU_A;
+    for (uint32_t pos = 1; pos < size;) {
+        uint32_t chunk = std::min<uint32_t>(size - pos, RTP_PAYLOAD - sizeof(fu));
+        bool end = pos + chunk == size;
+        fu[1] = (nal[0] & 0x1F) | (pos == 1 ? 0x80 : 0) | (end ? 0x40 : 0);
+        sendPacket(nal + pos, chunk, fu, sizeof(fu), last && end);
+        pos += chunk;
+    }
+}
+
+/* Build the RTP header, the capture time extension on a frame's first packet, and send */
+void RtpSink::sendPacket(const uint8_t *payload, uint32_t size, const uint8_t *prefix, uint32_t prefixSize, bool marker) {
+    uint8_t *packet = _packet;
+    packet[0] = 0x80 | (_extensionPending ? 0x10 : 0);
+    packet[1] = (marker ? 0x80 : 0) | RTP_PAYLOAD_TYPE;
+    putBigEndian(packet + 2, _sequence++, 2);
+    putBigEndian(packet + 4, _rtpTimestamp, 4);
+    putBigEndian(packet + 8, _ssrc, 4);
+    uint32_t length = RTP_HEADER;
+
+    if (_extensionPending) {
+        uint64_t wall = _frameCapture * 1000 + _wallOffset;
+        uint64_t seconds = wall / 1000000000ULL + NTP_EPOCH_OFFSET;
+        uint64_t fraction = ((wall % 1000000000ULL) << 32) / 1000000000ULL;
+        putBigEndian(packet + length, 0xBEDE, 2);
+        putBigEndian(packet + length + 2, 3, 2);                   // extension length in 32 bit words
+        packet[length + 4] = (CAPTURE_TIME_ID << 4) | (8 - 1);     // one-byte header, 8 data bytes
+        putBigEndian(packet + length + 5, (seconds << 32) | fraction, 8);
+        memset(packet + length + 13, 0, 3);
+        length += RTP_EXTENSION;
+        _extensionPending = false;
+    }
+
+    if (prefixSize > 0)
+        memcpy(packet + length, prefix, prefixSize);
+    memcpy(packet + length + prefixSize, payload, size);
+    length += prefixSize + size;
+    if (send(_socket, packet, length, 0) != (ssize_t) length)
+        _packetsDropped++;
+    else
+        _bytesSent += length;
+}
+
+/* Called from the capture plane DQ thread or its dequeue loop for every slice, returning false stops dequeueing the plane */
+bool RtpSink::captureCallback(struct v4l2_buffer *v4l2_buf, NvBuffer *buffer,
+                              NvBuffer *shared_buffer, void *data) {
+    RtpSink *sink = static_cast<RtpSink*>(data);
+    if (!v4l2_buf || buffer->planes[0].bytesused == 0)
+        return false;
+
+    uint64_t captureTime = v4l2_buf->timestamp.tv_sec * 1000000ULL + v4l2_buf->timestamp.tv_usec;
+    sink->sendSlice(buffer->planes[0].data, buffer->planes[0].bytesused, captureTime);
+    return sink->_encoder->capture_plane.qBuffer(*v4l2_buf, NULL) == 0;
+}
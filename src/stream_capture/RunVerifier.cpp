@@ -0,0 +1,409 @@
+/*
+ * RunVerifier.cpp
+ *
+ * Checks a finished run against the CRC32C the writers recorded. The images
+ * are listed from every camera's checksums.csv and container indexes on each
+ * volume of the run, then one thread per online core takes the next image,
+ * re-reads it and compares its size and checksum. The volumes are those of
+ * --volumes if given, as they may be mounted elsewhere now, otherwise those
+ * listed in the run's options.txt, which also gives the --fanout the image
+ * files were sharded with. With --recover the container segments a crash
+ * left without their footer are closed first. Problems are logged and
+ * listed in verify.csv in the run directory.
+ * File format: camera,index,path,problem
+ */
+
+#include "RunVerifier.hpp"
+
+#include "ContainerFile.hpp"
+#include "RunLayout.hpp"
+#include "VolumeSet.hpp"
+#include "Crc32c.hpp"
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "SteadyClock.hpp"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#define STDOUT_PRINT true
+#define VERIFY_OK 0
+#define VERIFY_MISSING 1      // listed in an index, no longer on the volume
+#define VERIFY_TRUNCATED 2    // shorter than the index says
+#define VERIFY_CORRUPT 3      // wrong size or checksum, or unreadable
+#define VERIFY_UNINDEXED 4    // on the volume, its index entry never made it to disk
+
+static const char *PROBLEM_NAMES[] = {"ok", "missing", "truncated", "corrupt", "unindexed"};
+
+RunVerifier::RunVerifier(Options& options) :
+    _options(options),
+    _logger(NULL),
+    _fanout(0)
+{}
+
+RunVerifier::~RunVerifier() {
+    if (_logger)
+        delete _logger;
+}
+
+/* Verify the run until done or doRun clears, return bool indicating every image checked out */
+bool RunVerifier::run(const std::atomic<bool>& doRun) {
+
+    bool errorOccurred = false;
+
+    /* Create the logger, the run being checked is left untouched but for verify.csv */
+    if (!errorOccurred) {
+        _logger = new Logger("VERIFY", "");
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Locate the run directory on every volume */
+    std::vector<std::string> directories;
+    if (!errorOccurred && !findVolumes(directories))
+        errorOccurred = true;
+
+    /* List every indexed image, camera by camera */
+    uint32_t cameras = 0;
+    if (!errorOccurred) {
+        std::vector<std::string> names = listDirectory(directories[0]);
+        for (uint32_t i = 0; i < names.size(); i++) {
+            if (!matchName(names[i].c_str(), "cam", ""))
+                continue;
+            uint32_t camera = atoi(names[i].c_str() + 3);
+            std::set<uint64_t> indexed;
+            size_t listed = _checks.size();
+            bool checksummed = readChecksums(camera, directories, indexed);
+            for (uint32_t j = 0; j < directories.size(); j++) {
+                if (_options.recover)
+                    recoverContainers(camera, directories[j]);
+                checksummed = readContainers(camera, directories[j]) || checksummed;
+            }
+            if (checksummed)
+                findUnindexed(camera, directories, indexed);
+            else
+                _logger->log("Camera " + std::to_string(camera) + " has no checksums, was it recorded raw or as video?",
+                             STDOUT_PRINT);
+            std::stringstream ss;
+            ss << "Camera " << camera << ": " << _checks.size() - listed << " images indexed";
+            _logger->log(ss.str());
+            cameras++;
+        }
+        if (cameras == 0) {
+            _logger->error("No camera directories in " + directories[0] + "! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    /* Re-read the images on every core */
+    uint32_t threadCount = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    uint64_t start = now();
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "Verifying " << _checks.size() << " images of " << cameras << " cameras on " << threadCount << " threads...";
+        _logger->log(ss.str(), STDOUT_PRINT);
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0; i < threadCount; i++)
+            threads.push_back(std::thread([this, &next, &doRun]() { verify(next, doRun); }));
+        for (uint32_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+    }
+    double seconds = (now() - start) / 1e9;
+
+    /* Count and list the problems */
+    uint64_t counts[VERIFY_UNINDEXED + 1] = {0};
+    uint64_t bytes = 0;
+    uint64_t unchecksummed = 0;
+    FILE *file = NULL;
+    if (!errorOccurred) {
+        std::string filename = directories[0] + "/verify.csv";
+        file = fopen(filename.c_str(), "w");
+        if (!file || fprintf(file, "camera,index,path,problem\n") < 0) {
+            _logger->error("Failed to create verify.csv! Exiting...");
+            errorOccurred = true;
+        }
+    }
+    for (uint32_t pass = 0; pass < 2 && !errorOccurred; pass++) {
+        std::vector<Check>& checks = pass == 0 ? _checks : _unindexed;
+        for (size_t i = 0; i < checks.size(); i++) {
+            const Check& check = checks[i];
+            if (check.problem < 0)
+                continue; // not reached before doRun cleared
+            counts[check.problem]++;
+            if (check.problem == VERIFY_OK) {
+                bytes += check.size;
+                unchecksummed += check.checksummed ? 0 : 1;
+                continue;
+            }
+            fprintf(file, "%u,%lu,%s,%s\n", check.camera, check.index, check.path.c_str(), PROBLEM_NAMES[check.problem]);
+            std::stringstream ss;
+            ss << "Camera " << check.camera << " image " << check.index << " " << PROBLEM_NAMES[check.problem] << ": "
+               << check.path;
+            _logger->log(ss.str());
+        }
+    }
+    if (file && fclose(file) != 0) {
+        _logger->error("Failed to close verify.csv!");
+        errorOccurred = true;
+    }
+
+    if (!errorOccurred) {
+        uint64_t failed = counts[VERIFY_MISSING] + counts[VERIFY_TRUNCATED] + counts[VERIFY_CORRUPT];
+        std::stringstream ss;
+        ss << "Verified " << counts[VERIFY_OK] << " images, " << (bytes >> 20) << " MiB in " << seconds << " s ("
+           << (seconds > 0 ? bytes / seconds / (1 << 20) : 0) << " MiB/s): " << counts[VERIFY_MISSING] << " missing, "
+           << counts[VERIFY_TRUNCATED] << " truncated, " << counts[VERIFY_CORRUPT] << " corrupt, "
+           << counts[VERIFY_UNINDEXED] << " unindexed";
+        _logger->log(ss.str(), STDOUT_PRINT);
+        if (unchecksummed > 0)
+            _logger->log(std::to_string(unchecksummed) + " container images predate checksums, only their size was checked",
+                         STDOUT_PRINT);
+        if (failed > 0)
+            _logger->log("Damaged images are listed in verify.csv", STDOUT_PRINT);
+        if (!doRun)
+            _logger->log("Interrupted, the rest of the run was not verified", STDOUT_PRINT);
+        errorOccurred = failed > 0 || !doRun;
+    }
+    return !errorOccurred;
+}
+
+/* The run directory on each volume, volume 0 is the one passed to --verify. Other volumes are
+   taken from --volumes if given, otherwise from the run's options.txt, as is the fan-out of the
+   image files unless --fanout is given */
+bool RunVerifier::findVolumes(std::vector<std::string>& directories) {
+    std::string directory = _options.verifyPath;
+    while (directory.size() > 1 && directory[directory.size() - 1] == '/')
+        directory.erase(directory.size() - 1);
+    struct stat info;
+    if (stat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+        _logger->error("No run directory at " + directory + "! Exiting...");
+        return false;
+    }
+    directories.push_back(directory);
+    std::string name = directory.substr(directory.find_last_of('/') + 1);
+
+    std::vector<std::string> volumes;
+    std::ifstream options(directory + "/options.txt");
+    std::string line;
+    _fanout = _options.fanout;
+    while (std::getline(options, line)) {
+        uint32_t volume, fanout;
+        int offset = 0;
+        if (sscanf(line.c_str(), "Volume %u: %n", &volume, &offset) == 1 && offset > 0 && volume == volumes.size())
+            volumes.push_back(line.substr(offset));
+        else if (sscanf(line.c_str(), "Fan-out: %u", &fanout) == 1 && _options.fanout == 0)
+            _fanout = fanout;
+    }
+    if (!_options.volumes.empty())
+        volumes = _options.volumes;
+    for (uint32_t i = 1; i < volumes.size(); i++) {
+        directories.push_back(VolumeSet::join(volumes[i], name));
+        _logger->log("Volume " + std::to_string(i) + ": " + directories[i], STDOUT_PRINT);
+    }
+    return true;
+}
+
+/* List the images of the camera's checksums.csv, return bool indicating the camera has one */
+bool RunVerifier::readChecksums(uint32_t camera, const std::vector<std::string>& directories,
+                                std::set<uint64_t>& indexed) {
+    std::string cameraDirectory = "/cam" + std::to_string(camera);
+    FILE *file = fopen((directories[0] + cameraDirectory + "/checksums.csv").c_str(), "r");
+    if (!file)
+        return false;
+
+    char line[256];
+    uint64_t malformed = 0;
+    while (fgets(line, sizeof(line), file)) {
+        Check check;
+        int volume;
+        unsigned long index, size;
+        if (sscanf(line, "%lu,%d,%lu,%x", &index, &volume, &size, &check.crc) != 4) {
+            malformed += strncmp(line, "index,", 6) == 0 ? 0 : 1;
+            continue;
+        }
+        char filename[40];
+        if (_fanout > 0)
+            snprintf(filename, sizeof(filename), "/%04lu/image%06lu.jpg", index / _fanout, index);
+        else
+            snprintf(filename, sizeof(filename), "/image%06lu.jpg", index);
+        check.camera = camera;
+        check.index = index;
+        check.offset = 0;
+        check.size = size;
+        check.container = false;
+        check.checksummed = true;
+        check.problem = -1;
+        if (volume >= 0 && volume < (int) directories.size()) {
+            check.path = directories[volume] + cameraDirectory + filename;
+        } else {
+            check.path = "volume " + std::to_string(volume) + cameraDirectory + filename;
+            check.problem = VERIFY_MISSING; // pass --volumes to point at where it is mounted now
+        }
+        _checks.push_back(check);
+        indexed.insert(index);
+    }
+    fclose(file);
+    if (malformed > 0) {
+        std::stringstream ss;
+        ss << "Camera " << camera << ": skipped " << malformed << " malformed checksums.csv lines, cut short by a power loss?";
+        _logger->log(ss.str(), STDOUT_PRINT);
+    }
+    return true;
+}
+
+/* List the images of the camera's containers in one run directory, full frames and proxies, return
+   bool indicating any were found */
+bool RunVerifier::readContainers(uint32_t camera, const std::string& directory) {
+    std::string cameraDirectory = directory + "/cam" + std::to_string(camera);
+    std::vector<std::string> names = listDirectory(cameraDirectory);
+    bool found = false;
+    for (uint32_t i = 0; i < names.size(); i++) {
+        const char *name = names[i].c_str();
+        if (!matchName(name, "frames", ".idx") && !matchName(name, "proxies", ".idx"))
+            continue;
+        std::string stem = cameraDirectory + "/" + names[i].substr(0, names[i].size() - 4);
+        int fd = open((stem + ".idx").c_str(), O_RDONLY);
+        if (fd == -1) {
+            _logger->log("Failed to open " + stem + ".idx", STDOUT_PRINT);
+            continue;
+        }
+        ContainerIndexEntry entry;
+        ssize_t length;
+        while ((length = read(fd, &entry, sizeof(entry))) == sizeof(entry)) {
+            Check check;
+            check.camera = camera;
+            check.index = entry.index;
+            check.path = stem + ".mjpg";
+            check.offset = entry.offset;
+            check.size = entry.size;
+            check.container = true;
+            check.crc = entry.crc32c;
+            check.checksummed = entry.crc32c != 0;
+            check.problem = -1;
+            _checks.push_back(check);
+        }
+        if (length != 0)
+            _logger->log("Ignoring the partial last entry of " + stem + ".idx", STDOUT_PRINT);
+        ::close(fd);
+        found = true;
+    }
+    return found;
+}
+
+/* Close the camera's container segments a crash left without their footer, so their .idx matches
+   what the checkpoints and checksums still vouch for */
+void RunVerifier::recoverContainers(uint32_t camera, const std::string& directory) {
+    std::string cameraDirectory = directory + "/cam" + std::to_string(camera);
+    std::vector<std::string> names = listDirectory(cameraDirectory);
+    for (uint32_t i = 0; i < names.size(); i++) {
+        const char *name = names[i].c_str();
+        if (!matchName(name, "frames", ".mjpg") && !matchName(name, "proxies", ".mjpg"))
+            continue;
+        std::string path = cameraDirectory + "/" + names[i];
+        uint64_t images = 0;
+        bool repaired = false;
+        if (!ContainerFile::recover(path, images, repaired))
+            _logger->log("Failed to recover " + path + ", left as it was", STDOUT_PRINT);
+        else if (repaired)
+            _logger->log("Recovered " + std::to_string(images) + " images of " + path, STDOUT_PRINT);
+    }
+}
+
+/* Image files on any volume the camera's checksums.csv does not list, in the camera directory and
+   its --fanout sub-directories */
+void RunVerifier::findUnindexed(uint32_t camera, const std::vector<std::string>& directories,
+                                const std::set<uint64_t>& indexed) {
+    std::vector<std::string> cameraDirectories;
+    for (uint32_t i = 0; i < directories.size(); i++) {
+        std::vector<std::string> found = findCameraDirectories(directories[i] + "/cam" + std::to_string(camera));
+        cameraDirectories.insert(cameraDirectories.end(), found.begin(), found.end());
+    }
+    for (uint32_t i = 0; i < cameraDirectories.size(); i++) {
+        const std::string& cameraDirectory = cameraDirectories[i];
+        std::vector<std::string> names = listDirectory(cameraDirectory);
+        for (uint32_t j = 0; j < names.size(); j++) {
+            if (!matchName(names[j].c_str(), "image", ".jpg"))
+                continue;
+            uint64_t index = strtoull(names[j].c_str() + 5, NULL, 10);
+            if (indexed.count(index))
+                continue;
+            Check check;
+            check.camera = camera;
+            check.index = index;
+            check.path = cameraDirectory + "/" + names[j];
+            check.offset = 0;
+            check.size = 0;
+            check.container = false;
+            check.crc = 0;
+            check.checksummed = false;
+            check.problem = VERIFY_UNINDEXED;
+            _unindexed.push_back(check);
+        }
+    }
+}
+
+/* Re-read images until every one is taken or doRun clears. Consecutive checks mostly share a
+   container, so the last file stays open */
+void RunVerifier::verify(std::atomic<size_t>& next, const std::atomic<bool>& doRun) {
+    std::vector<unsigned char> buffer;
+    std::string openPath;
+    int fd = -1;
+    uint64_t fileSize = 0;
+    size_t i;
+    while (doRun && (i = next++) < _checks.size()) {
+        Check& check = _checks[i];
+        if (check.problem >= 0)
+            continue;
+
+        if (check.path != openPath) {
+            if (fd != -1)
+                ::close(fd);
+            openPath = check.path;
+            fd = open(check.path.c_str(), O_RDONLY);
+            struct stat info;
+            fileSize = fd != -1 && fstat(fd, &info) == 0 ? info.st_size : 0;
+            if (fd != -1)
+                posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+        if (fd == -1) {
+            check.problem = VERIFY_MISSING;
+            continue;
+        }
+
+        /* An image file must be exactly its size, a container only has to hold it */
+        if (fileSize < check.offset + check.size) {
+            check.problem = VERIFY_TRUNCATED;
+            continue;
+        }
+        if (!check.container && fileSize != check.size) {
+            check.problem = VERIFY_CORRUPT;
+            continue;
+        }
+
+        buffer.resize(check.size);
+        uint64_t done = 0;
+        ssize_t length = 1;
+        while (done < check.size && (length = pread(fd, buffer.data() + done, check.size - done, check.offset + done)) > 0)
+            done += length;
+        if (done < check.size)
+            check.problem = length < 0 ? VERIFY_CORRUPT : VERIFY_TRUNCATED;
+        else if (check.checksummed && crc32c(buffer.data(), check.size) != check.crc)
+            check.problem = VERIFY_CORRUPT;
+        else
+            check.problem = VERIFY_OK;
+    }
+    if (fd != -1)
+        ::close(fd);
+}
@@ -0,0 +1,366 @@
+/*
+ * SegmentUploader.cpp
+ *
+ * Sends every closed segment to the --offload receiver as a tar stream over
+ * one TCP connection each: ustar headers from user space, file data with
+ * sendfile. Runs at idle CPU and I/O priority, at most --offload-rate MiB/s,
+ * and pauses while a writer queue fills. A failed segment is sent again.
+ * offload.csv in the root directory lists every segment sent.
+ * File format: segment,files,bytes,seconds
+ */
+
+#include "SegmentUploader.hpp"
+
+#include "ThreadPlacement.hpp"
+#include "VolumeSet.hpp"
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "SteadyClock.hpp"
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+
+#define STDOUT_PRINT true
+#define TAR_BLOCK 512U
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define OFFLOAD_CHUNK (1U << 20)                // bytes per sendfile, the rate and backoff are checked in between
+#define OFFLOAD_POLL_NS 1000000000ULL           // wait for the next segment to close
+#define OFFLOAD_RETRY_NS 10000000000ULL         // wait before sending a failed segment again
+#define OFFLOAD_BACKOFF_NS 100000000ULL         // wait while a writer queue fills
+#define OFFLOAD_BACKOFF_PERCENT 25U             // writer queue occupancy the offload pauses above
+#define OFFLOAD_DRAIN_TIMEOUT_S 10              // wait for the receiver to close after the archive
+
+/* Write value as a NUL terminated octal field, sizes too large for it go base-256 as GNU tar does */
+static void formatNumber(char *field, size_t length, uint64_t value) {
+    if (length == 12 && value >= (1ULL << 33)) {
+        memset(field, 0, length);
+        field[0] = (char) 0x80;
+        for (size_t i = length - 1; i > 0 && value > 0; i--, value >>= 8)
+            field[i] = (char) (value & 0xff);
+        return;
+    }
+    snprintf(field, length, "%0*lo", (int) length - 1, value);
+}
+
+SegmentUploader::SegmentUploader(const Options& options, VolumeSet& volumes) :
+    _options(options),
+    _volumes(volumes),
+    _logger(NULL),
+    _index(NULL),
+    _next(0),
+    _occupancy(0),
+    _segmentsSent(0),
+    _bytesSent(0),
+    _paceStart(0),
+    _paceBytes(0)
+{}
+
+SegmentUploader::~SegmentUploader() {
+    if (_index)
+        fclose(_index);
+    if (_logger)
+        delete _logger;
+}
+
+/* Highest occupancy of any camera's queues, 0 to 1, the supervisor loop reports it */
+void SegmentUploader::setOccupancy(double occupancy) {
+    _occupancy = (uint32_t) (occupancy * 100);
+}
+
+uint32_t SegmentUploader::getSegmentsSent() {
+    return _segmentsSent;
+}
+
+uint64_t SegmentUploader::getBytesSent() {
+    return _bytesSent;
+}
+
+bool SegmentUploader::threadInitialize() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        _logger = new Logger("OFFLOAD", _options.directory);
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Only take CPU and disk time nothing else wants, a failure is logged but not fatal */
+    if (!errorOccurred) {
+        placeThread(-1, SCHED_IDLE, 0, _logger);
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+            _logger->log("Failed to set the idle I/O priority: " + std::string(strerror(errno)), STDOUT_PRINT);
+    }
+
+    /* Open the list of segments sent */
+    if (!errorOccurred) {
+        std::string filename = std::string(_options.directory) + "/offload.csv";
+        _index = fopen(filename.c_str(), "w");
+        if (!_index || setvbuf(_index, NULL, _IOLBF, 0) != 0 || fprintf(_index, "segment,files,bytes,seconds\n") < 0) {
+            _logger->error("Failed to create offload.csv!");
+            errorOccurred = true;
+        }
+    }
+
+    if (!errorOccurred) {
+        std::string directory = _options.directory;
+        _runName = directory.substr(directory.find_last_of('/') + 1);
+        std::stringstream ss;
+        ss << "Sending closed segments to " << _options.offloadHost << ":" << _options.offloadPort;
+        if (_options.offloadRate > 0)
+            ss << " at up to " << _options.offloadRate << " MiB/s";
+        _logger->log(ss.str(), STDOUT_PRINT);
+    }
+    return !errorOccurred;
+}
+
+/* Send the next segment once every writer has moved past it, a failure is retried after a pause */
+bool SegmentUploader::threadExecute() {
+    if (!_volumes.isSegmentClosed(_next)) {
+        sleepFor(OFFLOAD_POLL_NS);
+        return true;
+    }
+
+    uint64_t start = now();
+    uint32_t files = 0;
+    uint64_t bytes = 0;
+    if (!sendSegment(_next, files, bytes)) {
+        if (!m_doShutdown) {
+            _logger->log("Failed to send segment " + std::to_string(_next) + ", trying again", STDOUT_PRINT);
+            sleepFor(OFFLOAD_RETRY_NS);
+        }
+        return true;
+    }
+
+    double seconds = (now() - start) / 1e9;
+    fprintf(_index, "%u,%u,%lu,%.3f\n", _next, files, bytes, seconds);
+    std::stringstream ss;
+    ss << "Segment " << _next << " sent: " << files << " files, " << (bytes >> 20) << " MiB in " << seconds << " s";
+    _logger->log(ss.str());
+    _segmentsSent++;
+    _next++;
+    return true;
+}
+
+bool SegmentUploader::threadShutdown() {
+    std::stringstream ss;
+    ss << "Segments offloaded: " << _segmentsSent << " (" << (_bytesSent >> 20) << " MiB), segment " << _next
+       << " on was not sent";
+    _logger->log(ss.str(), STDOUT_PRINT);
+    if (_index && fclose(_index) != 0)
+        _logger->error("Failed to close offload.csv!");
+    _index = NULL;
+    return true;
+}
+
+/* Send every file of the segment on every volume as one tar archive, return bool indicating the
+   receiver got all of it */
+bool SegmentUploader::sendSegment(uint32_t segment, uint32_t& files, uint64_t& bytes) {
+    char name[16];
+    snprintf(name, sizeof(name), "/seg%03u", segment);
+    std::vector<Upload> uploads;
+    for (uint32_t i = 0; i < _volumes.getVolumeCount(); i++) {
+        std::string prefix = i == 0 ? _runName : _runName + ".vol" + std::to_string(i);
+        listFiles(_volumes.getSegmentDirectory(i, segment), prefix + name, uploads);
+    }
+    if (uploads.empty())
+        return true;
+
+    int socket = connectReceiver();
+    if (socket == -1)
+        return false;
+    _paceStart = now();
+    _paceBytes = 0;
+    bool success = true;
+    for (size_t i = 0; i < uploads.size() && success; i++) {
+        success = sendHeader(socket, uploads[i]) && sendFile(socket, uploads[i], bytes);
+        files += success ? 1 : 0;
+    }
+
+    /* Two zero blocks end the archive, the receiver closes once it has taken them */
+    char end[2 * TAR_BLOCK];
+    memset(end, 0, sizeof(end));
+    success = success && sendAll(socket, end, sizeof(end)) && ::shutdown(socket, SHUT_WR) == 0;
+    if (success) {
+        char drain[256];
+        struct timeval timeout = {OFFLOAD_DRAIN_TIMEOUT_S, 0};
+        setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        while (recv(socket, drain, sizeof(drain), 0) > 0) {}
+    }
+    close(socket);
+    _bytesSent += success ? bytes : 0;
+    return success;
+}
+
+/* Regular files under directory, recursively, named under name in the archive */
+void SegmentUploader::listFiles(const std::string& directory, const std::string& name, std::vector<Upload>& uploads) {
+    DIR *dir = opendir(directory.c_str());
+    if (!dir)
+        return;
+    std::vector<std::string> entries;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            entries.push_back(entry->d_name);
+    closedir(dir);
+    std::sort(entries.begin(), entries.end());
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        std::string source = directory + "/" + entries[i];
+        struct stat info;
+        if (stat(source.c_str(), &info) != 0)
+            continue;
+        if (S_ISDIR(info.st_mode)) {
+            listFiles(source, name + "/" + entries[i], uploads);
+        } else if (S_ISREG(info.st_mode)) {
+            Upload upload = {source, name + "/" + entries[i], (uint64_t) info.st_size, (uint64_t) info.st_mtime};
+            uploads.push_back(upload);
+        }
+    }
+}
+
+/* Resolve the receiver and connect to it, -1 on failure */
+int SegmentUploader::connectReceiver() {
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    std::string port = std::to_string(_options.offloadPort);
+    if (getaddrinfo(_options.offloadHost.c_str(), port.c_str(), &hints, &result) != 0)
+        return -1;
+    int fd = ::socket(result->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd != -1 && connect(fd, result->ai_addr, result->ai_addrlen) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+/* The file's ustar header, a name over 100 characters is split into prefix and name at a slash */
+bool SegmentUploader::sendHeader(int socket, const Upload& upload) {
+    char header[TAR_BLOCK];
+    memset(header, 0, sizeof(header));
+    const std::string& path = upload.name;
+    if (path.size() <= 100) {
+        memcpy(header, path.data(), path.size());
+    } else {
+        size_t slash = path.find_last_of('/', 155);
+        if (slash == std::string::npos || path.size() - slash - 1 > 100)
+            return false;
+        memcpy(header, path.data() + slash + 1, path.size() - slash - 1);
+        memcpy(header + 345, path.data(), slash);
+    }
+    formatNumber(header + 100, 8, 0644);        // mode
+    formatNumber(header + 108, 8, 0);           // uid
+    formatNumber(header + 116, 8, 0);           // gid
+    formatNumber(header + 124, 12, upload.size);
+    formatNumber(header + 136, 12, upload.mtime);
+    header[156] = '0';                          // regular file
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+
+    /* The checksum is taken with its own field as spaces */
+    memset(header + 148, ' ', 8);
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < sizeof(header); i++)
+        sum += (unsigned char) header[i];
+    snprintf(header + 148, 8, "%06o", sum);
+    header[155] = ' ';
+    return sendAll(socket, header, sizeof(header));
+}
+
+/* The file's data with sendfile and the zeros padding it to a block, pausing while a writer queue
+   fills, return bool indicating all of it was sent */
+bool SegmentUploader::sendFile(int socket, const Upload& upload, uint64_t& bytes) {
+    int fd = open(upload.source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    off_t offset = 0;
+    bool success = true;
+    while (success && (uint64_t) offset < upload.size) {
+        while (_occupancy > OFFLOAD_BACKOFF_PERCENT && sleepFor(OFFLOAD_BACKOFF_NS)) {
+            _paceStart = now();
+            _paceBytes = 0;
+        }
+        if (m_doShutdown) {
+            success = false;
+            break;
+        }
+        size_t length = std::min((uint64_t) OFFLOAD_CHUNK, upload.size - offset);
+        ssize_t sent = sendfile(socket, fd, &offset, length);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        success = sent > 0 && pace(sent);
+    }
+
+    /* Keep the page cache for the recording, what was read is not needed again */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    char padding[TAR_BLOCK];
+    memset(padding, 0, sizeof(padding));
+    size_t tail = upload.size % TAR_BLOCK;
+    success = success && (tail == 0 || sendAll(socket, padding, TAR_BLOCK - tail));
+    if (success)
+        bytes += upload.size;
+    return success;
+}
+
+/* Send all of a buffer, return bool indicating success */
+bool SegmentUploader::sendAll(int socket, const void *data, size_t size) {
+    const char *next = (const char *) data;
+    while (size > 0) {
+        ssize_t sent = send(socket, next, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        next += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+/* Hold the rate to --offload-rate after sending bytes, return bool indicating no shutdown came */
+bool SegmentUploader::pace(uint64_t bytes) {
+    _paceBytes += bytes;
+    if (_options.offloadRate <= 0)
+        return !m_doShutdown;
+    /* Whole seconds and the rest apart, the bytes of a long offload times 1e9 would overflow */
+    uint64_t rate = (uint64_t) _options.offloadRate << 20;
+    uint64_t due = _paceBytes / rate * 1000000000ULL + _paceBytes % rate * 1000000000ULL / rate;
+    uint64_t elapsed = now() - _paceStart;
+    return due <= elapsed ? !m_doShutdown : sleepFor(due - elapsed);
+}
+
+/* Sleep up to ns in short steps, return bool indicating the whole time passed without a shutdown */
+bool SegmentUploader::sleepFor(uint64_t ns) {
+    uint64_t end = now() + ns;
+    while (!m_doShutdown) {
+        uint64_t time = now();
+        if (time >= end)
+            return true;
+        usleep(std::min<uint64_t>(end - time, OFFLOAD_BACKOFF_NS) / 1000);
+    }
+    return false;
+}
@@ -0,0 +1,123 @@
+/*
+ * SessionEvents.cpp
+ *
+ * A thread that drains one capture session's IEventProvider for the whole run.
+ * Each wait moves the session's pending events into the queue, replacing the
+ * previous ones, so the thread waits again as soon as it has counted them.
+ * The wait is bounded so shutdown is noticed on a session that has stopped.
+ */
+
+#include "SessionEvents.hpp"
+
+#include "Options.hpp"
+#include "Logger.hpp"
+#include <sstream>
+#include <vector>
+
+using namespace Argus;
+
+#define STDOUT_PRINT true
+#define EVENT_WAIT_NS 100000000ULL  // bounds how long shutdown waits on an idle session
+
+SessionEvents::SessionEvents(uint32_t id, CaptureSession *session, const Options& options) :
+    _id(id),
+    _session(session),
+    _options(options),
+    _logger(NULL),
+    _iEventProvider(NULL),
+    _capturesCompleted(0),
+    _capturesFailed(0),
+    _errors(0)
+{}
+
+SessionEvents::~SessionEvents() {
+    if (_logger)
+        delete _logger;
+}
+
+uint32_t SessionEvents::getId() const {
+    return _id;
+}
+
+/* Captures the session completed, including failed ones */
+uint64_t SessionEvents::getCapturesCompleted() {
+    return _capturesCompleted;
+}
+
+/* Captures completed with a status other than OK */
+uint64_t SessionEvents::getCapturesFailed() {
+    return _capturesFailed;
+}
+
+/* Error events the session reported */
+uint64_t SessionEvents::getErrors() {
+    return _errors;
+}
+
+bool SessionEvents::threadInitialize() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "SESSION " << _id;
+        _logger = new Logger(ss.str(), _options.directory);
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Subscribe to the capture-complete and error events */
+    if (!errorOccurred) {
+        _iEventProvider = interface_cast<IEventProvider>(_session);
+        std::vector<EventType> types;
+        types.push_back(EVENT_TYPE_CAPTURE_COMPLETE);
+        types.push_back(EVENT_TYPE_ERROR);
+        if (_iEventProvider)
+            _queue.reset(_iEventProvider->createEventQueue(types));
+        if (!_queue) {
+            _logger->error("Failed to create the session's event queue!");
+            errorOccurred = true;
+        }
+    }
+
+    return !errorOccurred;
+}
+
+bool SessionEvents::threadExecute() {
+    _iEventProvider->waitForEvents(_queue.get(), EVENT_WAIT_NS);
+    IEventQueue *iQueue = interface_cast<IEventQueue>(_queue);
+    for (uint32_t i = 0; iQueue && i < iQueue->getSize(); i++) {
+        const Event *event = iQueue->getEvent(i);
+        const IEvent *iEvent = interface_cast<const IEvent>(event);
+        if (!iEvent)
+            continue;
+        if (iEvent->getEventType() == EVENT_TYPE_CAPTURE_COMPLETE) {
+            const IEventCaptureComplete *iComplete = interface_cast<const IEventCaptureComplete>(event);
+            _capturesCompleted++;
+            if (iComplete && iComplete->getStatus() != STATUS_OK)
+                _capturesFailed++;
+        } else if (iEvent->getEventType() == EVENT_TYPE_ERROR) {
+            const IEventError *iError = interface_cast<const IEventError>(event);
+            _errors++;
+            std::stringstream ss;
+            ss << "Capture " << iEvent->getCaptureId() << " reported an error, status "
+               << (iError ? (int) iError->getStatus() : -1) << ", at " << iEvent->getTime() << " ns";
+            _logger->log(ss.str(), STDOUT_PRINT);
+        }
+    }
+    return true;
+}
+
+bool SessionEvents::threadShutdown() {
+    _queue.reset();
+    std::stringstream ss;
+    ss << "Captures completed: " << _capturesCompleted << ", failed: " << _capturesFailed << ", error events: " << _errors;
+    _logger->log(ss.str(), _capturesFailed + _errors > 0);
+    return true;
+}
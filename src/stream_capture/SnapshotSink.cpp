@@ -0,0 +1,65 @@
+/*
+ * SnapshotSink.cpp
+ *
+ * A PreviewSink that JPEG encodes every composite it is handed and replaces
+ * preview.jpg in the root directory with it. The file is written to a
+ * temporary and renamed, so a viewer or web server polling it never reads a
+ * partial image.
+ */
+
+#include "SnapshotSink.hpp"
+
+#include "Options.hpp"
+#include "NvJpegEncoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+SnapshotSink::SnapshotSink(const Options& options) :
+    _options(options),
+    _jpegEncoder(NULL),
+    _buffer(NULL),
+    _capacity(0)
+{}
+
+SnapshotSink::~SnapshotSink() {
+    close();
+}
+
+/* Create the encoder and an output buffer the size of the raw composite */
+bool SnapshotSink::open(const Argus::Size2D<uint32_t>& size) {
+    _filename = std::string(_options.directory) + "/preview.jpg";
+    _jpegEncoder = NvJPEGEncoder::createJPEGEncoder("previewenc");
+    _capacity = size.area() * 3 / 2;
+    _buffer = (unsigned char *) malloc(_capacity);
+    return _jpegEncoder && _buffer;
+}
+
+bool SnapshotSink::consume(int fd, uint64_t timestamp) {
+
+    /* libjpeg replaces a buffer it outgrows with its own, keep whichever it left us */
+    unsigned char *data = _buffer;
+    unsigned long size = _capacity;
+    if (_jpegEncoder->encodeFromFd(fd, JCS_YCbCr, &data, size) != 0)
+        return false;
+    if (data != _buffer) {
+        free(_buffer);
+        _buffer = data;
+        _capacity = size;
+    }
+
+    std::string temporary = _filename + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+    bool success = fwrite(data, 1, size, file) == size;
+    success = fclose(file) == 0 && success;
+    return success && rename(temporary.c_str(), _filename.c_str()) == 0;
+}
+
+void SnapshotSink::close() {
+    if (_jpegEncoder)
+        delete _jpegEncoder;
+    _jpegEncoder = NULL;
+    free(_buffer);
+    _buffer = NULL;
+}
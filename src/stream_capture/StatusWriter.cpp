@@ -0,0 +1,148 @@
+/*
+ * StatusWriter.cpp
+ *
+ * Periodically rewrites status.json in the output directory while recording,
+ * so a headless run can be monitored with nothing more than cat. The App calls
+ * publish() from its supervisor loop; rates are computed from the difference to
+ * the previous publish. The file is written to a temporary and renamed over the
+ * old one so readers never see a partial document. With a VolumeSet the free
+ * space and throughput of every volume are listed as well, with a
+ * BackpressureEngine each camera's current level, quality and save every.
+ * Each camera's drops are split by the stage that lost them, next to the
+ * measured sensor rate and frame interval jitter, and every capture session's
+ * completed and failed captures and error events are listed. With a
+ * CapacityForecast the recording time left is given, and each camera's
+ * image sizes it is forecast from.
+ */
+
+#include "StatusWriter.hpp"
+
+#include "Options.hpp"
+#include "ConsumerThread.hpp"
+#include "LatencyHistogram.hpp"
+#include "VolumeSet.hpp"
+#include "BackpressureEngine.hpp"
+#include "CapacityForecast.hpp"
+#include "SessionEvents.hpp"
+#include "FrameCadence.hpp"
+#include "ExposureGate.hpp"
+#include <stdio.h>
+#include <sys/statvfs.h>
+
+StatusWriter::StatusWriter(const Options& options, uint32_t numCameras, VolumeSet *volumes, BackpressureEngine *backpressure,
+                           CapacityForecast *forecast, const std::vector<SessionEvents*>& sessions) :
+    _options(options),
+    _volumes(volumes),
+    _backpressure(backpressure),
+    _forecast(forecast),
+    _sessions(sessions),
+    _filename(std::string(options.directory) + "/status.json"),
+    _start(std::chrono::steady_clock::now()),
+    _last(_start),
+    _lastFrames(numCameras, 0),
+    _lastBytes(numCameras, 0)
+{}
+
+/* Gather every camera's counters and replace status.json, return bool indicating success */
+bool StatusWriter::publish(ConsumerThread **consumers, uint32_t numCameras) {
+
+    auto now = std::chrono::steady_clock::now();
+    double interval = std::chrono::duration<double>(now - _last).count();
+    double uptime = std::chrono::duration<double>(now - _start).count();
+    _last = now;
+
+    struct statvfs volume;
+    uint64_t freeBytes = 0;
+    uint64_t totalBytes = 0;
+    if (statvfs(_options.directory, &volume) == 0) {
+        freeBytes = (uint64_t) volume.f_bavail * volume.f_frsize;
+        totalBytes = (uint64_t) volume.f_blocks * volume.f_frsize;
+    }
+
+    std::string temporary = _filename + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "w");
+    if (!file)
+        return false;
+
+    fprintf(file, "{\n  \"uptime_s\": %.1f,\n", uptime);
+    fprintf(file, "  \"volume\": {\"path\": \"%s\", \"free_bytes\": %lu, \"total_bytes\": %lu},\n",
+            _options.directory, freeBytes, totalBytes);
+    if (_volumes) {
+        fprintf(file, "  \"volumes\": [");
+        for (uint32_t i = 0; i < _volumes->getVolumeCount(); i++)
+            fprintf(file, "%s\n    {\"id\": %u, \"path\": \"%s\", \"free_bytes\": %lu, \"bytes_per_s\": %.0f, "
+                    "\"bytes_written\": %lu, \"full\": %s}", i ? "," : "", i, _volumes->getDirectory(i).c_str(),
+                    _volumes->getFreeBytes(i), _volumes->getBytesPerSecond(i), _volumes->getBytesWritten(i),
+                    _volumes->isFull(i) ? "true" : "false");
+        fprintf(file, "\n  ],\n");
+    }
+    if (_forecast) {
+        const Forecast& forecast = _forecast->getForecast();
+        fprintf(file, "  \"forecast\": {\"free_bytes\": %lu, \"bytes_per_s\": %.0f, \"bytes_per_s_p90\": %.0f, "
+                "\"remaining_s\": %.0f, \"remaining_s_p90\": %.0f},\n", forecast.freeBytes, forecast.bytesPerSecond,
+                forecast.bytesPerSecondHigh, forecast.remainingS, forecast.remainingSHigh);
+    }
+    fprintf(file, "  \"sessions\": [");
+    for (uint32_t i = 0, listed = 0; i < _sessions.size(); i++)
+        if (_sessions[i]) // none while its camera restarts
+            fprintf(file, "%s\n    {\"id\": %u, \"captures_completed\": %lu, \"captures_failed\": %lu, \"errors\": %lu}",
+                    listed++ ? "," : "", _sessions[i]->getId(), _sessions[i]->getCapturesCompleted(),
+                    _sessions[i]->getCapturesFailed(), _sessions[i]->getErrors());
+    fprintf(file, "\n  ],\n");
+    fprintf(file, "  \"cameras\": [");
+    for (uint32_t i = 0; i < numCameras && i < _lastFrames.size(); i++) {
+        ConsumerThread *consumer = consumers[i];
+        uint64_t frames = consumer->getFramesWritten();
+        uint64_t bytes = consumer->getBytesWritten();
+        double fps = interval > 0 ? (frames - _lastFrames[i]) / interval : 0;
+        double bytesPerSecond = interval > 0 ? (bytes - _lastBytes[i]) / interval : 0;
+        _lastFrames[i] = frames;
+        _lastBytes[i] = bytes;
+
+        const LatencyHistogram *latency = consumer->getLatency();
+        fprintf(file, "%s\n    {\"id\": %u, \"executing\": %s, \"paused\": %s, \"fps\": %.2f, \"frames_written\": %lu, "
+                "\"bytes_per_s\": %.0f, \"bytes_written\": %lu, \"frames_dropped\": %lu, \"acquire_timeouts\": %lu, "
+                "\"queue_depth\": %zu, \"stream_lost\": %s, \"restarts\": %u", i ? "," : "", i,
+                consumer->isExecuting() ? "true" : "false", consumer->isPaused() ? "true" : "false", fps, frames,
+                bytesPerSecond, bytes, consumer->getFramesDropped(), consumer->getAcquireTimeouts(),
+                consumer->getQueueDepth(), consumer->isStreamLost() ? "true" : "false", consumer->getRestarts());
+        if (latency)
+            fprintf(file, ", \"latency_us\": {\"p50\": %lu, \"p95\": %lu, \"p99\": %lu, \"max\": %lu}",
+                    latency->getPercentile(50), latency->getPercentile(95), latency->getPercentile(99), latency->getMax());
+        StageDrops drops;
+        consumer->getStageDrops(drops);
+        fprintf(file, ", \"drops\": {\"sensor\": %lu, \"replaced\": %lu, \"internal\": %lu, \"consumer\": %lu, "
+                "\"encoder\": %lu, \"writer\": %lu}", drops.sensor, drops.replaced, drops.internal, drops.consumer,
+                drops.encoder, drops.writer);
+        const FrameCadence *cadence = consumer->getCadence();
+        if (cadence) {
+            const LatencyHistogram *jitter = cadence->getJitter();
+            fprintf(file, ", \"sensor_fps\": %.2f, \"jitter_us\": {\"p50\": %lu, \"p99\": %lu, \"max\": %lu}",
+                    cadence->getSensorFps(), jitter->getPercentile(50), jitter->getPercentile(99), jitter->getMax());
+        }
+        if (_options.format == FORMAT_JPEG)
+            fprintf(file, ", \"quality\": %d", consumer->getQuality());
+        const ExposureGate *exposure = consumer->getExposureGate();
+        if (exposure)
+            fprintf(file, ", \"exposure\": {\"black\": %lu, \"saturated\": %lu, \"unmeasured\": %lu}",
+                    exposure->getFramesBlack(), exposure->getFramesSaturated(), exposure->getFramesUnmeasured());
+        const LatencyHistogram *writeLatency = consumer->getWriteLatency();
+        if (writeLatency)
+            fprintf(file, ", \"writes_in_flight\": %u, \"write_latency_us\": {\"p50\": %lu, \"p95\": %lu, \"p99\": %lu, \"max\": %lu}",
+                    consumer->getWritesInFlight(), writeLatency->getPercentile(50), writeLatency->getPercentile(95),
+                    writeLatency->getPercentile(99), writeLatency->getMax());
+        if (_backpressure)
+            fprintf(file, ", \"backpressure\": {\"level\": %u, \"floor\": %u, \"quality_drop\": %d, \"save_every\": %u, \"frames_shed\": %lu}",
+                    _backpressure->getLevel(i), _backpressure->getFloor(), _backpressure->getQualityDrop(i),
+                    _backpressure->getSaveEvery(i), _backpressure->getFramesShed(i));
+        if (_forecast)
+            fprintf(file, ", \"image_bytes\": {\"mean\": %.0f, \"p90\": %.0f, \"fps\": %.2f}", _forecast->getMeanSize(i),
+                    _forecast->getHighSize(i), _forecast->getFps(i));
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n  ]\n}\n");
+
+    bool success = !ferror(file);
+    success = fclose(file) == 0 && success;
+    return success && rename(temporary.c_str(), _filename.c_str()) == 0;
+}
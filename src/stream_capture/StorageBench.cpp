@@ -0,0 +1,283 @@
+/*
+ * StorageBench.cpp
+ *
+ * Replays the write pattern of a recording against candidate volumes before a
+ * mission. For each volume one FrameWriter per camera is fed images of the
+ * benchmark size at the benchmark rate from a BufferPool, exactly as the
+ * encoder workers would, so containers, --direct-io and --aio behave as in a
+ * run. The sustained rate, the write latency tail and the drops decide the
+ * recommended --save-every. The files written are removed afterwards.
+ */
+
+#include "StorageBench.hpp"
+
+#include "FrameWriter.hpp"
+#include "BufferPool.hpp"
+#include "VolumeSet.hpp"
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "PerfResults.hpp"
+#include "SteadyClock.hpp"
+#include <sys/stat.h>
+#include <ftw.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <sstream>
+
+#define MKDIR_MODE 0777
+#define STDOUT_PRINT true
+#define STORAGE_BENCH_SUFFIX "-bench"   // appended to the run directory name, never collides with a run
+#define STORAGE_BENCH_HEADROOM 0.8      // share of the sustained rate a recommendation may use
+#define REMOVE_FDS 16                   // descriptors nftw may hold open
+
+/* Sleep until the steady clock reaches time in ns */
+static void sleepUntil(uint64_t time) {
+    struct timespec deadline = {(time_t) (time / 1000000000ULL), (long) (time % 1000000000ULL)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+}
+
+/* nftw callback removing every file and directory, children first */
+static int removeEntry(const char *path, const struct stat *sb, int flag, struct FTW *ftwbuf) {
+    return remove(path);
+}
+
+StorageBench::StorageBench(Options& options) :
+    _options(options),
+    _logger(NULL)
+{}
+
+StorageBench::~StorageBench() {
+    if (_logger)
+        delete _logger;
+}
+
+/* Benchmark each candidate volume until done or doRun clears, return bool indicating success */
+bool StorageBench::run(const std::atomic<bool>& doRun) {
+
+    bool errorOccurred = false;
+
+    /* Create the logger, every run directory it could live in is removed again */
+    if (!errorOccurred) {
+        _logger = new Logger("STORAGE", "");
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Test the listed volumes, or every mounted device */
+    std::vector<std::string> volumes;
+    if (!errorOccurred) {
+        volumes = _options.volumes.empty() ? VolumeSet::findVolumes() : _options.volumes;
+        if (volumes.empty()) {
+            _logger->error("No volumes found to benchmark! Exiting...");
+            errorOccurred = true;
+        }
+    }
+
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "Replaying " << _options.benchCameras << " cameras writing " << _options.benchFrameSize << " KiB images at "
+           << _options.benchFps << " fps, " << getDemand() / (1 << 20) << " MiB/s, against " << volumes.size()
+           << " volumes for " << (_options.captureTime > 0 ? _options.captureTime : STORAGE_BENCH_TIME) << " s each";
+        _logger->log(ss.str(), STDOUT_PRINT);
+    }
+
+    /* Benchmark each volume, one that fails is reported and the rest still run */
+    std::stringstream workload;
+    workload << _options.benchCameras << "x" << _options.benchFrameSize << "@" << _options.benchFps << " for "
+             << (_options.captureTime > 0 ? _options.captureTime : STORAGE_BENCH_TIME) << " s per volume";
+    PerfResults results("storage", workload.str());
+    int best = -1;
+    double bestRate = 0;
+    for (uint32_t i = 0; i < volumes.size() && !errorOccurred && doRun; i++) {
+        Result result;
+        errorOccurred = !benchVolume(volumes[i], doRun, result);
+        if (errorOccurred)
+            break;
+
+        double rate = result.seconds > 0 ? result.bytesWritten / result.seconds : 0;
+        int saveEvery = recommendSaveEvery(result);
+        std::stringstream ss;
+        ss << "Volume " << volumes[i] << ": " << rate / (1 << 20) << " MiB/s sustained, " << result.framesWritten
+           << " images written, " << result.framesDropped << " dropped, write latency p50/p99/max " << result.p50
+           << "/" << result.p99 << "/" << result.max << " us";
+        if (result.failed)
+            ss << ", writes failed, is the volume full or failing?";
+        else if (saveEvery > 0)
+            ss << ", recommended --save-every " << saveEvery;
+        else
+            ss << ", unusable";
+        _logger->log(ss.str(), STDOUT_PRINT);
+        std::string prefix = "volume" + std::to_string(i) + ".";
+        results.add(prefix + "mib_per_s", result.failed ? 0 : rate / (1 << 20));
+        results.add(prefix + "p50_us", result.p50);
+        results.add(prefix + "p99_us", result.p99);
+        results.add(prefix + "dropped", result.framesDropped);
+        if (!result.failed && rate > bestRate) {
+            best = i;
+            bestRate = rate;
+        }
+    }
+
+    if (!errorOccurred && best >= 0)
+        _logger->log("Fastest volume: " + volumes[best], STDOUT_PRINT);
+
+    /* With --bench-json the results are kept for make perf-check, volumes in the order tested */
+    if (!errorOccurred && !_options.benchJson.empty() && !results.write(_options.benchJson)) {
+        _logger->error("Failed to write " + _options.benchJson + "!");
+        errorOccurred = true;
+    }
+    return !errorOccurred;
+}
+
+/* Bytes per second the benchmark asks for */
+double StorageBench::getDemand() const {
+    return (double) _options.benchCameras * _options.benchFrameSize * 1024 * _options.benchFps;
+}
+
+/* Write the pattern to the volume for the benchmark time, false only if it could not be set up */
+bool StorageBench::benchVolume(const std::string& volume, const std::atomic<bool>& doRun, Result& result) {
+
+    bool errorOccurred = false;
+    result.volume = volume;
+    result.seconds = 0;
+    result.framesWritten = 0;
+    result.framesDropped = 0;
+    result.bytesWritten = 0;
+    result.p50 = 0;
+    result.p99 = 0;
+    result.max = 0;
+    result.failed = false;
+    uint32_t numCameras = _options.benchCameras;
+    unsigned long frameBytes = (unsigned long) _options.benchFrameSize * 1024;
+
+    /* Point the writers at a run directory of their own on the volume */
+    std::string name(_options.directory);
+    std::string directory = VolumeSet::join(volume, name + STORAGE_BENCH_SUFFIX);
+    _logger->log("Benchmarking " + volume + "...", STDOUT_PRINT);
+    if (mkdir(directory.c_str(), MKDIR_MODE) != 0) {
+        _logger->error("Failed to create " + directory + "!");
+        result.failed = true;
+        return true;
+    }
+    strncpy(_options.directory, directory.data(), FILENAME_MAX);
+    for (uint32_t i = 0; i < numCameras && !errorOccurred; i++) {
+        std::stringstream ss;
+        ss << directory << "/cam" << i;
+        if (mkdir(ss.str().c_str(), MKDIR_MODE) != 0) {
+            _logger->error("Failed to create the image sub-directory!");
+            errorOccurred = true;
+        }
+    }
+
+    /* One pool of incompressible images and a writer per camera, as the consumers create them */
+    std::vector<BufferPool*> pools;
+    std::vector<FrameWriter*> writers;
+    uint32_t seed = 2463534242U;
+    for (uint32_t i = 0; i < numCameras && !errorOccurred; i++) {
+        pools.push_back(new BufferPool(_options.writeQueue, frameBytes));
+        if (!pools[i] || !pools[i]->allocate()) {
+            _logger->error("Failed to allocate buffer memory!");
+            errorOccurred = true;
+            break;
+        }
+        std::vector<uint32_t> slots;
+        uint32_t slot;
+        unsigned char *data;
+        unsigned long capacity;
+        while (pools[i]->acquire(slot, data, capacity)) {
+            for (unsigned long j = 0; j + sizeof(seed) <= frameBytes; j += sizeof(seed)) {
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                memcpy(data + j, &seed, sizeof(seed));
+            }
+            slots.push_back(slot);
+        }
+        for (uint32_t j = 0; j < slots.size(); j++)
+            pools[i]->release(slots[j], NULL, 0);
+
+        writers.push_back(new FrameWriter(i, _options, *pools[i], NULL, NULL));
+        if (!writers[i] || !writers[i]->initialize() || !writers[i]->waitRunning()) {
+            _logger->error("Failed to start writer thread!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Hand every camera an image each frame period, ticks missed while behind are skipped */
+    uint64_t frameDuration = 1000000000ULL / _options.benchFps;
+    uint64_t start = now();
+    uint64_t end = start + (uint64_t) (_options.captureTime > 0 ? _options.captureTime : STORAGE_BENCH_TIME) * 1000000000ULL;
+    uint64_t next = start;
+    uint64_t index = 1;
+    uint64_t queueDrops = 0;
+    while (!errorOccurred && !result.failed && doRun && next < end) {
+        sleepUntil(next);
+        for (uint32_t i = 0; i < writers.size(); i++) {
+            EncodedFrame frame;
+            memset(&frame, 0, sizeof(frame));
+            if (!writers[i]->getBuffer(frame))
+                continue;
+            frame.size = frameBytes;
+            frame.index = index;
+            frame.timestamp = now();
+            if (!writers[i]->submit(frame)) {
+                writers[i]->returnBuffer(frame);
+                queueDrops++;
+            }
+            result.failed = result.failed || writers[i]->hasFailed();
+        }
+        index++;
+        next += frameDuration;
+        uint64_t time = now();
+        if (time > next + frameDuration)
+            next += (time - next) / frameDuration * frameDuration;
+    }
+
+    /* Drain the writers, the rate counts until the last image is down */
+    for (uint32_t i = 0; i < writers.size(); i++)
+        writers[i]->shutdown();
+    result.seconds = (now() - start) / 1e9;
+    result.framesDropped = queueDrops;
+    for (uint32_t i = 0; i < writers.size(); i++) {
+        const LatencyHistogram *latency = writers[i]->getWriteLatency();
+        result.framesWritten += writers[i]->getFramesWritten();
+        result.bytesWritten += writers[i]->getBytesWritten();
+        result.framesDropped += writers[i]->getFramesDropped();
+        result.failed = result.failed || writers[i]->hasFailed();
+        if (latency->getPercentile(99) >= result.p99) {
+            result.p50 = latency->getPercentile(50);
+            result.p99 = latency->getPercentile(99);
+            result.max = latency->getMax();
+        }
+    }
+    for (uint32_t i = 0; i < writers.size(); i++)
+        delete writers[i];
+    for (uint32_t i = 0; i < pools.size(); i++)
+        delete pools[i];
+
+    /* Leave nothing behind on the volume */
+    if (nftw(directory.c_str(), removeEntry, REMOVE_FDS, FTW_DEPTH | FTW_PHYS) != 0)
+        _logger->log("Failed to remove " + directory + ", delete it by hand", STDOUT_PRINT);
+    strncpy(_options.directory, name.data(), FILENAME_MAX);
+    return !errorOccurred;
+}
+
+/* Smallest save every that keeps the demand within the headroom of the sustained rate, 1 if nothing
+   was dropped, 0 if the volume wrote nothing */
+int StorageBench::recommendSaveEvery(const Result& result) const {
+    if (result.framesDropped == 0 && !result.failed)
+        return 1;
+    double rate = result.seconds > 0 ? result.bytesWritten / result.seconds : 0;
+    if (rate <= 0)
+        return 0;
+    int saveEvery = (int) ceil(getDemand() / (rate * STORAGE_BENCH_HEADROOM));
+    return saveEvery < 2 ? 2 : saveEvery;
+}
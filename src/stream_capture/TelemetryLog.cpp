@@ -0,0 +1,83 @@
+/*
+ * TelemetryLog.cpp
+ *
+ * Appends one fixed-size binary record per saved, dropped or skipped frame to
+ * cam<N>/telemetry.bin. Each pipeline stage fills in its own timings as the
+ * record travels with the frame, and the last stage appends it. Records are
+ * batched in memory so logging costs a copy per frame and a write per batch.
+ * Decode with the TelemetryDump tool.
+ */
+
+#include "TelemetryLog.hpp"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define FILE_MODE 0666
+#define TELEMETRY_BATCH 64 // records per write, about 2 s of one camera at 30 fps
+
+TelemetryLog::TelemetryLog(uint32_t id, std::string directory) :
+    _id(id),
+    _directory(directory),
+    _fd(-1),
+    _records(0)
+{
+    _batch.reserve(TELEMETRY_BATCH);
+}
+
+TelemetryLog::~TelemetryLog() {
+    close();
+}
+
+/* Create the file and write its header */
+bool TelemetryLog::open() {
+    std::string filename = _directory + "/telemetry.bin";
+    _fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, FILE_MODE);
+    if (_fd == -1)
+        return false;
+
+    TelemetryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TELEMETRY_MAGIC, sizeof(header.magic));
+    header.camera = _id;
+    header.recordSize = sizeof(TelemetryRecord);
+    return write(_fd, &header, sizeof(header)) == sizeof(header);
+}
+
+/* Queue one record, safe to call from any stage thread */
+bool TelemetryLog::append(const TelemetryRecord& record) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _batch.push_back(record);
+    _records++;
+    if (_batch.size() < TELEMETRY_BATCH)
+        return true;
+    return flush();
+}
+
+/* Write the last partial batch and close the file */
+bool TelemetryLog::close() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    bool success = flush();
+    if (_fd != -1) {
+        ::close(_fd);
+        _fd = -1;
+    }
+    return success;
+}
+
+uint64_t TelemetryLog::getRecordCount() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _records;
+}
+
+/* Write the batched records, call with _mutex held */
+bool TelemetryLog::flush() {
+    bool success = true;
+    if (_fd != -1 && !_batch.empty()) {
+        ssize_t size = _batch.size() * sizeof(TelemetryRecord);
+        success = write(_fd, _batch.data(), size) == size;
+    }
+    _batch.clear();
+    return success;
+}
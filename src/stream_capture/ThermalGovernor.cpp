@@ -0,0 +1,421 @@
+/*
+ * ThermalGovernor.cpp
+ *
+ * Sheds capture load in logged steps as the hottest thermal zone nears its
+ * throttle point, and gives it back once the board has cooled. Throttle points
+ * are the zones' lowest passive trip points, zones without one are watched at
+ * a default if they are one of the SoC's -therm sensors. Every sample goes to
+ * thermal.csv with the clocks, the nvpmodel mode, the input power from the
+ * INA3221 monitor and the frames per joule.
+ */
+
+#include "ThermalGovernor.hpp"
+
+#include "CaptureGraph.hpp"
+#include "ConsumerThread.hpp"
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "SteadyClock.hpp"
+#include <glob.h>
+#include <string.h>
+#include <sstream>
+
+using namespace Argus;
+
+#define STDOUT_PRINT true
+#define THERMAL_ZONES_GLOB "/sys/class/thermal/thermal_zone*"
+#define TRIP_POINTS_MAX 16
+#define THROTTLE_DEFAULT_MC 95000       // zones without a passive trip point, below the TX2's software throttling
+#define HYSTERESIS_MC 5000              // headroom beyond the margin that counts as cooled down
+#define ESCALATE_HOLD_NS 10000000000ULL // time within the margin before stepping up, the board heats slowly
+#define RELAX_HOLD_NS 60000000000ULL    // time above the margin and the hysteresis before stepping down
+#define SAVE_EVERY_MAX 4U               // largest save every multiplier
+#define QUALITY_STEP 10                 // quality given up per level
+#define QUALITY_DROP_MAX 20             // most quality the ladder gives up
+#define QUALITY_MIN 30                  // lowest quality the ladder lowers to
+#define NVPMODEL_STATUS "/var/lib/nvpmodel/status"
+#define CPU_FREQ_FILE "/sys/devices/system/cpu/cpu%u/cpufreq/scaling_cur_freq"
+#define CPUS_MAX 8
+#define POWER_RAILS_GLOB "/sys/bus/i2c/drivers/ina3221x/*/iio:device*/rail_name_*"
+#define POWER_RAIL "VDD_IN"             // the whole module's input
+
+/* Clock rates in Hz, the first readable one is used, debugfs needs root */
+static const char *GPU_RATE_PATHS[] = {
+    "/sys/devices/17000000.gp10b/devfreq/17000000.gp10b/cur_freq",
+    "/sys/kernel/debug/bpmp/debug/clk/gpcclk/rate",
+    NULL
+};
+static const char *EMC_RATE_PATHS[] = {
+    "/sys/kernel/debug/bpmp/debug/clk/emc/rate",
+    "/sys/kernel/debug/clk/emc/clk_rate",
+    NULL
+};
+
+/* Read the first integer of a sysfs file */
+static bool readValue(const std::string& path, int64_t& value) {
+    FILE *file = fopen(path.c_str(), "r");
+    if (!file)
+        return false;
+    long long read;
+    bool success = fscanf(file, "%lld", &read) == 1;
+    fclose(file);
+    if (success)
+        value = read;
+    return success;
+}
+
+/* Read the first word of a sysfs file */
+static bool readWord(const std::string& path, std::string& word) {
+    FILE *file = fopen(path.c_str(), "r");
+    if (!file)
+        return false;
+    char buffer[64];
+    bool success = fscanf(file, "%63s", buffer) == 1;
+    fclose(file);
+    if (success)
+        word = buffer;
+    return success;
+}
+
+/* The current nvpmodel mode, -1 if unknown */
+static int readNvpmodel() {
+    FILE *file = fopen(NVPMODEL_STATUS, "r");
+    if (!file)
+        return -1;
+    int mode = -1;
+    if (fscanf(file, "pmode:%d", &mode) != 1)
+        mode = -1;
+    fclose(file);
+    return mode;
+}
+
+static std::string findPath(const char **candidates) {
+    int64_t value;
+    for (uint32_t i = 0; candidates[i]; i++)
+        if (readValue(candidates[i], value))
+            return candidates[i];
+    return "";
+}
+
+/* MHz from a file holding Hz, -1 if unreadable */
+static int64_t readMhz(const std::string& path) {
+    int64_t rate;
+    return !path.empty() && readValue(path, rate) ? rate / 1000000 : -1;
+}
+
+ThermalGovernor::ThermalGovernor(Options& options, CaptureGraph& graph, ConsumerThread **consumers, uint32_t numCameras,
+                                 const Range<uint64_t>& frameDurationRange) :
+    _options(options),
+    _graph(graph),
+    _consumers(consumers),
+    _numCameras(numCameras),
+    _frameDurationRange(frameDurationRange),
+    _quality(numCameras, 0),
+    _parked(numCameras, false),
+    _level(0),
+    _highestLevel(0),
+    _logger(NULL),
+    _file(NULL),
+    _start(now()),
+    _lastSample(0),
+    _belowSince(0),
+    _aboveSince(0),
+    _governedNs(0),
+    _lastFrames(0),
+    _frames(0),
+    _energy(0),
+    _nvpmodel(-1)
+{
+    /* Build the ladder, fewer frames relieve the encoder, the writers and a stretched sensor alike
+       and go first, parking cameras goes last. A stretched sensor can only slow down as far as its mode allows,
+       and cameras with a size budget keep steering their own quality */
+    Step step = {1, 0, 0};
+    _steps.push_back(step);
+    for (step.saveEvery = 2; step.saveEvery <= SAVE_EVERY_MAX; step.saveEvery *= 2) {
+        bool possible = true;
+        for (uint32_t i = 0; i < numCameras && !options.fullRate; i++)
+            possible = possible && options.getFrameDuration(i, options.getSaveEvery(i) * step.saveEvery) <= frameDurationRange.max();
+        if (!possible)
+            break;
+        _steps.push_back(step);
+    }
+    step.saveEvery = _steps.back().saveEvery;
+    bool fixedQuality = false;
+    for (uint32_t i = 0; i < numCameras; i++)
+        fixedQuality = fixedQuality || options.getQualityBudget(i) == 0;
+    if (options.format == FORMAT_JPEG && fixedQuality) {
+        for (step.qualityDrop = QUALITY_STEP; step.qualityDrop <= QUALITY_DROP_MAX; step.qualityDrop += QUALITY_STEP)
+            _steps.push_back(step);
+        step.qualityDrop = _steps.back().qualityDrop;
+    }
+    for (step.parked = 1; step.parked < numCameras; step.parked++)
+        _steps.push_back(step);
+}
+
+ThermalGovernor::~ThermalGovernor() {
+    close();
+    if (_logger)
+        delete _logger;
+}
+
+/* Find the zones, clocks and power monitor and open thermal.csv, return bool indicating success */
+bool ThermalGovernor::open() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        _logger = new Logger("THERMAL", _options.directory);
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Every zone that throttles, at its lowest passive trip point */
+    glob_t found;
+    if (!errorOccurred && glob(THERMAL_ZONES_GLOB, 0, NULL, &found) == 0) {
+        for (size_t i = 0; i < found.gl_pathc; i++) {
+            std::string directory = found.gl_pathv[i];
+            Zone zone;
+            zone.path = directory + "/temp";
+            zone.throttle = 0;
+            int64_t value;
+            if (!readWord(directory + "/type", zone.name) || !readValue(zone.path, value))
+                continue;
+            for (uint32_t j = 0; j < TRIP_POINTS_MAX; j++) {
+                std::string type;
+                std::string trip = directory + "/trip_point_" + std::to_string(j);
+                if (!readWord(trip + "_type", type))
+                    break;
+                if (type == "passive" && readValue(trip + "_temp", value) && value > 0 &&
+                    (zone.throttle == 0 || value < zone.throttle))
+                    zone.throttle = value;
+            }
+            if (zone.throttle == 0 && zone.name.size() > 6 && zone.name.compare(zone.name.size() - 6, 6, "-therm") == 0)
+                zone.throttle = THROTTLE_DEFAULT_MC;
+            if (zone.throttle > 0)
+                _zones.push_back(zone);
+        }
+        globfree(&found);
+    }
+    if (!errorOccurred && _zones.empty()) {
+        _logger->error("No thermal zone with a throttle point found!");
+        errorOccurred = true;
+    }
+
+    /* The clocks and the module's input rail, each is optional */
+    if (!errorOccurred) {
+        int64_t value;
+        for (uint32_t i = 0; i < CPUS_MAX; i++) {
+            char path[128];
+            snprintf(path, sizeof(path), CPU_FREQ_FILE, i);
+            if (readValue(path, value))
+                _cpuPaths.push_back(path);
+        }
+        _gpuPath = findPath(GPU_RATE_PATHS);
+        _emcPath = findPath(EMC_RATE_PATHS);
+        if (glob(POWER_RAILS_GLOB, 0, NULL, &found) == 0) {
+            for (size_t i = 0; i < found.gl_pathc && _powerPath.empty(); i++) {
+                std::string rail;
+                std::string path = found.gl_pathv[i];
+                size_t name = path.rfind("rail_name_");
+                if (readWord(path, rail) && rail == POWER_RAIL)
+                    _powerPath = path.substr(0, name) + "in_power" + path.substr(name + 10) + "_input";
+            }
+            globfree(&found);
+        }
+    }
+
+    /* Open the sample log */
+    if (!errorOccurred) {
+        std::string filename = std::string(_options.directory) + "/thermal.csv";
+        _file = fopen(filename.c_str(), "w");
+        if (!_file || fprintf(_file, "elapsed_ms,nvpmodel,cpu_mhz,gpu_mhz,emc_mhz,power_mw,zone,temp_mc,headroom_mc,"
+                              "level,frames,frames_per_joule\n") < 0) {
+            _logger->error("Failed to create thermal.csv!");
+            errorOccurred = true;
+        }
+    }
+
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "Ladder of " << _steps.size() - 1 << " levels, up to save every x" << _steps.back().saveEvery << ", "
+           << _steps.back().qualityDrop << " quality points off and " << _steps.back().parked << " cameras parked, "
+           << "throttle points:";
+        for (size_t i = 0; i < _zones.size(); i++)
+            ss << " " << _zones[i].name << " " << _zones[i].throttle / 1000.0 << " C";
+        _logger->log(ss.str());
+        _nvpmodel = readNvpmodel();
+        _logger->log("nvpmodel mode " + std::to_string(_nvpmodel) + (_powerPath.empty() ? ", no " POWER_RAIL " power monitor"
+                     : ", power from " + _powerPath), _powerPath.empty());
+    }
+    return !errorOccurred;
+}
+
+/* Close thermal.csv and log how far the run was governed and what its frames cost */
+void ThermalGovernor::close() {
+    if (!_file)
+        return;
+    if (fclose(_file) != 0)
+        _logger->error("Failed to close thermal.csv!");
+    _file = NULL;
+
+    std::stringstream ss;
+    ss << "Highest level: " << _highestLevel << ", " << _governedNs / 1000000000ULL << " s above level 0";
+    if (_energy > 0)
+        ss << ", " << _frames << " frames on " << (uint64_t) _energy << " J, " << _frames / _energy
+           << " frames per joule at a mean " << _energy / ((_lastSample - _start) / 1e9) << " W in nvpmodel mode "
+           << _nvpmodel;
+    _logger->log(ss.str(), STDOUT_PRINT);
+}
+
+/* Read the sensors once the interval has passed, log them and step the ladder, from the supervisor */
+void ThermalGovernor::sample() {
+    uint64_t time = now();
+    if (!_file || (_lastSample != 0 && time - _lastSample < GOVERNOR_INTERVAL_MS * 1000000ULL))
+        return;
+    double seconds = _lastSample ? (time - _lastSample) / 1e9 : 0;
+    if (_level > 0 && _lastSample)
+        _governedNs += time - _lastSample;
+    _lastSample = time;
+
+    /* The zone with the least headroom decides */
+    const Zone *hottest = NULL;
+    int64_t temperature = -1;
+    int64_t headroom = 0;
+    for (size_t i = 0; i < _zones.size(); i++) {
+        int64_t value;
+        if (!readValue(_zones[i].path, value))
+            continue;
+        if (!hottest || _zones[i].throttle - value < headroom) {
+            hottest = &_zones[i];
+            temperature = value;
+            headroom = _zones[i].throttle - value;
+        }
+    }
+
+    int64_t cpuMhz = -1;
+    for (size_t i = 0; i < _cpuPaths.size(); i++) {
+        int64_t value;
+        if (readValue(_cpuPaths[i], value) && value / 1000 > cpuMhz)
+            cpuMhz = value / 1000;
+    }
+    int64_t power = -1;
+    if (!_powerPath.empty() && !readValue(_powerPath, power))
+        power = -1;
+    int nvpmodel = readNvpmodel();
+    if (nvpmodel != _nvpmodel) {
+        _logger->log("nvpmodel mode " + std::to_string(_nvpmodel) + " -> " + std::to_string(nvpmodel), STDOUT_PRINT);
+        _nvpmodel = nvpmodel;
+    }
+
+    /* Frames per joule over the interval, the run's total only counts intervals with a known power */
+    uint64_t frames = 0;
+    for (uint32_t i = 0; i < _numCameras; i++)
+        frames += _consumers[i]->getFramesWritten();
+    uint64_t interval = frames - _lastFrames;
+    _lastFrames = frames;
+    double joules = power > 0 ? power / 1000.0 * seconds : 0;
+    if (joules > 0) {
+        _energy += joules;
+        _frames += interval;
+    }
+
+    if (fprintf(_file, "%lu,%d,%ld,%ld,%ld,%ld,%s,%ld,%ld,%u,%lu,%.2f\n", (time - _start) / 1000000, nvpmodel, cpuMhz,
+                readMhz(_gpuPath), readMhz(_emcPath), power, hottest ? hottest->name.c_str() : "", temperature,
+                hottest ? headroom : -1, _level, interval, joules > 0 ? interval / joules : 0) < 0)
+        _logger->error("Failed to write thermal.csv!");
+    fflush(_file);
+    if (!hottest)
+        return;
+
+    /* Step up while within the margin, down once well clear of it */
+    int64_t margin = _options.thermalMargin * 1000LL;
+    if (headroom < margin) {
+        _aboveSince = 0;
+        if (!_belowSince)
+            _belowSince = time;
+        if (time - _belowSince >= ESCALATE_HOLD_NS && _level + 1 < _steps.size()) {
+            _belowSince = time;
+            change(_level + 1, *hottest, temperature, headroom);
+        }
+    } else if (headroom > margin + HYSTERESIS_MC) {
+        _belowSince = 0;
+        if (!_aboveSince)
+            _aboveSince = time;
+        if (time - _aboveSince >= RELAX_HOLD_NS && _level > 0) {
+            _aboveSince = time;
+            change(_level - 1, *hottest, temperature, headroom);
+        }
+    } else {
+        _belowSince = 0;
+        _aboveSince = 0;
+    }
+}
+
+uint32_t ThermalGovernor::getLevel() const {
+    return _level;
+}
+
+/* Move every camera to level, changing only what differs between the two steps */
+void ThermalGovernor::change(uint32_t level, const Zone& zone, int64_t temperature, int64_t headroom) {
+    const Step& from = _steps[_level];
+    const Step& to = _steps[level];
+
+    /* The qualities to restore are those from before the first step, set by the options or the control socket */
+    if (_level == 0)
+        for (uint32_t i = 0; i < _numCameras; i++)
+            _quality[i] = _consumers[i]->getQuality();
+
+    for (uint32_t i = 0; i < _numCameras; i++) {
+        if (to.saveEvery != from.saveEvery && !setSaveEvery(i, _options.getSaveEvery(i) * to.saveEvery))
+            _logger->log("Camera " + std::to_string(i) + ": " + _graph.getError() + ", save every unchanged", STDOUT_PRINT);
+
+        CameraControl update;
+        memset(&update, 0, sizeof(update));
+        if (to.qualityDrop != from.qualityDrop && _options.getQualityBudget(i) == 0) {
+            int lowered = _quality[i] - to.qualityDrop;
+            update.quality = lowered >= QUALITY_MIN || to.qualityDrop == 0 ? lowered
+                             : _quality[i] < QUALITY_MIN ? _quality[i] : QUALITY_MIN;
+        }
+        bool park = i >= _numCameras - to.parked;
+        if (park != _parked[i]) {
+            update.pause = park ? 1 : -1;
+            _parked[i] = park;
+        }
+        if (update.quality || update.pause)
+            _consumers[i]->control(update);
+    }
+
+    std::stringstream ss;
+    ss << "Level " << _level << " -> " << level << " (save every x" << to.saveEvery << ", quality -" << to.qualityDrop
+       << ", " << to.parked << " cameras parked), " << zone.name << " at " << temperature / 1000.0 << " C, "
+       << headroom / 1000.0 << " C below throttling";
+    _logger->log(ss.str(), STDOUT_PRINT);
+    _options.writeChange("thermal level " + std::to_string(level));
+    _level = level;
+    if (level > _highestLevel)
+        _highestLevel = level;
+}
+
+/* Save every n-th frame of the camera, re-timing a stretched sensor as the control socket does */
+bool ThermalGovernor::setSaveEvery(uint32_t camera, uint32_t saveEvery) {
+    CameraControl update;
+    memset(&update, 0, sizeof(update));
+    if (!_options.fullRate) {
+        uint64_t duration = _options.getFrameDuration(camera, saveEvery);
+        Range<uint64_t> range = duration == _options.captureFrameDuration ? _frameDurationRange : Range<uint64_t>(duration);
+        bool submit = !_graph.isShared() || camera == 0;
+        if (submit && (!_graph.setFrameDuration(camera, range) || !_graph.submit(camera)))
+            return false;
+        update.frameDuration = duration;
+    } else {
+        update.stride = saveEvery;
+    }
+    _consumers[camera]->control(update);
+    return true;
+}
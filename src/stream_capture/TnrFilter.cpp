@@ -0,0 +1,155 @@
+/*
+ * TnrFilter.cpp
+ *
+ * Temporal noise reduction on the VIC through an NvVideoConverter whose
+ * planes both import dmabufs. Each frame is queued with its ring slot as the
+ * capture buffer and both are dequeued again before the next, so the slot
+ * holds the filtered frame when process() returns.
+ */
+
+#include "TnrFilter.hpp"
+
+#include "MemoryBudget.hpp"
+#include "SteadyClock.hpp"
+#include "NvVideoConverter.h"
+#include <string.h>
+
+#define DQ_RETRIES 1000 // ms to wait for the converter to return a buffer
+
+using namespace Argus;
+
+TnrFilter::TnrFilter(uint32_t id, int algorithm) :
+    _id(id),
+    _algorithm(algorithm),
+    _converter(NULL),
+    _staging(-1),
+    _numPlanes(0),
+    _frames(0)
+{}
+
+TnrFilter::~TnrFilter() {
+    close();
+}
+
+/* Set up the converter for frames of size into ring slots of format and layout and create the staging
+   buffer, return bool indicating success */
+bool TnrFilter::open(Size2D<uint32_t> size, NvBufferColorFormat format, NvBufferLayout layout) {
+
+    /* TNR only runs on planar and semi-planar 4:2:0 */
+    uint32_t pixfmt;
+    if (format == NvBufferColorFormat_YUV420) {
+        pixfmt = V4L2_PIX_FMT_YUV420M;
+        _numPlanes = 3;
+    } else if (format == NvBufferColorFormat_NV12) {
+        pixfmt = V4L2_PIX_FMT_NV12M;
+        _numPlanes = 2;
+    } else {
+        _error = "TNR needs YUV420 or NV12 frames";
+        return false;
+    }
+
+    NvBufferCreateParams params;
+    memset(&params, 0, sizeof(params));
+    params.width = size.width();
+    params.height = size.height();
+    params.payloadType = NvBufferPayload_SurfArray;
+    params.layout = NvBufferLayout_Pitch;
+    params.colorFormat = format;
+    params.nvbuf_tag = NvBufferTag_VIDEO_CONVERT;
+    if ((_staging = MemoryBudget::instance().createNvBuffer(MEMORY_RINGS, params)) == -1) {
+        _error = "Failed to create the TNR staging buffer";
+        return false;
+    }
+
+    std::string name = "tnr" + std::to_string(_id);
+    _converter = NvVideoConverter::createVideoConverter(name.c_str());
+    if (!_converter) {
+        _error = "Failed to create the video converter";
+        return false;
+    }
+    enum v4l2_nv_buffer_layout captureLayout = layout == NvBufferLayout_Pitch ? V4L2_NV_BUFFER_LAYOUT_PITCH
+                                                                                : V4L2_NV_BUFFER_LAYOUT_BLOCKLINEAR;
+    if (_converter->setOutputPlaneFormat(pixfmt, size.width(), size.height(), V4L2_NV_BUFFER_LAYOUT_PITCH) < 0
+        || _converter->setCapturePlaneFormat(pixfmt, size.width(), size.height(), captureLayout) < 0) {
+        _error = "Failed to set the video converter formats";
+        return false;
+    }
+    if (_converter->setTnrAlgorithm((enum v4l2_tnr_algorithm) _algorithm) < 0) {
+        _error = "Failed to set the TNR algorithm";
+        return false;
+    }
+
+    /* One buffer per plane, the dmabufs are attached anew on every queue */
+    if (_converter->output_plane.setupPlane(V4L2_MEMORY_DMABUF, 1, false, false) < 0
+        || _converter->capture_plane.setupPlane(V4L2_MEMORY_DMABUF, 1, false, false) < 0
+        || _converter->output_plane.setStreamStatus(true) < 0
+        || _converter->capture_plane.setStreamStatus(true) < 0) {
+        _error = "Failed to set up the video converter planes";
+        return false;
+    }
+    return true;
+}
+
+/* Filter the frame in input into output, both dmabufs of the opened size, return bool indicating success */
+bool TnrFilter::process(int input, int output) {
+    uint64_t start = now();
+    struct v4l2_buffer captureBuf, outputBuf;
+    struct v4l2_plane capturePlanes[MAX_PLANES], outputPlanes[MAX_PLANES];
+    memset(&captureBuf, 0, sizeof(captureBuf));
+    memset(&outputBuf, 0, sizeof(outputBuf));
+    memset(capturePlanes, 0, sizeof(capturePlanes));
+    memset(outputPlanes, 0, sizeof(outputPlanes));
+    captureBuf.m.planes = capturePlanes;
+    outputBuf.m.planes = outputPlanes;
+    for (uint32_t i = 0; i < _numPlanes; i++) {
+        capturePlanes[i].m.fd = output;
+        outputPlanes[i].m.fd = input;
+        outputPlanes[i].bytesused = 1; // must be non-zero, zero signals end of stream
+    }
+
+    /* The slot goes in first so the converter has somewhere to write as soon as the frame is queued */
+    if (_converter->capture_plane.qBuffer(captureBuf, NULL) < 0 || _converter->output_plane.qBuffer(outputBuf, NULL) < 0) {
+        _error = "Failed to queue the frame on the video converter";
+        return false;
+    }
+    if (_converter->capture_plane.dqBuffer(captureBuf, NULL, NULL, DQ_RETRIES) < 0
+        || _converter->output_plane.dqBuffer(outputBuf, NULL, NULL, DQ_RETRIES) < 0) {
+        _error = "The video converter did not return the frame";
+        return false;
+    }
+    _frames++;
+    _latency.record((now() - start) / 1000);
+    return true;
+}
+
+/* Stop and delete the converter and the staging buffer */
+void TnrFilter::close() {
+    if (_converter) {
+        _converter->output_plane.setStreamStatus(false);
+        _converter->capture_plane.setStreamStatus(false);
+        delete _converter;
+        _converter = NULL;
+    }
+    if (_staging != -1) {
+        MemoryBudget::instance().destroyNvBuffer(_staging);
+        _staging = -1;
+    }
+}
+
+/* Pitch linear buffer of the opened size and format, for frames that are not in a dmabuf yet */
+int TnrFilter::getStagingFd() const {
+    return _staging;
+}
+
+uint64_t TnrFilter::getFramesFiltered() const {
+    return _frames;
+}
+
+/* Time to filter one frame, queue to dequeue */
+const LatencyHistogram *TnrFilter::getLatency() const {
+    return &_latency;
+}
+
+const std::string& TnrFilter::getError() const {
+    return _error;
+}
@@ -0,0 +1,123 @@
+/*
+ * TraceLog.cpp
+ *
+ * Timeline of the pipeline stages with --trace. Each thread appends spans to
+ * a fixed buffer of its own, allocated on its first span, so recording is a
+ * couple of stores and one release store of the count with no locks. write()
+ * exports the spans as Chrome trace complete events, one track per thread,
+ * with the frame's image index or frame number as an argument.
+ */
+
+#include "TraceLog.hpp"
+
+#include "SteadyClock.hpp"
+#include <stdio.h>
+
+thread_local TraceLog::Buffer *TraceLog::_buffer = NULL;
+
+/* The process-wide trace, nothing is recorded until enable() */
+TraceLog& TraceLog::instance() {
+    static TraceLog trace;
+    return trace;
+}
+
+TraceLog::TraceLog() :
+    _enabled(false)
+{}
+
+TraceLog::~TraceLog() {
+    for (uint32_t i = 0; i < _buffers.size(); i++) {
+        delete[] _buffers[i]->spans;
+        delete _buffers[i];
+    }
+}
+
+/* Start recording, call before the threads to trace start */
+void TraceLog::enable() {
+    _enabled = true;
+}
+
+/* Name the calling thread's track */
+void TraceLog::nameThread(const std::string& name) {
+    if (!isEnabled())
+        return;
+    Buffer *buffer = getBuffer();
+    std::lock_guard<std::mutex> lock(_mutex);
+    buffer->name = name;
+}
+
+/* Steady clock time in ns, the clock every span is measured with */
+uint64_t TraceLog::now() {
+    return ::now();
+}
+
+/* First span of a thread, register a buffer for it */
+TraceLog::Buffer *TraceLog::createBuffer() {
+    Buffer *buffer = new Buffer;
+    buffer->spans = new Span[TRACE_BUFFER_SPANS];
+    buffer->count.store(0, std::memory_order_relaxed);
+    buffer->dropped.store(0, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(_mutex);
+    buffer->name = "thread " + std::to_string(_buffers.size());
+    _buffers.push_back(buffer);
+    return buffer;
+}
+
+/* Write every span recorded so far as Chrome trace JSON, return bool indicating success */
+bool TraceLog::write(const std::string& path) {
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    /* Times are shown from the earliest span on, an enclosing span is recorded after those it encloses */
+    uint64_t origin = UINT64_MAX;
+    for (uint32_t i = 0; i < _buffers.size(); i++) {
+        uint32_t count = _buffers[i]->count.load(std::memory_order_acquire);
+        for (uint32_t j = 0; j < count; j++)
+            if (_buffers[i]->spans[j].start < origin)
+                origin = _buffers[i]->spans[j].start;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"StreamCapture\"}}");
+    for (uint32_t i = 0; i < _buffers.size(); i++) {
+        const Buffer *buffer = _buffers[i];
+        fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+                i + 1, buffer->name.c_str());
+        fprintf(file, ",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"sort_index\": %u}}",
+                i + 1, i + 1);
+        uint32_t count = buffer->count.load(std::memory_order_acquire);
+        for (uint32_t j = 0; j < count; j++) {
+            const Span& span = buffer->spans[j];
+            uint64_t start = span.start - origin;
+            uint64_t duration = span.end > span.start ? span.end - span.start : 0;
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %lu.%03lu, \"dur\": %lu.%03lu",
+                    span.name, i + 1, start / 1000, start % 1000, duration / 1000, duration % 1000);
+            if (span.frame != UINT64_MAX)
+                fprintf(file, ", \"args\": {\"frame\": %lu}", span.frame);
+            fprintf(file, "}");
+        }
+    }
+    fprintf(file, "\n]}\n");
+    bool success = !ferror(file);
+    return fclose(file) == 0 && success;
+}
+
+/* Spans recorded by every thread */
+uint64_t TraceLog::getSpans() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint64_t spans = 0;
+    for (uint32_t i = 0; i < _buffers.size(); i++)
+        spans += _buffers[i]->count.load(std::memory_order_relaxed);
+    return spans;
+}
+
+/* Spans dropped as their thread's buffer was full */
+uint64_t TraceLog::getDropped() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint64_t dropped = 0;
+    for (uint32_t i = 0; i < _buffers.size(); i++)
+        dropped += _buffers[i]->dropped.load(std::memory_order_relaxed);
+    return dropped;
+}
@@ -0,0 +1,74 @@
+/*
+ * TriggerInput.cpp
+ *
+ * Watches a GPIO line through the sysfs interface for rising edges. The value
+ * file of an input with an edge set raises POLLPRI on every edge, and must be
+ * read from its start to re-arm.
+ */
+
+#include "TriggerInput.hpp"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#define EXPORT_SETTLE_US 100000 // udev needs a moment to hand the new line's files over
+
+TriggerInput::TriggerInput(int gpio) :
+    _gpio(gpio),
+    _fd(-1)
+{}
+
+TriggerInput::~TriggerInput() {
+    if (_fd != -1)
+        close(_fd);
+}
+
+/* Export the line if needed, make it a rising-edge input and open its value, return bool indicating success */
+bool TriggerInput::open() {
+    std::string directory = std::string(GPIO_SYSFS) + "/gpio" + std::to_string(_gpio);
+    struct stat info;
+    if (stat(directory.c_str(), &info) != 0) {
+        if (!writeFile(std::string(GPIO_SYSFS) + "/export", std::to_string(_gpio)))
+            return false;
+        usleep(EXPORT_SETTLE_US);
+    }
+    if (!writeFile(directory + "/direction", "in") || !writeFile(directory + "/edge", "rising"))
+        return false;
+
+    _fd = ::open((directory + "/value").c_str(), O_RDONLY | O_CLOEXEC);
+    if (_fd == -1) {
+        _error = "Failed to open " + directory + "/value";
+        return false;
+    }
+    acknowledge(); // clears an edge from before the line was polled
+    return true;
+}
+
+/* Descriptor raising POLLPRI on every rising edge, -1 before open() */
+int TriggerInput::getFd() const {
+    return _fd;
+}
+
+/* Read the value to re-arm the edge interrupt, true if the line is high */
+bool TriggerInput::acknowledge() {
+    char value = '0';
+    if (lseek(_fd, 0, SEEK_SET) == -1 || read(_fd, &value, sizeof(value)) != sizeof(value))
+        return false;
+    return value == '1';
+}
+
+const std::string& TriggerInput::getError() const {
+    return _error;
+}
+
+bool TriggerInput::writeFile(const std::string& path, const std::string& value) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    bool success = fd != -1 && write(fd, value.data(), value.size()) == (ssize_t) value.size();
+    if (fd != -1)
+        close(fd);
+    if (!success)
+        _error = "Failed to write " + value + " to " + path;
+    return success;
+}
@@ -0,0 +1,428 @@
+/*
+ * VideoWriter.cpp
+ *
+ * Records one camera as an H.264 or H.265 elementary stream with the hardware
+ * video encoder. Dmabufs from the DmabufRing are queued directly on the
+ * encoder's output plane (DMABUF memory, no CPU copy) and only released back
+ * to the ring once the encoder returns them. Encoded access units are written
+ * to cam<N>/stream.h264 or cam<N>/stream.h265 from the capture plane thread.
+ */
+
+#include "VideoWriter.hpp"
+
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "ThreadPlacement.hpp"
+#include "DmabufRing.hpp"
+#include "TelemetryLog.hpp"
+#include "VolumeSet.hpp"
+#include "DequeueLoops.hpp"
+#include "RoiMap.hpp"
+#include "SteadyClock.hpp"
+#include <NvVideoEncoder.h>
+#include <sstream>
+#include <sched.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define STDOUT_PRINT true
+#define POP_TIMEOUT_MS 100      // bounds how long shutdown waits on an idle queue
+#define DQ_RETRIES 1000         // ms to wait for the encoder to return an output buffer
+#define EOS_TIMEOUT_MS 2000     // ms to wait for the capture plane to drain at shutdown
+#define NUM_CAPTURE_BUFFERS 6
+#define FILE_MODE 0666
+
+VideoWriter::VideoWriter(uint32_t id, const Options& options, DmabufRing& ring, TelemetryLog *telemetry,
+                         VolumeSet *volumes) :
+    _id(id),
+    _options(options),
+    _logger(NULL),
+    _ring(ring),
+    _telemetry(telemetry),
+    _volumes(volumes),
+    _volume(-1),
+    _jobs(ring.getCount()),
+    _encoder(NULL),
+    _roi(NULL),
+    _outputFd(-1),
+    _numQueued(0),
+    _slots(ring.getCount(), -1),
+    _framesWritten(0),
+    _bytesWritten(0),
+    _failed(false)
+{}
+
+VideoWriter::~VideoWriter() {
+    if (_encoder)
+        delete _encoder;
+    if (_roi)
+        delete _roi;
+    if (_outputFd != -1) {
+        _behind.finish();
+        close(_outputFd);
+    }
+    if (_logger)
+        delete _logger;
+}
+
+bool VideoWriter::threadInitialize() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        std::stringstream ss;
+        ss << "VIDEO WRITER " << std::to_string(_id);
+        _logger = new Logger(ss.str(), _options.directory);
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Pin the thread and set its scheduling class, a failure is logged but not fatal */
+    if (!errorOccurred) {
+        placeThread(_options.getWriterCpu(_id), SCHED_OTHER, 0, _logger);
+    }
+
+    /* Create the elementary stream file, on the camera's volume for the whole run */
+    if (!errorOccurred) {
+        std::string directory(_options.directory);
+        if (_volumes) {
+            _volume = _volumes->assign(_id);
+            directory = _volume >= 0 ? _volumes->getDirectory(_volume) : "";
+        }
+        char filename[FILENAME_MAX];
+        snprintf(filename, FILENAME_MAX, "%s/cam%u/stream.%s", directory.c_str(), _id,
+                 _options.format == FORMAT_H265 ? "h265" : "h264");
+        _outputFd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, FILE_MODE);
+        if (_options.directIo && _outputFd != -1)
+            _behind.reset(_outputFd, WRITE_BEHIND_WINDOW);
+        if (_outputFd == -1) {
+            _logger->error("Failed to create the video stream file!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Create the ROI map, static regions and the saliency downscale target */
+    if (!errorOccurred) {
+        _roi = new RoiMap(_id, _options);
+        if (!_roi->open()) {
+            _logger->error(_roi->getError() + "!");
+            errorOccurred = true;
+        } else if (_roi->isEnabled()) {
+            _logger->log("ROI map: " + std::to_string(_roi->getParams().num_ROI_regions) + " static regions"
+                         + (_options.roiSaliency ? ", saliency every " + std::to_string(_options.roiSaliency) + " frames" : ""));
+        }
+    }
+
+    /* Create and configure the hardware encoder */
+    if (!errorOccurred) {
+        _logger->log("Creating the video encoder...");
+        if (!setupEncoder()) {
+            _logger->error("Failed to set up the video encoder, too many encoder sessions?");
+            errorOccurred = true;
+        }
+    }
+
+    return !errorOccurred;
+}
+
+bool VideoWriter::threadExecute() {
+    FrameJob job;
+    if (_jobs.pop(job, POP_TIMEOUT_MS)) {
+        if (_failed || !encodeFrame(job)) {
+            _failed = true;
+            _ring.release(job.slot);
+        }
+    }
+    return true;
+}
+
+bool VideoWriter::threadShutdown() {
+
+    /* Encode anything the consumer submitted before it stopped */
+    FrameJob job;
+    while (_jobs.tryPop(job)) {
+        if (_failed || !encodeFrame(job)) {
+            _failed = true;
+            _ring.release(job.slot);
+        }
+    }
+
+    /* Queue an empty buffer to signal end of stream, then let the capture plane drain */
+    if (_encoder) {
+        struct v4l2_buffer v4l2_buf;
+        struct v4l2_plane planes[MAX_PLANES];
+        memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+        memset(planes, 0, sizeof(planes));
+        v4l2_buf.m.planes = planes;
+        if (getOutputBuffer(v4l2_buf)) {
+            planes[0].m.fd = -1;
+            planes[0].bytesused = 0;
+            if (_encoder->output_plane.qBuffer(v4l2_buf, NULL) == 0)
+                _encoder->capture_plane.waitForDQThread(EOS_TIMEOUT_MS);
+        }
+        _encoder->capture_plane.stopDQThread();
+        _encoder->output_plane.setStreamStatus(false);
+        _encoder->capture_plane.setStreamStatus(false);
+    }
+
+    /* Frames still in flight never produced output */
+    for (uint32_t i = 0; i < _inFlight.size() && _telemetry; i++)
+        _telemetry->append(_inFlight[i].second);
+    _inFlight.clear();
+
+    /* Every buffer is back from the encoder once streaming stops */
+    for (uint32_t i = 0; i < _slots.size(); i++) {
+        if (_slots[i] != -1) {
+            _ring.release(_slots[i]);
+            _slots[i] = -1;
+        }
+    }
+
+    std::stringstream ss;
+    ss << "Video frames written: " << _framesWritten << " (" << _bytesWritten / (1 << 20) << " MiB)";
+    if (_roi && _roi->getRefreshes() > 0) {
+        const LatencyHistogram *cost = _roi->getCost();
+        ss << ", ROI map refreshed " << _roi->getRefreshes() << " times, p50/p99/max "
+           << cost->getPercentile(50) << "/" << cost->getPercentile(99) << "/" << cost->getMax() << " us";
+    }
+    _logger->log(ss.str());
+    return true;
+}
+
+/* Queue a copied frame, the slot is released back to the ring once the encoder returns it */
+bool VideoWriter::submit(const FrameJob& job) {
+    return _jobs.push(job);
+}
+
+/* True once encoding or writing has failed, the owning consumer should stop */
+bool VideoWriter::hasFailed() {
+    return _failed;
+}
+
+uint64_t VideoWriter::getFramesWritten() {
+    return _framesWritten;
+}
+
+uint64_t VideoWriter::getBytesWritten() {
+    return _bytesWritten;
+}
+
+/* Frames waiting to be queued plus frames inside the encoder */
+size_t VideoWriter::getQueueDepth() {
+    std::lock_guard<std::mutex> lock(_inFlightMutex);
+    return _jobs.size() + _inFlight.size();
+}
+
+/* Encoder turnaround from queueing a frame to its access unit coming out */
+const LatencyHistogram *VideoWriter::getLatency() {
+    return &_encodeLatency;
+}
+
+/* Configure both encoder planes, the output plane imports ring dmabufs directly */
+bool VideoWriter::setupEncoder() {
+
+    uint32_t width = _options.captureResolution.width();
+    uint32_t height = _options.captureResolution.height();
+    uint32_t fps = 1e9 / _options.getFrameDuration(_id) / _options.getFrameStride(_id);
+    if (fps < 1)
+        fps = 1;
+
+    std::stringstream ss;
+    ss << "enc" << _id;
+    _encoder = NvVideoEncoder::createVideoEncoder(ss.str().c_str());
+    if (!_encoder)
+        return false;
+
+    bool h265 = _options.format == FORMAT_H265;
+    if (_encoder->setCapturePlaneFormat(h265 ? V4L2_PIX_FMT_H265 : V4L2_PIX_FMT_H264, width, height, width * height) < 0)
+        return false;
+    if (_encoder->setOutputPlaneFormat(V4L2_PIX_FMT_YUV420M, width, height) < 0)
+        return false;
+    if (_encoder->setBitrate(_options.bitrate * 1000000U) < 0)
+        return false;
+    if (h265) {
+        if (_encoder->setProfile(V4L2_MPEG_VIDEO_H265_PROFILE_MAIN) < 0)
+            return false;
+    } else {
+        if (_encoder->setProfile(V4L2_MPEG_VIDEO_H264_PROFILE_HIGH) < 0)
+            return false;
+        if (_encoder->setLevel(V4L2_MPEG_VIDEO_H264_LEVEL_5_1) < 0)
+            return false;
+    }
+    if (_encoder->setRateControlMode(V4L2_MPEG_VIDEO_BITRATE_MODE_VBR) < 0)
+        return false;
+    if (_encoder->setIDRInterval(_options.idrInterval) < 0)
+        return false;
+    if (_encoder->setIFrameInterval(_options.idrInterval) < 0)
+        return false;
+    if (_encoder->setFrameRate(fps, 1) < 0)
+        return false;
+    if (_encoder->setInsertSpsPpsAtIdrEnabled(true) < 0)
+        return false;
+    if (_options.maxPerf && _encoder->setMaxPerfMode(1) < 0)
+        return false;
+
+    /* ROI parameters have to be enabled before the buffers are requested */
+    if (_roi->isEnabled()) {
+        v4l2_enc_enable_roi_param enable;
+        memset(&enable, 0, sizeof(enable));
+        enable.bEnableROI = 1;
+        if (_encoder->enableROI(enable) < 0)
+            return false;
+    }
+
+    /* One output buffer per ring slot, the encoder holds slots until it is done reading */
+    if (_encoder->output_plane.setupPlane(V4L2_MEMORY_DMABUF, _ring.getCount(), false, false) < 0)
+        return false;
+    if (_encoder->capture_plane.setupPlane(V4L2_MEMORY_MMAP, NUM_CAPTURE_BUFFERS, true, false) < 0)
+        return false;
+    if (_encoder->output_plane.setStreamStatus(true) < 0)
+        return false;
+    if (_encoder->capture_plane.setStreamStatus(true) < 0)
+        return false;
+
+    _encoder->capture_plane.setDQThreadCallback(captureCallback);
+    _encoder->capture_plane.setDQPollLoop(DequeueLoops::instance().next());
+    _encoder->capture_plane.startDQThread(this);
+
+    /* Hand every empty bitstream buffer to the encoder */
+    for (uint32_t i = 0; i < _encoder->capture_plane.getNumBuffers(); i++) {
+        struct v4l2_buffer v4l2_buf;
+        struct v4l2_plane planes[MAX_PLANES];
+        memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+        memset(planes, 0, sizeof(planes));
+        v4l2_buf.index = i;
+        v4l2_buf.m.planes = planes;
+        if (_encoder->capture_plane.qBuffer(v4l2_buf, NULL) < 0)
+            return false;
+    }
+    return true;
+}
+
+/* Take an unused output plane index, or wait for the encoder to return one and release its slot */
+bool VideoWriter::getOutputBuffer(struct v4l2_buffer& v4l2_buf) {
+    if (_numQueued < _encoder->output_plane.getNumBuffers()) {
+        v4l2_buf.index = _numQueued++;
+        return true;
+    }
+    if (_encoder->output_plane.dqBuffer(v4l2_buf, NULL, NULL, DQ_RETRIES) < 0)
+        return false;
+    if (_slots[v4l2_buf.index] != -1) {
+        _ring.release(_slots[v4l2_buf.index]);
+        _slots[v4l2_buf.index] = -1;
+    }
+    return true;
+}
+
+/* Queue the job's dmabuf on the output plane, return bool indicating success */
+bool VideoWriter::encodeFrame(const FrameJob& job) {
+    struct v4l2_buffer v4l2_buf;
+    struct v4l2_plane planes[MAX_PLANES];
+    memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+    memset(planes, 0, sizeof(planes));
+    v4l2_buf.m.planes = planes;
+    if (!getOutputBuffer(v4l2_buf))
+        return false;
+
+    planes[0].m.fd = job.fd;
+    planes[0].bytesused = 1; // must be non-zero, zero signals end of stream
+    v4l2_buf.flags |= V4L2_BUF_FLAG_TIMESTAMP_COPY;
+    v4l2_buf.timestamp.tv_sec = job.timestamp / 1000000000UL;
+    v4l2_buf.timestamp.tv_usec = (job.timestamp % 1000000000UL) / 1000;
+
+    /* The frame's region QP offsets, stored against the buffer index, which is the buffer's config store too */
+    if (_roi->isEnabled()) {
+        if (!_roi->update(job.fd, job.index)) {
+            _logger->error(_roi->getError() + "!");
+            return false;
+        }
+        v4l2_enc_frame_ROI_params params = _roi->getParams();
+        if (_encoder->setROIParams(v4l2_buf.index, params) < 0)
+            return false;
+        v4l2_buf.reserved2 = v4l2_buf.index;
+    }
+    uint64_t queued = now();
+    if (_encoder->output_plane.qBuffer(v4l2_buf, NULL) < 0)
+        return false;
+    _slots[v4l2_buf.index] = job.slot;
+
+    /* Keep the record until the matching access unit comes out of the capture plane */
+    TelemetryRecord telemetry = job.telemetry;
+    telemetry.queueUs = (queued - job.submitted) / 1000;
+    std::lock_guard<std::mutex> lock(_inFlightMutex);
+    _inFlight.push_back(std::make_pair(queued, telemetry));
+    return true;
+}
+
+/* Complete the record of the frame an access unit was encoded from, matched by the copied timestamp */
+void VideoWriter::recordEncoded(struct v4l2_buffer *v4l2_buf, uint32_t size, uint64_t writeStart) {
+    uint64_t timestampUs = v4l2_buf->timestamp.tv_sec * 1000000ULL + v4l2_buf->timestamp.tv_usec;
+    std::lock_guard<std::mutex> lock(_inFlightMutex);
+    while (!_inFlight.empty()) {
+        uint64_t queued = _inFlight.front().first;
+        TelemetryRecord telemetry = _inFlight.front().second;
+        _inFlight.pop_front();
+
+        /* Frames ahead of the match produced no output, record them as such */
+        if (telemetry.timestamp / 1000 != timestampUs) {
+            if (_telemetry)
+                _telemetry->append(telemetry);
+            continue;
+        }
+        telemetry.encodeUs = (writeStart - queued) / 1000;
+        telemetry.writeUs = (now() - writeStart) / 1000;
+        telemetry.size = size;
+        _encodeLatency.record(telemetry.encodeUs);
+        if (_telemetry)
+            _telemetry->append(telemetry);
+        break;
+    }
+}
+
+/* Append one encoded access unit to the stream file */
+bool VideoWriter::writeBitstream(struct v4l2_buffer *v4l2_buf, NvBuffer *buffer) {
+    uint32_t size = buffer->planes[0].bytesused;
+    bool success = write(_outputFd, buffer->planes[0].data, size) == (ssize_t) size;
+    if (_volumes)
+        _volumes->record(_id, _framesWritten, _volume, size, success);
+    if (!success)
+        return false;
+    _bytesWritten += size;
+    _behind.written(_bytesWritten);
+    _framesWritten++;
+    return true;
+}
+
+/* Called from the capture plane DQ thread or its dequeue loop, returning false stops dequeueing the plane */
+bool VideoWriter::captureCallback(struct v4l2_buffer *v4l2_buf, NvBuffer *buffer,
+                                  NvBuffer *shared_buffer, void *data) {
+    VideoWriter *writer = static_cast<VideoWriter*>(data);
+    if (!v4l2_buf) {
+        writer->_failed = true;
+        return false;
+    }
+
+    /* An empty buffer marks the end of stream */
+    if (buffer->planes[0].bytesused == 0)
+        return false;
+
+    uint64_t writeStart = now();
+    if (!writer->writeBitstream(v4l2_buf, buffer)) {
+        writer->_failed = true;
+        return false;
+    }
+    writer->recordEncoded(v4l2_buf, buffer->planes[0].bytesused, writeStart);
+    if (writer->_encoder->capture_plane.qBuffer(*v4l2_buf, NULL) < 0) {
+        writer->_failed = true;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,468 @@
+/*
+ * VolumeSet.cpp
+ *
+ * Spreads the image output over several volumes so no single device has to
+ * absorb every camera. The run directory is created on each volume passed with
+ * --volumes, the first one also holds the logs and metadata. Under the camera
+ * policy each camera writes to one volume, assigned round robin; under the
+ * frame policy each camera's consecutive frames rotate over the volumes. Free
+ * space is estimated from the bytes written since the last statvfs, and a
+ * volume whose estimate drops below the reserve, or that fails a write, is
+ * marked full and its cameras fail over to the next volume with room. Without
+ * --volumes the set holds the one mounted device with the most free space.
+ * With --segment the JPEG images go to segNNN directories under the run
+ * directories, each created one segment ahead of its first image.
+ */
+
+#include "VolumeSet.hpp"
+
+#include "Options.hpp"
+#include "Logger.hpp"
+#include "SteadyClock.hpp"
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <mntent.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#define STDOUT_PRINT true
+#define MKDIR_MODE 0777
+#define REFRESH_INTERVAL_NS 1000000000ULL // statvfs and throughput sampling period
+
+/* Bytes available to unprivileged writers on the file system holding path, return bool indicating success */
+static bool queryFreeBytes(const char *path, uint64_t& freeBytes) {
+    struct statvfs info;
+    if (statvfs(path, &info) != 0)
+        return false;
+    freeBytes = (uint64_t) info.f_bavail * info.f_frsize;
+    return true;
+}
+
+VolumeSet::VolumeSet(const Options& options, uint32_t numCameras) :
+    _options(options),
+    _numCameras(numCameras),
+    _reserve((uint64_t) options.volumeReserve << 20),
+    _logger(NULL),
+    _index(NULL),
+    _cameraVolume(numCameras, 0),
+    _cameraNext(numCameras, 0),
+    _lastRefresh(0),
+    _segmentStart(0),
+    _segmentBytes(0),
+    _cameraSegment(numCameras, 0)
+{
+    /* The root directory is the run directory on the first volume, the others mirror its name */
+    std::string name = std::string(options.directory).substr(options.volumes[0].size());
+    name.erase(0, name.find_first_not_of('/'));
+    for (uint32_t i = 0; i < options.volumes.size(); i++) {
+        Volume volume = {join(options.volumes[i], name), 0, 0, 0, 0, 0, 0, false};
+        _volumes.push_back(volume);
+    }
+    for (uint32_t i = 0; i < numCameras; i++) {
+        _cameraVolume[i] = i % _volumes.size();
+        _cameraNext[i] = i % _volumes.size();
+    }
+}
+
+VolumeSet::~VolumeSet() {
+    close();
+    if (_logger)
+        delete _logger;
+}
+
+/* Mount points of every /dev device whose free space can be queried */
+std::vector<std::string> VolumeSet::findVolumes() {
+    std::vector<std::string> result;
+    FILE *mounts = setmntent("/proc/mounts", "r");
+    if (!mounts)
+        return result;
+    struct mntent entry;
+    char buffer[1024];
+    while (getmntent_r(mounts, &entry, buffer, sizeof(buffer))) {
+        uint64_t freeBytes = 0;
+        if (strncmp(entry.mnt_fsname, "/dev/", 5) == 0 && queryFreeBytes(entry.mnt_dir, freeBytes))
+            result.push_back(entry.mnt_dir);
+    }
+    endmntent(mounts);
+    return result;
+}
+
+/* Mount point of the /dev device with the most space available, empty if none is mounted */
+std::string VolumeSet::findMostFreeVolume() {
+    std::string result;
+    uint64_t mostFree = 0;
+    std::vector<std::string> volumes = findVolumes();
+    for (uint32_t i = 0; i < volumes.size(); i++) {
+        uint64_t freeBytes = 0;
+        if (queryFreeBytes(volumes[i].c_str(), freeBytes) && freeBytes > mostFree) {
+            mostFree = freeBytes;
+            result = volumes[i];
+        }
+    }
+    return result;
+}
+
+/* The path of name under the volume's mount point */
+std::string VolumeSet::join(const std::string& volume, const std::string& name) {
+    if (volume.empty() || volume[volume.size() - 1] == '/')
+        return volume + name;
+    return volume + "/" + name;
+}
+
+/* Create the run and camera directories on every volume but the first, which the App and
+   consumers create, and open the index, return bool indicating success */
+bool VolumeSet::open() {
+
+    bool errorOccurred = false;
+
+    /* Create the logger */
+    if (!errorOccurred) {
+        _logger = new Logger("VOLUMES", _options.directory);
+        if (!_logger) {
+            errorOccurred = true;
+        } else if (_options.verbose) {
+            _logger->enableVerbose();
+        } else {
+            _logger->disableVerbose();
+        }
+    }
+
+    /* Create the directory structure */
+    for (uint32_t i = 1; i < _volumes.size() && !errorOccurred; i++) {
+        if (mkdir(_volumes[i].directory.c_str(), MKDIR_MODE) != 0) {
+            _logger->error("Failed to create the run directory on " + _volumes[i].directory + "!");
+            errorOccurred = true;
+        }
+        for (uint32_t j = 0; j < _numCameras && !errorOccurred; j++) {
+            if (mkdir(getCameraDirectory(i, j).c_str(), MKDIR_MODE) != 0) {
+                _logger->error("Failed to create the image sub-directory on " + _volumes[i].directory + "!");
+                errorOccurred = true;
+            }
+        }
+    }
+
+    /* Take the free space of every volume, one already below the reserve is never used */
+    for (uint32_t i = 0; i < _volumes.size() && !errorOccurred; i++) {
+        if (!statVolume(_volumes[i])) {
+            _logger->error("Failed to query the free space of " + _volumes[i].directory + "!");
+            errorOccurred = true;
+        } else {
+            std::stringstream ss;
+            ss << "Volume " << i << ": " << _volumes[i].directory << ", " << (_volumes[i].freeBytes >> 20) << " MiB free";
+            _logger->log(ss.str(), STDOUT_PRINT);
+            if (_volumes[i].freeBytes < _reserve)
+                markFull(i, "starts below the reserve");
+        }
+    }
+
+    /* Move cameras off volumes that are already full */
+    for (uint32_t i = 0; i < _numCameras && !errorOccurred; i++)
+        assign(i);
+
+    /* Open the index */
+    if (!errorOccurred) {
+        std::string filename = std::string(_options.directory) + "/volumes.csv";
+        _index = fopen(filename.c_str(), "w");
+        if (!_index || fprintf(_index, "camera,index,volume\n") < 0) {
+            _logger->error("Failed to create volumes.csv!");
+            errorOccurred = true;
+        }
+    }
+
+    /* Create the first segment and the one after it */
+    if (!errorOccurred && isSegmented()) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!createSegment(0) || !createSegment(1)) {
+            _logger->error("Failed to create the first segments!");
+            errorOccurred = true;
+        }
+        _segmentsEntered.insert(0);
+    }
+
+    _lastRefresh = now();
+    return !errorOccurred;
+}
+
+/* Flush the index and log what went where */
+void VolumeSet::close() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_index)
+        return;
+    if (fclose(_index) != 0)
+        _logger->error("Failed to close volumes.csv!");
+    _index = NULL;
+
+    /* A segment created ahead that no image reached is not kept */
+    for (std::set<uint32_t>::iterator it = _segmentsCreated.begin(); it != _segmentsCreated.end(); ++it)
+        if (!_segmentsEntered.count(*it))
+            removeSegment(*it);
+    if (isSegmented())
+        _logger->log("Segments written: " + std::to_string(_segmentsEntered.size()), STDOUT_PRINT);
+
+    for (uint32_t i = 0; i < _volumes.size(); i++) {
+        std::stringstream ss;
+        ss << "Volume " << i << " frames written: " << _volumes[i].framesWritten << " ("
+           << (_volumes[i].bytesWritten >> 20) << " MiB)" << (_volumes[i].full ? ", full" : "");
+        _logger->log(ss.str(), STDOUT_PRINT);
+    }
+}
+
+/* The camera's volume under the camera policy, moved to the next one with room if it is
+   full, -1 once every volume is full. Writers of a single stream file use this one */
+int VolumeSet::assign(uint32_t camera) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    int volume = nextFree(_cameraVolume[camera]);
+    if (volume >= 0 && volume != _cameraVolume[camera]) {
+        std::stringstream ss;
+        ss << "Camera " << camera << " failed over from volume " << _cameraVolume[camera] << " to volume " << volume;
+        _logger->log(ss.str(), STDOUT_PRINT);
+        _cameraVolume[camera] = volume;
+    }
+    return volume;
+}
+
+/* The volume the camera's next frame goes to, -1 once every volume is full */
+int VolumeSet::select(uint32_t camera) {
+    if (_options.stripePolicy == STRIPE_CAMERA)
+        return assign(camera);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    int volume = nextFree(_cameraNext[camera]);
+    if (volume >= 0)
+        _cameraNext[camera] = (volume + 1) % _volumes.size();
+    return volume;
+}
+
+/* Account a write and index the frame, a failed write marks its volume full */
+void VolumeSet::record(uint32_t camera, uint64_t index, int volume, uint64_t size, bool success) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    Volume& target = _volumes[volume];
+    if (!success) {
+        markFull(volume, "failed a write");
+        return;
+    }
+    target.bytesWritten += size;
+    target.sinceRefresh += size;
+    target.framesWritten++;
+    if (target.sinceRefresh + _reserve > target.freeBytes)
+        markFull(volume, "reached the reserve");
+    if (_index)
+        fprintf(_index, "%u,%lu,%d\n", camera, index, volume);
+}
+
+/* Re-read the free space and sample the throughput of every volume, at most once a
+   second. A volume freed up in the meantime is not taken back into use */
+void VolumeSet::refresh() {
+    uint64_t time = now();
+    if (time - _lastRefresh < REFRESH_INTERVAL_NS)
+        return;
+
+    /* statvfs can block on a busy device, so take the counters and query outside the lock */
+    std::vector<Volume> volumes;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        volumes = _volumes;
+    }
+    std::vector<bool> valid(volumes.size());
+    for (uint32_t i = 0; i < volumes.size(); i++)
+        valid[i] = statVolume(volumes[i]);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    double interval = (time - _lastRefresh) / 1e9;
+    _lastRefresh = time;
+    for (uint32_t i = 0; i < _volumes.size(); i++) {
+        Volume& volume = _volumes[i];
+        volume.bytesPerSecond = (volume.bytesWritten - volume.lastBytes) / interval;
+        volume.lastBytes = volume.bytesWritten;
+        if (!valid[i])
+            continue;
+        volume.freeBytes = volumes[i].freeBytes;
+        volume.sinceRefresh = volume.bytesWritten - volumes[i].bytesWritten;
+        if (volume.freeBytes < _reserve)
+            markFull(i, "reached the reserve");
+    }
+    if (_index)
+        fflush(_index);
+}
+
+uint32_t VolumeSet::getVolumeCount() const {
+    return _volumes.size();
+}
+
+/* The run directory on the volume */
+const std::string& VolumeSet::getDirectory(int volume) const {
+    return _volumes[volume].directory;
+}
+
+/* The camera's image sub-directory on the volume */
+std::string VolumeSet::getCameraDirectory(int volume, uint32_t camera) const {
+    return _volumes[volume].directory + "/cam" + std::to_string(camera);
+}
+
+/* True if the JPEG images are split into segments */
+bool VolumeSet::isSegmented() const {
+    return _options.segmentMinutes > 0 || _options.segmentSize > 0;
+}
+
+/* The segment an image of size bytes taken at timestamp goes to. Minutes count from the first image
+   any camera asked for, bytes over every camera, so each camera moves on at the same boundary */
+uint32_t VolumeSet::selectSegment(uint64_t timestamp, uint64_t size) {
+    if (_options.segmentMinutes > 0) {
+        uint64_t start = 0;
+        if (!_segmentStart.compare_exchange_strong(start, timestamp))
+            timestamp = std::max(timestamp, start);
+        else
+            start = timestamp;
+        return (timestamp - start) / ((uint64_t) _options.segmentMinutes * 60 * 1000000000ULL);
+    }
+    if (_options.segmentSize > 0)
+        return _segmentBytes.fetch_add(size) / ((uint64_t) _options.segmentSize << 30);
+    return 0;
+}
+
+/* The camera's writer closed its files of the last segment and moves on to segment, make sure its
+   directories exist and create the next segment's ahead of time, return bool indicating the
+   segment can be written */
+bool VolumeSet::enterSegment(uint32_t camera, uint32_t segment) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _cameraSegment[camera] = segment;
+    bool success = _segmentsCreated.count(segment) || createSegment(segment);
+    if (success && _segmentsEntered.insert(segment).second)
+        _logger->log("Segment " + std::to_string(segment) + " started");
+    if (!_segmentsCreated.count(segment + 1) && !createSegment(segment + 1))
+        _logger->log("Failed to create segment " + std::to_string(segment + 1) + " ahead, retrying on entry",
+                     STDOUT_PRINT);
+    return success;
+}
+
+/* True once every camera's writer has moved past segment, nothing more is written to it */
+bool VolumeSet::isSegmentClosed(uint32_t segment) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (uint32_t i = 0; i < _cameraSegment.size(); i++)
+        if (_cameraSegment[i] <= segment)
+            return false;
+    return true;
+}
+
+/* The segment's directory in the run directory on volume */
+std::string VolumeSet::getSegmentDirectory(int volume, uint32_t segment) const {
+    char name[16];
+    snprintf(name, sizeof(name), "/seg%03u", segment);
+    return _volumes[volume].directory + name;
+}
+
+/* Create the segment's directory and camera directories on every volume and snapshot options.txt
+   into it, with the volumes listed as their run directories so --verify finds the segment on each.
+   Called with the lock held, return bool indicating success */
+bool VolumeSet::createSegment(uint32_t segment) {
+    for (uint32_t i = 0; i < _volumes.size(); i++) {
+        std::string directory = getSegmentDirectory(i, segment);
+        if (mkdir(directory.c_str(), MKDIR_MODE) != 0 && errno != EEXIST)
+            return false;
+        for (uint32_t j = 0; j < _numCameras; j++)
+            if (mkdir((directory + "/cam" + std::to_string(j)).c_str(), MKDIR_MODE) != 0 && errno != EEXIST)
+                return false;
+    }
+
+    std::ifstream options(_volumes[0].directory + "/options.txt");
+    std::ofstream snapshot(getSegmentDirectory(0, segment) + "/options.txt");
+    std::string line;
+    while (std::getline(options, line)) {
+        uint32_t volume;
+        int offset = 0;
+        if (sscanf(line.c_str(), "Volume %u: %n", &volume, &offset) == 1 && offset > 0 && volume < _volumes.size())
+            line = line.substr(0, offset) + _volumes[volume].directory;
+        snapshot << line << std::endl;
+    }
+    snapshot << "Segment index: " << segment << std::endl;
+    snapshot.close();
+    if (!snapshot)
+        return false;
+    _segmentsCreated.insert(segment);
+    return true;
+}
+
+/* Remove a segment's empty directories again, called with the lock held */
+void VolumeSet::removeSegment(uint32_t segment) {
+    for (uint32_t i = 0; i < _volumes.size(); i++) {
+        std::string directory = getSegmentDirectory(i, segment);
+        for (uint32_t j = 0; j < _numCameras; j++)
+            rmdir((directory + "/cam" + std::to_string(j)).c_str());
+        if (i == 0)
+            unlink((directory + "/options.txt").c_str());
+        rmdir(directory.c_str());
+    }
+}
+
+/* Estimated free bytes on the volume */
+uint64_t VolumeSet::getFreeBytes(int volume) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const Volume& target = _volumes[volume];
+    return target.sinceRefresh < target.freeBytes ? target.freeBytes - target.sinceRefresh : 0;
+}
+
+/* Estimated space left above the reserve on every volume still in rotation, what the run can still write */
+uint64_t VolumeSet::getRecordableBytes() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint64_t total = 0;
+    for (size_t i = 0; i < _volumes.size(); i++) {
+        const Volume& volume = _volumes[i];
+        if (!volume.full && volume.sinceRefresh + _reserve < volume.freeBytes)
+            total += volume.freeBytes - volume.sinceRefresh - _reserve;
+    }
+    return total;
+}
+
+uint64_t VolumeSet::getBytesWritten(int volume) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _volumes[volume].bytesWritten;
+}
+
+/* Throughput over the last refresh interval */
+double VolumeSet::getBytesPerSecond(int volume) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _volumes[volume].bytesPerSecond;
+}
+
+bool VolumeSet::isFull(int volume) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _volumes[volume].full;
+}
+
+/* True once every volume has been taken out of rotation */
+bool VolumeSet::isExhausted() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return nextFree(0) < 0;
+}
+
+/* Take the free space available to unprivileged writers, return bool indicating success */
+bool VolumeSet::statVolume(Volume& volume) {
+    if (!queryFreeBytes(volume.directory.c_str(), volume.freeBytes))
+        return false;
+    volume.sinceRefresh = 0;
+    return true;
+}
+
+/* The first volume with room from start on, wrapping around, -1 if there is none. Lock held */
+int VolumeSet::nextFree(int start) {
+    for (uint32_t i = 0; i < _volumes.size(); i++) {
+        int volume = (start + i) % _volumes.size();
+        if (!_volumes[volume].full)
+            return volume;
+    }
+    return -1;
+}
+
+/* Take the volume out of rotation, logged once. Lock held */
+void VolumeSet::markFull(int volume, const char *reason) {
+    if (_volumes[volume].full)
+        return;
+    _volumes[volume].full = true;
+    std::stringstream ss;
+    ss << "Volume " << volume << " (" << _volumes[volume].directory << ") " << reason << ", no longer written to";
+    _logger->log(ss.str(), STDOUT_PRINT);
+}
@@ -3,23 +3,58 @@
  *
  * This is a re-worked version of the 'multi_camera' example from the
  * Jetson multimedia API samples. This will provide an indefinite stream
- * of composited images from each of the 6 cameras displayed on a simple
- * OpenCV window for interactivity.
+ * of composited images from each of the 6 cameras. The composite is handed to
+ * NvEglRenderer as a dmabuf, or to NvDrmRenderer when no X server is running,
+ * so a frame never passes through the CPU. With enough overlay planes the
+ * display hardware can composite instead, each camera's frame is then scanned
+ * out from its own plane and the frames are not copied at all. With a lens
+ * calibration the EGL renderer draws each camera's buffer straight into its
+ * cell through an undistortion remap in a fragment shader. The OpenCV window is kept as a
+ * fallback for remote X sessions, where the EGL renderer is not available.
+ * The ISP scales each camera straight to its cell of a configurable grid. A
+ * second, full-resolution stream per camera is only captured while that camera
+ * is shown alone in focus mode, selected from the keyboard. Where the ISP
+ * provides Ext::BayerSharpnessMap each cell carries a focus assist overlay
+ * built from it, so the metric costs no pixel processing at all.
+ * The sessions, streams and requests are set up by the CaptureGraph core
+ * shared with StreamCapture.
  */
 
 #include "Error.h"
 #include "Thread.h"
+#include "CaptureGraph.hpp"
+#include "PixelKernels.hpp"
+#include "PreviewLayout.hpp"
 
 #include <Argus/Argus.h>
 #include <EGLGlobal.h>
 #include <EGLStream/EGLStream.h>
 #include <EGLStream/NV/ImageNativeBuffer.h>
+#include <EGLStream/ArgusCaptureMetadata.h>
+#include <Argus/Ext/BayerSharpnessMap.h>
 
 #include <nvbuf_utils.h>
 #include <NvEglRenderer.h>
+#include <NvDrmRenderer.h>
+#include <tegra_drm.h>
+#include <tegra_drm_nvdc.h>
+#include <nvosd.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
 
 #include "opencv2/opencv.hpp"
 #include "opencv2/highgui.hpp"
@@ -30,14 +65,43 @@ using namespace EGLStream;
 /* Constants */
 static const uint32_t            MAX_CAMERA_NUM = 6;
 static const uint32_t            DEFAULT_FPS = 38;
-static const int32_t             CELL_WIDTH = 512;  // 2048 / 4 = 512.0
-static const int32_t             CELL_HEIGHT = 388; // 1554 / 4 = 388.5
-static const int32_t             CELL_SPACING = 2;
-static const Size2D<uint32_t>    STREAM_SIZE(3 * CELL_WIDTH + 4 * CELL_SPACING, 2 * CELL_HEIGHT + 3 * CELL_SPACING);
+static const uint32_t            DEFAULT_CELL_WIDTH = 512;  // 2048 / 4 = 512.0
+static const uint32_t            DEFAULT_CELL_HEIGHT = 388; // 1554 / 4 = 388.5
+static const uint32_t            DEFAULT_COLUMNS = 3;
+static const uint32_t            DEFAULT_ROWS = 2;
+static const uint32_t            NUM_COMPOSITE_BUFFERS = 3; // the DRM renderer holds on to the buffer on screen
+static const uint32_t            LATEST_FRAME_BUFFERS = 3;  // triple buffer, acquire and composite never wait on each other
+static const uint64_t            ACQUIRE_TIMEOUT_NS = 100000000; // bounds how long stopping an acquire thread takes
+static const uint64_t            STALE_FRAME_MS = 500;      // a camera silent this long is blanked in the composite
+static const float               IN_FOCUS_RATIO = 0.95f;    // sharpness within this of the peak draws the bar green
+static const uint32_t            OVERLAY_MARGIN = 4;
+static const uint32_t            OVERLAY_BAR_HEIGHT = 6;
+static const uint32_t            OVERLAY_FONT_SIZE = 14;
+static const uint32_t            OVERLAY_TEXT_LENGTH = 64;
+static const uint64_t            FPS_INTERVAL_MS = 1000;    // how often each camera's frame rate is updated
+
+/* Where the composited frame is shown */
+enum RenderMode {
+    RENDER_EGL,     // X window drawn by the GPU from the dmabuf
+    RENDER_DRM,     // display plane scanning out the dmabuf, no X server needed
+    RENDER_PLANES,  // one overlay plane per camera, the display hardware composites
+    RENDER_OPENCV   // CPU map and colour conversion, works over remote X
+};
+
+/* One camera's lens calibration, pinhole intrinsics and Brown-Conrady distortion */
+struct LensCalibration {
+    uint32_t width;     // resolution the intrinsics are in pixels of
+    uint32_t height;
+    float fx, fy, cx, cy;
+    float k1, k2, p1, p2, k3;
+};
 
 /* Globals */
-UniqueObj<CameraProvider>       g_cameraProvider;
-bool                            g_doStream = true;
+PreviewLayout                   g_layout = {DEFAULT_CELL_WIDTH, DEFAULT_CELL_HEIGHT, DEFAULT_COLUMNS, DEFAULT_ROWS};
+std::atomic<bool>               g_doStream(true); // cleared by the compositor and the signal handler
+RenderMode                      g_renderMode = RENDER_EGL;
+bool                            g_sharpnessMap = false; // the ISP reports Ext::BayerSharpnessMap
+std::vector<LensCalibration>    g_calibrations;         // per camera with --undistort, the grid is undistorted
 
 /* Debug print macros */
 #define PRODUCER_PRINT(...) printf("PRODUCER: " __VA_ARGS__)
@@ -45,100 +109,273 @@ bool                            g_doStream = true;
 
 namespace ArgusSamples {
 
-/* A utility class to hold all resources of one capture session */
-class CaptureHolder : public Destructable {
-
-    public:
-        explicit CaptureHolder();
-        virtual ~CaptureHolder();
+/* The capture graph's handles of one camera's output streams */
+struct CameraStreams {
+    int cell;   // scaled by the ISP straight to the cell size, always captured
+    int focus;  // sensor mode resolution, only captured while the camera is focused
+};
 
-        bool initialize(CameraDevice *device);
+/* The newest frame of one camera as the compositor takes it */
+struct LatestFrame {
+    int fd;
+    uint64_t sequence;      // counts the frames published, a cell is redrawn when it changes
+    uint64_t time;          // steady clock ms the frame was published
+    float sharpness;        // mean green sharpness, 0 without a sharpness map
+    float fps;              // frames published per second over the last FPS_INTERVAL_MS
+};
 
-        CaptureSession* getSession() const {
-            return m_captureSession.get();
+/* Where each pixel of a cell samples the camera's frame to undo the lens distortion, as fractions
+   of the frame size in units of 1/65535. The frame covers the calibrated field of view */
+static void buildUndistortRemap(const LensCalibration &lens, uint32_t width, uint32_t height,
+                                std::vector<uint16_t> &coords) {
+    coords.resize(width * height * 2);
+    float sx = (float) lens.width / width;
+    float sy = (float) lens.height / height;
+    for (uint32_t v = 0; v < height; v++) {
+        for (uint32_t u = 0; u < width; u++) {
+            float x = ((u + 0.5f) * sx - lens.cx) / lens.fx;
+            float y = ((v + 0.5f) * sy - lens.cy) / lens.fy;
+            float r2 = x * x + y * y;
+            float radial = 1.0f + r2 * (lens.k1 + r2 * (lens.k2 + r2 * lens.k3));
+            float xd = x * radial + 2.0f * lens.p1 * x * y + lens.p2 * (r2 + 2.0f * x * x);
+            float yd = y * radial + lens.p1 * (r2 + 2.0f * y * y) + 2.0f * lens.p2 * x * y;
+            float fu = std::min(std::max((lens.fx * xd + lens.cx) / lens.width, 0.0f), 1.0f);
+            float fv = std::min(std::max((lens.fy * yd + lens.cy) / lens.height, 0.0f), 1.0f);
+            coords[(v * width + u) * 2] = fu * 65535.0f + 0.5f;
+            coords[(v * width + u) * 2 + 1] = fv * 65535.0f + 0.5f;
         }
+    }
+}
 
-        OutputStream* getStream() const {
-            return m_outputStream.get();
-        }
+/* Steady clock time in ms */
+static uint64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-        Request* getRequest() const {
-            return m_request.get();
-        }
+/*
+ * Argus Acquire Thread:
+ * Drains one stream as fast as its camera delivers and keeps only the newest
+ * frame in a triple buffer of dmabufs. The acquire side always owns the back
+ * buffer and the compositor the front one; publishing and taking a frame only
+ * swap indices with the middle buffer, so neither side ever waits on the other
+ * and a slow or dead camera cannot hold up the composite.
+ */
+class AcquireThread : public Thread {
 
-        virtual void destroy() {
-            delete this;
+    public:
+        explicit AcquireThread(OutputStream *stream, uint32_t id, NvBufferColorFormat format,
+                               std::condition_variable &frameReady) :
+            m_stream(stream),
+            m_id(id),
+            m_format(format),
+            m_frameReady(frameReady),
+            m_back(0),
+            m_middle(1),
+            m_front(2),
+            m_fresh(false),
+            m_published(false),
+            m_fpsStart(0),
+            m_fpsFrames(0)
+        {
+            memset(m_buffers, 0, sizeof(m_buffers));
+            memset(&m_latest, 0, sizeof(m_latest));
         }
+        virtual ~AcquireThread();
+
+        bool getLatest(LatestFrame &frame);
+
+    protected:
+        /** @name Thread methods */
+        /**@{*/
+        virtual bool threadInitialize();
+        virtual bool threadExecute();
+        virtual bool threadShutdown();
+        /**@}*/
 
-    private:
-        UniqueObj<CaptureSession> m_captureSession;
-        UniqueObj<OutputStream> m_outputStream;
-        UniqueObj<Request> m_request;
+        OutputStream *m_stream;
+        uint32_t m_id;
+        NvBufferColorFormat m_format;
+        std::condition_variable &m_frameReady;
+        UniqueObj<FrameConsumer> m_consumer;
+        int m_buffers[LATEST_FRAME_BUFFERS];
+        std::mutex m_mutex;
+        uint32_t m_back;
+        uint32_t m_middle;
+        uint32_t m_front;
+        bool m_fresh;           // the middle buffer holds a frame the compositor has not taken
+        bool m_published;       // at least one frame was published
+        LatestFrame m_latest;   // the middle buffer's frame, fd is set when taken
+        uint64_t m_fpsStart;
+        uint32_t m_fpsFrames;
 };
 
-CaptureHolder::CaptureHolder() {}
+/* Mean green sharpness over all bins of the ISP sharpness map, 0 if the frame has none */
+static float getSharpness(Frame *frame) {
+    IArgusCaptureMetadata *iArgusCaptureMetadata = interface_cast<IArgusCaptureMetadata>(frame);
+    if (!iArgusCaptureMetadata)
+        return 0.0f;
+    const Ext::IBayerSharpnessMap *iSharpnessMap =
+        interface_cast<const Ext::IBayerSharpnessMap>(iArgusCaptureMetadata->getMetadata());
+    Array2D< BayerTuple<float> > values;
+    if (!iSharpnessMap || iSharpnessMap->getSharpnessValues(&values) != STATUS_OK || values.size().area() == 0)
+        return 0.0f;
+    float sum = 0.0f;
+    for (uint32_t y = 0; y < values.size().height(); y++)
+        for (uint32_t x = 0; x < values.size().width(); x++)
+            sum += values(x, y).gEven() + values(x, y).gOdd();
+    return sum / (2 * values.size().area());
+}
 
-CaptureHolder::~CaptureHolder() {
-    /* Destroy the output stream */
-    m_outputStream.reset();
+AcquireThread::~AcquireThread() {
+    for (uint32_t i = 0; i < LATEST_FRAME_BUFFERS; i++)
+        if (m_buffers[i])
+            NvBufferDestroy(m_buffers[i]);
 }
 
-bool CaptureHolder::initialize(CameraDevice *device) {
+bool AcquireThread::threadInitialize() {
 
-    ICameraProvider *iCameraProvider = interface_cast<ICameraProvider>(g_cameraProvider);
-    if (!iCameraProvider)
-        ORIGINATE_ERROR("Failed to get ICameraProvider interface");
+    /* Create the FrameConsumer */
+    m_consumer.reset(FrameConsumer::create(m_stream));
+    if (!m_consumer)
+        ORIGINATE_ERROR("Failed to create FrameConsumer for camera %d", m_id);
 
-    /* Create the capture session using the first device and get the core interface */
-    m_captureSession.reset(iCameraProvider->createCaptureSession(device));
-    ICaptureSession *iCaptureSession = interface_cast<ICaptureSession>(m_captureSession);
-    IEventProvider *iEventProvider = interface_cast<IEventProvider>(m_captureSession);
-    if (!iCaptureSession || !iEventProvider)
-        ORIGINATE_ERROR("Failed to create CaptureSession");
+    /* Wait until the producer has connected to the stream */
+    CONSUMER_PRINT("Waiting until producer %d is connected...\n", m_id);
+    if (interface_cast<IEGLOutputStream>(m_stream)->waitUntilConnected() != STATUS_OK)
+        ORIGINATE_ERROR("Stream %d failed to connect.", m_id);
+    CONSUMER_PRINT("Producer %d has connected; continuing.\n", m_id);
 
-    /* Create the OutputStream */
-    UniqueObj<OutputStreamSettings> streamSettings(
-        iCaptureSession->createOutputStreamSettings(STREAM_TYPE_EGL));
-    IEGLOutputStreamSettings *iEglStreamSettings =
-        interface_cast<IEGLOutputStreamSettings>(streamSettings);
-    if (!iEglStreamSettings)
-        ORIGINATE_ERROR("Failed to create EglOutputStreamSettings");
+    return true;
+}
 
-    iEglStreamSettings->setPixelFormat(PIXEL_FMT_YCbCr_420_888);
-    iEglStreamSettings->setEGLDisplay(EGL_NO_DISPLAY);
-    iEglStreamSettings->setResolution(STREAM_SIZE);
+bool AcquireThread::threadExecute() {
+
+    IFrameConsumer *iFrameConsumer = interface_cast<IFrameConsumer>(m_consumer);
+    if (!iFrameConsumer)
+        ORIGINATE_ERROR("Failed to get IFrameConsumer interface");
+
+    /* Acquire a frame, the timeout lets the thread observe shutdown */
+    UniqueObj<Frame> frame(iFrameConsumer->acquireFrame(ACQUIRE_TIMEOUT_NS));
+    IFrame *iFrame = interface_cast<IFrame>(frame);
+    if (!iFrame)
+        return true;
+
+    /* Get the IImageNativeBuffer extension interface */
+    NV::IImageNativeBuffer *iNativeBuffer =
+        interface_cast<NV::IImageNativeBuffer>(iFrame->getImage());
+    if (!iNativeBuffer)
+        ORIGINATE_ERROR("IImageNativeBuffer not supported by Image.");
+
+    /* If we don't already have buffers, create them from this image.
+       Otherwise, just blit to the back buffer */
+    if (!m_buffers[m_back]) {
+        Size2D<uint32_t> resolution = interface_cast<IEGLOutputStream>(m_stream)->getResolution();
+        for (uint32_t i = 0; i < LATEST_FRAME_BUFFERS; i++) {
+            m_buffers[i] = iNativeBuffer->createNvBuffer(resolution, m_format, NvBufferLayout_Pitch);
+            if (!m_buffers[i])
+                ORIGINATE_ERROR("Failed to create NvBuffer for camera %d", m_id);
+        }
+    } else if (iNativeBuffer->copyToNvBuffer(m_buffers[m_back]) != STATUS_OK) {
+        ORIGINATE_ERROR("Failed to copy frame to NvBuffer.");
+    }
 
-    m_outputStream.reset(iCaptureSession->createOutputStream(streamSettings.get()));
+    /* Publish the frame, an untaken older frame in the middle buffer is simply overwritten next time */
+    float sharpness = g_sharpnessMap ? getSharpness(frame.get()) : 0.0f;
+    uint64_t now = nowMs();
+    m_fpsFrames++;
+    if (m_fpsStart == 0)
+        m_fpsStart = now;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::swap(m_back, m_middle);
+        m_fresh = true;
+        m_published = true;
+        m_latest.sequence++;
+        m_latest.time = now;
+        m_latest.sharpness = sharpness;
+        if (now - m_fpsStart >= FPS_INTERVAL_MS) {
+            m_latest.fps = m_fpsFrames * 1000.0f / (now - m_fpsStart);
+            m_fpsStart = now;
+            m_fpsFrames = 0;
+        }
+    }
+    m_frameReady.notify_one();
 
-    /* Create capture request and enable the output stream */
-    m_request.reset(iCaptureSession->createRequest());
-    IRequest *iRequest = interface_cast<IRequest>(m_request);
-    if (!iRequest)
-        ORIGINATE_ERROR("Failed to create Request");
-    iRequest->enableOutputStream(m_outputStream.get());
+    return true;
+}
 
-    ISourceSettings *iSourceSettings =
-            interface_cast<ISourceSettings>(iRequest->getSourceSettings());
-    if (!iSourceSettings)
-        ORIGINATE_ERROR("Failed to get ISourceSettings interface");
-    iSourceSettings->setFrameDurationRange(Range<uint64_t>(1e9/DEFAULT_FPS));
+bool AcquireThread::threadShutdown() {
+    return true;
+}
 
+/* The newest frame, false until the camera delivered a first frame */
+bool AcquireThread::getLatest(LatestFrame &frame) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_published)
+        return false;
+    if (m_fresh) {
+        std::swap(m_front, m_middle);
+        m_fresh = false;
+    }
+    frame = m_latest;
+    frame.fd = m_buffers[m_front];
     return true;
 }
 
 
 /*
  * Argus Consumer Thread:
- * This is the thread acquires buffers from each stream and composite them to
- * one frame. Finally it renders the composited frame through EGLRenderer.
+ * This is the thread that composites the newest frame of each stream into one
+ * frame and renders it. Each stream is drained by its own AcquireThread, so
+ * the composite runs at display rate with whatever is newest. Cameras without
+ * a frame for STALE_FRAME_MS are left out of the composite, their cell stays
+ * black until they recover. Keys read from the terminal (or the OpenCV window)
+ * switch between the grid and one camera's full-resolution focus stream.
+ * The focus assist draws a bar per cell whose length is the camera's sharpness
+ * relative to the best seen since the last reset, green once within
+ * IN_FOCUS_RATIO of it. The bars are drawn by the hardware blender in any
+ * format; the values are added as text when the composite is RGBA.
+ * A composite is only made and presented when a camera delivered a frame or
+ * the view changed. Each composite buffer remembers which frame every cell
+ * holds, so without the focus assist only the cells whose camera has a newer
+ * frame are blitted into it, and the OpenCV window only converts those cells.
+ * RGBA composites label each cell with its camera's frame rate.
+ * With RENDER_PLANES nothing is composited: each camera's newest buffer is
+ * set on its own overlay plane at its cell, and the focused camera on the
+ * first plane alone. The focus assist has no composite to draw on there.
  */
 class ConsumerThread : public Thread {
 
     public:
-        explicit ConsumerThread(std::vector<OutputStream*> &streams) :
+        explicit ConsumerThread(CaptureGraph &graph, const std::vector<CameraStreams> &streams) :
+            m_graph(graph),
             m_streams(streams),
-            m_compositedFrame(0)
-        {}
+            m_compositeSize(g_layout.getCompositeSize()),
+            m_focus(-1),
+            m_zoom(false),
+            m_overlay(g_sharpnessMap),
+            m_showFps(true),
+            m_shown(false),
+            m_osd(NULL),
+            m_eglRenderer(NULL),
+            m_drmRenderer(NULL),
+            m_nextComposite(0),
+            m_compositesQueued(0)
+        {
+            memset(m_compositedFrames, 0, sizeof(m_compositedFrames));
+            memset(m_bufferContents, 0, sizeof(m_bufferContents));
+            memset(m_bufferFilled, 0, sizeof(m_bufferFilled));
+            memset(&m_shownContent, 0, sizeof(m_shownContent));
+            memset(m_planeRects, 0, sizeof(m_planeRects));
+            for (uint32_t i = 0; i < MAX_CAMERA_NUM; i++)
+                m_planeFds[i] = -1;
+            memset(m_acquireThreads, 0, sizeof(m_acquireThreads));
+            memset(m_focusThreads, 0, sizeof(m_focusThreads));
+            memset(m_peaks, 0, sizeof(m_peaks));
+            for (uint32_t i = 0; i < MAX_CAMERA_NUM; i++)
+                m_stale[i] = true;
+        }
         virtual ~ConsumerThread();
 
     protected:
@@ -149,165 +386,275 @@ class ConsumerThread : public Thread {
         virtual bool threadShutdown();
         /**@}*/
 
-        std::vector<OutputStream*> &m_streams;
-        UniqueObj<FrameConsumer> m_consumers[MAX_CAMERA_NUM];
-        int m_dmabufs[MAX_CAMERA_NUM];
+        /* What a composite shows, compared bytewise so it is always memset first */
+        struct CompositeContent {
+            bool focused;
+            bool zoom;
+            bool overlay;
+            bool fps;
+            uint32_t count;
+            uint32_t cameras[MAX_CAMERA_NUM];
+            uint64_t sequences[MAX_CAMERA_NUM];
+        };
+
+        int getCompositeBuffer();
+        bool composite(int fd, const CompositeContent &content, const NvBufferCompositeParams &compositeParam,
+                       const int *dmabufs, uint32_t *redrawn, uint32_t &redrawnCount, bool &full);
+        bool renderComposite(int fd);
+        bool showComposite(int fd, const NvBufferCompositeParams &compositeParam, const uint32_t *redrawn,
+                           uint32_t redrawnCount, bool full, const char *winName, int &key);
+        bool pollWindow(const char *winName, int &key);
+        bool showPlanes(const NvBufferCompositeParams &compositeParam, const int *dmabufs,
+                        const uint32_t *cameras, uint32_t count, bool focused);
+        bool setPlane(uint32_t plane, int fd, const NvBufferRect &src, const NvBufferRect &dst);
+        bool renderUndistorted(const NvBufferCompositeParams &compositeParam, const int *dmabufs,
+                               const uint32_t *cameras, uint32_t count);
+        uint32_t setupGrid(NvBufferCompositeParams &compositeParam, int *dmabufs, uint32_t *cameras, LatestFrame *frames);
+        uint32_t setupFocus(NvBufferCompositeParams &compositeParam, int *dmabufs, uint32_t *cameras, LatestFrame *frames);
+        bool drawOverlay(int fd, const NvBufferCompositeParams &compositeParam, uint32_t count,
+                         const uint32_t *cameras, const LatestFrame *frames);
+        bool drawFps(int fd, const NvBufferCompositeParams &compositeParam, const uint32_t *redrawn,
+                     uint32_t redrawnCount, const uint32_t *cameras, const LatestFrame *frames);
+        bool handleKey(int key);
+        bool setFocus(uint32_t camera, bool enable);
+
+        CaptureGraph &m_graph;
+        const std::vector<CameraStreams> &m_streams;
+        Size2D<uint32_t> m_compositeSize;
+        int m_focus;            // camera shown alone at full resolution, -1 for the grid
+        bool m_zoom;            // focus shows the centre at one sensor pixel per display pixel
+        bool m_overlay;         // draw the focus assist
+        bool m_showFps;         // label the cells of RGBA composites with their frame rate
+        bool m_shown;           // m_shownContent is on screen
+        CompositeContent m_shownContent;
+        cv::Mat m_display;      // the OpenCV window's image, only redrawn cells are converted
+        float m_peaks[MAX_CAMERA_NUM];
+        void *m_osd;
+        AcquireThread *m_acquireThreads[MAX_CAMERA_NUM];
+        AcquireThread *m_focusThreads[MAX_CAMERA_NUM];
+        bool m_stale[MAX_CAMERA_NUM];
+        std::mutex m_frameMutex;
+        std::condition_variable m_frameReady;
         NvBufferCompositeParams m_compositeParam;
-        int m_compositedFrame;
+        NvEglRenderer *m_eglRenderer;
+        NvDrmRenderer *m_drmRenderer;
+        int m_compositedFrames[NUM_COMPOSITE_BUFFERS];
+        uint32_t m_nextComposite;
+        uint32_t m_compositesQueued;
+        CompositeContent m_bufferContents[NUM_COMPOSITE_BUFFERS]; // what each composite buffer holds
+        bool m_bufferFilled[NUM_COMPOSITE_BUFFERS];
+        std::map<int, uint32_t> m_planeFbs;     // framebuffer of each acquire buffer shown on a plane
+        int m_planeFds[MAX_CAMERA_NUM];         // buffer on each plane, -1 while disabled
+        NvBufferRect m_planeRects[MAX_CAMERA_NUM][2]; // source and display rectangle of each plane
 };
 
 ConsumerThread::~ConsumerThread() {
 
-    if (m_compositedFrame)
-        NvBufferDestroy(m_compositedFrame);
+    if (m_osd)
+        nvosd_destroy_context(m_osd);
 
-    for (uint32_t i = 0; i < m_streams.size(); i++)
-        if (m_dmabufs[i])
-            NvBufferDestroy(m_dmabufs[i]);
+    /* The renderers may still reference a composite buffer, destroy them first */
+    if (m_eglRenderer)
+        delete m_eglRenderer;
+    for (std::map<int, uint32_t>::iterator it = m_planeFbs.begin(); it != m_planeFbs.end(); ++it)
+        m_drmRenderer->removeFB(it->second);
+    if (m_drmRenderer)
+        delete m_drmRenderer;
+
+    for (uint32_t i = 0; i < NUM_COMPOSITE_BUFFERS; i++)
+        if (m_compositedFrames[i])
+            NvBufferDestroy(m_compositedFrames[i]);
+
+    for (uint32_t i = 0; i < m_streams.size(); i++) {
+        if (m_acquireThreads[i])
+            delete m_acquireThreads[i];
+        if (m_focusThreads[i])
+            delete m_focusThreads[i];
+    }
 }
 
 bool ConsumerThread::threadInitialize() {
 
-    NvBufferRect dstCompRect[6];
     NvBufferCreateParams input_params = {0};
 
-    // -------------------------
-    // |  -----  -----  -----  |
-    // |  | 0 |  | 2 |  | 4 |  |
-    // |  -----  -----  -----  |
-    // |                       |
-    // |  -----  -----  -----  |
-    // |  | 1 |  | 3 |  | 5 |  |
-    // |  -----  -----  -----  |
-    // -------------------------
-
-    for (uint8_t i = 0; i < MAX_CAMERA_NUM / 2; i++) {
-        // top row
-        dstCompRect[i].top  = CELL_SPACING;
-        dstCompRect[i].left = (i + 1) * CELL_SPACING + i * CELL_WIDTH;
-        dstCompRect[i].width = CELL_WIDTH;
-        dstCompRect[i].height = CELL_HEIGHT;
-        // bottom row
-        dstCompRect[i + MAX_CAMERA_NUM / 2].top  = 2 * CELL_SPACING + CELL_HEIGHT;
-        dstCompRect[i + MAX_CAMERA_NUM / 2].left = dstCompRect[i].left;
-        dstCompRect[i + MAX_CAMERA_NUM / 2].width = CELL_WIDTH;
-        dstCompRect[i + MAX_CAMERA_NUM / 2].height = CELL_HEIGHT;
-    }
-
-    /* Allocate composited buffer */
+    /* Allocate the composited buffers, the DRM planes only scan out YUV */
     //input_params.payloadType = NvBufferPayload_SurfArray;
-    input_params.width = STREAM_SIZE.width();
-    input_params.height = STREAM_SIZE.height();
+    input_params.width = m_compositeSize.width();
+    input_params.height = m_compositeSize.height();
     input_params.layout = NvBufferLayout_Pitch;
-    input_params.colorFormat = NvBufferColorFormat_ABGR32;
+    input_params.colorFormat = g_renderMode == RENDER_DRM ? NvBufferColorFormat_YUV420 : NvBufferColorFormat_ABGR32;
     input_params.nvbuf_tag = NvBufferTag_VIDEO_CONVERT;
-    NvBufferCreateEx (&m_compositedFrame, &input_params);
-    if (!m_compositedFrame)
-        ORIGINATE_ERROR("Failed to allocate composited buffer");
-
-    /* Initialize composite parameters */
-    memset(&m_compositeParam, 0, sizeof(m_compositeParam));
-    m_compositeParam.composite_flag = NVBUFFER_COMPOSITE;
-    m_compositeParam.input_buf_count = m_streams.size();
-    memcpy(m_compositeParam.dst_comp_rect, dstCompRect,
-                sizeof(NvBufferRect) * m_compositeParam.input_buf_count);
-    for (uint32_t i = 0; i < 6; i++) {
-        m_compositeParam.dst_comp_rect_alpha[i] = 1.0f;
-        m_compositeParam.src_comp_rect[i].top = 0;
-        m_compositeParam.src_comp_rect[i].left = 0;
-        m_compositeParam.src_comp_rect[i].width = STREAM_SIZE.width();
-        m_compositeParam.src_comp_rect[i].height = STREAM_SIZE.height();
+    for (uint32_t i = 0; i < NUM_COMPOSITE_BUFFERS && g_renderMode != RENDER_PLANES; i++) {
+        NvBufferCreateEx(&m_compositedFrames[i], &input_params);
+        if (!m_compositedFrames[i])
+            ORIGINATE_ERROR("Failed to allocate composited buffer");
     }
 
-    /* Initialize buffer handles. Buffer will be created by FrameConsumer */
-    memset(m_dmabufs, 0, sizeof(m_dmabufs));
+    /* Create the renderer, the OpenCV window is created once the streams are connected */
+    if (g_renderMode == RENDER_EGL) {
+        m_eglRenderer = NvEglRenderer::createEglRenderer("renderer0", m_compositeSize.width(), m_compositeSize.height(), 0, 0);
+        if (!m_eglRenderer)
+            ORIGINATE_ERROR("Failed to create the EGL renderer, use --renderer opencv over remote X");
+        m_eglRenderer->setFPS(DEFAULT_FPS);
+
+        /* The remaps are computed once, the GPU applies them every frame */
+        for (uint32_t i = 0; i < g_calibrations.size() && i < m_streams.size(); i++) {
+            std::vector<uint16_t> coords;
+            buildUndistortRemap(g_calibrations[i], g_layout.cellWidth, g_layout.cellHeight, coords);
+            if (m_eglRenderer->setRemap(i, g_layout.cellWidth, g_layout.cellHeight, coords.data()) != 0)
+                ORIGINATE_ERROR("Failed to set the undistortion remap of camera %d", i);
+        }
+    } else if (g_renderMode == RENDER_DRM || g_renderMode == RENDER_PLANES) {
+        struct drm_tegra_hdr_metadata_smpte_2086 metadata;
+        memset(&metadata, 0, sizeof(metadata));
+        m_drmRenderer = NvDrmRenderer::createDrmRenderer("renderer0", m_compositeSize.width(), m_compositeSize.height(),
+                                                         0, 0, 0, 0, metadata, false);
+        if (!m_drmRenderer)
+            ORIGINATE_ERROR("Failed to create the DRM renderer");
+        m_drmRenderer->setFPS(DEFAULT_FPS);
+
+        /* The composite buffers are the only ones flipped to, import each just once */
+        m_drmRenderer->enableBufferCache(true);
+        if (g_renderMode == RENDER_PLANES && m_drmRenderer->getPlaneCount() < (int) m_streams.size())
+            ORIGINATE_ERROR("The display has %d planes for %d cameras, use --renderer drm",
+                            m_drmRenderer->getPlaneCount(), (int) m_streams.size());
+    }
 
-    /* Create the FrameConsumer */
-    for (uint32_t i = 0; i < m_streams.size(); i++)
-        m_consumers[i].reset(FrameConsumer::create(m_streams[i]));
+    /* Create the on-screen display context for the focus assist and the frame rate labels */
+    if (g_sharpnessMap || g_renderMode == RENDER_EGL || g_renderMode == RENDER_OPENCV) {
+        m_osd = nvosd_create_context();
+        if (!m_osd)
+            ORIGINATE_ERROR("Failed to create the NvOSD context");
+    }
+
+    /* Initialize composite parameters, the cells actually composited are picked per frame */
+    g_layout.setupComposite(m_compositeParam, m_streams.size(), g_layout.cellWidth, g_layout.cellHeight);
+
+    /* Launch one acquire thread per stream, each creates its own FrameConsumer.
+       The focus streams deliver nothing and allocate nothing until first focused */
+    NvBufferColorFormat cellFormat = g_renderMode == RENDER_DRM || g_renderMode == RENDER_PLANES ?
+                                     NvBufferColorFormat_YUV420 : NvBufferColorFormat_ABGR32;
+    for (uint32_t i = 0; i < m_streams.size(); i++) {
+        m_acquireThreads[i] = new AcquireThread(m_graph.getStream(m_streams[i].cell), i, cellFormat, m_frameReady);
+        PROPAGATE_ERROR(m_acquireThreads[i]->initialize());
+        m_focusThreads[i] = new AcquireThread(m_graph.getStream(m_streams[i].focus), i, cellFormat, m_frameReady);
+        PROPAGATE_ERROR(m_focusThreads[i]->initialize());
+    }
 
     return true;
 }
 
 bool ConsumerThread::threadExecute() {
 
-    IEGLOutputStream *iEglOutputStreams[MAX_CAMERA_NUM];
-    IFrameConsumer *iFrameConsumers[MAX_CAMERA_NUM];
-
-    for (uint32_t i = 0; i < m_streams.size(); i++) {
-        iEglOutputStreams[i] = interface_cast<IEGLOutputStream>(m_streams[i]);
-        iFrameConsumers[i] = interface_cast<IFrameConsumer>(m_consumers[i]);
-        if (!iFrameConsumers[i])
-            ORIGINATE_ERROR("Failed to get IFrameConsumer interface");
-
-        /* Wait until the producer has connected to the stream */
-        CONSUMER_PRINT("Waiting until producer is connected...\n");
-        if (iEglOutputStreams[i]->waitUntilConnected() != STATUS_OK)
-            ORIGINATE_ERROR("Stream failed to connect.");
-        CONSUMER_PRINT("Producer has connected; continuing.\n");
-    }
-
     /* Create a window for displaying the stream */
     char winName[] = "Stream Preview";
-    cv::namedWindow(winName, cv::WINDOW_NORMAL);
-    cv::resizeWindow(winName, STREAM_SIZE.width(), STREAM_SIZE.height());
+    if (g_renderMode == RENDER_OPENCV) {
+        cv::namedWindow(winName, cv::WINDOW_NORMAL);
+        cv::resizeWindow(winName, m_compositeSize.width(), m_compositeSize.height());
+    }
+    CONSUMER_PRINT("Keys: 1-%d focus a camera, z zoom the focused camera, g back to the grid, q quit\n",
+                   (int) m_streams.size());
+    if (g_renderMode == RENDER_EGL || g_renderMode == RENDER_OPENCV)
+        CONSUMER_PRINT("Keys: f toggle the frame rate labels\n");
+    if (g_sharpnessMap)
+        CONSUMER_PRINT("Keys: s toggle the focus assist, r reset its peaks\n");
+    else
+        CONSUMER_PRINT("The ISP provides no sharpness map, the focus assist is disabled\n");
 
     while (g_doStream) {
-        for (uint32_t i = 0; i < m_streams.size(); i++) {
-            /* Acquire a frame */
-            UniqueObj<Frame> frame(iFrameConsumers[i]->acquireFrame());
-            IFrame *iFrame = interface_cast<IFrame>(frame);
-            if (!iFrame)
-                break;
-
-            /* Get the IImageNativeBuffer extension interface */
-            NV::IImageNativeBuffer *iNativeBuffer =
-                interface_cast<NV::IImageNativeBuffer>(iFrame->getImage());
-            if (!iNativeBuffer)
-                ORIGINATE_ERROR("IImageNativeBuffer not supported by Image.");
-
-            /* If we don't already have a buffer, create one from this image.
-               Otherwise, just blit to our buffer */
-            if (!m_dmabufs[i]) {
-                m_dmabufs[i] = iNativeBuffer->createNvBuffer(iEglOutputStreams[i]->getResolution(),
-                                                             NvBufferColorFormat_ABGR32,
-                                                             NvBufferLayout_Pitch);
-                if (!m_dmabufs[i])
-                    CONSUMER_PRINT("\tFailed to create NvBuffer\n");
-            
-            } else if (iNativeBuffer->copyToNvBuffer(m_dmabufs[i]) != STATUS_OK) {
-                ORIGINATE_ERROR("Failed to copy frame to NvBuffer.");
-            }
+
+        /* Sleep until any camera publishes a frame, at most one display period */
+        {
+            std::unique_lock<std::mutex> lock(m_frameMutex);
+            m_frameReady.wait_for(lock, std::chrono::milliseconds(1000 / DEFAULT_FPS));
+        }
+
+        /* Switch layouts on a key press from the terminal */
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        char c;
+        if (poll(&pfd, 1, 0) > 0 && read(STDIN_FILENO, &c, 1) == 1)
+            PROPAGATE_ERROR(handleKey(c));
+
+        /* Show the focused camera alone, or the grid until its first full-resolution frame arrives */
+        NvBufferCompositeParams compositeParam = m_compositeParam;
+        int dmabufs[MAX_CAMERA_NUM];
+        uint32_t cameras[MAX_CAMERA_NUM];
+        LatestFrame frames[MAX_CAMERA_NUM];
+        uint32_t count = m_focus >= 0 ? setupFocus(compositeParam, dmabufs, cameras, frames) : 0;
+        bool focused = count > 0;
+        if (count == 0)
+            count = setupGrid(compositeParam, dmabufs, cameras, frames);
+
+        /* Let the display planes place the frames, stale cameras' planes are turned off */
+        if (g_renderMode == RENDER_PLANES) {
+            if (!showPlanes(compositeParam, dmabufs, cameras, count, focused))
+                ORIGINATE_ERROR("Failed to show the frames on the display planes");
+            continue;
+        }
+
+        /* Nothing new since the last composite, leave it on screen */
+        CompositeContent content;
+        memset(&content, 0, sizeof(content));
+        content.focused = focused;
+        content.zoom = focused && m_zoom;
+        content.overlay = m_overlay;
+        content.fps = m_showFps && (g_renderMode == RENDER_EGL || g_renderMode == RENDER_OPENCV);
+        content.count = count;
+        for (uint32_t i = 0; i < count; i++) {
+            content.cameras[i] = cameras[i];
+            content.sequences[i] = frames[i].sequence;
+        }
+        if (m_shown && memcmp(&content, &m_shownContent, sizeof(content)) == 0) {
+            int key = -1;
+            if (g_renderMode == RENDER_OPENCV && !pollWindow(winName, key))
+                ORIGINATE_ERROR("Failed to poll the OpenCV window");
+            if (key != -1)
+                PROPAGATE_ERROR(handleKey(key));
+            continue;
+        }
+
+        /* Undistort the grid on the GPU straight from the cameras' buffers, no composite is made */
+        if (!g_calibrations.empty() && !focused) {
+            if (count > 0 && !renderUndistorted(compositeParam, dmabufs, cameras, count))
+                ORIGINATE_ERROR("Failed to render the undistorted cells");
+            m_shownContent = content;
+            m_shown = true;
+            continue;
         }
 
         /* Composite and display the image */
-        if (m_streams.size() > 1) {
-
-            /* Create composite image */
-            NvBufferComposite(m_dmabufs, m_compositedFrame, &m_compositeParam);
-
-            /* Convert NvBuffer to cv::Mat */
-            void *pdata = NULL;
-            NvBufferMemMap(m_compositedFrame, 0, NvBufferMem_Read, &pdata);
-            NvBufferMemSyncForCpu(m_compositedFrame, 0, &pdata);
-            NvBufferParams params;
-            NvBufferGetParams(m_compositedFrame, &params);
-            cv::Mat imgbuf = cv::Mat(STREAM_SIZE.height(),
-                                    STREAM_SIZE.width(),
-                                    CV_8UC4, pdata, params.pitch[0]);
-            cv::Mat display_img; 
-            cvtColor(imgbuf, display_img, cv::COLOR_RGBA2BGR);
-            NvBufferMemUnMap(m_compositedFrame, 0, &pdata);
-
-            /* Display the image, check for exit button press */
-            cv::imshow(winName, display_img);
-            cv::waitKey(1);
-            g_doStream = cv::getWindowProperty(winName, cv::WND_PROP_AUTOSIZE) != -1;
+        if ((m_streams.size() > 1 || m_focus >= 0) && count > 0) {
+
+            /* Create composite image, or redraw only the cells the buffer holds an older frame of */
+            int fd = getCompositeBuffer();
+            if (fd == -1)
+                ORIGINATE_ERROR("Failed to get a free composited buffer");
+            uint32_t redrawn[MAX_CAMERA_NUM];
+            uint32_t redrawnCount = 0;
+            bool full = true;
+            PROPAGATE_ERROR(composite(fd, content, compositeParam, dmabufs, redrawn, redrawnCount, full));
+            if (m_overlay && !drawOverlay(fd, compositeParam, count, cameras, frames))
+                ORIGINATE_ERROR("Failed to draw the focus assist");
+            else if (!m_overlay && content.fps && !drawFps(fd, compositeParam, redrawn, redrawnCount, cameras, frames))
+                ORIGINATE_ERROR("Failed to draw the frame rate labels");
+
+            /* Display the image */
+            if (g_renderMode == RENDER_OPENCV) {
+                int key = -1;
+                if (!showComposite(fd, compositeParam, redrawn, redrawnCount, full, winName, key))
+                    ORIGINATE_ERROR("Failed to display the composited frame");
+                if (key != -1)
+                    PROPAGATE_ERROR(handleKey(key));
+            } else if (!renderComposite(fd)) {
+                ORIGINATE_ERROR("Failed to render the composited frame");
+            }
+            m_shownContent = content;
+            m_shown = true;
         }
     }
 
     /* Destroy the window, if it exists */
-    if (cv::getWindowProperty(winName, cv::WND_PROP_VISIBLE) != -1)
+    if (g_renderMode == RENDER_OPENCV && cv::getWindowProperty(winName, cv::WND_PROP_VISIBLE) != -1)
         cv::destroyWindow(winName);
 
     CONSUMER_PRINT("Done.\n");
@@ -318,6 +665,369 @@ bool ConsumerThread::threadExecute() {
 }
 
 bool ConsumerThread::threadShutdown() {
+
+    /* Stop the acquire threads, their acquire timeout bounds how long this takes */
+    for (uint32_t i = 0; i < m_streams.size(); i++) {
+        if (m_acquireThreads[i])
+            PROPAGATE_ERROR(m_acquireThreads[i]->shutdown());
+        if (m_focusThreads[i])
+            PROPAGATE_ERROR(m_focusThreads[i]->shutdown());
+    }
+    return true;
+}
+
+/* Take the newest frame of every camera, leaving out cameras that went quiet */
+uint32_t ConsumerThread::setupGrid(NvBufferCompositeParams &compositeParam, int *dmabufs,
+                                   uint32_t *cameras, LatestFrame *frames) {
+    uint32_t count = 0;
+    uint64_t now = nowMs();
+    for (uint32_t i = 0; i < m_streams.size(); i++) {
+        LatestFrame frame;
+        memset(&frame, 0, sizeof(frame));
+        bool stale = !m_acquireThreads[i]->getLatest(frame) || now - frame.time > STALE_FRAME_MS;
+        if (stale && !m_stale[i] && frame.time != 0)
+            CONSUMER_PRINT("Camera %d has stalled, showing its cell blank\n", i);
+        else if (!stale && m_stale[i])
+            CONSUMER_PRINT("Camera %d is streaming\n", i);
+        m_stale[i] = stale;
+        if (stale)
+            continue;
+        dmabufs[count] = frame.fd;
+        cameras[count] = i;
+        frames[count] = frame;
+        compositeParam.dst_comp_rect[count] = m_compositeParam.dst_comp_rect[i];
+        compositeParam.src_comp_rect[count] = m_compositeParam.src_comp_rect[i];
+        count++;
+    }
+    return count;
+}
+
+/* Fit the focused camera's full-resolution frame into the composite, or with zoom
+   show its centre unscaled; returns 0 while the focus stream has no recent frame */
+uint32_t ConsumerThread::setupFocus(NvBufferCompositeParams &compositeParam, int *dmabufs,
+                                    uint32_t *cameras, LatestFrame *frames) {
+    if (!m_focusThreads[m_focus]->getLatest(frames[0]) || nowMs() - frames[0].time > STALE_FRAME_MS)
+        return 0;
+
+    Size2D<uint32_t> frameSize = interface_cast<IEGLOutputStream>(m_graph.getStream(m_streams[m_focus].focus))->getResolution();
+    NvBufferRect src = {0, 0, frameSize.width(), frameSize.height()};
+    NvBufferRect dst;
+    if (m_zoom) {
+        src.width = std::min(frameSize.width(), m_compositeSize.width());
+        src.height = std::min(frameSize.height(), m_compositeSize.height());
+        src.left = (frameSize.width() - src.width) / 2;
+        src.top = (frameSize.height() - src.height) / 2;
+        dst.width = src.width;
+        dst.height = src.height;
+    } else {
+        float scale = std::min((float) m_compositeSize.width() / frameSize.width(),
+                               (float) m_compositeSize.height() / frameSize.height());
+        dst.width = frameSize.width() * scale;
+        dst.height = frameSize.height() * scale;
+    }
+    dst.left = (m_compositeSize.width() - dst.width) / 2;
+    dst.top = (m_compositeSize.height() - dst.height) / 2;
+
+    dmabufs[0] = frames[0].fd;
+    cameras[0] = m_focus;
+    compositeParam.src_comp_rect[0] = src;
+    compositeParam.dst_comp_rect[0] = dst;
+    return 1;
+}
+
+/* Draw each cell's sharpness bar, and its value and frame rate as text on RGBA composites */
+bool ConsumerThread::drawOverlay(int fd, const NvBufferCompositeParams &compositeParam, uint32_t count,
+                                 const uint32_t *cameras, const LatestFrame *frames) {
+    NvOSD_RectParams bars[MAX_CAMERA_NUM];
+    NvOSD_TextParams labels[MAX_CAMERA_NUM];
+    char text[MAX_CAMERA_NUM][OVERLAY_TEXT_LENGTH];
+    char font[] = "Arial";
+    memset(bars, 0, sizeof(bars));
+    memset(labels, 0, sizeof(labels));
+    for (uint32_t i = 0; i < count; i++) {
+        const NvBufferRect &cell = compositeParam.dst_comp_rect[i];
+        float &peak = m_peaks[cameras[i]];
+        peak = std::max(peak, frames[i].sharpness);
+        float ratio = peak > 0.0f ? frames[i].sharpness / peak : 0.0f;
+        bool inFocus = ratio >= IN_FOCUS_RATIO;
+
+        /* A solid bar along the bottom of the cell */
+        uint32_t barWidth = cell.width - 2 * OVERLAY_MARGIN;
+        bars[i].left = cell.left + OVERLAY_MARGIN;
+        bars[i].top = cell.top + cell.height - OVERLAY_MARGIN - OVERLAY_BAR_HEIGHT;
+        bars[i].width = std::max(1U, (uint32_t) (barWidth * ratio));
+        bars[i].height = OVERLAY_BAR_HEIGHT;
+        bars[i].has_bg_color = 1;
+        bars[i].bg_color.red = inFocus ? 0.0 : 1.0;
+        bars[i].bg_color.green = 1.0;
+        bars[i].bg_color.alpha = 1.0;
+
+        snprintf(text[i], OVERLAY_TEXT_LENGTH, "cam%u %.1f fps %.4f peak %.4f", cameras[i] + 1,
+                 frames[i].fps, frames[i].sharpness, peak);
+        labels[i].display_text = text[i];
+        labels[i].x_offset = cell.left + OVERLAY_MARGIN;
+        labels[i].y_offset = cell.top + OVERLAY_MARGIN;
+        labels[i].font_params.font_name = font;
+        labels[i].font_params.font_size = OVERLAY_FONT_SIZE;
+        labels[i].font_params.font_color = bars[i].bg_color;
+        labels[i].set_bg_clr = 1;
+        labels[i].text_bg_clr.alpha = 1.0;
+    }
+
+    if (nvosd_draw_rectangles(m_osd, MODE_HW, fd, count, bars) != 0)
+        return false;
+    if (g_renderMode != RENDER_DRM && nvosd_put_text(m_osd, MODE_CPU, fd, count, labels) != 0)
+        return false;
+    return true;
+}
+
+/* Label the redrawn cells with their camera's frame rate, the other cells keep the label
+   drawn with the frame they hold */
+bool ConsumerThread::drawFps(int fd, const NvBufferCompositeParams &compositeParam, const uint32_t *redrawn,
+                             uint32_t redrawnCount, const uint32_t *cameras, const LatestFrame *frames) {
+    if (redrawnCount == 0)
+        return true;
+    NvOSD_TextParams labels[MAX_CAMERA_NUM];
+    char text[MAX_CAMERA_NUM][OVERLAY_TEXT_LENGTH];
+    char font[] = "Arial";
+    memset(labels, 0, sizeof(labels));
+    for (uint32_t i = 0; i < redrawnCount; i++) {
+        uint32_t cell = redrawn[i];
+        snprintf(text[i], OVERLAY_TEXT_LENGTH, "cam%u %.1f fps", cameras[cell] + 1, frames[cell].fps);
+        labels[i].display_text = text[i];
+        labels[i].x_offset = compositeParam.dst_comp_rect[cell].left + OVERLAY_MARGIN;
+        labels[i].y_offset = compositeParam.dst_comp_rect[cell].top + OVERLAY_MARGIN;
+        labels[i].font_params.font_name = font;
+        labels[i].font_params.font_size = OVERLAY_FONT_SIZE;
+        labels[i].font_params.font_color.red = 1.0;
+        labels[i].font_params.font_color.green = 1.0;
+        labels[i].font_params.font_color.blue = 1.0;
+        labels[i].font_params.font_color.alpha = 1.0;
+        labels[i].set_bg_clr = 1;
+        labels[i].text_bg_clr.alpha = 1.0;
+    }
+    return nvosd_put_text(m_osd, MODE_CPU, fd, redrawnCount, labels) == 0;
+}
+
+/* Digits focus a camera, z toggles zoom, g or 0 return to the grid, s toggles the
+   focus assist, r resets its peaks, f toggles the frame rate labels and q quits */
+bool ConsumerThread::handleKey(int key) {
+    int focus = m_focus;
+    if (key >= '1' && key < '1' + (int) m_streams.size()) {
+        focus = key - '1';
+    } else if (key == 'g' || key == '0') {
+        focus = -1;
+    } else if (key == 'z') {
+        m_zoom = !m_zoom;
+    } else if (key == 's' && g_sharpnessMap) {
+        m_overlay = !m_overlay;
+    } else if (key == 'r') {
+        memset(m_peaks, 0, sizeof(m_peaks));
+    } else if (key == 'f') {
+        m_showFps = !m_showFps;
+    } else if (key == 'q') {
+        g_doStream = false;
+    }
+    if (focus == m_focus)
+        return true;
+
+    /* Only the focused camera captures its full-resolution stream */
+    if (m_focus >= 0)
+        PROPAGATE_ERROR(setFocus(m_focus, false));
+    if (focus >= 0)
+        PROPAGATE_ERROR(setFocus(focus, true));
+    m_focus = focus;
+    if (focus >= 0)
+        CONSUMER_PRINT("Focusing camera %d\n", focus);
+    else
+        CONSUMER_PRINT("Showing all cameras\n");
+    return true;
+}
+
+/* Start or stop capturing the camera's full-resolution focus stream */
+bool ConsumerThread::setFocus(uint32_t camera, bool enable) {
+    if (!m_graph.enableStream(m_streams[camera].focus, enable) || !m_graph.submit(camera))
+        ORIGINATE_ERROR("%s", m_graph.getError().c_str());
+    return true;
+}
+
+/* The next composited buffer to draw into, once the DRM renderer holds every
+   buffer wait for it to return the one it scanned out before the current one */
+int ConsumerThread::getCompositeBuffer() {
+    if (g_renderMode != RENDER_DRM || m_compositesQueued < NUM_COMPOSITE_BUFFERS) {
+        int fd = m_compositedFrames[m_nextComposite];
+        m_nextComposite = (m_nextComposite + 1) % NUM_COMPOSITE_BUFFERS;
+        return fd;
+    }
+    m_compositesQueued--;
+    return m_drmRenderer->dequeBuffer();
+}
+
+/* Bring the composite buffer up to the content, full is set when every cell had to be composited.
+   A buffer still holding an earlier grid only gets the cells blitted whose camera has a newer frame,
+   cells that went blank, a view change or the focus assist repaint it whole. redrawn lists the
+   cells drawn into the buffer */
+bool ConsumerThread::composite(int fd, const CompositeContent &content, const NvBufferCompositeParams &compositeParam,
+                               const int *dmabufs, uint32_t *redrawn, uint32_t &redrawnCount, bool &full) {
+    uint32_t index = 0;
+    while (index < NUM_COMPOSITE_BUFFERS - 1 && m_compositedFrames[index] != fd)
+        index++;
+    CompositeContent &held = m_bufferContents[index];
+
+    /* The cells the buffer holds a frame of, in the same order as the content's since both are grids */
+    bool incremental = m_bufferFilled[index] && !content.focused && !held.focused &&
+                       !content.overlay && !held.overlay && content.fps == held.fps;
+    uint64_t heldSequences[MAX_CAMERA_NUM] = {0};
+    for (uint32_t i = 0; i < held.count && incremental; i++) {
+        bool kept = false;
+        for (uint32_t j = 0; j < content.count && !kept; j++)
+            kept = content.cameras[j] == held.cameras[i];
+        incremental = kept;
+        heldSequences[held.cameras[i]] = held.sequences[i];
+    }
+
+    redrawnCount = 0;
+    if (incremental) {
+        for (uint32_t i = 0; i < content.count; i++) {
+            if (heldSequences[content.cameras[i]] == content.sequences[i])
+                continue;
+            NvBufferTransformParams params;
+            memset(&params, 0, sizeof(params));
+            params.transform_flag = NVBUFFER_TRANSFORM_CROP_SRC | NVBUFFER_TRANSFORM_CROP_DST;
+            params.src_rect = compositeParam.src_comp_rect[i];
+            params.dst_rect = compositeParam.dst_comp_rect[i];
+            if (NvBufferTransform(dmabufs[i], fd, &params) != 0)
+                ORIGINATE_ERROR("Failed to blit camera %u into the composite", content.cameras[i] + 1);
+            redrawn[redrawnCount++] = i;
+        }
+    } else {
+        NvBufferCompositeParams params = compositeParam;
+        params.input_buf_count = content.count;
+        NvBufferComposite(const_cast<int *>(dmabufs), fd, &params);
+        for (uint32_t i = 0; i < content.count; i++)
+            redrawn[redrawnCount++] = i;
+    }
+    held = content;
+    m_bufferFilled[index] = true;
+    full = !incremental;
+    return true;
+}
+
+/* Hand the composited dmabuf to the GPU or a display plane, it never touches the CPU */
+bool ConsumerThread::renderComposite(int fd) {
+    if (g_renderMode == RENDER_EGL)
+        return m_eglRenderer->render(fd) == 0;
+    if (m_drmRenderer->enqueBuffer(fd) != 0)
+        return false;
+    m_compositesQueued++;
+    return true;
+}
+
+/* Show each camera's frame on its own plane at its cell, or the focused camera alone on the
+   first plane. The planes still showing the same buffer are left alone, as every setPlane()
+   blocks until the next vblank */
+bool ConsumerThread::showPlanes(const NvBufferCompositeParams &compositeParam, const int *dmabufs,
+                                const uint32_t *cameras, uint32_t count, bool focused) {
+    int fds[MAX_CAMERA_NUM];
+    const NvBufferRect *rects[MAX_CAMERA_NUM][2];
+    for (uint32_t i = 0; i < m_streams.size(); i++)
+        fds[i] = -1;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t plane = focused ? 0 : cameras[i];
+        fds[plane] = dmabufs[i];
+        rects[plane][0] = &compositeParam.src_comp_rect[i];
+        rects[plane][1] = &compositeParam.dst_comp_rect[i];
+    }
+
+    NvBufferRect none = {0, 0, 0, 0};
+    for (uint32_t i = 0; i < m_streams.size(); i++) {
+        if (fds[i] == -1 && m_planeFds[i] != -1)
+            PROPAGATE_ERROR(setPlane(i, -1, none, none));
+        else if (fds[i] != -1)
+            PROPAGATE_ERROR(setPlane(i, fds[i], *rects[i][0], *rects[i][1]));
+    }
+    return true;
+}
+
+/* Put a buffer on a plane, or turn the plane off with fd -1. The framebuffers are kept per
+   buffer, the acquire threads cycle through the same few buffers for as long as they run */
+bool ConsumerThread::setPlane(uint32_t plane, int fd, const NvBufferRect &src, const NvBufferRect &dst) {
+    if (fd == m_planeFds[plane] && memcmp(&src, &m_planeRects[plane][0], sizeof(src)) == 0 &&
+        memcmp(&dst, &m_planeRects[plane][1], sizeof(dst)) == 0)
+        return true;
+
+    uint32_t fb = 0;
+    if (fd != -1) {
+        std::map<int, uint32_t>::iterator it = m_planeFbs.find(fd);
+        if (it == m_planeFbs.end()) {
+            if (m_drmRenderer->addBufferFB(fd, &fb) != 0)
+                ORIGINATE_ERROR("Failed to import a frame of camera plane %u", plane);
+            it = m_planeFbs.insert(std::make_pair(fd, fb)).first;
+        }
+        fb = it->second;
+    }
+
+    /* The source rectangle is in Q16.16 fixed point */
+    if (m_drmRenderer->setPlane(plane, fb, dst.left, dst.top, dst.width, dst.height,
+                                src.left << 16, src.top << 16, src.width << 16, src.height << 16) != 0)
+        ORIGINATE_ERROR("Failed to set display plane %u", plane);
+    m_planeFds[plane] = fd;
+    m_planeRects[plane][0] = src;
+    m_planeRects[plane][1] = dst;
+    return true;
+}
+
+/* Draw every cell in one frame, each camera's buffer sampled through its undistortion remap */
+bool ConsumerThread::renderUndistorted(const NvBufferCompositeParams &compositeParam, const int *dmabufs,
+                                       const uint32_t *cameras, uint32_t count) {
+    NvEglCell cells[MAX_CAMERA_NUM];
+    for (uint32_t i = 0; i < count; i++) {
+        const NvBufferRect &dst = compositeParam.dst_comp_rect[i];
+        cells[i].fd = dmabufs[i];
+        cells[i].x = dst.left;
+        cells[i].y = dst.top;
+        cells[i].width = dst.width;
+        cells[i].height = dst.height;
+        cells[i].remap = cameras[i] < g_calibrations.size() ? (int) cameras[i] : -1;
+    }
+    return m_eglRenderer->renderCells(count, cells) == 0;
+}
+
+/* Map the composited frame and draw it in the OpenCV window, check for exit button and key presses.
+   Unless full, only the redrawn cells are converted, the window image holds the rest already */
+bool ConsumerThread::showComposite(int fd, const NvBufferCompositeParams &compositeParam, const uint32_t *redrawn,
+                                   uint32_t redrawnCount, bool full, const char *winName, int &key) {
+
+    /* Convert NvBuffer to cv::Mat */
+    void *pdata = NULL;
+    if (NvBufferMemMap(fd, 0, NvBufferMem_Read, &pdata) != 0)
+        return false;
+    NvBufferMemSyncForCpu(fd, 0, &pdata);
+    NvBufferParams params;
+    NvBufferGetParams(fd, &params);
+    if (m_display.empty())
+        m_display.create(m_compositeSize.height(), m_compositeSize.width(), CV_8UC3);
+    if (full) {
+        rgbaToBgr((const uint8_t *) pdata, params.pitch[0], m_display.data, m_display.step,
+                  m_compositeSize.width(), m_compositeSize.height());
+    } else {
+        for (uint32_t i = 0; i < redrawnCount; i++) {
+            const NvBufferRect &cell = compositeParam.dst_comp_rect[redrawn[i]];
+            rgbaToBgr((const uint8_t *) pdata + cell.top * params.pitch[0] + cell.left * 4, params.pitch[0],
+                      m_display.ptr(cell.top, cell.left), m_display.step, cell.width, cell.height);
+        }
+    }
+    NvBufferMemUnMap(fd, 0, &pdata);
+
+    /* Display the image, check for exit button press */
+    cv::imshow(winName, m_display);
+    return pollWindow(winName, key);
+}
+
+/* Let the OpenCV window handle its events, check for exit button and key presses */
+bool ConsumerThread::pollWindow(const char *winName, int &key) {
+    key = cv::waitKey(1);
+    g_doStream = cv::getWindowProperty(winName, cv::WND_PROP_AUTOSIZE) != -1;
     return true;
 }
 
@@ -330,81 +1040,183 @@ bool ConsumerThread::threadShutdown() {
  */
 static bool execute() {
 
-    /* Initialize the Argus camera provider */
-    g_cameraProvider = UniqueObj<CameraProvider>(CameraProvider::create());
-    ICameraProvider *iCameraProvider = interface_cast<ICameraProvider>(g_cameraProvider);
-    if (!iCameraProvider)
-        ORIGINATE_ERROR("Failed to get ICameraProvider interface");
-    printf("Argus Version: %s\n", iCameraProvider->getVersion().c_str());
-
-    /* Get the camera devices */
-    std::vector<CameraDevice*> cameraDevices;
-    iCameraProvider->getCameraDevices(&cameraDevices);
-    if (cameraDevices.size() == 0)
-        ORIGINATE_ERROR("No cameras available");
-
-    UniqueObj<CaptureHolder> captureHolders[MAX_CAMERA_NUM];
-    uint32_t streamCount = cameraDevices.size() < MAX_CAMERA_NUM ?
-            cameraDevices.size() : MAX_CAMERA_NUM;
-    for (uint32_t i = 0; i < streamCount; i++) {
-        captureHolders[i].reset(new CaptureHolder);
-        if (!captureHolders[i].get()->initialize(cameraDevices[i]))
-            ORIGINATE_ERROR("Failed to initialize Camera session %d", i);
+    /* Open at most as many cameras as the grid has cells, one capture session each */
+    CaptureGraph graph;
+    if (!graph.open(std::min(MAX_CAMERA_NUM, g_layout.columns * g_layout.rows)) || !graph.createSessions(false))
+        ORIGINATE_ERROR("%s", graph.getError().c_str());
+    printf("Argus Version: %s\n", graph.getProvider()->getVersion().c_str());
+    g_sharpnessMap = graph.getProvider()->supportsExtension(EXT_BAYER_SHARPNESS_MAP);
+
+    /* The focus stream runs at the resolution of the first sensor mode */
+    SensorMode *sensorMode = graph.getSensorMode(0);
+    ISensorMode *iSensorMode = interface_cast<ISensorMode>(sensorMode);
+    if (!iSensorMode)
+        ORIGINATE_ERROR("Failed to get ISensorMode interface");
+
+    /* Create the OutputStreams, the ISP scales the preview stream straight to the cell size */
+    std::vector<CameraStreams> streams(graph.getCameraCount());
+    for (uint32_t i = 0; i < streams.size(); i++) {
+        streams[i].cell = graph.addStream(i, CAPTURE_STREAM_EGL, g_layout.getCellSize());
+        streams[i].focus = graph.addStream(i, CAPTURE_STREAM_EGL, iSensorMode->getResolution());
+        if (streams[i].cell < 0 || streams[i].focus < 0)
+            ORIGINATE_ERROR("Failed to initialize Camera session %d: %s", i, graph.getError().c_str());
     }
 
-    std::vector<OutputStream*> streams;
-    for (uint32_t i = 0; i < streamCount; i++)
-        streams.push_back(captureHolders[i].get()->getStream());
+    /* Create the capture requests and enable the preview streams, the focus streams only while focused */
+    if (!graph.createRequests(sensorMode, Range<uint64_t>(1e9/DEFAULT_FPS)))
+        ORIGINATE_ERROR("%s", graph.getError().c_str());
+    for (uint32_t i = 0; i < streams.size(); i++) {
+        if (!graph.enableStream(streams[i].cell, true))
+            ORIGINATE_ERROR("%s", graph.getError().c_str());
+
+        /* Let the ISP measure the sharpness of every capture for the focus assist overlay */
+        if (g_sharpnessMap) {
+            Ext::IBayerSharpnessMapSettings *iSharpnessSettings =
+                interface_cast<Ext::IBayerSharpnessMapSettings>(graph.getRequest(i));
+            if (!iSharpnessSettings)
+                ORIGINATE_ERROR("Failed to get IBayerSharpnessMapSettings interface");
+            iSharpnessSettings->setBayerSharpnessMapEnable(true);
+        }
+    }
 
     /* Start the rendering thread */
-    ConsumerThread consumerThread(streams);
-    PROPAGATE_ERROR(consumerThread.initialize());
-    PROPAGATE_ERROR(consumerThread.waitRunning());
+    ConsumerThread consumerThread(graph, streams);
+    if (!graph.registerConsumer(&consumerThread) || !graph.startConsumers())
+        ORIGINATE_ERROR("%s", graph.getError().c_str());
 
     /* Submit capture requests */
-    for (uint32_t j = 0; j < streamCount; j++) {
-        ICaptureSession *iCaptureSession =
-                interface_cast<ICaptureSession>(captureHolders[j].get()->getSession());
-        Request *request = captureHolders[j].get()->getRequest();
-        Argus::Status status = iCaptureSession->repeat(request);
-        if (status != STATUS_OK)
-            ORIGINATE_ERROR("Failed to submit capture request");
-    }
+    if (!graph.submit())
+        ORIGINATE_ERROR("%s", graph.getError().c_str());
 
-    /* Loop until g_doStream becomes false from signal handler or exit button pressed */
-    while (g_doStream) {}
+    /* Block until the rendering thread completes, g_doStream becomes false from the
+       signal handler or exit button press and it returns within one display period.
+       Joining instead of spinning on g_doStream leaves the core to the compositor */
+    if (!graph.shutdownConsumers())
+        ORIGINATE_ERROR("%s", graph.getError().c_str());
 
-    /* Stop repeating requests */
-    for (uint32_t i = 0; i < streamCount; i++) {
-        ICaptureSession *iCaptureSession =
-            interface_cast<ICaptureSession>(captureHolders[i].get()->getSession());
-        iCaptureSession->stopRepeat();
-    }
+    /* Stop repeating requests, wait for idle and shut down Argus */
+    graph.stop(TIMEOUT_INFINITE);
+    graph.close();
 
-    /* Wait for idle */
-    for (uint32_t i = 0; i < streamCount; i++) {
-        ICaptureSession *iCaptureSession =
-            interface_cast<ICaptureSession>(captureHolders[i].get()->getSession());
-        iCaptureSession->waitForIdle();
-    }
+    return true;
+}
 
-    /* Destroy the capture resources */
-    for (uint32_t i = 0; i < streamCount; i++) {
-        captureHolders[i].reset();
+}; /* namespace ArgusSamples */
+
+/* Stop streaming on ctrl+c, the GPU renderers have no window button to close */
+static void signalCallback(int signum) {
+    g_doStream = false;
+}
+
+static void printHelp() {
+    printf("Usage: StreamPreview [OPTIONS]\n"
+           "  --renderer\t-r\t<egl, drm, planes or opencv>\tHow the composited frame is shown. [Default: egl with X, drm without]\n"
+           "egl: GPU rendered X window. drm: display plane, no X server needed. planes: one display plane per camera,\n"
+           "needs as many overlay planes as cameras and has no focus assist. opencv: CPU rendered, works over remote X.\n"
+           "  --cell-size\t-c\t<WxH>\t\t\tResolution each camera is captured and shown at in the grid. [Default: %ux%u]\n"
+           "  --grid\t-g\t<CxR>\t\t\tColumns and rows of the grid, cameras fill it column by column. [Default: %ux%u]\n"
+           "  --undistort\t-u\t<file>\t\t\tUndistort the grid on the GPU, egl only. One line per camera of\n"
+           "\t\t\t\"width height fx fy cx cy k1 k2 p1 p2 k3\", the intrinsics in pixels of width x height. [Default: none]\n"
+           "  --help\t\t-h\tNone\t\t\tPrint this help.\n"
+           "While running, keys 1-%u show one camera at full resolution, z zooms it to one sensor pixel per\n"
+           "display pixel, g returns to the grid and q quits. s toggles the focus assist and r resets its peaks,\n"
+           "f toggles the frame rate labels.\n",
+           DEFAULT_CELL_WIDTH, DEFAULT_CELL_HEIGHT, DEFAULT_COLUMNS, DEFAULT_ROWS, MAX_CAMERA_NUM);
+}
+
+/* Read one camera per line, "width height fx fy cx cy k1 k2 p1 p2 k3", lines starting with # are skipped */
+static bool loadCalibrations(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return false;
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        LensCalibration lens;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%u %u %f %f %f %f %f %f %f %f %f", &lens.width, &lens.height, &lens.fx, &lens.fy,
+                   &lens.cx, &lens.cy, &lens.k1, &lens.k2, &lens.p1, &lens.p2, &lens.k3) != 11 ||
+            lens.width == 0 || lens.height == 0 || lens.fx <= 0.0f || lens.fy <= 0.0f) {
+            fclose(file);
+            return false;
+        }
+        g_calibrations.push_back(lens);
     }
+    fclose(file);
+    return !g_calibrations.empty();
+}
 
-    /* Wait for the rendering thread to complete */
-    PROPAGATE_ERROR(consumerThread.shutdown());
+/* Parse a "<a>x<b>" pair of positive integers */
+static bool parsePair(const char *arg, uint32_t &a, uint32_t &b) {
+    char end;
+    return sscanf(arg, "%ux%u%c", &a, &b, &end) == 2 && a > 0 && b > 0;
+}
 
-    /* Shut down Argus */
-    g_cameraProvider.reset();
+/* Read single key presses from the terminal without waiting for enter */
+static struct termios g_savedTermios;
+static bool g_termiosSaved = false;
 
-    return true;
+static void restoreTerminal() {
+    if (g_termiosSaved)
+        tcsetattr(STDIN_FILENO, TCSANOW, &g_savedTermios);
 }
 
-}; /* namespace ArgusSamples */
+static void setupTerminal() {
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &g_savedTermios) != 0)
+        return;
+    g_termiosSaved = true;
+    struct termios raw = g_savedTermios;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    atexit(restoreTerminal);
+}
 
 int main(int argc, char * argv[]) {
+
+    static struct option long_options[] = {
+        {"renderer", required_argument, NULL, 'r'},
+        {"cell-size", required_argument, NULL, 'c'},
+        {"grid", required_argument, NULL, 'g'},
+        {"undistort", required_argument, NULL, 'u'},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    /* Without an X server the dmabuf goes straight to a display plane */
+    g_renderMode = getenv("DISPLAY") ? RENDER_EGL : RENDER_DRM;
+    int c;
+    while ((c = getopt_long(argc, argv, "r:c:g:u:h", long_options, NULL)) != -1) {
+        if (c == 'r' && strcmp(optarg, "egl") == 0) {
+            g_renderMode = RENDER_EGL;
+        } else if (c == 'r' && strcmp(optarg, "drm") == 0) {
+            g_renderMode = RENDER_DRM;
+        } else if (c == 'r' && strcmp(optarg, "planes") == 0) {
+            g_renderMode = RENDER_PLANES;
+        } else if (c == 'r' && strcmp(optarg, "opencv") == 0) {
+            g_renderMode = RENDER_OPENCV;
+        } else if (c == 'c' && parsePair(optarg, g_layout.cellWidth, g_layout.cellHeight)) {
+            continue;
+        } else if (c == 'g' && parsePair(optarg, g_layout.columns, g_layout.rows)) {
+            continue;
+        } else if (c == 'u' && loadCalibrations(optarg)) {
+            continue;
+        } else {
+            printHelp();
+            return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (!g_calibrations.empty() && g_renderMode != RENDER_EGL) {
+        printf("--undistort needs the egl renderer\n");
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, signalCallback);
+    signal(SIGTERM, signalCallback);
+    setupTerminal();
+
     if (!ArgusSamples::execute())
         return EXIT_FAILURE;
     return EXIT_SUCCESS;
@@ -0,0 +1,289 @@
+/*
+ * ComponentBench.cpp
+ *
+ * Times the hot paths the pipeline is built from, one at a time with nothing
+ * else running, for a cost model of each component: the NvElementProfiler
+ * start and finish every encoder unit pays, Logger::log, a JPEG encode by
+ * resolution and quality, the VIC blit by source and destination layout and
+ * NvBufferComposite by the number of cells in the canvas. copyToNvBuffer
+ * needs a frame from an Argus stream, it is the same VIC blit as the transform
+ * from a pitch linear source and is timed as such. The frames are noise, so
+ * no encode gets an easy input.
+ *
+ * Every case runs BENCH_WARMUP untimed iterations, then the timed ones. Calls
+ * well under a microsecond are timed in batches of BENCH_BATCH and each sample
+ * is the batch's mean. The samples are sorted for the percentiles, which are
+ * exact rather than bucketed. The thread is pinned to the passed core first,
+ * 0 by default, an A57 core on the TX2 (1 and 2 are Denver). One CSV line per
+ * case goes to stdout.
+ *
+ * Usage: ./ComponentBench [cpu] [iterations]
+ * Output format: component,case,samples,mean_us,p50_us,p99_us,max_us
+ */
+
+#include "NvElement.h"
+#include "NvJpegEncoder.h"
+#include "Logger.hpp"
+#include "LogSink.hpp"
+#include "SyntheticPattern.hpp"
+#include "ThreadPlacement.hpp"
+#include <nvbuf_utils.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace Argus;
+
+#define BENCH_WIDTH 2048    // IMX265 full frame
+#define BENCH_HEIGHT 1536
+#define BENCH_ITERATIONS 50 // samples of the hardware cases
+#define BENCH_WARMUP 5      // untimed iterations before each case, the first calls map buffers and start engines
+#define BENCH_BATCH 1000    // calls per sample of the cases well under a microsecond
+#define BENCH_CALL_SAMPLES 200  // samples of those cases
+
+/* The profiler is only reachable from an element, this one does nothing else */
+class ProfiledElement : public NvElement {
+
+    public:
+        ProfiledElement() : NvElement("bench", NvElementProfiler::PROFILER_FIELD_ALL) {}
+
+        NvElementProfiler& getProfiler() {
+            return profiler;
+        }
+};
+
+/* Run call warmup times, then time samples samples of batch calls each and print their percentiles in us */
+template <typename F>
+static bool timeCase(const char *component, const std::string& name, uint32_t samples, uint32_t batch, F call) {
+    for (uint32_t i = 0; i < BENCH_WARMUP; i++) {
+        if (!call())
+            return false;
+    }
+    std::vector<double> times(samples);
+    for (uint32_t i = 0; i < samples; i++) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t j = 0; j < batch; j++) {
+            if (!call())
+                return false;
+        }
+        times[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / batch;
+    }
+    double total = 0;
+    for (uint32_t i = 0; i < samples; i++)
+        total += times[i];
+    std::sort(times.begin(), times.end());
+    uint32_t p99 = std::min(samples - 1, (uint32_t) (samples * 0.99));
+    printf("%s,%s,%u,%.3f,%.3f,%.3f,%.3f\n", component, name.c_str(), samples, total / samples, times[samples / 2],
+           times[p99], times[samples - 1]);
+    fflush(stdout);
+    return true;
+}
+
+/* A YUV420 buffer of the size and layout */
+static int createBuffer(uint32_t width, uint32_t height, NvBufferLayout layout) {
+    NvBufferCreateParams params;
+    memset(&params, 0, sizeof(params));
+    params.width = width;
+    params.height = height;
+    params.payloadType = NvBufferPayload_SurfArray;
+    params.layout = layout;
+    params.colorFormat = NvBufferColorFormat_YUV420;
+    params.nvbuf_tag = NvBufferTag_VIDEO_CONVERT;
+    int fd = -1;
+    if (NvBufferCreateEx(&fd, &params) != 0)
+        return -1;
+    return fd;
+}
+
+/* Blit src into dst, scaled to fit as a capture's copy is */
+static bool transform(int src, int dst) {
+    NvBufferTransformParams params;
+    memset(&params, 0, sizeof(params));
+    params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+    params.transform_filter = NvBufferTransform_Filter_Smart;
+    return NvBufferTransform(src, dst, &params) == 0;
+}
+
+static const char *layoutName(NvBufferLayout layout) {
+    return layout == NvBufferLayout_Pitch ? "pitch" : "block";
+}
+
+int main(int argc, char *argv[]) {
+
+    bool errorOccurred = false;
+
+    if (argc > 3) {
+        fprintf(stderr, "Usage:\n./ComponentBench [cpu] [iterations]\n");
+        return 1;
+    }
+    int cpu = argc > 1 ? atoi(argv[1]) : 0;
+    uint32_t iterations = argc > 2 ? atoi(argv[2]) : BENCH_ITERATIONS;
+    if (iterations < 2) {
+        fprintf(stderr, "Invalid iterations, expected >= 2\n");
+        return 1;
+    }
+    std::string placement;
+    if (!placeThread(cpu, SCHED_OTHER, 0, placement))
+        fprintf(stderr, "Thread placement incomplete, %s\n", placement.c_str());
+
+    printf("component,case,samples,mean_us,p50_us,p99_us,max_us\n");
+
+    /* The profiler calls of every encoded unit, enabled and disabled */
+    ProfiledElement element;
+    NvElementProfiler& profiler = element.getProfiler();
+    profiler.enableProfiling(true);
+    timeCase("profiler", "start_finish", BENCH_CALL_SAMPLES, BENCH_BATCH, [&] {
+        profiler.finishProcessing(profiler.startProcessing(), false);
+        return true;
+    });
+    profiler.disableProfiling();
+    timeCase("profiler", "start_finish_disabled", BENCH_CALL_SAMPLES, BENCH_BATCH, [&] {
+        profiler.finishProcessing(profiler.startProcessing(), false);
+        return true;
+    });
+
+    /* A typical record, formatted and queued for the sink's thread to write */
+    char directory[] = "/tmp/ComponentBench.XXXXXX";
+    if (mkdtemp(directory)) {
+        Logger logger("BENCH", directory, "bench.log");
+        logger.disableVerbose();
+        std::string message = "Camera 3: frame 123456 written, 812345 bytes";
+        timeCase("logger", "log", BENCH_CALL_SAMPLES, BENCH_BATCH / 10, [&] {
+            logger.log(message);
+            return true;
+        });
+        LogSink::instance().flush();
+        if (LogSink::instance().getDropped() > 0)
+            fprintf(stderr, "The log ring was full for %lu records, those were dropped rather than written\n",
+                    LogSink::instance().getDropped());
+        std::string path = std::string(directory) + "/bench.log";
+        unlink(path.c_str());
+        rmdir(directory);
+    } else {
+        fprintf(stderr, "Failed to create a directory for the logger, skipping it\n");
+    }
+
+    /* Noise frames to copy and encode */
+    SyntheticPattern pattern(Size2D<uint32_t>(BENCH_WIDTH, BENCH_HEIGHT), PATTERN_NOISE, "");
+    if (!pattern.create()) {
+        fprintf(stderr, "%s\n", pattern.getError().c_str());
+        return 1;
+    }
+    int source = pattern.getFd(0);
+
+    /* The encoder reads block-linear buffers, each size is scaled from the full frame */
+    NvJPEGEncoder *encoder = NvJPEGEncoder::createJPEGEncoder("benchenc");
+    if (!encoder) {
+        fprintf(stderr, "Failed to create the JPEG encoder\n");
+        errorOccurred = true;
+    }
+    static const uint32_t sizes[][2] = {{640, 480}, {1024, 768}, {BENCH_WIDTH, BENCH_HEIGHT}};
+    static const int qualities[] = {50, 75, 95};
+    unsigned long capacity = BENCH_WIDTH * BENCH_HEIGHT * 3 / 2;
+    unsigned char *output = (unsigned char *) malloc(capacity);
+    if (!output) {
+        fprintf(stderr, "Failed to allocate the JPEG output buffer\n");
+        errorOccurred = true;
+    }
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !errorOccurred; i++) {
+        int fd = createBuffer(sizes[i][0], sizes[i][1], NvBufferLayout_BlockLinear);
+        if (fd == -1 || !transform(source, fd)) {
+            fprintf(stderr, "Failed to prepare a %ux%u frame\n", sizes[i][0], sizes[i][1]);
+            errorOccurred = true;
+        }
+        for (uint32_t j = 0; j < sizeof(qualities) / sizeof(qualities[0]) && !errorOccurred; j++) {
+            char name[64];
+            snprintf(name, sizeof(name), "%ux%u_q%d", sizes[i][0], sizes[i][1], qualities[j]);
+            errorOccurred = !timeCase("jpeg_encode", name, iterations, 1, [&] {
+                /* libjpeg replaces a buffer it outgrows with its own, keep whichever it left us */
+                unsigned char *data = output;
+                unsigned long size = capacity;
+                bool encoded = encoder->encodeFromFd(fd, JCS_YCbCr, &data, size, qualities[j]) == 0;
+                if (data != output) {
+                    free(output);
+                    output = data;
+                    capacity = size;
+                }
+                return encoded;
+            });
+        }
+        if (fd != -1)
+            NvBufferDestroy(fd);
+    }
+    free(output);
+    delete encoder;
+
+    /* The VIC blit between the layouts, then scaled as the preview and motion gate copies are */
+    static const NvBufferLayout layouts[] = {NvBufferLayout_Pitch, NvBufferLayout_BlockLinear};
+    int block = errorOccurred ? -1 : createBuffer(BENCH_WIDTH, BENCH_HEIGHT, NvBufferLayout_BlockLinear);
+    if (!errorOccurred && (block == -1 || !transform(source, block))) {
+        fprintf(stderr, "Failed to prepare a block-linear frame\n");
+        errorOccurred = true;
+    }
+    for (uint32_t i = 0; i < 2 && !errorOccurred; i++) {
+        int src = layouts[i] == NvBufferLayout_Pitch ? source : block;
+        for (uint32_t j = 0; j < 2 && !errorOccurred; j++) {
+            for (uint32_t scale = 1; scale <= 2 && !errorOccurred; scale++) {
+                int dst = createBuffer(BENCH_WIDTH / scale, BENCH_HEIGHT / scale, layouts[j]);
+                if (dst == -1) {
+                    fprintf(stderr, "Failed to allocate a destination frame\n");
+                    errorOccurred = true;
+                    break;
+                }
+                char name[64];
+                snprintf(name, sizeof(name), "%s_to_%s_%ux%u", layoutName(layouts[i]), layoutName(layouts[j]),
+                         BENCH_WIDTH / scale, BENCH_HEIGHT / scale);
+                errorOccurred = !timeCase("transform", name, iterations, 1, [&] { return transform(src, dst); });
+                NvBufferDestroy(dst);
+            }
+        }
+    }
+
+    /* Full frames tiled into a full frame canvas, in a grid of as many columns as rows or one more */
+    static const uint32_t cells[] = {1, 2, 4, 6, 9};
+    int canvas = errorOccurred ? -1 : createBuffer(BENCH_WIDTH, BENCH_HEIGHT, NvBufferLayout_BlockLinear);
+    if (!errorOccurred && canvas == -1) {
+        fprintf(stderr, "Failed to allocate the canvas\n");
+        errorOccurred = true;
+    }
+    for (uint32_t i = 0; i < sizeof(cells) / sizeof(cells[0]) && !errorOccurred; i++) {
+        uint32_t columns = 1;
+        while (columns * columns < cells[i])
+            columns++;
+        uint32_t rows = (cells[i] + columns - 1) / columns;
+        NvBufferCompositeParams params;
+        memset(&params, 0, sizeof(params));
+        params.composite_flag = NVBUFFER_COMPOSITE;
+        params.input_buf_count = cells[i];
+        int fds[MAX_COMPOSITE_FRAME];
+        for (uint32_t j = 0; j < cells[i]; j++) {
+            fds[j] = source;
+            params.src_comp_rect[j].width = BENCH_WIDTH;
+            params.src_comp_rect[j].height = BENCH_HEIGHT;
+            params.dst_comp_rect[j].width = BENCH_WIDTH / columns & ~15U;
+            params.dst_comp_rect[j].height = BENCH_HEIGHT / rows & ~15U;
+            params.dst_comp_rect[j].left = j % columns * params.dst_comp_rect[j].width;
+            params.dst_comp_rect[j].top = j / columns * params.dst_comp_rect[j].height;
+            params.dst_comp_rect_alpha[j] = 1.0f;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "%u_cells", cells[i]);
+        errorOccurred = !timeCase("composite", name, iterations, 1, [&] {
+            return NvBufferComposite(fds, canvas, &params) == 0;
+        });
+    }
+    if (canvas != -1)
+        NvBufferDestroy(canvas);
+    if (block != -1)
+        NvBufferDestroy(block);
+
+    if (errorOccurred)
+        fprintf(stderr, "A case failed, the cases after it were not run\n");
+    return errorOccurred ? 1 : 0;
+}
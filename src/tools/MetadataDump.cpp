@@ -0,0 +1,64 @@
+/*
+ * MetadataDump.cpp
+ *
+ * Decodes a camN/metadata.bin file written with --metadata and prints one CSV
+ * line per saved image, followed by the exposure and gain range on stderr.
+ * Only the records the header counts are read, so a file left preallocated by
+ * a crashed run decodes up to its last stored frame.
+ */
+
+#include "MetadataLog.hpp"
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char *argv[]) {
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage:\n./MetadataDump <camN/metadata.bin>\n");
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", argv[1]);
+        return 1;
+    }
+
+    /* Validate the header, records may grow in later versions so honour recordSize */
+    MetadataHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, METADATA_MAGIC, sizeof(header.magic)) != 0
+        || header.recordSize < sizeof(MetadataRecord)) {
+        fprintf(stderr, "%s is not a metadata file\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    uint64_t records = 0, minExposure = UINT64_MAX, maxExposure = 0;
+    float minGain = 1e9, maxGain = 0;
+    char record[header.recordSize];
+    printf("camera,frame,index,sensor_timestamp_ns,exposure_ns,frame_duration_ns,readout_ns,capture_id,"
+           "analog_gain,isp_gain,lux,awb_cct,awb_r,awb_gr,awb_gb,awb_b,ae_state,awb_state,ae_locked\n");
+    while (records < header.count && fread(record, header.recordSize, 1, file) == 1) {
+        MetadataRecord r;
+        memcpy(&r, record, sizeof(r));
+        printf("%u,%lu,%lu,%lu,%lu,%lu,%lu,%u,%f,%f,%f,%u,%f,%f,%f,%f,%u,%u,%u\n", header.camera,
+               r.frameNumber, r.index, r.sensorTimestamp, r.exposureTime, r.frameDuration, r.readoutTime, r.captureId,
+               r.analogGain, r.ispDigitalGain, r.sceneLux, r.awbCct, r.awbGains[0], r.awbGains[1], r.awbGains[2],
+               r.awbGains[3], r.aeState, r.awbState, r.aeLocked);
+        records++;
+        if (r.exposureTime < minExposure)
+            minExposure = r.exposureTime;
+        if (r.exposureTime > maxExposure)
+            maxExposure = r.exposureTime;
+        if (r.analogGain < minGain)
+            minGain = r.analogGain;
+        if (r.analogGain > maxGain)
+            maxGain = r.analogGain;
+    }
+    fclose(file);
+
+    fprintf(stderr, "Camera %u: %lu of %lu records\n", header.camera, records, header.count);
+    if (records > 0)
+        fprintf(stderr, "  exposure %lu-%lu us  analog gain %.2f-%.2f\n", minExposure / 1000, maxExposure / 1000, minGain, maxGain);
+    return 0;
+}
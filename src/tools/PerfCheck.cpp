@@ -0,0 +1,173 @@
+/*
+ * PerfCheck.cpp
+ *
+ * Compares the PerfResults of make perf-check's benchmark runs with the
+ * committed baseline and prints every metric with its delta, exiting with 1
+ * once a throughput metric dropped or a p99 latency or the CPU time per frame
+ * rose by more than the tolerance, so a change that costs fps fails before
+ * it reaches the rover. Metrics are named <bench>.<stage>.<measure>, the
+ * baseline holds those of every bench it was recorded from:
+ *
+ *   ./PerfCheck [--tolerance <percent>] <baseline.json> <results.json>...
+ *   ./PerfCheck --update <baseline.json> <results.json>...
+ *
+ * --update writes the results as the new baseline instead of comparing.
+ */
+
+#include "PerfResults.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#define DEFAULT_TOLERANCE 5.0   // percent a metric may move the wrong way
+#define LATENCY_FLOOR_US 100    // latencies rising by less are timer and scheduling noise
+#define LINE_MAX_CHARS 512
+
+/* The metrics of one or more results files, in the order read */
+struct Results {
+    std::vector<std::string> workloads;
+    std::vector<std::string> names;
+    std::map<std::string, double> values;
+};
+
+/* Read a results file, metrics are prefixed with the bench name unless it is a baseline */
+static bool readResults(const char *filename, Results& results) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", filename);
+        return false;
+    }
+    char line[LINE_MAX_CHARS];
+    char text[LINE_MAX_CHARS];
+    std::string prefix;
+    bool valid = false;
+    while (fgets(line, sizeof(line), file)) {
+        double value;
+        if (sscanf(line, " \"bench\": \"%511[^\"]\"", text) == 1) {
+            prefix = strcmp(text, "baseline") == 0 ? "" : std::string(text) + ".";
+            valid = true;
+        } else if (sscanf(line, " \"workload\": \"%511[^\"]\"", text) == 1) {
+            results.workloads.push_back(text);
+        } else if (sscanf(line, " \"%511[^\"]\": %lf", text, &value) == 2) {
+            std::string name = prefix + text;
+            if (!results.values.count(name))
+                results.names.push_back(name);
+            results.values[name] = value;
+        }
+    }
+    fclose(file);
+    if (!valid)
+        fprintf(stderr, "%s is not a benchmark results file\n", filename);
+    return valid;
+}
+
+static bool endsWith(const std::string& name, const char *suffix) {
+    size_t length = strlen(suffix);
+    return name.size() >= length && name.compare(name.size() - length, length, suffix) == 0;
+}
+
+int main(int argc, char *argv[]) {
+
+    double tolerance = DEFAULT_TOLERANCE;
+    bool update = false;
+    int first = 1;
+    while (first < argc && strncmp(argv[first], "--", 2) == 0) {
+        if (strcmp(argv[first], "--update") == 0) {
+            update = true;
+            first++;
+        } else if (strcmp(argv[first], "--tolerance") == 0 && first + 1 < argc) {
+            tolerance = atof(argv[first + 1]);
+            first += 2;
+        } else {
+            break;
+        }
+    }
+    if (argc - first < 2 || tolerance <= 0) {
+        fprintf(stderr, "Usage:\n./PerfCheck [--tolerance <percent>] <baseline.json> <results.json>...\n"
+                        "./PerfCheck --update <baseline.json> <results.json>...\n");
+        return 1;
+    }
+
+    Results current;
+    for (int i = first + 1; i < argc; i++) {
+        if (!readResults(argv[i], current))
+            return 1;
+    }
+
+    /* Record the runs as the baseline to commit */
+    if (update) {
+        std::string workload;
+        for (size_t i = 0; i < current.workloads.size(); i++)
+            workload += (i ? "; " : "") + current.workloads[i];
+        PerfResults baseline("baseline", workload);
+        for (size_t i = 0; i < current.names.size(); i++)
+            baseline.add(current.names[i], current.values[current.names[i]]);
+        if (!baseline.write(argv[first])) {
+            fprintf(stderr, "Failed to write %s\n", argv[first]);
+            return 1;
+        }
+        printf("Baseline of %zu metrics written to %s, commit it to make it the reference\n", current.names.size(),
+               argv[first]);
+        return 0;
+    }
+
+    Results baseline;
+    if (!readResults(argv[first], baseline)) {
+        fprintf(stderr, "Record one on this TX2 with make perf-baseline and commit it\n");
+        return 1;
+    }
+
+    /* Numbers from another workload say nothing about this change */
+    std::string workload, baselineWorkload;
+    for (size_t i = 0; i < current.workloads.size(); i++)
+        workload += (i ? "; " : "") + current.workloads[i];
+    for (size_t i = 0; i < baseline.workloads.size(); i++)
+        baselineWorkload += (i ? "; " : "") + baseline.workloads[i];
+    if (workload != baselineWorkload) {
+        fprintf(stderr, "Workload differs from the baseline's\n  baseline: %s\n  current:  %s\n"
+                        "Rerun with the baseline's arguments or record a new one with make perf-baseline\n",
+                baselineWorkload.c_str(), workload.c_str());
+        return 1;
+    }
+
+    /* Every baseline metric with its delta, throughput may not drop and latency and cost may not rise */
+    uint32_t regressions = 0;
+    printf("%-36s %14s %14s %9s\n", "metric", "baseline", "current", "delta");
+    for (size_t i = 0; i < baseline.names.size(); i++) {
+        const std::string& name = baseline.names[i];
+        double before = baseline.values[name];
+        if (!current.values.count(name)) {
+            printf("%-36s %14.2f %14s %9s  MISSING\n", name.c_str(), before, "-", "-");
+            regressions++;
+            continue;
+        }
+        double after = current.values[name];
+        double delta = before != 0 ? (after - before) / fabs(before) * 100 : (after != 0 ? 100 : 0);
+        const char *verdict = "";
+        if (endsWith(name, ".fps") || endsWith(name, ".mib_per_s")) {
+            verdict = delta < -tolerance ? "  REGRESSED" : "";
+        } else if (endsWith(name, ".p99_us")) {
+            verdict = delta > tolerance && after - before > LATENCY_FLOOR_US ? "  REGRESSED" : "";
+        } else if (endsWith(name, ".cpu_us_per_frame")) {
+            verdict = delta > tolerance ? "  REGRESSED" : "";
+        }
+        if (*verdict)
+            regressions++;
+        printf("%-36s %14.2f %14.2f %+8.1f%%%s\n", name.c_str(), before, after, delta, verdict);
+    }
+    for (size_t i = 0; i < current.names.size(); i++) {
+        if (!baseline.values.count(current.names[i]))
+            printf("%-36s %14s %14.2f %9s  new\n", current.names[i].c_str(), "-", current.values[current.names[i]], "-");
+    }
+
+    if (regressions > 0) {
+        printf("%u metrics regressed beyond %.1f%%\n", regressions, tolerance);
+        return 1;
+    }
+    printf("No regression beyond %.1f%%\n", tolerance);
+    return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * PixelBench.cpp
+ *
+ * Times each PixelKernels kernel against its scalar twin on full frame planes
+ * and checks both produce the same output, and the CRC32C of the image
+ * checksums against its table driven twin. The thread is pinned to the passed
+ * core first, 0 by default, an A57 core on the TX2 (1 and 2 are Denver). One
+ * CSV line per kernel goes to stdout.
+ *
+ * Usage: ./PixelBench [cpu] [iterations]
+ * Output format: kernel,scalar_us,neon_us,speedup,match
+ */
+
+#include "PixelKernels.hpp"
+#include "Crc32c.hpp"
+#include "ThreadPlacement.hpp"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define BENCH_WIDTH 2048    // IMX265 full frame
+#define BENCH_HEIGHT 1536
+#define BENCH_ITERATIONS 50
+
+static volatile uint64_t g_sink; // keeps the sums from being optimised away
+
+/* Mean time of one call in us */
+template <typename F>
+static double timeKernel(F kernel, uint32_t iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++)
+        kernel();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+static void report(const char *name, double scalar, double neon, bool match) {
+    printf("%s,%.1f,%.1f,%.2f,%s\n", name, scalar, neon, scalar / neon, match ? "yes" : "NO");
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc > 3) {
+        fprintf(stderr, "Usage:\n./PixelBench [cpu] [iterations]\n");
+        return 1;
+    }
+    int cpu = argc > 1 ? atoi(argv[1]) : 0;
+    uint32_t iterations = argc > 2 ? atoi(argv[2]) : BENCH_ITERATIONS;
+    if (iterations < 1) {
+        fprintf(stderr, "Invalid iterations, expected >= 1\n");
+        return 1;
+    }
+    std::string placement;
+    if (!placeThread(cpu, SCHED_OTHER, 0, placement))
+        fprintf(stderr, "Thread placement incomplete, %s\n", placement.c_str());
+
+    /* Noise so no kernel gets an easy input */
+    uint32_t width = BENCH_WIDTH, height = BENCH_HEIGHT;
+    std::vector<uint8_t> rgba(width * height * 4), luma(width * height), previous(width * height);
+    uint32_t state = 2463534242U;
+    for (size_t i = 0; i < rgba.size(); i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        rgba[i] = state;
+    }
+    memcpy(luma.data(), rgba.data(), luma.size());
+    memcpy(previous.data(), rgba.data() + luma.size(), previous.size());
+    std::vector<uint8_t> scalarOut(width * height * 3), neonOut(width * height * 3);
+    const uint8_t *u = luma.data(), *v = previous.data();
+
+    printf("kernel,scalar_us,neon_us,speedup,match\n");
+
+    double scalar = timeKernel([&] { rgbaToBgrScalar(rgba.data(), width * 4, scalarOut.data(), width * 3, width, height); }, iterations);
+    double neon = timeKernel([&] { rgbaToBgr(rgba.data(), width * 4, neonOut.data(), width * 3, width, height); }, iterations);
+    report("rgba_to_bgr", scalar, neon, scalarOut == neonOut);
+
+    uint32_t chromaWidth = width / 2, chromaHeight = height / 2;
+    scalar = timeKernel([&] { interleaveChromaScalar(u, v, chromaWidth, scalarOut.data(), width, chromaWidth, chromaHeight); }, iterations);
+    neon = timeKernel([&] { interleaveChroma(u, v, chromaWidth, neonOut.data(), width, chromaWidth, chromaHeight); }, iterations);
+    report("i420_to_nv12_chroma", scalar, neon, scalarOut == neonOut);
+
+    scalar = timeKernel([&] { downscaleHalfScalar(luma.data(), width, scalarOut.data(), width / 2, width / 2, height / 2); }, iterations);
+    neon = timeKernel([&] { downscaleHalf(luma.data(), width, neonOut.data(), width / 2, width / 2, height / 2); }, iterations);
+    report("downscale_half", scalar, neon, scalarOut == neonOut);
+
+    uint64_t scalarSum = 0, neonSum = 0;
+    scalar = timeKernel([&] { g_sink = scalarSum = sumAbsDiffScalar(luma.data(), previous.data(), width * height); }, iterations);
+    neon = timeKernel([&] { g_sink = neonSum = sumAbsDiff(luma.data(), previous.data(), width * height); }, iterations);
+    report("sum_abs_diff", scalar, neon, scalarSum == neonSum);
+
+    scalar = timeKernel([&] { g_sink = scalarSum = sumPlaneScalar(luma.data(), width, width, height); }, iterations);
+    neon = timeKernel([&] { g_sink = neonSum = sumPlane(luma.data(), width, width, height); }, iterations);
+    report("sum_plane", scalar, neon, scalarSum == neonSum);
+
+    /* 12 bit samples in the top of each 16 bit word, one Bayer frame as packed by --raw-layout bayer12 */
+    const uint16_t *bayer = (const uint16_t *) rgba.data();
+    scalar = timeKernel([&] { packRaw12Scalar(bayer, width * 2, scalarOut.data(), width * 3 / 2, width, height, 4); }, iterations);
+    neon = timeKernel([&] { packRaw12(bayer, width * 2, neonOut.data(), width * 3 / 2, width, height, 4); }, iterations);
+    report("pack_raw12", scalar, neon, scalarOut == neonOut);
+
+    uint32_t scalarCrc = 0, neonCrc = 0;
+    scalar = timeKernel([&] { g_sink = scalarCrc = crc32cScalar(rgba.data(), rgba.size()); }, iterations);
+    neon = timeKernel([&] { g_sink = neonCrc = crc32c(rgba.data(), rgba.size()); }, iterations);
+    report("crc32c", scalar, neon, scalarCrc == neonCrc);
+
+#if !defined(__ARM_NEON)
+    fprintf(stderr, "Built without NEON, both columns time the scalar kernels\n");
+#endif
+    return 0;
+}
@@ -0,0 +1,225 @@
+/*
+ * QueueBench.cpp
+ *
+ * Stress test and throughput benchmark of the lock-free primitives every
+ * stage passes work through: SpscRing, MpmcRing with one consumer and with
+ * several, BoundedQueue with its blocking pop and the ObjectPool. Each case
+ * runs its producers and consumers flat out, one thread per core in turn, and
+ * checks every item arrived exactly once and, from each producer, in the order
+ * pushed as each consumer saw it; the pool checks no object is ever checked
+ * out twice at once. A full ring is retried after yielding the core, so the
+ * counts are exact and a case with more threads than cores still progresses. A failed
+ * check makes the exit status non-zero, which makes the run a test on the
+ * weakly ordered TX2 as well as a benchmark. One CSV line per case goes to
+ * stdout.
+ *
+ * Usage: ./QueueBench [items per producer]
+ * Output format: primitive,producers,consumers,capacity,items,mitems_per_s,ns_per_item,check
+ */
+
+#include "RingQueue.hpp"
+#include "BoundedQueue.hpp"
+#include "ObjectPool.hpp"
+#include "ThreadPlacement.hpp"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define BENCH_ITEMS 2000000     // items per producer
+#define BENCH_CAPACITY 64       // slots of each ring, a little over a deep write queue
+#define POOL_OBJECTS 16
+#define POP_TIMEOUT_MS 10       // BoundedQueue pops, long enough to sleep on the condition now and then
+
+/* Producer in the top bits, its sequence number in the rest */
+#define ITEM(producer, sequence) ((uint64_t) (producer) << 40 | (sequence))
+#define ITEM_PRODUCER(item) ((uint32_t) ((item) >> 40))
+#define ITEM_SEQUENCE(item) ((item) & ((1ULL << 40) - 1))
+
+static uint32_t g_cpus;
+
+/* Spread the case's threads over the cores, the placement is best effort */
+static void place(uint32_t thread) {
+    std::string description;
+    placeThread(thread % g_cpus, SCHED_OTHER, 0, description);
+}
+
+/* What each consumer saw, checked once every thread has joined */
+struct Received {
+    uint64_t count;
+    uint64_t sum;
+    bool ordered;
+    char pad[CACHE_LINE_SIZE];
+};
+
+static void report(const char *primitive, uint32_t producers, uint32_t consumers, size_t capacity, uint64_t items,
+                   double seconds, bool passed) {
+    printf("%s,%u,%u,%zu,%lu,%.2f,%.1f,%s\n", primitive, producers, consumers, capacity, items,
+           items / seconds / 1e6, seconds * 1e9 / items, passed ? "pass" : "FAIL");
+    fflush(stdout);
+}
+
+/* Every item arrived once and in order per producer and consumer */
+static bool check(const std::vector<Received>& received, uint32_t producers, uint64_t items) {
+    uint64_t count = 0, sum = 0, expected = 0;
+    bool ordered = true;
+    for (uint32_t i = 0; i < received.size(); i++) {
+        count += received[i].count;
+        sum += received[i].sum;
+        ordered = ordered && received[i].ordered;
+    }
+    for (uint32_t p = 0; p < producers; p++)
+        for (uint64_t s = 0; s < items; s++)
+            expected += ITEM(p, s);
+    return ordered && count == producers * items && sum == expected;
+}
+
+/* Run producers pushing items each through push(item) and consumers taking them with pop(item) until done */
+template <typename Push, typename Pop>
+static bool runCase(const char *primitive, uint32_t producers, uint32_t consumers, size_t capacity, uint64_t items,
+                    Push push, Pop pop) {
+    std::vector<Received> received(consumers);
+    std::atomic<uint64_t> remaining(producers * items);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (uint32_t p = 0; p < producers; p++) {
+        threads.push_back(std::thread([&, p] {
+            place(p);
+            while (!go.load(std::memory_order_acquire))
+                sched_yield();
+            for (uint64_t s = 0; s < items; s++)
+                while (!push(ITEM(p, s)))
+                    sched_yield();
+        }));
+    }
+    for (uint32_t c = 0; c < consumers; c++) {
+        threads.push_back(std::thread([&, c] {
+            place(producers + c);
+            Received& mine = received[c];
+            mine.count = 0;
+            mine.sum = 0;
+            mine.ordered = true;
+            std::vector<int64_t> last(producers, -1);
+            while (!go.load(std::memory_order_acquire))
+                sched_yield();
+            while (remaining.load(std::memory_order_relaxed) > 0) {
+                uint64_t item;
+                if (!pop(item)) {
+                    sched_yield();
+                    continue;
+                }
+                remaining.fetch_sub(1, std::memory_order_relaxed);
+                uint32_t producer = ITEM_PRODUCER(item);
+                int64_t sequence = ITEM_SEQUENCE(item);
+                if (producer >= producers || sequence <= last[producer])
+                    mine.ordered = false;
+                else
+                    last[producer] = sequence;
+                mine.count++;
+                mine.sum += item;
+            }
+        }));
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (uint32_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    bool passed = check(received, producers, items);
+    report(primitive, producers, consumers, capacity, producers * items, seconds, passed);
+    return passed;
+}
+
+/* Threads checking objects out and back in, each marks the object taken and must find it free */
+static bool runPool(uint32_t threads, uint64_t items) {
+    ObjectPool<std::atomic<uint32_t> > pool(POOL_OBJECTS);
+    for (uint32_t i = 0; i < POOL_OBJECTS; i++)
+        pool[i].store(0);
+    std::atomic<bool> go(false), passed(true);
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; t++) {
+        workers.push_back(std::thread([&, t] {
+            place(t);
+            while (!go.load(std::memory_order_acquire))
+                sched_yield();
+            for (uint64_t i = 0; i < items; i++) {
+                uint32_t index;
+                while (!pool.acquire(index))
+                    sched_yield();
+                if (pool[index].exchange(1, std::memory_order_relaxed) != 0)
+                    passed = false;
+                pool[index].store(0, std::memory_order_relaxed);
+                pool.release(index);
+            }
+        }));
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (uint32_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    bool ok = passed && pool.getAvailable() == POOL_OBJECTS;
+    report("object_pool", threads, threads, POOL_OBJECTS, threads * items, seconds, ok);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage:\n./QueueBench [items per producer]\n");
+        return 1;
+    }
+    uint64_t items = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_ITEMS;
+    if (items < 1) {
+        fprintf(stderr, "Invalid items, expected >= 1\n");
+        return 1;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    g_cpus = cpus > 0 ? cpus : 1;
+
+    printf("primitive,producers,consumers,capacity,items,mitems_per_s,ns_per_item,check\n");
+    bool passed = true;
+
+    SpscRing<uint64_t> spsc(BENCH_CAPACITY);
+    passed = runCase("spsc_ring", 1, 1, BENCH_CAPACITY, items,
+                     [&](uint64_t item) { return spsc.tryPush(item); },
+                     [&](uint64_t& item) { return spsc.tryPop(item); }) && passed;
+
+    MpmcRing<uint64_t> mpsc(BENCH_CAPACITY);
+    passed = runCase("mpmc_ring", 4, 1, BENCH_CAPACITY, items,
+                     [&](uint64_t item) { return mpsc.tryPush(item); },
+                     [&](uint64_t& item) { return mpsc.tryPop(item); }) && passed;
+
+    MpmcRing<uint64_t> mpmc(BENCH_CAPACITY);
+    passed = runCase("mpmc_ring", 3, 3, BENCH_CAPACITY, items,
+                     [&](uint64_t item) { return mpmc.tryPush(item); },
+                     [&](uint64_t& item) { return mpmc.tryPop(item); }) && passed;
+
+    /* The peek of the oldest-first encode policy must never see an item no consumer can still take */
+    MpmcRing<uint64_t> peeked(BENCH_CAPACITY);
+    std::atomic<bool> torn(false);
+    passed = runCase("mpmc_ring_peek", 2, 2, BENCH_CAPACITY, items,
+                     [&](uint64_t item) { return peeked.tryPush(item); },
+                     [&](uint64_t& item) {
+                         uint64_t head;
+                         if (peeked.peek(head) && (ITEM_PRODUCER(head) >= 2 || ITEM_SEQUENCE(head) >= items))
+                             torn = true;
+                         return peeked.tryPop(item);
+                     }) && !torn && passed;
+
+    BoundedQueue<uint64_t> bounded(BENCH_CAPACITY);
+    passed = runCase("bounded_queue", 4, 2, BENCH_CAPACITY, items,
+                     [&](uint64_t item) { return bounded.push(item); },
+                     [&](uint64_t& item) { return bounded.pop(item, POP_TIMEOUT_MS); }) && passed;
+
+    passed = runPool(4, items) && passed;
+
+    if (!passed)
+        fprintf(stderr, "A check failed, see the FAIL lines\n");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+/*
+ * StreamCtl.cpp
+ *
+ * Thin client for the --control socket of a running StreamCapture, typically
+ * one started with --daemon that keeps the cameras warm between recordings.
+ * Sends the command given on the command line and prints the reply, exiting
+ * with 0 for "ok" and 1 for "error" or a socket failure:
+ *
+ *   ./StreamCtl /tmp/capture.sock record
+ *   ./StreamCtl /tmp/capture.sock save-every all 4
+ */
+
+#include "ControlServer.hpp"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#define REPLY_TIMEOUT_S 5 // a command is applied between two frames, a stretched sensor's take longest
+
+int main(int argc, char *argv[]) {
+
+    if (argc < 3) {
+        fprintf(stderr, "Usage:\n./StreamCtl <socket> <command> [arguments]\n");
+        return 1;
+    }
+
+    /* One line with the command and its arguments */
+    std::string command(argv[2]);
+    for (int i = 3; i < argc; i++)
+        command += std::string(" ") + argv[i];
+    if (command.size() >= CONTROL_LINE_MAX) {
+        fprintf(stderr, "Command longer than %d characters\n", CONTROL_LINE_MAX - 1);
+        return 1;
+    }
+    command += "\n";
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, argv[1], sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0) {
+        fprintf(stderr, "Failed to connect to %s, is StreamCapture running with --control?\n", argv[1]);
+        if (fd != -1)
+            close(fd);
+        return 1;
+    }
+    struct timeval timeout = {REPLY_TIMEOUT_S, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (send(fd, command.data(), command.size(), MSG_NOSIGNAL) != (ssize_t) command.size()) {
+        fprintf(stderr, "Failed to send the command\n");
+        close(fd);
+        return 1;
+    }
+
+    /* The server answers with one line and closes the connection */
+    std::string reply;
+    char buffer[CONTROL_LINE_MAX];
+    ssize_t length;
+    while ((length = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+        reply.append(buffer, length);
+    close(fd);
+    if (reply.empty()) {
+        fprintf(stderr, "No reply from %s\n", argv[1]);
+        return 1;
+    }
+    fputs(reply.c_str(), stdout);
+    return reply.compare(0, 2, "ok") == 0 ? 0 : 1;
+}
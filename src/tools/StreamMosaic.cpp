@@ -0,0 +1,507 @@
+/*
+ * StreamMosaic.cpp
+ *
+ * Builds a contact sheet of every frame set of a finished run for QA: the
+ * images sets.csv groups into one set are tiled in the StreamPreview grid
+ * (PreviewLayout) and saved as one JPEG per set.
+ *
+ *   ./StreamMosaic [--grid 3x2] [--cell 512x388] [--every 1] [--quality 85] <run directory> [output directory]
+ *
+ * Writes setNNNNNN.jpg to the output directory, <run>/mosaics by default.
+ * Images are found in the camN directories of the run and of its segNNN
+ * segments, in their own files or in containers. MOSAIC_SLOTS sets are in
+ * flight at once across three stages, each on its own thread: a reader
+ * loads a set's JPEG images, a decoder decodes each with the hardware
+ * decoder and scales it into its cell's buffer on the VIC, and the main
+ * thread composites the cells with NvBufferComposite, encodes the sheet with
+ * NvJPEGEncoder and writes it. A camera missing from a set leaves its cell
+ * black. Sets per second are reported at the end.
+ */
+
+#include "Thread.h"
+#include "BoundedQueue.hpp"
+#include "ContainerReader.hpp"
+#include "RunLayout.hpp"
+#include "PreviewLayout.hpp"
+#include "SteadyClock.hpp"
+#include "NvJpegDecoder.h"
+#include "NvJpegEncoder.h"
+#include "nvbuf_utils.h"
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#define MOSAIC_SLOTS 4U             // sets in flight across the stages
+#define POP_TIMEOUT_MS 100
+#define END_OF_SETS UINT32_MAX      // slot of the marker following the last set
+#define DEFAULT_CELL_WIDTH 512U     // 2048 / 4, as StreamPreview
+#define DEFAULT_CELL_HEIGHT 388U    // 1554 / 4
+#define DEFAULT_COLUMNS 3U
+#define DEFAULT_ROWS 2U
+#define DEFAULT_QUALITY 85
+#define MKDIR_MODE 0777
+
+/* Parse "AxB" into two numbers */
+static bool parsePair(const char *text, uint32_t& first, uint32_t& second) {
+    return sscanf(text, "%ux%u", &first, &second) == 2 && first > 0 && second > 0;
+}
+
+/* Where one saved image lives, size 0 for the whole of its own file */
+struct Location {
+    std::string path;
+    uint64_t offset;
+    uint32_t size;
+};
+
+typedef std::map<uint64_t, Location> ImageMap;
+
+/* Locate every image of one camN directory and its --fanout sub-directories by image index */
+static void addCameraDirectory(const std::string& directory, ImageMap& images) {
+    std::vector<std::string> directories = findCameraDirectories(directory);
+    for (uint32_t i = 0; i < directories.size(); i++) {
+        std::vector<std::string> names = listDirectory(directories[i]);
+        for (uint32_t j = 0; j < names.size(); j++) {
+            const char *name = names[j].c_str();
+            std::string path = directories[i] + "/" + names[j];
+            if (matchName(name, "image", ".jpg")) {
+                Location location = {path, 0, 0};
+                images[strtoull(name + 5, NULL, 10)] = location;
+            } else if (matchName(name, "frames", ".mjpg")) {
+                ContainerReader reader;
+                if (!reader.open(path)) {
+                    fprintf(stderr, "Skipping unreadable container %s\n", path.c_str());
+                    continue;
+                }
+                const ContainerIndexEntry *entries = reader.getEntries();
+                for (size_t k = 0; k < reader.getCount(); k++) {
+                    Location location = {path, entries[k].offset, entries[k].size};
+                    images[entries[k].index] = location;
+                }
+            }
+        }
+    }
+}
+
+/* One line of sets.csv, -1 for a camera the set is missing */
+struct FrameSet {
+    uint64_t set;
+    uint64_t timestamp;
+    std::vector<int64_t> indexes;
+};
+
+/* Read sets.csv of the run, return bool indicating it could be read */
+static bool readSets(const std::string& path, uint32_t every, std::vector<FrameSet>& sets, uint32_t& cameras) {
+    FILE *file = fopen(path.c_str(), "r");
+    if (!file)
+        return false;
+    char line[1024];
+    cameras = 0;
+    if (fgets(line, sizeof(line), file))
+        for (const char *c = strstr(line, ",cam"); c; c = strstr(c + 1, ",cam"))
+            cameras++;
+    while (fgets(line, sizeof(line), file)) {
+        FrameSet frameSet;
+        char *next = line;
+        frameSet.set = strtoull(next, &next, 10);
+        if (*next != ',')
+            continue;
+        frameSet.timestamp = strtoull(next + 1, &next, 10);
+        for (uint32_t i = 0; i < cameras && *next == ','; i++) {
+            char *field = next + 1;
+            int64_t index = strtoll(field, &next, 10);
+            frameSet.indexes.push_back(next == field ? -1 : index);
+        }
+        frameSet.indexes.resize(cameras, -1);
+        if (frameSet.set % every == 0)
+            sets.push_back(frameSet);
+    }
+    fclose(file);
+    return true;
+}
+
+/* One set going through the stages, reused once its sheet is written */
+struct MosaicJob {
+    const FrameSet *frameSet;
+    std::vector<std::vector<unsigned char> > images;    // per camera, empty if the camera is missing
+    std::vector<int> cells;                             // per camera, the decoded image at cell size
+    std::vector<bool> decoded;
+};
+
+/* Loads each set's images ahead of the decoder */
+class SetReader : public ArgusSamples::Thread {
+
+    public:
+        SetReader(const std::vector<FrameSet>& sets, const std::vector<ImageMap>& cameras, std::vector<MosaicJob>& jobs,
+                  BoundedQueue<uint32_t>& free, BoundedQueue<uint32_t>& read) :
+            _sets(sets),
+            _cameras(cameras),
+            _jobs(jobs),
+            _free(free),
+            _read(read),
+            _next(0),
+            _missing(0),
+            _bytesRead(0)
+        {}
+
+        uint64_t getMissing() const {
+            return _missing;
+        }
+
+        uint64_t getBytesRead() const {
+            return _bytesRead;
+        }
+
+    protected:
+        virtual bool threadInitialize() {
+            return true;
+        }
+
+        virtual bool threadExecute() {
+            if (_next > _sets.size()) {
+                usleep(POP_TIMEOUT_MS * 1000); // every set is read, wait for the shutdown
+                return true;
+            }
+            if (_next == _sets.size()) {
+                _read.push(END_OF_SETS);
+                _next++;
+                return true;
+            }
+            uint32_t slot;
+            if (!_free.pop(slot, POP_TIMEOUT_MS))
+                return true;
+            MosaicJob& job = _jobs[slot];
+            job.frameSet = &_sets[_next++];
+            for (uint32_t i = 0; i < job.images.size(); i++)
+                if (!readImage(i, job.frameSet->indexes[i], job.images[i]))
+                    job.images[i].clear();
+            _read.push(slot);
+            return true;
+        }
+
+        virtual bool threadShutdown() {
+            return true;
+        }
+
+    private:
+        /* Read the camera's image index into data, return false if it is missing or unreadable */
+        bool readImage(uint32_t camera, int64_t index, std::vector<unsigned char>& data) {
+            if (index < 0)
+                return false;
+            ImageMap::const_iterator found = _cameras[camera].find(index);
+            if (found == _cameras[camera].end()) {
+                _missing++;
+                return false;
+            }
+            const Location& location = found->second;
+            int fd = open(location.path.c_str(), O_RDONLY | O_CLOEXEC);
+            uint64_t size = location.size;
+            struct stat info;
+            if (fd != -1 && size == 0 && fstat(fd, &info) == 0)
+                size = info.st_size;
+            data.resize(size);
+            bool success = fd != -1 && size > 0 && pread(fd, data.data(), size, location.offset) == (ssize_t) size;
+            if (fd != -1)
+                close(fd);
+            if (!success) {
+                _missing++;
+                return false;
+            }
+            _bytesRead += size;
+            return true;
+        }
+
+        const std::vector<FrameSet>& _sets;
+        const std::vector<ImageMap>& _cameras;
+        std::vector<MosaicJob>& _jobs;
+        BoundedQueue<uint32_t>& _free;
+        BoundedQueue<uint32_t>& _read;
+        size_t _next;
+        std::atomic<uint64_t> _missing;
+        std::atomic<uint64_t> _bytesRead;
+};
+
+/* Decodes each image of a set and scales it into its cell buffer, the decoder reuses its own
+   output buffer for the next image */
+class SetDecoder : public ArgusSamples::Thread {
+
+    public:
+        SetDecoder(std::vector<MosaicJob>& jobs, BoundedQueue<uint32_t>& read, BoundedQueue<uint32_t>& decoded) :
+            _jobs(jobs),
+            _read(read),
+            _decodedQueue(decoded),
+            _decoder(NULL),
+            _decoded(0),
+            _failed(0),
+            _decodeNs(0)
+        {}
+
+        virtual ~SetDecoder() {
+            if (_decoder)
+                delete _decoder;
+        }
+
+        uint64_t getDecoded() const {
+            return _decoded;
+        }
+
+        uint64_t getFailed() const {
+            return _failed;
+        }
+
+        uint64_t getDecodeNs() const {
+            return _decodeNs;
+        }
+
+    protected:
+        virtual bool threadInitialize() {
+            _decoder = NvJPEGDecoder::createJPEGDecoder("mosaicdec");
+            return _decoder != NULL;
+        }
+
+        virtual bool threadExecute() {
+            uint32_t slot;
+            if (!_read.pop(slot, POP_TIMEOUT_MS))
+                return true;
+            if (slot == END_OF_SETS) {
+                _decodedQueue.push(slot);
+                return true;
+            }
+            MosaicJob& job = _jobs[slot];
+            uint64_t start = now();
+            for (uint32_t i = 0; i < job.images.size(); i++) {
+                job.decoded[i] = !job.images[i].empty() && decode(job.images[i], job.cells[i]);
+                if (job.decoded[i])
+                    _decoded++;
+                else if (!job.images[i].empty())
+                    _failed++;
+            }
+            _decodeNs += now() - start;
+            _decodedQueue.push(slot);
+            return true;
+        }
+
+        virtual bool threadShutdown() {
+            return true;
+        }
+
+    private:
+        bool decode(std::vector<unsigned char>& image, int cell) {
+            int fd;
+            uint32_t format, width, height;
+            if (_decoder->decodeToFd(fd, image.data(), image.size(), format, width, height) != 0)
+                return false;
+            NvBufferTransformParams params;
+            memset(&params, 0, sizeof(params));
+            params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+            params.transform_filter = NvBufferTransform_Filter_Smart;
+            return NvBufferTransform(fd, cell, &params) == 0;
+        }
+
+        std::vector<MosaicJob>& _jobs;
+        BoundedQueue<uint32_t>& _read;
+        BoundedQueue<uint32_t>& _decodedQueue;
+        NvJPEGDecoder *_decoder;
+        std::atomic<uint64_t> _decoded;
+        std::atomic<uint64_t> _failed;
+        std::atomic<uint64_t> _decodeNs;
+};
+
+/* Create a YUV420 buffer for the VIC, -1 on failure */
+static int createBuffer(uint32_t width, uint32_t height) {
+    NvBufferCreateParams params;
+    memset(&params, 0, sizeof(params));
+    params.width = width;
+    params.height = height;
+    params.payloadType = NvBufferPayload_SurfArray;
+    params.layout = NvBufferLayout_Pitch;
+    params.colorFormat = NvBufferColorFormat_YUV420;
+    params.nvbuf_tag = NvBufferTag_JPEG;
+    int fd;
+    return NvBufferCreateEx(&fd, &params) == 0 ? fd : -1;
+}
+
+static void printUsage() {
+    fprintf(stderr, "Usage:\n./StreamMosaic [--grid <CxR>] [--cell <WxH>] [--every <n>] [--quality <1-100>] <run directory> "
+            "[output directory]\n"
+            "Tiles each frame set of sets.csv into setNNNNNN.jpg in the output directory, <run>/mosaics by default.\n"
+            "  --grid\tColumns and rows, filled column by column. [Default: %ux%u]\n"
+            "  --cell\tSize each image is scaled to. [Default: %ux%u]\n"
+            "  --every\tOnly sets whose number is a multiple of n. [Default: 1]\n"
+            "  --quality\tJPEG quality of the sheets. [Default: %d]\n",
+            DEFAULT_COLUMNS, DEFAULT_ROWS, DEFAULT_CELL_WIDTH, DEFAULT_CELL_HEIGHT, DEFAULT_QUALITY);
+}
+
+int main(int argc, char *argv[]) {
+
+    PreviewLayout layout = {DEFAULT_CELL_WIDTH, DEFAULT_CELL_HEIGHT, DEFAULT_COLUMNS, DEFAULT_ROWS};
+    uint32_t every = 1;
+    int quality = DEFAULT_QUALITY;
+    static struct option options[] = {
+        {"grid", required_argument, NULL, 'g'},
+        {"cell", required_argument, NULL, 'c'},
+        {"every", required_argument, NULL, 'e'},
+        {"quality", required_argument, NULL, 'q'},
+        {NULL, 0, NULL, 0}
+    };
+    int option;
+    bool valid = true;
+    while ((option = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        if (option == 'g')
+            valid = parsePair(optarg, layout.columns, layout.rows) && valid;
+        else if (option == 'c')
+            valid = parsePair(optarg, layout.cellWidth, layout.cellHeight) && valid;
+        else if (option == 'e')
+            valid = (every = atoi(optarg)) > 0 && valid;
+        else if (option == 'q')
+            valid = (quality = atoi(optarg)) >= 1 && quality <= 100 && valid;
+        else
+            valid = false;
+    }
+    if (!valid || optind >= argc || argc - optind > 2) {
+        printUsage();
+        return 1;
+    }
+
+    /* Group the images by sets.csv */
+    std::string run = argv[optind];
+    std::string output = argc - optind == 2 ? argv[optind + 1] : run + "/mosaics";
+    std::vector<FrameSet> sets;
+    uint32_t numCameras;
+    if (!readSets(run + "/sets.csv", every, sets, numCameras) || numCameras == 0) {
+        fprintf(stderr, "Failed to read %s/sets.csv, record with --sets\n", run.c_str());
+        return 1;
+    }
+    if (numCameras > layout.columns * layout.rows || numCameras > MAX_COMPOSITE_FRAME) {
+        fprintf(stderr, "%u cameras do not fit a %ux%u grid\n", numCameras, layout.columns, layout.rows);
+        return 1;
+    }
+
+    /* Locate every image of every camera, in the run and in its segments */
+    std::vector<ImageMap> cameras(numCameras);
+    std::vector<std::string> directories = findSegments(std::vector<std::string>(1, run));
+    for (uint32_t i = 0; i < directories.size(); i++)
+        for (uint32_t j = 0; j < numCameras; j++)
+            addCameraDirectory(directories[i] + "/cam" + std::to_string(j), cameras[j]);
+    if (mkdir(output.c_str(), MKDIR_MODE) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed to create %s\n", output.c_str());
+        return 1;
+    }
+
+    /* Every slot has its cell buffers for the whole run, the sheet is composited into one buffer */
+    Argus::Size2D<uint32_t> size = layout.getCompositeSize();
+    std::vector<MosaicJob> jobs(MOSAIC_SLOTS);
+    BoundedQueue<uint32_t> freeSlots(MOSAIC_SLOTS), read(MOSAIC_SLOTS + 1), decoded(MOSAIC_SLOTS + 1);
+    bool success = true;
+    for (uint32_t i = 0; i < MOSAIC_SLOTS; i++) {
+        jobs[i].images.resize(numCameras);
+        jobs[i].decoded.resize(numCameras, false);
+        for (uint32_t j = 0; j < numCameras; j++) {
+            jobs[i].cells.push_back(createBuffer(layout.cellWidth, layout.cellHeight));
+            success = success && jobs[i].cells.back() != -1;
+        }
+        freeSlots.push(i);
+    }
+    int sheet = createBuffer(size.width(), size.height());
+    NvJPEGEncoder *encoder = NvJPEGEncoder::createJPEGEncoder("mosaicenc");
+    unsigned long capacity = size.area() * 3 / 2;
+    unsigned char *buffer = (unsigned char *) malloc(capacity);
+    if (!success || sheet == -1 || !encoder || !buffer) {
+        fprintf(stderr, "Failed to create the mosaic buffers and encoder\n");
+        return 1;
+    }
+
+    SetReader reader(sets, cameras, jobs, freeSlots, read);
+    SetDecoder decoder(jobs, read, decoded);
+    if (!reader.initialize() || !decoder.initialize() || !reader.waitRunning() || !decoder.waitRunning()) {
+        fprintf(stderr, "Failed to start the mosaic pipeline\n");
+        return 1;
+    }
+    printf("%zu sets of %u cameras into %ux%u sheets in %s\n", sets.size(), numCameras, size.width(), size.height(),
+           output.c_str());
+
+    /* Composite, encode and write each set as it comes out of the decoder */
+    uint64_t start = now(), compositeNs = 0, encodeNs = 0, written = 0;
+    NvBufferCompositeParams base;
+    layout.setupComposite(base, numCameras, layout.cellWidth, layout.cellHeight);
+    uint32_t slot;
+    while (success) {
+        if (!decoded.pop(slot, POP_TIMEOUT_MS))
+            continue;
+        if (slot == END_OF_SETS)
+            break;
+        MosaicJob& job = jobs[slot];
+
+        /* Only the cameras decoded are composited, the background of the others stays black */
+        NvBufferCompositeParams params = base;
+        int fds[MAX_COMPOSITE_FRAME];
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < numCameras; i++) {
+            if (!job.decoded[i])
+                continue;
+            fds[count] = job.cells[i];
+            params.src_comp_rect[count] = base.src_comp_rect[i];
+            params.dst_comp_rect[count] = base.dst_comp_rect[i];
+            count++;
+        }
+        params.input_buf_count = count;
+        uint64_t stepStart = now();
+        bool composited = count > 0 && NvBufferComposite(fds, sheet, &params) == 0;
+        compositeNs += now() - stepStart;
+        uint64_t number = job.frameSet->set;
+        freeSlots.push(slot);
+        if (!composited) {
+            fprintf(stderr, "Set %lu: nothing to composite\n", number);
+            continue;
+        }
+
+        /* libjpeg replaces a buffer it outgrows with its own, keep whichever it left us */
+        stepStart = now();
+        unsigned char *data = buffer;
+        unsigned long length = capacity;
+        if (encoder->encodeFromFd(sheet, JCS_YCbCr, &data, length, quality) != 0) {
+            fprintf(stderr, "Set %lu: failed to encode the sheet\n", number);
+            continue;
+        }
+        if (data != buffer) {
+            ::free(buffer);
+            buffer = data;
+            capacity = length;
+        }
+        encodeNs += now() - stepStart;
+        char filename[FILENAME_MAX];
+        snprintf(filename, sizeof(filename), "%s/set%06lu.jpg", output.c_str(), number);
+        FILE *file = fopen(filename, "wb");
+        success = file && fwrite(data, 1, length, file) == length;
+        success = file && fclose(file) == 0 && success;
+        if (!success)
+            fprintf(stderr, "Failed to write %s\n", filename);
+        written++;
+    }
+    reader.shutdown();
+    decoder.shutdown();
+
+    double seconds = (now() - start) / 1e9;
+    printf("%lu sheets in %.1f s, %.1f sets/s, %.1f MiB read, %lu images decoded (%.2f ms each), %lu undecodable, "
+           "%lu missing or unreadable, composite %.2f ms and encode %.2f ms per sheet\n", written, seconds,
+           written / seconds, reader.getBytesRead() / 1048576.0, decoder.getDecoded(),
+           decoder.getDecoded() ? decoder.getDecodeNs() / 1e6 / decoder.getDecoded() : 0.0, decoder.getFailed(),
+           reader.getMissing(), written ? compositeNs / 1e6 / written : 0.0, written ? encodeNs / 1e6 / written : 0.0);
+
+    delete encoder;
+    ::free(buffer);
+    NvBufferDestroy(sheet);
+    for (uint32_t i = 0; i < MOSAIC_SLOTS; i++)
+        for (uint32_t j = 0; j < numCameras; j++)
+            NvBufferDestroy(jobs[i].cells[j]);
+    return success ? 0 : 1;
+}
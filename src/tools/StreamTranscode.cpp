@@ -0,0 +1,624 @@
+/*
+ * StreamTranscode.cpp
+ *
+ * Turns the JPEG images of a finished run into one H.265 (or H.264) elementary
+ * stream per camera on an otherwise idle TX2, so archived runs take a fraction
+ * of their space. Takes a run directory, camN directories directly in it or in
+ * its segNNN segments, or a single container segment:
+ *
+ *   ./StreamTranscode <run directory> [output directory]
+ *   ./StreamTranscode <cam0/frames000.mjpg> [output directory]
+ *
+ * Writes camN.h265 per camera, or <container>.h265, to the output directory,
+ * the input directory by default. Each camera runs as a pipeline of three
+ * threads: a reader takes the images from their files or containers in index
+ * order, the main thread decodes each with NvJPEGDecoder::decodeToFd and
+ * blits the decoded dmabuf on the VIC into a buffer the encoder's output plane
+ * imports, and the encoder's capture plane thread writes the access units. No
+ * pixel is touched by the CPU. Frames per second per camera and overall are
+ * reported at the end of each camera and of the run.
+ */
+
+#include "Thread.h"
+#include "BoundedQueue.hpp"
+#include "ContainerReader.hpp"
+#include "RunLayout.hpp"
+#include "SteadyClock.hpp"
+#include "NvJpegDecoder.h"
+#include <NvVideoEncoder.h>
+#include "nvbuf_utils.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#define READ_SLOTS 8U               // images read ahead of the decoder
+#define ENCODE_SLOTS 6U             // decoded frames the encoder may hold
+#define NUM_CAPTURE_BUFFERS 6
+#define POP_TIMEOUT_MS 100
+#define DQ_RETRIES 1000             // ms to wait for the encoder to return an output buffer
+#define EOS_TIMEOUT_MS 5000         // ms to wait for the capture plane to drain at the end
+#define DEFAULT_BITRATE 16U         // Mbit/s
+#define DEFAULT_FPS 30U
+#define DEFAULT_IDR_INTERVAL 30U
+#define FILE_MODE 0666
+
+/* A container segment or a single image file, in the order they are encoded */
+struct Source {
+    std::string path;
+    bool container;
+    uint64_t index;     // image index of a single file, for sorting
+};
+
+static bool isEarlier(const Source& a, const Source& b) {
+    return a.index < b.index;
+}
+
+/* Add the images of one camN directory and its --fanout sub-directories, container segments if
+   there are any */
+static void addCameraDirectory(const std::string& directory, std::vector<Source>& sources) {
+    std::vector<std::string> directories = findCameraDirectories(directory);
+    std::vector<Source> images;
+    for (uint32_t i = 0; i < directories.size(); i++) {
+        std::vector<std::string> names = listDirectory(directories[i]);
+        for (uint32_t j = 0; j < names.size(); j++) {
+            const char *name = names[j].c_str();
+            std::string path = directories[i] + "/" + names[j];
+            if (matchName(name, "frames", ".mjpg")) {
+                Source source = {path, true, 0};
+                sources.push_back(source);
+            } else if (matchName(name, "image", ".jpg")) {
+                Source source = {path, false, strtoull(name + 5, NULL, 10)};
+                images.push_back(source);
+            }
+        }
+    }
+
+    /* Indexes may outgrow the six digits of the name, so sort by number rather than by name */
+    std::sort(images.begin(), images.end(), isEarlier);
+    sources.insert(sources.end(), images.begin(), images.end());
+}
+
+/* Every camera's sources in the run directory and its segments, by camera */
+static std::vector<std::vector<Source> > findCameras(const std::string& directory) {
+    std::vector<std::vector<Source> > cameras;
+    std::vector<std::string> directories = findSegments(std::vector<std::string>(1, directory));
+    for (uint32_t i = 0; i < directories.size(); i++) {
+        std::vector<std::string> entries = listDirectory(directories[i]);
+        for (uint32_t j = 0; j < entries.size(); j++) {
+            if (!matchName(entries[j].c_str(), "cam", ""))
+                continue;
+            uint32_t camera = atoi(entries[j].c_str() + 3);
+            if (camera >= cameras.size())
+                cameras.resize(camera + 1);
+            addCameraDirectory(directories[i] + "/" + entries[j], cameras[camera]);
+        }
+    }
+    return cameras;
+}
+
+/* One image read ahead, size 0 marks the end of the camera */
+struct Compressed {
+    uint32_t slot;
+    uint32_t size;
+    uint64_t index;
+    uint64_t timestamp;
+};
+
+/* Reads one camera's images into READ_SLOTS buffers ahead of the decoder */
+class ImageReader : public ArgusSamples::Thread {
+
+    public:
+        explicit ImageReader(const std::vector<Source>& sources) :
+            _sources(sources),
+            _buffers(READ_SLOTS),
+            _free(READ_SLOTS),
+            _filled(READ_SLOTS + 1),
+            _source(0),
+            _position(0),
+            _done(false),
+            _bytesRead(0),
+            _failed(0)
+        {
+            for (uint32_t i = 0; i < READ_SLOTS; i++)
+                _free.push(i);
+        }
+
+        /* The next image in order, false while it has not been read yet */
+        bool next(Compressed& image) {
+            return _filled.pop(image, POP_TIMEOUT_MS);
+        }
+
+        const unsigned char *getData(uint32_t slot) const {
+            return _buffers[slot].data();
+        }
+
+        /* The decoder is done with the slot's image */
+        void release(uint32_t slot) {
+            _free.push(slot);
+        }
+
+        uint64_t getBytesRead() const {
+            return _bytesRead;
+        }
+
+        uint64_t getFailed() const {
+            return _failed;
+        }
+
+    protected:
+        virtual bool threadInitialize() {
+            return true;
+        }
+
+        virtual bool threadExecute() {
+            uint32_t slot;
+            if (_done) {
+                usleep(POP_TIMEOUT_MS * 1000); // every image is read, wait for the shutdown
+                return true;
+            }
+            if (!_free.pop(slot, POP_TIMEOUT_MS))
+                return true;
+            Compressed image = {slot, 0, 0, 0};
+            while (!_done && !readNext(image)) {}
+            if (_done && image.size == 0)
+                _free.push(slot);
+            _filled.push(image);
+            return true;
+        }
+
+        virtual bool threadShutdown() {
+            _container.close();
+            return true;
+        }
+
+    private:
+        /* Read the next image into its slot, return false if it was unreadable and skipped. Sets
+           _done and leaves size 0 after the last one */
+        bool readNext(Compressed& image) {
+            if (_source >= _sources.size()) {
+                _done = true;
+                return true;
+            }
+            const Source& source = _sources[_source];
+            std::vector<unsigned char>& buffer = _buffers[image.slot];
+
+            /* A container segment's images come from its mapping, in index order */
+            if (source.container) {
+                if (_position == 0 && !_container.open(source.path)) {
+                    fprintf(stderr, "Skipping unreadable container %s\n", source.path.c_str());
+                    _failed++;
+                    _source++;
+                    return false;
+                }
+                if (_position >= _container.getCount()) {
+                    _container.close();
+                    _position = 0;
+                    _source++;
+                    return false;
+                }
+                const ContainerIndexEntry& entry = _container.getEntries()[_position];
+                uint32_t size;
+                const unsigned char *data = _container.getImage(_position++, size);
+                if (!data || !_container.checkEntry(entry)) {
+                    _failed++;
+                    return false;
+                }
+                buffer.resize(size);
+                memcpy(buffer.data(), data, size);
+                image.size = size;
+                image.index = entry.index;
+                image.timestamp = entry.timestamp;
+                _bytesRead += size;
+                return true;
+            }
+
+            /* A file of its own, read in one go and dropped from the page cache */
+            _source++;
+            int fd = open(source.path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat info;
+            if (fd == -1 || fstat(fd, &info) != 0 || info.st_size == 0) {
+                if (fd != -1)
+                    close(fd);
+                _failed++;
+                return false;
+            }
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            buffer.resize(info.st_size);
+            bool success = read(fd, buffer.data(), info.st_size) == info.st_size;
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+            if (!success) {
+                _failed++;
+                return false;
+            }
+            image.size = info.st_size;
+            image.index = source.index;
+            image.timestamp = 0;
+            _bytesRead += info.st_size;
+            return true;
+        }
+
+        const std::vector<Source>& _sources;
+        std::vector<std::vector<unsigned char> > _buffers;
+        BoundedQueue<uint32_t> _free;
+        BoundedQueue<Compressed> _filled;   // READ_SLOTS images plus the end marker
+        ContainerReader _container;
+        uint32_t _source;
+        size_t _position;                   // next entry of the open container
+        bool _done;
+        std::atomic<uint64_t> _bytesRead;
+        std::atomic<uint64_t> _failed;
+};
+
+/* Settings from the command line */
+struct Settings {
+    uint32_t bitrate;   // Mbit/s
+    uint32_t fps;
+    bool h264;
+};
+
+/* Encodes one camera's decoded frames from ENCODE_SLOTS dmabufs and writes the stream file */
+class StreamEncoder {
+
+    public:
+        StreamEncoder(const Settings& settings) :
+            _settings(settings),
+            _encoder(NULL),
+            _outputFd(-1),
+            _numQueued(0),
+            _frames(0),
+            _bytesWritten(0),
+            _failed(false)
+        {
+            for (uint32_t i = 0; i < ENCODE_SLOTS; i++)
+                _fds[i] = -1;
+        }
+
+        ~StreamEncoder() {
+            if (_encoder)
+                delete _encoder;
+            for (uint32_t i = 0; i < ENCODE_SLOTS; i++)
+                if (_fds[i] != -1)
+                    NvBufferDestroy(_fds[i]);
+            if (_outputFd != -1)
+                close(_outputFd);
+        }
+
+        /* Create the stream file, the frame buffers and the encoder for frames of width x height */
+        bool open(const std::string& path, uint32_t width, uint32_t height) {
+            _outputFd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, FILE_MODE);
+            if (_outputFd == -1)
+                return false;
+
+            NvBufferCreateParams params;
+            memset(&params, 0, sizeof(params));
+            params.width = width;
+            params.height = height;
+            params.payloadType = NvBufferPayload_SurfArray;
+            params.layout = NvBufferLayout_Pitch;
+            params.colorFormat = NvBufferColorFormat_YUV420;
+            params.nvbuf_tag = NvBufferTag_VIDEO_ENC;
+            for (uint32_t i = 0; i < ENCODE_SLOTS; i++)
+                if (NvBufferCreateEx(&_fds[i], &params) != 0)
+                    return false;
+
+            _encoder = NvVideoEncoder::createVideoEncoder("transcode");
+            if (!_encoder)
+                return false;
+            if (_encoder->setCapturePlaneFormat(_settings.h264 ? V4L2_PIX_FMT_H264 : V4L2_PIX_FMT_H265, width, height,
+                                                width * height) < 0)
+                return false;
+            if (_encoder->setOutputPlaneFormat(V4L2_PIX_FMT_YUV420M, width, height) < 0)
+                return false;
+            if (_encoder->setBitrate(_settings.bitrate * 1000000U) < 0)
+                return false;
+            if (_settings.h264) {
+                if (_encoder->setProfile(V4L2_MPEG_VIDEO_H264_PROFILE_HIGH) < 0)
+                    return false;
+                if (_encoder->setLevel(V4L2_MPEG_VIDEO_H264_LEVEL_5_1) < 0)
+                    return false;
+            } else if (_encoder->setProfile(V4L2_MPEG_VIDEO_H265_PROFILE_MAIN) < 0) {
+                return false;
+            }
+            if (_encoder->setRateControlMode(V4L2_MPEG_VIDEO_BITRATE_MODE_VBR) < 0)
+                return false;
+            if (_encoder->setIDRInterval(DEFAULT_IDR_INTERVAL) < 0)
+                return false;
+            if (_encoder->setIFrameInterval(DEFAULT_IDR_INTERVAL) < 0)
+                return false;
+            if (_encoder->setFrameRate(_settings.fps, 1) < 0)
+                return false;
+            if (_encoder->setInsertSpsPpsAtIdrEnabled(true) < 0)
+                return false;
+            if (_encoder->setMaxPerfMode(1) < 0)
+                return false;
+
+            /* The output plane imports the frame buffers, one plane buffer per frame buffer */
+            if (_encoder->output_plane.setupPlane(V4L2_MEMORY_DMABUF, ENCODE_SLOTS, false, false) < 0)
+                return false;
+            if (_encoder->capture_plane.setupPlane(V4L2_MEMORY_MMAP, NUM_CAPTURE_BUFFERS, true, false) < 0)
+                return false;
+            if (_encoder->output_plane.setStreamStatus(true) < 0)
+                return false;
+            if (_encoder->capture_plane.setStreamStatus(true) < 0)
+                return false;
+            _encoder->capture_plane.setDQThreadCallback(captureCallback);
+            _encoder->capture_plane.startDQThread(this);
+            for (uint32_t i = 0; i < _encoder->capture_plane.getNumBuffers(); i++) {
+                struct v4l2_buffer v4l2_buf;
+                struct v4l2_plane planes[MAX_PLANES];
+                memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+                memset(planes, 0, sizeof(planes));
+                v4l2_buf.index = i;
+                v4l2_buf.m.planes = planes;
+                if (_encoder->capture_plane.qBuffer(v4l2_buf, NULL) < 0)
+                    return false;
+            }
+            return true;
+        }
+
+        /* Blit the decoded frame into a free frame buffer on the VIC and queue it, return bool
+           indicating success */
+        bool encode(int decoded, uint64_t timestamp) {
+            struct v4l2_buffer v4l2_buf;
+            struct v4l2_plane planes[MAX_PLANES];
+            memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+            memset(planes, 0, sizeof(planes));
+            v4l2_buf.m.planes = planes;
+            if (_numQueued < ENCODE_SLOTS)
+                v4l2_buf.index = _numQueued++;
+            else if (_encoder->output_plane.dqBuffer(v4l2_buf, NULL, NULL, DQ_RETRIES) < 0)
+                return false;
+
+            /* Also converts the decoder's 4:2:2 or 4:4:4 to 4:2:0 and scales an odd sized image */
+            NvBufferTransformParams params;
+            memset(&params, 0, sizeof(params));
+            params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+            params.transform_filter = NvBufferTransform_Filter_Smart;
+            if (NvBufferTransform(decoded, _fds[v4l2_buf.index], &params) != 0)
+                return false;
+
+            planes[0].m.fd = _fds[v4l2_buf.index];
+            planes[0].bytesused = 1; // must be non-zero, zero signals end of stream
+            v4l2_buf.flags |= V4L2_BUF_FLAG_TIMESTAMP_COPY;
+            v4l2_buf.timestamp.tv_sec = timestamp / 1000000000UL;
+            v4l2_buf.timestamp.tv_usec = (timestamp % 1000000000UL) / 1000;
+            return _encoder->output_plane.qBuffer(v4l2_buf, NULL) == 0;
+        }
+
+        /* Queue the end of stream and wait for the last access units to be written */
+        bool finish() {
+            if (!_encoder)
+                return false;
+            struct v4l2_buffer v4l2_buf;
+            struct v4l2_plane planes[MAX_PLANES];
+            memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+            memset(planes, 0, sizeof(planes));
+            v4l2_buf.m.planes = planes;
+            bool success = true;
+            if (_numQueued < ENCODE_SLOTS)
+                v4l2_buf.index = _numQueued++;
+            else
+                success = _encoder->output_plane.dqBuffer(v4l2_buf, NULL, NULL, DQ_RETRIES) == 0;
+            if (success) {
+                planes[0].m.fd = -1;
+                planes[0].bytesused = 0;
+                success = _encoder->output_plane.qBuffer(v4l2_buf, NULL) == 0
+                    && _encoder->capture_plane.waitForDQThread(EOS_TIMEOUT_MS) == 0;
+            }
+            _encoder->capture_plane.stopDQThread();
+            _encoder->output_plane.setStreamStatus(false);
+            _encoder->capture_plane.setStreamStatus(false);
+            return success && !_failed && fsync(_outputFd) == 0;
+        }
+
+        uint64_t getFrames() const {
+            return _frames;
+        }
+
+        uint64_t getBytesWritten() const {
+            return _bytesWritten;
+        }
+
+        bool hasFailed() const {
+            return _failed;
+        }
+
+    private:
+        /* Called from the capture plane DQ thread, returning false stops that thread */
+        static bool captureCallback(struct v4l2_buffer *v4l2_buf, NvBuffer *buffer, NvBuffer *shared_buffer,
+                                    void *data) {
+            StreamEncoder *encoder = static_cast<StreamEncoder*>(data);
+            if (!v4l2_buf) {
+                encoder->_failed = true;
+                return false;
+            }
+
+            /* An empty buffer marks the end of stream */
+            uint32_t size = buffer->planes[0].bytesused;
+            if (size == 0)
+                return false;
+            if (write(encoder->_outputFd, buffer->planes[0].data, size) != (ssize_t) size
+                || encoder->_encoder->capture_plane.qBuffer(*v4l2_buf, NULL) < 0) {
+                encoder->_failed = true;
+                return false;
+            }
+            encoder->_frames++;
+            encoder->_bytesWritten += size;
+            return true;
+        }
+
+        const Settings& _settings;
+        NvVideoEncoder *_encoder;
+        int _fds[ENCODE_SLOTS];
+        int _outputFd;
+        uint32_t _numQueued;
+        std::atomic<uint64_t> _frames;
+        std::atomic<uint64_t> _bytesWritten;
+        std::atomic<bool> _failed;
+};
+
+/* Transcode one camera's sources into path, return bool indicating success and add the frames */
+static bool transcode(const std::vector<Source>& sources, const std::string& path, const Settings& settings,
+                      NvJPEGDecoder *decoder, uint64_t& frames) {
+    ImageReader reader(sources);
+    StreamEncoder encoder(settings);
+    if (!reader.initialize() || !reader.waitRunning()) {
+        fprintf(stderr, "Failed to start the reader for %s\n", path.c_str());
+        return false;
+    }
+
+    uint64_t start = now(), decodeNs = 0, encodeNs = 0, skipped = 0;
+    uint64_t frameDuration = 1000000000ULL / settings.fps;
+    bool open = false, success = true;
+    Compressed image;
+    while (success) {
+        if (!reader.next(image))
+            continue;
+        if (image.size == 0)
+            break;
+
+        /* The decoder's output buffer is reused by the next decode, so it is blitted right away */
+        uint64_t stepStart = now();
+        int decoded;
+        uint32_t format, width, height;
+        int result = decoder->decodeToFd(decoded, (unsigned char *) reader.getData(image.slot), image.size,
+                                         format, width, height);
+        reader.release(image.slot);
+        decodeNs += now() - stepStart;
+        if (result != 0) {
+            skipped++;
+            continue;
+        }
+
+        /* The first image sets the stream's size, later ones of another size are scaled to it */
+        if (!open) {
+            if (!encoder.open(path, width, height)) {
+                fprintf(stderr, "Failed to set up the video encoder for %s\n", path.c_str());
+                success = false;
+                break;
+            }
+            printf("%s: %ux%u\n", path.c_str(), width, height);
+            open = true;
+        }
+        stepStart = now();
+        uint64_t timestamp = image.timestamp ? image.timestamp : image.index * frameDuration;
+        success = encoder.encode(decoded, timestamp) && !encoder.hasFailed();
+        encodeNs += now() - stepStart;
+    }
+    success = (!open || encoder.finish()) && success;
+    reader.shutdown();
+
+    double seconds = (now() - start) / 1e9;
+    uint64_t encoded = encoder.getFrames();
+    uint64_t decodes = encoded + skipped;
+    printf("%s: %lu frames, %.1f frames/s, %.1f MiB read, %.1f MiB written, decode %.2f ms and VIC+queue %.2f ms "
+           "per frame, %lu undecodable, %lu unreadable\n", path.c_str(), encoded, encoded / seconds,
+           reader.getBytesRead() / 1048576.0, encoder.getBytesWritten() / 1048576.0,
+           decodes ? decodeNs / 1e6 / decodes : 0.0, encoded ? encodeNs / 1e6 / encoded : 0.0, skipped,
+           reader.getFailed());
+    frames += encoded;
+    return success;
+}
+
+static void printUsage() {
+    fprintf(stderr, "Usage:\n./StreamTranscode [--bitrate <Mbit/s>] [--fps <fps>] [--h264] <run directory|container.mjpg> "
+            "[output directory]\n"
+            "Writes camN.h265 per camera of the run, or <container>.h265, to the output directory.\n"
+            "  --bitrate\tVBR target in Mbit/s. [Default: %u]\n"
+            "  --fps\t\tFrame rate the stream is played at. [Default: %u]\n"
+            "  --h264\tH.264 instead of H.265.\n", DEFAULT_BITRATE, DEFAULT_FPS);
+}
+
+int main(int argc, char *argv[]) {
+
+    Settings settings = {DEFAULT_BITRATE, DEFAULT_FPS, false};
+    int h264 = 0;
+    static struct option options[] = {
+        {"bitrate", required_argument, NULL, 'b'},
+        {"fps", required_argument, NULL, 'f'},
+        {"h264", no_argument, &h264, 1},
+        {NULL, 0, NULL, 0}
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (option) {
+            case 0:
+                break;
+            case 'b':
+                settings.bitrate = atoi(optarg);
+                break;
+            case 'f':
+                settings.fps = atoi(optarg);
+                break;
+            default:
+                printUsage();
+                return 1;
+        }
+    }
+    settings.h264 = h264;
+    if (optind >= argc || argc - optind > 2 || settings.bitrate < 1 || settings.fps < 1) {
+        printUsage();
+        return 1;
+    }
+
+    /* A single container, or every camera of a run */
+    std::string input = argv[optind];
+    while (input.size() > 1 && input[input.size() - 1] == '/')
+        input.erase(input.size() - 1);
+    struct stat info;
+    if (stat(input.c_str(), &info) != 0) {
+        fprintf(stderr, "Failed to open %s\n", input.c_str());
+        return 1;
+    }
+    bool single = !S_ISDIR(info.st_mode);
+    std::string output = argc - optind == 2 ? argv[optind + 1]
+                                            : single ? input.substr(0, input.find_last_of('/') + 1) : input;
+    if (output.empty())
+        output = ".";
+    const char *extension = settings.h264 ? ".h264" : ".h265";
+
+    std::vector<std::vector<Source> > cameras;
+    std::vector<std::string> paths;
+    if (single) {
+        Source source = {input, true, 0};
+        cameras.push_back(std::vector<Source>(1, source));
+        std::string name = input.substr(input.find_last_of('/') + 1);
+        paths.push_back(output + "/" + name.substr(0, name.find_last_of('.')) + extension);
+    } else {
+        cameras = findCameras(input);
+        for (uint32_t i = 0; i < cameras.size(); i++)
+            paths.push_back(output + "/cam" + std::to_string(i) + extension);
+    }
+
+    NvJPEGDecoder *decoder = NvJPEGDecoder::createJPEGDecoder("transcodedec");
+    if (!decoder) {
+        fprintf(stderr, "Failed to create the JPEG decoder\n");
+        return 1;
+    }
+    uint64_t start = now(), frames = 0;
+    uint32_t failed = 0, streams = 0;
+    for (uint32_t i = 0; i < cameras.size(); i++) {
+        if (cameras[i].empty())
+            continue;
+        streams++;
+        if (!transcode(cameras[i], paths[i], settings, decoder, frames))
+            failed++;
+    }
+    delete decoder;
+
+    double seconds = (now() - start) / 1e9;
+    if (streams == 0)
+        fprintf(stderr, "No images found in %s\n", input.c_str());
+    else
+        printf("%u streams, %lu frames in %.1f s, %.1f frames/s\n", streams, frames, seconds, frames / seconds);
+    return streams > 0 && failed == 0 ? 0 : 1;
+}
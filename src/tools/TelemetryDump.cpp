@@ -0,0 +1,80 @@
+/*
+ * TelemetryDump.cpp
+ *
+ * Decodes a camN/telemetry.bin file written with --telemetry and prints one
+ * CSV line per frame, followed by a per-stage summary on stderr so a stalling
+ * stage stands out without further processing.
+ */
+
+#include "TelemetryLog.hpp"
+#include <stdio.h>
+#include <string.h>
+
+/* Track the mean and maximum of one stage */
+struct StageSummary {
+    const char *name;
+    uint64_t total;
+    uint32_t max;
+};
+
+static void addSample(StageSummary& stage, uint32_t us) {
+    stage.total += us;
+    if (us > stage.max)
+        stage.max = us;
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage:\n./TelemetryDump <camN/telemetry.bin>\n");
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", argv[1]);
+        return 1;
+    }
+
+    /* Validate the header, records may grow in later versions so honour recordSize */
+    TelemetryHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TELEMETRY_MAGIC, sizeof(header.magic)) != 0
+        || header.recordSize < sizeof(TelemetryRecord)) {
+        fprintf(stderr, "%s is not a telemetry file\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    StageSummary stages[] = {{"acquire", 0, 0}, {"copy", 0, 0}, {"queue", 0, 0}, {"encode", 0, 0}, {"write", 0, 0}};
+    uint64_t records = 0, dropped = 0, failed = 0, skipped = 0, exposure = 0, missed = 0;
+    char record[header.recordSize];
+    printf("camera,frame,timestamp_ns,index,acquire_us,copy_us,queue_us,encode_us,write_us,size,gap,flags\n");
+    while (fread(record, header.recordSize, 1, file) == 1) {
+        TelemetryRecord r;
+        memcpy(&r, record, sizeof(r));
+        printf("%u,%lu,%lu,%lu,%u,%u,%u,%u,%u,%u,%u,0x%x\n", header.camera, r.frameNumber, r.timestamp, r.index,
+               r.acquireUs, r.copyUs, r.queueUs, r.encodeUs, r.writeUs, r.size, r.gap, r.flags);
+        records++;
+        missed += r.gap;
+        if (r.flags & (TELEMETRY_DROP_RING | TELEMETRY_DROP_BUFFER | TELEMETRY_DROP_QUEUE))
+            dropped++;
+        if (r.flags & TELEMETRY_FAILED)
+            failed++;
+        if (r.flags & TELEMETRY_SKIP_MOTION)
+            skipped++;
+        if (r.flags & TELEMETRY_SKIP_EXPOSURE)
+            exposure++;
+        addSample(stages[0], r.acquireUs);
+        addSample(stages[1], r.copyUs);
+        addSample(stages[2], r.queueUs);
+        addSample(stages[3], r.encodeUs);
+        addSample(stages[4], r.writeUs);
+    }
+    fclose(file);
+
+    fprintf(stderr, "Camera %u: %lu records, %lu dropped, %lu failed, %lu skipped unchanged, %lu skipped for exposure, "
+            "%lu sensor frames missed\n", header.camera, records, dropped, failed, skipped, exposure, missed);
+    for (uint32_t i = 0; i < sizeof(stages) / sizeof(stages[0]) && records > 0; i++)
+        fprintf(stderr, "  %-8s mean %8lu us  max %8u us\n", stages[i].name, stages[i].total / records, stages[i].max);
+    return 0;
+}